@@ -0,0 +1,716 @@
+#include "../include/tracer.hpp"
+#include "../include/util.hpp"
+#include "./workload.hpp"
+
+#ifdef WITH_HIGHLIGHT
+#include "../include/parser.hpp"
+#endif
+
+#ifdef WITH_STREAM_FILE
+#include "../include/file.hpp"
+#endif
+
+#ifdef WITH_STREAM_STTY
+#include "../include/stty.hpp"
+#endif
+
+#ifdef WITH_STREAM_TCP
+#include "../include/tcp_socket.hpp"
+#endif
+
+#include <algorithm>
+#include <malloc.h>
+
+/**
+	@file bench/bench.cpp
+
+	@brief libinstrument benchmark suite
+
+	Measures the hook overhead, symbol table loading, symbol lookups, trace
+	formatting, highlighting and stream output, with fixed iteration counts. The
+	results are written as a JSON document to the file given with -o (by
+	default, to the standard output):
+
+	@code
+	{
+	  "suite": "libinstrument",
+	  "version": "<major>.<minor>",
+	  "results": [
+	    {"name": "<benchmark>", <parameters>, "value": <value>, "unit": "<unit>"},
+	    ...
+	  ]
+	}
+	@endcode
+
+	Timed loops that are repeated report the median run. Diagnostics (e.g a
+	skipped benchmark) are printed on the standard error. With a results file,
+	the output of the library (e.g the symbol enumeration) doesn't end up in
+	the JSON document
+*/
+
+using namespace instrument;
+
+
+/**
+ * @brief Instrumented calls per hook overhead run (per thread)
+ */
+static const u32 g_hook_calls = 1000000;
+
+/**
+ * @brief Hook overhead thread pool sizes
+ */
+static const u32 g_hook_threads[] = {1, 8, 64};
+
+/**
+ * @brief Timed loop repetitions (the median is reported)
+ */
+static const u32 g_runs = 5;
+
+/**
+ * @brief Lookups per symbol lookup run
+ */
+static const u32 g_lookup_calls = 1000000;
+
+/**
+ * @brief Simulated call stack depths of the trace formatting runs
+ */
+static const u32 g_trace_depths[] = {4, 16, 64};
+
+/**
+ * @brief Traces (dumps) formatted per trace formatting run
+ */
+static const u32 g_trace_calls = 2000;
+
+/**
+ * @brief Highlighted text size
+ */
+static const u32 g_highlight_sz = 65536;
+
+/**
+ * @brief Highlight runs
+ */
+static const u32 g_highlight_calls = 100;
+
+/**
+ * @brief Stream payload size (per flush)
+ */
+static const u32 g_stream_payload_sz = 4096;
+
+/**
+ * @brief Flushes per stream run
+ */
+static const u32 g_stream_flushes = 4096;
+
+
+/**
+ * @brief Hook overhead job (per thread)
+ */
+struct hook_job {
+	pthread_barrier_t *barrier;						/**< @brief Start barrier (NULL to start at once) */
+
+	bool baseline;												/**< @brief true to call the uninstrumented leaf */
+
+	double ns;														/**< @brief Measured ns per call */
+};
+
+/**
+ * @brief Trace formatting job
+ */
+struct trace_job {
+	bool dump;														/**< @brief true to dump all threads */
+
+	string *dst;													/**< @brief Formatting buffer */
+
+	double us;														/**< @brief Measured us per trace */
+};
+
+/**
+ * @brief Stream consumer job
+ */
+struct drain_job {
+	i32 fd;																/**< @brief Source descriptor */
+
+	bool accept;													/**< @brief true if fd is a listening socket */
+};
+
+
+/**
+ * @brief Results file
+ */
+static FILE *s_out = NULL;
+
+/**
+ * @brief Whether a result was printed (JSON separators)
+ */
+static bool s_printed = false;
+
+/**
+ * @brief Keeps the results of the timed loops alive
+ */
+static volatile u64 s_sink = 0;
+
+
+/**
+ * @brief An uninstrumented function with the body of workload::leaf
+ *
+ * @param[in] val an input value
+ *
+ * @returns val + 1
+ */
+static __attribute((noinline)) u64 baseline_leaf(u64 val)
+{
+	__asm__ __volatile__("" : "+r" (val));
+	return val + 1;
+}
+
+
+/**
+ * @brief Get the time of a clock
+ *
+ * @param[in] clk the clock ID
+ *
+ * @returns the time in nanoseconds
+ */
+static u64 now(clockid_t clk = CLOCK_MONOTONIC)
+{
+	timespec ts;
+	clock_gettime(clk, &ts);
+	return static_cast<u64> (ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * @brief Get the allocated heap size
+ *
+ * @returns the allocated bytes
+ */
+static u64 heap_used()
+{
+#if defined __GLIBC__ && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	return mallinfo2().uordblks;
+#else
+	return static_cast<u32> (mallinfo().uordblks);
+#endif
+}
+
+
+/**
+ * @brief Get the median of a number of values
+ *
+ * @param[in,out] vals the values (sorted)
+ *
+ * @param[in] cnt the value count
+ *
+ * @returns the median
+ */
+static double median(double *vals, u32 cnt)
+{
+	std::sort(vals, vals + cnt);
+	return vals[cnt / 2];
+}
+
+
+/**
+ * @brief Print a result
+ *
+ * @param[in] name the benchmark name
+ *
+ * @param[in] params the benchmark parameters (JSON members followed by ", ")
+ *
+ * @param[in] val the result value
+ *
+ * @param[in] unit the result unit
+ */
+static void result(const i8 *name, const i8 *params, double val, const i8 *unit)
+{
+	fprintf(s_out, "%s\n    {\"name\": \"%s\", %s\"value\": %.3f, \"unit\": \"%s\"}",
+				 (likely(s_printed)) ? "," : "", name, params, val, unit);
+
+	s_printed = true;
+}
+
+
+/**
+ * @brief Run instrumented (or baseline) calls, measuring the thread CPU time
+ *
+ * @param[in,out] arg the hook job
+ *
+ * @returns NULL
+ *
+ * @note The thread is attached by a few calls before the start barrier
+ */
+static void* hook_worker(void *arg)
+{
+	hook_job *job = static_cast<hook_job*> (arg);
+	u64 (*leaf)(u64) = (likely(job->baseline)) ? baseline_leaf : workload::leaf;
+
+	u64 val = 0;
+	for (u32 i = 0; likely(i < 1000); i++) {
+		val = leaf(val);
+	}
+
+	if ( likely(job->barrier != NULL) ) {
+		pthread_barrier_wait(job->barrier);
+	}
+
+	u64 start = now(CLOCK_THREAD_CPUTIME_ID);
+	for (u32 i = 0; likely(i < g_hook_calls); i++) {
+		val = leaf(val);
+	}
+
+	job->ns = static_cast<double> (now(CLOCK_THREAD_CPUTIME_ID) - start) / g_hook_calls;
+	s_sink += val;
+	return NULL;
+}
+
+
+/**
+ * @brief Benchmark the hook overhead (ns per enter/exit pair)
+ *
+ * @note
+ *	The single-threaded runs use the main thread, the pool runs report the mean
+ *	of the threads. The baseline (uninstrumented) call cost is reported too
+ */
+static void bench_hooks()
+{
+	double runs[g_runs];
+
+	for (u32 i = 0; likely(i < 2); i++) {
+		bool baseline = (i == 0);
+
+		for (u32 j = 0; likely(j < g_runs); j++) {
+			hook_job job = {NULL, baseline, 0};
+			hook_worker(&job);
+			runs[j] = job.ns;
+		}
+
+		result((baseline) ? "hook.baseline" : "hook.pair", "\"threads\": 0, ", median(runs, g_runs), "ns");
+	}
+
+	for (u32 i = 0; likely(i < sizeof(g_hook_threads) / sizeof(u32)); i++) {
+		u32 cnt = g_hook_threads[i];
+		hook_job jobs[cnt];
+		pthread_t threads[cnt];
+		pthread_barrier_t barrier;
+
+		for (u32 j = 0; likely(j < g_runs); j++) {
+			pthread_barrier_init(&barrier, NULL, cnt);
+
+			for (u32 k = 0; likely(k < cnt); k++) {
+				jobs[k].barrier = &barrier;
+				jobs[k].baseline = false;
+				pthread_create(&threads[k], NULL, hook_worker, &jobs[k]);
+			}
+
+			double sum = 0;
+			for (u32 k = 0; likely(k < cnt); k++) {
+				pthread_join(threads[k], NULL);
+				sum += jobs[k].ns;
+			}
+
+			pthread_barrier_destroy(&barrier);
+			runs[j] = sum / cnt;
+		}
+
+		result("hook.pair", string("\"threads\": %u, ", cnt).cstring(), median(runs, g_runs), "ns");
+	}
+}
+
+
+/**
+ * @brief Find the path of libstdc++ (dl_iterate_phdr callback)
+ *
+ * @param[in] info the module info
+ *
+ * @param[in] sz the module info size
+ *
+ * @param[out] arg the path string
+ *
+ * @returns 1 if the module is libstdc++, 0 otherwise
+ */
+static i32 find_libstdcxx(dl_phdr_info *info, size_t sz, void *arg)
+{
+	if ( unlikely(strstr(info->dlpi_name, "libstdc++") == NULL) ) {
+		return 0;
+	}
+
+	static_cast<string*> (arg)->set("%s", info->dlpi_name);
+	return 1;
+}
+
+
+/**
+ * @brief Benchmark the construction of a symbol table
+ *
+ * @param[in] label the module label
+ *
+ * @param[in] path the module path
+ */
+static void bench_symtab(const i8 *label, const i8 *path)
+{
+	u64 heap = heap_used();
+	u64 start = now();
+
+	try {
+		symtab *table = new symtab(path);
+		double ms = static_cast<double> (now() - start) / 1000000;
+		u64 used = heap_used() - heap;
+		delete table;
+
+		string params("\"module\": \"%s\", ", label);
+		result("symtab.load", params.cstring(), ms, "ms");
+		result("symtab.memory", params.cstring(), static_cast<double> (used) / 1024, "KiB");
+	}
+	catch (exception &x) {
+		std::cerr << x;
+	}
+}
+
+
+/**
+ * @brief Benchmark the symbol lookups of the process
+ *
+ * @param[in] proc the process
+ *
+ * @note The lookups alternate between the workload functions
+ */
+static void bench_lookups(const process *proc)
+{
+	const mem_addr_t addrs[] = {
+		reinterpret_cast<mem_addr_t> (workload::leaf),
+		reinterpret_cast<mem_addr_t> (workload::descend)
+	};
+
+	u64 start = now();
+	for (u32 i = 0; likely(i < g_lookup_calls); i++) {
+		s_sink += reinterpret_cast<mem_addr_t> (proc->lookup(addrs[i & 1]));
+	}
+
+	result("process.lookup", "", static_cast<double> (now() - start) / g_lookup_calls, "ns");
+
+	start = now();
+	for (u32 i = 0; likely(i < g_lookup_calls); i++) {
+		mem_addr_t base;
+		s_sink += reinterpret_cast<mem_addr_t> (proc->inverse_lookup(addrs[i & 1], base));
+	}
+
+	result("process.inverse_lookup", "", static_cast<double> (now() - start) / g_lookup_calls, "ns");
+}
+
+
+/**
+ * @brief Format traces (or dumps) at the innermost workload call
+ *
+ * @param[in,out] arg the trace job
+ */
+static void trace_run(void *arg)
+{
+	trace_job *job = static_cast<trace_job*> (arg);
+	tracer *iface = tracer::interface();
+
+	u64 start = now();
+	for (u32 i = 0; likely(i < g_trace_calls); i++) {
+		job->dst->clear();
+
+		if ( likely(job->dump) ) {
+			iface->dump(*job->dst);
+		}
+		else {
+			iface->trace(*job->dst);
+		}
+	}
+
+	job->us = static_cast<double> (now() - start) / 1000 / g_trace_calls;
+}
+
+
+/**
+ * @brief Benchmark the trace and dump formatting at several call depths
+ *
+ * @param[out] text the trace of the deepest call stack
+ */
+static void bench_traces(string &text)
+{
+	for (u32 i = 0; likely(i < sizeof(g_trace_depths) / sizeof(u32)); i++) {
+		string params("\"depth\": %u, ", g_trace_depths[i]);
+
+		for (u32 j = 0; likely(j < 2); j++) {
+			trace_job job = {j == 1, &text, 0};
+			double runs[g_runs];
+
+			for (u32 k = 0; likely(k < g_runs); k++) {
+				workload::descend(g_trace_depths[i], trace_run, &job);
+				runs[k] = job.us;
+			}
+
+			result((job.dump) ? "tracer.dump" : "tracer.trace", params.cstring(), median(runs, g_runs), "us");
+		}
+	}
+
+	/* Leave the trace of the deepest call stack */
+	trace_job job = {false, &text, 0};
+	workload::descend(g_trace_depths[sizeof(g_trace_depths) / sizeof(u32) - 1], trace_run, &job);
+}
+
+
+#ifdef WITH_HIGHLIGHT
+/**
+ * @brief Benchmark the highlighting throughput
+ *
+ * @param[in] trace a trace, repeated to g_highlight_sz
+ */
+static void bench_highlight(const string &trace)
+{
+	const parser *def = parser::get_default();
+	if ( unlikely(def == NULL || trace.length() == 0) ) {
+		std::cerr << "highlight benchmark skipped (no default parser or trace)" << std::endl;
+		return;
+	}
+
+	parser p(*def);
+	p.clear();
+	while ( likely(p.length() < g_highlight_sz) ) {
+		p.append(trace);
+	}
+
+	string dst;
+	double runs[g_runs];
+	for (u32 i = 0; likely(i < g_runs); i++) {
+		u64 start = now();
+
+		for (u32 j = 0; likely(j < g_highlight_calls); j++) {
+			dst.clear();
+			p.highlight(dst);
+		}
+
+		runs[i] = static_cast<double> (p.length()) * g_highlight_calls * 1000 / (now() - start);
+	}
+
+	result("parser.highlight", "", median(runs, g_runs), "MB/s");
+}
+#endif
+
+
+#ifdef WITH_STREAM
+/**
+ * @brief Consume the output of a stream benchmark
+ *
+ * @param[in] arg the drain job
+ *
+ * @returns NULL
+ */
+static void* drain(void *arg)
+{
+	drain_job *job = static_cast<drain_job*> (arg);
+
+	i32 fd = job->fd;
+	if ( likely(job->accept) ) {
+		fd = accept(job->fd, NULL, NULL);
+	}
+
+	i8 buf[65536];
+	while ( likely(fd >= 0 && read(fd, buf, sizeof(buf)) > 0) ) {
+	}
+
+	if ( likely(job->accept && fd >= 0) ) {
+		::close(fd);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief Benchmark the flush throughput of a stream
+ *
+ * @param[in] type the stream type label
+ *
+ * @param[in,out] out the stream (closed)
+ *
+ * @param[in] async true to flush asynchronously
+ */
+static void bench_stream(const i8 *type, stream &out, bool async)
+{
+	string payload;
+	while ( likely(payload.length() < g_stream_payload_sz) ) {
+		payload.append('x');
+	}
+
+	try {
+		out.open();
+		out.set_async(async);
+
+		u64 start = now();
+		for (u32 i = 0; likely(i < g_stream_flushes); i++) {
+			out.append(payload);
+			out.flush();
+		}
+
+		out.close();
+		double mbs = static_cast<double> (g_stream_payload_sz) * g_stream_flushes * 1000 / (now() - start);
+
+		string params("\"type\": \"%s\", \"async\": %s, ", type, (async) ? "true" : "false");
+		result("stream.flush", params.cstring(), mbs, "MB/s");
+	}
+	catch (exception &x) {
+		std::cerr << x;
+	}
+}
+
+
+/**
+ * @brief Benchmark the flush throughput of each stream type
+ *
+ * @note
+ *	The file stream writes a temporary file, the serial stream a pseudoterminal
+ *	and the TCP stream a loopback connection, drained by a consumer thread
+ */
+static void bench_streams()
+{
+#ifdef WITH_STREAM_FILE
+	i8 path[] = "/tmp/instrument-bench-XXXXXX";
+	i32 fd = mkstemp(path);
+	if ( likely(fd >= 0) ) {
+		::close(fd);
+
+		for (u32 i = 0; likely(i < 2); i++) {
+			file out(path);
+			bench_stream("file", out, i == 1);
+		}
+
+		unlink(path);
+	}
+#endif
+
+#ifdef WITH_STREAM_STTY
+	i32 master = posix_openpt(O_RDWR | O_NOCTTY);
+	i32 slave = -1;
+	if ( likely(master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0) ) {
+		slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	}
+
+	if ( likely(slave >= 0) ) {
+		drain_job job = {master, false};
+		pthread_t consumer;
+		pthread_create(&consumer, NULL, drain, &job);
+
+		{
+			stty out(ptsname(master));
+			bench_stream("stty", out, false);
+		}
+
+		/* Reading the master fails once every slave descriptor is closed */
+		::close(slave);
+		pthread_join(consumer, NULL);
+	}
+
+	if ( likely(master >= 0) ) {
+		::close(master);
+	}
+#endif
+
+#ifdef WITH_STREAM_TCP
+	i32 listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ( likely(listener >= 0 &&
+							bind(listener, reinterpret_cast<sockaddr*> (&addr), sizeof(addr)) == 0 &&
+							listen(listener, 1) == 0 &&
+							getsockname(listener, reinterpret_cast<sockaddr*> (&addr), &len) == 0) ) {
+		drain_job job = {listener, true};
+		pthread_t consumer;
+		pthread_create(&consumer, NULL, drain, &job);
+
+		{
+			tcp_socket out("127.0.0.1", ntohs(addr.sin_port));
+			bench_stream("tcp", out, false);
+		}
+
+		/* Wakes the consumer up if it is still accepting (the connection failed) */
+		shutdown(listener, SHUT_RDWR);
+		pthread_join(consumer, NULL);
+	}
+
+	if ( likely(listener >= 0) ) {
+		::close(listener);
+	}
+#endif
+}
+#endif
+
+
+/**
+ * @brief Run the benchmark suite
+ *
+ * @param[in] argc the argument count
+ *
+ * @param[in] argv the arguments ([-o results file])
+ *
+ * @returns
+ *	EXIT_SUCCESS, or EXIT_FAILURE if the arguments are invalid, the results file
+ *	can't be opened or the tracer is not initialized
+ */
+int main(int argc, char *argv[])
+{
+	s_out = stdout;
+
+	if ( unlikely(argc == 3 && strcmp(argv[1], "-o") == 0) ) {
+		s_out = fopen(argv[2], "w");
+		if ( unlikely(s_out == NULL) ) {
+			std::cerr << "failed to open '" << argv[2] << "' (" << strerror(errno) << ")" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	else if ( unlikely(argc != 1) ) {
+		std::cerr << "usage: " << argv[0] << " [-o results file]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		std::cerr << "the tracer is not initialized (no symbols loaded?)" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	u16 major, minor;
+	util::version(&major, &minor);
+	fprintf(s_out, "{\n  \"suite\": \"libinstrument\",\n  \"version\": \"%u.%u\",\n  \"results\": [", major, minor);
+
+	bench_hooks();
+
+	const i8 *exe = util::executable_path();
+	bench_symtab("executable", exe);
+	delete[] exe;
+
+	string libstdcxx;
+	if ( likely(dl_iterate_phdr(find_libstdcxx, &libstdcxx) != 0) ) {
+		bench_symtab("libstdc++", libstdcxx.cstring());
+	}
+
+	bench_lookups(iface->proc());
+
+	string trace;
+	bench_traces(trace);
+
+#ifdef WITH_HIGHLIGHT
+	bench_highlight(trace);
+#endif
+
+#ifdef WITH_STREAM
+	bench_streams();
+#endif
+
+	fprintf(s_out, "\n  ]\n}\n");
+
+	if ( unlikely(s_out != stdout && fclose(s_out) != 0) ) {
+		std::cerr << "failed to write '" << argv[2] << "' (" << strerror(errno) << ")" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
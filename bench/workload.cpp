@@ -0,0 +1,47 @@
+#include "./workload.hpp"
+
+/**
+	@file bench/workload.cpp
+
+	@brief Class instrument::workload method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Nest instrumented calls, then run a callback at the innermost call
+ *
+ * @param[in] depth the remaining call depth
+ *
+ * @param[in] pfunc the callback (runs with depth + 1 simulated frames)
+ *
+ * @param[in] arg the callback argument
+ */
+void workload::descend(u32 depth, const callback_t pfunc, void *arg)
+{
+	if ( likely(depth > 0) ) {
+		descend(depth - 1, pfunc, arg);
+	}
+	else {
+		pfunc(arg);
+	}
+
+	/* Keep the call from being turned into a jump */
+	__asm__ __volatile__("" : : : "memory");
+}
+
+
+/**
+ * @brief An instrumented function with a trivial body
+ *
+ * @param[in] val an input value
+ *
+ * @returns val + 1
+ */
+__attribute((noinline)) u64 workload::leaf(u64 val)
+{
+	__asm__ __volatile__("" : "+r" (val));
+	return val + 1;
+}
+
+}
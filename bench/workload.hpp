@@ -0,0 +1,37 @@
+#ifndef _WORKLOAD
+#define _WORKLOAD 1
+
+/**
+	@file bench/workload.hpp
+
+	@brief Class instrument::workload definition
+*/
+
+#include "../include/object.hpp"
+
+namespace instrument {
+
+/**
+	@brief Instrumented benchmark workload
+
+	The workload is the only code of the benchmark suite compiled with
+	-finstrument-functions, so the harness measures the hooks of the workload
+	calls only
+*/
+class workload: virtual public object
+{
+public:
+
+	typedef void (*callback_t)(void*);
+
+
+	/* Static methods */
+
+	static void descend(u32, const callback_t, void*);
+
+	static u64 leaf(u64);
+};
+
+}
+
+#endif
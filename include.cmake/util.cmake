@@ -53,6 +53,75 @@ FUNCTION(LIST_FILES GLOB_EXPRESSION RETVAL)
 ENDFUNCTION(LIST_FILES)
 
 
+# Embed dictionary files in a header, as word tables named after the files
+
+FUNCTION(EMBED_DICTIONARIES TO_FILE)
+
+	SET(CONTENT "#ifndef _CONFIG_DICTIONARIES\n#define _CONFIG_DICTIONARIES 1\n\n")
+
+	STRING(APPEND CONTENT "/**\n\t@file include/config_dictionaries.hpp\n\n")
+
+	STRING(APPEND CONTENT "\t@brief Embedded dictionaries (generated from the etc dictionary files, do not edit)\n*/\n\n\n")
+
+	STRING(APPEND CONTENT "namespace instrument {\n")
+
+	FOREACH(DICT ${ARGN})
+
+		GET_FILENAME_COMPONENT(NAME ${DICT} NAME_WE)
+
+		STRING(MAKE_C_IDENTIFIER ${NAME} ID)
+
+		FILE(STRINGS ${DICT} LINES)
+
+		STRING(APPEND CONTENT "\n/**\n\t@brief Embedded '${NAME}' dictionary words\n\n")
+
+		STRING(APPEND CONTENT "\t@see parser::add_default_dictionary\n*/\n")
+
+		STRING(APPEND CONTENT "static const i8 *const g_dict_${ID}[] = {\n")
+
+		SET(CNT 0)
+
+		FOREACH(LINE ${LINES})
+
+			STRING(STRIP "${LINE}" WORD)
+
+			IF(NOT WORD STREQUAL "")
+
+				STRING(REPLACE "\\" "\\\\" WORD "${WORD}")
+
+				STRING(REPLACE "\"" "\\\"" WORD "${WORD}")
+
+				STRING(APPEND CONTENT "\t\"${WORD}\",\n")
+
+				MATH(EXPR CNT "${CNT} + 1")
+
+			ENDIF(NOT WORD STREQUAL "")
+
+		ENDFOREACH(LINE)
+
+		STRING(APPEND CONTENT "};\n\n")
+
+		STRING(APPEND CONTENT "/**\n\t@brief Embedded '${NAME}' dictionary word count\n\n")
+
+		STRING(APPEND CONTENT "\t@see parser::add_default_dictionary\n*/\n")
+
+		STRING(APPEND CONTENT "static const u32 g_dict_${ID}_cnt = ${CNT};\n")
+
+	ENDFOREACH(DICT)
+
+	STRING(APPEND CONTENT "\n}\n\n#endif\n")
+
+	# The header is replaced only if the words changed
+
+	FILE(WRITE ${TO_FILE}.tmp "${CONTENT}")
+
+	CONFIGURE_FILE(${TO_FILE}.tmp ${TO_FILE} COPYONLY)
+
+	FILE(REMOVE ${TO_FILE}.tmp)
+
+ENDFUNCTION(EMBED_DICTIONARIES)
+
+
 # Store variable listing to a file
 
 FUNCTION(LIST_VARIABLES TO_FILE)
@@ -13,6 +13,9 @@ namespace instrument {
 
 /**
 	@brief This class represents a program/library runtime function call
+
+	The call stack is simulated with plain frames (frame_t), a call is a view of
+	a frame for the public API
 */
 class call: virtual public symbol
 {
@@ -28,6 +31,8 @@ public:
 
 	call(mem_addr_t, mem_addr_t, const i8* = NULL);
 
+	explicit call(const frame_t&, const i8* = NULL);
+
 	call(const call&);
 
 	virtual ~call();
@@ -37,6 +42,8 @@ public:
 
 	/* Accessor methods */
 
+	virtual frame_t frame() const;
+
 	virtual mem_addr_t site() const;
 
 
@@ -0,0 +1,177 @@
+#ifndef _CALLGRAPH
+#define _CALLGRAPH 1
+
+/**
+	@file include/callgraph.hpp
+
+	@brief Class instrument::callgraph definition
+*/
+
+#include "./list.hpp"
+#include "./registry.hpp"
+
+namespace instrument {
+
+/**
+	@brief Aggregated call graph (call counts per stack path)
+
+	When enabled (callgraph::enable), each simulated call and return (see
+	thread::called and thread::returned) moves a cursor in a prefix tree of the
+	current thread, keyed by function address. Each tree node is a distinct
+	stack path and counts the calls that reached it, the caller to callee edges
+	are the parent to child links. Each thread only writes its own tree, without
+	locking, and the nodes are allocated in chunks.
+
+	The trees of all threads are merged at export time and each distinct
+	function is symbolized once (process::lookup), in a single pass. The graph
+	can be exported as folded stacks (callgraph::folded, for flame graphs), as an
+	uncompressed pprof protobuf profile (callgraph::pprof) or as a caller to
+	callee edge list (callgraph::edges). The values are call counts, the trees
+	live until the process exits
+*/
+class callgraph: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Prefix tree node (a stack path)
+	*/
+	struct node {
+		mem_addr_t fn;										/**< @brief Function address (0 for the root) */
+
+		u64 calls;												/**< @brief Calls that reached the path */
+
+		node *parent;											/**< @brief Caller path */
+
+		node *child;											/**< @brief First callee path */
+
+		node *sibling;										/**< @brief Next sibling (same caller) path */
+	};
+
+
+	/**
+		@brief Node allocation chunk
+	*/
+	struct chunk {
+		node nodes[g_callgraph_chunk_sz];	/**< @brief Nodes */
+
+		chunk *next;											/**< @brief Previously allocated chunk */
+	};
+
+
+	/**
+		@brief Prefix tree (of a thread or merged)
+	*/
+	struct tree {
+		node root;												/**< @brief Root (empty) path */
+
+		node *cursor;											/**< @brief Current path */
+
+		node **index;											/**< @brief Open addressing (parent, function) index */
+
+		u32 slots;												/**< @brief Index slot count (power of 2) */
+
+		u32 used;													/**< @brief Node count */
+
+		chunk *chunks;										/**< @brief Node chunks (last first) */
+
+		u32 free;													/**< @brief Free nodes in the last chunk */
+
+		u32 generation;										/**< @brief Enabling generation of the cursor */
+
+		tree *next;												/**< @brief Next thread tree */
+	};
+
+
+	/**
+		@brief Symbolized function (export time)
+	*/
+	struct function {
+		mem_addr_t fn;										/**< @brief Function address */
+
+		const i8 *name;										/**< @brief Demangled name (NULL if unresolved) */
+
+		u32 id;														/**< @brief Export ID (1 based) */
+	};
+
+
+	/**
+		@brief Caller to callee edge (export time)
+	*/
+	struct edge {
+		mem_addr_t caller;								/**< @brief Caller address */
+
+		mem_addr_t callee;								/**< @brief Callee address */
+
+		u64 calls;												/**< @brief Call count */
+	};
+
+
+	/* Protected static variables */
+
+	static __thread tree *s_tree;				/**< @brief Current thread tree (TLS) */
+
+	static tree *s_trees;								/**< @brief All thread trees */
+
+	static bool s_enabled;							/**< @brief True if calls are aggregated */
+
+	static u32 s_generation;						/**< @brief Enabling generation */
+
+
+	/* Protected static methods */
+
+	static tree* alloc();
+
+	static i32 by_edge(const edge*, const edge*);
+
+	static node* child(tree*, node*, mem_addr_t);
+
+	static void dispose(tree*);
+
+	static u32 hash(const node*, mem_addr_t);
+
+	static tree* merge();
+
+	static string& name(string&, const function*);
+
+	static void pb_bytes(string&, u32, const string&);
+
+	static void pb_varint(string&, u64);
+
+	static function* symbolize(list<function>&, registry<mem_addr_t, function>&,
+															mem_addr_t);
+
+	static void symbolize(tree*, list<function>&,
+												registry<mem_addr_t, function>&);
+
+public:
+
+	/* Static methods */
+
+	static void called(mem_addr_t);
+
+	static void disable();
+
+	static void enable();
+
+	static bool is_enabled();
+
+	static void returned();
+
+	static void rewind();
+
+
+	/* Export methods */
+
+	static string& edges(string&);
+
+	static string& folded(string&);
+
+	static string& pprof(string&);
+};
+
+}
+
+#endif
@@ -23,7 +23,10 @@ namespace instrument {
 	with a NULL or a duplicate (within the chain) data pointer. A node can be
 	detached (unlink and dispose the node without deleting its data) or removed
 	(unlink/dispose both node and data). A chain can be traversed using callbacks
-	and method chain::each
+	and method chain::each, or with a cursor (chain::first, chain::last). Each
+	cursor step is a single node hop, whereas chain::at walks from the nearest
+	end, so loops over chain::at are quadratic. Similarly, adding a node checks
+	for duplicates, unless the caller guarantees a new data pointer
 
 	@see instrument::node
 */
@@ -54,6 +57,49 @@ public:
 	typedef void (*callback_t)(u32, T*);
 
 
+	/**
+		@brief Chain traversal position (in either direction)
+
+		A cursor keeps the current node and its neighbour towards the head, so it
+		steps XOR links both ways. Once it steps past either end it is no longer
+		valid. Modifying the chain invalidates its cursors
+	*/
+	class cursor
+	{
+	protected:
+
+		/* Protected variables */
+
+		const node<T> *m_prev;					/**< @brief Neighbour towards the head */
+
+		const node<T> *m_cur;						/**< @brief Current node (NULL past the ends) */
+
+		u32 m_index;										/**< @brief Current node offset */
+
+	public:
+
+		/* Constructors */
+
+		explicit cursor(const node<T>* = NULL, const node<T>* = NULL, u32 = 0);
+
+
+		/* Accessor methods */
+
+		T* data() const;
+
+		u32 index() const;
+
+		bool is_valid() const;
+
+
+		/* Generic methods */
+
+		cursor& next();
+
+		cursor& prev();
+	};
+
+
 	/* Constructors, copy constructors and destructor */
 
 	chain();
@@ -79,7 +125,7 @@ public:
 
 	/* Generic methods */
 
-	virtual chain& add(T*);
+	virtual chain& add(T*, bool = false);
 
 	virtual T* at(u32) const;
 
@@ -91,6 +137,10 @@ public:
 
 	virtual chain& each(const callback_t) const;
 
+	virtual cursor first() const;
+
+	virtual cursor last() const;
+
 	virtual chain& remove(u32);
 
 	virtual i32 search(const T*) const;
@@ -329,7 +379,7 @@ chain<T>& chain<T>::operator=(const chain &rval)
 
 		try {
 			copy = new T(*cur->m_data);
-			add(copy);
+			add(copy, true);
 		}
 		catch (...) {
 			delete copy;
@@ -366,20 +416,24 @@ inline T* chain<T>::operator[](u32 i) const
  *
  * @param[in] d the new node data pointer
  *
+ * @param[in] unique
+ *	true if the caller guarantees that the data pointer is not in the chain, to
+ *	skip the (linear) duplicate check
+ *
  * @returns *this
  *
  * @throws std::bad_alloc
  * @throws instrument::exception
  */
 template <class T>
-chain<T>& chain<T>::add(T *d)
+chain<T>& chain<T>::add(T *d, bool unique)
 {
 	if ( unlikely(d == NULL) ) {
 		throw exception("invalid argument: d (=%p)", d);
 	}
 
 	/* If the data pointer already exists in the chain */
-	if ( unlikely(node_with(d) != NULL) ) {
+	if ( unlikely(!unique && node_with(d) != NULL) ) {
 		throw exception("chain @ %p already has a node with data @ %p", this, d);
 	}
 
@@ -510,6 +564,34 @@ chain<T>& chain<T>::each(const callback_t pfunc) const
 }
 
 
+/**
+ * @brief Get a cursor at the chain head
+ *
+ * @returns the cursor (not valid if the chain is empty)
+ */
+template <class T>
+inline typename chain<T>::cursor chain<T>::first() const
+{
+	return cursor(NULL, m_head, 0);
+}
+
+
+/**
+ * @brief Get a cursor at the chain tail
+ *
+ * @returns the cursor (not valid if the chain is empty)
+ */
+template <class T>
+inline typename chain<T>::cursor chain<T>::last() const
+{
+	if ( unlikely(m_tail == NULL) ) {
+		return cursor();
+	}
+
+	return cursor(m_tail->link(), m_tail, m_count - 1);
+}
+
+
 /**
  * @brief Dispose the node (and its data) at a chain offset
  *
@@ -558,6 +640,102 @@ i32 chain<T>::search(const T *d) const
 	return -1;
 }
 
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] prev the neighbour of the node towards the head (NULL at the head)
+ *
+ * @param[in] cur the node (NULL for an invalid cursor)
+ *
+ * @param[in] i the node offset
+ */
+template <class T>
+inline chain<T>::cursor::cursor(const node<T> *prev, const node<T> *cur, u32 i):
+m_prev(prev),
+m_cur(cur),
+m_index(i)
+{
+}
+
+
+/**
+ * @brief Get the current node data pointer
+ *
+ * @returns the data pointer (NULL if the cursor is not valid)
+ */
+template <class T>
+inline T* chain<T>::cursor::data() const
+{
+	return (likely(m_cur != NULL)) ? m_cur->m_data : NULL;
+}
+
+
+/**
+ * @brief Get the current node offset
+ *
+ * @returns this->m_index
+ */
+template <class T>
+inline u32 chain<T>::cursor::index() const
+{
+	return m_index;
+}
+
+
+/**
+ * @brief Check if the cursor is at a node
+ *
+ * @returns true if it is at a node, false if it stepped past either end
+ */
+template <class T>
+inline bool chain<T>::cursor::is_valid() const
+{
+	return m_cur != NULL;
+}
+
+
+/**
+ * @brief Step towards the tail
+ *
+ * @returns *this
+ *
+ * @note NO-OP if the cursor is not valid
+ */
+template <class T>
+inline typename chain<T>::cursor& chain<T>::cursor::next()
+{
+	if ( likely(m_cur != NULL) ) {
+		const node<T> *next = m_cur->link(m_prev);
+		m_prev = m_cur;
+		m_cur = next;
+		m_index++;
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Step towards the head
+ *
+ * @returns *this
+ *
+ * @note NO-OP if the cursor is not valid
+ */
+template <class T>
+inline typename chain<T>::cursor& chain<T>::cursor::prev()
+{
+	if ( likely(m_cur != NULL) ) {
+		const node<T> *prev = (likely(m_prev != NULL)) ? m_prev->link(m_cur) : NULL;
+		m_cur = m_prev;
+		m_prev = prev;
+		m_index--;
+	}
+
+	return *this;
+}
+
 }
 
 #endif
@@ -0,0 +1,138 @@
+#ifndef _COMPRESSOR
+#define _COMPRESSOR 1
+
+/**
+	@file include/compressor.hpp
+
+	@brief Class instrument::compressor definition
+*/
+
+#include "./exception.hpp"
+
+namespace instrument {
+
+/**
+	@brief Frame based, streaming LZ4 or zstd compressor (for output streams)
+
+	A compressor turns a byte stream into a single standard LZ4 or zstd frame,
+	readable by the lz4(1) and zstd(1) tools or by any decompressor of the
+	respective library. LZ4 is fast, zstd is dense, the level selects the
+	trade-off within each codec (0 for the codec default). Data is compressed as
+	it's fed, the compressor keeps the frame history, so the signatures and the
+	headers repeated all over a trace are encoded as back references.
+
+	A compressed block is emitted every block size bytes of input and whenever
+	the compressor is flushed, so a reader can decompress everything fed so far
+	without waiting for the end of the frame. The compressed output accumulates
+	in a buffer (see compressor::data) until it's cleared. A frame is started by
+	the first compress and ended by compressor::finish, compressor::reset
+	abandons it (e.g the connection it was sent over is lost). This class is not
+	thread safe
+
+	@see stream::set_compression
+*/
+class compressor: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Growable byte buffer
+	*/
+	struct buffer {
+		i8 *data;												/**< @brief Buffer data */
+
+		u32 size;												/**< @brief Used size */
+
+		u32 slots;											/**< @brief Allocated size */
+	};
+
+
+	/* Protected variables */
+
+	u32 m_codec;												/**< @brief Codec (LZ4 or ZSTD) */
+
+	i32 m_level;												/**< @brief Compression level (0 for default) */
+
+	u32 m_block;												/**< @brief Input bytes per compressed block */
+
+	void *m_context;										/**< @brief Codec compression context */
+
+	buffer m_out;												/**< @brief Compressed output */
+
+	u32 m_unflushed;										/**< @brief Input bytes since the last block */
+
+	bool m_framing;											/**< @brief Frame started, not yet finished */
+
+
+	/* Protected copy constructors */
+
+	compressor(const compressor&)										__attribute((noreturn));
+
+	virtual compressor* clone() const								__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual compressor& operator=(const compressor&)	__attribute((noreturn));
+
+
+	/* Protected generic methods */
+
+	virtual compressor& begin();
+
+	virtual compressor& reserve(u32);
+
+	virtual compressor& update(const i8*, u32, u32);
+
+public:
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit compressor(u32, i32 = 0, u32 = g_stream_block_sz);
+
+	virtual ~compressor();
+
+
+	/* Accessor methods */
+
+	virtual u32 block() const;
+
+	virtual u32 codec() const;
+
+	virtual const i8* data() const;
+
+	virtual i32 level() const;
+
+	virtual u32 size() const;
+
+
+	/* Generic methods */
+
+	virtual compressor& clear();
+
+	virtual compressor& compress(const i8*, u32);
+
+	virtual compressor& finish();
+
+	virtual compressor& flush();
+
+	virtual compressor& reset();
+
+
+	/* Public static variables */
+
+	/**
+		@brief Compression codecs
+	*/
+	static const enum {
+
+		NONE				= 0x00,		LZ4					= 0x01,		ZSTD				= 0x02
+
+	} codecs;
+};
+
+}
+
+#endif
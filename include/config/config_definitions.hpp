@@ -55,6 +55,202 @@ namespace instrument {
 #define THREAD_EXIT							0x08
 
 
+/*
+	Tracer initialization states
+*/
+
+/**
+	@brief Tracer not initialized (library not loaded or no symbols available)
+*/
+#define TRACER_UNINITIALIZED		0x00
+
+/**
+	@brief Tracer loading the symbol tables (library constructor running)
+*/
+#define TRACER_LOADING					0x01
+
+/**
+	@brief Tracer ready to simulate call stacks
+*/
+#define TRACER_READY						0x02
+
+/**
+	@brief Tracer shutting down (library destructor running or finished)
+*/
+#define TRACER_SHUTDOWN					0x04
+
+
+/*
+	Symbol table loading modes
+*/
+
+/**
+	@brief Load the symbol tables in the library constructor
+*/
+#define SYMTAB_EAGER						0x00
+
+/**
+	@brief Load each symbol table upon the first lookup in its module
+*/
+#define SYMTAB_LAZY							0x01
+
+/**
+	@brief Load the symbol tables on a background thread (lazy until loaded)
+*/
+#define SYMTAB_BACKGROUND				0x02
+
+
+/*
+	Sampling modes
+*/
+
+/**
+	@brief Simulate every call (no sampling)
+*/
+#define SAMPLING_OFF						0x00
+
+/**
+	@brief Simulate 1 out of N calls of each function
+*/
+#define SAMPLING_CALLS					0x01
+
+/**
+	@brief Snapshot the simulated call stacks periodically, on a sampler thread
+*/
+#define SAMPLING_TIMER					0x02
+
+
+/*
+	Flight recorder event kinds
+*/
+
+/**
+	@brief Function entry (see record_t)
+*/
+#define RECORD_ENTER						0x00
+
+/**
+	@brief Function exit (see record_t)
+*/
+#define RECORD_EXIT							0x01
+
+
+/*
+	Execution context states (see instrument::context)
+*/
+
+/**
+	@brief Context suspended (its stack is not running on any thread)
+*/
+#define CONTEXT_SUSPENDED				0x00
+
+/**
+	@brief Context running on a thread
+*/
+#define CONTEXT_ACTIVE					0x01
+
+/**
+	@brief Suspended context pinned by a reader (its frames are being copied)
+*/
+#define CONTEXT_PINNED					0x02
+
+
+/*
+	Hook variant features (see tracer::select_hooks)
+*/
+
+/**
+	@brief Evaluate the instrumentation filters
+*/
+#define HOOK_FILTERS						0x01
+
+/**
+	@brief Dispatch the plugins
+*/
+#define HOOK_PLUGINS						0x02
+
+/**
+	@brief Feed the flight recorders
+*/
+#define HOOK_RECORDING					0x04
+
+/**
+	@brief Hook variant count (every feature combination)
+*/
+#define HOOK_VARIANTS						0x08
+
+
+/*
+	Self-metrics counters (see instrument::metrics)
+*/
+
+#ifdef WITH_METRICS
+
+/**
+	@brief Instrumentation hook invocations (function entries and exits)
+*/
+#define METRIC_HOOKS						0
+
+/**
+	@brief Contended lock acquisitions (tracer, process, thread and filter locks)
+*/
+#define METRIC_LOCK_CONTENDED		1
+
+/**
+	@brief Time spent waiting for contended locks (in nanoseconds)
+*/
+#define METRIC_LOCK_WAIT				2
+
+/**
+	@brief Simulated call stack frames allocated
+*/
+#define METRIC_FRAMES						3
+
+/**
+	@brief Symbol name lookups (see process::lookup)
+*/
+#define METRIC_LOOKUPS					4
+
+/**
+	@brief Symbol name lookups served by the name cache
+*/
+#define METRIC_LOOKUP_HITS			5
+
+/**
+	@brief Source line resolutions (see symtab::addr2line, cached lines excluded)
+*/
+#define METRIC_ADDR2LINE				6
+
+/**
+	@brief Bytes written by the output streams
+*/
+#define METRIC_STREAM_BYTES			7
+
+/**
+	@brief Plugin callback invocations
+*/
+#define METRIC_PLUGIN_CALLS			8
+
+/**
+	@brief Filter evaluations (filter verdict cache misses)
+*/
+#define METRIC_FILTER_EVALS			9
+
+/**
+	@brief
+		Dropped events (hook invocations before the tracer is ready and flight
+		recorder events overwritten before they were drained)
+*/
+#define METRIC_DROPPED					10
+
+/**
+	@brief Self-metrics counter count
+*/
+#define METRIC_COUNT						11
+
+#endif
+
+
 /*
 	Property token validation
 */
@@ -0,0 +1,166 @@
+#ifndef _CONFIG_DICTIONARIES
+#define _CONFIG_DICTIONARIES 1
+
+/**
+	@file include/config_dictionaries.hpp
+
+	@brief Embedded dictionaries (generated from the etc dictionary files, do not edit)
+*/
+
+
+namespace instrument {
+
+/**
+	@brief Embedded 'extensions' dictionary words
+
+	@see parser::add_default_dictionary
+*/
+static const i8 *const g_dict_extensions[] = {
+	"\\.c$",
+	"\\.cc$",
+	"\\.cp$",
+	"\\.cpp$",
+	"\\.cxx$",
+	"\\.c++$",
+	"\\.h$",
+	"\\.hh$",
+	"\\.hp$",
+	"\\.hpp",
+	"\\.hxx$",
+	"\\.h++$",
+	"\\.i$",
+	"\\.ii$",
+	"\\.ip$",
+	"\\.ipp$",
+	"\\.ixx$",
+	"\\.i++$",
+	"\\.inl$",
+	"\\.tcc$",
+	"\\.s$",
+	"\\.sx$",
+};
+
+/**
+	@brief Embedded 'extensions' dictionary word count
+
+	@see parser::add_default_dictionary
+*/
+static const u32 g_dict_extensions_cnt = 22;
+
+/**
+	@brief Embedded 'keywords' dictionary words
+
+	@see parser::add_default_dictionary
+*/
+static const i8 *const g_dict_keywords[] = {
+	"alignas",
+	"alignof",
+	"and",
+	"and_eq",
+	"asm",
+	"auto",
+	"bitand",
+	"bitor",
+	"break",
+	"case",
+	"catch",
+	"class",
+	"compl",
+	"const",
+	"constexpr",
+	"const_cast",
+	"continue",
+	"decltype",
+	"default",
+	"delete",
+	"do",
+	"dynamic_cast",
+	"else",
+	"enum",
+	"explicit",
+	"export",
+	"extern",
+	"false",
+	"for",
+	"friend",
+	"goto",
+	"if",
+	"inline",
+	"mutable",
+	"namespace",
+	"new",
+	"noexcept",
+	"not",
+	"not_eq",
+	"nullptr",
+	"operator",
+	"or",
+	"or_eq",
+	"private",
+	"protected",
+	"public",
+	"register",
+	"reinterpret_cast",
+	"return",
+	"sizeof",
+	"static",
+	"static_assert",
+	"static_cast",
+	"struct",
+	"switch",
+	"template",
+	"this",
+	"thread_local",
+	"throw",
+	"true",
+	"try",
+	"typedef",
+	"typeid",
+	"typename",
+	"union",
+	"using",
+	"virtual",
+	"volatile",
+	"while",
+	"xor",
+	"xor_eq",
+};
+
+/**
+	@brief Embedded 'keywords' dictionary word count
+
+	@see parser::add_default_dictionary
+*/
+static const u32 g_dict_keywords_cnt = 71;
+
+/**
+	@brief Embedded 'types' dictionary words
+
+	@see parser::add_default_dictionary
+*/
+static const i8 *const g_dict_types[] = {
+	"bool",
+	"char",
+	"char16_t",
+	"char32_t",
+	"double",
+	"float",
+	"int",
+	"long",
+	"short",
+	"signed",
+	"unsigned",
+	"void",
+	"wchar_t",
+};
+
+/**
+	@brief Embedded 'types' dictionary word count
+
+	@see parser::add_default_dictionary
+*/
+static const u32 g_dict_types_cnt = 13;
+
+}
+
+#endif
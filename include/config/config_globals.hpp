@@ -10,6 +10,25 @@
 
 namespace instrument {
 
+/**
+	@brief Symbol index cache directory shell variable
+
+	@see symtab::load_index
+*/
+static const i8 g_cache_env[] = "INSTRUMENT_CACHE";
+
+/**
+	@brief Cache line size (for padding data shared between threads)
+*/
+static const u32 g_cacheline_sz = 64;
+
+/**
+	@brief Call graph nodes per allocation chunk
+
+	@see callgraph::child
+*/
+static const u32 g_callgraph_chunk_sz = 256;
+
 /**
 	@brief Supported instrument::string codepages
 
@@ -23,6 +42,161 @@ static const codepage_t g_codepages[] = {
 
 };
 
+/**
+	@brief
+		Control block shell variable ('on' for g_control_path, 'off' or a control
+		block file path)
+
+	@see control::attach
+*/
+static const i8 g_control_env[] = "INSTRUMENT_CONTROL";
+
+/**
+	@brief Control block magic number ('ICB1', little endian)
+
+	@see instrument::control
+*/
+static const u32 g_control_magic = 0x31424349;
+
+/**
+	@brief Default control block file path (formatted with the process ID)
+
+	@see control::attach
+*/
+static const i8 g_control_path[] = "/dev/shm/libinstrument.%d";
+
+/**
+	@brief Control block layout version
+
+	@see instrument::control
+*/
+static const u32 g_control_version = 1;
+
+/**
+	@brief Crash dump buffer size (preallocated, flushed when full)
+
+	@see crash::install
+*/
+static const u32 g_crash_buffer_sz = 65536;
+
+/**
+	@brief Crash dump shell variable (dump file path or 'stderr')
+
+	@see tracer::crash_path
+*/
+static const i8 g_crash_env[] = "INSTRUMENT_CRASH";
+
+/**
+	@brief Signals that produce a crash dump
+
+	@see crash::install
+*/
+static const i32 g_crash_signals[] = {
+
+	SIGSEGV,
+
+	SIGBUS,
+
+	SIGFPE,
+
+	SIGILL,
+
+	SIGABRT
+
+};
+
+/**
+	@brief Crash handler alternate stack size (for stack overflows)
+
+	@see crash::install
+*/
+static const u32 g_crash_stack_sz = 65536;
+
+/**
+	@brief
+		Exception trace deduplication shell variable ('on' or the window in
+		milliseconds)
+
+	@see tracer::dedup_window
+*/
+static const i8 g_dedup_env[] = "INSTRUMENT_DEDUP";
+
+/**
+	@brief Recent exception trace signature sets (power of 2)
+
+	@see tracer::deduplicate
+*/
+static const u32 g_dedup_sets = 64;
+
+/**
+	@brief Default exception trace deduplication window (in milliseconds)
+
+	@see tracer::dedup_window
+*/
+static const u32 g_dedup_window = 1000;
+
+/**
+	@brief Recent exception trace signatures per set (least recently used replaced)
+
+	@see tracer::deduplicate
+*/
+static const u32 g_dedup_ways = 4;
+
+/**
+	@brief
+		Simulated call stack depth shell variable (the maximum stored frames per
+		thread or 'off')
+
+	@see tracer::depth_limit
+*/
+static const i8 g_depth_env[] = "INSTRUMENT_MAX_DEPTH";
+
+/**
+	@brief Recursion folding shell variable ('on' or 'off')
+
+	@see tracer::folding_mode
+*/
+static const i8 g_fold_env[] = "INSTRUMENT_FOLD";
+
+/**
+	@brief Frames per shadow stack chunk (power of 2)
+
+	@see shadow_stack::grow
+*/
+static const u32 g_frame_chunk_sz = 256;
+
+/**
+	@brief Binary IDP (Instrumentation Data Protocol) v2 preamble
+
+	@see encoder::header
+*/
+static const i8 g_idp_magic[] = "IDP2";
+
+/**
+	@brief Binary IDP (Instrumentation Data Protocol) version
+
+	@see encoder::header
+*/
+static const u32 g_idp_version = 2;
+
+/**
+	@brief
+		Latency histogram range, the magnitude (log2) of the largest distinct
+		value (in ticks, larger values share the last bucket)
+
+	@see latency::bucket
+*/
+static const u32 g_latency_range_bits = 48;
+
+/**
+	@brief
+		Latency histogram precision, the linear sub-buckets per power of 2 (log2,
+		for a relative error of at most 1 / 2^N)
+
+	@see latency::bucket
+*/
+static const u32 g_latency_sub_bits = 4;
+
 /**
 	@brief DSO filtering shell variable
 
@@ -30,11 +204,36 @@ static const codepage_t g_codepages[] = {
 */
 static const i8 g_libs_env[] = "INSTRUMENT_LIBS";
 
+/**
+	@brief
+		Symbol table loader pool size shell variable (default: the online
+		processor count)
+
+	@see tracer::loader_count
+*/
+static const i8 g_loaders_env[] = "INSTRUMENT_LOADERS";
+
+/**
+	@brief Maximum symbol table loader pool size
+
+	@see tracer::loader_count
+*/
+static const u32 g_loaders_max = 64;
+
 /**
 	@brief Library version major
 */
 static const u16 g_major = 1;
 
+/**
+	@brief
+		Memory kernel shell variable (scalar, sse2, avx2 or neon, default: the
+		fastest kernel the processor supports)
+
+	@see util::dispatch
+*/
+static const i8 g_mem_kernel_env[] = "INSTRUMENT_MEMKERNEL";
+
 /**
 	@brief Block size (allocation alignment)
 
@@ -47,6 +246,52 @@ static const u16 g_memblock_sz = 64;
 */
 static const u16 g_minor = 0;
 
+/**
+	@brief Initial slot count of the process symbol name cache (by address)
+
+	@see process::lookup
+*/
+static const u32 g_name_cache_sz = 1024;
+
+/**
+	@brief
+		Hot-patching shell variable ('on' to patch the hook calls of filtered out
+		functions into NOPs)
+
+	@see tracer::patching_mode
+*/
+static const i8 g_patch_env[] = "INSTRUMENT_PATCH";
+
+/**
+	@brief Maximum number of cached compiled regular expressions
+
+	@see pattern::cached
+*/
+static const u32 g_pattern_cache_sz = 256;
+
+/**
+	@brief
+		Plugin snapshot reclamation attempts (yields) per reader stripe, before
+		the reclamation is deferred
+
+	@see tracer::reclaim_plugins
+*/
+static const u32 g_plugin_grace_sz = 1024;
+
+/**
+	@brief Plugin snapshot reader stripes (power of 2)
+
+	@see tracer::begin_plugins
+*/
+static const u32 g_plugin_stripes = 16;
+
+/**
+	@brief Hardware performance counters per thread group
+
+	@see pmu::open
+*/
+static const u32 g_pmu_counters = 4;
+
 /**
 	@brief Preallocation block size
 
@@ -64,6 +309,166 @@ static const i8 g_prefix[] = "/usr/local";
 */
 static const i8 g_properties_path[] = "share/libinstrument/instrument.properties";
 
+/**
+	@brief Flight recorder records per thread, included in tracer::dump
+
+	@see tracer::dump
+*/
+static const u32 g_recorder_dump_sz = 16;
+
+/**
+	@brief Flight recorder shell variable
+
+	@see tracer::recording_size
+*/
+static const i8 g_recorder_env[] = "INSTRUMENT_RECORDER";
+
+/**
+	@brief Default flight recorder records per thread (ring size)
+
+	@see recorder::recorder
+*/
+static const u32 g_recorder_sz = 65536;
+
+/**
+	@brief Registry reader stripes (power of 2, up to 32)
+
+	@see registry::find
+*/
+static const u32 g_registry_stripes = 16;
+
+/**
+	@brief Initial slot count of a registry (hash index)
+
+	@see registry::registry
+*/
+static const u16 g_registry_sz = 64;
+
+/**
+	@brief Call sampling counters per thread (power of 2)
+
+	@see thread::sampled_call
+*/
+static const u32 g_sample_buckets = 64;
+
+/**
+	@brief Default timer sampling interval (in milliseconds)
+
+	@see tracer::sample
+*/
+static const u32 g_sample_interval = 10;
+
+/**
+	@brief Default call sampling period (1 out of N calls of each function)
+
+	@see thread::sampled_call
+*/
+static const u32 g_sample_period = 64;
+
+/**
+	@brief
+		Sampling mode shell variable (calls:N or timer:milliseconds)
+
+	@see tracer::sampling_mode
+*/
+static const i8 g_sampling_env[] = "INSTRUMENT_SAMPLING";
+
+/**
+	@brief
+		Patchable function entry shell variable ('on' to enable the sleds of all
+		the instrumented modules at load time)
+
+	@see sled::enable_all
+*/
+static const i8 g_sled_env[] = "INSTRUMENT_SLEDS";
+
+/**
+	@brief Initial return stack size of a thread (sled frames, doubled when full)
+
+	@see sled::entered
+*/
+static const u32 g_sled_stack_sz = 256;
+
+/**
+	@brief Maximum trampoline stub pages (one for each 2GB of instrumented code)
+
+	@see sled::stub
+*/
+static const u32 g_sled_stubs_max = 16;
+
+/**
+	@brief Tick rate calibration interval of the slow call thresholds (in milliseconds)
+
+	@see slow_call::calibrate
+*/
+static const u32 g_slow_calibration_ms = 10;
+
+/**
+	@brief
+		Slow call capture shell variable (a threshold in microseconds, for every
+		function)
+
+	@see tracer::slow_threshold
+*/
+static const i8 g_slow_env[] = "INSTRUMENT_SLOW";
+
+/**
+	@brief Frames captured with a slow call (the slow call and its innermost callers)
+
+	@see slow_call::capture_call
+*/
+static const u32 g_slow_frames = 16;
+
+/**
+	@brief Slow call captures kept per thread (ring size, power of 2)
+
+	@see slow_call::register_thread
+*/
+static const u32 g_slow_ring_sz = 256;
+
+/**
+	@brief Spare frames of a stack snapshot array (the stack may grow meanwhile)
+
+	@see tracer::snapshot
+*/
+static const u32 g_snapshot_slack = 16;
+
+/**
+	@brief Stack buffer size of string::format_tail (longer text is formatted on the heap)
+
+	@see string::format_tail
+*/
+static const u32 g_string_format_sz = 256;
+
+/**
+	@brief Inline buffer size of a string (short strings are not heap allocated)
+
+	@see string::memalign
+*/
+static const u32 g_string_inline_sz = 32;
+
+/**
+	@brief
+		Symbol table loading mode shell variable (eager, lazy or background)
+
+	@see tracer::loading_mode
+*/
+static const i8 g_symbols_env[] = "INSTRUMENT_SYMBOLS";
+
+/**
+	@brief Symbol index cache file magic number (first 8 bytes)
+
+	@see symtab::index_header
+*/
+static const i8 g_symidx_magic[] = "INSTRIDX";
+
+/**
+	@brief Symbol index cache file format version
+
+	@see symtab::index_header
+*/
+static const u32 g_symidx_version = 2;
+
 
 /*
 	Syntax highlighter globals
@@ -71,6 +476,22 @@ static const i8 g_properties_path[] = "share/libinstrument/instrument.properties
 
 #ifdef WITH_HIGHLIGHT
 
+/**
+	@brief
+		Dictionary override directory shell variable (the directory of the .dict
+		files replacing the embedded dictionaries)
+
+	@see parser::add_default_dictionary
+*/
+static const i8 g_dict_env[] = "INSTRUMENT_DICTS";
+
+/**
+	@brief C++ stack trace delimiter characters (the set of g_trace_syntax)
+
+	@see instrument::parser
+*/
+static const i8 g_trace_delimiters[] = " \t\n\r{}()*&,:<>\\";
+
 /**
 	@brief C++ stack trace syntax
 
@@ -81,6 +502,84 @@ static const i8 g_trace_syntax[] = "[ \t\n\r\\{\\}\\(\\)\\*&,:<>]+";
 #endif
 
 
+/*
+	Stream globals
+*/
+
+#ifdef WITH_STREAM
+
+/**
+	@brief Default pending buffer capacity of asynchronous streams (in bytes)
+
+	@see stream::set_async
+*/
+static const u32 g_stream_async_sz = 1048576;
+
+/**
+	@brief Default input byte count per compressed block of compressing streams
+
+	@see stream::set_compression
+*/
+static const u32 g_stream_block_sz = 262144;
+
+#endif
+
+
+/*
+	File stream globals
+*/
+
+#ifdef WITH_STREAM_FILE
+
+/**
+	@brief Default segment file count of memory-mapped logs
+
+	@see file::set_mapped
+*/
+static const u32 g_file_log_segments = 4;
+
+/**
+	@brief Sync interval of memory-mapped logs (in milliseconds)
+
+	@see file::sync_log
+*/
+static const u32 g_file_sync_ms = 100;
+
+#endif
+
+
+/*
+	Shared memory stream globals
+*/
+
+#ifdef WITH_STREAM_SHM
+
+/**
+	@brief Shared memory ring magic number
+
+	@see shm_stream::ring
+*/
+static const i8 g_shm_magic[8] = "IDPRING";
+
+/**
+	@brief Default data capacity of a shared memory ring (in bytes, a power of 2)
+
+	@see instrument::shm_reader
+*/
+static const u32 g_shm_ring_sz = 4194304;
+
+/**
+	@brief
+		Wait timeout of the blocked producers and of an idle collector (in
+		milliseconds, bounds the latency of a missed wakeup)
+
+	@see shm_stream::wait
+*/
+static const u32 g_shm_wait_ms = 100;
+
+#endif
+
+
 /*
 	Stty stream globals
 */
@@ -101,11 +600,25 @@ static const i8 g_idp_stty_port[] = "/dev/ttyS0";
 
 #ifdef WITH_STREAM_TCP
 
+/**
+	@brief Minimum interval between the reconnection attempts of a socket (in milliseconds)
+
+	@see tcp_socket::set_reconnect
+*/
+static const u32 g_idp_retry_ms = 1000;
+
 /**
 	@brief IDP (Instrumentation Data Protocol) service port
 */
 static const i32 g_idp_tcp_port = 4242;
 
+/**
+	@brief Default connection timeout of a socket (in milliseconds)
+
+	@see tcp_socket::set_timeout
+*/
+static const u32 g_idp_timeout_ms = 3000;
+
 #endif
 
 }
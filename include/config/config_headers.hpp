@@ -17,6 +17,12 @@
 #include <cstdlib>
 #include <cstring>
 
+#if defined __x86_64__ || defined __i386__
+#include <immintrin.h>
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,17 +31,40 @@ extern "C" {
 #include <bfd.h>
 #include <link.h>
 #include <pthread.h>
+#include <fcntl.h>
 #include <regex.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
-#ifdef WITH_HIGHLIGHT
-#include <fcntl.h>
-#include <sys/mman.h>
+#ifdef WITH_PMU
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef WITH_SLEDS
+#include <unwind.h>
+
+#if defined __x86_64__
+#include <cpuid.h>
+#endif
 #endif
 
 #ifdef WITH_STREAM
 #include <sys/file.h>
-#include <sys/time.h>
+#include <sys/uio.h>
+
+#ifdef WITH_STREAM_LZ4
+#include <lz4frame.h>
+#include <lz4hc.h>
+#endif
+
+#ifdef WITH_STREAM_SHM
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #ifdef WITH_STREAM_STTY
 #include <termios.h>
@@ -43,7 +72,15 @@ extern "C" {
 
 #ifdef WITH_STREAM_TCP
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#ifdef WITH_STREAM_ZSTD
+#include <zstd.h>
 #endif
 #endif
 
@@ -146,4 +146,61 @@ if (!(x)) {													\
 
 #endif
 
+
+/*
+	Use of gcc built-ins for atomic memory access
+*/
+
+/**
+	@brief Atomically load a variable (acquire semantics)
+*/
+#define load_acquire(ptr)					__atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+/**
+	@brief Atomically load a variable (no ordering constraints)
+*/
+#define load_relaxed(ptr)					__atomic_load_n((ptr), __ATOMIC_RELAXED)
+
+/**
+	@brief Atomically store a variable (release semantics)
+*/
+#define store_release(ptr, val)		__atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+
+/**
+	@brief Atomically store a variable (no ordering constraints)
+*/
+#define store_relaxed(ptr, val)		__atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+
+/**
+	@brief Atomically add to a variable and return the new value (full barrier)
+*/
+#define fetch_add(ptr, val)				__atomic_add_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+
+/**
+	@brief Atomically subtract from a variable and return the new value (full barrier)
+*/
+#define fetch_sub(ptr, val)				__atomic_sub_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+
+/**
+	@brief
+		Atomically replace the value of a variable, if it's equal to an expected
+		value (full barrier). Evaluates to true if the value was replaced
+*/
+#define compare_swap(ptr, old, val)	__sync_bool_compare_and_swap((ptr), (old), (val))
+
+/**
+	@brief Full memory barrier
+*/
+#define memory_barrier()					__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/**
+	@brief Load barrier (the preceding loads complete before the following ones)
+*/
+#define load_barrier()						__atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+/**
+	@brief Store barrier (the preceding accesses complete before the following stores)
+*/
+#define store_barrier()						__atomic_thread_fence(__ATOMIC_RELEASE)
+
 #endif
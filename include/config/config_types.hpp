@@ -73,11 +73,21 @@ typedef const i8*						codepage_t;
 */
 typedef const i8*						console_tag_t;
 
+/**
+	@brief File metadata
+*/
+typedef struct stat					fileinfo_t;
+
 /**
 	@brief Thread running status
 */
 typedef u8									thread_status_t;
 
+/**
+	@brief Tracer initialization state
+*/
+typedef u8									tracer_state_t;
+
 /**
 	@brief Thread entry function argument type
 */
@@ -110,6 +120,81 @@ typedef unsigned int				mem_addr_t;
 #endif
 
 
+/*
+	Call stack simulation type definitions
+*/
+
+#ifdef WITH_PMU
+
+/**
+	@brief Hardware performance counter values (see instrument::pmu)
+*/
+typedef struct {
+	u64 cycles;									/**< @brief CPU cycles */
+
+	u64 instructions;						/**< @brief Retired instructions */
+
+	u64 llc_misses;							/**< @brief Last level cache misses */
+
+	u64 branch_misses;					/**< @brief Mispredicted branches */
+} pmu_counts_t;
+
+#endif
+
+/**
+	@brief Simulated call stack frame
+*/
+typedef struct {
+	mem_addr_t fn;							/**< @brief Called function address */
+
+	mem_addr_t site;						/**< @brief Call site address */
+
+	u64 stamp;									/**< @brief Plugin annotation (e.g call timestamp) */
+
+	u64 children;								/**< @brief Plugin annotation (e.g callee time) */
+
+#ifdef WITH_PMU
+	pmu_counts_t counts;				/**< @brief Plugin annotation (counters at the call) */
+
+	pmu_counts_t callees;				/**< @brief Plugin annotation (callee counter deltas) */
+#endif
+
+	u32 repeats;								/**< @brief
+																 Consecutive identical calls held by the
+																 frame (1 unless recursion is folded) */
+} frame_t;
+
+
+/**
+	@brief Flight recorder event (see instrument::recorder)
+*/
+typedef struct {
+	u64 tsc;										/**< @brief Timestamp (TSC ticks on x86) */
+
+	mem_addr_t fn;							/**< @brief Called (or returning) function address */
+
+	mem_addr_t site;						/**< @brief Call (or return) site address */
+
+	u32 kind;										/**< @brief RECORD_ENTER or RECORD_EXIT */
+} record_t;
+
+
+/*
+	Symbol table type definitions
+*/
+
+/**
+	@brief Function symbol table entry (see instrument::symtab)
+*/
+typedef struct {
+	mem_addr_t addr;						/**< @brief Link time address (relative to the load base) */
+
+	u32 size;										/**< @brief Code size (0 if unknown) */
+
+	u32 name;										/**< @brief Decorated name offset in the name pool */
+} symbol_t;
+
+
 /*
 	Syntax highlighter type definitions
 */
@@ -129,11 +214,6 @@ typedef u16									attrset_t;
 */
 typedef u8									color_t;
 
-/**
-	@brief File metadata
-*/
-typedef struct stat					fileinfo_t;
-
 #endif
 
 
@@ -172,6 +252,11 @@ typedef struct sockaddr_in	tcp_addr_t;
 */
 typedef struct sockaddr			ip_addr_t;
 
+/**
+	@brief Unix domain socket address
+*/
+typedef struct sockaddr_un	unix_addr_t;
+
 #endif
 
 }
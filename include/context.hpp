@@ -0,0 +1,126 @@
+#ifndef _CONTEXT
+#define _CONTEXT 1
+
+/**
+	@file include/context.hpp
+
+	@brief Class instrument::context definition
+*/
+
+#include "./shadow_stack.hpp"
+
+namespace instrument {
+
+/**
+	@brief An execution context (fiber, coroutine) with its own simulated call stack
+
+	User space schedulers (fibers, stackful coroutines, green threads) run many
+	logical call stacks on one thread. Without contexts the thread simulates a
+	single stack, mixing the calls of every fiber it runs. A context holds the
+	simulated call stack of a fiber and its call tracking state (the lag and
+	the call sampling bitmap) while the fiber is suspended. Switching the fiber
+	running on a thread (context::switch_to, called next to the real switch,
+	e.g swapcontext(3)) exchanges the stack pointers of the thread and of the
+	context under the thread sequence counter, in O(1), no frame is copied.
+
+	A context is active on at most one thread at a time, a fiber may resume on
+	another thread than the one that suspended it. Contexts are registered with
+	the process, so dumps include the stacks of the suspended contexts next to
+	the thread stacks (see tracer::dump). A reader pins a suspended context
+	while it copies its frames (context::snapshot), a thread resuming a pinned
+	context waits for the copy to complete.
+
+	The stack of the thread itself (the scheduler) is kept in a context of the
+	thread while a fiber is active, named after the thread. A context must be
+	suspended when it's disposed, the contexts active on a thread are suspended
+	when the thread is disposed
+*/
+class context: virtual public object
+{
+protected:
+
+	/* Protected variables */
+
+	i8 *m_name;													/**< @brief Context name */
+
+	shadow_stack *m_stack;							/**< @brief Simulated call stack (while suspended) */
+
+	i32 m_lag;													/**< @brief Simulated call stack lag (see thread::lag) */
+
+	u64 *m_sampled;											/**< @brief Sampled call bitmap (see thread::sampled_call) */
+
+	u32 m_sampled_slots;								/**< @brief Sampled call bitmap size (words) */
+
+	u32 m_depth;												/**< @brief Real call depth (call sampling mode) */
+
+	u32 m_state;												/**< @brief
+																			 Scheduling state (CONTEXT_SUSPENDED,
+																			 CONTEXT_ACTIVE or CONTEXT_PINNED) */
+
+	pthread_t m_owner;									/**< @brief Thread running the context (if active) */
+
+	u32 m_slot;													/**< @brief Position in the process context list */
+
+	bool m_registered;									/**< @brief Registered with the process */
+
+
+	/* Protected generic methods */
+
+	virtual context& resume(pthread_t);
+
+	virtual context& suspend();
+
+
+	/* Protected copy constructors */
+
+	context(const context&)												__attribute((noreturn));
+
+	virtual context* clone() const								__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual context& operator=(const context&)		__attribute((noreturn));
+
+public:
+
+	/* Friend classes and functions */
+
+	template <class F> friend class list;
+
+	friend class process;
+
+	friend class thread;
+
+
+	/* Static methods */
+
+	static context* current();
+
+	static context* switch_to(context*);
+
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit context(const i8* = NULL);
+
+	virtual ~context();
+
+
+	/* Accessor methods */
+
+	virtual bool is_active() const;
+
+	virtual const i8* name() const;
+
+	virtual pthread_t owner() const;
+
+
+	/* Generic methods */
+
+	virtual frame_t* snapshot(u32&, u32&) const;
+};
+
+}
+
+#endif
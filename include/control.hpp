@@ -0,0 +1,152 @@
+#ifndef _CONTROL
+#define _CONTROL 1
+
+/**
+	@file include/control.hpp
+
+	@brief Class instrument::control definition
+*/
+
+#include "./object.hpp"
+
+namespace instrument {
+
+/**
+	@brief Shared memory control block, to reconfigure tracing at runtime
+
+	The control block is a cache line of 32-bit words, mapped from a file (by
+	default /dev/shm/libinstrument.<pid>, see g_control_env), so an external
+	tool can switch tracing on and off, or change the sampling period and the
+	active plugins, without restarting the process. Without a file, the block is
+	private to the process and it's reconfigured only with the methods below.
+	The words are (native byte order):<br><br>
+	<ol>
+		<li>magic number (g_control_magic)
+		<li>layout version (g_control_version)
+		<li>process ID
+		<li>tracing: the generation shifted left by one, ORed with 1 if tracing is
+		on
+		<li>call sampling period (N, for 1 out of N calls, 0 to simulate every
+		call)
+		<li>plugin mask (bit i dispatches plugin i, the plugins after the 32nd are
+		always dispatched)
+		<li>filter generation
+	</ol><br>
+
+	The hooks read the tracing word with a single relaxed load, so tracing off
+	costs one predictable branch per call. Each thread applies the sampling
+	period and the plugin mask when it sees a new generation, starting over a
+	new simulated stack (see thread::resync), so the writers must change the
+	other words first and then store the tracing word with a new generation.
+	While tracing is off, the simulated stacks keep the calls of the moment it
+	was switched off. A new filter generation makes the tracer discard its
+	cached filter verdicts (upon the next generation), the tracer also advances
+	it when its filters change. A forked child starts with a copy of the block
+	of its parent, in its own file if the file path defaults to the process ID
+	(see control::after_fork)
+*/
+class control: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Control block layout (padded to a cache line)
+	*/
+	struct block {
+		u32 magic;												/**< @brief Magic number (g_control_magic) */
+
+		u32 version;											/**< @brief Layout version (g_control_version) */
+
+		u32 pid;													/**< @brief Process ID */
+
+		u32 tracing;											/**< @brief Generation << 1 | tracing on */
+
+		u32 sample_period;								/**< @brief Call sampling period (0 for off) */
+
+		u32 plugin_mask;									/**< @brief Dispatched plugins */
+
+		u32 filter_generation;						/**< @brief Filter generation */
+
+		u8 pad[g_cacheline_sz - 7 * sizeof(u32)];	/**< @brief Padding */
+	};
+
+
+	/* Protected static variables */
+
+	static block s_private;							/**< @brief Private control block */
+
+	static block *s_block;							/**< @brief Control block (never NULL) */
+
+	static i8 *s_path;									/**< @brief Mapped file path (NULL if private) */
+
+
+	/* Protected static methods */
+
+	static void initialize(block*, u32);
+
+	static void map(const i8*);
+
+public:
+
+	/* Static methods */
+
+	static void after_fork();
+
+	static void attach(u32 = 0);
+
+	static void detach();
+
+	static u32 filter_generation();
+
+	static bool is_enabled(u32);
+
+	static u32 next_filter_generation();
+
+	static const i8* path();
+
+	static u32 plugin_mask();
+
+	static void publish(bool);
+
+	static void restart();
+
+	static u32 sample_period();
+
+	static void set_plugin_mask(u32);
+
+	static void set_sample_period(u32);
+
+	static u32 tracing();
+};
+
+
+/**
+ * @brief Check if a tracing word switches tracing on
+ *
+ * @param[in] word the tracing word (see control::tracing)
+ *
+ * @returns true if tracing is on, false otherwise
+ */
+inline bool control::is_enabled(u32 word)
+{
+	return (word & 1) != 0;
+}
+
+
+/**
+ * @brief Read the tracing word (generation and on/off bit)
+ *
+ * @returns the tracing word
+ *
+ * @note Defined here to be inlined in the hooks, a single relaxed load
+ */
+inline u32 control::tracing()
+{
+	return load_relaxed(&s_block->tracing);
+}
+
+}
+
+#endif
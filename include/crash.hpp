@@ -0,0 +1,97 @@
+#ifndef _CRASH
+#define _CRASH 1
+
+/**
+	@file include/crash.hpp
+
+	@brief Class instrument::crash definition
+*/
+
+#include "./process.hpp"
+
+namespace instrument {
+
+/**
+	@brief Async-signal-safe crash dump of all simulated call stacks
+
+	crash::install opens (or duplicates) the dump file descriptor, maps the dump
+	buffer and an alternate signal stack and registers a handler for each of the
+	g_crash_signals. When a crash signal is delivered, the handler writes the
+	module map of the process and the raw frames of every simulated call stack
+	to the buffer, flushing it to the descriptor with write(2). It doesn't lock,
+	allocate, symbolize or format with stdio, so it can't deadlock on the tracer
+	or the allocator locks. Then the previous handler is restored and the signal
+	is raised again.
+
+	The dump is plain text, one record per line:
+
+	@code
+	crash <signal> <pid> <fault address>
+	module <id> <begin> <end> <base> <path>
+	thread <id> <depth> <name>
+	frame <module id> <function offset> <site module id> <call site offset>
+	end
+	@endcode
+
+	The frames of each thread start from the outermost call. The offsets are
+	relative to the module base (see symtab::base), so the frames are symbolized
+	post-mortem, e.g with addr2line -e <path> <offset>. Module ID 0 stands for
+	an address outside of the instrumented modules (the offset is the address).
+	Threads that modify their stack while the dump is taken produce frames of
+	either state, the dump is best effort
+*/
+class crash: virtual public object
+{
+protected:
+
+	/* Protected static variables */
+
+	static i32 s_fd;										/**< @brief Dump file descriptor (-1 if uninstalled) */
+
+	static i8 *s_buffer;								/**< @brief Dump buffer (mapped) */
+
+	static u32 s_size;									/**< @brief Dump buffer used size */
+
+	static void *s_stack;								/**< @brief Alternate signal stack (mapped) */
+
+	static u32 s_dumping;								/**< @brief Non zero while a dump is taken */
+
+	static struct sigaction s_previous[sizeof(g_crash_signals) / sizeof(i32)];	/**< @brief
+																							 Replaced signal
+																							 actions */
+
+
+	/* Protected static methods */
+
+	static void flush();
+
+	static u32 module_id(const process*, mem_addr_t, mem_addr_t&);
+
+	static void on_signal(i32, siginfo_t*, void*);
+
+	static void put(const i8*, u32);
+
+	static void put_hex(u64);
+
+	static void put_number(u64);
+
+	static void put_string(const i8*);
+
+	static void put_thread(const process*, thread*);
+
+public:
+
+	/* Static methods */
+
+	static bool dump(i32 = 0, const void* = NULL);
+
+	static void install(const i8* = NULL);
+
+	static bool is_installed();
+
+	static void uninstall();
+};
+
+}
+
+#endif
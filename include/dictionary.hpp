@@ -8,6 +8,7 @@
 */
 
 #include "./list.hpp"
+#include "./registry.hpp"
 #include "./string.hpp"
 
 namespace instrument {
@@ -21,11 +22,20 @@ namespace instrument {
 	with only whitespace characters is considered an empty line. The tokens are
 	trimmed to remove leading and trailing whitespace characters. If the source
 	file is empty no tokens are loaded, but the dictionary object remains valid.
+	Words can also be loaded from a word table (see dictionary::load_words), the
+	default dictionaries are embedded in the library that way (see
+	parser::add_default_dictionary).
 	The dictionary class inherits from instrument::list (T = instrument::string)
 	all its methods for item management. A dictionary can be looked up for literal
 	strings or for POSIX extended regular expressions (with or without case
 	sensitivity). If a word appears more than once, its first occurence is used. A
-	dictionary is not thread safe, users must implement thread synchronization
+	dictionary is not thread safe, users must implement thread synchronization.
+
+	Lookups use an index that is built when a file is loaded (or upon the first
+	lookup after the words change). Literal lookups probe a hash index (one for
+	case sensitive and one for case insensitive lookups), so they are O(1).
+	Regular expression lookups first match the alternation of all the words,
+	compiled to a single expression, and only scan the words on a match
 
 	@see instrument::parser
 	@see
@@ -43,6 +53,30 @@ protected:
 
 	i8 *m_name;								/**< @brief Dictionary name */
 
+	bool m_indexed;						/**< @brief True if the index is up to date */
+
+	registry<u64, string> *m_index;		/**< @brief Word index (by hash) */
+
+	registry<u64, string> *m_iindex;	/**< @brief Case insensitive word index */
+
+	pattern *m_expr;					/**< @brief Combined words (NULL if not compiled) */
+
+	pattern *m_iexpr;					/**< @brief Case insensitive combined words */
+
+
+	/* Protected static methods */
+
+	static u64 hash(const i8*, bool);
+
+
+	/* Protected generic methods */
+
+	virtual dictionary& index();
+
+	virtual dictionary& invalidate();
+
+	virtual const string* scan(const string&, bool) const;
+
 public:
 
 	/* Constructors, copy constructors and destructor */
@@ -74,9 +108,25 @@ public:
 
 	/* Generic methods */
 
+	virtual dictionary& add(string*);
+
+	virtual dictionary& add_range(string* const*, u32, bool = false);
+
+	virtual dictionary& clear();
+
+	virtual string* detach(u32);
+
+	virtual dictionary& detach_all();
+
 	virtual dictionary& load_file(const i8*);
 
+	virtual dictionary& load_words(const i8* const*, u32);
+
 	virtual const string* lookup(const string&, bool = false) const;
+
+	virtual dictionary& remove(u32);
+
+	virtual dictionary& sort(const comparator_t);
 };
 
 }
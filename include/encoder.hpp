@@ -0,0 +1,214 @@
+#ifndef _ENCODER
+#define _ENCODER 1
+
+/**
+	@file include/encoder.hpp
+
+	@brief Class instrument::encoder definition
+*/
+
+#include "./process.hpp"
+
+namespace instrument {
+
+/**
+	@brief Binary, compact IDP (Instrumentation Data Protocol) v2 encoder
+
+	An encoder produces the binary IDP v2 wire format, an alternative to the text
+	IDP produced by stream::header and tracer::trace. Frames are encoded as
+	module IDs and delta encoded addresses, so symbolization is left to the
+	collector. Each module path, and optionally each function name, is sent once
+	per connection, the first time it is referenced. An encoder is meant to be
+	used for a single connection (call encoder::reset when reconnecting) and it
+	is not thread safe.
+
+	The encoded data starts with the g_idp_magic preamble followed by messages.
+	All integers are unsigned LEB128 varints, signed integers are zigzag encoded
+	and strings are a varint length followed by the characters:<br><br>
+	<ul>
+		<li>message: type (1 byte), payload length, payload
+		<li>HELLO: version, process ID, thread ID, timestamp (in microseconds),
+		executable path
+		<li>MODULE: module ID, load base address, module path
+		<li>SYMBOL: module ID, function offset (from the load base), name
+		<li>TRACE: thread ID, thread name, frame count and for each frame, the
+		module ID of the function (0 if unknown), the function address delta from
+		the previous frame function (signed) and the call site delta from the
+		function (signed)
+		<li>METRICS: timestamp (in microseconds), counter count and the counters
+		(by METRIC_* definition, see instrument::metrics)
+		<li>LATENCY: timestamp (in microseconds), module ID of the function (0 if
+		unknown), function offset (from the load base, the address if the module
+		is unknown), call count, quantile count and the quantiles (in nanoseconds,
+		see instrument::latency::report)
+		<li>SLOW: timestamp (in microseconds, at the return), call duration (in
+		nanoseconds), thread ID, call depth, frame count and the frames, encoded
+		like the TRACE frames, the slow call first (see
+		instrument::slow_call::report)
+		<li>DELTA: snapshot number, thread ID, thread name, exited flag, kept
+		frame count (the outermost frames shared with the previous snapshot of
+		the thread), frame count and the frames past the kept ones, encoded like
+		the TRACE frames (the first function delta is from 0, see
+		tracer::dump(encoder&, stack_delta&) const)
+	</ul><br>
+
+	The encoded data can be flushed to any stream, without copying it, using
+	stream::attach
+
+	@see tracer::trace(encoder&, pthread_t) const
+*/
+class encoder: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Growable byte buffer
+	*/
+	struct buffer {
+		u8 *data;												/**< @brief Buffer data */
+
+		u32 size;												/**< @brief Used size */
+
+		u32 slots;											/**< @brief Allocated size */
+	};
+
+
+	/* Protected static variables */
+
+	static const bool s_known;					/**< @brief Sent symbol marker */
+
+
+	/* Protected variables */
+
+	const process *m_proc;							/**< @brief Symbolized process */
+
+	buffer m_out;												/**< @brief Encoded messages */
+
+	buffer m_defs;											/**< @brief Pending definition messages */
+
+	buffer m_msg;												/**< @brief Current trace payload */
+
+	buffer m_tmp;												/**< @brief Definition payload scratch */
+
+	list<symtab> *m_modules;						/**< @brief Sent modules (by ID - 1) */
+
+	registry<mem_addr_t, const bool> *m_symbols;	/**< @brief
+																								 Functions with a sent
+																								 name */
+
+	const symtab *m_last;								/**< @brief Last referenced module */
+
+	u32 m_last_id;											/**< @brief Last referenced module ID */
+
+	mem_addr_t m_cursor;								/**< @brief Previous frame function */
+
+	bool m_names;												/**< @brief Send function names */
+
+
+	/* Protected static methods */
+
+	static void commit(buffer&, u8, buffer&);
+
+	static void put(buffer&, const void*, u32);
+
+	static void put_signed(buffer&, i64);
+
+	static void put_string(buffer&, const i8*);
+
+	static void put_varint(buffer&, u64);
+
+	static void release(buffer&);
+
+
+	/* Protected copy constructors */
+
+	encoder(const encoder&)												__attribute((noreturn));
+
+	virtual encoder* clone() const								__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual encoder& operator=(const encoder&)		__attribute((noreturn));
+
+
+	/* Protected generic methods */
+
+	virtual u32 module_id(mem_addr_t);
+
+	virtual encoder& symbol(u32, const symtab*, mem_addr_t);
+
+public:
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit encoder(const process* = NULL, bool = false);
+
+	virtual ~encoder();
+
+
+	/* Accessor methods */
+
+	virtual const u8* data() const;
+
+	virtual bool names() const;
+
+	virtual u32 size() const;
+
+
+	/* Generic methods */
+
+#ifdef WITH_PLUGIN
+	virtual encoder& begin_slow_call(pthread_t, u64, u64, u32, u32);
+#endif
+
+	virtual encoder& begin_delta(u64, pthread_t, const i8*, bool, u32, u32);
+
+	virtual encoder& begin_trace(pthread_t, const i8*, u32);
+
+	virtual encoder& clear();
+
+	virtual encoder& end_delta();
+
+#ifdef WITH_PLUGIN
+	virtual encoder& end_slow_call();
+#endif
+
+	virtual encoder& end_trace();
+
+	virtual encoder& frame(mem_addr_t, mem_addr_t);
+
+	virtual encoder& header();
+
+#ifdef WITH_PLUGIN
+	virtual encoder& latency(mem_addr_t, u64, const u64*, u32);
+#endif
+
+#ifdef WITH_METRICS
+	virtual encoder& metrics(const u64*, u32);
+#endif
+
+	virtual encoder& reset();
+
+
+	/* Public static variables */
+
+	/**
+		@brief IDP v2 message types
+	*/
+	static const enum {
+
+		HELLO				= 0x01,		MODULE			= 0x02,		SYMBOL			= 0x03,
+
+		TRACE				= 0x04,		METRICS			= 0x05,		LATENCY			= 0x06,
+
+		SLOW				= 0x07,		DELTA				= 0x08
+
+	} idp_messages;
+};
+
+}
+
+#endif
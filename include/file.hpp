@@ -20,6 +20,17 @@ namespace instrument {
 	safe, the caller must implement thread synchronization, nevertheless basic
 	file locking methods are inherited from instrument::stream
 
+	In mapped mode (see file::set_mapped) the file is a rotating log of fixed
+	size segment files (the path suffixed with the segment number). Each
+	segment is preallocated and mapped shared, so a flush is a copy into the
+	mapping followed by an atomic tail update, without a system call. When the
+	segment can't hold a flush, the next segment file is mapped (the oldest one
+	is overwritten once all the segments are used). A background thread syncs
+	the written pages to the file (msync) and drops them from the mapping
+	(madvise), the full segments are truncated to their data and unmapped by
+	this thread as well. Mapped logs are neither compressed nor written
+	asynchronously, an active segment reads as zeroes past its data
+
 	@note Methods seek_to and resize are not const in case mmap is used
 
 	@see
@@ -35,10 +46,77 @@ class file: virtual public stream
 {
 protected:
 
+	/* Protected types */
+
+	/**
+		@brief Mapped segment file of a log
+	*/
+	struct log_segment {
+		i8 *data;												/**< @brief Mapped data */
+
+		u32 size;												/**< @brief Segment size */
+
+		u32 tail;												/**< @brief Written byte count (published) */
+
+		u32 synced;											/**< @brief Synced byte count (syncer side) */
+
+		i32 handle;											/**< @brief Segment file descriptor */
+
+		log_segment *next;							/**< @brief Next retired segment */
+	};
+
+	/**
+		@brief Memory-mapped log state, shared by the producer and the syncer
+	*/
+	struct mapped_log {
+		pthread_t thread;								/**< @brief Syncer thread (0 if not started) */
+
+		pthread_mutex_t lock;						/**< @brief State mutex */
+
+		pthread_cond_t wake;						/**< @brief Segments retired (or stop requested) */
+
+		log_segment *active;						/**< @brief Written segment */
+
+		log_segment *retired;						/**< @brief Full segments pending unmapping */
+
+		u32 rotations;									/**< @brief Mapped segment count, minus one */
+
+		i32 error;											/**< @brief First sync error (errno) */
+
+		bool stop;											/**< @brief Stop requested */
+	};
+
+
 	/* Protected variables */
 
 	i8 *m_path;										/**< @brief Output file path */
 
+	mapped_log *m_log;						/**< @brief Mapped log state (NULL if not open mapped) */
+
+	u32 m_log_sz;									/**< @brief Mapped log segment size (0 if not mapped) */
+
+	u32 m_log_segments;						/**< @brief Mapped log segment count */
+
+
+	/* Protected static methods */
+
+	static void* sync_log(void*);
+
+	static i32 sync_segment(log_segment*);
+
+	static i32 unmap_segment(log_segment*);
+
+
+	/* Protected generic methods */
+
+	virtual i32 emit(const struct iovec*, u32);
+
+	virtual log_segment* map_segment(u32);
+
+	virtual file& open_log();
+
+	virtual file& rotate();
+
 public:
 
 	/* Static methods */
@@ -59,8 +137,12 @@ public:
 
 	/* Accessor methods */
 
+	virtual bool is_mapped() const;
+
 	virtual const i8* path() const;
 
+	virtual file& set_mapped(u32, u32 = g_file_log_segments);
+
 
 	/* Operator overloading methods */
 
@@ -69,6 +151,8 @@ public:
 
 	/* Generic methods */
 
+	virtual file& close();
+
 	virtual file& flush();
 
 	virtual file& open();
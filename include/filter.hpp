@@ -30,6 +30,8 @@ protected:
 
 	bool m_mode;									/**< @brief Filter type switch */
 
+	bool m_icase;									/**< @brief Case insensitive matching */
+
 	i8 *m_src_expr;								/**< @brief Source (uncompiled) expression */
 
 
@@ -62,6 +64,8 @@ public:
 
 	virtual const i8* expr() const;
 
+	virtual bool icase() const;
+
 	virtual bool mode() const;
 
 	virtual filter& set_expr(const i8*, bool);
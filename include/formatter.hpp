@@ -0,0 +1,69 @@
+#ifndef _FORMATTER
+#define _FORMATTER 1
+
+/**
+	@file include/formatter.hpp
+
+	@brief Class instrument::formatter definition
+*/
+
+#include "./string.hpp"
+
+namespace instrument {
+
+/**
+	@brief This abstract class is the base of all trace output formats
+
+	A formatter lays out the stack traces produced by tracer::trace and
+	tracer::dump (see tracer::trace(string&, formatter&)). The tracer walks the
+	frames and calls the formatter for each one, so no intermediate trace text
+	is built and the output never has to be parsed back downstream. The output
+	is appended to any string, so when a stream is passed, the trace is
+	formatted straight into the stream buffer, which is reused by every flush.
+
+	Currently, libinstrument is shipped with three formats,
+	instrument::text_formatter for the <b>text</b> layout of tracer::trace,
+	instrument::json_formatter for <b>JSON lines</b> and instrument::idp_formatter
+	for <b>binary IDP v2</b>. Numbers are formatted with the fast helpers of this
+	class, not with printf-style format strings
+*/
+class formatter: virtual public object
+{
+protected:
+
+	/* Protected static methods */
+
+	static string& decimal(string&, u64);
+
+	static string& hex(string&, u64, u32 = 0);
+
+	static string& quote(string&, const i8*);
+
+public:
+
+	/* Constructors, copy constructors and destructor */
+
+	virtual ~formatter() = 0;									/**< @brief To be implemented */
+
+	virtual formatter* clone() const = 0;			/**< @brief To be implemented */
+
+
+	/* Accessor methods */
+
+	virtual bool is_symbolic() const;
+
+
+	/* Generic methods */
+
+	virtual formatter& begin_trace(string&, pthread_t, const i8*, u32, u64) = 0;	/**< @brief To be implemented */
+
+	virtual formatter& end_trace(string&, u32) = 0;	/**< @brief To be implemented */
+
+	virtual formatter& frame(string&, mem_addr_t, mem_addr_t, const i8*, const i8*, u32) = 0;	/**< @brief To be implemented */
+
+	virtual formatter& repeat(string&, pthread_t, const i8*, u64, u32) = 0;	/**< @brief To be implemented */
+};
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _IDP_FORMATTER
+#define _IDP_FORMATTER 1
+
+/**
+	@file include/idp_formatter.hpp
+
+	@brief Class instrument::idp_formatter definition
+*/
+
+#include "./encoder.hpp"
+#include "./formatter.hpp"
+
+namespace instrument {
+
+/**
+	@brief The binary IDP v2 layout of the stack traces
+
+	An idp_formatter encodes each trace as an IDP v2 TRACE message (see
+	instrument::encoder), preceded by the preamble and the HELLO message the
+	first time. Symbolization is left to the collector, so the tracer doesn't
+	look up the frames. Like an encoder, an idp_formatter is meant to be used for
+	a single connection (call idp_formatter::reset when reconnecting) and it is
+	not thread safe
+
+	@note
+		IDP v2 has no message for the deduplicated trace repeats, nor a field for
+		the folded frame repeats or the dropped calls
+*/
+class idp_formatter: virtual public formatter
+{
+protected:
+
+	/* Protected variables */
+
+	encoder *m_encoder;									/**< @brief Message encoder */
+
+	bool m_header;											/**< @brief Preamble and HELLO output */
+
+
+	/* Protected copy constructors */
+
+	idp_formatter(const idp_formatter&)									__attribute((noreturn));
+
+	virtual idp_formatter* clone() const								__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual idp_formatter& operator=(const idp_formatter&)	__attribute((noreturn));
+
+public:
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit idp_formatter(const process* = NULL, bool = false);
+
+	virtual ~idp_formatter();
+
+
+	/* Accessor methods */
+
+	virtual bool is_symbolic() const;
+
+
+	/* Generic methods */
+
+	virtual idp_formatter& begin_trace(string&, pthread_t, const i8*, u32, u64);
+
+	virtual idp_formatter& end_trace(string&, u32);
+
+	virtual idp_formatter& frame(string&, mem_addr_t, mem_addr_t, const i8*, const i8*, u32);
+
+	virtual idp_formatter& repeat(string&, pthread_t, const i8*, u64, u32);
+
+	virtual idp_formatter& reset();
+};
+
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _JSON_FORMATTER
+#define _JSON_FORMATTER 1
+
+/**
+	@file include/json_formatter.hpp
+
+	@brief Class instrument::json_formatter definition
+*/
+
+#include "./formatter.hpp"
+
+namespace instrument {
+
+/**
+	@brief The JSON lines layout of the stack traces
+
+	A json_formatter produces one JSON object per line for each trace, so the
+	output can be indexed as it arrives, without parsing any trace text:<br><br>
+	<ul>
+		<li>trace: {"thread":"name","tid":"0x...","depth":N,"signature":"...",
+		"frames":[{"fn":"0x...","site":"0x...","symbol":"...","line":"...",
+		"repeats":N},...],"dropped":N}
+		<li>repeat: {"thread":"name","tid":"0x...","signature":"...","repeats":N}
+	</ul><br>
+	The signature is included only if the traces are deduplicated, the repeats
+	only for the folded frames and the dropped calls only past the maximum
+	depth. Unresolved symbols and unknown lines are null
+*/
+class json_formatter: virtual public formatter
+{
+protected:
+
+	/* Protected variables */
+
+	u32 m_frames;												/**< @brief Frames of the current trace */
+
+public:
+
+	/* Constructors, copy constructors and destructor */
+
+	json_formatter();
+
+	json_formatter(const json_formatter&);
+
+	virtual ~json_formatter();
+
+	virtual json_formatter* clone() const;
+
+
+	/* Operator overloading methods */
+
+	virtual json_formatter& operator=(const json_formatter&);
+
+
+	/* Generic methods */
+
+	virtual json_formatter& begin_trace(string&, pthread_t, const i8*, u32, u64);
+
+	virtual json_formatter& end_trace(string&, u32);
+
+	virtual json_formatter& frame(string&, mem_addr_t, mem_addr_t, const i8*, const i8*, u32);
+
+	virtual json_formatter& repeat(string&, pthread_t, const i8*, u64, u32);
+};
+
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef _LATENCY
+#define _LATENCY 1
+
+/**
+	@file include/latency.hpp
+
+	@brief Class instrument::latency definition
+*/
+
+#include "./profiler.hpp"
+
+namespace instrument {
+
+/**
+	@brief Built-in per function latency histograms (HDR-style, log-linear)
+
+	The latency plugin is an inline plugin, registered with latency::attach. It
+	keeps a histogram of the call durations of each function, per thread, so the
+	tail latencies are not hidden by averages. The histograms are log-linear,
+	like HDR histograms, each power of 2 is split in 2^g_latency_sub_bits linear
+	buckets, so a duration is counted with a relative error of at most
+	1 / 2^g_latency_sub_bits. The bucket count is fixed, a histogram is allocated
+	once, on the first call of a function by a thread, then a call only
+	increments counters.
+
+	The histograms are merged (bucket by bucket) only when a summary is
+	requested, latency::summarize computes the median, the 99th and the 99.9th
+	percentiles and the maximum of each function, latency::report outputs
+	them as text or as IDP v2 LATENCY messages (see also tracer::latencies).
+
+	The enter timestamp is the one stored in the simulated stack frame
+	(frame_t::stamp), shared with the profiler: the first timing plugin that
+	sees a call stamps it. Of the calls unwound by an exception, only the
+	innermost one is counted. The times are wall clock times
+*/
+class latency: virtual public object
+{
+public:
+
+	/* Public types */
+
+	/**
+		@brief Latency summary of a function (in nanoseconds)
+	*/
+	struct summary {
+		mem_addr_t fn;										/**< @brief Function address */
+
+		u64 calls;												/**< @brief Call count */
+
+		u64 p50;													/**< @brief Median */
+
+		u64 p99;													/**< @brief 99th percentile */
+
+		u64 p999;													/**< @brief 99.9th percentile */
+
+		u64 max;													/**< @brief Maximum */
+	};
+
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Latency histogram of a function
+	*/
+	struct entry {
+		mem_addr_t fn;										/**< @brief Function address (0 if unused) */
+
+		u64 calls;												/**< @brief Call count */
+
+		u64 max;													/**< @brief Maximum (in ticks) */
+
+		u64 *counts;											/**< @brief Bucket counters */
+	};
+
+
+	/**
+		@brief Open addressing hash table storage (published as a whole)
+	*/
+	struct slab {
+		u32 slots;												/**< @brief Slot count (power of 2) */
+
+		u32 used;													/**< @brief Used slot count */
+
+		entry *entries;										/**< @brief Slots (cache line aligned) */
+
+		slab *retired;										/**< @brief Replaced (smaller) storage */
+	};
+
+
+	/**
+		@brief Histograms of a thread (padded to a cache line)
+	*/
+	struct table {
+		slab *data;												/**< @brief Published storage */
+
+		table *next;											/**< @brief Next thread histograms */
+
+		u8 pad[g_cacheline_sz - 2 * sizeof(void*)];	/**< @brief Padding */
+	};
+
+
+	/* Protected static variables */
+
+	static __thread table *s_table;			/**< @brief Current thread histograms (TLS) */
+
+	static table *s_tables;							/**< @brief All thread histograms */
+
+	static const plugin *s_plugin;			/**< @brief Registered plugin (NULL if detached) */
+
+	static u64 s_tick0;									/**< @brief Ticks when attached */
+
+	static u64 s_nsec0;									/**< @brief Nanoseconds when attached */
+
+
+	/* Protected static methods */
+
+	static slab* alloc(u32);
+
+	static void begin(void*, void*);
+
+	static u32 bucket(u64);
+
+	static u32 buckets();
+
+	static i32 by_p99(const summary*, const summary*);
+
+	static void end(void*, void*);
+
+	static entry* lookup(table*, mem_addr_t);
+
+	static u64 quantile(const u64*, u64, u64, u32);
+
+	static table* register_thread();
+
+	static u64 upper_bound(u32);
+
+public:
+
+	/* Static methods */
+
+	static const plugin* attach();
+
+	static void detach();
+
+	static bool is_attached();
+
+	static encoder& report(encoder&);
+
+	static string& report(string&);
+
+	static list<summary>* summarize();
+};
+
+}
+
+#endif
@@ -7,6 +7,7 @@
 	@brief Class instrument::list definition and method implementation
 */
 
+#include "./registry.hpp"
 #include "./string.hpp"
 
 namespace instrument {
@@ -23,7 +24,13 @@ namespace instrument {
 	A list object has vastly better performance in access times, compared to a
 	chain (doubly linked list), O(1) vs O(n), but item addition, insertion and
 	removal is more expensive. To get the best of both, memory preallocation (in
-	blocks) is supported (transparently)
+	blocks) is supported (transparently). The array grows geometrically, so
+	adding n items copies O(n) item pointers overall. Slots can be reserved
+	upfront (list::reserve) and items added in bulk (list::add_range).
+
+	Adding an item checks for duplicates, which is a linear search. Large lists
+	can keep a hashed membership index (list::set_indexed), then the duplicate
+	check is O(1) and searching for an item that is not in the list is O(1)
 */
 template <class T>
 class list: virtual public object
@@ -40,6 +47,10 @@ protected:
 
 	u32 m_slots;									/**< @brief Allocated item slots */
 
+	registry<mem_addr_t, T> *m_index;	/**< @brief
+																		 Membership index (by item address, NULL
+																		 if not indexed) */
+
 
 	/* Protected generic methods */
 
@@ -49,6 +60,8 @@ public:
 
 	typedef void (*callback_t)(u32, T*);
 
+	typedef i32 (*comparator_t)(const T*, const T*);
+
 
 	/* Constructors, copy constructors and destructor */
 
@@ -65,8 +78,14 @@ public:
 
 	virtual T* at(u32) const;
 
+	virtual T* const* data() const;
+
+	virtual bool indexed() const;
+
 	virtual bool ordered() const;
 
+	virtual list& set_indexed(bool);
+
 	virtual list& set_ordered(bool);
 
 	virtual	u32 size() const;
@@ -85,6 +104,8 @@ public:
 
 	virtual list& add(T*);
 
+	virtual list& add_range(T* const*, u32, bool = false);
+
 	virtual u32 available() const;
 
 	virtual list& clear();
@@ -97,8 +118,12 @@ public:
 
 	virtual list& remove(u32);
 
+	virtual list& reserve(u32);
+
 	virtual i32 search(const T*) const;
 
+	virtual list& sort(const comparator_t);
+
 	virtual list& to_string(string&) const;
 };
 
@@ -155,7 +180,8 @@ inline list<T>::list(u32 slots, bool ordered):
 m_data(NULL),
 m_ordered(ordered),
 m_size(0),
-m_slots(0)
+m_slots(0),
+m_index(NULL)
 {
 	memalign(slots);
 }
@@ -174,14 +200,17 @@ try:
 m_data(NULL),
 m_ordered(src.m_ordered),
 m_size(0),
-m_slots(0)
+m_slots(0),
+m_index(NULL)
 {
 	*this = src;
 }
 catch(...) {
 	clear();
 	delete[] m_data;
+	delete m_index;
 	m_data = NULL;
+	m_index = NULL;
 }
 
 
@@ -191,6 +220,8 @@ catch(...) {
 template <class T>
 inline list<T>::~list()
 {
+	delete m_index;
+	m_index = NULL;
 	clear();
 	delete[] m_data;
 	m_data = NULL;
@@ -231,6 +262,34 @@ inline T* list<T>::at(u32 i) const
 }
 
 
+/**
+ * @brief Get the data array (unchecked access to the items)
+ *
+ * @returns the data array (NULL if no slots are allocated)
+ *
+ * @note
+ *	The array is valid until the list reallocates it, e.g for the readers that
+ *	can't take locks (see crash::dump)
+ */
+template <class T>
+inline T* const* list<T>::data() const
+{
+	return m_data;
+}
+
+
+/**
+ * @brief Check if the list keeps a membership index
+ *
+ * @returns true if the list is indexed, false otherwise
+ */
+template <class T>
+inline bool list<T>::indexed() const
+{
+	return m_index != NULL;
+}
+
+
 /**
  * @brief Check if the list maintains ordering
  *
@@ -243,6 +302,49 @@ inline bool list<T>::ordered() const
 }
 
 
+/**
+ * @brief Enable/disable the membership index
+ *
+ * @param[in] indexed
+ *	true to index the items by address, so duplicate checks and searches for
+ *	missing items are O(1)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The index is built from the current items
+ */
+template <class T>
+list<T>& list<T>::set_indexed(bool indexed)
+{
+	if ( likely(!indexed) ) {
+		delete m_index;
+		m_index = NULL;
+		return *this;
+	}
+
+	if ( unlikely(m_index != NULL) ) {
+		return *this;
+	}
+
+	registry<mem_addr_t, T> *idx = new registry<mem_addr_t, T>(2 * m_size);
+
+	try {
+		for (u32 i = 0; likely(i < m_size); i++) {
+			idx->insert(reinterpret_cast<mem_addr_t> (m_data[i]), m_data[i]);
+		}
+	}
+	catch (...) {
+		delete idx;
+		throw;
+	}
+
+	m_index = idx;
+	return *this;
+}
+
+
 /**
  * @brief Enable/disable list ordering
  *
@@ -319,6 +421,10 @@ list<T>& list<T>::operator=(const list &rval)
 	for (u32 i = 0; likely(i < rval.m_size); i++) {
 		m_data[i] = new T(*rval.m_data[i]);
 		m_size++;
+
+		if ( unlikely(m_index != NULL) ) {
+			m_index->insert(reinterpret_cast<mem_addr_t> (m_data[i]), m_data[i]);
+		}
 	}
 
 	m_ordered = rval.m_ordered;
@@ -365,9 +471,13 @@ list<T>& list<T>::add(T *d)
 		throw exception("list @ %p already has an item @ %p (at %d)", this, d, i);
 	}
 
-	/* Mandate size if preallocation is needed */
+	/* Grow geometrically if preallocation is needed */
 	if ( unlikely(m_size == m_slots) ) {
-		memalign(m_size + 1);
+		memalign((likely(m_size > 0)) ? 2 * m_size : 1);
+	}
+
+	if ( unlikely(m_index != NULL) ) {
+		m_index->insert(reinterpret_cast<mem_addr_t> (d), d);
 	}
 
 	m_data[m_size++] = d;
@@ -375,6 +485,60 @@ list<T>& list<T>::add(T *d)
 }
 
 
+/**
+ * @brief Add a number of items to the list
+ *
+ * @param[in] items the new item pointers
+ *
+ * @param[in] cnt the item count
+ *
+ * @param[in] unique
+ *	true if the caller guarantees that the items are not in the list and are
+ *	distinct, to skip the duplicate checks
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The slots are reserved once for all the items. If an item is invalid, the
+ *	items before it are added
+ */
+template <class T>
+list<T>& list<T>::add_range(T* const *items, u32 cnt, bool unique)
+{
+	if ( unlikely(items == NULL && cnt > 0) ) {
+		throw exception("invalid argument: items (=%p)", items);
+	}
+
+	reserve(m_size + cnt);
+
+	if ( likely(!unique) ) {
+		for (u32 i = 0; likely(i < cnt); i++) {
+			add(items[i]);
+		}
+
+		return *this;
+	}
+
+	for (u32 i = 0; likely(i < cnt); i++) {
+		T *d = items[i];
+		if ( unlikely(d == NULL) ) {
+			throw exception("invalid argument: items[%d] (=%p)", i, d);
+		}
+
+		if ( unlikely(m_index != NULL) ) {
+			m_index->insert(reinterpret_cast<mem_addr_t> (d), d);
+		}
+
+		m_data[m_size++] = d;
+	}
+
+	return *this;
+}
+
+
 /**
  * @brief Get the list available slots
  *
@@ -400,6 +564,10 @@ list<T>& list<T>::clear()
 		m_data[i] = NULL;
 	}
 
+	if ( unlikely(m_index != NULL) ) {
+		m_index->clear();
+	}
+
 	m_size = 0;
 	return *this;
 }
@@ -419,6 +587,10 @@ T* list<T>::detach(u32 i)
 {
 	T *d = at(i);
 
+	if ( unlikely(m_index != NULL) ) {
+		m_index->remove(reinterpret_cast<mem_addr_t> (d));
+	}
+
 	/* If it's the last list item */
 	if ( unlikely(i == m_size - 1) ) {
 		m_size--;
@@ -454,6 +626,10 @@ list<T>& list<T>::detach_all()
 		m_data[i] = NULL;
 	}
 
+	if ( unlikely(m_index != NULL) ) {
+		m_index->clear();
+	}
+
 	m_size = 0;
 	return *this;
 }
@@ -499,12 +675,32 @@ inline list<T>& list<T>::remove(u32 i)
 }
 
 
+/**
+ * @brief Reserve slots for a number of items
+ *
+ * @param[in] slots the minimum slot count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note NO-OP if enough slots are allocated, the items are kept
+ */
+template <class T>
+inline list<T>& list<T>::reserve(u32 slots)
+{
+	return memalign(slots);
+}
+
+
 /**
  * @brief Search for an item
  *
  * @param[in] d the searched item address (can be NULL)
  *
  * @returns the item offset in the list, -1 if not item is found
+ *
+ * @note If the list is indexed, a missing item is found missing in O(1)
  */
 template <class T>
 i32 list<T>::search(const T *d) const
@@ -514,6 +710,12 @@ i32 list<T>::search(const T *d) const
 		return -1;
 	}
 
+	if ( unlikely(m_index != NULL) ) {
+		if ( likely(m_index->find(reinterpret_cast<mem_addr_t> (d)) == NULL) ) {
+			return -1;
+		}
+	}
+
 	for (u32 i = 0; likely(i < m_size); i++) {
 		if ( unlikely(m_data[i] == d) ) {
 			return i;
@@ -524,6 +726,63 @@ i32 list<T>::search(const T *d) const
 }
 
 
+/**
+ * @brief Sort the list items (in place heapsort, O(n log n))
+ *
+ * @param[in] pfunc
+ *	the item comparator, it returns a negative, zero or positive value when its
+ *	first argument is less than, equal to or greater than the second one
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ *
+ * @note The sorting is not stable
+ */
+template <class T>
+list<T>& list<T>::sort(const comparator_t pfunc)
+{
+	if ( unlikely(pfunc == NULL) ) {
+		throw exception("invalid argument: pfunc (=%p)", pfunc);
+	}
+
+	/* Build a max-heap, then move the maximum to the end, one item at a time */
+	for (u32 end = m_size, i = m_size / 2, n = 0; likely(end > 1);) {
+		T *d;
+		if ( likely(i > 0) ) {
+			n = --i;
+		}
+		else {
+			d = m_data[--end];
+			m_data[end] = m_data[0];
+			m_data[0] = d;
+			n = 0;
+		}
+
+		/* Sift down the n-th item */
+		d = m_data[n];
+		for (u32 child = 2 * n + 1; likely(child < end); child = 2 * n + 1) {
+			if ( likely(child + 1 < end) ) {
+				if ( likely(pfunc(m_data[child], m_data[child + 1]) < 0) ) {
+					child++;
+				}
+			}
+
+			if ( likely(pfunc(d, m_data[child]) >= 0) ) {
+				break;
+			}
+
+			m_data[n] = m_data[child];
+			n = child;
+		}
+
+		m_data[n] = d;
+	}
+
+	return *this;
+}
+
+
 /**
  * @brief Get a string representation
  *
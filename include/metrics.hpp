@@ -0,0 +1,136 @@
+#ifndef _METRICS
+#define _METRICS 1
+
+/**
+	@file include/metrics.hpp
+
+	@brief Class instrument::metrics definition
+*/
+
+#include "./object.hpp"
+
+namespace instrument {
+
+#ifdef WITH_METRICS
+
+/**
+	@brief Self-metrics of the library internals (per thread counters)
+
+	Each thread counts the library events it causes (METRIC_* definitions) in
+	its own table of counters, padded to cache lines and reached through
+	thread-local storage, so counting is a plain (relaxed) increment without
+	locking or sharing cache lines. The tables are merged only when the counters
+	are requested (metrics::merge, see tracer::metrics). The table of an exited
+	thread is reused by the next thread that counts an event, without being
+	reset, so the merged counters are the totals since the library was loaded.
+
+	Contended lock acquisitions are counted by acquiring the locks with
+	metrics::lock (see lock_mutex), which only reads the clock if the lock is
+	held by another thread. Without WITH_METRICS, the class is not compiled and
+	the count_metric and lock_mutex macros expand to nothing and to a plain
+	pthread_mutex_lock respectively
+*/
+class metrics: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Counters of a thread (padded to cache lines)
+	*/
+	struct table {
+		u64 counters[METRIC_COUNT];				/**< @brief Counters (by METRIC_* definition) */
+
+		table *next;											/**< @brief Next thread table */
+
+		u32 active;												/**< @brief Non zero while a thread owns the table */
+
+		u8 pad[g_cacheline_sz - (METRIC_COUNT * sizeof(u64) + sizeof(void*) + sizeof(u32)) %
+					 g_cacheline_sz];						/**< @brief Padding */
+	};
+
+
+	/* Protected static variables */
+
+	static __thread table *s_table;			/**< @brief Current thread table (TLS) */
+
+	static table *s_tables;							/**< @brief All thread tables */
+
+	static table s_fallback;						/**< @brief
+																			 Shared table of the threads that failed to
+																			 allocate their own */
+
+	static const i8 *s_names[METRIC_COUNT];	/**< @brief Counter names */
+
+	static pthread_key_t s_exit_key;		/**< @brief Thread exit hook key */
+
+	static pthread_once_t s_exit_once;	/**< @brief Thread exit hook key creation */
+
+
+	/* Protected static methods */
+
+	static void create_exit_key();
+
+	static u64 nsec();
+
+	static void on_thread_exit(void*);
+
+	static table* register_thread();
+
+public:
+
+	/* Static methods */
+
+	static void add(u32, u64 = 1);
+
+	static void lock(pthread_mutex_t*);
+
+	static void merge(u64*);
+
+	static const i8* name(u32);
+};
+
+
+/**
+ * @brief Add to a counter of the current thread
+ *
+ * @param[in] which the counter (METRIC_* definition)
+ *
+ * @param[in] val the added value
+ *
+ * @note Defined here to be inlined in the instrumented paths
+ */
+inline void metrics::add(u32 which, u64 val)
+{
+	table *t = s_table;
+	if ( unlikely(t == NULL) ) {
+		t = register_thread();
+	}
+
+	/* Only the owning thread writes, the readers merge relaxed loads */
+	store_relaxed(&t->counters[which], t->counters[which] + val);
+}
+
+
+/**
+	@brief Count a self-metrics event (compiled out without WITH_METRICS)
+*/
+#define count_metric(which, val)	metrics::add((which), (val))
+
+/**
+	@brief Acquire a mutex, counting the contended acquisitions
+*/
+#define lock_mutex(mtx)						metrics::lock(mtx)
+
+#else
+
+#define count_metric(which, val)
+
+#define lock_mutex(mtx)						pthread_mutex_lock(mtx)
+
+#endif
+
+}
+
+#endif
@@ -20,9 +20,11 @@ namespace instrument {
 	POSIX extended regular expressions. Parsed text can then be highlighted for
 	VT100 terminals (XTerm, RXVT, GNOME terminal e.t.c), using configurable styles
 	for each type of token. Token types can be identified using a set of C++
-	language dictionaries. By subclassing class instrument::parser, users can
-	create parsers and higlighters for any kind of content, syntax and output
-	media
+	language dictionaries, embedded in the library at build time (generated from
+	the dictionary files of etc) and replaceable at run time (see
+	parser::add_default_dictionary). By subclassing class instrument::parser,
+	users can create parsers and higlighters for any kind of content, syntax and
+	output media
 
 	@see instrument::g_trace_syntax
 	@see
@@ -34,12 +36,42 @@ class parser: virtual public string
 {
 protected:
 
+	/* Protected types */
+
+	/**
+		@brief Styles and dictionaries, resolved once for each highlighted buffer
+	*/
+	struct palette {
+		const style *delimiter;							/**< @brief Delimiter style */
+
+		const style *file;									/**< @brief File name style */
+
+		const style *function;							/**< @brief Function name style */
+
+		const style *keyword;								/**< @brief Keyword style */
+
+		const style *number;								/**< @brief Number style */
+
+		const style *scope;									/**< @brief Scope (namespace/class) style */
+
+		const style *type;									/**< @brief Intrinsic type style */
+
+		const dictionary *keywords;					/**< @brief Keyword dictionary */
+
+		const dictionary *types;						/**< @brief Intrinsic type dictionary */
+
+		const dictionary *extensions;				/**< @brief File extension dictionary */
+	};
+
+
 	/* Protected static variables */
 
 	static parser *s_default;							/**< @brief Default parser */
 
 	static style *s_fallback;							/**< @brief Shared fallback style */
 
+	static bool s_delimiters[256];				/**< @brief g_trace_delimiters lookup table */
+
 
 	/* Protected variables */
 
@@ -54,6 +86,19 @@ protected:
 
 	static void on_lib_unload()	__attribute((destructor));
 
+	static bool is_number(const i8*, u32);
+
+	static u32 span(const i8*, u32, bool);
+
+
+	/* Protected generic methods */
+
+	virtual dictionary* add_default_dictionary(const i8*, const i8* const*, u32, bool);
+
+	virtual const style* classify(const palette&, const string&, const i8*, u32, bool) const;
+
+	virtual parser& resolve(palette&) const;
+
 public:
 
 	/* Friend classes and functions */
@@ -90,6 +135,8 @@ public:
 
 	virtual dictionary* add_dictionary(const i8*, const i8*, bool);
 
+	virtual dictionary* add_dictionary(const i8*, const i8* const*, u32, bool);
+
 	virtual parser& add_dictionary(dictionary*);
 
 	virtual dictionary* get_dictionary(const i8*) const;
@@ -120,6 +167,8 @@ public:
 
 	virtual string* highlight(const i8* = NULL, bool = false) const;
 
+	virtual parser& highlight(string&, const i8* = NULL, bool = false) const;
+
 	virtual bool lookup(const string&, const i8*, bool = false) const;
 
 	virtual const i8* lookup(const string&, bool = false) const;
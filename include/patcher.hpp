@@ -0,0 +1,126 @@
+#ifndef _PATCHER
+#define _PATCHER 1
+
+/**
+	@file include/patcher.hpp
+
+	@brief Class instrument::patcher definition
+*/
+
+#include "./registry.hpp"
+
+namespace instrument {
+
+/**
+	@brief Runtime patching of the hook calls of instrumented functions
+
+	patcher::patch replaces the instruction that called a hook, found from the
+	return address of the hook, with a NOP of the same length, so the function
+	stops calling the hook. The instruction is verified first, it must be a
+	direct call to the hook or to its PLT stub (e8 rel32), or an indirect call
+	through the GOT slot of the hook (ff 15 disp32, with -fno-plt). The page is
+	writable (mprotect(2)) only while the 8 aligned bytes around the instruction
+	are replaced with an atomic compare and swap, so a thread running the
+	function meanwhile executes either the call or the NOP, then the instruction
+	cache is synchronized. Calls that straddle a cache line are not patched.
+	Every code write (the call sites and the sleds, see instrument::sled) is
+	serialized by a process-wide mutex, so a page isn't protected again in the
+	middle of another write, and the page gets its original protection back
+	(read from /proc/self/maps).
+
+	Each call site is tried once, whether it's patched or not. The sites are
+	indexed by return address, so the hooks check if they tried a site without
+	locking. patcher::revert restores the original instructions and forgets the
+	sites. Only x86-64 code is patched, elsewhere patcher::patch always fails
+*/
+class patcher: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Patched (or tried) call site
+	*/
+	struct site {
+		mem_addr_t window;								/**< @brief Replaced 8 bytes address */
+
+		u64 code;													/**< @brief Original bytes */
+
+		u64 patched;											/**< @brief Patched bytes (0 if not patched) */
+
+		site *next;												/**< @brief Next site */
+	};
+
+
+	/* Protected static variables */
+
+	static pthread_mutex_t s_write_lock;	/**< @brief Code write mutex (process-wide) */
+
+	static mem_addr_t s_map_begin;			/**< @brief Last looked up mapping start */
+
+	static mem_addr_t s_map_end;				/**< @brief Last looked up mapping end */
+
+	static i32 s_map_prot;							/**< @brief Last looked up mapping protection */
+
+
+	/* Protected variables */
+
+	registry<mem_addr_t, site> *m_index;	/**< @brief Sites by return address */
+
+	site *m_sites;											/**< @brief All sites */
+
+	u32 m_count;												/**< @brief Patched site count */
+
+	pthread_mutex_t m_lock;							/**< @brief Patching mutex */
+
+
+	/* Protected static methods */
+
+	static u32 decode(mem_addr_t, mem_addr_t);
+
+	static bool is_stub(mem_addr_t, mem_addr_t);
+
+	static i32 protection(mem_addr_t);
+
+
+	/* Protected copy constructors */
+
+	patcher(const patcher&)												__attribute((noreturn));
+
+	virtual patcher* clone() const								__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual patcher& operator=(const patcher&)		__attribute((noreturn));
+
+public:
+
+	/* Static methods */
+
+	static bool write(mem_addr_t, u64, u64);
+
+
+	/* Constructors, copy constructors and destructor */
+
+	patcher();
+
+	virtual ~patcher();
+
+
+	/* Accessor methods */
+
+	virtual u32 count() const;
+
+
+	/* Generic methods */
+
+	virtual bool patch(mem_addr_t, mem_addr_t);
+
+	virtual patcher& revert();
+};
+
+}
+
+#endif
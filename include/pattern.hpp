@@ -0,0 +1,95 @@
+#ifndef _PATTERN
+#define _PATTERN 1
+
+/**
+	@file include/pattern.hpp
+
+	@brief Class instrument::pattern definition
+*/
+
+#include "./registry.hpp"
+
+namespace instrument {
+
+/**
+	@brief Compiled POSIX regular expression, with a process-wide pattern cache
+
+	A pattern is compiled once and can be matched any number of times, from any
+	thread. Method pattern::cached returns a cached pattern, keyed by the
+	expression and the compilation flags, so repeated matching against the same
+	expression (e.g string::match and string::split with constant expressions)
+	doesn't recompile it. The cache is read without locking, at most
+	g_pattern_cache_sz patterns are cached and cached patterns live until
+	pattern::flush is called (at library unload)
+*/
+class pattern: virtual public object
+{
+protected:
+
+	/* Protected static variables */
+
+	static registry<u64, pattern> *s_cache;	/**< @brief Pattern cache (by key) */
+
+	static pthread_mutex_t s_lock;				/**< @brief Pattern cache writer mutex */
+
+
+	/* Protected variables */
+
+	regex_t m_expr;												/**< @brief Compiled expression */
+
+	i8 *m_src_expr;												/**< @brief Source (uncompiled) expression */
+
+	i32 m_flags;													/**< @brief Compilation flags (regcomp) */
+
+
+	/* Protected static methods */
+
+	static void dispose(u32, pattern*);
+
+	static u64 key(const i8*, i32);
+
+
+	/* Protected copy constructors */
+
+	pattern(const pattern&)												__attribute((noreturn));
+
+	virtual pattern* clone() const								__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual pattern& operator=(const pattern&)		__attribute((noreturn));
+
+public:
+
+	/* Static methods */
+
+	static const pattern* cached(const i8*, i32 = REG_EXTENDED);
+
+	static void flush();
+
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit pattern(const i8*, i32 = REG_EXTENDED);
+
+	virtual ~pattern();
+
+
+	/* Accessor methods */
+
+	virtual const i8* expr() const;
+
+	virtual i32 flags() const;
+
+
+	/* Generic methods */
+
+	virtual bool match(const i8*) const;
+
+	virtual bool search(const i8*, u32, regmatch_t&) const;
+};
+
+}
+
+#endif
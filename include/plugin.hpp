@@ -80,6 +80,10 @@ public:
 
 	/* Accessor methods */
 
+	virtual modsym_t begin_callback() const;
+
+	virtual modsym_t end_callback() const;
+
 	virtual const i8* path() const;
 
 
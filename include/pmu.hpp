@@ -0,0 +1,108 @@
+#ifndef _PMU
+#define _PMU 1
+
+/**
+	@file include/pmu.hpp
+
+	@brief Class instrument::pmu definition
+*/
+
+#include "./profiler.hpp"
+
+namespace instrument {
+
+#ifdef WITH_PMU
+
+/**
+	@brief Built-in hardware performance counter attribution (Linux perf_event)
+
+	The pmu is an inline plugin, registered with pmu::attach (which attaches the
+	profiler as well). Each thread opens, on its first simulated call, a
+	perf_event_open(2) counter group counting its user space CPU cycles, retired
+	instructions, last level cache misses and branch misses. On each function
+	call and return the counters are read with the rdpmc instruction, through
+	the mapped counter pages, so no system call is made. Where rdpmc is not
+	available (not x86 or disabled by /sys/bus/event_source/devices/cpu/rdpmc),
+	the group is read with read(2) instead.
+
+	The counter values at the call and the counter deltas of the callees are
+	annotations of the simulated stack frames (frame_t::counts and
+	frame_t::callees), like the profiler times. The inclusive and exclusive
+	deltas are added to the profile of the function, in the profiler tables, so
+	profiler::report shows them next to the times. If the counters can't be
+	opened (e.g perf_event_paranoid or a container policy), a warning is output
+	once and the thread is only profiled. The counters are not scaled when the
+	kernel multiplexes them. A forked child reopens the counters of the forking
+	thread
+*/
+class pmu: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Counter group of a thread
+	*/
+	struct group {
+		i32 fds[g_pmu_counters];					/**< @brief Counter descriptors (the first leads) */
+
+		perf_event_mmap_page *pages[g_pmu_counters];	/**< @brief Mapped counter pages */
+
+		bool rdpmc;												/**< @brief Counters readable with rdpmc */
+
+		bool open;												/**< @brief Counters opened */
+	};
+
+
+	/* Protected static variables */
+
+	static __thread group *s_group;			/**< @brief Current thread counter group (TLS) */
+
+	static const plugin *s_plugin;			/**< @brief Registered plugin (NULL if detached) */
+
+	static u32 s_warned;								/**< @brief Open failure reported */
+
+	static pthread_key_t s_exit_key;		/**< @brief Thread exit hook key */
+
+	static pthread_once_t s_hooks_once;	/**< @brief Thread exit and fork hook installation */
+
+	static const u64 s_configs[g_pmu_counters];	/**< @brief Counter event configurations */
+
+
+	/* Protected static methods */
+
+	static void begin(void*, void*);
+
+	static group* current();
+
+	static void end(void*, void*);
+
+	static void install_hooks();
+
+	static void on_fork_child();
+
+	static void on_thread_exit(void*);
+
+	static bool open(group*);
+
+	static void read(group*, pmu_counts_t&);
+
+	static u64 read_counter(const perf_event_mmap_page*);
+
+public:
+
+	/* Static methods */
+
+	static const plugin* attach();
+
+	static void detach();
+
+	static bool is_attached();
+};
+
+#endif
+
+}
+
+#endif
@@ -7,6 +7,7 @@
 	@brief Class instrument::process definition
 */
 
+#include "./registry.hpp"
 #include "./symtab.hpp"
 #include "./thread.hpp"
 
@@ -21,24 +22,175 @@ namespace instrument {
 	one for each objective code module (executable and selected DSO libraries). A
 	process object offers methods to perform batch symbol lookups, inverse lookups
 	(given a resolved symbol find the module that defines it) and thread handling.
-	Access to the process object <b>is thread safe</b>
+	Access to the process object <b>is thread safe</b>.
+
+	Each actual thread caches its instrument::thread object in thread-local
+	storage, so the instrumentation hooks reach it without acquiring the process
+	lock. The cached handles are invalidated whenever a thread is removed from the
+	process (the thread generation changes). Threads are also indexed by ID, the
+	index lookups are O(1) and don't block while threads are registered or
+	removed. The threads attached implicitly (upon their first instrumented call)
+	are removed and disposed in O(1) when they exit, by a thread-specific data
+	destructor, so the thread list doesn't grow with exited threads.
+
+	Modules are indexed by their mapped address range, so an address maps to a
+	single module in O(log n). The index is replaced (not modified) when a
+	module is added, so symbol lookups don't acquire the process lock. Module
+	symbol tables can be deferred, to be loaded upon the first lookup. The
+	modules loaded later (dlopen) are added one by one, the modules unloaded
+	(dlclose) are dropped from the index but keep their symbol tables, which
+	readers may still use. A module mapped again at the same range reuses its
+	table, it's not loaded again (see process::add_module).
+
+	The process survives fork(2): the forking thread holds the process lock and
+	the symbol table loading locks across the fork (process::before_fork), then
+	the child drops the threads of the parent and adopts its own process ID
+	(process::after_fork). The symbol tables and the name cache are inherited
+	as they are, shared copy-on-write with the parent, so a child is fully
+	instrumented without parsing or loading anything again.
+
+	Resolved names are cached by address, so looking up an address again (e.g
+	the frames of repeated traces) is a single hash probe. The cache stores
+	pointers to the names held by the symbol tables, which are never modified or
+	disposed while the process is alive, so cache hits don't copy or allocate.
+	A batch of addresses (e.g the frames of all the threads) is resolved at once,
+	the cache misses are sorted, split by module and each module resolves its
+	share in a single merge pass, then the cache is updated under a single
+	process lock acquisition
+
+	The execution contexts (fibers, coroutines, see instrument::context) are
+	registered with the process too, so the stacks of the suspended contexts
+	are found next to the thread stacks. The contexts are owned by the
+	application, the process only drops its registrations when it's disposed
 */
 class process: virtual public object
 {
 protected:
 
+	/* Protected types */
+
+	/**
+		@brief Module address range
+	*/
+	struct module_range {
+		mem_addr_t begin;										/**< @brief Range start */
+
+		mem_addr_t end;											/**< @brief Range end */
+
+		symtab *table;											/**< @brief Module symbol table */
+	};
+
+	/**
+		@brief Module address range index (published as a whole to readers)
+	*/
+	struct module_index {
+		u32 size;														/**< @brief Module count */
+
+		module_range *ranges;								/**< @brief Ranges sorted by address */
+
+		module_index *next;									/**< @brief Next retired index */
+	};
+
+	/**
+		@brief Batch lookup query (an address missed by the name cache)
+	*/
+	struct lookup_query {
+		mem_addr_t addr;										/**< @brief Address */
+
+		u32 slot;														/**< @brief Result position */
+	};
+
+
+	/* Protected static variables */
+
+	static u32 s_generations;						/**< @brief Thread generation counter */
+
+	static __thread thread *s_current;	/**< @brief Current thread handle (TLS) */
+
+	static __thread u32 s_current_gen;	/**< @brief
+																			 The thread generation that s_current was
+																			 cached at (TLS) */
+
+	static pthread_key_t s_exit_key;		/**< @brief Thread exit hook key */
+
+	static pthread_once_t s_exit_once;	/**< @brief Thread exit hook key creation */
+
+	static const i8 s_unresolved;				/**< @brief Cached unresolved name marker */
+
+
 	/* Protected variables */
 
 	pthread_mutex_t m_lock;							/**< @brief Access mutex */
 
 	pid_t m_pid;												/**< @brief Process ID */
 
+	volatile u32 m_generation;					/**< @brief Current thread generation */
+
 	list<symtab> *m_symtabs;						/**< @brief Symbol table list */
 
+	module_index *m_ranges;							/**< @brief Module address range index */
+
+	module_index *m_retired_ranges;			/**< @brief
+																			 Replaced range indexes (disposed with the
+																			 process) */
+
 	list<thread> *m_threads;						/**< @brief Instrumented thread list */
 
+	registry<pthread_t, thread> *m_index;	/**< @brief
+																				 Instrumented thread index (by thread
+																				 ID) */
+
+	list<thread> *m_retired;						/**< @brief
+																			 Threads removed from the process while
+																			 possibly still running */
+
+	registry<mem_addr_t, const i8> *m_names;	/**< @brief
+																						 Resolved name cache (by
+																						 address) */
+
+	list<context> *m_contexts;					/**< @brief Registered execution contexts */
+
+
+	/* Protected static methods */
+
+	static i32 compare_queries(const void*, const void*);
+
+	static void create_exit_key();
+
+	static bool is_same_module(const symtab*, const symtab*);
+
+	static void on_thread_exit(void*);
+
+
+	/* Protected generic methods */
+
+	virtual process& add_context(context*);
+
+	virtual process& add_thread(thread*);
+
+	virtual thread* attach_current_thread();
+
+	virtual thread* detach_thread(thread*);
+
+	virtual process& invalidate_threads();
+
+	virtual process& reindex_modules();
+
+	virtual process& reindex_threads();
+
+	virtual process& remove_context(context*);
+
 public:
 
+	/* Friend classes and functions */
+
+	friend class context;
+
+	friend class crash;
+
+	friend class sled;
+
+
 	/* Static methods */
 
 	static process* current();
@@ -74,21 +226,53 @@ public:
 	virtual process& unlock() const;
 
 
+	/* Fork handling methods */
+
+	virtual process& after_fork(bool);
+
+	virtual process& before_fork();
+
+
 	/* Module (symtab) handling methods */
 
-	virtual process& add_module(const i8*, mem_addr_t);
+	virtual process& add_module(const i8*,
+															mem_addr_t,
+															mem_addr_t = 0,
+															mem_addr_t = 0,
+															bool = false);
+
+	virtual process& add_module(symtab*);
+
+	virtual const symtab* get_module(mem_addr_t) const;
+
+	virtual const symtab* get_module(u32) const;
 
 	virtual const i8* inverse_lookup(mem_addr_t, mem_addr_t&) const;
 
+	virtual bool load_module(u32) const;
+
 	virtual const i8* lookup(mem_addr_t) const;
 
+	virtual u32 lookup(const mem_addr_t*, u32, const i8**, const symtab** = NULL) const;
+
 	virtual u32 module_count() const;
 
 	virtual u32 symbol_count() const;
 
+	virtual process& unmap_module(const symtab*);
+
+
+	/* Context handling methods */
+
+	virtual u32 context_count() const;
+
+	virtual context* get_context(u32) const;
+
 
 	/* Thread handling methods */
 
+	virtual thread* cached_thread() const;
+
 	virtual process& cleanup_thread(pthread_t);
 
 	virtual process& cleanup_zombie_threads();
@@ -0,0 +1,212 @@
+#ifndef _PROFILER
+#define _PROFILER 1
+
+/**
+	@file include/profiler.hpp
+
+	@brief Class instrument::profiler definition
+*/
+
+#include "./tracer.hpp"
+
+namespace instrument {
+
+/**
+	@brief Built-in function profiler (call count, inclusive and exclusive time)
+
+	The profiler is an inline plugin, registered with profiler::attach. Its
+	callbacks read a timestamp (the TSC on x86, CLOCK_MONOTONIC_RAW otherwise)
+	on each function call and return and keep the call count, the inclusive and
+	the exclusive time of each function, per thread, in an open addressing hash
+	table aligned to cache lines. A thread only writes its own table, without
+	locking. The tables are merged only when a report is requested
+	(profiler::report).
+
+	The call timestamp and the time spent in callees are kept as annotations of
+	the simulated stack frames of each thread (frame_t::stamp and
+	frame_t::children), so exclusive time is computed without a second stack.
+	The timestamp is shared with the other timing plugins (see
+	instrument::latency), the first one that sees a call stamps it.
+	The time of a recursive function is counted once per simulated frame, so its
+	inclusive time can exceed the profiled time. Of the calls unwound by an
+	exception, only the innermost one is counted. The times are wall clock times
+*/
+class profiler: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Profile of a function
+	*/
+	struct entry {
+		mem_addr_t fn;										/**< @brief Function address (0 if unused) */
+
+		u64 calls;												/**< @brief Call count */
+
+		u64 inclusive;										/**< @brief Inclusive time (in ticks) */
+
+		u64 exclusive;										/**< @brief Exclusive time (in ticks) */
+
+#ifdef WITH_PMU
+		pmu_counts_t inclusive_counts;		/**< @brief Inclusive counter deltas (see instrument::pmu) */
+
+		pmu_counts_t exclusive_counts;		/**< @brief Exclusive counter deltas */
+#endif
+	};
+
+
+	/**
+		@brief Open addressing hash table storage (published as a whole)
+	*/
+	struct slab {
+		u32 slots;												/**< @brief Slot count (power of 2) */
+
+		u32 used;													/**< @brief Used slot count */
+
+		entry *entries;										/**< @brief Slots (cache line aligned) */
+
+		slab *retired;										/**< @brief Replaced (smaller) storage */
+	};
+
+
+	/**
+		@brief Profile of a thread (padded to a cache line)
+	*/
+	struct table {
+		slab *data;												/**< @brief Published storage */
+
+		table *next;											/**< @brief Next thread profile */
+
+		u8 pad[g_cacheline_sz - 2 * sizeof(void*)];	/**< @brief Padding */
+	};
+
+
+	/* Protected static variables */
+
+	static __thread table *s_table;			/**< @brief Current thread profile (TLS) */
+
+	static table *s_tables;							/**< @brief All thread profiles */
+
+	static const plugin *s_plugin;			/**< @brief Registered plugin (NULL if detached) */
+
+	static u64 s_tick0;									/**< @brief Ticks when attached */
+
+	static u64 s_nsec0;									/**< @brief Nanoseconds when attached */
+
+
+	/* Protected static methods */
+
+	static slab* alloc(u32);
+
+	static void begin(void*, void*);
+
+	static i32 by_exclusive(const entry*, const entry*);
+
+	static u64 calibrate(u64, u64);
+
+	static void end(void*, void*);
+
+	static u32 hash(mem_addr_t);
+
+	static entry* lookup(table*, mem_addr_t);
+
+	static u64 nsec();
+
+	static table* register_thread();
+
+	static u64 ticks();
+
+	static u64 to_nsec(u64, u64);
+
+public:
+
+	/* Friend classes and functions */
+
+	friend class latency;
+
+	friend class slow_call;
+
+#ifdef WITH_PMU
+	friend class pmu;
+#endif
+
+
+	/* Static methods */
+
+	static const plugin* attach();
+
+	static void detach();
+
+	static bool is_attached();
+
+	static string& report(string&);
+};
+
+
+/**
+ * @brief Hash a function address (multiplicative hash)
+ *
+ * @param[in] fn the function address
+ *
+ * @returns the address hash
+ */
+inline u32 profiler::hash(mem_addr_t fn)
+{
+	return static_cast<u32> ((static_cast<u64> (fn) >> 4) * 0x9e3779b97f4a7c15ULL >> 32);
+}
+
+
+/**
+ * @brief Read the monotonic (raw) clock
+ *
+ * @returns the clock value in nanoseconds
+ */
+inline u64 profiler::nsec()
+{
+	timespec now;
+#ifdef CLOCK_MONOTONIC_RAW
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+
+	return static_cast<u64> (now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+
+/**
+ * @brief Read the timestamp counter
+ *
+ * @returns the counter value (TSC ticks on x86, nanoseconds otherwise)
+ *
+ * @note Defined here to be inlined in the timing plugins (see instrument::latency)
+ */
+inline u64 profiler::ticks()
+{
+#if defined __x86_64__ || defined __i386__
+	return __builtin_ia32_rdtsc();
+#else
+	return nsec();
+#endif
+}
+
+
+/**
+ * @brief Convert ticks to nanoseconds
+ *
+ * @param[in] t the ticks
+ *
+ * @param[in] scale the nanoseconds per tick (32-bit fixed point)
+ *
+ * @returns the nanoseconds
+ */
+inline u64 profiler::to_nsec(u64 t, u64 scale)
+{
+	return (t >> 32) * scale + (((t & 0xffffffffULL) * scale) >> 32);
+}
+
+}
+
+#endif
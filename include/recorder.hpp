@@ -0,0 +1,102 @@
+#ifndef _RECORDER
+#define _RECORDER 1
+
+/**
+	@file include/recorder.hpp
+
+	@brief Class instrument::recorder definition
+*/
+
+#include "./exception.hpp"
+
+namespace instrument {
+
+/**
+	@brief Single producer ring buffer of function entry and exit events
+
+	A recorder is the "flight recorder" of a thread. The thread writes a compact
+	{timestamp, function, site, kind} record (record_t) on every function entry
+	and exit, without locking and without allocating memory, overwriting the
+	oldest records once the ring is full. So the ring always holds the last N
+	events of the thread, not just its current call stack.
+
+	Only the owning thread may write a recorder. Any thread may read it while it
+	is written: recorder::snapshot copies the most recent records and
+	recorder::drain copies the records written since the previous drain. The
+	reader validates the copied records against the write position afterwards,
+	so records overwritten while they were read are discarded and never mixed
+	with newer ones. Drains must be serialized by the readers
+*/
+class recorder: virtual public object
+{
+protected:
+
+	/* Protected static variables */
+
+	static u32 s_slots;									/**< @brief Ring size of new recorders (0 if off) */
+
+
+	/* Protected variables */
+
+	record_t *m_records;								/**< @brief Ring (power of 2 records) */
+
+	u32 m_mask;													/**< @brief Ring index mask (size - 1) */
+
+	u64 m_head;													/**< @brief Written record count (published) */
+
+	u64 m_tail;													/**< @brief Drained record count (reader side) */
+
+
+	/* Protected generic methods */
+
+	virtual u32 copy(record_t*, u64, u32) const;
+
+
+	/* Protected copy constructors */
+
+	recorder(const recorder&)											__attribute((noreturn));
+
+	virtual recorder* clone() const								__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual recorder& operator=(const recorder&)	__attribute((noreturn));
+
+public:
+
+	/* Static methods */
+
+	static void set_slots(u32);
+
+	static u32 slots();
+
+	static u64 ticks();
+
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit recorder(u32 = g_recorder_sz);
+
+	virtual ~recorder();
+
+
+	/* Accessor methods */
+
+	virtual u32 capacity() const;
+
+	virtual u64 count() const;
+
+
+	/* Generic methods */
+
+	virtual u32 drain(record_t*, u32, u64&);
+
+	virtual recorder& record(u32, mem_addr_t, mem_addr_t);
+
+	virtual u32 snapshot(record_t*, u32) const;
+};
+
+}
+
+#endif
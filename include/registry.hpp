@@ -0,0 +1,646 @@
+#ifndef _REGISTRY
+#define _REGISTRY 1
+
+/**
+	@file include/registry.hpp
+
+	@brief Class instrument::registry definition and method implementation
+*/
+
+#include "./exception.hpp"
+
+namespace instrument {
+
+/**
+	@brief Lightweight, templated hash index with non-blocking readers
+
+	A registry maps integral keys (e.g thread IDs) to data pointers using an open
+	addressing hash table, so lookups are O(1). It is an index and doesn't own
+	the data it points to, items are never deleted by the registry. Lookups
+	(registry::find) don't block and can run concurrently with a writer, but
+	writers (registry::insert, registry::remove, registry::clear) must be
+	serialized by the caller. The zero key value K() is reserved.
+
+	Removed entries leave their key behind (with a NULL data pointer), so a
+	reader never misses an entry that moved. When the table grows it is copied,
+	and the old table is disposed once its readers are done. Readers are
+	counted in stripes (by thread, a cache line each), so concurrent lookups
+	don't share a counter, under the parity of a reader epoch. Retiring tables
+	flips the epoch, the retired tables are disposed once the readers of the
+	previous parity are done, so steady lookups don't hold the disposal back.
+	A registry can be traversed using callbacks and method registry::each
+*/
+template <class K, class T>
+class registry: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Hash table storage (published as a whole to readers)
+	*/
+	struct table {
+		u32 slots;									/**< @brief Slot count (power of 2) */
+
+		u32 used;										/**< @brief Slots with a key */
+
+		K *keys;										/**< @brief Slot keys */
+
+		T **data;										/**< @brief Slot data */
+
+		table *next;								/**< @brief Next retired table */
+	};
+
+
+	/**
+		@brief Reader count (padded to a cache line)
+	*/
+	struct reader_stripe {
+		u32 count[2];								/**< @brief Active reader counts (by epoch parity) */
+
+		u8 pad[g_cacheline_sz - 2 * sizeof(u32)];	/**< @brief Padding */
+	};
+
+
+	/* Protected variables */
+
+	table *m_table;									/**< @brief Published hash table */
+
+	table *m_retired;								/**< @brief Tables pending disposal */
+
+	table *m_draining;							/**< @brief
+																		 Tables retired before the last epoch flip
+																		 (waiting for the previous parity readers) */
+
+	reader_stripe m_readers[g_registry_stripes];	/**< @brief Active reader counts */
+
+	u32 m_epoch;										/**< @brief Reader epoch (flipped upon disposals) */
+
+	u32 m_size;											/**< @brief Item count */
+
+
+	/* Protected static methods */
+
+	static table* alloc(u32);
+
+	static void dispose(table*);
+
+	static u32 hash(K);
+
+	static u32 stripe();
+
+
+	/* Protected generic methods */
+
+	virtual registry& reclaim();
+
+	virtual registry& rehash(u32);
+
+public:
+
+	typedef void (*callback_t)(u32, T*);
+
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit registry(u32 = g_registry_sz);
+
+	registry(const registry&);
+
+	virtual	~registry();
+
+	virtual registry* clone() const;
+
+
+	/* Accessor methods */
+
+	virtual	u32 size() const;
+
+	virtual	u32 slots() const;
+
+
+	/* Operator overloading methods */
+
+	virtual registry& operator=(const registry&);
+
+	virtual T* operator[](K) const;
+
+
+	/* Generic methods */
+
+	virtual registry& clear();
+
+	virtual registry& each(const callback_t) const;
+
+	virtual T* find(K) const;
+
+	virtual registry& insert(K, T*);
+
+	virtual T* remove(K);
+};
+
+
+/**
+ * @brief Allocate an empty hash table
+ *
+ * @param[in] slots the minimum slot count
+ *
+ * @returns the table (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+template <class K, class T>
+typename registry<K, T>::table* registry<K, T>::alloc(u32 slots)
+{
+	u32 sz = 1;
+	while ( likely(sz < slots) ) {
+		sz <<= 1;
+	}
+
+	table *retval = new table;
+	retval->slots = sz;
+	retval->used = 0;
+	retval->keys = NULL;
+	retval->data = NULL;
+	retval->next = NULL;
+
+	try {
+		retval->keys = new K[sz];
+		retval->data = new T*[sz];
+	}
+	catch (...) {
+		dispose(retval);
+		throw;
+	}
+
+	for (u32 i = 0; likely(i < sz); i++) {
+		retval->keys[i] = K();
+		retval->data[i] = NULL;
+	}
+
+	return retval;
+}
+
+
+/**
+ * @brief Release a hash table
+ *
+ * @param[in] t the table (can be NULL for NO-OP)
+ */
+template <class K, class T>
+inline void registry<K, T>::dispose(table *t)
+{
+	if ( unlikely(t == NULL) ) {
+		return;
+	}
+
+	delete[] t->keys;
+	delete[] t->data;
+	delete t;
+}
+
+
+/**
+ * @brief Hash a key (64-bit finalizer mix)
+ *
+ * @param[in] key the key
+ *
+ * @returns the key hash
+ */
+template <class K, class T>
+inline u32 registry<K, T>::hash(K key)
+{
+	u64 h = static_cast<u64> (key);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return static_cast<u32> (h);
+}
+
+
+/**
+ * @brief Get the reader stripe of the current thread
+ *
+ * @returns the stripe index (less than g_registry_stripes)
+ */
+template <class K, class T>
+inline u32 registry<K, T>::stripe()
+{
+	u64 h = static_cast<u64> (pthread_self()) * 0x9e3779b97f4a7c15ULL;
+	return static_cast<u32> (h >> 32) & (g_registry_stripes - 1);
+}
+
+
+/**
+ * @brief Dispose the retired tables, once all their readers are done
+ *
+ * @returns *this
+ *
+ * @note
+ *	Doesn't block. The retired tables are moved to the draining ones and the
+ *	epoch is flipped, the new readers count themselves under the new parity.
+ *	The draining tables are disposed once no reader of the previous parity is
+ *	left, a reader that counts itself under it after the check already reads
+ *	the published table
+ */
+template <class K, class T>
+registry<K, T>& registry<K, T>::reclaim()
+{
+	if ( likely(m_retired == NULL && m_draining == NULL) ) {
+		return *this;
+	}
+
+	if ( likely(m_draining == NULL) ) {
+		m_draining = m_retired;
+		m_retired = NULL;
+		store_release(&m_epoch, m_epoch + 1);
+	}
+
+	/* Order the table publication and the epoch flip before the reader count checks */
+	memory_barrier();
+
+	u32 parity = (m_epoch - 1) & 1;
+	for (u32 i = 0; likely(i < g_registry_stripes); i++) {
+		if ( unlikely(load_acquire(&m_readers[i].count[parity]) != 0) ) {
+			return *this;
+		}
+	}
+
+	while ( likely(m_draining != NULL) ) {
+		table *t = m_draining;
+		m_draining = t->next;
+		dispose(t);
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Copy the live entries to a new table and publish it
+ *
+ * @param[in] slots the minimum slot count of the new table
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+template <class K, class T>
+registry<K, T>& registry<K, T>::rehash(u32 slots)
+{
+	table *old = m_table;
+	table *t = alloc(slots);
+
+	for (u32 i = 0; likely(i < old->slots); i++) {
+		T *d = old->data[i];
+		if ( likely(d == NULL) ) {
+			continue;
+		}
+
+		u32 mask = t->slots - 1;
+		u32 j = hash(old->keys[i]) & mask;
+		while ( likely(t->keys[j] != K()) ) {
+			j = (j + 1) & mask;
+		}
+
+		t->keys[j] = old->keys[i];
+		t->data[j] = d;
+		t->used++;
+	}
+
+	store_release(&m_table, t);
+	old->next = m_retired;
+	m_retired = old;
+	return reclaim();
+}
+
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] slots the minimum slot count
+ *
+ * @throws std::bad_alloc
+ */
+template <class K, class T>
+inline registry<K, T>::registry(u32 slots):
+m_table(NULL),
+m_retired(NULL),
+m_draining(NULL),
+m_epoch(0),
+m_size(0)
+{
+	memset(m_readers, 0, sizeof(m_readers));
+	m_table = alloc(slots);
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The copy points to the same data as the source registry
+ */
+template <class K, class T>
+inline registry<K, T>::registry(const registry &src):
+m_table(NULL),
+m_retired(NULL),
+m_draining(NULL),
+m_epoch(0),
+m_size(0)
+{
+	memset(m_readers, 0, sizeof(m_readers));
+	m_table = alloc(src.m_table->slots);
+	*this = src;
+}
+
+
+/**
+ * @brief Object destructor
+ */
+template <class K, class T>
+inline registry<K, T>::~registry()
+{
+	while ( likely(m_retired != NULL) ) {
+		table *t = m_retired;
+		m_retired = t->next;
+		dispose(t);
+	}
+
+	while ( likely(m_draining != NULL) ) {
+		table *t = m_draining;
+		m_draining = t->next;
+		dispose(t);
+	}
+
+	dispose(m_table);
+	m_table = NULL;
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @returns the object copy (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+template <class K, class T>
+inline registry<K, T>* registry<K, T>::clone() const
+{
+	return new registry(*this);
+}
+
+
+/**
+ * @brief Get the registry size (item count)
+ *
+ * @returns this->m_size
+ */
+template <class K, class T>
+inline u32 registry<K, T>::size() const
+{
+	return m_size;
+}
+
+
+/**
+ * @brief Get the registry allocated size (slot count)
+ *
+ * @returns this->m_table->slots
+ */
+template <class K, class T>
+inline u32 registry<K, T>::slots() const
+{
+	return m_table->slots;
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+template <class K, class T>
+registry<K, T>& registry<K, T>::operator=(const registry &rval)
+{
+	if ( unlikely(this == &rval) ) {
+		return *this;
+	}
+
+	clear();
+
+	const table *t = rval.m_table;
+	for (u32 i = 0; likely(i < t->slots); i++) {
+		if ( likely(t->data[i] != NULL) ) {
+			insert(t->keys[i], t->data[i]);
+		}
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Subscript operator
+ *
+ * @param[in] key the key
+ *
+ * @returns the item registered with the key or NULL
+ */
+template <class K, class T>
+inline T* registry<K, T>::operator[](K key) const
+{
+	return find(key);
+}
+
+
+/**
+ * @brief Remove all items (the items are not deleted)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+template <class K, class T>
+inline registry<K, T>& registry<K, T>::clear()
+{
+	table *old = m_table;
+	store_release(&m_table, alloc(old->slots));
+	m_size = 0;
+
+	old->next = m_retired;
+	m_retired = old;
+	return reclaim();
+}
+
+
+/**
+ * @brief Traverse the registry with a callback for each item (in no order)
+ *
+ * @param[in] pfunc the callback (can be NULL for NO-OP)
+ *
+ * @returns *this
+ *
+ * @note Writers must be serialized with the traversal
+ */
+template <class K, class T>
+registry<K, T>& registry<K, T>::each(const callback_t pfunc) const
+{
+	__D_ASSERT(pfunc != NULL);
+	if ( unlikely(pfunc == NULL) ) {
+		return const_cast<registry<K, T>&> (*this);
+	}
+
+	const table *t = m_table;
+	for (u32 i = 0, n = 0; likely(i < t->slots); i++) {
+		if ( likely(t->data[i] != NULL) ) {
+			pfunc(n++, t->data[i]);
+		}
+	}
+
+	return const_cast<registry<K, T>&> (*this);
+}
+
+
+/**
+ * @brief Find the item registered with a key
+ *
+ * @param[in] key the key
+ *
+ * @returns the item or NULL if the key is not registered
+ *
+ * @note
+ *	This method doesn't block and is safe to call concurrently with writers.
+ *	It counts itself in the reader stripe of the thread, under the current
+ *	epoch parity, concurrent lookups of other threads don't contend on it
+ */
+template <class K, class T>
+T* registry<K, T>::find(K key) const
+{
+	u32 parity = load_relaxed(&m_epoch) & 1;
+	u32 *readers = const_cast<u32*> (&m_readers[stripe()].count[parity]);
+	fetch_add(readers, 1);
+
+	const table *t = load_acquire(&m_table);
+	u32 mask = t->slots - 1;
+	u32 i = hash(key) & mask;
+
+	T *retval = NULL;
+	for (u32 n = 0; likely(n < t->slots); n++) {
+		K cur = load_acquire(&t->keys[i]);
+
+		if ( likely(cur == key) ) {
+			retval = load_acquire(&t->data[i]);
+			break;
+		}
+
+		if ( unlikely(cur == K()) ) {
+			break;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	fetch_sub(readers, 1);
+	return retval;
+}
+
+
+/**
+ * @brief Register an item with a key (replacing any previous item)
+ *
+ * @param[in] key the key (must not be K())
+ *
+ * @param[in] d the item
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+template <class K, class T>
+registry<K, T>& registry<K, T>::insert(K key, T *d)
+{
+	if ( unlikely(key == K()) ) {
+		throw exception("invalid argument: key (reserved value)");
+	}
+
+	if ( unlikely(d == NULL) ) {
+		throw exception("invalid argument: d (=%p)", d);
+	}
+
+	/* Keep the load factor at or below 1/2 */
+	if ( unlikely(2 * (m_table->used + 1) > m_table->slots) ) {
+		rehash(4 * (m_size + 1));
+	}
+
+	table *t = m_table;
+	u32 mask = t->slots - 1;
+	u32 i = hash(key) & mask;
+	while ( likely(t->keys[i] != key && t->keys[i] != K()) ) {
+		i = (i + 1) & mask;
+	}
+
+	if ( likely(t->data[i] == NULL) ) {
+		m_size++;
+	}
+
+	/* The data pointer is published before the key */
+	store_release(&t->data[i], d);
+	if ( likely(t->keys[i] == K()) ) {
+		store_release(&t->keys[i], key);
+		t->used++;
+	}
+
+	return reclaim();
+}
+
+
+/**
+ * @brief Unregister the item registered with a key
+ *
+ * @param[in] key the key
+ *
+ * @returns the item (not deleted) or NULL if the key is not registered
+ */
+template <class K, class T>
+T* registry<K, T>::remove(K key)
+{
+	table *t = m_table;
+	u32 mask = t->slots - 1;
+	u32 i = hash(key) & mask;
+
+	for (u32 n = 0; likely(n < t->slots); n++) {
+		if ( likely(t->keys[i] == key) ) {
+			T *retval = t->data[i];
+			if ( likely(retval != NULL) ) {
+				store_release(&t->data[i], static_cast<T*> (NULL));
+				m_size--;
+			}
+
+			reclaim();
+			return retval;
+		}
+
+		if ( unlikely(t->keys[i] == K()) ) {
+			break;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef _SHADOW_STACK
+#define _SHADOW_STACK 1
+
+/**
+	@file include/shadow_stack.hpp
+
+	@brief Class instrument::shadow_stack definition
+*/
+
+#include "./exception.hpp"
+
+namespace instrument {
+
+/**
+	@brief Chunked, array-backed LIFO queue of call stack frames
+
+	A shadow stack stores plain frame records (called function and call site
+	addresses) in fixed size chunks of g_frame_chunk_sz frames, so indexed access
+	is O(1) and traversal is sequential in memory. The stack grows one chunk at a
+	time, frames are never moved and the frame pointers remain valid while the
+	frames are on the stack. Chunks are kept when the stack shrinks, so a stack
+	that has reached its maximum depth pushes and pops without heap allocations.
+	The spare chunks are released with shadow_stack::trim or with the stack.
+
+	The stack is not thread safe, callers should synchronize thread access. Just
+	like instrument::stack, offset 0 is the stack top and a shadow stack can be
+	traversed using callbacks and method shadow_stack::each. A reader may copy
+	the frames (shadow_stack::snapshot) while the stack is pushed and popped,
+	as long as the chunk directory is not modified meanwhile (the stack doesn't
+	grow or get trimmed), then validate the copy (e.g with a sequence counter,
+	see thread::snapshot)
+
+	The stack depth can be bounded (see shadow_stack::set_limit), the calls past
+	the maximum depth are only counted and popped off the count first. With
+	recursion folding (see shadow_stack::set_folding), a call of the same
+	function from the same call site as the top frame is folded into it, the
+	frame repeat count is incremented instead of pushing a new frame. Popping a
+	folded frame decrements its repeat count, so a push and a pop always stand
+	for a single call, as the lag of the thread counts (see thread::unwind). The
+	annotations of a folded frame belong to the most recent call
+*/
+class shadow_stack: virtual public object
+{
+protected:
+
+	/* Protected static variables */
+
+	static u32 s_limit;							/**< @brief Maximum stored frames (0 for no limit) */
+
+	static bool s_folding;					/**< @brief Recursion folding enabled */
+
+
+	/* Protected variables */
+
+	frame_t **m_chunks;							/**< @brief Chunk directory */
+
+	u32 m_chunk_count;							/**< @brief Allocated chunk count */
+
+	u32 m_slots;										/**< @brief Chunk directory size */
+
+	u32 m_size;											/**< @brief Frame count */
+
+	u32 m_dropped;									/**< @brief Calls past the maximum depth */
+
+
+	/* Protected generic methods */
+
+	virtual shadow_stack& grow();
+
+public:
+
+	typedef void (*callback_t)(u32, const frame_t*);
+
+
+	/* Static methods */
+
+	static bool folding();
+
+	static u32 limit();
+
+	static void set_folding(bool);
+
+	static void set_limit(u32);
+
+
+	/* Constructors, copy constructors and destructor */
+
+	shadow_stack();
+
+	shadow_stack(const shadow_stack&);
+
+	virtual	~shadow_stack();
+
+	virtual shadow_stack* clone() const;
+
+
+	/* Accessor methods */
+
+	virtual u32 capacity() const;
+
+	virtual u32 dropped() const;
+
+	virtual	u32 size() const;
+
+
+	/* Operator overloading methods */
+
+	virtual shadow_stack& operator=(const shadow_stack&);
+
+	virtual const frame_t* operator[](u32) const;
+
+
+	/* Generic methods */
+
+	virtual shadow_stack& clear();
+
+	virtual shadow_stack& each(const callback_t) const;
+
+	virtual const frame_t* peek(u32) const;
+
+	virtual shadow_stack& pop();
+
+	virtual shadow_stack& push(mem_addr_t, mem_addr_t);
+
+	virtual u32 snapshot(frame_t*, u32) const;
+
+	virtual frame_t* top(u32 = 0);
+
+	virtual shadow_stack& trim();
+};
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _SHM_READER
+#define _SHM_READER 1
+
+/**
+	@file include/shm_reader.hpp
+
+	@brief Class instrument::shm_reader definition
+*/
+
+#include "./shm_stream.hpp"
+
+namespace instrument {
+
+/**
+	@brief The collector side of a shared memory ring (see instrument::shm_stream)
+
+	A shm_reader object creates a named POSIX shared memory segment holding a
+	ring and consumes the records written by any number of shm_stream producers.
+	The data of the records is appended to a string in order, as a byte stream,
+	exactly as a TCP collector would receive it. Consumed records are zeroed and
+	released to the producers, then the blocked producers (if any) are woken up.
+	A reader sleeps on a futex while the ring is empty, so an idle collector
+	costs nothing. There must be a single reader for each ring, this class is
+	not thread safe
+
+	@see
+		<a href="index.html#sec5_4">
+			<b>5.4 IDP (Instrumentation Data Protocol)</b>
+		</a>
+*/
+class shm_reader: virtual public object
+{
+protected:
+
+	/* Protected variables */
+
+	i8 *m_name;											/**< @brief Shared memory segment name */
+
+	shm_stream::ring *m_ring;				/**< @brief Mapped ring (NULL if not open) */
+
+	u32 m_capacity;									/**< @brief Data area size */
+
+
+	/* Protected generic methods */
+
+	virtual u32 consume(string&, u32);
+
+
+	/* Protected copy constructors */
+
+	shm_reader(const shm_reader&)											__attribute((noreturn));
+
+	virtual shm_reader* clone() const									__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual shm_reader& operator=(const shm_reader&)	__attribute((noreturn));
+
+public:
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit shm_reader(const i8*, u32 = g_shm_ring_sz);
+
+	virtual ~shm_reader();
+
+
+	/* Accessor methods */
+
+	virtual u32 capacity() const;
+
+	virtual bool is_open() const;
+
+	virtual const i8* name() const;
+
+	virtual u64 pending() const;
+
+
+	/* Generic methods */
+
+	virtual shm_reader& close();
+
+	virtual shm_reader& open();
+
+	virtual u32 read(string&, u32 = 0, u32 = g_shm_wait_ms);
+};
+
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef _SHM_STREAM
+#define _SHM_STREAM 1
+
+/**
+	@file include/shm_stream.hpp
+
+	@brief Class instrument::shm_stream definition
+*/
+
+#include "./stream.hpp"
+
+namespace instrument {
+
+/**
+	@brief A buffered shared memory ring output stream
+
+	A shm_stream object outputs IDP and generic data to a collector on the same
+	host, through a ring in a named POSIX shared memory segment (created by the
+	collector, see instrument::shm_reader). Any number of streams, in any number
+	of processes, can write to the same ring, each flush is stored as one or more
+	contiguous records. A producer reserves a record with a single atomic
+	compare and swap, copies the data and commits the record, so under normal
+	load a flush makes no system call. The collector is woken up with a futex
+	only if it's sleeping on an empty ring.
+
+	When the ring is full, the stream either waits for the collector (the BLOCK
+	backpressure policy, the default) or drops the data (any other policy, see
+	shm_stream::dropped). Records are committed in place, so a producer that
+	dies in the middle of a flush stalls the ring. This class is not thread safe,
+	the caller must implement thread synchronization, nevertheless basic stream
+	locking is inherited from instrument::stream
+
+	@see
+		<a href="index.html#sec5_4">
+			<b>5.4 IDP (Instrumentation Data Protocol)</b>
+		</a>
+*/
+class shm_stream: virtual public stream
+{
+public:
+
+	/* Public types */
+
+	/**
+		@brief
+			Shared memory ring header (followed by the data area, capacity bytes
+			long). The reserved and consumed offsets grow monotonically, they're
+			reduced modulo the capacity to address the data area
+	*/
+	struct ring {
+		i8 magic[8];										/**< @brief Magic number (g_shm_magic) */
+
+		u32 capacity;										/**< @brief Data area size (a power of 2) */
+
+		u8 pad0[g_cacheline_sz - 12];		/**< @brief Padding */
+
+		u64 reserved;										/**< @brief Reserved offset (producers) */
+
+		u8 pad1[g_cacheline_sz - 8];		/**< @brief Padding */
+
+		u64 consumed;										/**< @brief Consumed offset (collector) */
+
+		u32 reader_waiting;							/**< @brief Collector sleeping (futex word) */
+
+		u32 writer_waiting;							/**< @brief Producers sleeping (futex word) */
+
+		u8 pad2[g_cacheline_sz - 16];		/**< @brief Padding */
+	};
+
+	/**
+		@brief
+			Ring record header (8 byte aligned, followed by the data). A record
+			never wraps around the data area, the space left at the end is filled
+			with a padding record
+	*/
+	struct record {
+		u32 length;											/**< @brief
+																			 Record length, including the header (0 until
+																			 committed) */
+
+		u32 size;												/**< @brief Data size (0 for padding) */
+	};
+
+protected:
+
+	/* Protected variables */
+
+	i8 *m_name;											/**< @brief Shared memory segment name */
+
+	ring *m_ring;										/**< @brief Mapped ring (NULL if not open) */
+
+	u32 m_policy;										/**< @brief Backpressure policy */
+
+	u64 m_dropped;									/**< @brief Dropped byte count */
+
+
+	/* Protected generic methods */
+
+	virtual i32 emit(const struct iovec*, u32);
+
+	virtual shm_stream& map();
+
+	virtual bool wait_space(u64);
+
+public:
+
+	/* Static methods */
+
+	static i32 wait(u32*, u32, u32);
+
+	static void wake(u32*, u32);
+
+
+	/* Constructors, copy constructors and destructor */
+
+	explicit shm_stream(const i8*, u32 = BLOCK);
+
+	shm_stream(const shm_stream&);
+
+	virtual ~shm_stream();
+
+	virtual shm_stream* clone() const;
+
+
+	/* Accessor methods */
+
+	virtual u64 dropped() const;
+
+	virtual bool is_open() const;
+
+	virtual const i8* name() const;
+
+	virtual shm_stream& set_async(bool, u32 = g_stream_async_sz, u32 = BLOCK);
+
+#ifdef WITH_STREAM_COMPRESSION
+	virtual shm_stream& set_compression(u32, i32 = 0, u32 = g_stream_block_sz)	__attribute((noreturn));
+#endif
+
+
+	/* Operator overloading methods */
+
+	virtual shm_stream& operator=(const shm_stream&);
+
+
+	/* Generic methods */
+
+	virtual shm_stream& close();
+
+	virtual shm_stream& flush();
+
+	virtual shm_stream& open();
+
+	virtual shm_stream& sync() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef _SLED
+#define _SLED 1
+
+/**
+	@file include/sled.hpp
+
+	@brief Class instrument::sled definition
+*/
+
+#include "./process.hpp"
+
+namespace instrument {
+
+#ifdef WITH_SLEDS
+
+/**
+	@brief Patchable function entry backend (x86-64)
+
+	Code compiled with -fpatchable-function-entry=7,5 (instead of
+	-finstrument-functions) starts each function with 2 NOPs, preceded by 5
+	unreachable NOPs. Such a function (a sled) costs nothing until it's
+	enabled. sled::enable replaces the 7 NOPs atomically (see patcher::write)
+	with a call to the entry trampoline, before the entry, and a short jump to
+	it at the entry. The call reaches the trampoline through a stub mapped
+	within 2GB of the function. A thread running the entry meanwhile executes
+	either the NOPs or the jump (a thread past the first NOP executes stc,
+	which is harmless at a function entry).
+
+	The entry trampoline saves the argument registers and calls sled::entered,
+	which pushes the return address of the function on a per thread return
+	stack and replaces it with the exit trampoline. The exit trampoline saves
+	the return value registers and calls sled::returned, which pops the return
+	stack. Both save the whole extended state (xsave, with the features enabled
+	in XCR0, or fxsave without XSAVE support, see sled::probe_state), so the
+	vector arguments and return values of any width (ymm, zmm) and the x87
+	state survive the handlers. Both feed tracer::on_enter and tracer::on_exit,
+	so the simulated stacks, filters, sampling and plugins work as with
+	-finstrument-functions. A filtered out function is disabled upon its next
+	call (see tracer::unhook).
+
+	Calls that don't return through the exit trampoline (longjmp) are detected
+	by their return address stack slot, when a later call or return happens
+	deeper in (or past) the stack, and their returns are simulated then. Before
+	an exception unwinds the stack, the original return addresses are restored
+	(the unwinder functions are interposed), so the unwinder finds the real
+	callers, and the returns are simulated the same way. With the
+	INSTRUMENT_SLEDS shell variable set to 'on', the sleds of all the
+	instrumented modules are enabled at load time
+*/
+class sled: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Return stack frame of a call entered through a sled
+	*/
+	struct frame {
+		mem_addr_t *slot;									/**< @brief Return address stack slot */
+
+		mem_addr_t ret;										/**< @brief Original return address */
+
+		mem_addr_t fn;										/**< @brief Function address */
+
+		bool hijacked;										/**< @brief True if the slot holds the exit trampoline */
+	};
+
+	/**
+		@brief Return stack of a thread
+	*/
+	struct stack {
+		frame *frames;										/**< @brief Frames (outermost first) */
+
+		u32 size;													/**< @brief Frame count */
+
+		u32 capacity;											/**< @brief Allocated frames */
+	};
+
+
+	/* Protected static variables */
+
+	static __thread stack *s_stack;			/**< @brief Current thread return stack (TLS) */
+
+	static pthread_key_t s_exit_key;		/**< @brief Thread exit hook key */
+
+	static pthread_once_t s_exit_once;	/**< @brief Thread exit hook key creation */
+
+	static mem_addr_t s_stubs[g_sled_stubs_max];	/**< @brief Trampoline stubs */
+
+	static u32 s_stub_count;						/**< @brief Mapped stub count */
+
+	static u32 s_count;									/**< @brief Enabled sled count */
+
+	static pthread_mutex_t s_lock;			/**< @brief Patching mutex */
+
+
+	/* Protected static methods */
+
+	static void create_exit_key();
+
+	static stack* current();
+
+	static void on_thread_exit(void*);
+
+	static void probe_state();
+
+	static void simulate_return(stack*);
+
+	static mem_addr_t stub(mem_addr_t);
+
+	static mem_addr_t window(mem_addr_t);
+
+public:
+
+	/* Static methods */
+
+	static u32 count();
+
+	static bool disable(mem_addr_t);
+
+	static u32 enable_all(const process*);
+
+	static bool enable(mem_addr_t);
+
+	static void entered(mem_addr_t, mem_addr_t*);
+
+	static bool is_enabled(mem_addr_t);
+
+	static bool is_sled(mem_addr_t);
+
+	static mem_addr_t returned(mem_addr_t);
+
+	static void unwinding(mem_addr_t);
+};
+
+#endif
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef _SLOW_CALL
+#define _SLOW_CALL 1
+
+/**
+	@file include/slow_call.hpp
+
+	@brief Class instrument::slow_call definition
+*/
+
+#include "./pattern.hpp"
+#include "./profiler.hpp"
+
+namespace instrument {
+
+/**
+	@brief Built-in slow call capture (the calls exceeding a latency threshold)
+
+	The slow call plugin is an inline plugin, registered with slow_call::attach
+	(or at load time, with the INSTRUMENT_SLOW shell variable set to a threshold
+	in microseconds). Recording every call is too expensive and sampling misses
+	the rare slow calls, so only the calls that last longer than a threshold are
+	captured, with their stack context. The starting callback only stamps the
+	simulated frame and the ending callback compares the elapsed time with the
+	lowest threshold in use, so a fast call costs two timestamp reads and a
+	compare.
+
+	The threshold of a function is the one of the first expression (a POSIX
+	extended regular expression, like the symbol filters) that matches its
+	signature (see slow_call::add_threshold), or the default threshold (see
+	slow_call::set_threshold). It's resolved once per function, upon its first
+	call that exceeds the lowest threshold, then it's read from a lock-free
+	index.
+
+	A slow call is captured in a ring of the thread that made it, along with
+	its duration and its innermost callers (g_slow_frames frames), without
+	locking. The latest g_slow_ring_sz captures of each thread are kept,
+	slow_call::report drains them, as text or as IDP v2 SLOW messages (see also
+	tracer::slow_calls). The enter timestamp is the one stored in the simulated
+	stack frame, shared with the other timing plugins (see instrument::latency)
+*/
+class slow_call: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Latency threshold of the functions matching an expression
+	*/
+	struct rule {
+		pattern *expr;										/**< @brief
+																				 Function signature expression (NULL for the
+																				 default threshold) */
+
+		u64 usec;													/**< @brief Threshold (in microseconds, 0 if off) */
+
+		u64 ticks;												/**< @brief Threshold (in ticks, ~0 if off) */
+	};
+
+
+	/**
+		@brief Captured slow call
+	*/
+	struct capture {
+		u64 usec;													/**< @brief Return time (wall clock, in microseconds) */
+
+		u64 ticks;												/**< @brief Call duration (in ticks) */
+
+		u32 depth;												/**< @brief Simulated call depth */
+
+		u32 size;													/**< @brief Captured frame count */
+
+		mem_addr_t fns[g_slow_frames];		/**< @brief Captured functions (the slow call first) */
+
+		mem_addr_t sites[g_slow_frames];	/**< @brief Captured call sites */
+	};
+
+
+	/**
+		@brief Slow call captures of a thread (single producer ring)
+	*/
+	struct ring {
+		capture *captures;								/**< @brief Ring (g_slow_ring_sz captures) */
+
+		u64 head;													/**< @brief Written capture count (published) */
+
+		u64 tail;													/**< @brief Reported capture count (reader side) */
+
+		pthread_t id;											/**< @brief Thread ID */
+
+		ring *next;												/**< @brief Next thread captures */
+	};
+
+
+	/* Protected static variables */
+
+	static __thread ring *s_ring;				/**< @brief Current thread captures (TLS) */
+
+	static ring *s_rings;								/**< @brief All thread captures */
+
+	static const plugin *s_plugin;			/**< @brief Registered plugin (NULL if detached) */
+
+	static rule s_default;							/**< @brief Default threshold */
+
+	static list<rule> *s_rules;					/**< @brief Function thresholds (by priority) */
+
+	static registry<mem_addr_t, const rule> *s_index;	/**< @brief
+																								 Resolved thresholds by
+																								 function address */
+
+	static u64 s_floor;									/**< @brief Lowest threshold in use (in ticks) */
+
+	static u64 s_tick0;									/**< @brief Ticks at the calibration start */
+
+	static u64 s_nsec0;									/**< @brief Nanoseconds at the calibration start */
+
+	static u64 s_tick_rate;							/**< @brief Ticks per microsecond (0 if not calibrated) */
+
+	static pthread_mutex_t s_lock;			/**< @brief Threshold access mutex */
+
+	static pthread_mutex_t s_report_lock;	/**< @brief Capture drain mutex */
+
+
+	/* Protected static methods */
+
+	static void begin(void*, void*);
+
+	static u64 calibrate();
+
+	static void capture_call(thread*, u64);
+
+	static u32 drain(ring*, capture*);
+
+	static void end(void*, void*);
+
+	static ring* register_thread();
+
+	static const rule* resolve(mem_addr_t);
+
+	static void update_floor();
+
+public:
+
+	/* Static methods */
+
+	static void add_threshold(const i8*, u64, bool = true);
+
+	static const plugin* attach();
+
+	static void detach();
+
+	static bool is_attached();
+
+	static encoder& report(encoder&);
+
+	static string& report(string&);
+
+	static void set_threshold(u64);
+
+	static u64 threshold();
+};
+
+}
+
+#endif
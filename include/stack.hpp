@@ -19,8 +19,15 @@ namespace instrument {
 	but it is not thread safe, callers should synchronize thread access. This
 	implementation doesn't allow a node with a NULL or a duplicate (within the
 	stack) data pointer. A stack can be traversed using callbacks and method
-	stack::each. Apart from the legacy push/pop functions, node data can be
-	accessed using stack offsets, just like a singly-linked list
+	stack::each, or with a cursor from the top (stack::first). Apart from the
+	legacy push/pop functions, node data can be accessed using stack offsets,
+	just like a singly-linked list.
+
+	Popped nodes are not released, they are kept (with their data) on a spare
+	list and recycled by the next push. When data is pushed by value (copied to a
+	recycled node with T::operator=), a stack that has reached its maximum depth
+	pushes and pops without heap allocations. The spare nodes are released with
+	stack::trim or with the stack
 
 	@see instrument::node
 */
@@ -35,6 +42,8 @@ protected:
 
 	node<T> *m_top;									/**< @brief Stack top */
 
+	node<T> *m_spare;								/**< @brief Popped nodes, to be recycled */
+
 
 	/* Protected generic methods */
 
@@ -42,11 +51,52 @@ protected:
 
 	virtual node<T>* node_with(const T*) const;
 
+	virtual node<T>* recycle();
+
 public:
 
 	typedef void (*callback_t)(u32, T*);
 
 
+	/**
+		@brief Stack traversal position (from the top)
+
+		Each step is a single node hop, whereas stack::peek walks from the top, so
+		loops over stack::peek are quadratic. Once the cursor steps past the bottom
+		it is no longer valid. Modifying the stack invalidates its cursors
+	*/
+	class cursor
+	{
+	protected:
+
+		/* Protected variables */
+
+		const node<T> *m_cur;						/**< @brief Current node (NULL past the bottom) */
+
+		u32 m_index;										/**< @brief Current node offset */
+
+	public:
+
+		/* Constructors */
+
+		explicit cursor(const node<T>* = NULL);
+
+
+		/* Accessor methods */
+
+		T* data() const;
+
+		u32 index() const;
+
+		bool is_valid() const;
+
+
+		/* Generic methods */
+
+		cursor& next();
+	};
+
+
 	/* Constructors, copy constructors and destructor */
 
 	stack();
@@ -76,11 +126,17 @@ public:
 
 	virtual stack& each(const callback_t) const;
 
+	virtual cursor first() const;
+
 	virtual T* peek(u32) const;
 
 	virtual stack& pop();
 
 	virtual stack& push(T*);
+
+	virtual stack& push(const T&);
+
+	virtual stack& trim();
 };
 
 
@@ -134,13 +190,32 @@ node<T>* stack<T>::node_with(const T *d) const
 }
 
 
+/**
+ * @brief Get a node from the spare list
+ *
+ * @returns a popped node (with its data, if any) or NULL if there are none
+ */
+template <class T>
+inline node<T>* stack<T>::recycle()
+{
+	node<T> *n = m_spare;
+	if ( likely(n != NULL) ) {
+		m_spare = n->m_link;
+		n->m_link = NULL;
+	}
+
+	return n;
+}
+
+
 /**
  * @brief Object default constructor
  */
 template <class T>
 inline stack<T>::stack():
 m_size(0),
-m_top(NULL)
+m_top(NULL),
+m_spare(NULL)
 {
 }
 
@@ -156,12 +231,14 @@ template <class T>
 inline stack<T>::stack(const stack &src)
 try:
 m_size(0),
-m_top(NULL)
+m_top(NULL),
+m_spare(NULL)
 {
 	*this = src;
 }
 catch (...) {
 	clear();
+	trim();
 }
 
 
@@ -172,6 +249,7 @@ template <class T>
 inline stack<T>::~stack()
 {
 	clear();
+	trim();
 }
 
 
@@ -266,6 +344,8 @@ inline T* stack<T>::operator[](u32 i) const
  * @brief Empty the stack
  *
  * @returns *this
+ *
+ * @note The nodes are released, not kept for recycling
  */
 template <class T>
 stack<T>& stack<T>::clear()
@@ -307,6 +387,18 @@ stack<T>& stack<T>::each(const callback_t pfunc) const
 }
 
 
+/**
+ * @brief Get a cursor at the stack top
+ *
+ * @returns the cursor (not valid if the stack is empty)
+ */
+template <class T>
+inline typename stack<T>::cursor stack<T>::first() const
+{
+	return cursor(m_top);
+}
+
+
 /**
  * @brief Get the node data pointer at a stack offset
  *
@@ -336,7 +428,10 @@ stack<T>& stack<T>::pop()
 		node<T> *n = m_top;
 		m_top = m_top->m_link;
 		m_size--;
-		delete n;
+
+		/* Keep the node for the next push */
+		n->m_link = m_spare;
+		m_spare = n;
 	}
 
 	return *this;
@@ -365,7 +460,15 @@ stack<T>& stack<T>::push(T *d)
 		throw exception("stack @ %p has a node with data @ %p", this, d);
 	}
 
-	node<T> *n = new node<T>(d);
+	node<T> *n = recycle();
+	if ( likely(n != NULL) ) {
+		delete n->m_data;
+		n->m_data = d;
+	}
+	else {
+		n = new node<T>(d);
+	}
+
 	n->m_link = m_top;
 	m_top = n;
 	m_size++;
@@ -373,6 +476,148 @@ stack<T>& stack<T>::push(T *d)
 	return *this;
 }
 
+
+/**
+ * @brief Push a copy of data on the stack
+ *
+ * @param[in] d the new node data
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	If a popped node is available, its data is assigned (T::operator=) and no
+ *	memory is allocated
+ */
+template <class T>
+stack<T>& stack<T>::push(const T &d)
+{
+	node<T> *n = recycle();
+
+	try {
+		if ( likely(n != NULL && n->m_data != NULL) ) {
+			*n->m_data = d;
+		}
+		else if ( likely(n != NULL) ) {
+			n->m_data = new T(d);
+		}
+		else {
+			T *copy = new T(d);
+
+			try {
+				n = new node<T>(copy);
+			}
+			catch (...) {
+				delete copy;
+				throw;
+			}
+		}
+	}
+	catch (...) {
+		if ( likely(n != NULL) ) {
+			n->m_link = m_spare;
+			m_spare = n;
+		}
+
+		throw;
+	}
+
+	n->m_link = m_top;
+	m_top = n;
+	m_size++;
+
+	return *this;
+}
+
+
+/**
+ * @brief Release the spare (popped) nodes
+ *
+ * @returns *this
+ */
+template <class T>
+stack<T>& stack<T>::trim()
+{
+	node<T> *n = m_spare;
+	while ( likely(n != NULL) ) {
+		node<T> *tmp = n->m_link;
+		delete n;
+		n = tmp;
+	}
+
+	m_spare = NULL;
+	return *this;
+}
+
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] cur the node (NULL for an invalid cursor)
+ */
+template <class T>
+inline stack<T>::cursor::cursor(const node<T> *cur):
+m_cur(cur),
+m_index(0)
+{
+}
+
+
+/**
+ * @brief Get the current node data pointer
+ *
+ * @returns the data pointer (NULL if the cursor is not valid)
+ */
+template <class T>
+inline T* stack<T>::cursor::data() const
+{
+	return (likely(m_cur != NULL)) ? m_cur->m_data : NULL;
+}
+
+
+/**
+ * @brief Get the current node offset (from the top)
+ *
+ * @returns this->m_index
+ */
+template <class T>
+inline u32 stack<T>::cursor::index() const
+{
+	return m_index;
+}
+
+
+/**
+ * @brief Check if the cursor is at a node
+ *
+ * @returns true if it is at a node, false if it stepped past the bottom
+ */
+template <class T>
+inline bool stack<T>::cursor::is_valid() const
+{
+	return m_cur != NULL;
+}
+
+
+/**
+ * @brief Step towards the bottom
+ *
+ * @returns *this
+ *
+ * @note NO-OP if the cursor is not valid
+ */
+template <class T>
+inline typename stack<T>::cursor& stack<T>::cursor::next()
+{
+	if ( likely(m_cur != NULL) ) {
+		m_cur = m_cur->m_link;
+		m_index++;
+	}
+
+	return *this;
+}
+
 }
 
 #endif
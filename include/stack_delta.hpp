@@ -0,0 +1,118 @@
+#ifndef _STACK_DELTA
+#define _STACK_DELTA 1
+
+/**
+	@file include/stack_delta.hpp
+
+	@brief Class instrument::stack_delta definition
+*/
+
+#include "./exception.hpp"
+
+namespace instrument {
+
+/**
+	@brief The stacks of a previous dump, the base of incremental (delta) dumps
+
+	Polling dumps of many threads mostly resend frames that didn't change, the
+	stacks of consecutive dumps share long outermost prefixes. A stack delta
+	keeps the frames of each stack sent by the previous delta dump (see
+	tracer::dump(encoder&, stack_delta&) const), so the next one sends, for
+	each stack, the depth of the prefix it shares with the previous frames and
+	the new frames only. The unchanged stacks are not sent at all, a thread
+	whose stack sequence (see thread::sequence) didn't change since the
+	previous dump is not even copied.
+
+	A stack delta stands for the view of a single collector, it must be used
+	with the same encoder (connection) and reset along with it (see
+	stack_delta::reset). It is not thread safe
+*/
+class stack_delta: virtual public object
+{
+protected:
+
+	/* Protected types */
+
+	/**
+		@brief Stack of the previous dump
+	*/
+	struct entry {
+		pthread_t id;											/**< @brief Thread ID (or context address) */
+
+		u64 serial;												/**< @brief
+																					 Thread serial number (0 for a context,
+																					 see thread::serial) */
+
+		frame_t *frames;									/**< @brief Frames (bottom to top, heap allocated) */
+
+		u32 depth;												/**< @brief Frame count */
+
+		u32 seq;													/**< @brief
+																					 Stack sequence at the copy (odd if
+																					 unknown, see thread::snapshot) */
+
+		bool seen;												/**< @brief Found by the running delta dump */
+	};
+
+
+	/* Protected static methods */
+
+	static i32 compare(const void*, const void*);
+
+
+	/* Protected variables */
+
+	entry *m_entries;										/**< @brief Previous stacks (by ID) */
+
+	u32 m_size;													/**< @brief Previous stack count */
+
+	u64 m_count;												/**< @brief Delta dump count */
+
+
+	/* Protected copy constructors */
+
+	stack_delta(const stack_delta&)										__attribute((noreturn));
+
+	virtual stack_delta* clone() const								__attribute((noreturn));
+
+
+	/* Protected operator overloading methods */
+
+	virtual stack_delta& operator=(const stack_delta&)	__attribute((noreturn));
+
+
+	/* Protected generic methods */
+
+	virtual entry* find(pthread_t) const;
+
+	virtual stack_delta& replace(entry*, u32);
+
+public:
+
+	/* Friend classes and functions */
+
+	friend class tracer;
+
+
+	/* Constructors, copy constructors and destructor */
+
+	stack_delta();
+
+	virtual ~stack_delta();
+
+
+	/* Accessor methods */
+
+	virtual u64 count() const;
+
+	virtual u32 size() const;
+
+
+	/* Generic methods */
+
+	virtual stack_delta& reset();
+};
+
+}
+
+#endif
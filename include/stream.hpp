@@ -8,6 +8,9 @@
 */
 
 #include "./string.hpp"
+#ifdef WITH_STREAM_COMPRESSION
+#include "./compressor.hpp"
+#endif
 
 namespace instrument {
 
@@ -20,15 +23,38 @@ namespace instrument {
 	trace and other data to various media. A stream-derived object is both a
 	string buffer and an output stream for any type of media that can be accessed
 	using an integer descriptor/handle. Currently, libinstrument is shipped with
-	three such implementations, instrument::file for <b>files</b>,
-	instrument::tcp_socket for <b>TCP/IP sockets</b> and instrument::stty for
-	<b>serial interfaces</b>. Class stream is not thread safe, but it implements
+	four such implementations, instrument::file for <b>files</b>,
+	instrument::tcp_socket for <b>TCP/IP sockets</b>, instrument::stty for
+	<b>serial interfaces</b> and instrument::shm_stream for <b>shared memory
+	rings</b> (to a collector on the same host). Class stream is not thread safe, but it implements
 	basic stream locking. The buffer part of the object can be manipulated using
 	the methods inherited from instrument::string. For example if you need to copy
 	only the buffer from one object to another (even of different types) use the
 	string::set(const string&) method instead of the overloaded assignment
 	operator
 
+	By default stream::flush writes the buffer synchronously, on the calling
+	thread. In asynchronous mode (see stream::set_async) flushed data is moved to
+	a pending buffer and a dedicated writer thread outputs it, so a slow consumer
+	(e.g a TCP collector) doesn't stall the producers. The pending buffer is
+	bounded and a backpressure policy selects what happens when it is full. The
+	writer can hold the pending data back, up to a byte count or a latency
+	bound, so the data of many flushes (IDP messages) is written at once (see
+	stream::set_batching). A failed write is reported by the next flush, unless
+	the stream recovers (e.g a socket reconnects) and only the data being
+	written is lost
+
+	The output can be compressed as LZ4 or zstd frames (see
+	stream::set_compression). In asynchronous mode the writer thread compresses
+	the pending data, so the producers never pay the compression cost. Each
+	write of the writer (or each synchronous flush) ends with a complete block,
+	so the reader can decompress all the data written so far
+
+	Data that is already built elsewhere (e.g a stack trace) can be attached to
+	the stream as a borrowed segment (see stream::attach), instead of copying it
+	into the buffer. Segments are output in order with the buffered data, using
+	vectored I/O, and they must remain valid until the next flush or clear
+
 	@see
 		<a href="index.html#sec5_4">
 			<b>5.4 IDP (Instrumentation Data Protocol)</b>
@@ -41,10 +67,107 @@ class stream: virtual public string
 {
 protected:
 
+	/* Protected types */
+
+	/**
+		@brief Asynchronous output state, shared by the producers and the writer
+	*/
+	struct async_writer {
+		pthread_t thread;								/**< @brief Writer thread */
+
+		pthread_mutex_t lock;						/**< @brief State mutex */
+
+		pthread_cond_t ready;						/**< @brief Data pending (or stop requested) */
+
+		pthread_cond_t drained;					/**< @brief Pending data taken by the writer */
+
+		string *pending;								/**< @brief Data flushed by the producers */
+
+		string *front;									/**< @brief Data being written */
+
+		u64 dropped;										/**< @brief Dropped byte count */
+
+		u32 capacity;										/**< @brief Pending buffer capacity (bytes) */
+
+		u32 policy;											/**< @brief Backpressure policy */
+
+		u32 batch;											/**< @brief Coalesced byte count (0 for none) */
+
+		u32 linger;											/**< @brief
+																			 Maximum coalescing latency (milliseconds, 0
+																			 for none) */
+
+		i32 error;											/**< @brief First write error (errno) */
+
+		bool busy;											/**< @brief Writing the front buffer */
+
+		bool urgent;										/**< @brief
+																			 Producers wait for the pending data (no
+																			 coalescing) */
+
+		bool stop;											/**< @brief Stop requested */
+	};
+
+	/**
+		@brief Output segment, either borrowed or a part of the buffer
+	*/
+	struct segment {
+		const i8 *data;									/**< @brief Borrowed data (NULL for buffered data) */
+
+		u32 offset;											/**< @brief Buffered data offset */
+
+		u32 length;											/**< @brief Segment length */
+	};
+
+
 	/* Protected variables */
 
 	i32 m_handle;										/**< @brief Stream handle (descriptor) */
 
+	async_writer *m_async;					/**< @brief Asynchronous output state */
+
+#ifdef WITH_STREAM_COMPRESSION
+	compressor *m_compressor;				/**< @brief Output compressor (NULL for none) */
+#endif
+
+	segment *m_segments;						/**< @brief Output segments */
+
+	u32 m_segment_count;						/**< @brief Output segment count */
+
+	u32 m_segment_slots;						/**< @brief Output segment array size */
+
+	u32 m_mark;											/**< @brief Buffer offset of the next segment */
+
+	u64 m_flushed;									/**< @brief Flushed byte count */
+
+
+	/* Protected static methods */
+
+	static void transmit(i32, const i8*, u32);
+
+	static void* writer(void*);
+
+
+	/* Protected generic methods */
+
+#ifdef WITH_STREAM_COMPRESSION
+	virtual stream& deflate();
+#endif
+
+	virtual i32 emit(const struct iovec*, u32);
+
+	virtual stream& enqueue();
+
+	virtual stream& push(const i8*, u32, u32);
+
+	virtual bool recover(i32);
+
+#ifdef WITH_STREAM_COMPRESSION
+	virtual stream& seal();
+#endif
+
+	virtual stream& transmit();
+
 public:
 
 	/* Constructors, copy constructors and destructor */
@@ -60,10 +183,28 @@ public:
 
 	/* Accessor methods */
 
+#ifdef WITH_STREAM_COMPRESSION
+	virtual u32 compression() const;
+#endif
+
+	virtual u64 dropped() const;
+
+	virtual u64 flushed() const;
+
 	virtual i32 handle() const;
 
+	virtual bool is_async() const;
+
 	virtual bool is_open() const;
 
+	virtual stream& set_async(bool, u32 = g_stream_async_sz, u32 = BLOCK);
+
+	virtual stream& set_batching(u32, u32);
+
+#ifdef WITH_STREAM_COMPRESSION
+	virtual stream& set_compression(u32, i32 = 0, u32 = g_stream_block_sz);
+#endif
+
 
 	/* Operator overloading methods */
 
@@ -72,8 +213,16 @@ public:
 
 	/* Generic methods */
 
+	virtual stream& attach(const i8*, u32);
+
+	virtual stream& attach(const string&);
+
+	virtual stream& clear();
+
 	virtual stream& close();
 
+	virtual stream& drain();
+
 	virtual stream& flush() = 0;						/**< @brief To be implemented */
 
 	virtual stream& header();
@@ -85,6 +234,19 @@ public:
 	virtual stream& sync() const = 0;				/**< @brief To be implemented */
 
 	virtual stream& unlock() const;
+
+
+	/* Public static variables */
+
+	/**
+		@brief Backpressure policies of asynchronous output, when the pending
+		buffer is full
+	*/
+	static const enum {
+
+		BLOCK				= 0x00,		DROP_NEWEST		= 0x01,		DROP_OLDEST		= 0x02
+
+	} backpressure_policies;
 };
 
 }
@@ -8,6 +8,7 @@
 */
 
 #include "./chain.hpp"
+#include "./pattern.hpp"
 
 namespace instrument {
 
@@ -19,6 +20,12 @@ namespace instrument {
 	allocated in blocks (aligning) to reduce overhead when appending multiple
 	small strings. It is comparable against POSIX extended regular expressions.
 
+	Short strings (up to g_string_inline_sz characters, including the trailing
+	null) are stored inline, without a heap allocation. Appending grows the
+	buffer geometrically and formats the appended text straight into the free
+	space at the end of the buffer, so appending is allocation free once the
+	buffer is large enough.
+
 	It is very easy to direct library output to any kind of stream (console, file,
 	serial, network, plugin, device e.t.c), by storing that output (trace) in
 	string buffers or other subclassed objects.
@@ -35,7 +42,7 @@ protected:
 
 	/* Protected variables */
 
-	i8 *m_data;								/**< @brief String data */
+	i8 *m_data;								/**< @brief String data (m_inline if short) */
 
 	u32 m_length;							/**< @brief Character count */
 
@@ -43,13 +50,19 @@ protected:
 
 	u32 m_size;								/**< @brief Buffer size */
 
+	i8 m_inline[g_string_inline_sz];	/**< @brief Inline buffer (short strings) */
+
 
 	/* Protected generic methods */
 
 	virtual string& format(const i8*, va_list);
 
+	virtual string& format_tail(const i8*, va_list);
+
 	virtual string& memalign(u32, bool = false);
 
+	virtual string& release();
+
 public:
 
 	/* Friend classes and functions */
@@ -112,6 +125,8 @@ public:
 
 	virtual string& clear();
 
+	virtual string& concat(const i8*, u32);
+
 	virtual string& crop(u32);
 
 	virtual string& insert(u32, const string&);
@@ -160,6 +175,8 @@ public:
 
 	virtual bool match(const i8*, bool = false) const;
 
+	virtual bool match(const pattern&) const;
+
 
 	/* Slicing */
 
@@ -167,6 +184,8 @@ public:
 
 	virtual chain<string>* split(const i8*, bool = true, bool = false) const;
 
+	virtual chain<string>* split(const pattern&, bool = true) const;
+
 	virtual string* substring(u32 = 0, u32 = 0, bool = false);
 };
 
@@ -34,6 +34,15 @@ protected:
 
 	i8 *m_name;										/**< @brief Style name */
 
+	i8 m_escape[g_memblock_sz];		/**< @brief Cached escape sequence */
+
+	u32 m_escape_len;							/**< @brief Cached escape sequence length */
+
+
+	/* Protected generic methods */
+
+	virtual style& refresh();
+
 public:
 
 	/* Constructors, copy constructors and destructor */
@@ -53,6 +62,8 @@ public:
 
 	virtual color_t bgcolor() const;
 
+	virtual const i8* escape() const;
+
 	virtual color_t fgcolor() const;
 
 	virtual const i8* name() const;
@@ -75,6 +86,8 @@ public:
 
 	virtual style& apply(string&) const;
 
+	virtual style& apply(string&, const i8*, u32) const;
+
 	virtual bool is_attr_enabled(attrset_t) const;
 
 	virtual style& set_attr_enabled(attrset_t, bool);
@@ -13,6 +13,12 @@ namespace instrument {
 
 /**
 	@brief This class represents a program/library function symbol
+
+	Symbol tables store plain entries (symbol_t), a symbol is a standalone view
+	of an entry for the public API (see symtab::view). A symbol can refer to its
+	decorated (mangled) name in a string pool, which must outlive it. The name is
+	demangled the first time it's requested and the result is kept (symbol::name
+	is thread safe)
 */
 class symbol: virtual public object
 {
@@ -22,13 +28,26 @@ protected:
 
 	mem_addr_t m_addr;									/**< @brief Symbol address */
 
-	i8 *m_name;													/**< @brief Symbol name */
+	i8 *m_name;													/**< @brief
+																				 Symbol name (demangled, NULL until
+																				 requested) */
+
+	const i8 *m_mangled;								/**< @brief
+																				 Decorated symbol name (pooled, not
+																				 owned) */
+
+	u32 m_size;													/**< @brief Symbol code size (0 if unknown) */
+
+
+	/* Protected generic methods */
+
+	virtual const i8* demangle() const;
 
 public:
 
 	/* Constructors, copy constructors and destructor */
 
-	explicit symbol(mem_addr_t, const i8* = NULL);
+	explicit symbol(mem_addr_t, const i8* = NULL, u32 = 0);
 
 	symbol(const symbol&);
 
@@ -43,14 +62,27 @@ public:
 
 	virtual bool is_resolved() const;
 
+	virtual const i8* mangled() const;
+
+	virtual symbol& set_mangled(const i8*);
+
 	virtual const i8* name() const;
 
 	virtual symbol& set_name(const i8* = NULL);
 
+	virtual u32 size() const;
+
+	virtual symbol& set_size(u32);
+
 
 	/* Operator overloading methods */
 
 	virtual symbol& operator=(const symbol&);
+
+
+	/* Generic methods */
+
+	virtual bool contains(mem_addr_t) const;
 };
 
 }
@@ -8,6 +8,7 @@
 */
 
 #include "./list.hpp"
+#include "./registry.hpp"
 #include "./symbol.hpp"
 
 namespace instrument {
@@ -20,36 +21,179 @@ namespace instrument {
 	by the libbfd backends on the host (target) machine (elf, coff, ecoff e.t.c).
 
 	To optimize lookups the symbol table (as structured in libbfd) is parsed, the
-	non-function symbols are discarded and function symbols are demangled once and
-	stored in simpler data structures. The symbol list is sorted by address and
-	binary searched for even better lookup times. The list is random access (as
-	opposed to a chain), so single lookups are O(n).
+	non-function symbols are discarded and function symbols are stored in a
+	contiguous array of plain entries (symbol_t). The decorated names are copied
+	to a single string pool and each name is demangled only when it's first
+	requested. The array is sorted by address and binary searched, so single
+	lookups are O(log n), a sorted batch of addresses is resolved in a single
+	merge pass (see tools/symbolize.cpp). Each symbol spans up to the next symbol (or its section
+	end), so any address within a function (e.g a call site) resolves to it. An
+	instrument::symbol view of an entry can be obtained with symtab::view.
+
+	If a cache directory is set (INSTRUMENT_CACHE shell variable), the parsed
+	symbol table is saved to a compact index file, keyed by the module path, size
+	and modification time. Later loads of the same module map the index file
+	read-only and use the mapped entries, instead of parsing the module with
+	libbfd.
+
+	A symtab can be loaded lazily, then only the module path, base address and
+	mapped range are recorded and the symbol table is parsed upon the first
+	lookup (or an explicit symtab::load). Loading is thread safe and happens once.
+	Only the libbfd calls are serialized across modules, mapping an index,
+	sorting and saving the parsed table are not, so separate symtabs can be
+	loaded concurrently (see tracer::load_modules).
 
 	A symtab can be traversed using callbacks and method symtab::each. The access
-	to a symtab is not thread safe, callers must implement thread synchronization
-
-	@todo Sort the table by address and implement binary lookup
+	to a symtab is not thread safe, callers must implement thread synchronization.
+	The exception is source line resolution (symtab::addr2line), which reads the
+	debug information in-process through libbfd and is thread safe. The module
+	file is reopened on the first request and each resolved address is cached
 */
 class symtab: virtual public object
 {
 protected:
 
+	/* Protected types */
+
+	/**
+		@brief Section lookup query (bfd_map_over_sections argument)
+	*/
+	struct section_query {
+		bfd_vma pc;											/**< @brief Link time address */
+
+		asection *section;							/**< @brief Section containing pc */
+	};
+
+	/**
+		@brief
+			Symbol index file header (followed by the symbol_t entries and the name
+			pool)
+	*/
+	struct index_header {
+		i8 magic[8];										/**< @brief Magic number (g_symidx_magic) */
+
+		u32 version;										/**< @brief Format version */
+
+		u32 count;											/**< @brief Entry count */
+
+		u32 names_sz;										/**< @brief Name pool size */
+
+		u32 entry_sz;										/**< @brief sizeof(symbol_t) */
+
+		u64 mtime;											/**< @brief Module modification time */
+
+		u64 size;												/**< @brief Module file size */
+	};
+
+
+	/* Protected static variables */
+
+	static pthread_mutex_t s_bfd_lock;	/**< @brief libbfd access mutex */
+
+
 	/* Protected variables */
 
+	pthread_mutex_t m_load_lock;		/**< @brief Symbol table loading mutex */
+
 	mem_addr_t m_base;							/**< @brief Load base address */
 
+	mem_addr_t m_begin;							/**< @brief Mapped address range start */
+
+	mem_addr_t m_end;								/**< @brief Mapped address range end */
+
+	bool m_mapped;									/**< @brief
+																		 Module mapped in the process (an unloaded
+																		 module keeps its table, see
+																		 process::unmap_module) */
+
 	i8 *m_path;											/**< @brief Objective code file path */
 
-	list<symbol> *m_table;					/**< @brief Function symbol table */
+	symbol_t *m_table;							/**< @brief
+																		 Function symbol table (sorted, NULL until
+																		 loaded) */
+
+	u32 m_count;										/**< @brief Function symbol count */
+
+	i8 **m_demangled;								/**< @brief
+																		 Demangled names (parallel to m_table,
+																		 allocated upon the first request) */
+
+	i8 *m_names;										/**< @brief Decorated symbol name pool */
+
+	u32 m_names_sz;									/**< @brief Symbol name pool size */
+
+	void *m_index;									/**< @brief
+																		 Mapped symbol index file (the table and the
+																		 name pool are mapped, NULL if not mapped) */
+
+	u32 m_index_sz;									/**< @brief Mapped symbol index file size */
+
+	bfd *m_bfd;											/**< @brief Debug information descriptor */
+
+	asymbol **m_symbols;						/**< @brief Canonical libbfd symbol table */
+
+	bool m_lineless;								/**< @brief No debug information available */
+
+	registry<mem_addr_t, string> *m_lines;	/**< @brief
+																						 Resolved source lines (by address) */
+
+
+	/* Protected static methods */
+
+	static i32 compare(const void*, const void*);
+
+	static void dispose_line(u32, string*);
+
+	static void find_section(bfd*, asection*, void*);
+
+	static symbol_t* sort(symbol_t*, u32);
+
+	static bool write_all(i32, const void*, u32);
+
+
+	/* Protected generic methods */
+
+	virtual symtab& close_debug_info();
+
+	virtual bool open_debug_info();
+
+	virtual symtab& copy_table(const symtab&);
+
+	virtual const i8* demangle(u32) const;
+
+	virtual bool index_path(string&, fileinfo_t&) const;
+
+	virtual bool load_index();
+
+	virtual symtab& parse();
+
+	virtual symtab& publish(symbol_t*, u32);
+
+	virtual symtab& release_table();
+
+	virtual symtab& save_index() const;
+
+	virtual const symbol_t* table() const;
 
 public:
 
-	typedef void (*callback_t)(u32, symbol*);
+	typedef void (*callback_t)(u32, const symbol_t*);
+
+
+	/* Friend classes and functions */
+
+	friend class process;
+
+	friend class sled;
 
 
 	/* Constructors, copy constructors and destructor */
 
-	explicit symtab(const i8*, mem_addr_t = 0);
+	explicit symtab(const i8*,
+									mem_addr_t = 0,
+									mem_addr_t = 0,
+									mem_addr_t = 0,
+									bool = false);
 
 	symtab(const symtab&);
 
@@ -62,6 +206,14 @@ public:
 
 	virtual mem_addr_t base() const;
 
+	virtual mem_addr_t begin() const;
+
+	virtual mem_addr_t end() const;
+
+	virtual bool is_mapped() const;
+
+	virtual bool loaded() const;
+
 	virtual const i8* path() const;
 
 
@@ -69,26 +221,40 @@ public:
 
 	virtual symtab& operator=(const symtab&);
 
-	virtual const symbol* operator[](mem_addr_t) const;
+	virtual const symbol_t* operator[](mem_addr_t) const;
 
 
 	/* Generic methods */
 
+	virtual mem_addr_t addr(const symbol_t*) const;
+
+	virtual const i8* addr2line(mem_addr_t) const;
+
 	virtual const i8* addr2name(mem_addr_t) const;
 
+	virtual bool contains(mem_addr_t) const;
+
 	virtual symtab& each(const callback_t) const;
 
 	virtual bool exists(mem_addr_t) const;
 
-	virtual const symbol* lookup(mem_addr_t) const;
+	virtual symtab& load() const;
 
-	virtual const symbol* lookup(const i8*) const;
+	virtual const symbol_t* lookup(mem_addr_t) const;
+
+	virtual const symbol_t* lookup(const i8*) const;
+
+	virtual u32 lookup(const mem_addr_t*, u32, const symbol_t**) const;
+
+	virtual const i8* name(const symbol_t*) const;
 
 	virtual mem_addr_t name2addr(const i8*) const;
 
 	virtual symtab& print(std::ostream& = std::cout) const;
 
 	virtual u32 size() const;
+
+	virtual symbol view(const symbol_t*) const;
 };
 
 }
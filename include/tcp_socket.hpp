@@ -16,9 +16,20 @@ namespace instrument {
 
 	A tcp_socket object is a buffered TCP/IP client socket, designed specifically
 	to implement the client side of IDP, or any other unidirectional application
-	protocol (write only). The class currently supports only IPv4 addresses. This
-	class is not thread safe, the caller must implement thread synchronization,
-	nevertheless basic stream locking is inherited from instrument::stream
+	protocol (write only). The peer is an IPv4 or IPv6 address, or a host name,
+	or the path of a Unix domain socket (an absolute path, the port is ignored).
+	The connection is established without blocking for longer than the timeout
+	(see tcp_socket::set_timeout), and the TCP_NODELAY and TCP_CORK options can
+	be controlled (they're restored upon reconnection). This class is not thread
+	safe, the caller must implement thread synchronization, nevertheless basic
+	stream locking is inherited from instrument::stream
+
+	With asynchronous output and a dropping backpressure policy, a slow or down
+	collector never stalls the producers (see stream::set_async), and the
+	batching of the writer coalesces many IDP messages into one send (see
+	stream::set_batching). If reconnection is enabled, a connection that fails
+	while the writer sends is re-established in the background (at most once
+	every g_idp_retry_ms milliseconds), the data meanwhile is dropped
 
 	@see
 		<a href="index.html#sec5_4">
@@ -29,9 +40,8 @@ namespace instrument {
 			<b>5.5.2 Using instrument::tcp_socket</b>
 		</a>
 
-	@todo Add domain name lookup (getaddrinfo will also resolve IPv4 vs IPv6)
 	@todo Implement connection drop detection (SO_KEEPALIVE, SIGPIPE)
-	@todo Fine tune socket options (buffer size, linger, no-delay e.t.c)
+	@todo Fine tune socket options (buffer size, linger e.t.c)
 
 	@test Stream locking
 	@test TCP_NODELAY option or other means to flush cached network data
@@ -47,6 +57,34 @@ protected:
 
 	i32 m_port;									/**< @brief Peer TCP port */
 
+	u32 m_timeout;							/**< @brief Connection timeout (milliseconds) */
+
+	u64 m_retry;								/**< @brief
+																 Earliest next reconnection attempt (monotonic
+																 milliseconds) */
+
+	bool m_reconnect;						/**< @brief Reconnect in the background */
+
+	bool m_nodelay;							/**< @brief TCP_NODELAY option */
+
+	bool m_cork;								/**< @brief TCP_CORK option */
+
+
+	/* Protected static methods */
+
+	static i32 set_tcp_option(i32, i32, bool);
+
+
+	/* Protected generic methods */
+
+	virtual i32 dial() const;
+
+	virtual i32 emit(const struct iovec*, u32);
+
+	virtual bool is_local() const;
+
+	virtual bool recover(i32);
+
 public:
 
 	/* Constructors, copy constructors and destructor */
@@ -68,6 +106,16 @@ public:
 
 	virtual i32 port() const;
 
+	virtual tcp_socket& set_cork(bool);
+
+	virtual tcp_socket& set_nodelay(bool);
+
+	virtual tcp_socket& set_reconnect(bool);
+
+	virtual tcp_socket& set_timeout(u32);
+
+	virtual u32 timeout() const;
+
 
 	/* Operator overloading methods */
 
@@ -0,0 +1,57 @@
+#ifndef _TEXT_FORMATTER
+#define _TEXT_FORMATTER 1
+
+/**
+	@file include/text_formatter.hpp
+
+	@brief Class instrument::text_formatter definition
+*/
+
+#include "./formatter.hpp"
+
+namespace instrument {
+
+/**
+	@brief The text layout of the stack traces
+
+	A text_formatter produces the traditional trace text of tracer::trace, an
+	opening 'at 'name' thread (0x...) {' line, one '  at symbol (file:line)'
+	line per frame (followed by ' ×N' if N calls are folded into it) and a
+	closing '}' line, all terminated by CRLF. If the traces
+	are deduplicated, the opening line includes the trace signature and a repeat
+	is a single 'at 'name' thread (0x...) signature X repeated N times' line
+*/
+class text_formatter: virtual public formatter
+{
+public:
+
+	/* Constructors, copy constructors and destructor */
+
+	text_formatter();
+
+	text_formatter(const text_formatter&);
+
+	virtual ~text_formatter();
+
+	virtual text_formatter* clone() const;
+
+
+	/* Operator overloading methods */
+
+	virtual text_formatter& operator=(const text_formatter&);
+
+
+	/* Generic methods */
+
+	virtual text_formatter& begin_trace(string&, pthread_t, const i8*, u32, u64);
+
+	virtual text_formatter& end_trace(string&, u32);
+
+	virtual text_formatter& frame(string&, mem_addr_t, mem_addr_t, const i8*, const i8*, u32);
+
+	virtual text_formatter& repeat(string&, pthread_t, const i8*, u64, u32);
+};
+
+}
+
+#endif
@@ -7,8 +7,9 @@
 	@brief Class instrument::thread definition
 */
 
-#include "./call.hpp"
-#include "./stack.hpp"
+#include "./context.hpp"
+#include "./control.hpp"
+#include "./recorder.hpp"
 
 namespace instrument {
 
@@ -20,7 +21,38 @@ namespace instrument {
 	to track a thread execution. The simulated call stack can be traversed using
 	simple callbacks and method thread::each. Currently only POSIX threads are
 	supported. As each thread object manipulates thread specific data, it can be
-	considered thread safe
+	considered thread safe. The simulated call stack is modified only by the
+	thread it tracks, under a per-thread lock that is never contended unless
+	another thread reads the stack (e.g to produce a trace), so the tracking
+	threads never serialize with each other. The simulated call stack is a
+	chunked array of plain frames (instrument::shadow_stack), so once a thread
+	reaches its maximum call depth, tracking calls doesn't allocate memory.
+
+	Stack modifications are published with a sequence counter (a seqlock), so
+	the thread locks itself only when its stack grows. Other threads copy a
+	consistent snapshot of the raw frames with thread::snapshot, retrying if
+	the stack was modified meanwhile, and symbolize it afterwards without
+	blocking the thread. When recording is on (see recorder::set_slots), each thread also keeps its
+	last function entry and exit events in a flight recorder
+
+	Each thread applies the control block configuration (sampling period and
+	plugin mask, see instrument::control) when it sees a new generation, and
+	starts over its simulated stack (see thread::resync)
+
+	While an exception propagates, the unwound calls are not popped off the
+	simulated stack, they're counted in the lag instead. The propagating
+	exceptions are counted by the interposed C++ runtime calls (see
+	thread::thrown and thread::caught), so tracking a call doesn't query the
+	C++ runtime
+
+	The simulated stack can be bounded and can fold recursion (see
+	instrument::shadow_stack), the lag still counts calls, so a folded frame or
+	the calls past the maximum depth are unwinded one call at a time. Use
+	thread::frame_of to find the frame of a call
+
+	A thread running fibers or coroutines switches its simulated stack with the
+	running context (see instrument::context and thread::switch_context), the
+	stack of the thread itself is kept aside meanwhile
 
 	@todo Use std::thread (C++11) class for portability
 	@todo Store the entry method (to detect thread exit)
@@ -29,8 +61,19 @@ class thread: virtual public object
 {
 protected:
 
+	/* Protected static variables */
+
+	static u64 s_serials;				/**< @brief Created thread count (the last serial number) */
+
+
 	/* Protected variables */
 
+	u64 m_serial;								/**< @brief
+																	 Serial number (unique in the process, upon
+																	 a reused thread ID too) */
+
+	pthread_mutex_t m_lock;			/**< @brief Simulated call stack access mutex */
+
 	pthread_t m_handle;					/**< @brief Thread handle */
 
 	i32 m_lag;									/**< @brief
@@ -38,12 +81,50 @@ protected:
 																	 the simulated stack for it to match the real
 																	 one */
 
+	u32 m_uncaught;							/**< @brief
+																	 Thrown exceptions not caught yet (see
+																	 thread::thrown) */
+
 	i8 *m_name;									/**< @brief Thread name */
 
-	stack<call> *m_stack;				/**< @brief Simulated call stack */
+	shadow_stack *m_stack;			/**< @brief Simulated call stack */
+
+	u32 m_seq;									/**< @brief
+																	 Simulated call stack sequence (odd while
+																	 the stack is modified) */
 
 	thread_status_t m_status;		/**< @brief Running status */
 
+	u32 *m_ticks;								/**< @brief
+																	 Call sampling counters (by function address
+																	 hash) */
+
+	u64 *m_sampled;							/**< @brief Sampled call bitmap (by real call depth) */
+
+	u32 m_sampled_slots;				/**< @brief Sampled call bitmap size (words) */
+
+	u32 m_depth;								/**< @brief Real call depth (call sampling mode) */
+
+	recorder *m_recorder;				/**< @brief Flight recorder (NULL if not recording) */
+
+	u32 m_slot;									/**< @brief Position in the process thread list */
+
+	u32 m_tracing;							/**< @brief
+																	 Applied control block tracing word (see
+																	 instrument::control) */
+
+	u32 m_period;								/**< @brief Call sampling period (0 for off) */
+
+	u32 m_plugin_mask;					/**< @brief Dispatched plugins (bit i for plugin i) */
+
+	context *m_active;					/**< @brief
+																	 Running context (NULL for the stack of the
+																	 thread itself) */
+
+	context *m_home;						/**< @brief
+																	 Context holding the stack of the thread
+																	 itself while another context runs */
+
 
 	/* Protected generic methods */
 
@@ -51,9 +132,16 @@ protected:
 
 	virtual thread& detach_from_process();
 
+	virtual thread& exchange(context*, context*);
+
 public:
 
-	typedef void (*callback_t)(u32, call*);
+	/* Friend classes and functions */
+
+	friend class process;
+
+
+	typedef void (*callback_t)(u32, const frame_t*);
 
 
 	/* Static methods */
@@ -76,36 +164,65 @@ public:
 
 	/* Accessor methods */
 
+	virtual context* active_context() const;
+
+	virtual u32 dropped_calls() const;
+
+	virtual recorder* get_recorder() const;
+
 	virtual	pthread_t handle() const;
 
 	virtual i32 lag() const;
 
 	virtual const i8* name() const;
 
+	virtual u32 plugin_mask() const;
+
+	virtual u32 sample_period() const;
+
+	virtual u32 sequence() const;
+
+	virtual u64 serial() const;
+
 	virtual thread& set_name(const i8*);
 
 	virtual thread_status_t status() const;
 
+	virtual u32 tracing() const;
+
 
 	/* Operator overloading methods */
 
 	virtual thread& operator=(const thread&);
 
-	virtual const call* operator[](u32) const;
+	virtual const frame_t* operator[](u32) const;
 
 
 	/* Generic methods */
 
-	virtual const call* backtrace(u32) const;
+	/* Access control */
+
+	virtual thread& lock() const;
+
+	virtual thread& unlock() const;
+
+
+	/* Call stack simulation methods */
+
+	virtual const frame_t* backtrace(u32) const;
 
 	virtual u32 call_depth() const;
 
-	virtual thread& called(mem_addr_t, mem_addr_t, const i8* = NULL);
+	virtual thread& called(mem_addr_t, mem_addr_t);
 
 	virtual thread& cancel();
 
+	virtual thread& caught();
+
 	virtual thread& each(const callback_t) const;
 
+	virtual i32 frame_of(u32, u32&) const;
+
 	virtual bool is(pthread_t) const;
 
 	virtual bool is(const i8*) const;
@@ -114,8 +231,24 @@ public:
 
 	virtual thread& join(void* = NULL);
 
+	virtual thread& record(u32, mem_addr_t, mem_addr_t);
+
+	virtual thread& resync(u32);
+
 	virtual thread& returned();
 
+	virtual bool sampled_call(mem_addr_t, u32);
+
+	virtual bool sampled_return();
+
+	virtual u32 snapshot(frame_t*, u32, u32&, u32* = NULL, u32* = NULL) const;
+
+	virtual context* switch_context(context*);
+
+	virtual thread& thrown();
+
+	virtual frame_t* top(u32 = 0);
+
 	virtual thread& unwind();
 };
 
@@ -7,14 +7,25 @@
 	@brief Class instrument::tracer definition
 */
 
+#include "./callgraph.hpp"
+#include "./control.hpp"
+#include "./crash.hpp"
+#include "./encoder.hpp"
+#include "./formatter.hpp"
+#include "./metrics.hpp"
 #include "./process.hpp"
+#include "./stack_delta.hpp"
 #include "./string.hpp"
 #ifdef WITH_FILTER
 #include "./filter.hpp"
+#include "./patcher.hpp"
 #endif
 #ifdef WITH_PLUGIN
 #include "./plugin.hpp"
 #endif
+#ifdef WITH_SLEDS
+#include "./sled.hpp"
+#endif
 
 namespace instrument {
 
@@ -36,7 +47,129 @@ namespace instrument {
 	The constructors of the class are protected so there is no way for the library
 	user to instantiate a tracer object. The library constructor (on_lib_load)
 	creates a global static tracer object to be used as interface to the library
-	facilities. All public methods are thread safe
+	facilities. All public methods are thread safe.
+
+	The tracer goes through an explicit initialization state machine,
+	uninitialized, loading, ready and shutting down (TRACER_* definitions). The
+	state is published with a single atomic variable, so checking if the tracer
+	is ready costs a single load.
+
+	The symbol tables are loaded in the library constructor by default. With the
+	INSTRUMENT_SYMBOLS shell variable set to 'lazy', only the module paths and
+	address ranges are recorded and each symbol table is loaded upon the first
+	lookup in its module. With 'background' the tables are also loaded on a
+	helper thread, after the tracer becomes ready. Eagerly loaded tables are
+	loaded after all the modules are collected, by a pool of loader threads
+	(INSTRUMENT_LOADERS shell variable, the online processor count by default)
+
+	Filters are evaluated once for each distinct function address. The verdict
+	is cached in a lock-free index, so a call to a filtered function costs a
+	single hash probe. The filter expressions of the same type (and case
+	sensitivity) are combined and compiled to a single regular expression
+
+	With the INSTRUMENT_PATCH shell variable set to 'on', the hook calls of the
+	filtered out functions are patched into NOPs the first time they're reached
+	(see instrument::patcher), so these functions run at native speed. When the
+	filters change, the patched calls are restored and the threads start over
+	their simulated stacks (see control::restart), as the functions running
+	meanwhile may return without calling the exit hook or call it unmatched
+
+	Plugins are dispatched from an immutable snapshot of their callbacks, taken
+	with a single atomic load, so plugins can be registered and unregistered at
+	any time. Each change publishes a new snapshot. The replaced snapshot (and
+	any unregistered plugin module) is disposed once its readers are done
+
+	The modules loaded after startup are registered as they're loaded:
+	dlopen(3) and dlclose(3) are interposed, a new module (if selected) is
+	added with a deferred symbol table and an unloaded module is dropped from
+	the module index (see tracer::on_dlopen and tracer::on_dlclose). The index
+	is republished each time, so the lookups in progress are not blocked. The
+	interposed dlopen searches a bare file name in the paths of the calling
+	object, not in the ones of libinstrument (see tracer::open_module)
+
+	The tracer is fork-aware: fork handlers hold the tracer and the process
+	locks across fork(2), then the child drops the threads of the parent and
+	starts its own loader and sampler threads, if any (see
+	tracer::on_fork_child). The symbol tables are inherited, so a forked worker
+	is instrumented without loading them again
+
+	With the INSTRUMENT_SAMPLING shell variable set to 'calls:N', only 1 out of N
+	calls of each function is simulated (and reported to the plugins). The other
+	calls only update a per thread depth bitmap, so their returns are skipped as
+	well and the simulated stacks stay consistent. With 'timer:N', every call is
+	simulated and a sampler thread snapshots all the simulated stacks every N
+	milliseconds, aggregating a flat profile (see tracer::samples)
+
+	With the INSTRUMENT_RECORDER shell variable set to 'on' (or to a record count
+	per thread), each thread records every function entry and exit in its own
+	flight recorder ring (instrument::recorder), before sampling. The latest
+	events of each thread are included in dumps (see tracer::history)
+
+	With the INSTRUMENT_CRASH shell variable set to a file path (or to 'stderr'),
+	crash signals dump the raw simulated call stacks of all threads, without
+	locking or allocating (see instrument::crash)
+
+	Programs running fibers or coroutines create an execution context
+	(instrument::context) for each of them and call context::switch_to along
+	with each switch, so each fiber has its own simulated stack. Dumps include
+	the stacks of the suspended contexts
+
+	Periodic dumps can be incremental: a delta dump (see instrument::stack_delta)
+	sends, as IDP v2 DELTA messages, only the stacks that changed since the
+	previous dump of the same collector, each as the depth of the prefix it
+	shares with its previous frames and the new frames
+
+	With WITH_METRICS, the library counts its own costs per thread (hook
+	invocations, contended locks, frame allocations, lookups, stream output
+	e.t.c, see instrument::metrics). The counters are merged on demand with
+	tracer::metrics, also as an IDP v2 METRICS message
+
+	With WITH_PLUGIN, the built-in latency plugin (instrument::latency) keeps a
+	per function histogram of the call durations. The median, the 99th and the
+	99.9th percentiles and the maximum of each function are output with
+	tracer::latencies, also as IDP v2 LATENCY messages. The built-in slow call
+	plugin (instrument::slow_call) captures the calls exceeding a latency
+	threshold, with their innermost callers, and the captures are drained with
+	tracer::slow_calls, also as IDP v2 SLOW messages. With the INSTRUMENT_SLOW
+	shell variable set to a threshold in microseconds, it's attached at load
+	time with this threshold for every function
+
+	With the INSTRUMENT_CONTROL shell variable set to 'on' (or to a file path),
+	the control block is mapped from /dev/shm/libinstrument.<pid> (or from the
+	file), so an external tool can switch tracing on and off, change the call
+	sampling period or mask plugins at runtime (see instrument::control). The
+	threads start over their simulated stacks upon each new generation
+
+	With WITH_SLEDS and the INSTRUMENT_SLEDS shell variable set to 'on', the
+	functions compiled with -fpatchable-function-entry=7,5 are traced as well,
+	through their patched entry sleds (see instrument::sled). The filtered out
+	functions get their sleds disabled, the filters re-enable all of them
+
+	With the INSTRUMENT_DEDUP shell variable set to 'on' (or to a window in
+	milliseconds), the exception traces are hashed by their raw frames, before
+	any symbolization. Only the first trace of each signature in a window is
+	output in full, the repeats are output as a single line with the signature
+	and the repeat count (see tracer::trace(string&)). The recent signatures
+	are kept in a bounded, least recently used cache
+
+	With the INSTRUMENT_MAX_DEPTH shell variable set to a frame count, the
+	simulated stacks store at most as many frames, the deeper calls are only
+	counted. With the INSTRUMENT_FOLD shell variable set to 'on', the repeated
+	calls of a recursion (same function, same call site) are folded into a
+	single frame (see instrument::shadow_stack). Traces show a folded frame once
+	with its repeat count and the dropped calls as a count
+
+	The traces can be laid out by any instrument::formatter, plain text, JSON
+	lines or binary IDP v2 (see tracer::trace(string&, formatter&)), directly
+	into the destination string, so passing a stream formats a trace straight
+	into its buffer
+
+	The hook bodies are templates over the optional features they serve
+	(filters, plugins and flight recording, HOOK_* definitions), so a feature
+	that is off costs nothing, not even a branch. A variant is instantiated for
+	every combination and the hooks dispatch through a pointer to the variant
+	that matches the current configuration, selected at load time and patched
+	whenever plugins, filters or recording change (see tracer::select_hooks)
 
 	@todo Implement plugin discovery (in system, user and custom directories)
 */
@@ -44,25 +177,259 @@ class tracer: virtual public object
 {
 protected:
 
+	/* Protected types */
+
+	/**
+		@brief DSO selection (the combined INSTRUMENT_LIBS expressions)
+	*/
+	struct dso_selection {
+		regex_t expr;											/**< @brief Combined expression */
+
+		bool none;												/**< @brief True if no DSO is selected */
+	};
+
+
+	/**
+		@brief Module scan (dl_iterate_phdr argument, see tracer::scan_modules)
+	*/
+	struct dso_scan {
+		const process *proc;							/**< @brief Process */
+
+		list<symtab> *found;							/**< @brief New module symbol tables (deferred) */
+
+		u32 reported;											/**< @brief Reported object count */
+
+		bool initial;											/**< @brief Library constructor scan */
+	};
+
+
+	/**
+		@brief Mapped module probe (dl_iterate_phdr argument, see tracer::on_dlclose)
+	*/
+	struct dso_probe {
+		const symtab *table;							/**< @brief Probed module */
+
+		bool found;												/**< @brief Module still mapped */
+	};
+
+
+	/**
+		@brief Symbol table loading job (shared by the loader pool)
+	*/
+	struct load_job {
+		const process *proc;							/**< @brief Process */
+
+		u32 next;													/**< @brief Next module index */
+	};
+
+
+	/**
+		@brief Recent exception trace signature
+	*/
+	struct trace_signature {
+		u64 hash;													/**< @brief Signature (frame hash) */
+
+		u64 window;												/**< @brief Window start (milliseconds) */
+
+		u64 used;													/**< @brief Last use tick (0 if free) */
+
+		u32 repeats;											/**< @brief Repeats in the window */
+	};
+
+
+	/**
+		@brief Specialized hook variant (see tracer::select_hooks)
+	*/
+	struct hook_variant {
+		u32 features;											/**< @brief Served features (HOOK_* definitions) */
+
+		void (*enter)(void*, void*, mem_addr_t);	/**< @brief Enter hook body */
+
+		void (*exit)(void*, void*, mem_addr_t);	/**< @brief Exit hook body */
+	};
+
+
+	/**
+		@brief Timer sampling counters of a function
+	*/
+	struct sample_counter {
+		mem_addr_t fn;										/**< @brief Function address */
+
+		u64 self;													/**< @brief Samples on top of a stack */
+
+		u64 total;												/**< @brief Samples anywhere in a stack */
+
+		u64 stamp;												/**< @brief Last counted tick */
+	};
+
+
+	/**
+		@brief Simulated call stack snapshot of a thread (see tracer::snapshot)
+	*/
+	struct stack_snapshot {
+		pthread_t id;											/**< @brief Thread ID */
+
+		u64 serial;												/**< @brief
+																					 Thread serial number (0 for a context,
+																					 see thread::serial) */
+
+		string name;											/**< @brief Thread name */
+
+		frame_t *frames;									/**< @brief Frames (NULL if the thread exited) */
+
+		u32 depth;												/**< @brief Frame count */
+
+		u32 dropped;											/**< @brief Calls past the maximum depth */
+
+		u32 seq;													/**< @brief
+																					 Stack sequence at the copy (odd if
+																					 unknown, see thread::snapshot) */
+
+		bool unchanged;										/**< @brief
+																					 Not copied, the stack is the one of the
+																					 previous delta dump */
+	};
+
+#ifdef WITH_PLUGIN
+
+	/**
+		@brief Immutable snapshot of the plugin callbacks (read-copy-update)
+	*/
+	struct plugin_table {
+		u32 size;													/**< @brief Plugin count */
+
+		modsym_t *begin;									/**< @brief Starting callbacks */
+
+		modsym_t *end;										/**< @brief Ending callbacks */
+
+		list<plugin> *retired;						/**< @brief
+																			 Plugins unregistered when the snapshot was
+																			 replaced (deleted with it, can be NULL) */
+
+		plugin_table *next;								/**< @brief Next retired snapshot */
+	};
+
+
+	/**
+		@brief Plugin snapshot reader count (padded to a cache line)
+	*/
+	struct reader_stripe {
+		u32 count;												/**< @brief Active reader count */
+
+		u8 pad[g_cacheline_sz - sizeof(u32)];	/**< @brief Padding */
+	};
+#endif
+
+
 	/* Protected static variables */
 
 	static tracer *s_iface;							/**< @brief Interface object */
 
+	static tracer_state_t s_state;			/**< @brief Initialization state */
+
 	static pthread_mutex_t s_lock;			/**< @brief Access mutex */
 
+	static u8 s_symtab_mode;						/**< @brief
+																			 Symbol table loading mode (SYMTAB_*
+																			 definitions) */
+
+	static pthread_t s_loader;					/**< @brief
+																			 Background symbol table loader thread (0 if
+																			 not started) */
+
+	static u8 s_sampling;								/**< @brief
+																			 Sampling mode (SAMPLING_* definitions) */
+
+	static u32 s_sample_period;					/**< @brief
+																			 Call sampling period (SAMPLING_CALLS) or
+																			 timer sampling interval in milliseconds
+																			 (SAMPLING_TIMER) */
+
+	static pthread_t s_sampler;					/**< @brief
+																			 Timer sampler thread (0 if not started) */
+
+	static u32 s_dedup_window;					/**< @brief
+																			 Exception trace deduplication window in
+																			 milliseconds (0 if off) */
+
+	static dso_selection *s_selection;	/**< @brief
+																			 DSO selection (NULL if all DSO are
+																			 selected) */
+
+	static pthread_mutex_t s_scan_lock;	/**< @brief Module scan mutex (dlopen and dlclose) */
+
+#ifdef WITH_SLEDS
+	static bool s_sleds;								/**< @brief Function entry sleds enabled */
+#endif
+
+#ifdef WITH_FILTER
+	static const bool s_verdicts[2];		/**< @brief Cached filter verdicts */
+#endif
+
+	static const hook_variant *s_hooks;	/**< @brief Selected hook variant */
+
+	static const hook_variant s_variants[HOOK_VARIANTS];	/**< @brief
+																												 Hook variants (by
+																												 feature set) */
+
 
 	/* Protected variables */
 
 #ifdef WITH_FILTER
 	list<filter> *m_filters;						/**< @brief Instrumentation filters */
+
+	list<filter> *m_compiled;						/**< @brief
+																			 Combined filters (one for each type and case
+																			 sensitivity) */
+
+	registry<mem_addr_t, const bool> *m_verdicts;	/**< @brief
+																						 Filter verdicts by function
+																						 address */
+
+	bool m_filtering;										/**< @brief True if any filter is registered */
+
+	u32 m_filter_generation;						/**< @brief
+																			 Control block filter generation of the
+																			 cached verdicts */
+
+	patcher *m_patcher;									/**< @brief
+																			 Hook call patcher (NULL if hot-patching is
+																			 off) */
+
+	pthread_mutex_t m_filter_lock;			/**< @brief Filter access mutex */
 #endif
 
 #ifdef WITH_PLUGIN
 	list<plugin> *m_plugins;						/**< @brief Instrumentation plugins */
+
+	plugin_table *m_snapshot;						/**< @brief
+																			 Published plugin snapshot (NULL if no plugin
+																			 is registered) */
+
+	plugin_table *m_retired;						/**< @brief Snapshots pending disposal */
+
+	reader_stripe m_readers[g_plugin_stripes];	/**< @brief
+																							 Snapshot readers (by
+																							 thread ID hash) */
 #endif
 
 	process *m_proc;										/**< @brief Process handle */
 
+	registry<mem_addr_t, sample_counter> *m_sample_index;	/**< @brief
+																						 Timer sampling counters by
+																						 function address */
+
+	list<sample_counter> *m_samples;		/**< @brief Timer sampling counters */
+
+	u64 m_sample_ticks;									/**< @brief Timer samples taken */
+
+	trace_signature *m_signatures;			/**< @brief
+																			 Recent exception trace signatures
+																			 (g_dedup_sets sets of g_dedup_ways, NULL if
+																			 deduplication is off) */
+
+	u64 m_signature_ticks;							/**< @brief Signature uses (LRU order) */
+
 
 	/* Protected static methods */
 
@@ -74,10 +441,80 @@ protected:
 
 	static void __on_lib_unload()	__attribute((destructor));
 
-	static string& addr2line(string&, const i8*, mem_addr_t);
+	static i32 by_self_samples(const sample_counter*, const sample_counter*);
+
+	static bool crash_path(string&);
+
+	static u32 dedup_window();
+
+	static u32 depth_limit();
+
+	static void dso_range(const dl_phdr_info*, mem_addr_t&, mem_addr_t&);
+
+	template <u32 F> static void enter_hook(void*, void*, mem_addr_t);
+
+	template <u32 F> static void exit_hook(void*, void*, mem_addr_t);
+
+	static bool folding_mode();
+
+	static u32 hook_features();
+
+	static void load_modules(const process*);
+
+	static void* load_symbols(void*);
+
+	static void* load_worker(void*);
+
+	static u32 loader_count();
+
+	static u8 loading_mode();
 
 	static i32 on_dso_load(dl_phdr_info*, size_t, void*);
 
+	static i32 on_dso_probe(dl_phdr_info*, size_t, void*);
+
+	static void on_fork_child();
+
+	static void on_fork_parent();
+
+	static void on_fork_prepare();
+
+#ifdef WITH_FILTER
+	static bool patching_mode();
+#endif
+
+	static u32 recording_size();
+
+	static void release_snapshots(stack_snapshot*, u32);
+
+	static void* sample_stacks(void*);
+
+	static u8 sampling_mode(u32&);
+
+	static bool select_dso(dso_selection&, const chain<string>*);
+
+	static u32 scan_modules(process*, bool);
+
+	static Dl_serinfo* search_paths(const void*);
+
+	static u64 signature(const thread*, i32);
+
+#ifdef WITH_PLUGIN
+	static u64 slow_threshold();
+#endif
+
+	static const i8* source_line(const symtab*, mem_addr_t);
+
+#ifdef WITH_SLEDS
+	static bool sled_mode();
+#endif
+
+#ifdef WITH_PLUGIN
+	static void release_plugins(plugin_table*);
+
+	static u32 stripe();
+#endif
+
 
 	/* Protected constructors, copy constructors and destructor */
 
@@ -97,14 +534,58 @@ protected:
 
 	/* Protected generic methods */
 
+	virtual u32 deduplicate(u64);
+
 	virtual tracer& destroy();
 
+	virtual tracer& format_trace(string&, formatter&, const stack_snapshot&) const;
+
+	virtual tracer& sample();
+
+	virtual frame_t* snapshot(pthread_t, u32&, string&, u32* = NULL, u32* = NULL) const;
+
+	virtual stack_snapshot* snapshot_threads(u32&, bool, const stack_delta* = NULL) const;
+
+	virtual tracer& symbolize(string&, formatter&, const frame_t*, u32) const;
+
+#ifdef WITH_PLUGIN
+	virtual tracer& publish_plugins(list<plugin>*);
+
+	virtual tracer& reclaim_plugins();
+#endif
+
+#ifdef WITH_FILTER
+	virtual tracer& compile_filters();
+
+	virtual bool verdict(mem_addr_t);
+#endif
+
 public:
 
 	/* Static methods */
 
 	static tracer* interface();
 
+	static void on_catch();
+
+	static void on_dlclose();
+
+	static void on_dlopen(void*);
+
+	static void on_enter(void*, void*, mem_addr_t);
+
+	static void on_exit(void*, void*, mem_addr_t);
+
+	static void on_throw();
+
+	static void* open_module(const i8*, i32, const void*);
+
+	static u32 sample_period();
+
+	static void select_hooks();
+
+	static tracer_state_t state();
+
 	static void lock();
 
 	static void unlock();
@@ -122,17 +603,70 @@ public:
 
 	/* Generic methods */
 
+	virtual tracer& resync(thread*, u32);
+
+
 	/* Trace producing methods */
 
+	virtual tracer& dump(encoder&) const;
+
+	virtual tracer& dump(encoder&, stack_delta&) const;
+
 	virtual tracer& dump(string&) const;
 
+	virtual tracer& dump(string&, formatter&) const;
+
+	virtual tracer& trace(encoder&);
+
+	virtual tracer& trace(encoder&, pthread_t) const;
+
 	virtual tracer& trace(string&);
 
 	virtual tracer& trace(string&, pthread_t) const;
 
+	virtual tracer& trace(string&, formatter&);
+
+	virtual tracer& trace(string&, formatter&, pthread_t) const;
+
 	virtual tracer& unwind();
 
 
+	/* Sampling methods */
+
+	virtual u64 sample_count() const;
+
+	virtual tracer& samples(string&) const;
+
+
+	/* Flight recorder methods */
+
+	virtual tracer& history(string&, pthread_t, u32 = g_recorder_dump_sz) const;
+
+
+	/* Latency methods */
+
+#ifdef WITH_PLUGIN
+	virtual tracer& latencies(encoder&) const;
+
+	virtual tracer& latencies(string&) const;
+
+	virtual tracer& slow_calls(encoder&) const;
+
+	virtual tracer& slow_calls(string&) const;
+#endif
+
+
+	/* Self-metrics methods */
+
+#ifdef WITH_METRICS
+	virtual tracer& metrics(encoder&) const;
+
+	virtual tracer& metrics(string&) const;
+
+	virtual tracer& metrics(u64*) const;
+#endif
+
+
 	/* Filter handling methods */
 
 #ifdef WITH_FILTER
@@ -146,7 +680,13 @@ public:
 
 	virtual filter* get_filter(u32) const;
 
+	virtual bool is_filtered(mem_addr_t);
+
+	virtual u32 patch_count() const;
+
 	virtual tracer& remove_filter(u32);
+
+	virtual tracer& unhook(mem_addr_t, mem_addr_t, mem_addr_t);
 #endif
 
 
@@ -157,9 +697,9 @@ public:
 
 	virtual const plugin* add_plugin(modsym_t, modsym_t);
 
-	virtual tracer& begin_plugins(void*, void*) const;
+	virtual tracer& begin_plugins(void*, void*, u32 = ~0U) const;
 
-	virtual tracer& end_plugins(void*, void*) const;
+	virtual tracer& end_plugins(void*, void*, u32 = ~0U) const;
 
 	virtual const plugin* get_plugin(const i8*) const;
 
@@ -24,13 +24,70 @@ protected:
 
 	static pthread_mutex_t s_global_lock;		/**< @brief Global access mutex */
 
+	static const i8 *s_mem_kernel;					/**< @brief Selected memory kernel name */
+
+	static i32 (*s_memcmp)(const void*, const void*, u32);	/**< @brief memcmp kernel */
+
+	static void* (*s_memcpy)(void*, const void*, u32);			/**< @brief memcpy kernel */
+
+	static void* (*s_memset)(void*, u8, u32);								/**< @brief memset kernel */
+
+	static void* (*s_memswap)(void*, u32);									/**< @brief memswap kernel */
+
 
 	/* Protected static methods */
 
+	static void dispatch();
+
 	static void on_lib_load()	__attribute((constructor));
 
 	static void on_lib_unload()	__attribute((destructor));
 
+
+	/* Memory kernels (util::dispatch selects one set on first use) */
+
+	static i32 memcmp_resolve(const void*, const void*, u32);
+
+	static void* memcpy_resolve(void*, const void*, u32);
+
+	static void* memset_resolve(void*, u8, u32);
+
+	static void* memswap_resolve(void*, u32);
+
+	static i32 memcmp_scalar(const void*, const void*, u32);
+
+	static void* memcpy_scalar(void*, const void*, u32);
+
+	static void* memset_scalar(void*, u8, u32);
+
+	static void* memswap_scalar(void*, u32);
+
+#if defined __x86_64__ || defined __i386__
+	static i32 memcmp_avx2(const void*, const void*, u32)	__attribute((target("avx2")));
+
+	static void* memcpy_avx2(void*, const void*, u32)			__attribute((target("avx2")));
+
+	static void* memset_avx2(void*, u8, u32)								__attribute((target("avx2")));
+
+	static void* memswap_avx2(void*, u32)									__attribute((target("avx2")));
+
+	static i32 memcmp_sse2(const void*, const void*, u32)	__attribute((target("sse2")));
+
+	static void* memcpy_sse2(void*, const void*, u32)			__attribute((target("sse2")));
+
+	static void* memset_sse2(void*, u8, u32)								__attribute((target("sse2")));
+
+	static void* memswap_sse2(void*, u32)									__attribute((target("sse2")));
+#elif defined __ARM_NEON
+	static i32 memcmp_neon(const void*, const void*, u32);
+
+	static void* memcpy_neon(void*, const void*, u32);
+
+	static void* memset_neon(void*, u8, u32);
+
+	static void* memswap_neon(void*, u32);
+#endif
+
 public:
 
 	/* Generic methods */
@@ -58,6 +115,8 @@ public:
 
 	static void lock();
 
+	static const i8* mem_kernel();
+
 	static i32 memcmp(const void*, const void*, u32);
 
 	static void* memcpy(void*, const void*, u32);
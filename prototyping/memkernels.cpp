@@ -0,0 +1,225 @@
+#include "../include/util.hpp"
+
+#include <algorithm>
+
+/**
+	@file prototyping/memkernels.cpp
+
+	@brief Memory kernel microbenchmark
+
+	Times util::memcpy, util::memset, util::memcmp and util::memswap against the
+	former bytewise loops and against libc, for several block sizes. Link with
+	libinstrument and select the kernels to compare with INSTRUMENT_MEMKERNEL
+	(e.g INSTRUMENT_MEMKERNEL=scalar ./memkernels)
+*/
+
+using namespace instrument;
+
+
+/**
+ * @brief Block sizes benchmarked
+ */
+static const u32 g_sizes[] = {16, 64, 256, 4096, 65536};
+
+/**
+ * @brief Bytes processed per benchmark run
+ */
+static const u64 g_volume = 1ULL << 28;
+
+
+/**
+ * @brief Former util::memcmp loop (bytewise)
+ */
+static i32 byte_memcmp(const void *b1, const void *b2, u32 sz)
+{
+	const u8 *p1 = static_cast<const u8*> (b1);
+	const u8 *p2 = static_cast<const u8*> (b2);
+	while ( likely(sz-- > 0) ) {
+		i32 diff = static_cast<i32> (*(p1++)) - *(p2++);
+
+		if ( likely(diff != 0) ) {
+			return diff;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Former util::memcpy loop (bytewise)
+ */
+static void* byte_memcpy(void *dst, const void *src, u32 sz)
+{
+	u8 *d = static_cast<u8*> (dst);
+	const u8 *s = static_cast<const u8*> (src);
+	while ( likely(sz-- > 0) ) {
+		*(d++) = *(s++);
+	}
+
+	return dst;
+}
+
+
+/**
+ * @brief Former util::memset loop (bytewise)
+ */
+static void* byte_memset(void *mem, u8 val, u32 sz)
+{
+	u8 *p = static_cast<u8*> (mem);
+	while ( likely(sz-- > 0) ) {
+		*(p++) = val;
+	}
+
+	return mem;
+}
+
+
+/**
+ * @brief Former util::memswap loop (bytewise)
+ */
+static void* byte_memswap(void *mem, u32 sz)
+{
+	u8 *l = static_cast<u8*> (mem);
+	u8 *r = l + sz - 1;
+	while ( likely(l < r) ) {
+		u8 tmp = *l;
+		*(l++) = *r;
+		*(r--) = tmp;
+	}
+
+	return mem;
+}
+
+
+/**
+ * @brief libc based byte reversal (no libc equivalent, a std::reverse loop)
+ */
+static void* libc_memswap(void *mem, u32 sz)
+{
+	u8 *p = static_cast<u8*> (mem);
+	std::reverse(p, p + sz);
+	return mem;
+}
+
+
+/**
+ * @brief libc memcmp adapter
+ */
+static i32 libc_memcmp(const void *b1, const void *b2, u32 sz)
+{
+	return memcmp(b1, b2, sz);
+}
+
+
+/**
+ * @brief libc memcpy adapter
+ */
+static void* libc_memcpy(void *dst, const void *src, u32 sz)
+{
+	return memcpy(dst, src, sz);
+}
+
+
+/**
+ * @brief libc memset adapter
+ */
+static void* libc_memset(void *mem, u8 val, u32 sz)
+{
+	return memset(mem, val, sz);
+}
+
+
+/**
+ * @brief Get the monotonic clock time
+ *
+ * @returns the time in nanoseconds
+ */
+static u64 now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<u64> (ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * @brief Print the throughput of a benchmark run
+ *
+ * @param[in] op the operation name
+ *
+ * @param[in] impl the implementation name
+ *
+ * @param[in] sz the block size
+ *
+ * @param[in] ns the run time in nanoseconds
+ */
+static void report(const i8 *op, const i8 *impl, u32 sz, u64 ns)
+{
+	printf("%-8s %-8s %6u %10.2f GB/s\n", op, impl, sz, static_cast<double> (g_volume) / ns);
+}
+
+
+/**
+ * @brief Benchmark the memory kernels
+ *
+ * @returns EXIT_SUCCESS
+ */
+int main()
+{
+	u8 *b1 = new u8[g_sizes[sizeof(g_sizes) / sizeof(u32) - 1]];
+	u8 *b2 = new u8[g_sizes[sizeof(g_sizes) / sizeof(u32) - 1]];
+	volatile i32 sink = 0;
+
+	printf("kernel %s\n", util::mem_kernel());
+
+	for (u32 i = 0; likely(i < sizeof(g_sizes) / sizeof(u32)); i++) {
+		u32 sz = g_sizes[i];
+		u64 runs = g_volume / sz;
+
+		memset(b1, 0x5a, sz);
+
+		i32 (*cmp[])(const void*, const void*, u32) = {byte_memcmp, util::memcmp, libc_memcmp};
+		void* (*cpy[])(void*, const void*, u32) = {byte_memcpy, util::memcpy, libc_memcpy};
+		void* (*set[])(void*, u8, u32) = {byte_memset, util::memset, libc_memset};
+		void* (*swap[])(void*, u32) = {byte_memswap, util::memswap, libc_memswap};
+		const i8 *impl[] = {"bytewise", util::mem_kernel(), "libc"};
+
+		for (u32 j = 0; likely(j < 3); j++) {
+			/* The blocks are equal, so memcmp compares all the bytes */
+			memset(b2, 0x5a, sz);
+
+			u64 start = now();
+			for (u64 k = 0; likely(k < runs); k++) {
+				sink += cmp[j](b1, b2, sz);
+				__asm__ __volatile__("" : : "r" (b1), "r" (b2) : "memory");
+			}
+			report("memcmp", impl[j], sz, now() - start);
+
+			start = now();
+			for (u64 k = 0; likely(k < runs); k++) {
+				cpy[j](b2, b1, sz);
+				__asm__ __volatile__("" : : "r" (b2) : "memory");
+			}
+			report("memcpy", impl[j], sz, now() - start);
+
+			start = now();
+			for (u64 k = 0; likely(k < runs); k++) {
+				set[j](b2, k, sz);
+				__asm__ __volatile__("" : : "r" (b2) : "memory");
+			}
+			report("memset", impl[j], sz, now() - start);
+
+			start = now();
+			for (u64 k = 0; likely(k < runs); k++) {
+				swap[j](b2, sz);
+				__asm__ __volatile__("" : : "r" (b2) : "memory");
+			}
+			report("memswap", impl[j], sz, now() - start);
+		}
+	}
+
+	delete[] b1;
+	delete[] b2;
+	return EXIT_SUCCESS;
+}
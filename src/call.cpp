@@ -26,6 +26,22 @@ m_site(site)
 }
 
 
+/**
+ * @brief Object constructor (view of a simulated call stack frame)
+ *
+ * @param[in] f the frame
+ *
+ * @param[in] nm the called function name (NULL if unresolved)
+ *
+ * @throws std::bad_alloc
+ */
+call::call(const frame_t &f, const i8 *nm):
+symbol(f.fn, nm),
+m_site(f.site)
+{
+}
+
+
 /**
  * @brief Object copy constructor
  *
@@ -63,6 +79,23 @@ inline call* call::clone() const
 }
 
 
+/**
+ * @brief Get the simulated call stack frame of the call
+ *
+ * @returns the frame (called function and call site addresses)
+ */
+inline frame_t call::frame() const
+{
+	frame_t retval;
+	retval.fn = m_addr;
+	retval.site = m_site;
+	retval.stamp = 0;
+	retval.children = 0;
+	retval.repeats = 1;
+	return retval;
+}
+
+
 /**
  * @brief Get the call site address
  *
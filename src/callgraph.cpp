@@ -0,0 +1,756 @@
+#include "../include/tracer.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/callgraph.cpp
+
+	@brief Class instrument::callgraph method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+__thread callgraph::tree *callgraph::s_tree = NULL;
+
+callgraph::tree *callgraph::s_trees = NULL;
+
+bool callgraph::s_enabled = false;
+
+u32 callgraph::s_generation = 0;
+
+
+/**
+ * @brief Allocate an empty prefix tree
+ *
+ * @returns the tree (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+callgraph::tree* callgraph::alloc()
+{
+	tree *retval = new tree;
+	memset(retval, 0, sizeof(tree));
+	retval->cursor = &retval->root;
+
+	try {
+		retval->slots = g_callgraph_chunk_sz;
+		retval->index = new node*[retval->slots];
+		memset(retval->index, 0, retval->slots * sizeof(node*));
+	}
+	catch (...) {
+		delete retval;
+		throw;
+	}
+
+	return retval;
+}
+
+
+/**
+ * @brief Compare two edges by caller and callee address
+ *
+ * @param[in] a the first edge
+ *
+ * @param[in] b the second edge
+ *
+ * @returns a negative, zero or positive value (list::comparator_t)
+ */
+i32 callgraph::by_edge(const edge *a, const edge *b)
+{
+	if ( likely(a->caller != b->caller) ) {
+		return (a->caller < b->caller) ? -1 : 1;
+	}
+
+	if ( likely(a->callee != b->callee) ) {
+		return (a->callee < b->callee) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Find (or insert) the callee path of a path
+ *
+ * @param[in,out] t the tree
+ *
+ * @param[in] parent the caller path
+ *
+ * @param[in] fn the callee address
+ *
+ * @returns the callee path
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The index is private to the tree writer. A new node is linked to its parent
+ *	last, so a concurrent export never reaches a partially initialized node
+ */
+callgraph::node* callgraph::child(tree *t, node *parent, mem_addr_t fn)
+{
+	u32 mask = t->slots - 1;
+	u32 i = hash(parent, fn) & mask;
+
+	for (node *cur = t->index[i]; likely(cur != NULL); cur = t->index[i]) {
+		if ( likely(cur->parent == parent && cur->fn == fn) ) {
+			return cur;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	/* Keep the index load factor at or below 1/2 */
+	if ( unlikely(2 * (t->used + 1) > t->slots) ) {
+		u32 slots = 2 * t->slots;
+		node **index = new node*[slots];
+		memset(index, 0, slots * sizeof(node*));
+
+		for (u32 j = 0; likely(j < t->slots); j++) {
+			node *cur = t->index[j];
+			if ( likely(cur == NULL) ) {
+				continue;
+			}
+
+			u32 k = hash(cur->parent, cur->fn) & (slots - 1);
+			while ( likely(index[k] != NULL) ) {
+				k = (k + 1) & (slots - 1);
+			}
+
+			index[k] = cur;
+		}
+
+		delete[] t->index;
+		t->index = index;
+		t->slots = slots;
+
+		mask = slots - 1;
+		i = hash(parent, fn) & mask;
+		while ( likely(t->index[i] != NULL) ) {
+			i = (i + 1) & mask;
+		}
+	}
+
+	if ( unlikely(t->free == 0) ) {
+		chunk *c = new chunk;
+		c->next = t->chunks;
+		t->chunks = c;
+		t->free = g_callgraph_chunk_sz;
+	}
+
+	node *retval = &t->chunks->nodes[g_callgraph_chunk_sz - t->free--];
+	retval->fn = fn;
+	retval->calls = 0;
+	retval->parent = parent;
+	retval->child = NULL;
+	retval->sibling = parent->child;
+
+	t->index[i] = retval;
+	t->used++;
+
+	store_release(&parent->child, retval);
+	return retval;
+}
+
+
+/**
+ * @brief Release a prefix tree
+ *
+ * @param[in] t the tree (can be NULL for NO-OP)
+ */
+void callgraph::dispose(tree *t)
+{
+	if ( unlikely(t == NULL) ) {
+		return;
+	}
+
+	while ( likely(t->chunks != NULL) ) {
+		chunk *c = t->chunks;
+		t->chunks = c->next;
+		delete c;
+	}
+
+	delete[] t->index;
+	delete t;
+}
+
+
+/**
+ * @brief Hash a (caller path, callee address) pair
+ *
+ * @param[in] parent the caller path
+ *
+ * @param[in] fn the callee address
+ *
+ * @returns the pair hash
+ */
+inline u32 callgraph::hash(const node *parent, mem_addr_t fn)
+{
+	u64 h = reinterpret_cast<u64> (parent) ^ (static_cast<u64> (fn) << 1);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return static_cast<u32> (h);
+}
+
+
+/**
+ * @brief Merge the prefix trees of all threads
+ *
+ * @returns the merged tree (heap allocated)
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The trees are traversed in pre-order without recursion, following the
+ *	published child and sibling links, while their threads keep writing them
+ */
+callgraph::tree* callgraph::merge()
+{
+	tree *retval = alloc();
+
+	try {
+		for (tree *t = load_acquire(&s_trees); likely(t != NULL); t = t->next) {
+			const node *cur = load_acquire(&t->root.child);
+			node *dst = &retval->root;
+
+			while ( likely(cur != NULL) ) {
+				node *merged = child(retval, dst, cur->fn);
+				merged->calls += cur->calls;
+
+				/* Descend, or move to the next sibling, or climb */
+				const node *next = load_acquire(&cur->child);
+				if ( likely(next != NULL) ) {
+					dst = merged;
+					cur = next;
+					continue;
+				}
+
+				while ( likely(cur != NULL) ) {
+					if ( likely(cur->sibling != NULL) ) {
+						cur = cur->sibling;
+						break;
+					}
+
+					cur = cur->parent;
+					dst = dst->parent;
+					if ( unlikely(cur == &t->root) ) {
+						cur = NULL;
+					}
+				}
+			}
+		}
+
+		return retval;
+	}
+	catch (...) {
+		dispose(retval);
+		throw;
+	}
+}
+
+
+/**
+ * @brief Append the name of a function (or its address, if unresolved)
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] f the symbolized function
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ */
+string& callgraph::name(string &dst, const function *f)
+{
+	if ( likely(f->name != NULL) ) {
+		return dst.concat(f->name, strlen(f->name));
+	}
+
+	return dst.append("0x%llx", static_cast<u64> (f->fn));
+}
+
+
+/**
+ * @brief Append a length delimited protobuf field to a string
+ *
+ * @param[in,out] dst the destination string (binary)
+ *
+ * @param[in] field the field number
+ *
+ * @param[in] val the field value
+ *
+ * @throws std::bad_alloc
+ */
+void callgraph::pb_bytes(string &dst, u32 field, const string &val)
+{
+	pb_varint(dst, (field << 3) | 2);
+	pb_varint(dst, val.length());
+	dst.concat(val.cstring(), val.length());
+}
+
+
+/**
+ * @brief Append a protobuf (LEB128) varint to a string
+ *
+ * @param[in,out] dst the destination string (binary)
+ *
+ * @param[in] val the value
+ *
+ * @throws std::bad_alloc
+ */
+void callgraph::pb_varint(string &dst, u64 val)
+{
+	i8 bytes[10];
+	u32 len = 0;
+
+	while ( unlikely(val >= 0x80) ) {
+		bytes[len++] = static_cast<i8> (val | 0x80);
+		val >>= 7;
+	}
+
+	bytes[len++] = static_cast<i8> (val);
+	dst.concat(bytes, len);
+}
+
+
+/**
+ * @brief Get (or add) a distinct function of an export
+ *
+ * @param[in,out] funcs the distinct functions (by ID - 1)
+ *
+ * @param[in,out] index the distinct functions (by address)
+ *
+ * @param[in] fn the function address
+ *
+ * @returns the function
+ *
+ * @throws std::bad_alloc
+ */
+callgraph::function* callgraph::symbolize(list<function> &funcs,
+																					registry<mem_addr_t, function> &index,
+																					mem_addr_t fn)
+{
+	function *retval = index.find(fn);
+	if ( likely(retval != NULL) ) {
+		return retval;
+	}
+
+	retval = new function;
+	retval->fn = fn;
+	retval->name = NULL;
+	retval->id = funcs.size() + 1;
+
+	try {
+		funcs.add(retval);
+	}
+	catch (...) {
+		delete retval;
+		throw;
+	}
+
+	index.insert(fn, retval);
+	return retval;
+}
+
+
+/**
+ * @brief Collect and symbolize the distinct functions of a tree
+ *
+ * @param[in] t the (merged) tree
+ *
+ * @param[in,out] funcs the distinct functions (by ID - 1)
+ *
+ * @param[in,out] index the distinct functions (by address)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note The names are looked up in one pass, after the functions are collected
+ */
+void callgraph::symbolize(tree *t, list<function> &funcs,
+													registry<mem_addr_t, function> &index)
+{
+	for (chunk *c = t->chunks; likely(c != NULL); c = c->next) {
+		u32 used = (likely(c == t->chunks)) ? g_callgraph_chunk_sz - t->free
+																				: g_callgraph_chunk_sz;
+
+		for (u32 i = 0; likely(i < used); i++) {
+			symbolize(funcs, index, c->nodes[i].fn);
+		}
+	}
+
+	const process *proc = process::current();
+	for (u32 i = 0, sz = funcs.size(); likely(i < sz); i++) {
+		function *f = funcs[i];
+		f->name = proc->lookup(f->fn);
+	}
+}
+
+
+/**
+ * @brief Count a call of the current thread
+ *
+ * @param[in] fn the called function address
+ *
+ * @throws std::bad_alloc
+ *
+ * @note NO-OP if the call graph is disabled
+ */
+void callgraph::called(mem_addr_t fn)
+{
+	if ( likely(!load_acquire(&s_enabled)) ) {
+		return;
+	}
+
+	tree *t = s_tree;
+	if ( unlikely(t == NULL) ) {
+		t = alloc();
+		t->generation = load_acquire(&s_generation);
+
+		/* Lock-free push, the trees are never removed */
+		do {
+			t->next = load_acquire(&s_trees);
+		} while ( unlikely(!compare_swap(&s_trees, t->next, t)) );
+
+		s_tree = t;
+	}
+
+	/* The cursor is stale if the call graph was disabled meanwhile */
+	u32 gen = load_acquire(&s_generation);
+	if ( unlikely(t->generation != gen) ) {
+		t->generation = gen;
+		t->cursor = &t->root;
+	}
+
+	node *n = child(t, t->cursor, fn);
+	n->calls++;
+	t->cursor = n;
+}
+
+
+/**
+ * @brief Stop aggregating calls (the aggregated calls are kept)
+ */
+void callgraph::disable()
+{
+	store_release(&s_enabled, false);
+}
+
+
+/**
+ * @brief Start aggregating calls
+ *
+ * @note The calls in progress are aggregated as if they were called from the root
+ */
+void callgraph::enable()
+{
+	fetch_add(&s_generation, 1);
+	store_release(&s_enabled, true);
+}
+
+
+/**
+ * @brief Check if calls are aggregated
+ *
+ * @returns callgraph::s_enabled
+ */
+bool callgraph::is_enabled()
+{
+	return load_acquire(&s_enabled);
+}
+
+
+/**
+ * @brief Count a return of the current thread
+ *
+ * @note
+ *	NO-OP if the call graph is disabled. A return from a call made before the
+ *	call graph was enabled leaves the cursor at the root
+ */
+void callgraph::returned()
+{
+	if ( likely(!load_acquire(&s_enabled)) ) {
+		return;
+	}
+
+	tree *t = s_tree;
+	if ( unlikely(t == NULL || t->generation != load_acquire(&s_generation)) ) {
+		return;
+	}
+
+	if ( likely(t->cursor != &t->root) ) {
+		t->cursor = t->cursor->parent;
+	}
+}
+
+
+/**
+ * @brief
+ *	Move the cursor of the current thread back to the root (e.g when its
+ *	simulated stack starts over)
+ */
+void callgraph::rewind()
+{
+	tree *t = s_tree;
+	if ( likely(t != NULL) ) {
+		t->cursor = &t->root;
+	}
+}
+
+
+/**
+ * @brief Append the caller to callee edges to a string
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note Each line is the call count, the caller and the callee name
+ */
+string& callgraph::edges(string &dst)
+{
+	tree *t = merge();
+
+	try {
+		list<function> funcs;
+		registry<mem_addr_t, function> index;
+		symbolize(t, funcs, index);
+
+		/* Edges of different paths are coalesced after sorting */
+		list<edge> all;
+		for (chunk *c = t->chunks; likely(c != NULL); c = c->next) {
+			u32 used = (likely(c == t->chunks)) ? g_callgraph_chunk_sz - t->free
+																					: g_callgraph_chunk_sz;
+
+			for (u32 i = 0; likely(i < used); i++) {
+				const node *n = &c->nodes[i];
+				if ( unlikely(n->parent == &t->root) ) {
+					continue;
+				}
+
+				edge *e = new edge;
+				e->caller = n->parent->fn;
+				e->callee = n->fn;
+				e->calls = n->calls;
+
+				try {
+					all.add(e);
+				}
+				catch (...) {
+					delete e;
+					throw;
+				}
+			}
+		}
+
+		all.sort(by_edge);
+
+		for (u32 i = 0, sz = all.size(); likely(i < sz);) {
+			const edge *e = all[i];
+
+			u64 calls = 0;
+			for (; likely(i < sz && by_edge(all[i], e) == 0); i++) {
+				calls += all[i]->calls;
+			}
+
+			dst.append("%llu ", calls);
+			name(dst, index.find(e->caller));
+			dst.append(" -> ");
+			name(dst, index.find(e->callee));
+			dst.append("\n");
+		}
+
+		dispose(t);
+		return dst;
+	}
+	catch (...) {
+		dispose(t);
+		throw;
+	}
+}
+
+
+/**
+ * @brief Append the stack paths to a string, as folded stacks
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	Each line is a path, the function names from the outermost call separated
+ *	by ';', and the call count of the path (the flamegraph.pl input format)
+ */
+string& callgraph::folded(string &dst)
+{
+	tree *t = merge();
+	const node **path = NULL;
+
+	try {
+		list<function> funcs;
+		registry<mem_addr_t, function> index;
+		symbolize(t, funcs, index);
+
+		u32 slots = g_memblock_sz;
+		path = new const node*[slots];
+
+		for (chunk *c = t->chunks; likely(c != NULL); c = c->next) {
+			u32 used = (likely(c == t->chunks)) ? g_callgraph_chunk_sz - t->free
+																					: g_callgraph_chunk_sz;
+
+			for (u32 i = 0; likely(i < used); i++) {
+				const node *n = &c->nodes[i];
+
+				u32 depth = 0;
+				for (const node *cur = n; likely(cur != &t->root); cur = cur->parent) {
+					if ( unlikely(depth == slots) ) {
+						const node **grown = new const node*[2 * slots];
+						memcpy(grown, path, slots * sizeof(const node*));
+						delete[] path;
+						path = grown;
+						slots *= 2;
+					}
+
+					path[depth++] = cur;
+				}
+
+				while ( likely(depth > 0) ) {
+					name(dst, index.find(path[--depth]->fn));
+					dst.append((likely(depth > 0)) ? ";" : " ");
+				}
+
+				dst.append("%llu\n", n->calls);
+			}
+		}
+
+		delete[] path;
+		dispose(t);
+		return dst;
+	}
+	catch (...) {
+		delete[] path;
+		dispose(t);
+		throw;
+	}
+}
+
+
+/**
+ * @brief Append the stack paths to a string, as a pprof profile
+ *
+ * @param[in,out] dst the destination string (binary)
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The profile is an uncompressed perftools.profiles.Profile protobuf message,
+ *	with one "calls/count" sample per path and one location (and function) per
+ *	distinct function. The pprof tool reads it as is
+ */
+string& callgraph::pprof(string &dst)
+{
+	tree *t = merge();
+
+	try {
+		list<function> funcs;
+		registry<mem_addr_t, function> index;
+		symbolize(t, funcs, index);
+
+		string msg, field;
+
+		/* Field 1, sample_type: {type: "calls", unit: "count"} (strings 1 and 2) */
+		field.clear();
+		pb_varint(field, 1 << 3);
+		pb_varint(field, 1);
+		pb_varint(field, 2 << 3);
+		pb_varint(field, 2);
+		pb_bytes(dst, 1, field);
+
+		/* Field 2, samples: {location_id (packed, leaf first), value (packed)} */
+		for (chunk *c = t->chunks; likely(c != NULL); c = c->next) {
+			u32 used = (likely(c == t->chunks)) ? g_callgraph_chunk_sz - t->free
+																					: g_callgraph_chunk_sz;
+
+			for (u32 i = 0; likely(i < used); i++) {
+				const node *n = &c->nodes[i];
+
+				field.clear();
+				for (const node *cur = n; likely(cur != &t->root); cur = cur->parent) {
+					pb_varint(field, index.find(cur->fn)->id);
+				}
+
+				msg.clear();
+				pb_bytes(msg, 1, field);
+
+				field.clear();
+				pb_varint(field, n->calls);
+				pb_bytes(msg, 2, field);
+
+				pb_bytes(dst, 2, msg);
+			}
+		}
+
+		/*
+		 * Fields 4 and 5, locations {id, address, line: {function_id}} and
+		 * functions {id, name, system_name}. The strings are numbered after the
+		 * sample type strings, one per function
+		 */
+		for (u32 i = 0, sz = funcs.size(); likely(i < sz); i++) {
+			const function *f = funcs[i];
+
+			field.clear();
+			pb_varint(field, 1 << 3);
+			pb_varint(field, f->id);
+
+			msg.clear();
+			pb_varint(msg, 1 << 3);
+			pb_varint(msg, f->id);
+			pb_varint(msg, 3 << 3);
+			pb_varint(msg, f->fn);
+			pb_bytes(msg, 4, field);
+			pb_bytes(dst, 4, msg);
+
+			msg.clear();
+			pb_varint(msg, 1 << 3);
+			pb_varint(msg, f->id);
+			pb_varint(msg, 2 << 3);
+			pb_varint(msg, f->id + 2);
+			pb_varint(msg, 3 << 3);
+			pb_varint(msg, f->id + 2);
+			pb_bytes(dst, 5, msg);
+		}
+
+		/* Field 6, string table ("" first) */
+		field.clear();
+		pb_bytes(dst, 6, field);
+		field.set("calls");
+		pb_bytes(dst, 6, field);
+		field.set("count");
+		pb_bytes(dst, 6, field);
+
+		for (u32 i = 0, sz = funcs.size(); likely(i < sz); i++) {
+			field.clear();
+			name(field, funcs[i]);
+			pb_bytes(dst, 6, field);
+		}
+
+		dispose(t);
+		return dst;
+	}
+	catch (...) {
+		dispose(t);
+		throw;
+	}
+}
+
+}
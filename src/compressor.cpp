@@ -0,0 +1,507 @@
+#include "../include/compressor.hpp"
+
+/**
+	@file src/compressor.cpp
+
+	@brief Class instrument::compressor method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] codec the codec (LZ4 or ZSTD)
+ *
+ * @param[in] level
+ *	the compression level (0 for the codec default, a negative LZ4 level trades
+ *	density for speed)
+ *
+ * @param[in] block the input byte count per compressed block (0 for the default)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+compressor::compressor(u32 codec, i32 level, u32 block)
+try:
+m_codec(codec),
+m_level(level),
+m_block((likely(block > 0)) ? block : g_stream_block_sz),
+m_context(NULL),
+m_unflushed(0),
+m_framing(false)
+{
+	m_out.data = NULL;
+	m_out.size = 0;
+	m_out.slots = 0;
+
+	switch (codec) {
+#ifdef WITH_STREAM_LZ4
+	case LZ4: {
+		if ( unlikely(level > LZ4HC_CLEVEL_MAX) ) {
+			throw exception("invalid argument: level (=%d)", level);
+		}
+
+		LZ4F_cctx *ctx = NULL;
+		LZ4F_errorCode_t err = LZ4F_createCompressionContext(&ctx, LZ4F_VERSION);
+		if ( unlikely(LZ4F_isError(err)) ) {
+			throw exception("failed to create an LZ4 context (%s)", LZ4F_getErrorName(err));
+		}
+
+		m_context = ctx;
+		break;
+	}
+#endif
+
+#ifdef WITH_STREAM_ZSTD
+	case ZSTD: {
+		if ( unlikely(level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()) ) {
+			throw exception("invalid argument: level (=%d)", level);
+		}
+
+		ZSTD_CCtx *ctx = ZSTD_createCCtx();
+		if ( unlikely(ctx == NULL) ) {
+			throw std::bad_alloc();
+		}
+
+		m_context = ctx;
+		ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, (likely(level != 0)) ? level : ZSTD_CLEVEL_DEFAULT);
+		ZSTD_CCtx_setParameter(ctx, ZSTD_c_checksumFlag, 1);
+		break;
+	}
+#endif
+
+	default:
+		throw exception("invalid argument: codec (=%d)", codec);
+	}
+}
+catch (...) {
+	m_context = NULL;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+compressor::compressor(const compressor &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object destructor
+ *
+ * @note An unfinished frame is abandoned
+ */
+compressor::~compressor()
+{
+	switch (m_codec) {
+#ifdef WITH_STREAM_LZ4
+	case LZ4:
+		LZ4F_freeCompressionContext(static_cast<LZ4F_cctx*> (m_context));
+		break;
+#endif
+
+#ifdef WITH_STREAM_ZSTD
+	case ZSTD:
+		ZSTD_freeCCtx(static_cast<ZSTD_CCtx*> (m_context));
+		break;
+#endif
+
+	default:
+		break;
+	}
+
+	m_context = NULL;
+
+	delete[] m_out.data;
+	m_out.data = NULL;
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline compressor* compressor::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Get the input byte count per compressed block
+ *
+ * @returns this->m_block
+ */
+inline u32 compressor::block() const
+{
+	return m_block;
+}
+
+
+/**
+ * @brief Get the codec
+ *
+ * @returns this->m_codec
+ */
+inline u32 compressor::codec() const
+{
+	return m_codec;
+}
+
+
+/**
+ * @brief Get the compressed output
+ *
+ * @returns this->m_out.data (NULL if nothing was output)
+ */
+inline const i8* compressor::data() const
+{
+	return m_out.data;
+}
+
+
+/**
+ * @brief Get the compression level
+ *
+ * @returns this->m_level
+ */
+inline i32 compressor::level() const
+{
+	return m_level;
+}
+
+
+/**
+ * @brief Get the compressed output size
+ *
+ * @returns this->m_out.size
+ */
+inline u32 compressor::size() const
+{
+	return m_out.size;
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline compressor& compressor::operator=(const compressor &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Start a new frame
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+compressor& compressor::begin()
+{
+	switch (m_codec) {
+#ifdef WITH_STREAM_LZ4
+	case LZ4: {
+		/* The smallest LZ4 block size holding a whole block */
+		LZ4F_preferences_t prefs;
+		memset(&prefs, 0, sizeof(prefs));
+		prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+		if ( likely(m_block <= 65536) ) {
+			prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+		}
+		else if ( likely(m_block <= 262144) ) {
+			prefs.frameInfo.blockSizeID = LZ4F_max256KB;
+		}
+		else if ( likely(m_block <= 1048576) ) {
+			prefs.frameInfo.blockSizeID = LZ4F_max1MB;
+		}
+
+		prefs.frameInfo.blockMode = LZ4F_blockLinked;
+		prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+		prefs.compressionLevel = m_level;
+
+		reserve(LZ4F_HEADER_SIZE_MAX);
+		size_t len = LZ4F_compressBegin(
+			static_cast<LZ4F_cctx*> (m_context),
+			m_out.data + m_out.size,
+			m_out.slots - m_out.size,
+			&prefs
+		);
+
+		if ( unlikely(LZ4F_isError(len)) ) {
+			throw exception("failed to start an LZ4 frame (%s)", LZ4F_getErrorName(len));
+		}
+
+		m_out.size += len;
+		break;
+	}
+#endif
+
+#ifdef WITH_STREAM_ZSTD
+	case ZSTD:
+		/* The frame header is output with the first block */
+		ZSTD_CCtx_reset(static_cast<ZSTD_CCtx*> (m_context), ZSTD_reset_session_only);
+		break;
+#endif
+
+	default:
+		break;
+	}
+
+	m_unflushed = 0;
+	m_framing = true;
+	return *this;
+}
+
+
+/**
+ * @brief Clear the compressed output (the frame goes on)
+ *
+ * @returns *this
+ */
+inline compressor& compressor::clear()
+{
+	m_out.size = 0;
+	return *this;
+}
+
+
+/**
+ * @brief Compress data (a frame is started if needed)
+ *
+ * @param[in] src the data
+ *
+ * @param[in] len the data size
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note A block is emitted every block size bytes of input, the rest is held back
+ */
+compressor& compressor::compress(const i8 *src, u32 len)
+{
+	if ( unlikely(!m_framing) ) {
+		begin();
+	}
+
+	while ( likely(len > 0) ) {
+		u32 chunk = m_block - m_unflushed;
+		if ( likely(chunk > len) ) {
+			chunk = len;
+		}
+
+		update(src, chunk, 0);
+		src += chunk;
+		len -= chunk;
+
+		m_unflushed += chunk;
+		if ( unlikely(m_unflushed >= m_block) ) {
+			update(NULL, 0, 1);
+			m_unflushed = 0;
+		}
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief End the frame (the next compress starts a new one)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note NO-OP if no frame is started
+ */
+compressor& compressor::finish()
+{
+	if ( unlikely(!m_framing) ) {
+		return *this;
+	}
+
+	update(NULL, 0, 2);
+	m_unflushed = 0;
+	m_framing = false;
+	return *this;
+}
+
+
+/**
+ * @brief Emit a block of the input held back (decompressible at once)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+compressor& compressor::flush()
+{
+	if ( unlikely(!m_framing || m_unflushed == 0) ) {
+		return *this;
+	}
+
+	update(NULL, 0, 1);
+	m_unflushed = 0;
+	return *this;
+}
+
+
+/**
+ * @brief Ensure free space in the compressed output
+ *
+ * @param[in] len the free byte count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The buffer grows geometrically
+ */
+compressor& compressor::reserve(u32 len)
+{
+	if ( likely(m_out.size + len <= m_out.slots) ) {
+		return *this;
+	}
+
+	u32 slots = (likely(m_out.slots > 0)) ? m_out.slots : g_memblock_sz;
+	while ( likely(slots < m_out.size + len) ) {
+		slots *= 2;
+	}
+
+	i8 *data = new i8[slots];
+	memcpy(data, m_out.data, m_out.size);
+
+	delete[] m_out.data;
+	m_out.data = data;
+	m_out.slots = slots;
+	return *this;
+}
+
+
+/**
+ * @brief Abandon the frame and clear the compressed output
+ *
+ * @returns *this
+ *
+ * @note The next compress starts a new frame (e.g on a new connection)
+ */
+compressor& compressor::reset()
+{
+	m_out.size = 0;
+	m_unflushed = 0;
+	m_framing = false;
+	return *this;
+}
+
+
+/**
+ * @brief Feed the codec
+ *
+ * @param[in] src the data (NULL for none)
+ *
+ * @param[in] len the data size
+ *
+ * @param[in] op 0 to compress, 1 to emit a block, 2 to end the frame
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+compressor& compressor::update(const i8 *src, u32 len, u32 op)
+{
+	switch (m_codec) {
+#ifdef WITH_STREAM_LZ4
+	case LZ4: {
+		LZ4F_cctx *ctx = static_cast<LZ4F_cctx*> (m_context);
+
+		/* The bound covers the data held back by the context */
+		reserve(LZ4F_compressBound(len, NULL));
+		i8 *dst = m_out.data + m_out.size;
+		u32 free = m_out.slots - m_out.size;
+
+		size_t written;
+		if ( likely(op == 0) ) {
+			written = LZ4F_compressUpdate(ctx, dst, free, src, len, NULL);
+		}
+		else if ( likely(op == 1) ) {
+			written = LZ4F_flush(ctx, dst, free, NULL);
+		}
+		else {
+			written = LZ4F_compressEnd(ctx, dst, free, NULL);
+		}
+
+		if ( unlikely(LZ4F_isError(written)) ) {
+			throw exception("failed to compress data (LZ4 - %s)", LZ4F_getErrorName(written));
+		}
+
+		m_out.size += written;
+		break;
+	}
+#endif
+
+#ifdef WITH_STREAM_ZSTD
+	case ZSTD: {
+		ZSTD_CCtx *ctx = static_cast<ZSTD_CCtx*> (m_context);
+		ZSTD_EndDirective how = ZSTD_e_continue;
+		if ( unlikely(op == 1) ) {
+			how = ZSTD_e_flush;
+		}
+		else if ( unlikely(op == 2) ) {
+			how = ZSTD_e_end;
+		}
+
+		ZSTD_inBuffer in;
+		in.src = src;
+		in.size = len;
+		in.pos = 0;
+
+		/* Flushing and ending are done when nothing is left in the context */
+		size_t left;
+		do {
+			reserve(ZSTD_CStreamOutSize());
+
+			ZSTD_outBuffer out;
+			out.dst = m_out.data + m_out.size;
+			out.size = m_out.slots - m_out.size;
+			out.pos = 0;
+
+			left = ZSTD_compressStream2(ctx, &out, &in, how);
+			if ( unlikely(ZSTD_isError(left)) ) {
+				throw exception("failed to compress data (zstd - %s)", ZSTD_getErrorName(left));
+			}
+
+			m_out.size += out.pos;
+		}
+		while ( likely((how == ZSTD_e_continue) ? in.pos < in.size : left > 0) );
+
+		break;
+	}
+#endif
+
+	default:
+		break;
+	}
+
+	return *this;
+}
+
+}
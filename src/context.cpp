@@ -0,0 +1,263 @@
+#include "../include/tracer.hpp"
+
+/**
+	@file src/context.cpp
+
+	@brief Class instrument::context method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Acquire the context for a thread, waiting for the readers that pinned it
+ *
+ * @param[in] self the thread that resumes the context
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ */
+context& context::resume(pthread_t self)
+{
+	while ( unlikely(!compare_swap(&m_state,
+																 static_cast<u32> (CONTEXT_SUSPENDED),
+																 static_cast<u32> (CONTEXT_ACTIVE))) ) {
+		if ( unlikely(load_acquire(&m_state) == CONTEXT_ACTIVE) ) {
+			throw exception(
+				"context '%s' is active on another thread",
+				(likely(m_name != NULL)) ? m_name : "anonymous");
+		}
+
+		/* A reader is copying the frames */
+		sched_yield();
+	}
+
+	m_owner = self;
+	return *this;
+}
+
+
+/**
+ * @brief Release the context, once the thread saved its call tracking state
+ *
+ * @returns *this
+ */
+context& context::suspend()
+{
+	m_owner = 0;
+	store_release(&m_state, static_cast<u32> (CONTEXT_SUSPENDED));
+	return *this;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+context::context(const context &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline context* context::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline context& context::operator=(const context &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Get the context active on the current thread
+ *
+ * @returns the active context (NULL if the thread runs its own stack)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+context* context::current()
+{
+	return process::current()->current_thread()->active_context();
+}
+
+
+/**
+ * @brief Switch the context running on the current thread
+ *
+ * @param[in] to the resumed context (NULL to resume the stack of the thread itself)
+ *
+ * @returns the suspended context (NULL if it was the stack of the thread itself)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note See thread::switch_context
+ */
+context* context::switch_to(context *to)
+{
+	return process::current()->current_thread()->switch_context(to);
+}
+
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] nm the context name (it can be NULL)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note The context is suspended, with an empty stack, and registered with the process
+ */
+context::context(const i8 *nm)
+try:
+m_name(NULL),
+m_stack(NULL),
+m_lag(0),
+m_sampled(NULL),
+m_sampled_slots(0),
+m_depth(0),
+m_state(CONTEXT_SUSPENDED),
+m_owner(0),
+m_slot(0),
+m_registered(false)
+{
+	if ( unlikely(nm != NULL) ) {
+		m_name = new i8[strlen(nm) + 1];
+		strcpy(m_name, nm);
+	}
+
+	m_stack = new shadow_stack;
+	process::current()->add_context(this);
+}
+catch (...) {
+	delete[] m_name;
+	delete m_stack;
+	m_name = NULL;
+	m_stack = NULL;
+}
+
+
+/**
+ * @brief Object destructor
+ *
+ * @note
+ *	The context must be suspended, unless it's the home context of a thread
+ *	that is disposed (see thread::switch_context)
+ */
+context::~context()
+{
+	/* The process drops its registrations when it's disposed */
+	tracer *iface = tracer::interface();
+	if ( likely(m_registered && iface != NULL && iface->proc() != NULL) ) {
+		iface->proc()->remove_context(this);
+	}
+
+	delete[] m_name;
+	delete m_stack;
+	delete[] m_sampled;
+	m_name = NULL;
+	m_stack = NULL;
+	m_sampled = NULL;
+}
+
+
+/**
+ * @brief Check if the context runs on a thread
+ *
+ * @returns true if the context is active, false if it's suspended
+ */
+inline bool context::is_active() const
+{
+	return load_acquire(&m_state) == CONTEXT_ACTIVE;
+}
+
+
+/**
+ * @brief Get the context name
+ *
+ * @returns this->m_name
+ */
+inline const i8* context::name() const
+{
+	return m_name;
+}
+
+
+/**
+ * @brief Get the thread running the context
+ *
+ * @returns this->m_owner (0 if the context is suspended)
+ */
+inline pthread_t context::owner() const
+{
+	return m_owner;
+}
+
+
+/**
+ * @brief Copy the simulated frames of a suspended context
+ *
+ * @param[out] depth the copied frame count (the call depth)
+ *
+ * @param[out] dropped the calls past the maximum depth
+ *
+ * @returns the frames (bottom to top, heap allocated) or NULL if the context is active
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The context is pinned while the frames are copied, so it's not resumed
+ *	meanwhile. The process lock must be held, so the context is not disposed
+ *	meanwhile. The frames of an active context are in the stack of its thread
+ *	(see thread::snapshot)
+ */
+frame_t* context::snapshot(u32 &depth, u32 &dropped) const
+{
+	depth = 0;
+	dropped = 0;
+
+	u32 *state = const_cast<u32*> (&m_state);
+	if ( unlikely(!compare_swap(state,
+															static_cast<u32> (CONTEXT_SUSPENDED),
+															static_cast<u32> (CONTEXT_PINNED))) ) {
+		return NULL;
+	}
+
+	frame_t *retval = NULL;
+	try {
+		depth = m_stack->size();
+		dropped = m_stack->dropped();
+		retval = new frame_t[depth];
+		m_stack->snapshot(retval, depth);
+	}
+	catch (...) {
+		store_release(state, static_cast<u32> (CONTEXT_SUSPENDED));
+		throw;
+	}
+
+	store_release(state, static_cast<u32> (CONTEXT_SUSPENDED));
+	return retval;
+}
+
+}
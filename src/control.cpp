@@ -0,0 +1,314 @@
+#include "../include/control.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/control.cpp
+
+	@brief Class instrument::control method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+control::block control::s_private = {
+	g_control_magic,
+	g_control_version,
+	0,
+	(1 << 1) | 1,
+	0,
+	~0U,
+	0,
+	{0}
+};
+
+control::block *control::s_block = &control::s_private;
+
+i8 *control::s_path = NULL;
+
+
+/**
+ * @brief Initialize a control block (tracing on, first generation)
+ *
+ * @param[in,out] blk the control block
+ *
+ * @param[in] period the call sampling period
+ */
+void control::initialize(block *blk, u32 period)
+{
+	memset(blk, 0, sizeof(block));
+	blk->magic = g_control_magic;
+	blk->version = g_control_version;
+	blk->pid = getpid();
+	blk->sample_period = period;
+	blk->plugin_mask = ~0U;
+	blk->filter_generation = 0;
+	store_release(&blk->tracing, (1 << 1) | 1);
+}
+
+
+/**
+ * @brief Map a control block file, starting with the private block words
+ *
+ * @param[in] path the file path
+ *
+ * @note
+ *	The file is created, never opened through a symbolic link. A stale file
+ *	owned by the user (e.g of an exited process with the same ID) is replaced.
+ *	If the file can't be mapped, a warning is printed and the block stays
+ *	private
+ */
+void control::map(const i8 *path)
+{
+	const i32 flags = O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+
+	i32 fd = open(path, flags, 0600);
+	if ( unlikely(fd < 0 && errno == EEXIST) ) {
+		struct stat st;
+		if ( likely(lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid()) ) {
+			unlink(path);
+			fd = open(path, flags, 0600);
+		}
+		else {
+			errno = EEXIST;
+		}
+	}
+
+	if ( unlikely(fd < 0) ) {
+		util::dbg_warn("failed to open the control block '%s' (%s)", path, strerror(errno));
+		return;
+	}
+
+	/* Defensive, e.g for file systems that don't support O_EXCL */
+	struct stat st;
+	if ( unlikely(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) ) {
+		util::dbg_warn("failed to open the control block '%s' (not a file of the user)", path);
+		close(fd);
+		return;
+	}
+
+	void *mem = MAP_FAILED;
+	if ( likely(ftruncate(fd, sizeof(block)) == 0) ) {
+		mem = mmap(NULL, sizeof(block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	/* The mapping keeps the file referenced */
+	i32 err = errno;
+	close(fd);
+
+	if ( unlikely(mem == MAP_FAILED) ) {
+		util::dbg_warn("failed to map the control block '%s' (%s)", path, strerror(err));
+		unlink(path);
+		return;
+	}
+
+	s_path = new (std::nothrow) i8[strlen(path) + 1];
+	if ( likely(s_path != NULL) ) {
+		strcpy(s_path, path);
+	}
+
+	block *blk = static_cast<block*> (mem);
+	memcpy(blk, &s_private, sizeof(block));
+	store_release(&s_block, blk);
+}
+
+
+/**
+ * @brief Fork handler, give the child process its own control block
+ *
+ * @note
+ *	The file of the parent is neither unlinked nor written by the child. The
+ *	child continues with a private copy of the block words (with its own process
+ *	ID) and, if the file path defaults to the process ID, maps a file of its own
+ *	(see control::attach)
+ */
+void control::after_fork()
+{
+	if ( likely(s_block == &s_private) ) {
+		s_private.pid = getpid();
+		return;
+	}
+
+	block *shared = s_block;
+	memcpy(&s_private, shared, sizeof(block));
+	s_private.pid = getpid();
+
+	/* The child has no other threads, the shared block has no readers left */
+	store_release(&s_block, &s_private);
+	munmap(shared, sizeof(block));
+
+	delete[] s_path;
+	s_path = NULL;
+
+	const i8 *val = ::getenv(g_control_env);
+	if ( likely(val != NULL && strcmp(val, "on") == 0) ) {
+		i8 path[PATH_MAX];
+		snprintf(path, sizeof(path), g_control_path, getpid());
+		map(path);
+	}
+}
+
+
+/**
+ * @brief Map the control block file, as selected by the environment
+ *
+ * @param[in] period the initial call sampling period (0 for off)
+ *
+ * @note
+ *	With g_control_env unset (or 'off') the control block is private. If the
+ *	file can't be mapped, a warning is printed and the block is private. Call
+ *	once, from the library constructor, before the tracer becomes ready
+ *
+ * @see g_control_env
+ */
+void control::attach(u32 period)
+{
+	initialize(&s_private, period);
+
+	const i8 *val = ::getenv(g_control_env);
+	if ( likely(val == NULL || val[0] == '\0' || strcmp(val, "off") == 0) ) {
+		return;
+	}
+
+	i8 path[PATH_MAX];
+	if ( likely(strcmp(val, "on") == 0) ) {
+		snprintf(path, sizeof(path), g_control_path, getpid());
+	}
+	else {
+		snprintf(path, sizeof(path), "%s", val);
+	}
+
+	map(path);
+}
+
+
+/**
+ * @brief Remove the control block file
+ *
+ * @note
+ *	The block stays mapped (the hooks of other threads may still read it), so it
+ *	keeps working, only external tools can't reach it anymore
+ */
+void control::detach()
+{
+	if ( likely(s_path == NULL) ) {
+		return;
+	}
+
+	unlink(s_path);
+	delete[] s_path;
+	s_path = NULL;
+}
+
+
+/**
+ * @brief Get the filter generation
+ *
+ * @returns the filter generation word
+ */
+u32 control::filter_generation()
+{
+	return load_acquire(&s_block->filter_generation);
+}
+
+
+/**
+ * @brief Advance the filter generation (e.g when the filters change)
+ *
+ * @returns the new filter generation
+ */
+u32 control::next_filter_generation()
+{
+	return fetch_add(&s_block->filter_generation, 1);
+}
+
+
+/**
+ * @brief Get the control block file path
+ *
+ * @returns the path or NULL if the control block is private
+ */
+const i8* control::path()
+{
+	return s_path;
+}
+
+
+/**
+ * @brief Get the plugin mask
+ *
+ * @returns the plugin mask word (bit i dispatches plugin i)
+ */
+u32 control::plugin_mask()
+{
+	return load_acquire(&s_block->plugin_mask);
+}
+
+
+/**
+ * @brief Switch tracing on or off, starting a new generation
+ *
+ * @param[in] enabled true to switch tracing on, false to switch it off
+ *
+ * @note
+ *	The threads apply the sampling period and the plugin mask, and start over
+ *	their simulated stacks, when they see the new generation
+ */
+void control::publish(bool enabled)
+{
+	u32 word;
+	do {
+		word = load_acquire(&s_block->tracing);
+	} while ( unlikely(!compare_swap(&s_block->tracing, word,
+																	 (((word >> 1) + 1) << 1) | (enabled ? 1 : 0))) );
+}
+
+
+/**
+ * @brief Start a new generation, keeping tracing on or off
+ *
+ * @note The threads start over their simulated stacks (see control::publish)
+ */
+void control::restart()
+{
+	fetch_add(&s_block->tracing, 1 << 1);
+}
+
+
+/**
+ * @brief Get the call sampling period
+ *
+ * @returns the sampling period (0 if call sampling is off)
+ */
+u32 control::sample_period()
+{
+	return load_acquire(&s_block->sample_period);
+}
+
+
+/**
+ * @brief Set the plugin mask
+ *
+ * @param[in] mask the plugin mask (bit i dispatches plugin i)
+ *
+ * @note Applied with the next generation (see control::publish)
+ */
+void control::set_plugin_mask(u32 mask)
+{
+	store_release(&s_block->plugin_mask, mask);
+}
+
+
+/**
+ * @brief Set the call sampling period
+ *
+ * @param[in] period the sampling period (N, for 1 out of N calls, 0 for off)
+ *
+ * @note Applied with the next generation (see control::publish)
+ */
+void control::set_sample_period(u32 period)
+{
+	store_release(&s_block->sample_period, period);
+}
+
+}
@@ -0,0 +1,444 @@
+#include "../include/crash.hpp"
+#include "../include/tracer.hpp"
+
+/**
+	@file src/crash.cpp
+
+	@brief Class instrument::crash method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+i32 crash::s_fd = -1;
+
+i8 *crash::s_buffer = NULL;
+
+u32 crash::s_size = 0;
+
+void *crash::s_stack = NULL;
+
+u32 crash::s_dumping = 0;
+
+struct sigaction crash::s_previous[sizeof(g_crash_signals) / sizeof(i32)];
+
+
+/**
+ * @brief Write the dump buffer to the dump file descriptor
+ *
+ * @note Async-signal-safe, the buffer is emptied even if writing fails
+ */
+void crash::flush()
+{
+	u32 done = 0;
+
+	while ( likely(done < s_size) ) {
+		ssize_t cnt = write(s_fd, s_buffer + done, s_size - done);
+		if ( unlikely(cnt < 0 && errno == EINTR) ) {
+			continue;
+		}
+
+		if ( unlikely(cnt <= 0) ) {
+			break;
+		}
+
+		done += cnt;
+	}
+
+	s_size = 0;
+}
+
+
+/**
+ * @brief Find the module of an address in the module index
+ *
+ * @param[in] proc the process
+ *
+ * @param[in] addr the address
+ *
+ * @param[out] base the module base (0 if the address is not in any module)
+ *
+ * @returns the module ID (1 based, 0 if the address is not in any module)
+ *
+ * @note Async-signal-safe, the module index is read without locking
+ */
+u32 crash::module_id(const process *proc, mem_addr_t addr, mem_addr_t &base)
+{
+	base = 0;
+
+	const process::module_index *idx = load_acquire(&proc->m_ranges);
+	if ( unlikely(idx == NULL) ) {
+		return 0;
+	}
+
+	u32 lo = 0, hi = idx->size;
+	while ( likely(lo < hi) ) {
+		u32 mid = lo + (hi - lo) / 2;
+
+		if ( likely(idx->ranges[mid].begin <= addr) ) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if ( unlikely(lo == 0 || addr >= idx->ranges[lo - 1].end) ) {
+		return 0;
+	}
+
+	base = idx->ranges[lo - 1].table->base();
+	return lo;
+}
+
+
+/**
+ * @brief Crash signal handler
+ *
+ * @param[in] sig the signal
+ *
+ * @param[in] info the signal information
+ *
+ * @param[in] ctx the interrupted context (unused)
+ *
+ * @note
+ *	Only one thread dumps, the other crashing threads wait for the dump (for a
+ *	bounded time). Then the previous action is restored and the signal raised
+ *	again, so the process terminates (or the previous handler runs) as usual
+ */
+void crash::on_signal(i32 sig, siginfo_t *info, void *ctx)
+{
+	if ( unlikely(!dump(sig, (likely(info != NULL)) ? info->si_addr : NULL)) ) {
+		timespec pause = {0, 1000000};
+
+		for (u32 i = 0; likely(i < 1000 && load_acquire(&s_dumping) != 0); i++) {
+			nanosleep(&pause, NULL);
+		}
+	}
+
+	for (u32 i = 0; likely(i < sizeof(g_crash_signals) / sizeof(i32)); i++) {
+		if ( unlikely(g_crash_signals[i] == sig) ) {
+			sigaction(sig, &s_previous[i], NULL);
+			break;
+		}
+	}
+
+	raise(sig);
+}
+
+
+/**
+ * @brief Append bytes to the dump buffer, flushing it when full
+ *
+ * @param[in] src the bytes
+ *
+ * @param[in] len the byte count
+ *
+ * @note Async-signal-safe
+ */
+void crash::put(const i8 *src, u32 len)
+{
+	while ( likely(len > 0) ) {
+		if ( unlikely(s_size == g_crash_buffer_sz) ) {
+			flush();
+		}
+
+		u32 cnt = g_crash_buffer_sz - s_size;
+		if ( likely(cnt > len) ) {
+			cnt = len;
+		}
+
+		for (u32 i = 0; likely(i < cnt); i++) {
+			s_buffer[s_size++] = src[i];
+		}
+
+		src += cnt;
+		len -= cnt;
+	}
+}
+
+
+/**
+ * @brief Append a hexadecimal number (0x prefixed) to the dump buffer
+ *
+ * @param[in] val the number
+ *
+ * @note Async-signal-safe
+ */
+void crash::put_hex(u64 val)
+{
+	i8 digits[2 + 16];
+	u32 pos = sizeof(digits);
+
+	do {
+		digits[--pos] = "0123456789abcdef"[val & 0xf];
+		val >>= 4;
+	} while ( likely(val > 0) );
+
+	digits[--pos] = 'x';
+	digits[--pos] = '0';
+	put(digits + pos, sizeof(digits) - pos);
+}
+
+
+/**
+ * @brief Append a decimal number to the dump buffer
+ *
+ * @param[in] val the number
+ *
+ * @note Async-signal-safe
+ */
+void crash::put_number(u64 val)
+{
+	i8 digits[20];
+	u32 pos = sizeof(digits);
+
+	do {
+		digits[--pos] = '0' + val % 10;
+		val /= 10;
+	} while ( likely(val > 0) );
+
+	put(digits + pos, sizeof(digits) - pos);
+}
+
+
+/**
+ * @brief Append a C string to the dump buffer
+ *
+ * @param[in] str the string (can be NULL for NO-OP)
+ *
+ * @note Async-signal-safe
+ */
+void crash::put_string(const i8 *str)
+{
+	if ( likely(str != NULL) ) {
+		put(str, strlen(str));
+	}
+}
+
+
+/**
+ * @brief Append the simulated call stack of a thread to the dump buffer
+ *
+ * @param[in] proc the process
+ *
+ * @param[in] thr the thread
+ *
+ * @note
+ *	Async-signal-safe, the thread is not locked. The frames are appended from
+ *	the outermost call, as in tracer::trace
+ */
+void crash::put_thread(const process *proc, thread *thr)
+{
+	u32 depth = thr->call_depth();
+
+	put_string("thread ");
+	put_hex(thr->handle());
+	put_string(" ");
+	put_number(depth);
+	put_string(" ");
+	put_string((likely(thr->name() != NULL)) ? thr->name() : "anonymous");
+	put_string("\n");
+
+	for (u32 i = depth; likely(i > 0); i--) {
+		const frame_t *cur = thr->top(i - 1);
+		if ( unlikely(cur == NULL) ) {
+			continue;
+		}
+
+		mem_addr_t fn_base, site_base;
+		u32 fn_id = module_id(proc, cur->fn, fn_base);
+		u32 site_id = module_id(proc, cur->site, site_base);
+
+		put_string("frame ");
+		put_number(fn_id);
+		put_string(" ");
+		put_hex(cur->fn - fn_base);
+		put_string(" ");
+		put_number(site_id);
+		put_string(" ");
+		put_hex(cur->site - site_base);
+		put_string("\n");
+	}
+}
+
+
+/**
+ * @brief Write a crash dump of all simulated call stacks
+ *
+ * @param[in] sig the signal (0 for an explicit dump)
+ *
+ * @param[in] addr the fault address (can be NULL)
+ *
+ * @returns true if the dump was written, false if another dump is in progress
+ *
+ * @note
+ *	Async-signal-safe, it can be called from a user signal handler too. NO-OP
+ *	if the crash handlers are not installed. The thread walk is best-effort,
+ *	the thread list is not locked: the thread count and the list array are
+ *	read once, the walk stops at an empty slot and the threads that exit
+ *	meanwhile may be dumped stale
+ */
+bool crash::dump(i32 sig, const void *addr)
+{
+	if ( unlikely(!compare_swap(&s_dumping, 0, 1)) ) {
+		return false;
+	}
+
+	if ( unlikely(s_fd < 0) ) {
+		store_release(&s_dumping, 0);
+		return true;
+	}
+
+	s_size = 0;
+	put_string("crash ");
+	put_number(sig);
+	put_string(" ");
+	put_number(getpid());
+	put_string(" ");
+	put_hex(reinterpret_cast<mem_addr_t> (addr));
+	put_string("\n");
+
+	tracer *iface = tracer::interface();
+	const process *proc = (likely(iface != NULL)) ? iface->proc() : NULL;
+
+	if ( likely(proc != NULL) ) {
+		const process::module_index *idx = load_acquire(&proc->m_ranges);
+
+		for (u32 i = 0; likely(idx != NULL && i < idx->size); i++) {
+			const process::module_range &cur = idx->ranges[i];
+
+			put_string("module ");
+			put_number(i + 1);
+			put_string(" ");
+			put_hex(cur.begin);
+			put_string(" ");
+			put_hex(cur.end);
+			put_string(" ");
+			put_hex(cur.table->base());
+			put_string(" ");
+			put_string(cur.table->path());
+			put_string("\n");
+		}
+
+		/* No bounds checks, an exception can't be thrown from a signal handler */
+		const list<thread> *threads = proc->m_threads;
+		thread* const *data = threads->data();
+		u32 cnt = threads->size();
+
+		for (u32 i = 0; likely(data != NULL && i < cnt && data[i] != NULL); i++) {
+			put_thread(proc, data[i]);
+		}
+	}
+
+	put_string("end\n");
+	flush();
+
+	store_release(&s_dumping, 0);
+	return true;
+}
+
+
+/**
+ * @brief Install the crash handlers (replacing any previous installation)
+ *
+ * @param[in] path the dump file path (NULL for the standard error)
+ *
+ * @throws instrument::exception
+ *
+ * @note
+ *	The dump buffer and the alternate signal stack are mapped and touched
+ *	upfront. The alternate stack serves the installing thread, so a stack
+ *	overflow of that thread still produces a dump
+ */
+void crash::install(const i8 *path)
+{
+	uninstall();
+
+	i32 fd = (likely(path == NULL)) ? dup(STDERR_FILENO)
+																	: open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ( unlikely(fd < 0) ) {
+		throw exception("failed to open crash dump file '%s' (%s)",
+										(path != NULL) ? path : "stderr", strerror(errno));
+	}
+
+	void *buf = mmap(NULL, g_crash_buffer_sz + g_crash_stack_sz, PROT_READ | PROT_WRITE,
+									 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( unlikely(buf == MAP_FAILED) ) {
+		close(fd);
+		throw exception("failed to map the crash dump buffer (%s)", strerror(errno));
+	}
+
+	memset(buf, 0, g_crash_buffer_sz + g_crash_stack_sz);
+	s_buffer = static_cast<i8*> (buf);
+	s_stack = s_buffer + g_crash_buffer_sz;
+	s_size = 0;
+
+	stack_t alt;
+	alt.ss_sp = s_stack;
+	alt.ss_size = g_crash_stack_sz;
+	alt.ss_flags = 0;
+	sigaltstack(&alt, NULL);
+
+	struct sigaction act;
+	memset(&act, 0, sizeof(act));
+	sigemptyset(&act.sa_mask);
+	act.sa_sigaction = on_signal;
+	act.sa_flags = SA_SIGINFO | SA_ONSTACK;
+
+	store_release(&s_fd, fd);
+	for (u32 i = 0; likely(i < sizeof(g_crash_signals) / sizeof(i32)); i++) {
+		sigaction(g_crash_signals[i], &act, &s_previous[i]);
+	}
+}
+
+
+/**
+ * @brief Check if the crash handlers are installed
+ *
+ * @returns true if the crash handlers are installed, false otherwise
+ */
+bool crash::is_installed()
+{
+	return load_acquire(&s_fd) >= 0;
+}
+
+
+/**
+ * @brief Uninstall the crash handlers, restoring the previous signal actions
+ *
+ * @note NO-OP if the crash handlers are not installed
+ */
+void crash::uninstall()
+{
+	if ( likely(s_fd < 0) ) {
+		return;
+	}
+
+	for (u32 i = 0; likely(i < sizeof(g_crash_signals) / sizeof(i32)); i++) {
+		sigaction(g_crash_signals[i], &s_previous[i], NULL);
+	}
+
+	/* Wait for a dump in progress */
+	while ( unlikely(!compare_swap(&s_dumping, 0, 1)) ) {
+		sched_yield();
+	}
+
+	stack_t alt;
+	if ( likely(sigaltstack(NULL, &alt) == 0 && alt.ss_sp == s_stack) ) {
+		alt.ss_flags = SS_DISABLE;
+		sigaltstack(&alt, NULL);
+	}
+
+	close(s_fd);
+	store_release(&s_fd, -1);
+	munmap(s_buffer, g_crash_buffer_sz + g_crash_stack_sz);
+	s_buffer = NULL;
+	s_stack = NULL;
+	s_size = 0;
+
+	store_release(&s_dumping, 0);
+}
+
+}
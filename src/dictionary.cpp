@@ -9,6 +9,134 @@
 
 namespace instrument {
 
+/**
+ * @brief Hash a word (FNV-1a)
+ *
+ * @param[in] word the word
+ *
+ * @param[in] icase true to hash the word case insensitively
+ *
+ * @returns the word hash (never 0, the reserved registry key)
+ */
+u64 dictionary::hash(const i8 *word, bool icase)
+{
+	u64 h = 14695981039346656037ULL;
+
+	for (const i8 *c = word; likely(*c != '\0'); c++) {
+		u8 ch = static_cast<u8> (*c);
+		h ^= (unlikely(icase)) ? tolower(ch) : ch;
+		h *= 1099511628211ULL;
+	}
+
+	return (likely(h != 0)) ? h : 1;
+}
+
+
+/**
+ * @brief
+ *	Build the lookup index. Literal words are indexed by hash and regular
+ *	expressions are combined and compiled to a single expression
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	If the combined expression fails to compile, the error is reported and the
+ *	words are matched one by one
+ */
+dictionary& dictionary::index()
+{
+	invalidate();
+	m_index->clear();
+	m_iindex->clear();
+
+	if ( likely(m_mode == SIMPLE_LOOKUP_MODE) ) {
+		/* The first occurence of a word is indexed */
+		for (u32 i = 0; likely(i < m_size); i++) {
+			string *word = at(i);
+
+			u64 key = hash(word->cstring(), false);
+			if ( likely(m_index->find(key) == NULL) ) {
+				m_index->insert(key, word);
+			}
+
+			key = hash(word->cstring(), true);
+			if ( likely(m_iindex->find(key) == NULL) ) {
+				m_iindex->insert(key, word);
+			}
+		}
+	}
+
+	else if ( likely(m_size > 0) ) {
+		string buf;
+		for (u32 i = 0; likely(i < m_size); i++) {
+			buf.append((likely(i == 0)) ? "(%s)" : "|(%s)", at(i)->cstring());
+		}
+
+		try {
+			m_expr = new pattern(buf.cstring(), REG_EXTENDED | REG_NOSUB);
+			m_iexpr = new pattern(buf.cstring(), REG_EXTENDED | REG_NOSUB | REG_ICASE);
+		}
+		catch (exception &x) {
+			invalidate();
+			util::dbg_warn("in dictionary::%s(): %s", __FUNCTION__, x.msg());
+		}
+	}
+
+	m_indexed = true;
+	return *this;
+}
+
+
+/**
+ * @brief Mark the lookup index as stale (the words have changed)
+ *
+ * @returns *this
+ */
+dictionary& dictionary::invalidate()
+{
+	delete m_expr;
+	delete m_iexpr;
+	m_expr = NULL;
+	m_iexpr = NULL;
+
+	m_indexed = false;
+	return *this;
+}
+
+
+/**
+ * @brief Lookup an expression, by testing each word in order
+ *
+ * @param[in] exp the expression to lookup
+ *
+ * @param[in] icase true to ignore case in comparing/matching
+ *
+ * @returns the first matched dictionary word, NULL if no match is found
+ *
+ * @throws instrument::exception
+ */
+const string* dictionary::scan(const string &exp, bool icase) const
+{
+	for (u32 i = 0; likely(i < m_size); i++) {
+		const string *word = at(i);
+
+		if ( likely(m_mode == SIMPLE_LOOKUP_MODE) ) {
+			if ( unlikely(exp.compare(*word, icase) == 0) ) {
+				return word;
+			}
+		}
+
+		else if ( unlikely(exp.match(*word, icase)) ) {
+			return word;
+		}
+	}
+
+	return NULL;
+}
+
+
 /**
  * @brief Object constructor
  *
@@ -25,7 +153,12 @@ dictionary::dictionary(const i8 *nm, const i8 *path, bool mode)
 try:
 list<string>(),
 m_mode(mode),
-m_name(NULL)
+m_name(NULL),
+m_indexed(false),
+m_index(NULL),
+m_iindex(NULL),
+m_expr(NULL),
+m_iexpr(NULL)
 {
 	if ( unlikely(nm == NULL) ) {
 		throw exception("invalid argument: nm (=%p)", nm);
@@ -33,8 +166,9 @@ m_name(NULL)
 
 	m_name = new i8[strlen(nm) + 1];
 	strcpy(m_name, nm);
+	m_index = new registry<u64, string>;
+	m_iindex = new registry<u64, string>;
 
-	__D_ASSERT(path != NULL);
 	if ( likely(path != NULL) ) {
 		load_file(path);
 	}
@@ -42,7 +176,11 @@ m_name(NULL)
 catch (...) {
 	clear();
 	delete[] m_name;
+	delete m_index;
+	delete m_iindex;
 	m_name = NULL;
+	m_index = NULL;
+	m_iindex = NULL;
 }
 
 
@@ -57,13 +195,26 @@ dictionary::dictionary(const dictionary &src)
 try:
 list<string>(src),
 m_mode(src.m_mode),
-m_name(NULL)
+m_name(NULL),
+m_indexed(false),
+m_index(NULL),
+m_iindex(NULL),
+m_expr(NULL),
+m_iexpr(NULL)
 {
 	m_name = new i8[strlen(src.m_name) + 1];
 	strcpy(m_name, src.m_name);
+	m_index = new registry<u64, string>;
+	m_iindex = new registry<u64, string>;
 }
 catch (...) {
 	clear();
+	delete[] m_name;
+	delete m_index;
+	delete m_iindex;
+	m_name = NULL;
+	m_index = NULL;
+	m_iindex = NULL;
 }
 
 
@@ -72,8 +223,13 @@ catch (...) {
  */
 dictionary::~dictionary()
 {
+	invalidate();
 	delete[] m_name;
+	delete m_index;
+	delete m_iindex;
 	m_name = NULL;
+	m_index = NULL;
+	m_iindex = NULL;
 }
 
 
@@ -122,7 +278,7 @@ inline const i8* dictionary::name() const
 inline dictionary& dictionary::set_mode(bool mode)
 {
 	m_mode = mode;
-	return *this;
+	return invalidate();
 }
 
 
@@ -173,10 +329,97 @@ dictionary& dictionary::operator=(const dictionary &rval)
 	list<string>::operator=(rval);
 
 	m_mode = rval.m_mode;
+	invalidate();
 	return set_name(rval.m_name);
 }
 
 
+/**
+ * @brief Add a word
+ *
+ * @param[in] word the word (can be NULL for NO-OP)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+inline dictionary& dictionary::add(string *word)
+{
+	list<string>::add(word);
+	return invalidate();
+}
+
+
+/**
+ * @brief Add words in bulk
+ *
+ * @param[in] words the words
+ *
+ * @param[in] cnt the word count
+ *
+ * @param[in] unique true to skip the duplicate checks (see list::add_range)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+dictionary& dictionary::add_range(string* const *words, u32 cnt, bool unique)
+{
+	/* If a word is invalid, the words before it are added */
+	try {
+		list<string>::add_range(words, cnt, unique);
+	}
+	catch (...) {
+		invalidate();
+		throw;
+	}
+
+	return invalidate();
+}
+
+
+/**
+ * @brief Remove (and delete) all words
+ *
+ * @returns *this
+ */
+inline dictionary& dictionary::clear()
+{
+	list<string>::clear();
+	return invalidate();
+}
+
+
+/**
+ * @brief Detach a word (the word is not deleted)
+ *
+ * @param[in] i the word offset
+ *
+ * @returns the word
+ *
+ * @throws instrument::exception
+ */
+inline string* dictionary::detach(u32 i)
+{
+	string *retval = list<string>::detach(i);
+	invalidate();
+	return retval;
+}
+
+
+/**
+ * @brief Detach all words (the words are not deleted)
+ *
+ * @returns *this
+ */
+inline dictionary& dictionary::detach_all()
+{
+	list<string>::detach_all();
+	return invalidate();
+}
+
+
 /**
  * @brief Load words from a dictionary file
  *
@@ -207,7 +450,7 @@ dictionary& dictionary::load_file(const i8 *path)
 	i32 retval = stat(path, &inf);
 
 	/* File doesn't exist */
-	if ( unlikely(errno == ENOENT) ) {
+	if ( unlikely(retval < 0 && errno == ENOENT) ) {
 		throw exception("file '%s' does not exist", path);
 	}
 
@@ -275,6 +518,17 @@ dictionary& dictionary::load_file(const i8 *path)
 		i8 *offset, *cur;
 		offset = cur = static_cast<i8*> (mmap_base);
 
+		/* Reserve a slot for each line */
+		u32 lines = 0;
+		const i8 *nl = static_cast<const i8*> (memchr(cur, '\n', sz));
+		while ( likely(nl != NULL) ) {
+			lines++;
+			nl++;
+			nl = static_cast<const i8*> (memchr(nl, '\n', cur + sz - nl));
+		}
+
+		reserve(size() + lines);
+
 		/* Load the dictionary words */
 		while ( likely(bytes-- > 0) ) {
 			if ( unlikely(*cur == '\n') ) {
@@ -286,8 +540,9 @@ dictionary& dictionary::load_file(const i8 *path)
 						delete word;
 					}
 					else {
+						/* The word is new, the duplicate check is skipped */
 						cnt++;
-						add(word);
+						add_range(&word, 1, true);
 					}
 
 					word = NULL;
@@ -309,6 +564,7 @@ dictionary& dictionary::load_file(const i8 *path)
 
 	munmap(mmap_base, sz);
 	close(fd);
+	index();
 
 #if DBG_LEVEL & DBGL_INFO
 	if ( likely(cnt > 0) ) {
@@ -329,6 +585,58 @@ dictionary& dictionary::load_file(const i8 *path)
 }
 
 
+/**
+ * @brief Load words from a word table
+ *
+ * @param[in] words the words (can be NULL for NO-OP)
+ *
+ * @param[in] cnt the word count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The words are trimmed, like the lines of a dictionary file, and the empty
+ *	ones are skipped. No file is read, so the embedded dictionaries are loaded
+ *	without I/O
+ */
+dictionary& dictionary::load_words(const i8 *const *words, u32 cnt)
+{
+	__D_ASSERT(words != NULL || cnt == 0);
+	if ( unlikely(words == NULL) ) {
+		return *this;
+	}
+
+	reserve(size() + cnt);
+
+	/* If an exception occurs, clean up and rethrow it */
+	string *word = NULL;
+	try {
+		for (u32 i = 0; likely(i < cnt); i++) {
+			word = new string("%s", words[i]);
+			word->trim();
+
+			if ( unlikely(word->length() == 0) ) {
+				delete word;
+			}
+			else {
+				/* The word is new, the duplicate check is skipped */
+				add_range(&word, 1, true);
+			}
+
+			word = NULL;
+		}
+	}
+	catch (...) {
+		delete word;
+		throw;
+	}
+
+	return index();
+}
+
+
 /**
  * @brief Dictionary lookup
  *
@@ -338,25 +646,71 @@ dictionary& dictionary::load_file(const i8 *path)
  *
  * @returns the matched dictionary word, NULL if no match is found
  *
+ * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note
+ *	A literal lookup is a hash probe. A regular expression lookup is a single
+ *	match against the combined words, the words are scanned only on a match
  */
 const string* dictionary::lookup(const string &exp, bool icase) const
 {
-	for (u32 i = 0; likely(i < m_size); i++) {
-		const string *word = at(i);
+	if ( unlikely(!m_indexed) ) {
+		const_cast<dictionary*> (this)->index();
+	}
 
-		if ( likely(m_mode == SIMPLE_LOOKUP_MODE) ) {
-			if ( unlikely(exp.compare(*word, icase) == 0) ) {
-				return word;
-			}
+	if ( likely(m_mode == SIMPLE_LOOKUP_MODE) ) {
+		const registry<u64, string> *idx = (unlikely(icase)) ? m_iindex : m_index;
+
+		const string *word = idx->find(hash(exp.cstring(), icase));
+		if ( likely(word == NULL) ) {
+			return NULL;
 		}
 
-		else if ( unlikely(exp.match(*word, icase)) ) {
+		if ( likely(exp.compare(*word, icase) == 0) ) {
 			return word;
 		}
+
+		/* The hash collided, the word may not be indexed */
+		return scan(exp, icase);
 	}
 
-	return NULL;
+	const pattern *expr = (unlikely(icase)) ? m_iexpr : m_expr;
+	if ( likely(expr != NULL && !expr->match(exp.cstring())) ) {
+		return NULL;
+	}
+
+	return scan(exp, icase);
+}
+
+
+/**
+ * @brief Remove (and delete) a word
+ *
+ * @param[in] i the word offset
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ */
+inline dictionary& dictionary::remove(u32 i)
+{
+	list<string>::remove(i);
+	return invalidate();
+}
+
+
+/**
+ * @brief Sort the words (the first occurence of a word may change)
+ *
+ * @param[in] pfunc the comparator
+ *
+ * @returns *this
+ */
+inline dictionary& dictionary::sort(const comparator_t pfunc)
+{
+	list<string>::sort(pfunc);
+	return invalidate();
 }
 
 }
@@ -0,0 +1,685 @@
+#include "../include/encoder.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/encoder.cpp
+
+	@brief Class instrument::encoder method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+const bool encoder::s_known = true;
+
+
+/**
+ * @brief Append a message to a buffer
+ *
+ * @param[in,out] dst the destination buffer
+ *
+ * @param[in] type the message type
+ *
+ * @param[in,out] payload the message payload (cleared)
+ *
+ * @throws std::bad_alloc
+ */
+void encoder::commit(buffer &dst, u8 type, buffer &payload)
+{
+	put(dst, &type, 1);
+	put_varint(dst, payload.size);
+	put(dst, payload.data, payload.size);
+
+	payload.size = 0;
+}
+
+
+/**
+ * @brief Append raw bytes to a buffer
+ *
+ * @param[in,out] dst the destination buffer
+ *
+ * @param[in] src the bytes
+ *
+ * @param[in] len the byte count
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The buffer grows geometrically
+ */
+void encoder::put(buffer &dst, const void *src, u32 len)
+{
+	if ( unlikely(dst.size + len > dst.slots) ) {
+		u32 slots = (likely(dst.slots > 0)) ? dst.slots : g_memblock_sz;
+		while ( likely(slots < dst.size + len) ) {
+			slots *= 2;
+		}
+
+		u8 *data = new u8[slots];
+		memcpy(data, dst.data, dst.size);
+
+		delete[] dst.data;
+		dst.data = data;
+		dst.slots = slots;
+	}
+
+	memcpy(dst.data + dst.size, src, len);
+	dst.size += len;
+}
+
+
+/**
+ * @brief Append a zigzag encoded signed varint to a buffer
+ *
+ * @param[in,out] dst the destination buffer
+ *
+ * @param[in] val the value
+ *
+ * @throws std::bad_alloc
+ */
+inline void encoder::put_signed(buffer &dst, i64 val)
+{
+	put_varint(dst, (static_cast<u64> (val) << 1) ^ static_cast<u64> (val >> 63));
+}
+
+
+/**
+ * @brief Append a length prefixed string to a buffer
+ *
+ * @param[in,out] dst the destination buffer
+ *
+ * @param[in] str the string (NULL is encoded as an empty string)
+ *
+ * @throws std::bad_alloc
+ */
+void encoder::put_string(buffer &dst, const i8 *str)
+{
+	u32 len = (likely(str != NULL)) ? strlen(str) : 0;
+
+	put_varint(dst, len);
+	put(dst, str, len);
+}
+
+
+/**
+ * @brief Append an unsigned (LEB128) varint to a buffer
+ *
+ * @param[in,out] dst the destination buffer
+ *
+ * @param[in] val the value
+ *
+ * @throws std::bad_alloc
+ */
+void encoder::put_varint(buffer &dst, u64 val)
+{
+	u8 bytes[10];
+	u32 len = 0;
+
+	while ( unlikely(val >= 0x80) ) {
+		bytes[len++] = static_cast<u8> (val) | 0x80;
+		val >>= 7;
+	}
+
+	bytes[len++] = static_cast<u8> (val);
+	put(dst, bytes, len);
+}
+
+
+/**
+ * @brief Release the memory of a buffer
+ *
+ * @param[in,out] dst the buffer
+ */
+inline void encoder::release(buffer &dst)
+{
+	delete[] dst.data;
+	dst.data = NULL;
+	dst.size = 0;
+	dst.slots = 0;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+encoder::encoder(const encoder &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline encoder* encoder::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline encoder& encoder::operator=(const encoder &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Get the ID of a function module, sending the module first if needed
+ *
+ * @param[in] addr the function address
+ *
+ * @returns the module ID (0 if the address is not in any module)
+ *
+ * @throws std::bad_alloc
+ */
+u32 encoder::module_id(mem_addr_t addr)
+{
+	const symtab *tab = m_proc->get_module(addr);
+	if ( unlikely(tab == NULL) ) {
+		return 0;
+	}
+
+	if ( likely(tab == m_last) ) {
+		return m_last_id;
+	}
+
+	symtab *key = const_cast<symtab*> (tab);
+	i32 pos = m_modules->search(key);
+	if ( unlikely(pos < 0) ) {
+		m_modules->add(key);
+		pos = m_modules->size() - 1;
+
+		put_varint(m_tmp, pos + 1);
+		put_varint(m_tmp, tab->base());
+		put_string(m_tmp, tab->path());
+		commit(m_defs, MODULE, m_tmp);
+	}
+
+	m_last = tab;
+	m_last_id = pos + 1;
+	return m_last_id;
+}
+
+
+/**
+ * @brief Send the name of a function, if it wasn't already sent
+ *
+ * @param[in] id the module ID
+ *
+ * @param[in] tab the module symbol table
+ *
+ * @param[in] addr the function address
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+encoder& encoder::symbol(u32 id, const symtab *tab, mem_addr_t addr)
+{
+	if ( likely(m_symbols->find(addr) != NULL) ) {
+		return *this;
+	}
+
+	const i8 *nm = m_proc->lookup(addr);
+	if ( unlikely(nm != NULL) ) {
+		put_varint(m_tmp, id);
+		put_varint(m_tmp, addr - tab->base());
+		put_string(m_tmp, nm);
+		commit(m_defs, SYMBOL, m_tmp);
+	}
+
+	/* Unresolved functions are not looked up again */
+	m_symbols->insert(addr, &s_known);
+	return *this;
+}
+
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] proc the symbolized process (NULL for the instrumented process)
+ *
+ * @param[in] names true to send function names (symbolize on the sender)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+encoder::encoder(const process *proc, bool names)
+try:
+m_proc(proc),
+m_modules(NULL),
+m_symbols(NULL),
+m_last(NULL),
+m_last_id(0),
+m_cursor(0),
+m_names(names)
+{
+	m_out.data = m_defs.data = m_msg.data = m_tmp.data = NULL;
+	m_out.size = m_defs.size = m_msg.size = m_tmp.size = 0;
+	m_out.slots = m_defs.slots = m_msg.slots = m_tmp.slots = 0;
+
+	if ( likely(m_proc == NULL) ) {
+		m_proc = process::current();
+	}
+
+	m_modules = new list<symtab>;
+	m_symbols = new registry<mem_addr_t, const bool>;
+}
+catch (...) {
+	delete m_modules;
+	m_modules = NULL;
+}
+
+
+/**
+ * @brief Object destructor
+ */
+encoder::~encoder()
+{
+	/* The module list doesn't own the symbol tables */
+	m_modules->detach_all();
+
+	delete m_modules;
+	delete m_symbols;
+	m_modules = NULL;
+	m_symbols = NULL;
+
+	release(m_out);
+	release(m_defs);
+	release(m_msg);
+	release(m_tmp);
+}
+
+
+/**
+ * @brief Get the encoded data
+ *
+ * @returns this->m_out.data (can be NULL if nothing is encoded)
+ */
+inline const u8* encoder::data() const
+{
+	return m_out.data;
+}
+
+
+/**
+ * @brief Check if function names are sent
+ *
+ * @returns this->m_names
+ */
+inline bool encoder::names() const
+{
+	return m_names;
+}
+
+
+/**
+ * @brief Get the encoded data size
+ *
+ * @returns this->m_out.size
+ */
+inline u32 encoder::size() const
+{
+	return m_out.size;
+}
+
+
+#ifdef WITH_PLUGIN
+/**
+ * @brief Begin a SLOW message
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[in] usec the return time (wall clock, in microseconds)
+ *
+ * @param[in] nsec the call duration (in nanoseconds)
+ *
+ * @param[in] depth the simulated call depth
+ *
+ * @param[in] cnt the frame count (exactly cnt frames must follow, see encoder::frame)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+encoder& encoder::begin_slow_call(pthread_t id, u64 usec, u64 nsec, u32 depth, u32 cnt)
+{
+	m_msg.size = 0;
+	m_cursor = 0;
+
+	put_varint(m_msg, usec);
+	put_varint(m_msg, nsec);
+	put_varint(m_msg, id);
+	put_varint(m_msg, depth);
+	put_varint(m_msg, cnt);
+	return *this;
+}
+#endif
+
+
+/**
+ * @brief Begin a DELTA message
+ *
+ * @param[in] number the snapshot number (shared by the messages of a delta dump)
+ *
+ * @param[in] id the thread ID (or context address)
+ *
+ * @param[in] nm the thread name (can be NULL)
+ *
+ * @param[in] exited true if the thread (or context) is gone since the previous snapshot
+ *
+ * @param[in] kept the outermost frames shared with the previous snapshot of the thread
+ *
+ * @param[in] cnt the new frame count (exactly cnt frames must follow)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+encoder& encoder::begin_delta(u64 number, pthread_t id, const i8 *nm, bool exited, u32 kept, u32 cnt)
+{
+	m_msg.size = 0;
+	m_cursor = 0;
+
+	put_varint(m_msg, number);
+	put_varint(m_msg, id);
+	put_string(m_msg, nm);
+	put_varint(m_msg, exited);
+	put_varint(m_msg, kept);
+	put_varint(m_msg, cnt);
+	return *this;
+}
+
+
+/**
+ * @brief Begin a TRACE message
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[in] nm the thread name (can be NULL)
+ *
+ * @param[in] cnt the frame count (exactly cnt frames must follow)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+encoder& encoder::begin_trace(pthread_t id, const i8 *nm, u32 cnt)
+{
+	m_msg.size = 0;
+	m_cursor = 0;
+
+	put_varint(m_msg, id);
+	put_string(m_msg, nm);
+	put_varint(m_msg, cnt);
+	return *this;
+}
+
+
+/**
+ * @brief Clear the encoded data (the sent modules and names are kept)
+ *
+ * @returns *this
+ */
+encoder& encoder::clear()
+{
+	m_out.size = 0;
+	m_defs.size = 0;
+	m_msg.size = 0;
+	m_tmp.size = 0;
+	return *this;
+}
+
+
+/**
+ * @brief End a DELTA message
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The modules and names referenced by the new frames are output before it
+ */
+encoder& encoder::end_delta()
+{
+	put(m_out, m_defs.data, m_defs.size);
+	m_defs.size = 0;
+
+	commit(m_out, DELTA, m_msg);
+	return *this;
+}
+
+
+#ifdef WITH_PLUGIN
+/**
+ * @brief End a SLOW message
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The modules and names referenced by the frames are output before it
+ */
+encoder& encoder::end_slow_call()
+{
+	put(m_out, m_defs.data, m_defs.size);
+	m_defs.size = 0;
+
+	commit(m_out, SLOW, m_msg);
+	return *this;
+}
+#endif
+
+
+/**
+ * @brief End a TRACE message
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The modules and names referenced by the trace are output before it
+ */
+encoder& encoder::end_trace()
+{
+	put(m_out, m_defs.data, m_defs.size);
+	m_defs.size = 0;
+
+	commit(m_out, TRACE, m_msg);
+	return *this;
+}
+
+
+/**
+ * @brief Add a frame to the current TRACE message
+ *
+ * @param[in] fn the called function address
+ *
+ * @param[in] site the call site address
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+encoder& encoder::frame(mem_addr_t fn, mem_addr_t site)
+{
+	u32 id = module_id(fn);
+	if ( unlikely(m_names && id > 0) ) {
+		symbol(id, m_last, fn);
+	}
+
+	put_varint(m_msg, id);
+	put_signed(m_msg, static_cast<i64> (fn - m_cursor));
+	put_signed(m_msg, static_cast<i64> (site - fn));
+
+	m_cursor = fn;
+	return *this;
+}
+
+
+/**
+ * @brief Append the preamble and a HELLO message
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note Call once at the beginning of each connection
+ */
+encoder& encoder::header()
+{
+	const i8 *path = util::executable_path();
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	u64 tstamp = static_cast<u64> (now.tv_sec) * 1000000 + now.tv_usec;
+
+	try {
+		put(m_out, g_idp_magic, sizeof(g_idp_magic) - 1);
+
+		put_varint(m_tmp, g_idp_version);
+		put_varint(m_tmp, getpid());
+		put_varint(m_tmp, pthread_self());
+		put_varint(m_tmp, tstamp);
+		put_string(m_tmp, path);
+		commit(m_out, HELLO, m_tmp);
+
+		delete[] path;
+		return *this;
+	}
+	catch (...) {
+		m_tmp.size = 0;
+		delete[] path;
+		throw;
+	}
+}
+
+
+#ifdef WITH_PLUGIN
+/**
+ * @brief Append a LATENCY message
+ *
+ * @param[in] fn the function address
+ *
+ * @param[in] calls the call count
+ *
+ * @param[in] quantiles the quantiles, in nanoseconds (see latency::summary)
+ *
+ * @param[in] cnt the quantile count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note The module and the name of the function are output before it
+ */
+encoder& encoder::latency(mem_addr_t fn, u64 calls, const u64 *quantiles, u32 cnt)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	try {
+		u32 id = module_id(fn);
+		mem_addr_t off = fn;
+		if ( likely(id > 0) ) {
+			if ( unlikely(m_names) ) {
+				symbol(id, m_last, fn);
+			}
+
+			off = fn - m_last->base();
+		}
+
+		put(m_out, m_defs.data, m_defs.size);
+		m_defs.size = 0;
+
+		put_varint(m_tmp, static_cast<u64> (now.tv_sec) * 1000000 + now.tv_usec);
+		put_varint(m_tmp, id);
+		put_varint(m_tmp, off);
+		put_varint(m_tmp, calls);
+		put_varint(m_tmp, cnt);
+		for (u32 i = 0; likely(i < cnt); i++) {
+			put_varint(m_tmp, quantiles[i]);
+		}
+
+		commit(m_out, LATENCY, m_tmp);
+		return *this;
+	}
+	catch (...) {
+		m_tmp.size = 0;
+		throw;
+	}
+}
+#endif
+
+
+#ifdef WITH_METRICS
+/**
+ * @brief Append a METRICS message
+ *
+ * @param[in] counters the counters (see tracer::metrics)
+ *
+ * @param[in] cnt the counter count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+encoder& encoder::metrics(const u64 *counters, u32 cnt)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	try {
+		put_varint(m_tmp, static_cast<u64> (now.tv_sec) * 1000000 + now.tv_usec);
+		put_varint(m_tmp, cnt);
+		for (u32 i = 0; likely(i < cnt); i++) {
+			put_varint(m_tmp, counters[i]);
+		}
+
+		commit(m_out, METRICS, m_tmp);
+		return *this;
+	}
+	catch (...) {
+		m_tmp.size = 0;
+		throw;
+	}
+}
+#endif
+
+
+/**
+ * @brief Forget the sent modules and names (e.g for a new connection)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+encoder& encoder::reset()
+{
+	m_modules->detach_all();
+	m_symbols->clear();
+	m_last = NULL;
+	m_last_id = 0;
+
+	return clear();
+}
+
+}
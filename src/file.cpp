@@ -9,6 +9,101 @@
 
 namespace instrument {
 
+/**
+ * @brief Sync the written pages of a mapped segment and drop them from the mapping
+ *
+ * @param[in,out] seg the segment
+ *
+ * @returns 0 on success, the errno value otherwise
+ *
+ * @note
+ *	Only the syncer (or the owner, once the syncer is stopped) may call this
+ *	method. The pages below the last written one are not written again, so
+ *	they're dropped, the data remains in the file
+ */
+i32 file::sync_segment(log_segment *seg)
+{
+	u32 tail = load_acquire(&seg->tail);
+	if ( likely(tail == seg->synced) ) {
+		return 0;
+	}
+
+	u32 pgsz = sysconf(_SC_PAGESIZE);
+	u32 from = seg->synced & ~(pgsz - 1);
+	if ( unlikely(msync(seg->data + from, tail - from, MS_ASYNC) < 0) ) {
+		return errno;
+	}
+
+	u32 done = tail & ~(pgsz - 1);
+	if ( likely(done > from) ) {
+		madvise(seg->data + from, done - from, MADV_DONTNEED);
+	}
+
+	seg->synced = tail;
+	return 0;
+}
+
+
+/**
+ * @brief Memory-mapped log syncer thread
+ *
+ * @param[in] arg the mapped log state
+ *
+ * @returns NULL
+ *
+ * @note
+ *	Every g_file_sync_ms, or as soon as a segment is retired, the written pages
+ *	of the active segment are synced and the retired segments are unmapped.
+ *	Sync errors are recorded and reported by the next flush
+ */
+void* file::sync_log(void *arg)
+{
+	mapped_log *log = static_cast<mapped_log*> (arg);
+
+	pthread_mutex_lock(&log->lock);
+	while ( likely(!log->stop) ) {
+		if ( likely(log->retired == NULL) ) {
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += g_file_sync_ms / 1000;
+			deadline.tv_nsec += (g_file_sync_ms % 1000) * 1000000L;
+			if ( unlikely(deadline.tv_nsec >= 1000000000L) ) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+
+			pthread_cond_timedwait(&log->wake, &log->lock, &deadline);
+		}
+
+		/* The retired segments are never the active one, the producer doesn't unmap them */
+		log_segment *active = log->active;
+		log_segment *retired = log->retired;
+		log->retired = NULL;
+		pthread_mutex_unlock(&log->lock);
+
+		i32 err = sync_segment(active);
+		while ( unlikely(retired != NULL) ) {
+			log_segment *next = retired->next;
+
+			i32 retval = unmap_segment(retired);
+			if ( unlikely(err == 0) ) {
+				err = retval;
+			}
+
+			retired = next;
+		}
+
+		pthread_mutex_lock(&log->lock);
+		if ( unlikely(err != 0 && log->error == 0) ) {
+			log->error = err;
+		}
+	}
+
+	pthread_mutex_unlock(&log->lock);
+	return NULL;
+}
+
+
 /**
  * @brief
  *	Create a unique ID based on process identifiers arranged as indicated by a
@@ -108,6 +203,219 @@ string* file::unique_id(const i8 *fmt)
 }
 
 
+/**
+ * @brief Sync, truncate to its data and unmap a segment, then close its file
+ *
+ * @param[in] seg the segment (deleted)
+ *
+ * @returns 0 on success, the errno value of the first failure otherwise
+ */
+i32 file::unmap_segment(log_segment *seg)
+{
+	i32 retval = sync_segment(seg);
+
+	i32 err;
+	do {
+		err = ftruncate(seg->handle, seg->tail);
+	}
+	while ( unlikely(err < 0 && (errno == EINTR || errno == EAGAIN)) );
+
+	if ( unlikely(err < 0 && retval == 0) ) {
+		retval = errno;
+	}
+
+	munmap(seg->data, seg->size);
+	::close(seg->handle);
+	delete seg;
+	return retval;
+}
+
+
+/**
+ * @brief Write data to the active segment of the mapped log
+ *
+ * @param[in] iov the data segments
+ *
+ * @param[in] cnt the segment count
+ *
+ * @returns the written byte count or -1 (errno is set)
+ *
+ * @throws instrument::exception
+ *
+ * @note
+ *	The data is copied into the mapping and the tail is published, without a
+ *	system call. The segment is rotated first if it can't hold the data (data
+ *	larger than a segment fills it). If the file is not mapped, the data is
+ *	written with vectored I/O
+ */
+i32 file::emit(const struct iovec *iov, u32 cnt)
+{
+	if ( likely(m_log == NULL) ) {
+		return writev(m_handle, iov, cnt);
+	}
+
+	u32 total = 0;
+	for (u32 i = 0; likely(i < cnt); i++) {
+		total += iov[i].iov_len;
+	}
+
+	/* The data of a flush is kept in one segment if it fits */
+	log_segment *seg = m_log->active;
+	u32 tail = seg->tail;
+	u32 room = seg->size - tail;
+	if ( unlikely(total > room && (total <= seg->size || room == 0)) ) {
+		rotate();
+
+		seg = m_log->active;
+		tail = 0;
+		room = seg->size;
+	}
+
+	i8 *dst = seg->data + tail;
+	u32 left = (likely(total < room)) ? total : room;
+	for (u32 i = 0; likely(i < cnt && left > 0); i++) {
+		u32 len = (likely(iov[i].iov_len < left)) ? iov[i].iov_len : left;
+		memcpy(dst, iov[i].iov_base, len);
+		dst += len;
+		left -= len;
+	}
+
+	u32 retval = dst - (seg->data + tail);
+	store_release(&seg->tail, tail + retval);
+	return retval;
+}
+
+
+/**
+ * @brief Create and map a segment file of the log
+ *
+ * @param[in] index the segment number (the path suffix)
+ *
+ * @returns the segment (heap allocated)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	An existing segment file is replaced (unlinked first, so a retired segment
+ *	that is not unmapped yet is not affected). The segment blocks are allocated
+ *	up front, so the stores into the mapping can't fail on a full filesystem
+ */
+file::log_segment* file::map_segment(u32 index)
+{
+	string path;
+	path.append("%s.%u", m_path, index);
+	unlink(path.cstring());
+
+	i32 fd;
+	do {
+		fd = ::open(path.cstring(), O_RDWR | O_CREAT | O_TRUNC, DEFAULT_UMASK);
+	}
+	while ( unlikely(fd < 0 && (errno == EINTR || errno == EAGAIN)) );
+
+	if ( unlikely(fd < 0) ) {
+		throw exception(
+			"failed to open file '%s' (errno %d - %s)",
+			path.cstring(),
+			errno,
+			strerror(errno)
+		);
+	}
+
+	/* Filesystems that can't allocate blocks get a sparse segment */
+	i32 err = posix_fallocate(fd, 0, m_log_sz);
+	if ( unlikely(err == EOPNOTSUPP || err == EINVAL) ) {
+		err = (likely(ftruncate(fd, m_log_sz) == 0)) ? 0 : errno;
+	}
+
+	void *mem = MAP_FAILED;
+	if ( likely(err == 0) ) {
+		mem = mmap(NULL, m_log_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if ( unlikely(mem == MAP_FAILED) ) {
+			err = errno;
+		}
+	}
+
+	if ( unlikely(err != 0) ) {
+		::close(fd);
+		throw exception(
+			"failed to map file '%s' (%u bytes, errno %d - %s)",
+			path.cstring(),
+			m_log_sz,
+			err,
+			strerror(err)
+		);
+	}
+
+	madvise(mem, m_log_sz, MADV_SEQUENTIAL);
+
+	log_segment *retval = NULL;
+	try {
+		retval = new log_segment;
+	}
+	catch (...) {
+		munmap(mem, m_log_sz);
+		::close(fd);
+		throw;
+	}
+
+	retval->data = static_cast<i8*> (mem);
+	retval->size = m_log_sz;
+	retval->tail = 0;
+	retval->synced = 0;
+	retval->handle = fd;
+	retval->next = NULL;
+	return retval;
+}
+
+
+/**
+ * @brief Map the next segment of the log and retire the active one
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The retired segment is unmapped by the syncer thread or, if it's not
+ *	running, right away
+ */
+file& file::rotate()
+{
+	mapped_log *log = m_log;
+	log_segment *seg = map_segment((log->rotations + 1) % m_log_segments);
+
+	pthread_mutex_lock(&log->lock);
+	log->active->next = log->retired;
+	log->retired = log->active;
+	log->active = seg;
+	log->rotations++;
+	m_handle = seg->handle;
+
+	log_segment *retired = NULL;
+	if ( unlikely(log->thread == 0) ) {
+		retired = log->retired;
+		log->retired = NULL;
+	}
+
+	pthread_cond_signal(&log->wake);
+	pthread_mutex_unlock(&log->lock);
+
+	while ( unlikely(retired != NULL) ) {
+		log_segment *next = retired->next;
+		i32 err = unmap_segment(retired);
+		if ( unlikely(err != 0 && log->error == 0) ) {
+			log->error = err;
+		}
+
+		retired = next;
+	}
+
+	return *this;
+}
+
+
 /**
  * @brief Object constructor
  *
@@ -119,7 +427,10 @@ string* file::unique_id(const i8 *fmt)
 file::file(const i8 *path)
 try:
 stream(),
-m_path(NULL)
+m_path(NULL),
+m_log(NULL),
+m_log_sz(0),
+m_log_segments(g_file_log_segments)
 {
 	if ( unlikely(path == NULL) ) {
 		throw exception("invalid argument: path (=%p)", path);
@@ -129,8 +440,7 @@ m_path(NULL)
 	strcpy(m_path, path);
 }
 catch (...) {
-	delete[] m_data;
-	m_data = NULL;
+	release();
 	m_path = NULL;
 }
 
@@ -146,14 +456,21 @@ catch (...) {
 file::file(const file &src)
 try:
 stream(src),
-m_path(NULL)
+m_path(NULL),
+m_log(NULL),
+m_log_sz(src.m_log_sz),
+m_log_segments(src.m_log_segments)
 {
 	m_path = new i8[strlen(src.m_path) + 1];
 	strcpy(m_path, src.m_path);
+
+	/* The log is mapped by the source, the copy must be re-opened */
+	if ( unlikely(src.m_log != NULL) ) {
+		stream::close();
+	}
 }
 catch (...) {
-	delete[] m_data;
-	m_data = NULL;
+	release();
 	m_path = NULL;
 
 	close();
@@ -165,6 +482,8 @@ catch (...) {
  */
 file::~file()
 {
+	close();
+
 	delete[] m_path;
 	m_path = NULL;
 }
@@ -184,6 +503,17 @@ inline file* file::clone() const
 }
 
 
+/**
+ * @brief Check if the file is a memory-mapped log
+ *
+ * @returns true if the file is (or will be, once opened) mapped, false otherwise
+ */
+inline bool file::is_mapped() const
+{
+	return m_log_sz > 0;
+}
+
+
 /**
  * @brief Get the output file path
  *
@@ -195,6 +525,44 @@ inline const i8* file::path() const
 }
 
 
+/**
+ * @brief Set the file to be a memory-mapped rotating log (or a plain file)
+ *
+ * @param[in] sz the segment size in bytes (0 for a plain file)
+ *
+ * @param[in] segments the segment file count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The mode applies from the next open, an open file is closed and re-opened.
+ *	The segments are named after the file path, suffixed with the segment
+ *	number (from 0 to segments - 1)
+ */
+file& file::set_mapped(u32 sz, u32 segments)
+{
+	if ( unlikely(segments == 0) ) {
+		throw exception("invalid argument: segments (=%u)", segments);
+	}
+
+	bool reopen = (m_handle >= 0);
+	if ( unlikely(reopen) ) {
+		close();
+	}
+
+	m_log_sz = sz;
+	m_log_segments = segments;
+	if ( unlikely(reopen) ) {
+		open();
+	}
+
+	return *this;
+}
+
+
 /**
  * @brief Assignment operator
  *
@@ -222,6 +590,57 @@ file& file::operator=(const file &rval)
 	}
 
 	strcpy(m_path, rval.m_path);
+	m_log_sz = rval.m_log_sz;
+	m_log_segments = rval.m_log_segments;
+
+	/* The log is mapped by the source, the copy must be re-opened */
+	if ( unlikely(rval.m_log != NULL) ) {
+		stream::close();
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Close the file
+ *
+ * @returns *this
+ *
+ * @note
+ *	A mapped log stops its syncer, then each segment is synced, truncated to
+ *	its data and unmapped (sync errors are ignored)
+ */
+file& file::close()
+{
+	mapped_log *log = m_log;
+	if ( likely(log == NULL) ) {
+		stream::close();
+		return *this;
+	}
+
+	m_log = NULL;
+	if ( likely(log->thread != 0) ) {
+		pthread_mutex_lock(&log->lock);
+		log->stop = true;
+		pthread_cond_signal(&log->wake);
+		pthread_mutex_unlock(&log->lock);
+		pthread_join(log->thread, NULL);
+	}
+
+	log->active->next = log->retired;
+	for (log_segment *seg = log->active; likely(seg != NULL); ) {
+		log_segment *next = seg->next;
+		unmap_segment(seg);
+		seg = next;
+	}
+
+	pthread_cond_destroy(&log->wake);
+	pthread_mutex_destroy(&log->lock);
+	delete log;
+
+	/* The descriptor was closed with the active segment */
+	m_handle = -1;
 	return *this;
 }
 
@@ -231,12 +650,40 @@ file& file::operator=(const file &rval)
  *
  * @returns *this
  *
+ * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note
+ *	In asynchronous mode the data is not synced (see stream::set_async). A
+ *	mapped log copies the data to the active segment, the syncer thread syncs
+ *	it (the sync errors it recorded are thrown here)
  */
 file& file::flush()
 {
 	try {
+		if ( unlikely(m_log != NULL) ) {
+			pthread_mutex_lock(&m_log->lock);
+			i32 err = m_log->error;
+			m_log->error = 0;
+			pthread_mutex_unlock(&m_log->lock);
+
+			if ( unlikely(err != 0) ) {
+				throw err;
+			}
+
+			/* The buffered data is one segment if nothing is borrowed */
+			transmit();
+			clear();
+			return *this;
+		}
+
 		stream::flush();
+
+		/* In asynchronous mode the writer thread outputs the data */
+		if ( unlikely(m_async != NULL) ) {
+			return *this;
+		}
+
 		return sync();
 	}
 	catch (i32 err) {
@@ -281,7 +728,10 @@ inline file& file::open()
  *
  * @throws instrument::exception
  *
- * @note If the file is already open, it is re-opened with the new flags
+ * @note
+ *	If the file is already open, it is re-opened with the new flags. A mapped
+ *	log ignores the flags and the mode, its segments are created anew (see
+ *	file::set_mapped)
  */
 file& file::open(u32 flags, u32 umask)
 {
@@ -289,6 +739,10 @@ file& file::open(u32 flags, u32 umask)
 		close();
 	}
 
+	if ( unlikely(m_log_sz > 0) ) {
+		return open_log();
+	}
+
 	do {
 		m_handle = ::open(m_path, flags, umask);
 	}
@@ -334,6 +788,66 @@ file& file::open(u32 flags, u32 umask)
 }
 
 
+/**
+ * @brief Create the segments of the mapped log and start its syncer thread
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note The segments of a previous log are removed, so a reader never mixes two runs
+ */
+file& file::open_log()
+{
+	for (u32 i = 0; likely(i < m_log_segments); i++) {
+		string path;
+		path.append("%s.%u", m_path, i);
+		unlink(path.cstring());
+	}
+
+	mapped_log *log = new mapped_log;
+	try {
+		log->active = map_segment(0);
+	}
+	catch (...) {
+		delete log;
+		throw;
+	}
+
+	log->thread = 0;
+	log->retired = NULL;
+	log->rotations = 0;
+	log->error = 0;
+	log->stop = false;
+	pthread_mutex_init(&log->lock, NULL);
+	pthread_cond_init(&log->wake, NULL);
+	m_log = log;
+	m_handle = log->active->handle;
+
+	/* The syncer inherits a full signal mask */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	i32 err = pthread_create(&log->thread, NULL, sync_log, log);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if ( unlikely(err != 0) ) {
+		log->thread = 0;
+		close();
+
+		throw exception(
+			"failed to start the log syncer thread of file '%s' (errno %d - %s)",
+			m_path,
+			err,
+			strerror(err)
+		);
+	}
+
+	return *this;
+}
+
+
 /**
  * @brief Resize the file
  *
@@ -421,10 +935,29 @@ inline file& file::sync() const
  * @returns *this
  *
  * @throws instrument::exception
+ *
+ * @note The written pages of the active segment of a mapped log are synced first
  */
 file& file::sync(bool full) const
 {
 	i32 retval;
+	if ( unlikely(m_log != NULL) ) {
+		/* The active segment is owned by the flushing thread */
+		log_segment *seg = m_log->active;
+
+		u32 pgsz = sysconf(_SC_PAGESIZE);
+		u32 from = seg->synced & ~(pgsz - 1);
+		u32 tail = load_acquire(&seg->tail);
+		if ( unlikely(tail > from && msync(seg->data + from, tail - from, MS_SYNC) < 0) ) {
+			throw exception(
+				"failed to sync file '%s' (errno %d - %s)",
+				m_path,
+				errno,
+				strerror(errno)
+			);
+		}
+	}
+
 	if ( likely(full) ) {
 		retval = fsync(m_handle);
 	}
@@ -59,6 +59,7 @@ inline filter& filter::operator=(const filter &rval)
  */
 filter::filter(const i8 *expr, bool icase, bool mode):
 m_mode(mode),
+m_icase(icase),
 m_src_expr(NULL)
 {
 	util::memset(&m_expr, 0, sizeof(regex_t));
@@ -89,6 +90,17 @@ inline const i8* filter::expr() const
 }
 
 
+/**
+ * @brief Check if the filter ignores case
+ *
+ * @returns this->m_icase
+ */
+inline bool filter::icase() const
+{
+	return m_icase;
+}
+
+
 /**
  * @brief Get the filter type
  *
@@ -136,6 +148,7 @@ filter& filter::set_expr(const i8 *expr, bool icase)
 	/* Compile the regular expression */
 	i32 retval = regcomp(&m_expr, expr, flags);
 	if ( likely(retval == 0) ) {
+		m_icase = icase;
 		return *this;
 	}
 
@@ -0,0 +1,135 @@
+#include "../include/formatter.hpp"
+
+/**
+	@file src/formatter.cpp
+
+	@brief Class instrument::formatter method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Append an unsigned decimal integer to a string
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] val the value
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ */
+string& formatter::decimal(string &dst, u64 val)
+{
+	i8 digits[20];
+	u32 pos = sizeof(digits);
+
+	do {
+		digits[--pos] = '0' + val % 10;
+		val /= 10;
+	}
+	while ( likely(val > 0) );
+
+	return dst.concat(digits + pos, sizeof(digits) - pos);
+}
+
+
+/**
+ * @brief Append a hexadecimal integer (lowercase, without a prefix) to a string
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] val the value
+ *
+ * @param[in] width the minimum digit count (zero padded)
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ */
+string& formatter::hex(string &dst, u64 val, u32 width)
+{
+	static const i8 s_digits[] = "0123456789abcdef";
+
+	i8 digits[16];
+	u32 pos = sizeof(digits);
+
+	do {
+		digits[--pos] = s_digits[val & 0x0f];
+		val >>= 4;
+	}
+	while ( likely(val > 0) );
+
+	while ( unlikely(sizeof(digits) - pos < width && pos > 0) ) {
+		digits[--pos] = '0';
+	}
+
+	return dst.concat(digits + pos, sizeof(digits) - pos);
+}
+
+
+/**
+ * @brief Append a JSON string literal to a string
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] src the (null terminated) text, NULL for a JSON null
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The unescaped runs of the text are appended at once
+ */
+string& formatter::quote(string &dst, const i8 *src)
+{
+	if ( unlikely(src == NULL) ) {
+		return dst.concat("null", 4);
+	}
+
+	dst.concat("\"", 1);
+
+	const i8 *run = src;
+	for (const i8 *c = src; likely(*c != '\0'); c++) {
+		u8 ch = *c;
+		if ( likely(ch >= 0x20 && ch != '"' && ch != '\\') ) {
+			continue;
+		}
+
+		dst.concat(run, c - run);
+		run = c + 1;
+
+		if ( likely(ch == '"' || ch == '\\') ) {
+			i8 esc[2] = {'\\', static_cast<i8> (ch)};
+			dst.concat(esc, 2);
+		}
+		else {
+			i8 esc[6] = {'\\', 'u', '0', '0', "0123456789abcdef"[ch >> 4], "0123456789abcdef"[ch & 0x0f]};
+			dst.concat(esc, 6);
+		}
+	}
+
+	dst.concat(run, strlen(run));
+	return dst.concat("\"", 1);
+}
+
+
+/**
+ * @brief Object destructor
+ */
+formatter::~formatter()
+{
+}
+
+
+/**
+ * @brief Check if the format needs the symbol names and the source lines
+ *
+ * @returns true (the frames are symbolized before they're formatted)
+ */
+inline bool formatter::is_symbolic() const
+{
+	return true;
+}
+
+}
@@ -0,0 +1,204 @@
+#include "../include/idp_formatter.hpp"
+
+/**
+	@file src/idp_formatter.cpp
+
+	@brief Class instrument::idp_formatter method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] proc the symbolized process (NULL for the instrumented process)
+ *
+ * @param[in] names true to send function names (symbolize on the sender)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+idp_formatter::idp_formatter(const process *proc, bool names)
+try:
+formatter(),
+m_encoder(NULL),
+m_header(false)
+{
+	m_encoder = new encoder(proc, names);
+}
+catch (...) {
+	m_encoder = NULL;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+idp_formatter::idp_formatter(const idp_formatter &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object destructor
+ */
+idp_formatter::~idp_formatter()
+{
+	delete m_encoder;
+	m_encoder = NULL;
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline idp_formatter* idp_formatter::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Check if the format needs the symbol names and the source lines
+ *
+ * @returns false (the frames are symbolized by the collector)
+ */
+inline bool idp_formatter::is_symbolic() const
+{
+	return false;
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline idp_formatter& idp_formatter::operator=(const idp_formatter &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Begin a TRACE message (the preamble and HELLO are output the first time)
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[in] nm the thread name (can be NULL)
+ *
+ * @param[in] depth the frame count
+ *
+ * @param[in] sig the trace signature (not encoded)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+idp_formatter& idp_formatter::begin_trace(string &dst, pthread_t id, const i8 *nm, u32 depth, u64 sig)
+{
+	if ( unlikely(!m_header) ) {
+		m_encoder->header();
+		m_header = true;
+	}
+
+	m_encoder->begin_trace(id, nm, depth);
+	return *this;
+}
+
+
+/**
+ * @brief End the TRACE message and append the encoded messages
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] dropped the calls past the maximum depth (not encoded)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+idp_formatter& idp_formatter::end_trace(string &dst, u32 dropped)
+{
+	m_encoder->end_trace();
+	dst.concat(reinterpret_cast<const i8*> (m_encoder->data()), m_encoder->size());
+	m_encoder->clear();
+	return *this;
+}
+
+
+/**
+ * @brief Add a frame to the TRACE message
+ *
+ * @param[in,out] dst the destination string (unused)
+ *
+ * @param[in] fn the called function address
+ *
+ * @param[in] site the call site address
+ *
+ * @param[in] sym the function name (unused)
+ *
+ * @param[in] line the call site source file and line (unused)
+ *
+ * @param[in] repeats the folded calls of the frame (encoded once)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+idp_formatter& idp_formatter::frame(string &dst, mem_addr_t fn, mem_addr_t site, const i8 *sym, const i8 *line, u32 repeats)
+{
+	m_encoder->frame(fn, site);
+	return *this;
+}
+
+
+/**
+ * @brief Skip a deduplicated trace repeat
+ *
+ * @param[in,out] dst the destination string (unused)
+ *
+ * @param[in] id the thread ID (unused)
+ *
+ * @param[in] nm the thread name (unused)
+ *
+ * @param[in] sig the trace signature (unused)
+ *
+ * @param[in] n the repeat count (unused)
+ *
+ * @returns *this
+ *
+ * @note NO-OP, IDP v2 has no repeat message
+ */
+inline idp_formatter& idp_formatter::repeat(string &dst, pthread_t id, const i8 *nm, u64 sig, u32 n)
+{
+	return *this;
+}
+
+
+/**
+ * @brief Forget the sent modules, names and header (e.g on a new connection)
+ *
+ * @returns *this
+ */
+idp_formatter& idp_formatter::reset()
+{
+	m_encoder->reset();
+	m_header = false;
+	return *this;
+}
+
+}
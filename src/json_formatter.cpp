@@ -0,0 +1,208 @@
+#include "../include/json_formatter.hpp"
+
+/**
+	@file src/json_formatter.cpp
+
+	@brief Class instrument::json_formatter method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Object constructor
+ */
+json_formatter::json_formatter():
+formatter(),
+m_frames(0)
+{
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ */
+json_formatter::json_formatter(const json_formatter &src):
+formatter(),
+m_frames(0)
+{
+}
+
+
+/**
+ * @brief Object destructor
+ */
+json_formatter::~json_formatter()
+{
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @returns the object copy (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+inline json_formatter* json_formatter::clone() const
+{
+	return new json_formatter(*this);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @returns *this
+ */
+inline json_formatter& json_formatter::operator=(const json_formatter &rval)
+{
+	m_frames = 0;
+	return *this;
+}
+
+
+/**
+ * @brief Append the opening of a trace object
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[in] nm the thread name (NULL for null)
+ *
+ * @param[in] depth the frame count
+ *
+ * @param[in] sig the trace signature (0 if not deduplicating)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+json_formatter& json_formatter::begin_trace(string &dst, pthread_t id, const i8 *nm, u32 depth, u64 sig)
+{
+	dst.concat("{\"thread\":", 10);
+	quote(dst, nm);
+	dst.concat(",\"tid\":\"0x", 10);
+	hex(dst, id);
+	dst.concat("\",\"depth\":", 10);
+	decimal(dst, depth);
+
+	if ( unlikely(sig != 0) ) {
+		dst.concat(",\"signature\":\"", 14);
+		hex(dst, sig, 16);
+		dst.concat("\"", 1);
+	}
+
+	dst.concat(",\"frames\":[", 11);
+	m_frames = 0;
+	return *this;
+}
+
+
+/**
+ * @brief Append the closing of a trace object (and the line end)
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] dropped the calls past the maximum depth (a "dropped" member if any)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+json_formatter& json_formatter::end_trace(string &dst, u32 dropped)
+{
+	if ( unlikely(dropped > 0) ) {
+		dst.concat("],\"dropped\":", 12);
+		decimal(dst, dropped);
+		dst.concat("}\n", 2);
+	}
+	else {
+		dst.concat("]}\n", 3);
+	}
+
+	m_frames = 0;
+	return *this;
+}
+
+
+/**
+ * @brief Append a frame object
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] fn the called function address
+ *
+ * @param[in] site the call site address
+ *
+ * @param[in] sym the function name (NULL if unresolved)
+ *
+ * @param[in] line the call site source file and line (NULL if unknown)
+ *
+ * @param[in] repeats the folded calls of the frame (a "repeats" member if more than 1)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+json_formatter& json_formatter::frame(string &dst, mem_addr_t fn, mem_addr_t site, const i8 *sym, const i8 *line, u32 repeats)
+{
+	if ( likely(m_frames++ > 0) ) {
+		dst.concat(",", 1);
+	}
+
+	dst.concat("{\"fn\":\"0x", 9);
+	hex(dst, fn);
+	dst.concat("\",\"site\":\"0x", 12);
+	hex(dst, site);
+	dst.concat("\",\"symbol\":", 11);
+	quote(dst, sym);
+	dst.concat(",\"line\":", 8);
+	quote(dst, line);
+
+	if ( unlikely(repeats > 1) ) {
+		dst.concat(",\"repeats\":", 11);
+		decimal(dst, repeats);
+	}
+
+	dst.concat("}", 1);
+	return *this;
+}
+
+
+/**
+ * @brief Append a deduplicated trace repeat object (and the line end)
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[in] nm the thread name (NULL for null)
+ *
+ * @param[in] sig the trace signature
+ *
+ * @param[in] n the repeat count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+json_formatter& json_formatter::repeat(string &dst, pthread_t id, const i8 *nm, u64 sig, u32 n)
+{
+	dst.concat("{\"thread\":", 10);
+	quote(dst, nm);
+	dst.concat(",\"tid\":\"0x", 10);
+	hex(dst, id);
+	dst.concat("\",\"signature\":\"", 15);
+	hex(dst, sig, 16);
+	dst.concat("\",\"repeats\":", 12);
+	decimal(dst, n);
+	dst.concat("}\n", 2);
+	return *this;
+}
+
+}
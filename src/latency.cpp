@@ -0,0 +1,631 @@
+#include "../include/latency.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/latency.cpp
+
+	@brief Class instrument::latency method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+__thread latency::table *latency::s_table = NULL;
+
+latency::table *latency::s_tables = NULL;
+
+const plugin *latency::s_plugin = NULL;
+
+u64 latency::s_tick0 = 0;
+
+u64 latency::s_nsec0 = 0;
+
+
+/**
+ * @brief Allocate an empty hash table storage
+ *
+ * @param[in] slots the slot count (power of 2)
+ *
+ * @returns the storage (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+latency::slab* latency::alloc(u32 slots)
+{
+	void *buf = NULL;
+	if ( unlikely(posix_memalign(&buf, g_cacheline_sz, slots * sizeof(entry)) != 0) ) {
+		throw std::bad_alloc();
+	}
+
+	memset(buf, 0, slots * sizeof(entry));
+
+	slab *retval = NULL;
+	try {
+		retval = new slab;
+	}
+	catch (...) {
+		free(buf);
+		throw;
+	}
+
+	retval->slots = slots;
+	retval->used = 0;
+	retval->entries = static_cast<entry*> (buf);
+	retval->retired = NULL;
+	return retval;
+}
+
+
+/**
+ * @brief Instrumentation starting callback
+ *
+ * @param[in] this_fn the address of the called function
+ *
+ * @param[in] call_site the address where the function was called
+ *
+ * @note
+ *	The call is already on the simulated stack, it's stamped in place unless
+ *	another timing plugin (e.g the profiler) stamped it
+ */
+void latency::begin(void *this_fn, void *call_site)
+{
+	thread *thr = process::current()->current_thread();
+
+	/* Calls made while an exception propagates are not simulated */
+	frame_t *f = thr->top();
+	if ( unlikely(f == NULL || f->fn != reinterpret_cast<mem_addr_t> (this_fn)) ) {
+		return;
+	}
+
+	if ( likely(f->stamp == 0) ) {
+		f->stamp = profiler::ticks();
+	}
+}
+
+
+/**
+ * @brief Get the histogram bucket of a duration
+ *
+ * @param[in] t the duration (in ticks)
+ *
+ * @returns the bucket index
+ *
+ * @note
+ *	The durations below 2^g_latency_sub_bits have a bucket each, then each power
+ *	of 2 is split in 2^g_latency_sub_bits buckets, by the bits that follow the
+ *	most significant one
+ */
+inline u32 latency::bucket(u64 t)
+{
+	if ( unlikely(t < (1ULL << g_latency_sub_bits)) ) {
+		return t;
+	}
+
+	u32 msb = 63 - __builtin_clzll(t);
+	if ( unlikely(msb >= g_latency_range_bits) ) {
+		return buckets() - 1;
+	}
+
+	u32 shift = msb - g_latency_sub_bits;
+	return ((shift + 1) << g_latency_sub_bits) | ((t >> shift) & ((1U << g_latency_sub_bits) - 1));
+}
+
+
+/**
+ * @brief Get the bucket count of a histogram
+ *
+ * @returns the bucket count (see g_latency_range_bits and g_latency_sub_bits)
+ */
+inline u32 latency::buckets()
+{
+	return (g_latency_range_bits - g_latency_sub_bits + 1) << g_latency_sub_bits;
+}
+
+
+/**
+ * @brief Compare the 99th percentile of two function summaries (descending order)
+ *
+ * @param[in] a the first summary
+ *
+ * @param[in] b the second summary
+ *
+ * @returns a negative, zero or positive value (list::comparator_t)
+ *
+ * @note Summaries with equal 99th percentiles are ordered by their maximum
+ */
+i32 latency::by_p99(const summary *a, const summary *b)
+{
+	if ( likely(a->p99 != b->p99) ) {
+		return (a->p99 > b->p99) ? -1 : 1;
+	}
+
+	if ( likely(a->max != b->max) ) {
+		return (a->max > b->max) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Instrumentation ending callback
+ *
+ * @param[in] this_fn the address of the returning function
+ *
+ * @param[in] call_site the address that the program counter will return to
+ *
+ * @note
+ *	The returning call is still on the simulated stack. The histogram of a
+ *	function is allocated on its first call by the thread, then the call only
+ *	increments counters (the thread is the only writer)
+ */
+void latency::end(void *this_fn, void *call_site)
+{
+	u64 now = profiler::ticks();
+
+	thread *thr = process::current()->current_thread();
+	mem_addr_t fn = reinterpret_cast<mem_addr_t> (this_fn);
+
+	/* Each frame is counted once, even if an exception is propagating */
+	const frame_t *f = thr->top();
+	if ( unlikely(f == NULL || f->fn != fn || f->stamp == 0) ) {
+		return;
+	}
+
+	u64 t = now - f->stamp;
+
+	table *tab = s_table;
+	if ( unlikely(tab == NULL) ) {
+		tab = register_thread();
+	}
+
+	entry *e = lookup(tab, fn);
+	e->counts[bucket(t)]++;
+	e->calls++;
+	if ( unlikely(t > e->max) ) {
+		e->max = t;
+	}
+}
+
+
+/**
+ * @brief Find (or insert) the histogram of a function in a thread table
+ *
+ * @param[in] t the thread table (of the current thread)
+ *
+ * @param[in] fn the function address
+ *
+ * @returns the function histogram
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The storage grows at half load. The replaced storage is kept, since a
+ *	summary may be reading it (the thread tables and the histograms live until
+ *	the process exits)
+ */
+latency::entry* latency::lookup(table *t, mem_addr_t fn)
+{
+	slab *s = t->data;
+	u32 mask = s->slots - 1;
+	u32 i = profiler::hash(fn) & mask;
+
+	while ( likely(s->entries[i].fn != 0) ) {
+		if ( likely(s->entries[i].fn == fn) ) {
+			return &s->entries[i];
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	/* The counters are allocated once, before the entry is published */
+	u64 *counts = new u64[buckets()];
+	memset(counts, 0, buckets() * sizeof(u64));
+
+	/* Insert, growing the storage first if needed */
+	if ( unlikely(2 * (s->used + 1) > s->slots) ) {
+		slab *grown = NULL;
+		try {
+			grown = alloc(2 * s->slots);
+		}
+		catch (...) {
+			delete[] counts;
+			throw;
+		}
+
+		mask = grown->slots - 1;
+		for (u32 j = 0; likely(j < s->slots); j++) {
+			const entry &cur = s->entries[j];
+			if ( likely(cur.fn == 0) ) {
+				continue;
+			}
+
+			u32 k = profiler::hash(cur.fn) & mask;
+			while ( likely(grown->entries[k].fn != 0) ) {
+				k = (k + 1) & mask;
+			}
+
+			grown->entries[k] = cur;
+		}
+
+		grown->used = s->used;
+		grown->retired = s;
+		store_release(&t->data, grown);
+		s = grown;
+
+		i = profiler::hash(fn) & mask;
+		while ( likely(s->entries[i].fn != 0) ) {
+			i = (i + 1) & mask;
+		}
+	}
+
+	s->used++;
+	s->entries[i].counts = counts;
+	store_release(&s->entries[i].fn, fn);
+	return &s->entries[i];
+}
+
+
+/**
+ * @brief Find a quantile of a histogram
+ *
+ * @param[in] counts the bucket counters
+ *
+ * @param[in] total the counted durations
+ *
+ * @param[in] max the maximum duration (in ticks)
+ *
+ * @param[in] q the quantile (in 1 / 100000, e.g 99900 for the 99.9th percentile)
+ *
+ * @returns the highest duration of the bucket of the quantile, at most max (in ticks)
+ */
+u64 latency::quantile(const u64 *counts, u64 total, u64 max, u32 q)
+{
+	u64 rank = (total * q + 99999) / 100000;
+	if ( unlikely(rank == 0) ) {
+		rank = 1;
+	}
+
+	u64 seen = 0;
+	for (u32 i = 0, n = buckets(); likely(i < n); i++) {
+		seen += counts[i];
+		if ( unlikely(seen >= rank) ) {
+			u64 retval = upper_bound(i);
+			return (likely(retval < max)) ? retval : max;
+		}
+	}
+
+	return max;
+}
+
+
+/**
+ * @brief Create the histogram table of the current thread and publish it
+ *
+ * @returns the thread table
+ *
+ * @throws std::bad_alloc
+ */
+latency::table* latency::register_thread()
+{
+	table *retval = new table;
+
+	try {
+		retval->data = alloc(g_memblock_sz);
+	}
+	catch (...) {
+		delete retval;
+		throw;
+	}
+
+	/* Lock-free push, the tables are never removed */
+	do {
+		retval->next = load_acquire(&s_tables);
+	} while ( unlikely(!compare_swap(&s_tables, retval->next, retval)) );
+
+	s_table = retval;
+	return retval;
+}
+
+
+/**
+ * @brief Get the highest duration counted in a histogram bucket
+ *
+ * @param[in] i the bucket index
+ *
+ * @returns the duration (in ticks)
+ */
+inline u64 latency::upper_bound(u32 i)
+{
+	if ( unlikely(i < (1U << g_latency_sub_bits)) ) {
+		return i;
+	}
+
+	u32 shift = (i >> g_latency_sub_bits) - 1;
+	u64 low = static_cast<u64> ((1U << g_latency_sub_bits) | (i & ((1U << g_latency_sub_bits) - 1))) << shift;
+	return low + (1ULL << shift) - 1;
+}
+
+
+/**
+ * @brief Register the latency plugin (if it's not registered)
+ *
+ * @returns the plugin
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The histograms filled while the plugin was attached before are kept
+ */
+const plugin* latency::attach()
+{
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		return NULL;
+	}
+
+	try {
+		tracer::lock();
+
+		if ( likely(s_plugin == NULL) ) {
+			s_tick0 = profiler::ticks();
+			s_nsec0 = profiler::nsec();
+			s_plugin = iface->add_plugin(begin, end);
+		}
+
+		tracer::unlock();
+		return s_plugin;
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Unregister the latency plugin (if it's registered)
+ *
+ * @throws std::bad_alloc
+ */
+void latency::detach()
+{
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		return;
+	}
+
+	try {
+		tracer::lock();
+
+		for (u32 i = 0, sz = iface->plugin_count(); likely(i < sz); i++) {
+			if ( unlikely(iface->get_plugin(i) == s_plugin) ) {
+				iface->remove_plugin(i);
+				break;
+			}
+		}
+
+		s_plugin = NULL;
+		tracer::unlock();
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Check if the latency plugin is registered
+ *
+ * @returns true if the plugin is attached, false otherwise
+ */
+bool latency::is_attached()
+{
+	return load_acquire(&s_plugin) != NULL;
+}
+
+
+/**
+ * @brief Encode the merged latency summaries as binary IDP v2 LATENCY messages
+ *
+ * @param[in,out] dst the encoder
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note One message per function, see encoder::latency
+ */
+encoder& latency::report(encoder &dst)
+{
+	list<summary> *all = summarize();
+
+	try {
+		for (u32 i = 0, sz = all->size(); likely(i < sz); i++) {
+			const summary *cur = (*all)[i];
+
+			u64 values[4] = {cur->p50, cur->p99, cur->p999, cur->max};
+			dst.latency(cur->fn, cur->calls, values, 4);
+		}
+
+		delete all;
+		return dst;
+	}
+	catch (...) {
+		delete all;
+		throw;
+	}
+}
+
+
+/**
+ * @brief
+ *	Merge the thread histograms and append the latency summary of each function
+ *	to a string, the functions with the highest 99th percentile first
+ *
+ * @param[in,out] dst the report destination string
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	Each line has the call count, the median, the 99th and 99.9th percentiles
+ *	and the maximum (in nanoseconds) of a function
+ */
+string& latency::report(string &dst)
+{
+	list<summary> *all = summarize();
+
+	try {
+		const process *proc = process::current();
+		dst.append("latency (%u functions) {\r\n", all->size());
+
+		for (u32 i = 0, sz = all->size(); likely(i < sz); i++) {
+			const summary *cur = (*all)[i];
+
+			dst.append("  %10llu %10llu %10llu %10llu %10llu ",
+								 cur->calls,
+								 cur->p50,
+								 cur->p99,
+								 cur->p999,
+								 cur->max);
+
+			const i8 *nm = proc->lookup(cur->fn);
+			if ( likely(nm != NULL) ) {
+				dst.append("%s\r\n", nm);
+			}
+			else {
+				dst.append("0x%llx\r\n", static_cast<u64> (cur->fn));
+			}
+		}
+
+		dst.append("}\r\n");
+		delete all;
+		return dst;
+	}
+	catch (...) {
+		delete all;
+		throw;
+	}
+}
+
+
+/**
+ * @brief Merge the thread histograms and summarize the latency of each function
+ *
+ * @returns the summaries (heap allocated), the highest 99th percentile first
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The histograms are merged bucket by bucket. The threads keep counting
+ *	meanwhile, so the summary of a function is computed from a consistent
+ *	snapshot of each counter, not of the whole histogram
+ */
+list<latency::summary>* latency::summarize()
+{
+	/* Calibrate the ticks against the monotonic clock, since attaching */
+	u64 scale = profiler::calibrate(s_tick0, s_nsec0);
+	u32 n = buckets();
+
+	list<entry> merged;
+	registry<mem_addr_t, entry> index;
+	list<summary> *retval = NULL;
+
+	try {
+		for (table *t = load_acquire(&s_tables); likely(t != NULL); t = t->next) {
+			const slab *s = load_acquire(&t->data);
+
+			for (u32 i = 0; likely(i < s->slots); i++) {
+				const entry &cur = s->entries[i];
+
+				mem_addr_t fn = load_acquire(&cur.fn);
+				if ( likely(fn == 0) ) {
+					continue;
+				}
+
+				entry *e = index.find(fn);
+				if ( unlikely(e == NULL) ) {
+					e = new entry;
+					e->fn = fn;
+					e->calls = e->max = 0;
+					e->counts = NULL;
+
+					try {
+						merged.add(e);
+					}
+					catch (...) {
+						delete e;
+						throw;
+					}
+
+					index.insert(fn, e);
+					e->counts = new u64[n];
+					memset(e->counts, 0, n * sizeof(u64));
+				}
+
+				for (u32 j = 0; likely(j < n); j++) {
+					e->counts[j] += cur.counts[j];
+				}
+
+				e->calls += cur.calls;
+				u64 max = cur.max;
+				if ( likely(max > e->max) ) {
+					e->max = max;
+				}
+			}
+		}
+
+		retval = new list<summary>;
+		for (u32 i = 0, sz = merged.size(); likely(i < sz); i++) {
+			const entry *cur = merged[i];
+
+			/* The quantiles are ranked among the counted durations */
+			u64 total = 0;
+			for (u32 j = 0; likely(j < n); j++) {
+				total += cur->counts[j];
+			}
+
+			summary *sum = new summary;
+			sum->fn = cur->fn;
+			sum->calls = cur->calls;
+			sum->p50 = profiler::to_nsec(quantile(cur->counts, total, cur->max, 50000), scale);
+			sum->p99 = profiler::to_nsec(quantile(cur->counts, total, cur->max, 99000), scale);
+			sum->p999 = profiler::to_nsec(quantile(cur->counts, total, cur->max, 99900), scale);
+			sum->max = profiler::to_nsec(cur->max, scale);
+
+			try {
+				retval->add(sum);
+			}
+			catch (...) {
+				delete sum;
+				throw;
+			}
+		}
+
+		retval->sort(by_p99);
+	}
+	catch (...) {
+		delete retval;
+		retval = NULL;
+	}
+
+	/* The list deletes the merged entries, not their counters */
+	for (u32 i = 0, sz = merged.size(); likely(i < sz); i++) {
+		delete[] merged[i]->counts;
+		merged[i]->counts = NULL;
+	}
+
+	if ( unlikely(retval == NULL) ) {
+		throw std::bad_alloc();
+	}
+
+	return retval;
+}
+
+}
@@ -0,0 +1,189 @@
+#include "../include/metrics.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/metrics.cpp
+
+	@brief Class instrument::metrics method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+__thread metrics::table *metrics::s_table = NULL;
+
+metrics::table *metrics::s_tables = NULL;
+
+metrics::table metrics::s_fallback;
+
+const i8 *metrics::s_names[METRIC_COUNT] = {
+	"hooks",
+	"lock_contended",
+	"lock_wait_ns",
+	"frames",
+	"lookups",
+	"lookup_hits",
+	"addr2line",
+	"stream_bytes",
+	"plugin_calls",
+	"filter_evals",
+	"dropped"
+};
+
+pthread_key_t metrics::s_exit_key;
+
+pthread_once_t metrics::s_exit_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * @brief Create the thread exit hook key (once per library instance)
+ */
+void metrics::create_exit_key()
+{
+	if ( unlikely(pthread_key_create(&s_exit_key, on_thread_exit) != 0) ) {
+		util::dbg_warn("failed to create the metrics exit key, exited thread tables are kept");
+	}
+}
+
+
+/**
+ * @brief Get the monotonic clock time
+ *
+ * @returns the time in nanoseconds
+ */
+u64 metrics::nsec()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<u64> (now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+
+/**
+ * @brief Thread exit hook, release the table of the exiting thread for reuse
+ *
+ * @param[in] arg the table
+ *
+ * @note
+ *	The counters are kept. If the thread counts events afterwards (e.g from
+ *	other thread-specific data destructors), it registers again
+ */
+void metrics::on_thread_exit(void *arg)
+{
+	table *t = static_cast<table*> (arg);
+	if ( likely(t == s_table) ) {
+		s_table = NULL;
+	}
+
+	store_release(&t->active, 0);
+}
+
+
+/**
+ * @brief Assign a table to the current thread, reusing the table of an exited thread
+ *
+ * @returns the thread table
+ *
+ * @note
+ *	Doesn't throw, if a table can't be allocated the thread counts in a shared
+ *	table (its counts may be lost to races with the other sharing threads)
+ */
+metrics::table* metrics::register_thread()
+{
+	table *retval = NULL;
+
+	/* The tables are never removed, a released table is claimed atomically */
+	for (table *t = load_acquire(&s_tables); likely(t != NULL); t = t->next) {
+		if ( unlikely(load_relaxed(&t->active) == 0 && compare_swap(&t->active, 0, 1)) ) {
+			retval = t;
+			break;
+		}
+	}
+
+	if ( likely(retval == NULL) ) {
+		retval = new (std::nothrow) table;
+		if ( unlikely(retval == NULL) ) {
+			s_table = &s_fallback;
+			return s_table;
+		}
+
+		memset(retval, 0, sizeof(table));
+		retval->active = 1;
+
+		/* Lock-free push */
+		do {
+			retval->next = load_acquire(&s_tables);
+		} while ( unlikely(!compare_swap(&s_tables, retval->next, retval)) );
+	}
+
+	pthread_once(&s_exit_once, create_exit_key);
+	pthread_setspecific(s_exit_key, retval);
+
+	s_table = retval;
+	return retval;
+}
+
+
+/**
+ * @brief Acquire a mutex, counting the acquisition if the mutex is contended
+ *
+ * @param[in] mtx the mutex
+ *
+ * @note
+ *	An uncontended acquisition costs a single trylock. A contended one adds the
+ *	time waited to METRIC_LOCK_WAIT
+ */
+void metrics::lock(pthread_mutex_t *mtx)
+{
+	if ( likely(pthread_mutex_trylock(mtx) == 0) ) {
+		return;
+	}
+
+	u64 start = nsec();
+	pthread_mutex_lock(mtx);
+
+	add(METRIC_LOCK_CONTENDED);
+	add(METRIC_LOCK_WAIT, nsec() - start);
+}
+
+
+/**
+ * @brief Merge the counters of all threads
+ *
+ * @param[out] dst the merged counters (METRIC_COUNT counters, by METRIC_* definition)
+ *
+ * @note
+ *	The counters are read without stopping the counting threads, so they are
+ *	not a consistent snapshot (e.g the hook count may include an event whose
+ *	lock wait is not counted yet)
+ */
+void metrics::merge(u64 *dst)
+{
+	memset(dst, 0, METRIC_COUNT * sizeof(u64));
+
+	for (table *t = load_acquire(&s_tables); likely(t != NULL); t = t->next) {
+		for (u32 i = 0; likely(i < METRIC_COUNT); i++) {
+			dst[i] += load_relaxed(&t->counters[i]);
+		}
+	}
+
+	for (u32 i = 0; likely(i < METRIC_COUNT); i++) {
+		dst[i] += load_relaxed(&s_fallback.counters[i]);
+	}
+}
+
+
+/**
+ * @brief Get the name of a counter
+ *
+ * @param[in] which the counter (METRIC_* definition)
+ *
+ * @returns the counter name or NULL if there's no such counter
+ */
+const i8* metrics::name(u32 which)
+{
+	return (likely(which < METRIC_COUNT)) ? s_names[which] : NULL;
+}
+
+}
@@ -1,4 +1,5 @@
 #include "../include/parser.hpp"
+#include "../include/config/config_dictionaries.hpp"
 #include "../include/util.hpp"
 
 /**
@@ -15,6 +16,8 @@ parser *parser::s_default = NULL;
 
 style *parser::s_fallback = NULL;
 
+bool parser::s_delimiters[256] = {false};
+
 
 /**
  * @brief Library constructor
@@ -25,22 +28,33 @@ style *parser::s_fallback = NULL;
  */
 void parser::on_lib_load()
 {
+	/* Build the delimiter lookup table of the default (stack trace) syntax */
+	for (const i8 *c = g_trace_delimiters; likely(*c != '\0'); c++) {
+		s_delimiters[static_cast<u8> (*c)] = true;
+	}
+
 	try {
 		/* Create the default parser */
 		s_default = new parser;
 
 		/*
 		 * Equip the default parser with dictionaries for C++ keywords, intrinsic
-		 * types and file extensions
+		 * types and file extensions (embedded, so no file is read)
 		 */
-		string path("%s/etc/extensions.dict", util::prefix());
-		s_default->add_dictionary("extensions", path.cstring(), REGEXP_LOOKUP_MODE);
+		s_default->add_default_dictionary("extensions",
+																			g_dict_extensions,
+																			g_dict_extensions_cnt,
+																			REGEXP_LOOKUP_MODE);
 
-		path.set("%s/etc/keywords.dict", util::prefix());
-		s_default->add_dictionary("keywords", path.cstring(), SIMPLE_LOOKUP_MODE);
+		s_default->add_default_dictionary("keywords",
+																			g_dict_keywords,
+																			g_dict_keywords_cnt,
+																			SIMPLE_LOOKUP_MODE);
 
-		path.set("%s/etc/types.dict", util::prefix());
-		s_default->add_dictionary("types", path.cstring(), SIMPLE_LOOKUP_MODE);
+		s_default->add_default_dictionary("types",
+																			g_dict_types,
+																			g_dict_types_cnt,
+																			SIMPLE_LOOKUP_MODE);
 
 		/*
 		 * Create the default, fallback style. When a highlighter can't determine or
@@ -114,6 +128,67 @@ void parser::on_lib_unload()
 }
 
 
+/**
+ * @brief Check if a token is a decimal or hexadecimal number
+ *
+ * @param[in] text the token text
+ *
+ * @param[in] len the token length
+ *
+ * @returns true if the token matches ^0x[0-9a-f]+$|^[0-9]+$ (ignoring case)
+ */
+bool parser::is_number(const i8 *text, u32 len)
+{
+	if ( unlikely(len == 0) ) {
+		return false;
+	}
+
+	u32 i = 0;
+	bool hex = (len > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'));
+	if ( unlikely(hex) ) {
+		i = 2;
+	}
+
+	for (; likely(i < len); i++) {
+		u8 ch = static_cast<u8> (text[i]);
+		if ( likely((hex) ? !isxdigit(ch) : !isdigit(ch)) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief
+ *	Measure a run of delimiter (or non-delimiter) characters of the default
+ *	syntax, at the beginning of some text
+ *
+ * @param[in] text the text
+ *
+ * @param[in] len the text length
+ *
+ * @param[in] delim true to measure delimiters, false for non-delimiters
+ *
+ * @returns the run length
+ *
+ * @note
+ *	Characters are classified with a lookup table and no per-character branch
+ *	on the delimiter set, so the loop can be replaced by a vectorized scan
+ *	without changing the lexer
+ */
+inline u32 parser::span(const i8 *text, u32 len, bool delim)
+{
+	u32 i = 0;
+	while ( likely(i < len && s_delimiters[static_cast<u8> (text[i])] == delim) ) {
+		i++;
+	}
+
+	return i;
+}
+
+
 /**
  * @brief Stream insertion operator for instrument::parser objects
  *
@@ -129,9 +204,9 @@ std::ostream& operator<<(std::ostream &lval, const parser &rval)
 
 	/* If an exception occurs, output its details instead of rval */
 	try {
-		string *buf = rval.highlight();
-		lval << *buf;
-		delete buf;
+		string buf;
+		rval.highlight(buf);
+		lval << buf;
 	}
 	catch (exception &x) {
 		lval << x;
@@ -160,8 +235,7 @@ m_styles(NULL)
 	m_styles = new chain<style>;
 }
 catch (...) {
-	delete[] m_data;
-	m_data = NULL;
+	release();
 
 	delete m_dictionaries;
 	m_dictionaries = NULL;
@@ -185,8 +259,7 @@ m_styles(NULL)
 	m_styles = src.m_styles->clone();
 }
 catch (...) {
-	delete[] m_data;
-	m_data = NULL;
+	release();
 
 	delete m_dictionaries;
 	m_dictionaries = NULL;
@@ -294,6 +367,38 @@ dictionary* parser::add_dictionary(const i8 *nm, const i8 *path, bool mode)
 }
 
 
+/**
+ * @brief Add a dictionary to the parser, loaded from a word table
+ *
+ * @param[in] nm the dictionary name
+ *
+ * @param[in] words the dictionary words
+ *
+ * @param[in] cnt the word count
+ *
+ * @param[in] mode the lookup mode (REGEXP_LOOKUP_MODE or SIMPLE_LOOKUP_MODE)
+ *
+ * @returns the new dictionary (heap allocated)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+dictionary* parser::add_dictionary(const i8 *nm, const i8 *const *words, u32 cnt, bool mode)
+{
+	dictionary *retval = NULL;
+	try {
+		retval = new dictionary(nm, NULL, mode);
+		retval->load_words(words, cnt);
+		m_dictionaries->add(retval);
+		return retval;
+	}
+	catch (...) {
+		delete retval;
+		throw;
+	}
+}
+
+
 /**
  * @brief Add a dictionary to the parser
  *
@@ -325,8 +430,8 @@ dictionary* parser::get_dictionary(const i8 *nm) const
 		return NULL;
 	}
 
-	for (u32 i = 0, sz = m_dictionaries->size(); likely(i < sz); i++) {
-		dictionary *dict = m_dictionaries->at(i);
+	for (chain<dictionary>::cursor cur = m_dictionaries->first(); likely(cur.is_valid()); cur.next()) {
+		dictionary *dict = cur.data();
 
 		if ( unlikely(strcmp(dict->name(), nm) == 0) ) {
 			return dict;
@@ -350,9 +455,9 @@ const chain<string>* parser::get_dictionary_names() const
 	string *nm = NULL;
 
 	try {
-		for (u32 i = 0, sz = m_dictionaries->size(); likely(i < sz); i++) {
-			nm = new string(m_dictionaries->at(i)->name());
-			retval->add(nm);
+		for (chain<dictionary>::cursor cur = m_dictionaries->first(); likely(cur.is_valid()); cur.next()) {
+			nm = new string(cur.data()->name());
+			retval->add(nm, true);
 			nm = NULL;
 		}
 
@@ -392,11 +497,11 @@ parser& parser::remove_dictionary(const i8 *nm)
 		return *this;
 	}
 
-	for (u32 i = 0, sz = m_dictionaries->size(); likely(i < sz); i++) {
-		const dictionary *dict = m_dictionaries->at(i);
+	for (chain<dictionary>::cursor cur = m_dictionaries->first(); likely(cur.is_valid()); cur.next()) {
+		const dictionary *dict = cur.data();
 
 		if ( unlikely(strcmp(dict->name(), nm) == 0) ) {
-			m_dictionaries->remove(i);
+			m_dictionaries->remove(cur.index());
 			break;
 		}
 	}
@@ -467,8 +572,8 @@ style* parser::get_style(const i8 *nm) const
 		return s_fallback;
 	}
 
-	for (u32 i = 0, sz = m_styles->size(); likely(i < sz); i++) {
-		style *stl = m_styles->at(i);
+	for (chain<style>::cursor cur = m_styles->first(); likely(cur.is_valid()); cur.next()) {
+		style *stl = cur.data();
 
 		if ( unlikely(strcmp(stl->name(), nm) == 0) ) {
 			return stl;
@@ -492,9 +597,9 @@ const chain<string>* parser::get_style_names() const
 	string *nm = NULL;
 
 	try {
-		for (u32 i = 0, sz = m_styles->size(); likely(i < sz); i++) {
-			nm = new string(m_styles->at(i)->name());
-			retval->add(nm);
+		for (chain<style>::cursor cur = m_styles->first(); likely(cur.is_valid()); cur.next()) {
+			nm = new string(cur.data()->name());
+			retval->add(nm, true);
 			nm = NULL;
 		}
 
@@ -534,11 +639,11 @@ parser& parser::remove_style(const i8 *nm)
 		return *this;
 	}
 
-	for (u32 i = 0, sz = m_styles->size(); likely(i < sz); i++) {
-		const style *stl = m_styles->at(i);
+	for (chain<style>::cursor cur = m_styles->first(); likely(cur.is_valid()); cur.next()) {
+		const style *stl = cur.data();
 
 		if ( unlikely(strcmp(stl->name(), nm) == 0) ) {
-			m_styles->remove(i);
+			m_styles->remove(cur.index());
 			break;
 		}
 	}
@@ -547,6 +652,123 @@ parser& parser::remove_style(const i8 *nm)
 }
 
 
+/**
+ * @brief Add a default dictionary, embedded or replaced by a user file
+ *
+ * @param[in] nm the dictionary name
+ *
+ * @param[in] words the embedded words
+ *
+ * @param[in] cnt the embedded word count
+ *
+ * @param[in] mode the lookup mode (REGEXP_LOOKUP_MODE or SIMPLE_LOOKUP_MODE)
+ *
+ * @returns the new dictionary (heap allocated)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	If the g_dict_env shell variable names a directory with a file named after
+ *	the dictionary (e.g keywords.dict), the file is loaded instead of the
+ *	embedded words. Otherwise no file is accessed
+ */
+dictionary* parser::add_default_dictionary(const i8 *nm, const i8 *const *words, u32 cnt, bool mode)
+{
+	const i8 *dir = ::getenv(g_dict_env);
+	if ( unlikely(dir != NULL && *dir != '\0') ) {
+		string path("%s/%s.dict", dir, nm);
+
+		fileinfo_t inf;
+		if ( likely(stat(path.cstring(), &inf) == 0) ) {
+			return add_dictionary(nm, path.cstring(), mode);
+		}
+	}
+
+	return add_dictionary(nm, words, cnt, mode);
+}
+
+
+/**
+ * @brief Select the style of a token
+ *
+ * @param[in] pal the resolved styles and dictionaries
+ *
+ * @param[in] token the token
+ *
+ * @param[in] delim the delimiter following the token
+ *
+ * @param[in] dlen the delimiter length
+ *
+ * @param[in] found false if the token is the last one (no delimiter follows)
+ *
+ * @returns the token style
+ *
+ * @throws instrument::exception
+ */
+const style* parser::classify(const palette &pal, const string &token,
+															const i8 *delim, u32 dlen, bool found) const
+{
+	if ( unlikely(is_number(token.cstring(), token.length())) ) {
+		return pal.number;
+	}
+
+	if ( unlikely(pal.keywords != NULL && pal.keywords->lookup(token) != NULL) ) {
+		return pal.keyword;
+	}
+
+	if ( unlikely(pal.types != NULL && pal.types->lookup(token) != NULL) ) {
+		return pal.type;
+	}
+
+	/* Ignore case for extension (regexp) lookups */
+	if ( unlikely(pal.extensions != NULL && pal.extensions->lookup(token, true) != NULL) ) {
+		return pal.file;
+	}
+
+	/* Select the style based on the next delimiter */
+	if ( likely(found && dlen > 0) ) {
+		i8 ch = delim[0];
+
+		if ( unlikely(dlen == 2 && ch == ':' && delim[1] == ':') ) {
+			return pal.scope;
+		}
+
+		if ( unlikely(ch == '(' || ch == '<' || ch == '\r') ) {
+			return pal.function;
+		}
+	}
+
+	/* The token was not identified (plain text) */
+	return s_fallback;
+}
+
+
+/**
+ * @brief Resolve the styles and the dictionaries used while highlighting
+ *
+ * @param[out] pal the resolved styles and dictionaries
+ *
+ * @returns *this
+ */
+parser& parser::resolve(palette &pal) const
+{
+	pal.delimiter = get_style("delimiter");
+	pal.file = get_style("file");
+	pal.function = get_style("function");
+	pal.keyword = get_style("keyword");
+	pal.number = get_style("number");
+	pal.scope = get_style("scope");
+	pal.type = get_style("type");
+
+	pal.keywords = get_dictionary("keywords");
+	pal.types = get_dictionary("types");
+	pal.extensions = get_dictionary("extensions");
+
+	return const_cast<parser&> (*this);
+}
+
+
 /**
  * @brief Highlight (escape) the current buffer using a custom syntax
  *
@@ -561,73 +783,111 @@ parser& parser::remove_style(const i8 *nm)
  */
 string* parser::highlight(const i8 *syntax, bool icase) const
 {
-	const i8 *num = "^0x[0-9a-f]+$|^[0-9]+$";
-
 	string *retval = new string;
-	chain<string> *tokens = NULL;
 
-	/* If an exception occurs, release resources and rethrow it */
 	try {
-		/* Parse the buffer */
-		tokens = parse(syntax, icase);
-
-		/* Highlight and append each token in the result */
-		for (u32 i = 0, sz = tokens->size(); likely(i < sz); i++) {
-			string *token = tokens->at(i);
-
-			/* Select the style for the current token */
-			const style *cur = NULL;
-			if ( likely(i % 2 == 1) ) {
-				cur = get_style("delimiter");
-			}
+		highlight(*retval, syntax, icase);
+		return retval;
+	}
+	catch (...) {
+		delete retval;
+		throw;
+	}
+}
 
-			else if ( unlikely(token->match(num, true)) ) {
-				cur = get_style("number");
-			}
 
-			else if ( unlikely(lookup(*token, "keywords")) ) {
-				cur = get_style("keyword");
-			}
+/**
+ * @brief
+ *	Highlight (escape) the current buffer using a custom syntax, appending the
+ *	escaped text to a string
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] syntax a POSIX extended regular expression (can be NULL)
+ *
+ * @param[in] icase true to ignore case while parsing
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The buffer is scanned once and each token is escaped straight into dst,
+ *	without an intermediate token list. The default syntax (g_trace_syntax) is
+ *	scanned with a lookup table instead of a regular expression
+ */
+parser& parser::highlight(string &dst, const i8 *syntax, bool icase) const
+{
+	palette pal;
+	resolve(pal);
+
+	/* Compile (or obtain) a custom syntax expression */
+	const pattern *expr = NULL;
+	pattern *tmp = NULL;
+	if ( unlikely(syntax != NULL && strcmp(syntax, g_trace_syntax) != 0) ) {
+		i32 flags = REG_EXTENDED;
+		if ( unlikely(icase) ) {
+			flags |= REG_ICASE;
+		}
 
-			else if ( unlikely(lookup(*token, "types")) ) {
-				cur = get_style("type");
-			}
+		expr = pattern::cached(syntax, flags);
+		if ( unlikely(expr == NULL) ) {
+			expr = tmp = new pattern(syntax, flags);
+		}
+	}
 
-			/* Ignore case for extension (regexp) lookups */
-			else if ( unlikely(lookup(*token, "extensions", true)) ) {
-				cur = get_style("file");
+	/* If an exception occurs, release resources and rethrow it */
+	try {
+		/* Scratch token, reused for each dictionary lookup */
+		string token;
+
+		const i8 *pos = m_data;
+		u32 left = m_length;
+		while (true) {
+			u32 tlen = left;
+			u32 dlen = 0;
+			bool found;
+
+			/* Find the next delimiter */
+			if ( likely(expr == NULL) ) {
+				tlen = span(pos, left, false);
+				dlen = span(pos + tlen, left - tlen, true);
+				found = (dlen > 0);
 			}
-
-			/* Select the style based on the next delimiter */
-			else if ( likely(i < sz - 1) ) {
-				string *delim = tokens->at(i + 1);
-				i8 ch = delim->at(0);
-
-				if ( unlikely(delim->compare("::") == 0) ) {
-					cur = get_style("scope");
+			else {
+				regmatch_t match;
+				found = expr->search(pos, left, match);
+				if ( likely(found) ) {
+					if ( unlikely(match.rm_eo == 0) ) {
+						throw exception("logic error in regular expression '%s'", syntax);
+					}
+
+					tlen = match.rm_so;
+					dlen = match.rm_eo - match.rm_so;
 				}
+			}
 
-				else if ( unlikely(ch == '(' || ch == '<' || ch == '\r') ) {
-					cur = get_style("function");
-				}
+			/* Apply the selected style to the token and the delimiter */
+			if ( likely(tlen > 0) ) {
+				token.clear().concat(pos, tlen);
+				classify(pal, token, pos + tlen, dlen, found)->apply(dst, pos, tlen);
 			}
 
-			/* If the token was not identified (plain text) */
-			if ( unlikely(cur == NULL) ) {
-				cur = s_fallback;
+			if ( unlikely(!found) ) {
+				break;
 			}
 
-			/* Apply the style to the token and append it to the result buffer */
-			cur->apply(*token);
-			retval->append(*token);
+			pal.delimiter->apply(dst, pos + tlen, dlen);
+			pos += tlen + dlen;
+			left -= tlen + dlen;
 		}
 
-		delete tokens;
-		return retval;
+		delete tmp;
+		return const_cast<parser&> (*this);
 	}
 	catch (...) {
-		delete tokens;
-		delete retval;
+		delete tmp;
 		throw;
 	}
 }
@@ -670,8 +930,8 @@ inline bool parser::lookup(const string &exp, const i8 *nm, bool icase) const
  */
 const i8* parser::lookup(const string &exp, bool icase) const
 {
-	for (u32 i = 0, sz = m_dictionaries->size(); likely(i < sz); i++) {
-		const dictionary *dict = m_dictionaries->at(i);
+	for (chain<dictionary>::cursor cur = m_dictionaries->first(); likely(cur.is_valid()); cur.next()) {
+		const dictionary *dict = cur.data();
 
 		if ( unlikely(dict->lookup(exp, icase) != NULL) ) {
 			return dict->name();
@@ -0,0 +1,413 @@
+#include "../include/patcher.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/patcher.cpp
+
+	@brief Class instrument::patcher method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+pthread_mutex_t patcher::s_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+mem_addr_t patcher::s_map_begin = 0;
+
+mem_addr_t patcher::s_map_end = 0;
+
+i32 patcher::s_map_prot = 0;
+
+
+/**
+ * @brief Decode the instruction before a hook return address
+ *
+ * @param[in] ret the return address of the hook
+ *
+ * @param[in] hook the hook address
+ *
+ * @returns the length of the call instruction or 0 if it's not a call of the hook
+ */
+u32 patcher::decode(mem_addr_t ret, mem_addr_t hook)
+{
+#if defined __x86_64__
+	const u8 *pc = reinterpret_cast<const u8*> (ret);
+	i32 disp;
+
+	/* Direct call, to the hook or to its PLT stub */
+	if ( likely(pc[-5] == 0xe8) ) {
+		memcpy(&disp, pc - 4, sizeof(disp));
+
+		mem_addr_t target = ret + disp;
+		if ( likely(target == hook || is_stub(target, hook)) ) {
+			return 5;
+		}
+	}
+
+	/* Indirect call through the GOT slot of the hook */
+	if ( unlikely(pc[-6] == 0xff && pc[-5] == 0x15) ) {
+		memcpy(&disp, pc - 4, sizeof(disp));
+
+		if ( likely(*reinterpret_cast<const mem_addr_t*> (ret + disp) == hook) ) {
+			return 6;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+
+/**
+ * @brief Check if a call target is the PLT stub of a hook
+ *
+ * @param[in] target the call target
+ *
+ * @param[in] hook the hook address
+ *
+ * @returns true if the target jumps through the GOT slot of the hook, false otherwise
+ *
+ * @note The stub may start with endbr64 and a bnd prefix (.plt.sec stubs)
+ */
+bool patcher::is_stub(mem_addr_t target, mem_addr_t hook)
+{
+#if defined __x86_64__
+	const u8 *pc = reinterpret_cast<const u8*> (target);
+	if ( likely(pc[0] == 0xf3 && pc[1] == 0x0f && pc[2] == 0x1e && pc[3] == 0xfa) ) {
+		pc += 4;
+	}
+
+	if ( likely(pc[0] == 0xf2) ) {
+		pc++;
+	}
+
+	if ( unlikely(pc[0] != 0xff || pc[1] != 0x25) ) {
+		return false;
+	}
+
+	i32 disp;
+	memcpy(&disp, pc + 2, sizeof(disp));
+
+	const mem_addr_t *slot = reinterpret_cast<const mem_addr_t*> (pc + 6 + disp);
+	return (*slot == hook);
+#else
+	return false;
+#endif
+}
+
+
+/**
+ * @brief Get the protection of the mapping that contains an address
+ *
+ * @param[in] addr the address
+ *
+ * @returns the PROT_* flags (PROT_READ | PROT_EXEC if the mapping is not found)
+ *
+ * @note
+ *	patcher::s_write_lock must be held. The mapping is cached, so consecutive
+ *	writes in the same module read /proc/self/maps once. Doesn't allocate
+ */
+i32 patcher::protection(mem_addr_t addr)
+{
+	if ( likely(addr >= s_map_begin && addr < s_map_end) ) {
+		return s_map_prot;
+	}
+
+	i32 fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+	if ( unlikely(fd < 0) ) {
+		return PROT_READ | PROT_EXEC;
+	}
+
+	/* Each line starts with "begin-end perms", the rest is skipped */
+	mem_addr_t bounds[2] = {0, 0};
+	i32 prot = 0;
+	u32 field = 0;
+	bool found = false;
+
+	i8 buf[4096];
+	ssize_t len = 0;
+	while ( likely(!found && (len = read(fd, buf, sizeof(buf))) > 0) ) {
+		for (ssize_t i = 0; likely(i < len && !found); i++) {
+			i8 c = buf[i];
+			if ( unlikely(c == '\n') ) {
+				if ( unlikely(field >= 2 && addr >= bounds[0] && addr < bounds[1]) ) {
+					found = true;
+					break;
+				}
+
+				bounds[0] = bounds[1] = 0;
+				prot = 0;
+				field = 0;
+			}
+			else if ( field < 2 ) {
+				if ( unlikely((field == 0 && c == '-') || (field == 1 && c == ' ')) ) {
+					field++;
+				}
+				else {
+					u32 digit = (c >= 'a') ? c - 'a' + 10 : c - '0';
+					bounds[field] = (bounds[field] << 4) | (digit & 0xf);
+				}
+			}
+			else if ( field == 2 ) {
+				if ( unlikely(c == ' ') ) {
+					field++;
+				}
+				else if ( c == 'r' ) {
+					prot |= PROT_READ;
+				}
+				else if ( c == 'w' ) {
+					prot |= PROT_WRITE;
+				}
+				else if ( c == 'x' ) {
+					prot |= PROT_EXEC;
+				}
+			}
+		}
+	}
+
+	close(fd);
+	if ( unlikely(!found) ) {
+		return PROT_READ | PROT_EXEC;
+	}
+
+	s_map_begin = bounds[0];
+	s_map_end = bounds[1];
+	s_map_prot = prot;
+	return prot;
+}
+
+
+/**
+ * @brief Replace 8 bytes of code atomically
+ *
+ * @param[in] window the code address (the 8 bytes are within a cache line)
+ *
+ * @param[in] expected the current bytes
+ *
+ * @param[in] replacement the new bytes
+ *
+ * @returns true if the bytes were replaced, false otherwise
+ *
+ * @note
+ *	The page is made writable and then gets its original protection back. The
+ *	code writes are serialized (patcher::s_write_lock), whatever lock the
+ *	caller holds, so concurrent writes to the same page don't race on its
+ *	protection
+ */
+bool patcher::write(mem_addr_t window, u64 expected, u64 replacement)
+{
+	mem_addr_t pgsz = sysconf(_SC_PAGESIZE);
+	void *page = reinterpret_cast<void*> (window & ~(pgsz - 1));
+
+	pthread_mutex_lock(&s_write_lock);
+
+	i32 prot = protection(window);
+	if ( unlikely(mprotect(page, pgsz, prot | PROT_WRITE) != 0) ) {
+		pthread_mutex_unlock(&s_write_lock);
+		util::dbg_warn("failed to make the code at %p writable (%s)", window, strerror(errno));
+		return false;
+	}
+
+	/* Lock cmpxchg is atomic within a cache line, even if unaligned */
+	u64 *code = reinterpret_cast<u64*> (window);
+	bool retval = compare_swap(code, expected, replacement);
+
+	if ( likely(!(prot & PROT_WRITE)) ) {
+		mprotect(page, pgsz, prot);
+	}
+
+	i8 *begin = reinterpret_cast<i8*> (window);
+	__builtin___clear_cache(begin, begin + sizeof(u64));
+
+	pthread_mutex_unlock(&s_write_lock);
+	return retval;
+}
+
+
+/**
+ * @brief Object default constructor
+ *
+ * @throws std::bad_alloc
+ */
+patcher::patcher()
+try:
+m_index(NULL),
+m_sites(NULL),
+m_count(0),
+m_lock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP)
+{
+	m_index = new registry<mem_addr_t, site>;
+}
+catch (...) {
+	m_index = NULL;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+patcher::patcher(const patcher &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline patcher* patcher::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object destructor
+ *
+ * @note The patched sites are not reverted (they stop calling hooks of an unloaded library)
+ */
+patcher::~patcher()
+{
+	delete m_index;
+	m_index = NULL;
+
+	while ( likely(m_sites != NULL) ) {
+		site *next = m_sites->next;
+		delete m_sites;
+		m_sites = next;
+	}
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline patcher& patcher::operator=(const patcher &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Get the patched site count
+ *
+ * @returns this->m_count
+ */
+inline u32 patcher::count() const
+{
+	return load_acquire(&m_count);
+}
+
+
+/**
+ * @brief Patch the call of a hook into a NOP
+ *
+ * @param[in] ret the return address of the hook call
+ *
+ * @param[in] hook the hook address
+ *
+ * @returns true if the call was patched, false otherwise
+ *
+ * @note
+ *	Doesn't throw. A site that was tried before is not tried again (until
+ *	patcher::revert), the check doesn't lock
+ */
+bool patcher::patch(mem_addr_t ret, mem_addr_t hook)
+{
+	if ( likely(m_index->find(ret) != NULL) ) {
+		return false;
+	}
+
+	pthread_mutex_lock(&m_lock);
+
+	site *s = NULL;
+	if ( unlikely(m_index->find(ret) != NULL || (s = new (std::nothrow) site) == NULL) ) {
+		pthread_mutex_unlock(&m_lock);
+		return false;
+	}
+
+	s->window = 0;
+	s->code = 0;
+	s->patched = 0;
+
+	/* The replaced instruction must be within a cache line */
+	u32 len = decode(ret, hook);
+	mem_addr_t begin = ret - len;
+	mem_addr_t line = (begin | (g_cacheline_sz - 1)) + 1;
+
+	if ( likely(len > 0 && ret <= line) ) {
+		static const u8 nops[][6] = {
+			{0x0f, 0x1f, 0x44, 0x00, 0x00, 0x00},
+			{0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00}
+		};
+
+		s->window = (likely(begin + sizeof(u64) <= line)) ? begin : line - sizeof(u64);
+		memcpy(&s->code, reinterpret_cast<const void*> (s->window), sizeof(u64));
+
+		u64 patched = s->code;
+		memcpy(reinterpret_cast<u8*> (&patched) + (begin - s->window), nops[len - 5], len);
+
+		if ( likely(write(s->window, s->code, patched)) ) {
+			s->patched = patched;
+			store_release(&m_count, m_count + 1);
+		}
+	}
+
+	/* If the site can't be indexed, it's tried again */
+	try {
+		m_index->insert(ret, s);
+		s->next = m_sites;
+		m_sites = s;
+	}
+	catch (...) {
+		delete s;
+		s = NULL;
+	}
+
+	pthread_mutex_unlock(&m_lock);
+	return (likely(s != NULL) && s->patched != 0);
+}
+
+
+/**
+ * @brief Restore the original instructions of the patched sites and forget all sites
+ *
+ * @returns *this
+ *
+ * @note
+ *	A site whose code changed meanwhile (e.g an unloaded module) is not
+ *	restored. The functions call the hooks again when they're called next, a
+ *	call that entered while its site was patched returns through the hook
+ */
+patcher& patcher::revert()
+{
+	pthread_mutex_lock(&m_lock);
+
+	m_index->clear();
+	while ( likely(m_sites != NULL) ) {
+		site *s = m_sites;
+		if ( likely(s->patched != 0) ) {
+			write(s->window, s->patched, s->code);
+		}
+
+		m_sites = s->next;
+		delete s;
+	}
+
+	store_release(&m_count, 0);
+	pthread_mutex_unlock(&m_lock);
+	return *this;
+}
+
+}
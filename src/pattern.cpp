@@ -0,0 +1,306 @@
+#include "../include/pattern.hpp"
+
+/**
+	@file src/pattern.cpp
+
+	@brief Class instrument::pattern method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+registry<u64, pattern> *pattern::s_cache = NULL;
+
+pthread_mutex_t pattern::s_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @brief Dispose a cached pattern (registry callback)
+ *
+ * @param[in] i the pattern offset (unused)
+ *
+ * @param[in] p the pattern
+ */
+void pattern::dispose(u32 i, pattern *p)
+{
+	delete p;
+}
+
+
+/**
+ * @brief Get the cache key of an expression (FNV-1a hash)
+ *
+ * @param[in] expr the expression
+ *
+ * @param[in] flags the compilation flags
+ *
+ * @returns the key (never 0, the reserved registry key)
+ */
+u64 pattern::key(const i8 *expr, i32 flags)
+{
+	u64 h = 14695981039346656037ULL ^ static_cast<u32> (flags);
+	h *= 1099511628211ULL;
+
+	for (const i8 *c = expr; likely(*c != '\0'); c++) {
+		h ^= static_cast<u8> (*c);
+		h *= 1099511628211ULL;
+	}
+
+	return (likely(h != 0)) ? h : 1;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+pattern::pattern(const pattern &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline pattern* pattern::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline pattern& pattern::operator=(const pattern &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Get a cached pattern, compiling (and caching) it upon the first request
+ *
+ * @param[in] expr the regular expression
+ *
+ * @param[in] flags the compilation flags (REG_EXTENDED by default)
+ *
+ * @returns the pattern (owned by the cache) or NULL if it can't be cached
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	This method is thread safe and a cached pattern is found without locking.
+ *	When the cache is full (or the key collides with another pattern) NULL is
+ *	returned, the caller should compile a pattern of its own
+ */
+const pattern* pattern::cached(const i8 *expr, i32 flags)
+{
+	if ( unlikely(expr == NULL) ) {
+		throw exception("invalid argument: expr (=%p)", expr);
+	}
+
+	u64 k = key(expr, flags);
+	const registry<u64, pattern> *cache = load_acquire(&s_cache);
+
+	const pattern *retval = NULL;
+	if ( likely(cache != NULL) ) {
+		retval = cache->find(k);
+	}
+
+	if ( unlikely(retval == NULL) ) {
+		pthread_mutex_lock(&s_lock);
+
+		try {
+			if ( unlikely(s_cache == NULL) ) {
+				registry<u64, pattern> *tmp = new registry<u64, pattern>;
+				store_release(&s_cache, tmp);
+			}
+
+			/* The pattern may have been cached meanwhile */
+			retval = s_cache->find(k);
+			if ( likely(retval == NULL && s_cache->size() < g_pattern_cache_sz) ) {
+				pattern *p = new pattern(expr, flags);
+
+				try {
+					s_cache->insert(k, p);
+				}
+				catch (...) {
+					delete p;
+					throw;
+				}
+
+				retval = p;
+			}
+		}
+		catch (...) {
+			pthread_mutex_unlock(&s_lock);
+			throw;
+		}
+
+		pthread_mutex_unlock(&s_lock);
+		if ( unlikely(retval == NULL) ) {
+			return NULL;
+		}
+	}
+
+	/* Verify that the key didn't collide */
+	if ( likely(retval->m_flags == flags && strcmp(retval->m_src_expr, expr) == 0) ) {
+		return retval;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief Dispose all cached patterns
+ *
+ * @note
+ *	Not thread safe, the patterns returned by pattern::cached must not be in
+ *	use. This method is called when the library is unloaded
+ */
+void pattern::flush()
+{
+	pthread_mutex_lock(&s_lock);
+
+	if ( likely(s_cache != NULL) ) {
+		s_cache->each(dispose);
+		delete s_cache;
+		s_cache = NULL;
+	}
+
+	pthread_mutex_unlock(&s_lock);
+}
+
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] expr the regular expression
+ *
+ * @param[in] flags the compilation flags (REG_EXTENDED by default)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+pattern::pattern(const i8 *expr, i32 flags):
+m_src_expr(NULL),
+m_flags(flags)
+{
+	if ( unlikely(expr == NULL) ) {
+		throw exception("invalid argument: expr (=%p)", expr);
+	}
+
+	m_src_expr = new i8[strlen(expr) + 1];
+	strcpy(m_src_expr, expr);
+
+	/* Compile the regular expression */
+	i32 retval = regcomp(&m_expr, expr, flags);
+	if ( likely(retval == 0) ) {
+		return;
+	}
+
+	delete[] m_src_expr;
+	m_src_expr = NULL;
+
+	/* If the expression compilation failed */
+	i32 len = regerror(retval, &m_expr, NULL, 0);
+	i8 errbuf[len];
+	regerror(retval, &m_expr, errbuf, len);
+	regfree(&m_expr);
+
+	throw exception(
+		"failed to compile regexp '%s' (regex errno %d - %s)",
+		expr,
+		retval,
+		errbuf
+	);
+}
+
+
+/**
+ * @brief Object destructor
+ */
+pattern::~pattern()
+{
+	delete[] m_src_expr;
+	m_src_expr = NULL;
+
+	regfree(&m_expr);
+}
+
+
+/**
+ * @brief Get the source (uncompiled) expression
+ *
+ * @returns this->m_src_expr
+ */
+inline const i8* pattern::expr() const
+{
+	return m_src_expr;
+}
+
+
+/**
+ * @brief Get the compilation flags
+ *
+ * @returns this->m_flags
+ */
+inline i32 pattern::flags() const
+{
+	return m_flags;
+}
+
+
+/**
+ * @brief Match a text against the pattern
+ *
+ * @param[in] text the text (can be NULL)
+ *
+ * @returns true if there is a match, false otherwise
+ */
+inline bool pattern::match(const i8 *text) const
+{
+	if ( unlikely(text == NULL) ) {
+		return false;
+	}
+
+	return !regexec(&m_expr, text, 0, NULL, 0);
+}
+
+
+/**
+ * @brief Find the first match of the pattern in a text
+ *
+ * @param[in] text the text
+ *
+ * @param[in] len the text length
+ *
+ * @param[out] match the matched text offsets
+ *
+ * @returns true if there is a match, false otherwise
+ *
+ * @note
+ *	The pattern must be compiled without REG_NOSUB. The text length is given
+ *	(REG_STARTEND), so searching a long text repeatedly doesn't rescan its tail
+ */
+inline bool pattern::search(const i8 *text, u32 len, regmatch_t &match) const
+{
+	match.rm_so = 0;
+	match.rm_eo = len;
+	return !regexec(&m_expr, text, 1, &match, REG_STARTEND);
+}
+
+}
@@ -152,6 +152,28 @@ inline plugin* plugin::clone() const
 }
 
 
+/**
+ * @brief Get the instrumentation starting callback
+ *
+ * @returns this->m_begin
+ */
+inline modsym_t plugin::begin_callback() const
+{
+	return m_begin;
+}
+
+
+/**
+ * @brief Get the instrumentation ending callback
+ *
+ * @returns this->m_end
+ */
+inline modsym_t plugin::end_callback() const
+{
+	return m_end;
+}
+
+
 /**
  * @brief Get the module file path
  *
@@ -294,8 +316,8 @@ modsym_t plugin::resolve(const i8 *nm, const i8 *scope) const
 			mangled = new string("_ZN");
 			parts = tmp.split("::");
 
-			for (u32 i = 0, sz = parts->size(); likely(i < sz); i++) {
-				const string *token = parts->at(i);
+			for (chain<string>::cursor cur = parts->first(); likely(cur.is_valid()); cur.next()) {
+				const string *token = cur.data();
 				mangled->append("%d%s", token->length(), token->cstring());
 			}
 
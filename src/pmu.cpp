@@ -0,0 +1,415 @@
+#include "../include/pmu.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/pmu.cpp
+
+	@brief Class instrument::pmu method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+__thread pmu::group *pmu::s_group = NULL;
+
+const plugin *pmu::s_plugin = NULL;
+
+u32 pmu::s_warned = 0;
+
+pthread_key_t pmu::s_exit_key;
+
+pthread_once_t pmu::s_hooks_once = PTHREAD_ONCE_INIT;
+
+const u64 pmu::s_configs[g_pmu_counters] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+
+/**
+ * @brief Instrumentation starting callback
+ *
+ * @param[in] this_fn the address of the called function
+ *
+ * @param[in] call_site the address where the function was called
+ *
+ * @note
+ *	The call is already on the simulated stack, the counters are read into its
+ *	frame. The call is stamped too, unless another timing plugin stamped it
+ */
+void pmu::begin(void *this_fn, void *call_site)
+{
+	thread *thr = process::current()->current_thread();
+
+	/* Calls made while an exception propagates are not simulated */
+	frame_t *f = thr->top();
+	if ( unlikely(f == NULL || f->fn != reinterpret_cast<mem_addr_t> (this_fn)) ) {
+		return;
+	}
+
+	memset(&f->callees, 0, sizeof(pmu_counts_t));
+	read(current(), f->counts);
+
+	if ( likely(f->stamp == 0) ) {
+		f->stamp = profiler::ticks();
+	}
+}
+
+
+/**
+ * @brief Get the counter group of the current thread, opening it on first use
+ *
+ * @returns the counter group or NULL if it can't be allocated
+ */
+pmu::group* pmu::current()
+{
+	group *retval = s_group;
+	if ( likely(retval != NULL) ) {
+		return retval;
+	}
+
+	retval = new (std::nothrow) group;
+	if ( unlikely(retval == NULL) ) {
+		return NULL;
+	}
+
+	retval->open = open(retval);
+
+	pthread_once(&s_hooks_once, install_hooks);
+	pthread_setspecific(s_exit_key, retval);
+
+	s_group = retval;
+	return retval;
+}
+
+
+/**
+ * @brief Instrumentation ending callback
+ *
+ * @param[in] this_fn the address of the returning function
+ *
+ * @param[in] call_site the address that the program counter will return to
+ *
+ * @note
+ *	The returning call is still on the simulated stack. Its inclusive counter
+ *	deltas are added to the callee deltas of the calling frame
+ */
+void pmu::end(void *this_fn, void *call_site)
+{
+	pmu_counts_t now;
+	read(current(), now);
+
+	thread *thr = process::current()->current_thread();
+	mem_addr_t fn = reinterpret_cast<mem_addr_t> (this_fn);
+
+	/* Each frame is counted once, even if an exception is propagating */
+	frame_t *f = thr->top();
+	if ( unlikely(f == NULL || f->fn != fn || f->stamp == 0) ) {
+		return;
+	}
+
+	pmu_counts_t inclusive;
+	inclusive.cycles = now.cycles - f->counts.cycles;
+	inclusive.instructions = now.instructions - f->counts.instructions;
+	inclusive.llc_misses = now.llc_misses - f->counts.llc_misses;
+	inclusive.branch_misses = now.branch_misses - f->counts.branch_misses;
+
+	frame_t *caller = thr->top(1);
+	if ( likely(caller != NULL) ) {
+		caller->callees.cycles += inclusive.cycles;
+		caller->callees.instructions += inclusive.instructions;
+		caller->callees.llc_misses += inclusive.llc_misses;
+		caller->callees.branch_misses += inclusive.branch_misses;
+	}
+
+	profiler::table *t = profiler::s_table;
+	if ( unlikely(t == NULL) ) {
+		t = profiler::register_thread();
+	}
+
+	/* The callee deltas can't exceed the inclusive ones, unless the counters wrapped */
+	profiler::entry *e = profiler::lookup(t, fn);
+	e->inclusive_counts.cycles += inclusive.cycles;
+	e->inclusive_counts.instructions += inclusive.instructions;
+	e->inclusive_counts.llc_misses += inclusive.llc_misses;
+	e->inclusive_counts.branch_misses += inclusive.branch_misses;
+	e->exclusive_counts.cycles += inclusive.cycles - f->callees.cycles;
+	e->exclusive_counts.instructions += inclusive.instructions - f->callees.instructions;
+	e->exclusive_counts.llc_misses += inclusive.llc_misses - f->callees.llc_misses;
+	e->exclusive_counts.branch_misses += inclusive.branch_misses - f->callees.branch_misses;
+}
+
+
+/**
+ * @brief Create the thread exit hook key and install the fork hook (once per library instance)
+ */
+void pmu::install_hooks()
+{
+	if ( unlikely(pthread_key_create(&s_exit_key, on_thread_exit) != 0) ) {
+		util::dbg_warn("failed to create the pmu exit key, exited thread counters are kept open");
+	}
+
+	if ( unlikely(pthread_atfork(NULL, NULL, on_fork_child) != 0) ) {
+		util::dbg_warn("failed to install the pmu fork hook, forked children count the parent thread");
+	}
+}
+
+
+/**
+ * @brief Fork hook, reopen the counters of the forking thread in the child
+ *
+ * @note
+ *	The inherited counters count the parent thread, they're closed and the
+ *	child opens its own on its next call. The counters inherited from the
+ *	other threads of the parent are not closed
+ */
+void pmu::on_fork_child()
+{
+	group *grp = s_group;
+	if ( likely(grp != NULL) ) {
+		pthread_setspecific(s_exit_key, NULL);
+		on_thread_exit(grp);
+	}
+}
+
+
+/**
+ * @brief Thread exit hook, close the counter group of the exiting thread
+ *
+ * @param[in] arg the counter group
+ */
+void pmu::on_thread_exit(void *arg)
+{
+	group *grp = static_cast<group*> (arg);
+	if ( likely(grp == s_group) ) {
+		s_group = NULL;
+	}
+
+	if ( likely(grp->open) ) {
+		long pgsz = sysconf(_SC_PAGESIZE);
+
+		for (u32 i = g_pmu_counters; likely(i > 0); i--) {
+			if ( likely(grp->pages[i - 1] != NULL) ) {
+				munmap(grp->pages[i - 1], pgsz);
+			}
+
+			close(grp->fds[i - 1]);
+		}
+	}
+
+	delete grp;
+}
+
+
+/**
+ * @brief Open and map the counters of the current thread
+ *
+ * @param[out] grp the counter group
+ *
+ * @returns true if the counters were opened, false otherwise
+ *
+ * @note
+ *	The counters count the user space of the thread only. The first failure is
+ *	reported, the other threads fail silently
+ */
+bool pmu::open(group *grp)
+{
+	long pgsz = sysconf(_SC_PAGESIZE);
+	grp->rdpmc = true;
+
+	for (u32 i = 0; likely(i < g_pmu_counters); i++) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = s_configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		i32 leader = (i == 0) ? -1 : grp->fds[0];
+		grp->fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+		if ( unlikely(grp->fds[i] < 0) ) {
+			if ( likely(compare_swap(&s_warned, 0U, 1U)) ) {
+				util::dbg_warn("failed to open the hardware performance counters (%s), the threads are only profiled", strerror(errno));
+			}
+
+			while ( likely(i > 0) ) {
+				i--;
+				if ( likely(grp->pages[i] != NULL) ) {
+					munmap(grp->pages[i], pgsz);
+				}
+
+				close(grp->fds[i]);
+			}
+
+			return false;
+		}
+
+		/* The mapped page exposes the hardware counter index to rdpmc */
+		void *page = mmap(NULL, pgsz, PROT_READ, MAP_SHARED, grp->fds[i], 0);
+		grp->pages[i] = (likely(page != MAP_FAILED)) ? static_cast<perf_event_mmap_page*> (page) : NULL;
+		if ( unlikely(grp->pages[i] == NULL || !grp->pages[i]->cap_user_rdpmc) ) {
+			grp->rdpmc = false;
+		}
+	}
+
+#if !defined __x86_64__ && !defined __i386__
+	grp->rdpmc = false;
+#endif
+
+	return true;
+}
+
+
+/**
+ * @brief Read the counters of the current thread
+ *
+ * @param[in] grp the counter group of the current thread (can be NULL)
+ *
+ * @param[out] dst the counter values (zeroes if the counters aren't open)
+ */
+void pmu::read(group *grp, pmu_counts_t &dst)
+{
+	u64 values[g_pmu_counters + 1];
+	memset(values, 0, sizeof(values));
+
+	if ( likely(grp != NULL && grp->open) ) {
+		if ( likely(grp->rdpmc) ) {
+			for (u32 i = 0; likely(i < g_pmu_counters); i++) {
+				values[i + 1] = read_counter(grp->pages[i]);
+			}
+		}
+		else if ( unlikely(::read(grp->fds[0], values, sizeof(values)) != sizeof(values)) ) {
+			memset(values, 0, sizeof(values));
+		}
+	}
+
+	/* The group read format is the counter count followed by the values */
+	dst.cycles = values[1];
+	dst.instructions = values[2];
+	dst.llc_misses = values[3];
+	dst.branch_misses = values[4];
+}
+
+
+/**
+ * @brief Read a counter in user space
+ *
+ * @param[in] page the mapped counter page
+ *
+ * @returns the counter value
+ *
+ * @note
+ *	The page is updated by the kernel whenever the counter is scheduled, the
+ *	sequence lock detects the updates that raced with the read. A counter that
+ *	isn't scheduled yields the count the kernel accumulated
+ */
+u64 pmu::read_counter(const perf_event_mmap_page *page)
+{
+	u64 retval = 0;
+	u32 seq = 0;
+
+	do {
+		seq = load_acquire(&page->lock);
+
+		u32 idx = page->index;
+		retval = page->offset;
+		if ( likely(idx > 0) ) {
+#if defined __x86_64__ || defined __i386__
+			u32 shift = 64 - page->pmc_width;
+			retval += static_cast<u64> (static_cast<i64> (__builtin_ia32_rdpmc(idx - 1) << shift) >> shift);
+#endif
+		}
+
+		load_barrier();
+	} while ( unlikely(load_relaxed(&page->lock) != seq) );
+
+	return retval;
+}
+
+
+/**
+ * @brief Register the pmu plugin and the profiler (if they're not registered)
+ *
+ * @returns the plugin
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The profiler is attached first, so both plugins annotate the same frames
+ *	and the counter deltas are added to the function profiles
+ */
+const plugin* pmu::attach()
+{
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		return NULL;
+	}
+
+	try {
+		tracer::lock();
+
+		if ( likely(s_plugin == NULL) ) {
+			profiler::attach();
+			s_plugin = iface->add_plugin(begin, end);
+		}
+
+		tracer::unlock();
+		return s_plugin;
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Unregister the pmu plugin (if it's registered)
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The profiler remains attached, the counters of each thread remain open
+ */
+void pmu::detach()
+{
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		return;
+	}
+
+	try {
+		tracer::lock();
+
+		for (u32 i = 0, sz = iface->plugin_count(); likely(i < sz); i++) {
+			if ( unlikely(iface->get_plugin(i) == s_plugin) ) {
+				iface->remove_plugin(i);
+				break;
+			}
+		}
+
+		s_plugin = NULL;
+		tracer::unlock();
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Check if the pmu plugin is registered
+ *
+ * @returns true if the plugin is attached, false otherwise
+ */
+bool pmu::is_attached()
+{
+	return load_acquire(&s_plugin) != NULL;
+}
+
+}
@@ -1,4 +1,5 @@
 #include "../include/tracer.hpp"
+#include "../include/util.hpp"
 
 /**
 	@file src/process.cpp
@@ -8,6 +9,388 @@
 
 namespace instrument {
 
+/* Static member variable definition */
+
+u32 process::s_generations = 1;
+
+__thread thread *process::s_current = NULL;
+
+__thread u32 process::s_current_gen = 0;
+
+pthread_key_t process::s_exit_key;
+
+pthread_once_t process::s_exit_once = PTHREAD_ONCE_INIT;
+
+const i8 process::s_unresolved = '\0';
+
+
+/**
+ * @brief Compare two batch lookup queries by address (qsort callback)
+ *
+ * @param[in] lval the left query
+ *
+ * @param[in] rval the right query
+ *
+ * @returns -1, 0 or 1 if the left address is below, equal to or above the right one
+ */
+i32 process::compare_queries(const void *lval, const void *rval)
+{
+	mem_addr_t laddr = static_cast<const lookup_query*> (lval)->addr;
+	mem_addr_t raddr = static_cast<const lookup_query*> (rval)->addr;
+
+	if ( likely(laddr != raddr) ) {
+		return (laddr < raddr) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Create the thread exit hook key (once per library instance)
+ */
+void process::create_exit_key()
+{
+	if ( unlikely(pthread_key_create(&s_exit_key, on_thread_exit) != 0) ) {
+		util::dbg_warn("failed to create the thread exit key, exited threads are kept");
+	}
+}
+
+
+/**
+ * @brief Check if two symbol tables describe the same module mapping
+ *
+ * @param[in] a the first symbol table
+ *
+ * @param[in] b the second symbol table
+ *
+ * @returns true if the paths, the load bases and the ranges match, false otherwise
+ */
+bool process::is_same_module(const symtab *a, const symtab *b)
+{
+	return a->m_base == b->m_base &&
+				 a->m_begin == b->m_begin &&
+				 a->m_end == b->m_end &&
+				 strcmp(a->m_path, b->m_path) == 0;
+}
+
+
+/**
+ * @brief
+ *	Thread exit hook, remove the exiting thread from the process and dispose its
+ *	instrument::thread object (and simulated call stack)
+ *
+ * @param[in] arg the process the thread was attached to
+ *
+ * @note
+ *	The removal is O(1) and the thread generation doesn't change, since only the
+ *	exiting thread caches the removed handle. If the thread calls instrumented
+ *	functions afterwards (e.g from other thread-specific data destructors), it's
+ *	attached again and this hook runs again
+ */
+void process::on_thread_exit(void *arg)
+{
+	tracer *iface = tracer::interface();
+	process *proc = static_cast<process*> (arg);
+	if ( unlikely(iface == NULL || iface->proc() != proc) ) {
+		return;
+	}
+
+	/* Exclude cross-thread readers (traces, dumps) while disposing */
+	tracer::lock();
+	proc->lock();
+
+	thread *thr = proc->m_index->remove(pthread_self());
+	if ( likely(thr != NULL) ) {
+		delete proc->detach_thread(thr);
+	}
+
+	s_current = NULL;
+	proc->unlock();
+	tracer::unlock();
+}
+
+
+/**
+ * @brief Register an execution context, keeping its position
+ *
+ * @param[in] ctx the context
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+process& process::add_context(context *ctx)
+{
+	lock();
+
+	try {
+		m_contexts->add(ctx);
+		ctx->m_slot = m_contexts->size() - 1;
+		ctx->m_registered = true;
+	}
+	catch (...) {
+		unlock();
+		throw;
+	}
+
+	return unlock();
+}
+
+
+/**
+ * @brief Add a thread to the thread list, keeping its position
+ *
+ * @param[in] t the thread
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+process& process::add_thread(thread *t)
+{
+	m_threads->add(t);
+	t->m_slot = m_threads->size() - 1;
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Register the currently executing thread to the process (or find the already
+ *	registered instrument::thread object for it) and cache its handle in
+ *	thread-local storage
+ *
+ * @returns the instrument::thread object that tracks the actual current thread
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	If the cached handle of the current thread was retired (from another thread,
+ *	see process::cleanup_zombie_threads) it is reattached to the process, unless
+ *	an object for the current thread was registered meanwhile. A thread object
+ *	created (or reattached) here is disposed when the thread exits, see
+ *	process::on_thread_exit
+ */
+thread* process::attach_current_thread()
+{
+	lock();
+
+	thread *retval = NULL;
+	try {
+		pthread_t self = pthread_self();
+		retval = m_index->find(self);
+
+		/* Reclaim the cached handle, if it was retired */
+		i32 i = -1;
+		if ( unlikely(s_current != NULL) ) {
+			i = m_retired->search(s_current);
+		}
+
+		/* Only the implicitly attached threads are disposed upon exit */
+		bool attached = false;
+		if ( unlikely(i >= 0) ) {
+			if ( likely(retval == NULL) ) {
+				retval = m_retired->detach(i);
+				add_thread(retval);
+				m_index->insert(self, retval);
+				attached = true;
+			}
+			else {
+				m_retired->remove(i);
+			}
+		}
+
+		s_current = NULL;
+		if ( likely(retval == NULL) ) {
+			retval = new thread;
+			add_thread(retval);
+			m_index->insert(self, retval);
+			attached = true;
+		}
+
+		if ( likely(attached) ) {
+			pthread_once(&s_exit_once, create_exit_key);
+			pthread_setspecific(s_exit_key, this);
+		}
+
+		/* The thread may be attached while an exception propagates */
+		retval->m_uncaught = (unlikely(std::uncaught_exception())) ? 1 : 0;
+
+		s_current = retval;
+		s_current_gen = m_generation;
+		unlock();
+		return retval;
+	}
+	catch (...) {
+		if ( likely(retval != NULL && m_threads->search(retval) < 0) ) {
+			delete retval;
+		}
+
+		unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Detach a thread from the thread list in O(1), using its position
+ *
+ * @param[in] t the thread
+ *
+ * @returns the detached thread (NULL if it's not in the list)
+ *
+ * @note The last thread of the list fills the gap (the list is not ordered)
+ */
+thread* process::detach_thread(thread *t)
+{
+	u32 sz = m_threads->size();
+	i32 i = (likely(t->m_slot < sz && m_threads->at(t->m_slot) == t))
+						? static_cast<i32> (t->m_slot)
+						: m_threads->search(t);
+
+	if ( unlikely(i < 0) ) {
+		return NULL;
+	}
+
+	m_threads->detach(i);
+	if ( likely(static_cast<u32> (i) < sz - 1) ) {
+		m_threads->at(i)->m_slot = i;
+	}
+
+	return t;
+}
+
+
+/**
+ * @brief Unregister an execution context in O(1), using its position
+ *
+ * @param[in] ctx the context
+ *
+ * @returns *this
+ *
+ * @note The last context of the list fills the gap (the list is not ordered)
+ */
+process& process::remove_context(context *ctx)
+{
+	lock();
+
+	u32 sz = m_contexts->size();
+	i32 i = (likely(ctx->m_slot < sz && m_contexts->at(ctx->m_slot) == ctx))
+						? static_cast<i32> (ctx->m_slot)
+						: m_contexts->search(ctx);
+
+	if ( likely(i >= 0) ) {
+		m_contexts->detach(i);
+		if ( likely(static_cast<u32> (i) < sz - 1) ) {
+			m_contexts->at(i)->m_slot = i;
+		}
+	}
+
+	ctx->m_registered = false;
+	return unlock();
+}
+
+
+/**
+ * @brief
+ *	Rebuild the module address range index from the symbol table list and
+ *	publish it to the readers
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The replaced index may still be in use by a reader, it is retired and
+ *	disposed with the process
+ */
+process& process::reindex_modules()
+{
+	module_index *idx = new module_index;
+	idx->size = 0;
+	idx->ranges = NULL;
+	idx->next = NULL;
+
+	try {
+		u32 sz = m_symtabs->size();
+		idx->ranges = new module_range[sz];
+
+		/* Insertion sort by range start, the module count is small */
+		for (u32 i = 0; likely(i < sz); i++) {
+			symtab *table = m_symtabs->at(i);
+
+			/* The unloaded modules keep their tables, but not their ranges */
+			if ( unlikely(!table->m_mapped) ) {
+				continue;
+			}
+
+			u32 j = idx->size++;
+			while ( likely(j > 0 && idx->ranges[j - 1].begin > table->begin()) ) {
+				idx->ranges[j] = idx->ranges[j - 1];
+				j--;
+			}
+
+			idx->ranges[j].begin = table->begin();
+			idx->ranges[j].end = table->end();
+			idx->ranges[j].table = table;
+		}
+	}
+	catch (...) {
+		delete[] idx->ranges;
+		delete idx;
+		throw;
+	}
+
+	module_index *old = m_ranges;
+	store_release(&m_ranges, idx);
+
+	if ( likely(old != NULL) ) {
+		old->next = m_retired_ranges;
+		m_retired_ranges = old;
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Rebuild the thread index from the instrumented thread list
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+process& process::reindex_threads()
+{
+	m_index->clear();
+
+	for (u32 i = 0, sz = m_threads->size(); likely(i < sz); i++) {
+		thread *thr = m_threads->at(i);
+		m_index->insert(thr->handle(), thr);
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Invalidate the thread handles cached (in thread-local storage) by the actual
+ *	threads, by moving to a new thread generation
+ *
+ * @returns *this
+ */
+inline process& process::invalidate_threads()
+{
+	store_release(&m_generation, fetch_add(&s_generations, 1));
+	return *this;
+}
+
+
 /**
  * @brief Return the currently running process
  *
@@ -40,15 +423,37 @@ process::process()
 try:
 m_lock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP),
 m_pid(getpid()),
+m_generation(fetch_add(&s_generations, 1)),
 m_symtabs(NULL),
-m_threads(NULL)
+m_ranges(NULL),
+m_retired_ranges(NULL),
+m_threads(NULL),
+m_index(NULL),
+m_retired(NULL),
+m_names(NULL),
+m_contexts(NULL)
 {
 	m_symtabs = new list<symtab>;
 	m_threads = new list<thread>;
+	m_threads->set_indexed(true);
+	m_index = new registry<pthread_t, thread>;
+	m_retired = new list<thread>;
+	m_names = new registry<mem_addr_t, const i8>(g_name_cache_sz);
+	m_contexts = new list<context>;
 }
 catch (...) {
 	delete m_symtabs;
+	delete m_threads;
+	delete m_index;
+	delete m_retired;
+	delete m_names;
+	delete m_contexts;
 	m_symtabs = NULL;
+	m_threads = NULL;
+	m_index = NULL;
+	m_retired = NULL;
+	m_names = NULL;
+	m_contexts = NULL;
 }
 
 
@@ -63,18 +468,48 @@ process::process(const process &src)
 try:
 m_lock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP),
 m_pid(src.m_pid),
+m_generation(fetch_add(&s_generations, 1)),
 m_symtabs(NULL),
-m_threads(NULL)
+m_ranges(NULL),
+m_retired_ranges(NULL),
+m_threads(NULL),
+m_index(NULL),
+m_retired(NULL),
+m_names(NULL),
+m_contexts(NULL)
 {
 	src.lock();
-	m_symtabs = src.m_symtabs->clone();
-	m_threads = src.m_threads->clone();
-	src.unlock();
+
+	try {
+		m_symtabs = src.m_symtabs->clone();
+		m_threads = src.m_threads->clone();
+		m_threads->set_indexed(true);
+		m_index = new registry<pthread_t, thread>(src.m_index->slots());
+		m_retired = new list<thread>;
+		m_names = new registry<mem_addr_t, const i8>(g_name_cache_sz);
+		m_contexts = new list<context>;
+		reindex_modules();
+		reindex_threads();
+		src.unlock();
+	}
+	catch (...) {
+		src.unlock();
+		throw;
+	}
 }
 catch (...) {
-	src.unlock();
 	delete m_symtabs;
+	delete m_threads;
+	delete m_index;
+	delete m_retired;
+	delete m_names;
+	delete m_contexts;
 	m_symtabs = NULL;
+	m_threads = NULL;
+	m_index = NULL;
+	m_retired = NULL;
+	m_names = NULL;
+	m_contexts = NULL;
 }
 
 
@@ -83,10 +518,40 @@ catch (...) {
  */
 process::~process()
 {
+	invalidate_threads();
+
+	/* The contexts are owned by the application (or by their thread) */
+	for (u32 i = 0, sz = m_contexts->size(); likely(i < sz); i++) {
+		m_contexts->at(i)->m_registered = false;
+	}
+
+	m_contexts->detach_all();
+	delete m_contexts;
+	m_contexts = NULL;
+
+	if ( likely(m_ranges != NULL) ) {
+		m_ranges->next = m_retired_ranges;
+		m_retired_ranges = m_ranges;
+		m_ranges = NULL;
+	}
+
+	while ( likely(m_retired_ranges != NULL) ) {
+		module_index *idx = m_retired_ranges;
+		m_retired_ranges = idx->next;
+		delete[] idx->ranges;
+		delete idx;
+	}
+
 	delete m_symtabs;
 	delete m_threads;
+	delete m_index;
+	delete m_retired;
+	delete m_names;
 	m_symtabs = NULL;
 	m_threads = NULL;
+	m_index = NULL;
+	m_retired = NULL;
+	m_names = NULL;
 
 	unlock();
 }
@@ -135,9 +600,20 @@ process& process::operator=(const process &rval)
 		return unlock();
 	}
 
-	m_pid = rval.m_pid;
-	*m_symtabs = *rval.m_symtabs;
-	*m_threads = *rval.m_threads;
+	try {
+		m_pid = rval.m_pid;
+		m_names->clear();
+		*m_symtabs = *rval.m_symtabs;
+		*m_threads = *rval.m_threads;
+		invalidate_threads();
+		reindex_modules();
+		reindex_threads();
+	}
+	catch (...) {
+		rval.unlock();
+		unlock();
+		throw;
+	}
 
 	rval.unlock();
 	return unlock();
@@ -151,50 +627,281 @@ process& process::operator=(const process &rval)
  */
 inline process& process::lock() const
 {
-	pthread_mutex_lock(const_cast<pthread_mutex_t*> (&m_lock));
+	lock_mutex(const_cast<pthread_mutex_t*> (&m_lock));
+	return const_cast<process&> (*this);
+}
+
+
+/**
+ * @brief Yield object access
+ *
+ * @returns *this
+ */
+inline process& process::unlock() const
+{
+	pthread_mutex_unlock(const_cast<pthread_mutex_t*> (&m_lock));
 	return const_cast<process&> (*this);
 }
 
 
 /**
- * @brief Yield object access
+ * @brief Release (or reset) the locks taken by process::before_fork, after a fork
+ *
+ * @param[in] child true in the child process, false in the parent
+ *
+ * @returns *this
+ *
+ * @note
+ *	In the child, the forking thread is the only one left: the other threads
+ *	(and the retired ones) are disposed, their simulated stacks are not reached
+ *	by anything anymore, and the process ID is updated. The locks are
+ *	initialized again, since the thread that holds them has a new thread ID.
+ *	The forking thread keeps its simulated stack, since the child returns
+ *	through the same calls. The symbol tables are kept, loaded or deferred
+ */
+process& process::after_fork(bool child)
+{
+	if ( likely(child) ) {
+		m_pid = getpid();
+
+		/* The child thread has a new ID, it doesn't own the (recursive) mutexes */
+		pthread_mutex_t recursive = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+		pthread_mutex_t normal = PTHREAD_MUTEX_INITIALIZER;
+		m_lock = recursive;
+
+		/* The threads of the parent suspend their contexts as they're disposed */
+		pthread_t self = pthread_self();
+		for (u32 i = 0, sz = m_threads->size(); likely(i < sz); i++) {
+			thread *thr = m_threads->at(i);
+			if ( unlikely(pthread_equal(thr->handle(), self)) ) {
+				continue;
+			}
+
+			m_index->remove(thr->handle());
+			delete detach_thread(thr);
+			i--;
+			sz--;
+		}
+
+		m_retired->clear();
+
+		symtab::s_bfd_lock = recursive;
+		for (u32 i = 0, sz = m_symtabs->size(); likely(i < sz); i++) {
+			m_symtabs->at(i)->m_load_lock = normal;
+		}
+
+		return *this;
+	}
+
+	pthread_mutex_unlock(&symtab::s_bfd_lock);
+	for (u32 i = m_symtabs->size(); likely(i > 0); i--) {
+		pthread_mutex_unlock(&m_symtabs->at(i - 1)->m_load_lock);
+	}
+
+	return unlock();
+}
+
+
+/**
+ * @brief Take the locks that must be consistent in a forked child, before a fork
+ *
+ * @returns *this
+ *
+ * @note
+ *	The process lock, then the loading lock of each symbol table (waiting for
+ *	the loads in progress) and the libbfd lock are held until
+ *	process::after_fork, so the child doesn't inherit a lock held by a thread
+ *	that doesn't exist in it, nor a partially loaded symbol table. The tracer
+ *	lock must be held (see tracer::on_fork_prepare)
+ */
+process& process::before_fork()
+{
+	lock();
+
+	for (u32 i = 0, sz = m_symtabs->size(); likely(i < sz); i++) {
+		pthread_mutex_lock(&m_symtabs->at(i)->m_load_lock);
+	}
+
+	pthread_mutex_lock(&symtab::s_bfd_lock);
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Add a symbol table to the namespace. The symbol table is loaded from a non
+ *	stripped objective code file (executable or DSO library)
+ *
+ * @param[in] path the path of the objective code file
+ *
+ * @param[in] base the load base address
+ *
+ * @param[in] begin the mapped address range start (from the module segments)
+ *
+ * @param[in] end
+ *	the mapped address range end. If the range is empty, the module is mapped to
+ *	the range of its function symbols
+ *
+ * @param[in] lazy
+ *	true to defer loading the symbol table until an address in the module is
+ *	looked up (or process::load_module is called), false to load it now
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+process& process::add_module(	const i8 *path,
+															mem_addr_t base,
+															mem_addr_t begin,
+															mem_addr_t end,
+															bool lazy)
+{
+	return add_module(new symtab(path, base, begin, end, lazy));
+}
+
+
+/**
+ * @brief Add a symbol table to the namespace, mapping its module
+ *
+ * @param[in] table the symbol table (heap allocated, the process adopts it)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	If the same module (path, load base and range) is registered already, the
+ *	table is disposed. An unloaded module is mapped again with its former table,
+ *	so it's not loaded again. The module index is replaced, not modified, so the
+ *	lookups in progress are not blocked
+ */
+process& process::add_module(symtab *table)
+{
+	if ( unlikely(table == NULL) ) {
+		throw exception("invalid argument: table (=%p)", table);
+	}
+
+	lock();
+
+	symtab *added = table;
+	try {
+		for (u32 i = 0, sz = m_symtabs->size(); likely(i < sz); i++) {
+			symtab *cur = m_symtabs->at(i);
+			if ( likely(!is_same_module(cur, table)) ) {
+				continue;
+			}
+
+			delete table;
+			table = NULL;
+
+			if ( likely(cur->m_mapped) ) {
+				return unlock();
+			}
+
+			added = cur;
+			break;
+		}
+
+		if ( likely(table != NULL) ) {
+			m_symtabs->add(table);
+		}
+	}
+	catch (...) {
+		unlock();
+		delete table;
+		throw;
+	}
+
+	try {
+		added->m_mapped = true;
+		reindex_modules();
+
+		/* Addresses in the new module range may have been cached as unresolved */
+		m_names->clear();
+		return unlock();
+	}
+	catch (...) {
+		if ( likely(table != NULL) ) {
+			m_symtabs->remove(m_symtabs->search(table));
+		}
+		else {
+			added->m_mapped = false;
+		}
+
+		unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Find the module (executable or DSO library) mapped at an address
  *
- * @returns *this
+ * @param[in] addr the address
+ *
+ * @returns the module symbol table or NULL if no module is mapped at addr
+ *
+ * @note
+ *	The lookup is a binary search of the module address range index, O(log n),
+ *	and doesn't acquire the process lock
  */
-inline process& process::unlock() const
+const symtab* process::get_module(mem_addr_t addr) const
 {
-	pthread_mutex_unlock(const_cast<pthread_mutex_t*> (&m_lock));
-	return const_cast<process&> (*this);
+	const module_index *idx = load_acquire(&m_ranges);
+	if ( unlikely(idx == NULL) ) {
+		return NULL;
+	}
+
+	/* Find the last range that starts at or before addr */
+	u32 lo = 0, hi = idx->size;
+	while ( likely(lo < hi) ) {
+		u32 mid = lo + (hi - lo) / 2;
+
+		if ( likely(idx->ranges[mid].begin <= addr) ) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if ( unlikely(lo == 0) ) {
+		return NULL;
+	}
+
+	const module_range &range = idx->ranges[lo - 1];
+	if ( likely(addr < range.end) ) {
+		return range.table;
+	}
+
+	return NULL;
 }
 
 
 /**
- * @brief
- *	Add a symbol table to the namespace. The symbol table is loaded from a non
- *	stripped objective code file (executable or DSO library)
+ * @brief Get a module by position
  *
- * @param[in] path the path of the objective code file
- *
- * @param[in] base the load base address
+ * @param[in] i the position (see process::module_count)
  *
- * @returns *this
+ * @returns the i-th module symbol table (it may be unloaded, see symtab::is_mapped)
  *
- * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note Modules are never removed while the process is alive
  */
-process& process::add_module(const i8 *path, mem_addr_t base)
+const symtab* process::get_module(u32 i) const
 {
 	lock();
 
-	symtab *table = NULL;
 	try {
-		table = new symtab(path, base);
-		m_symtabs->add(table);
-		return unlock();
+		const symtab *retval = m_symtabs->at(i);
+		unlock();
+		return retval;
 	}
 	catch (...) {
 		unlock();
-		delete table;
 		throw;
 	}
 }
@@ -213,22 +920,55 @@ process& process::add_module(const i8 *path, mem_addr_t base)
  */
 const i8* process::inverse_lookup(mem_addr_t addr, mem_addr_t &base) const
 {
-	lock();
+	const symtab *table = get_module(addr);
+	if ( likely(table != NULL && table->exists(addr)) ) {
+		base = table->base();
+		return table->path();
+	}
 
-	for (u32 i = 0, sz = m_symtabs->size(); likely(i < sz); i++) {
-		const symtab *table = m_symtabs->at(i);
+	base = 0;
+	return NULL;
+}
 
-		if ( unlikely(table->exists(addr)) ) {
-			base = table->base();
-			const i8 *retval = table->path();
-			unlock();
-			return retval;
-		}
+
+/**
+ * @brief Load the symbol table of a module, if it's deferred
+ *
+ * @param[in] i the module index (in order of addition)
+ *
+ * @returns false if the index is out of range, true otherwise
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The process lock is not held while the symbol table is loaded, so lookups
+ *	and module additions aren't blocked
+ */
+bool process::load_module(u32 i) const
+{
+	lock();
+
+	if ( unlikely(i >= m_symtabs->size()) ) {
+		unlock();
+		return false;
 	}
 
+	const symtab *table = m_symtabs->at(i);
 	unlock();
-	base = 0;
-	return NULL;
+
+	/* Modules are never removed while the process is alive, unloaded ones are skipped */
+	if ( unlikely(!table->is_mapped()) ) {
+		return true;
+	}
+
+	try {
+		table->load();
+	}
+	catch (exception &x) {
+		util::dbg_error("in process::%s(): %s", __FUNCTION__, x.msg());
+	}
+
+	return true;
 }
 
 
@@ -239,27 +979,195 @@ const i8* process::inverse_lookup(mem_addr_t addr, mem_addr_t &base) const
  *
  * @returns the demangled symbol name or NULL if the address is unresolved
  *
+ * @throws std::bad_alloc
+ *
  * @note
- *	If demangling failed upon symbol table loading/parsing the decorated symbol
- *	is returned
+ *	The name is demangled upon the first lookup. If demangling fails the
+ *	decorated symbol name is returned. The result (resolved or not) is cached,
+ *	so a repeated lookup doesn't acquire the process lock and doesn't search
+ *	the module index or the symbol table
  */
 const i8* process::lookup(mem_addr_t addr) const
 {
+	const i8 *retval = m_names->find(addr);
+	count_metric(METRIC_LOOKUPS, 1);
+	if ( likely(retval != NULL) ) {
+		count_metric(METRIC_LOOKUP_HITS, 1);
+		return (likely(retval != &s_unresolved)) ? retval : NULL;
+	}
+
+	const symtab *table = get_module(addr);
+	if ( likely(table != NULL) ) {
+		retval = table->addr2name(addr);
+	}
+
+	/* The zero key is reserved by the cache */
+	if ( unlikely(addr == 0) ) {
+		return retval;
+	}
+
 	lock();
-	for (u32 i = 0, sz = m_symtabs->size(); likely(i < sz); i++) {
-		const i8* retval =
-			m_symtabs	->at(i)
-							 	->addr2name(addr);
 
-		if ( unlikely(retval != NULL) ) {
-			unlock();
-			return retval;
+	try {
+		/* A module may have been added meanwhile, the address is resolved next time */
+		if ( likely(retval != NULL) ) {
+			m_names->insert(addr, retval);
+		}
+		else if ( likely(get_module(addr) == table) ) {
+			m_names->insert(addr, &s_unresolved);
 		}
 	}
+	catch (...) {
+		unlock();
+		throw;
+	}
 
-	/* The address was not resolved */
 	unlock();
-	return NULL;
+	return retval;
+}
+
+
+/**
+ * @brief Lookup a batch of addresses to resolve their symbol names
+ *
+ * @param[in] addrs the addresses (in any order, may repeat)
+ *
+ * @param[in] cnt the address count
+ *
+ * @param[out] names the demangled symbol names (NULL for each unresolved address)
+ *
+ * @param[out]
+ *	modules the module symbol table of each address (NULL if no module is
+ *	mapped at the address), optional
+ *
+ * @returns the resolved address count
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The cached addresses are resolved first. The misses are sorted and merged
+ *	with the module index, each module resolves its run of addresses in a
+ *	single pass (see symtab::lookup). The results are cached with a single
+ *	process lock acquisition
+ */
+u32 process::lookup(const mem_addr_t *addrs, u32 cnt, const i8 **names, const symtab **modules) const
+{
+	lookup_query *queries = NULL;
+	mem_addr_t *sorted = NULL;
+	const symbol_t **syms = NULL;
+	const symtab **owners = NULL;
+
+	try {
+		queries = new lookup_query[cnt];
+
+		u32 retval = 0, misses = 0;
+		for (u32 i = 0; likely(i < cnt); i++) {
+			/* The zero key is reserved by the cache */
+			const i8 *nm = (likely(addrs[i] != 0)) ? m_names->find(addrs[i]) : NULL;
+			if ( unlikely(nm == NULL) ) {
+				queries[misses].addr = addrs[i];
+				queries[misses++].slot = i;
+				continue;
+			}
+
+			names[i] = (likely(nm != &s_unresolved)) ? nm : NULL;
+			retval += (names[i] != NULL);
+			if ( unlikely(modules != NULL) ) {
+				modules[i] = get_module(addrs[i]);
+			}
+		}
+
+		count_metric(METRIC_LOOKUPS, cnt);
+		count_metric(METRIC_LOOKUP_HITS, cnt - misses);
+
+		if ( likely(misses == 0) ) {
+			delete[] queries;
+			return retval;
+		}
+
+		qsort(queries, misses, sizeof(lookup_query), compare_queries);
+
+		sorted = new mem_addr_t[misses];
+		syms = new const symbol_t*[misses];
+		owners = new const symtab*[misses];
+		for (u32 i = 0; likely(i < misses); i++) {
+			sorted[i] = queries[i].addr;
+		}
+
+		/* The ranges and the misses are both sorted, each range resolves a run */
+		const module_index *idx = load_acquire(&m_ranges);
+		u32 sz = (likely(idx != NULL)) ? idx->size : 0;
+
+		for (u32 first = 0, r = 0; likely(first < misses); ) {
+			while ( likely(r < sz && idx->ranges[r].end <= sorted[first]) ) {
+				r++;
+			}
+
+			bool mapped = (likely(r < sz && idx->ranges[r].begin <= sorted[first]));
+			mem_addr_t limit = (likely(mapped)) ? idx->ranges[r].end
+																					: ((likely(r < sz)) ? idx->ranges[r].begin : 0);
+
+			u32 last = first + 1;
+			while ( likely(last < misses && (limit == 0 || sorted[last] < limit)) ) {
+				last++;
+			}
+
+			const symtab *table = (likely(mapped)) ? idx->ranges[r].table : NULL;
+			if ( likely(table != NULL) ) {
+				retval += table->lookup(sorted + first, last - first, syms + first);
+			}
+
+			for (u32 i = first; likely(i < last); i++) {
+				u32 slot = queries[i].slot;
+
+				owners[i] = table;
+				names[slot] = (likely(table != NULL && syms[i] != NULL)) ? table->name(syms[i]) : NULL;
+				if ( unlikely(modules != NULL) ) {
+					modules[slot] = table;
+				}
+			}
+
+			first = last;
+		}
+
+		lock();
+
+		try {
+			for (u32 i = 0; likely(i < misses); i++) {
+				const i8 *nm = names[queries[i].slot];
+				if ( unlikely(sorted[i] == 0 || (i > 0 && sorted[i] == sorted[i - 1])) ) {
+					continue;
+				}
+
+				/* A module may have been added meanwhile, the address is resolved next time */
+				if ( likely(nm != NULL) ) {
+					m_names->insert(sorted[i], nm);
+				}
+				else if ( likely(get_module(sorted[i]) == owners[i]) ) {
+					m_names->insert(sorted[i], &s_unresolved);
+				}
+			}
+		}
+		catch (...) {
+			unlock();
+			throw;
+		}
+
+		unlock();
+
+		delete[] owners;
+		delete[] syms;
+		delete[] sorted;
+		delete[] queries;
+		return retval;
+	}
+	catch (...) {
+		delete[] owners;
+		delete[] syms;
+		delete[] sorted;
+		delete[] queries;
+		throw;
+	}
 }
 
 
@@ -278,6 +1186,8 @@ inline u32 process::module_count() const
  * @brief Get the number of symbols
  *
  * @returns the sum of the loaded symbol table sizes
+ *
+ * @note The deferred symbol tables are loaded
  */
 u32 process::symbol_count() const
 {
@@ -295,6 +1205,46 @@ u32 process::symbol_count() const
 }
 
 
+/**
+ * @brief Drop an unloaded module (e.g by dlclose) from the module index
+ *
+ * @param[in] table the module symbol table
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The symbol table is kept (readers may still use it or the names it holds),
+ *	only its range is dropped, so its addresses are no longer resolved. NO-OP
+ *	if the module is not registered or not mapped
+ */
+process& process::unmap_module(const symtab *table)
+{
+	lock();
+
+	i32 i = m_symtabs->search(table);
+	if ( unlikely(i < 0 || !table->m_mapped) ) {
+		return unlock();
+	}
+
+	symtab *cur = m_symtabs->at(i);
+	try {
+		cur->m_mapped = false;
+		reindex_modules();
+
+		/* Addresses in the dropped range may have been cached as resolved */
+		m_names->clear();
+		return unlock();
+	}
+	catch (...) {
+		cur->m_mapped = true;
+		unlock();
+		throw;
+	}
+}
+
+
 /**
  * @brief Cleanup libinstrument-related thread resources upon thread exit
  *
@@ -311,22 +1261,31 @@ u32 process::symbol_count() const
  *	useless when the actual thread has exited, it continues to occupy memory and
  *	will also inject junk, empty traces in dumps or in explicit trace requests
  *
+ * @attention
+ *	The thread handle is disposed, so this method must not be called for another
+ *	thread that is still running instrumented code
+ *
  * @see man pthread_cleanup_push, pthread_cleanup_pop
  */
 process& process::cleanup_thread(pthread_t id)
 {
+	/* Exclude cross-thread readers (traces, dumps) while disposing */
+	tracer::lock();
 	lock();
 
-	for (u32 i = 0, sz = m_threads->size(); likely(i < sz); i++) {
-		const thread *thr = m_threads->at(i);
-
-		if ( unlikely(thr->is(id)) ) {
-			m_threads->remove(i);
-			break;
+	thread *thr = m_index->remove(id);
+	if ( likely(thr != NULL) ) {
+		if ( unlikely(thr == s_current) ) {
+			s_current = NULL;
 		}
+
+		invalidate_threads();
+		delete detach_thread(thr);
 	}
 
-	return unlock();
+	unlock();
+	tracer::unlock();
+	return *this;
 }
 
 
@@ -335,27 +1294,67 @@ process& process::cleanup_thread(pthread_t id)
  *
  * @returns *this
  *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	A zombie thread may still be running (between two instrumented calls), so
+ *	its handle is retired instead of disposed. If the thread calls an
+ *	instrumented function again, the handle is reattached to the process
+ *
  * @see instrument::thread::m_status and related macros
  */
 process& process::cleanup_zombie_threads()
 {
+	tracer::lock();
 	lock();
 
-	for (u32 i = 0, sz = m_threads->size(); likely(i < sz); i++) {
-		const thread *thr = m_threads->at(i);
-
-		if ( likely(thr->call_depth() > 0) ) {
-			continue;
+	try {
+		for (u32 i = 0, sz = m_threads->size(); likely(i < sz); i++) {
+			const thread *thr = m_threads->at(i);
+
+			if ( likely(thr->call_depth() > 0) ) {
+				continue;
+			}
+
+			thread_status_t status = thr->status();
+			if ( unlikely(is_thread_started(status) || is_thread_finished(status)) ) {
+				invalidate_threads();
+				m_index->remove(thr->handle());
+				m_retired->add(detach_thread(m_threads->at(i--)));
+				sz--;
+			}
 		}
 
-		thread_status_t status = thr->status();
-		if ( unlikely(is_thread_started(status) || is_thread_finished(status)) ) {
-			m_threads->remove(i--);
-			sz--;
-		}
+		unlock();
+		tracer::unlock();
+		return *this;
+	}
+	catch (...) {
+		unlock();
+		tracer::unlock();
+		throw;
 	}
+}
 
-	return unlock();
+
+/**
+ * @brief Get the currently executing thread, if it's already tracked
+ *
+ * @returns the cached handle of the current thread or NULL if it's not attached
+ *
+ * @note
+ *	The thread is not attached and the process lock is not acquired, so it
+ *	can be called from the interposed C++ runtime calls (see tracer::on_throw)
+ */
+inline thread* process::cached_thread() const
+{
+	thread *retval = s_current;
+	if ( likely(retval != NULL && s_current_gen == load_acquire(&m_generation)) ) {
+		return retval;
+	}
+
+	return NULL;
 }
 
 
@@ -365,37 +1364,61 @@ process& process::cleanup_zombie_threads()
  * @returns the instrument::thread object that tracks the actual current thread
  *
  * @throws std::bad_alloc
+ * @throws instrument::exception
  *
  * @note
  *	When an actual thread is created the m_threads chain is populated with an
  *	entry for the equivalent instrument::thread object when the thread executes
  *	its first <b>instrumented</b> function, unless thread::fork is used for its
- *	creation
+ *	creation. After that, the handle is obtained from thread-local storage and
+ *	the process lock is not acquired
  */
 thread* process::current_thread() const
 {
-	lock();
+	thread *retval = s_current;
+	if ( likely(retval != NULL && s_current_gen == load_acquire(&m_generation)) ) {
+		return retval;
+	}
 
-	for (u32 i = 0, sz = m_threads->size(); likely(i < sz); i++) {
-		thread *thr = m_threads->at(i);
+	return const_cast<process*> (this)->attach_current_thread();
+}
 
-		if ( unlikely(thr->is_current()) ) {
-			unlock();
-			return thr;
-		}
-	}
 
-	thread *retval = NULL;
+/**
+ * @brief Get the registered execution context count
+ *
+ * @returns this->m_contexts->size()
+ */
+inline u32 process::context_count() const
+{
+	return m_contexts->size();
+}
+
+
+/**
+ * @brief Get a registered execution context by position
+ *
+ * @param[in] i the position
+ *
+ * @returns the i-th context
+ *
+ * @throws instrument::exception
+ *
+ * @note
+ *	The process lock must be held while the context is used, so it's not
+ *	disposed meanwhile
+ */
+context* process::get_context(u32 i) const
+{
+	lock();
+
 	try {
-		retval = new thread;
-		m_threads->add(retval);
+		context *retval = m_contexts->at(i);
 		unlock();
 		return retval;
 	}
-
 	catch (...) {
 		unlock();
-		delete retval;
 		throw;
 	}
 }
@@ -409,22 +1432,12 @@ thread* process::current_thread() const
  * @returns
  *	the instrument::thread object that tracks the actual thread (with the given
  *	ID) or NULL if no such thread is found
+ *
+ * @note The lookup is O(1) and doesn't acquire the process lock
  */
-thread* process::get_thread(pthread_t id) const
+inline thread* process::get_thread(pthread_t id) const
 {
-	lock();
-
-	for (u32 i = 0, sz = m_threads->size(); likely(i < sz); i++) {
-		thread *thr = m_threads->at(i);
-
-		if ( unlikely(thr->is(id)) ) {
-			unlock();
-			return thr;
-		}
-	}
-
-	unlock();
-	return NULL;
+	return m_index->find(id);
 }
 
 
@@ -436,6 +1449,10 @@ thread* process::get_thread(pthread_t id) const
  * @returns
  *	the instrument::thread object that tracks the actual thread (with the given
  *	name) or NULL if no such thread is found
+ *
+ * @note
+ *	Thread names are mutable and not indexed, the lookup is a linear scan of the
+ *	instrumented threads
  */
 thread* process::get_thread(const i8 *nm) const
 {
@@ -501,16 +1518,25 @@ process& process::register_thread(thread *t)
 
 	if ( unlikely(get_thread(t->handle()) != NULL) ) {
 		unlock();
-		throw new exception(	"Process %d already has thread 0x%x registered",
-													m_pid,
-													t->handle());
+		throw exception("Process %d already has thread 0x%x registered",
+										m_pid,
+										t->handle());
+	}
+
+	try {
+		add_thread(t);
+	}
+	catch (...) {
+		unlock();
+		throw;
 	}
 
 	try {
-		m_threads->add(t);
+		m_index->insert(t->handle(), t);
 		return unlock();
 	}
 	catch (...) {
+		detach_thread(t);
 		unlock();
 		throw;
 	}
@@ -0,0 +1,469 @@
+#include "../include/profiler.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/profiler.cpp
+
+	@brief Class instrument::profiler method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+__thread profiler::table *profiler::s_table = NULL;
+
+profiler::table *profiler::s_tables = NULL;
+
+const plugin *profiler::s_plugin = NULL;
+
+u64 profiler::s_tick0 = 0;
+
+u64 profiler::s_nsec0 = 0;
+
+
+/**
+ * @brief Allocate an empty hash table storage
+ *
+ * @param[in] slots the slot count (power of 2)
+ *
+ * @returns the storage (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+profiler::slab* profiler::alloc(u32 slots)
+{
+	void *buf = NULL;
+	if ( unlikely(posix_memalign(&buf, g_cacheline_sz, slots * sizeof(entry)) != 0) ) {
+		throw std::bad_alloc();
+	}
+
+	memset(buf, 0, slots * sizeof(entry));
+
+	slab *retval = NULL;
+	try {
+		retval = new slab;
+	}
+	catch (...) {
+		free(buf);
+		throw;
+	}
+
+	retval->slots = slots;
+	retval->used = 0;
+	retval->entries = static_cast<entry*> (buf);
+	retval->retired = NULL;
+	return retval;
+}
+
+
+/**
+ * @brief Compare the exclusive time of two function profiles (descending order)
+ *
+ * @param[in] a the first profile
+ *
+ * @param[in] b the second profile
+ *
+ * @returns a negative, zero or positive value (list::comparator_t)
+ */
+i32 profiler::by_exclusive(const entry *a, const entry *b)
+{
+	if ( likely(a->exclusive != b->exclusive) ) {
+		return (a->exclusive > b->exclusive) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Instrumentation starting callback
+ *
+ * @param[in] this_fn the address of the called function
+ *
+ * @param[in] call_site the address where the function was called
+ *
+ * @note
+ *	The call is already on the simulated stack, it's annotated in place. A call
+ *	already stamped by another timing plugin keeps its timestamp
+ */
+void profiler::begin(void *this_fn, void *call_site)
+{
+	thread *thr = process::current()->current_thread();
+
+	/* Calls made while an exception propagates are not simulated */
+	frame_t *f = thr->top();
+	if ( unlikely(f == NULL || f->fn != reinterpret_cast<mem_addr_t> (this_fn)) ) {
+		return;
+	}
+
+	if ( likely(f->stamp == 0) ) {
+		f->stamp = ticks();
+	}
+}
+
+
+/**
+ * @brief Calibrate the ticks against the monotonic clock
+ *
+ * @param[in] tick0 the ticks at the calibration start
+ *
+ * @param[in] nsec0 the nanoseconds at the calibration start
+ *
+ * @returns the nanoseconds per tick (32-bit fixed point, see profiler::to_nsec)
+ */
+u64 profiler::calibrate(u64 tick0, u64 nsec0)
+{
+	u64 dt = ticks() - tick0;
+	u64 dns = nsec() - nsec0;
+	u64 scale = 1ULL << 32;
+
+#if defined __x86_64__ || defined __i386__
+	while ( unlikely(dns >= (1ULL << 32)) ) {
+		dns >>= 1;
+		dt >>= 1;
+	}
+
+	scale = (likely(dt > 0)) ? (dns << 32) / dt : 0;
+#endif
+
+	return scale;
+}
+
+
+/**
+ * @brief Instrumentation ending callback
+ *
+ * @param[in] this_fn the address of the returning function
+ *
+ * @param[in] call_site the address that the program counter will return to
+ *
+ * @note
+ *	The returning call is still on the simulated stack. Its inclusive time is
+ *	added to the callee time of the calling frame. The timestamp is cleared by
+ *	the thread once all the exit callbacks ran (see thread::returned)
+ */
+void profiler::end(void *this_fn, void *call_site)
+{
+	u64 now = ticks();
+
+	thread *thr = process::current()->current_thread();
+	mem_addr_t fn = reinterpret_cast<mem_addr_t> (this_fn);
+
+	/* Each frame is counted once, even if an exception is propagating */
+	frame_t *f = thr->top();
+	if ( unlikely(f == NULL || f->fn != fn || f->stamp == 0) ) {
+		return;
+	}
+
+	u64 inclusive = now - f->stamp;
+	u64 exclusive = (likely(inclusive > f->children)) ? inclusive - f->children : 0;
+
+	frame_t *caller = thr->top(1);
+	if ( likely(caller != NULL) ) {
+		caller->children += inclusive;
+	}
+
+	table *t = s_table;
+	if ( unlikely(t == NULL) ) {
+		t = register_thread();
+	}
+
+	entry *e = lookup(t, fn);
+	e->calls++;
+	e->inclusive += inclusive;
+	e->exclusive += exclusive;
+}
+
+
+/**
+ * @brief Find (or insert) the profile of a function in a thread profile
+ *
+ * @param[in] t the thread profile (of the current thread)
+ *
+ * @param[in] fn the function address
+ *
+ * @returns the function profile
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The storage grows at half load. The replaced storage is kept, since a report
+ *	may be reading it (the thread profiles live until the process exits)
+ */
+profiler::entry* profiler::lookup(table *t, mem_addr_t fn)
+{
+	slab *s = t->data;
+	u32 mask = s->slots - 1;
+	u32 i = hash(fn) & mask;
+
+	while ( likely(s->entries[i].fn != 0) ) {
+		if ( likely(s->entries[i].fn == fn) ) {
+			return &s->entries[i];
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	/* Insert, growing the storage first if needed */
+	if ( unlikely(2 * (s->used + 1) > s->slots) ) {
+		slab *grown = alloc(2 * s->slots);
+		mask = grown->slots - 1;
+
+		for (u32 j = 0; likely(j < s->slots); j++) {
+			const entry &cur = s->entries[j];
+			if ( likely(cur.fn == 0) ) {
+				continue;
+			}
+
+			u32 k = hash(cur.fn) & mask;
+			while ( likely(grown->entries[k].fn != 0) ) {
+				k = (k + 1) & mask;
+			}
+
+			grown->entries[k] = cur;
+		}
+
+		grown->used = s->used;
+		grown->retired = s;
+		store_release(&t->data, grown);
+		s = grown;
+
+		i = hash(fn) & mask;
+		while ( likely(s->entries[i].fn != 0) ) {
+			i = (i + 1) & mask;
+		}
+	}
+
+	s->used++;
+	store_release(&s->entries[i].fn, fn);
+	return &s->entries[i];
+}
+
+
+/**
+ * @brief Create the profile of the current thread and publish it
+ *
+ * @returns the thread profile
+ *
+ * @throws std::bad_alloc
+ */
+profiler::table* profiler::register_thread()
+{
+	table *retval = new table;
+
+	try {
+		retval->data = alloc(g_memblock_sz);
+	}
+	catch (...) {
+		delete retval;
+		throw;
+	}
+
+	/* Lock-free push, the profiles are never removed */
+	do {
+		retval->next = load_acquire(&s_tables);
+	} while ( unlikely(!compare_swap(&s_tables, retval->next, retval)) );
+
+	s_table = retval;
+	return retval;
+}
+
+
+/**
+ * @brief Register the profiler plugin (if it's not registered)
+ *
+ * @returns the plugin
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The profiles taken while the profiler was attached before are kept
+ */
+const plugin* profiler::attach()
+{
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		return NULL;
+	}
+
+	try {
+		tracer::lock();
+
+		if ( likely(s_plugin == NULL) ) {
+			s_tick0 = ticks();
+			s_nsec0 = nsec();
+			s_plugin = iface->add_plugin(begin, end);
+		}
+
+		tracer::unlock();
+		return s_plugin;
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Unregister the profiler plugin (if it's registered)
+ *
+ * @throws std::bad_alloc
+ */
+void profiler::detach()
+{
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		return;
+	}
+
+	try {
+		tracer::lock();
+
+		for (u32 i = 0, sz = iface->plugin_count(); likely(i < sz); i++) {
+			if ( unlikely(iface->get_plugin(i) == s_plugin) ) {
+				iface->remove_plugin(i);
+				break;
+			}
+		}
+
+		s_plugin = NULL;
+		tracer::unlock();
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Check if the profiler plugin is registered
+ *
+ * @returns true if the profiler is attached, false otherwise
+ */
+bool profiler::is_attached()
+{
+	return load_acquire(&s_plugin) != NULL;
+}
+
+
+/**
+ * @brief
+ *	Merge the thread profiles and append the process profile to a string, the
+ *	functions with the most exclusive time first
+ *
+ * @param[in,out] dst the report destination string
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	Each line has the call count, the inclusive and the exclusive time (in
+ *	microseconds) of a function. The threads keep profiling meanwhile, so the
+ *	report is a consistent snapshot of each counter, not of all counters. With
+ *	WITH_PMU, if hardware counters were attributed (see instrument::pmu), the
+ *	inclusive/exclusive cycles, instructions, LLC misses and branch misses
+ *	follow the times
+ */
+string& profiler::report(string &dst)
+{
+	/* Calibrate the ticks against the monotonic clock, since attaching */
+	u64 scale = calibrate(s_tick0, s_nsec0);
+
+	list<entry> merged;
+	registry<mem_addr_t, entry> index;
+#ifdef WITH_PMU
+	bool counted = false;
+#endif
+
+	for (table *t = load_acquire(&s_tables); likely(t != NULL); t = t->next) {
+		const slab *s = load_acquire(&t->data);
+
+		for (u32 i = 0; likely(i < s->slots); i++) {
+			const entry &cur = s->entries[i];
+
+			mem_addr_t fn = load_acquire(&cur.fn);
+			if ( likely(fn == 0) ) {
+				continue;
+			}
+
+			entry *e = index.find(fn);
+			if ( unlikely(e == NULL) ) {
+				e = new entry;
+				e->fn = fn;
+				e->calls = e->inclusive = e->exclusive = 0;
+#ifdef WITH_PMU
+				memset(&e->inclusive_counts, 0, sizeof(pmu_counts_t));
+				memset(&e->exclusive_counts, 0, sizeof(pmu_counts_t));
+#endif
+
+				try {
+					merged.add(e);
+				}
+				catch (...) {
+					delete e;
+					throw;
+				}
+
+				index.insert(fn, e);
+			}
+
+			e->calls += cur.calls;
+			e->inclusive += cur.inclusive;
+			e->exclusive += cur.exclusive;
+#ifdef WITH_PMU
+			e->inclusive_counts.cycles += cur.inclusive_counts.cycles;
+			e->inclusive_counts.instructions += cur.inclusive_counts.instructions;
+			e->inclusive_counts.llc_misses += cur.inclusive_counts.llc_misses;
+			e->inclusive_counts.branch_misses += cur.inclusive_counts.branch_misses;
+			e->exclusive_counts.cycles += cur.exclusive_counts.cycles;
+			e->exclusive_counts.instructions += cur.exclusive_counts.instructions;
+			e->exclusive_counts.llc_misses += cur.exclusive_counts.llc_misses;
+			e->exclusive_counts.branch_misses += cur.exclusive_counts.branch_misses;
+			counted = counted || cur.inclusive_counts.cycles > 0;
+#endif
+		}
+	}
+
+	const process *proc = process::current();
+	merged.sort(by_exclusive);
+	dst.append("profile (%u functions) {\r\n", merged.size());
+
+	for (u32 i = 0, sz = merged.size(); likely(i < sz); i++) {
+		const entry *cur = merged[i];
+
+		dst.append("  %10llu %12llu %12llu ",
+							 cur->calls,
+							 to_nsec(cur->inclusive, scale) / 1000,
+							 to_nsec(cur->exclusive, scale) / 1000);
+
+#ifdef WITH_PMU
+		if ( unlikely(counted) ) {
+			const pmu_counts_t &inc = cur->inclusive_counts;
+			const pmu_counts_t &exc = cur->exclusive_counts;
+
+			dst.append("%llu/%llu %llu/%llu %llu/%llu %llu/%llu ",
+								 inc.cycles, exc.cycles,
+								 inc.instructions, exc.instructions,
+								 inc.llc_misses, exc.llc_misses,
+								 inc.branch_misses, exc.branch_misses);
+		}
+#endif
+
+		const i8 *nm = proc->lookup(cur->fn);
+		if ( likely(nm != NULL) ) {
+			dst.append("%s\r\n", nm);
+		}
+		else {
+			dst.append("0x%llx\r\n", static_cast<u64> (cur->fn));
+		}
+	}
+
+	dst.append("}\r\n");
+	return dst;
+}
+
+}
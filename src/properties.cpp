@@ -178,7 +178,7 @@ properties& properties::deserialize()
 	i32 retval = stat(m_path, &inf);
 
 	/* File doesn't exist */
-	if ( unlikely(errno == ENOENT) ) {
+	if ( unlikely(retval < 0 && errno == ENOENT) ) {
 		throw exception("properties file '%s' does not exist", m_path);
 	}
 
@@ -248,8 +248,8 @@ properties& properties::deserialize()
 		string text(reinterpret_cast<i8*> (mmap_base));
 		lines = text.split("\r?\n");
 
-		for (u32 i = 0, linecnt = lines->size(); likely(i < linecnt); i++) {
-			string *line = lines->at(i);
+		for (chain<string>::cursor cur = lines->first(); likely(cur.is_valid()); cur.next()) {
+			string *line = cur.data();
 			line->trim();
 
 			if ( unlikely(line->is_empty()) ) {
@@ -295,17 +295,18 @@ properties& properties::deserialize()
 			chain<string> *parts = line->split("=");
 			parts->each(__trim_chain_callback);
 
-			u32 partcnt = parts->size();
-			if ( likely(partcnt >= 1) ) {
-				current->m_name = parts->at(0);
+			chain<string>::cursor part = parts->first();
+			if ( likely(part.is_valid()) ) {
+				current->m_name = part.data();
+				part.next();
 			}
 
-			if ( likely(partcnt >= 2) ) {
-				current->m_value = parts->at(1);
+			if ( likely(part.is_valid()) ) {
+				current->m_value = part.data();
 
-				for (u32 j = 2; likely(j < partcnt); j++) {
+				for (part.next(); likely(part.is_valid()); part.next()) {
 					current->m_value->append("=");
-					current->m_value->append(*parts->at(j));
+					current->m_value->append(*part.data());
 				}
 			}
 
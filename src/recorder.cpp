@@ -0,0 +1,297 @@
+#include "../include/metrics.hpp"
+#include "../include/recorder.hpp"
+#include "../include/tracer.hpp"
+
+/**
+	@file src/recorder.cpp
+
+	@brief Class instrument::recorder method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+u32 recorder::s_slots = 0;
+
+
+/**
+ * @brief Copy the records of a range, validating them against the write position
+ *
+ * @param[out] dst the destination array
+ *
+ * @param[in] first the index (written record count) of the first record
+ *
+ * @param[in] cnt the record count (at most the ring size)
+ *
+ * @returns the valid record count, the valid records start at dst[0]
+ *
+ * @note
+ *	After copying, the write position is read again. The records the writer
+ *	reached meanwhile (including the one it may be writing) are dropped
+ */
+u32 recorder::copy(record_t *dst, u64 first, u32 cnt) const
+{
+	u32 slots = m_mask + 1;
+	u32 pos = first & m_mask;
+	u32 part = (likely(pos + cnt <= slots)) ? cnt : slots - pos;
+
+	memcpy(dst, m_records + pos, part * sizeof(record_t));
+	memcpy(dst + part, m_records, (cnt - part) * sizeof(record_t));
+
+	/* The copies are complete before the write position is read again */
+	memory_barrier();
+	u64 head = load_acquire(&m_head);
+
+	u64 valid = (likely(head + 1 > slots)) ? head + 1 - slots : 0;
+	if ( likely(first >= valid) ) {
+		return cnt;
+	}
+
+	u64 lost = valid - first;
+	if ( unlikely(lost >= cnt) ) {
+		return 0;
+	}
+
+	memmove(dst, dst + lost, (cnt - lost) * sizeof(record_t));
+	return cnt - lost;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+recorder::recorder(const recorder &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline recorder* recorder::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline recorder& recorder::operator=(const recorder &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Set the ring size of new thread recorders
+ *
+ * @param[in] slots the records per thread (0 turns recording off)
+ *
+ * @note
+ *	The recorders of threads that already recorded events are kept. The hooks
+ *	start feeding the recorders once recording is on (see tracer::select_hooks)
+ */
+void recorder::set_slots(u32 slots)
+{
+	store_release(&s_slots, slots);
+	tracer::select_hooks();
+}
+
+
+/**
+ * @brief Get the ring size of new thread recorders
+ *
+ * @returns recorder::s_slots (0 if recording is off)
+ */
+u32 recorder::slots()
+{
+	return load_acquire(&s_slots);
+}
+
+
+/**
+ * @brief Read the timestamp counter
+ *
+ * @returns the counter value (TSC ticks on x86, nanoseconds otherwise)
+ */
+u64 recorder::ticks()
+{
+#if defined __x86_64__ || defined __i386__
+	return __builtin_ia32_rdtsc();
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<u64> (now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+}
+
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] slots the minimum ring size (rounded up to a power of 2)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+recorder::recorder(u32 slots)
+try:
+m_records(NULL),
+m_mask(0),
+m_head(0),
+m_tail(0)
+{
+	if ( unlikely(slots == 0 || slots > (1U << 31)) ) {
+		throw exception("invalid argument: slots (=%u)", slots);
+	}
+
+	u32 sz = 1;
+	while ( likely(sz < slots) ) {
+		sz <<= 1;
+	}
+
+	m_records = new record_t[sz];
+	m_mask = sz - 1;
+}
+catch (...) {
+	m_records = NULL;
+}
+
+
+/**
+ * @brief Object destructor
+ */
+recorder::~recorder()
+{
+	delete[] m_records;
+	m_records = NULL;
+}
+
+
+/**
+ * @brief Get the ring size
+ *
+ * @returns the maximum record count kept
+ */
+inline u32 recorder::capacity() const
+{
+	return m_mask + 1;
+}
+
+
+/**
+ * @brief Get the written record count (including the overwritten records)
+ *
+ * @returns this->m_head
+ */
+inline u64 recorder::count() const
+{
+	return load_acquire(&m_head);
+}
+
+
+/**
+ * @brief Copy the records written since the previous drain (oldest first)
+ *
+ * @param[out] dst the destination array
+ *
+ * @param[in] max the destination array size
+ *
+ * @param[out] lost the records overwritten before they were drained
+ *
+ * @returns the copied record count (the remaining records are drained next)
+ *
+ * @note
+ *	Any thread may drain a recorder, but drains must not run concurrently with
+ *	each other (e.g drain under the tracer lock)
+ */
+u32 recorder::drain(record_t *dst, u32 max, u64 &lost)
+{
+	u64 head = load_acquire(&m_head);
+	u64 first = m_tail;
+	lost = 0;
+
+	if ( unlikely(head - first > capacity()) ) {
+		lost = head - first - capacity();
+		first = head - capacity();
+	}
+
+	u32 cnt = (likely(head - first < max)) ? head - first : max;
+	u32 retval = copy(dst, first, cnt);
+
+	/* Records overwritten while copying are lost too */
+	lost += cnt - retval;
+	m_tail = first + cnt;
+
+	count_metric(METRIC_DROPPED, lost);
+	return retval;
+}
+
+
+/**
+ * @brief Record an event
+ *
+ * @param[in] kind the event kind (RECORD_ENTER or RECORD_EXIT)
+ *
+ * @param[in] fn the function address
+ *
+ * @param[in] site the call site address
+ *
+ * @returns *this
+ *
+ * @note
+ *	Only the owning thread may record events. The oldest record is overwritten
+ *	if the ring is full
+ */
+recorder& recorder::record(u32 kind, mem_addr_t fn, mem_addr_t site)
+{
+	u64 head = m_head;
+	record_t &r = m_records[head & m_mask];
+
+	r.tsc = ticks();
+	r.fn = fn;
+	r.site = site;
+	r.kind = kind;
+
+	store_release(&m_head, head + 1);
+	return *this;
+}
+
+
+/**
+ * @brief Copy the most recent records (oldest first)
+ *
+ * @param[out] dst the destination array
+ *
+ * @param[in] max the destination array size
+ *
+ * @returns the copied record count
+ *
+ * @note Any thread may take a snapshot, the drained records are not affected
+ */
+u32 recorder::snapshot(record_t *dst, u32 max) const
+{
+	u64 head = load_acquire(&m_head);
+
+	u64 cnt = (likely(head < capacity())) ? head : capacity();
+	if ( likely(cnt > max) ) {
+		cnt = max;
+	}
+
+	return copy(dst, head - cnt, cnt);
+}
+
+}
@@ -0,0 +1,10 @@
+#include "../include/registry.hpp"
+
+/**
+	@file src/registry.cpp
+
+	@brief Class instrument::registry dummy implementation file
+
+	Template classes must have their class declaration and method implementation
+	all in the same file according to ISO
+*/
@@ -0,0 +1,472 @@
+#include "../include/metrics.hpp"
+#include "../include/shadow_stack.hpp"
+
+/**
+	@file src/shadow_stack.cpp
+
+	@brief Class instrument::shadow_stack method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+u32 shadow_stack::s_limit = 0;
+
+bool shadow_stack::s_folding = false;
+
+
+/**
+ * @brief Check if recursion is folded
+ *
+ * @returns shadow_stack::s_folding
+ */
+bool shadow_stack::folding()
+{
+	return load_relaxed(&s_folding);
+}
+
+
+/**
+ * @brief Get the maximum stored frames per stack
+ *
+ * @returns shadow_stack::s_limit (0 for no limit)
+ */
+u32 shadow_stack::limit()
+{
+	return load_relaxed(&s_limit);
+}
+
+
+/**
+ * @brief Enable or disable recursion folding
+ *
+ * @param[in] on true to fold the consecutive identical calls
+ *
+ * @note The frames folded before are kept
+ */
+void shadow_stack::set_folding(bool on)
+{
+	store_release(&s_folding, on);
+}
+
+
+/**
+ * @brief Set the maximum stored frames per stack
+ *
+ * @param[in] max the frame count (0 for no limit)
+ *
+ * @note The frames pushed before are kept, even past the new limit
+ */
+void shadow_stack::set_limit(u32 max)
+{
+	store_release(&s_limit, max);
+}
+
+
+/**
+ * @brief Allocate a chunk for the next frames (growing the chunk directory)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note Only the chunk directory is reallocated, the frames are never moved
+ */
+shadow_stack& shadow_stack::grow()
+{
+	if ( unlikely(m_chunk_count == m_slots) ) {
+		u32 slots = (likely(m_slots > 0)) ? 2 * m_slots : 4;
+
+		frame_t **dir = new frame_t*[slots];
+		for (u32 i = 0; likely(i < m_chunk_count); i++) {
+			dir[i] = m_chunks[i];
+		}
+
+		delete[] m_chunks;
+		m_chunks = dir;
+		m_slots = slots;
+	}
+
+	m_chunks[m_chunk_count] = new frame_t[g_frame_chunk_sz];
+	m_chunk_count++;
+
+	count_metric(METRIC_FRAMES, g_frame_chunk_sz);
+	return *this;
+}
+
+
+/**
+ * @brief Object default constructor
+ */
+shadow_stack::shadow_stack():
+m_chunks(NULL),
+m_chunk_count(0),
+m_slots(0),
+m_size(0),
+m_dropped(0)
+{
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws std::bad_alloc
+ */
+shadow_stack::shadow_stack(const shadow_stack &src)
+try:
+m_chunks(NULL),
+m_chunk_count(0),
+m_slots(0),
+m_size(0),
+m_dropped(0)
+{
+	*this = src;
+}
+catch (...) {
+	trim();
+}
+
+
+/**
+ * @brief Object destructor
+ */
+shadow_stack::~shadow_stack()
+{
+	clear();
+	trim();
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @returns the object copy (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+inline shadow_stack* shadow_stack::clone() const
+{
+	return new shadow_stack(*this);
+}
+
+
+/**
+ * @brief Get the frame count the stack holds without allocating memory
+ *
+ * @returns the allocated chunk count times g_frame_chunk_sz
+ */
+inline u32 shadow_stack::capacity() const
+{
+	return m_chunk_count * g_frame_chunk_sz;
+}
+
+
+/**
+ * @brief Get the count of the calls past the maximum depth (not stored)
+ *
+ * @returns this->m_dropped
+ */
+inline u32 shadow_stack::dropped() const
+{
+	return load_relaxed(&m_dropped);
+}
+
+
+/**
+ * @brief Get the stack size (frame count)
+ *
+ * @returns this->m_size
+ */
+inline u32 shadow_stack::size() const
+{
+	return m_size;
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+shadow_stack& shadow_stack::operator=(const shadow_stack &rval)
+{
+	if ( unlikely(this == &rval) ) {
+		return *this;
+	}
+
+	clear();
+
+	/* Copy whole chunks, bottom to top */
+	for (u32 i = 0; likely(i < rval.m_size); i += g_frame_chunk_sz) {
+		u32 c = i / g_frame_chunk_sz;
+		if ( unlikely(c >= m_chunk_count) ) {
+			grow();
+		}
+
+		u32 cnt = rval.m_size - i;
+		cnt = (cnt < g_frame_chunk_sz) ? cnt : g_frame_chunk_sz;
+		memcpy(m_chunks[c], rval.m_chunks[c], cnt * sizeof(frame_t));
+	}
+
+	m_size = rval.m_size;
+	m_dropped = rval.m_dropped;
+	return *this;
+}
+
+
+/**
+ * @brief Subscript operator
+ *
+ * @param[in] i the offset
+ *
+ * @returns the i-th frame
+ *
+ * @throws instrument::exception
+ */
+inline const frame_t* shadow_stack::operator[](u32 i) const
+{
+	return peek(i);
+}
+
+
+/**
+ * @brief Empty the stack
+ *
+ * @returns *this
+ *
+ * @note The chunks are kept for reuse
+ */
+inline shadow_stack& shadow_stack::clear()
+{
+	m_size = 0;
+	m_dropped = 0;
+	return *this;
+}
+
+
+/**
+ * @brief Traverse the stack with a callback for each frame (top to bottom)
+ *
+ * @param[in] pfunc the callback (can be NULL, for NO-OP)
+ *
+ * @returns *this
+ */
+shadow_stack& shadow_stack::each(const callback_t pfunc) const
+{
+	__D_ASSERT(pfunc != NULL);
+	if ( unlikely(pfunc == NULL) ) {
+		return const_cast<shadow_stack&> (*this);
+	}
+
+	for (u32 i = 0; likely(i < m_size); i++) {
+		u32 pos = m_size - 1 - i;
+		pfunc(i, &m_chunks[pos / g_frame_chunk_sz][pos % g_frame_chunk_sz]);
+	}
+
+	return const_cast<shadow_stack&> (*this);
+}
+
+
+/**
+ * @brief Get the frame at a stack offset
+ *
+ * @param[in] i the offset (0 is the stack top)
+ *
+ * @returns the i-th frame
+ *
+ * @throws instrument::exception
+ */
+const frame_t* shadow_stack::peek(u32 i) const
+{
+	if ( unlikely(i >= m_size) ) {
+		throw exception("offset out of stack bounds (%d >= %d)", i, m_size);
+	}
+
+	u32 pos = m_size - 1 - i;
+	return &m_chunks[pos / g_frame_chunk_sz][pos % g_frame_chunk_sz];
+}
+
+
+/**
+ * @brief Remove the most recent call
+ *
+ * @returns *this
+ *
+ * @note
+ *	The calls past the maximum depth are popped first, then the repeats of a
+ *	folded top frame (clearing its annotations), the top frame is removed with
+ *	its last call
+ */
+shadow_stack& shadow_stack::pop()
+{
+	if ( unlikely(m_dropped > 0) ) {
+		store_relaxed(&m_dropped, m_dropped - 1);
+		return *this;
+	}
+
+	__D_ASSERT(m_size > 0);
+	if ( unlikely(m_size == 0) ) {
+		return *this;
+	}
+
+	frame_t *f = &m_chunks[(m_size - 1) / g_frame_chunk_sz][(m_size - 1) % g_frame_chunk_sz];
+	/* The annotations belonged to the popped call */
+	if ( unlikely(f->repeats > 1) ) {
+		f->repeats--;
+		f->stamp = 0;
+		f->children = 0;
+		return *this;
+	}
+
+	m_size--;
+	return *this;
+}
+
+
+/**
+ * @brief Push a call on the stack
+ *
+ * @param[in] fn the called function address
+ *
+ * @param[in] site the call site address
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	If folding, a call identical to the top frame is folded into it (its
+ *	annotations are reset). Past the maximum depth, the call is only counted
+ */
+shadow_stack& shadow_stack::push(mem_addr_t fn, mem_addr_t site)
+{
+	/* The calls past the maximum depth are more recent than the top frame */
+	if ( unlikely(m_dropped > 0) ) {
+		store_relaxed(&m_dropped, m_dropped + 1);
+		return *this;
+	}
+
+	if ( unlikely(m_size > 0 && load_relaxed(&s_folding)) ) {
+		frame_t *f = &m_chunks[(m_size - 1) / g_frame_chunk_sz][(m_size - 1) % g_frame_chunk_sz];
+		if ( likely(f->fn == fn && f->site == site && f->repeats < UINT_MAX) ) {
+			f->repeats++;
+			f->stamp = 0;
+			f->children = 0;
+			return *this;
+		}
+	}
+
+	u32 max = load_relaxed(&s_limit);
+	if ( unlikely(max > 0 && m_size >= max) ) {
+		store_relaxed(&m_dropped, 1U);
+		return *this;
+	}
+
+	u32 c = m_size / g_frame_chunk_sz;
+	if ( unlikely(c >= m_chunk_count) ) {
+		grow();
+	}
+
+	frame_t *f = &m_chunks[c][m_size % g_frame_chunk_sz];
+	f->fn = fn;
+	f->site = site;
+	f->stamp = 0;
+	f->children = 0;
+	f->repeats = 1;
+
+	m_size++;
+	return *this;
+}
+
+
+/**
+ * @brief Copy the most recent frames (bottom to top)
+ *
+ * @param[out] dst the destination array
+ *
+ * @param[in] max the destination array size
+ *
+ * @returns the copied frame count, dst[0] is the outermost copied frame
+ *
+ * @note
+ *	The frames may be pushed and popped meanwhile, then the copy is
+ *	inconsistent (but within the allocated chunks) and must be discarded by the
+ *	caller. The chunk directory must not be modified meanwhile
+ */
+u32 shadow_stack::snapshot(frame_t *dst, u32 max) const
+{
+	u32 sz = load_relaxed(&m_size);
+	if ( unlikely(sz > capacity()) ) {
+		sz = capacity();
+	}
+
+	u32 cnt = (likely(sz < max)) ? sz : max;
+	for (u32 i = 0, pos = sz - cnt; likely(i < cnt); ) {
+		u32 off = pos % g_frame_chunk_sz;
+		u32 part = g_frame_chunk_sz - off;
+		if ( likely(part > cnt - i) ) {
+			part = cnt - i;
+		}
+
+		memcpy(dst + i, &m_chunks[pos / g_frame_chunk_sz][off], part * sizeof(frame_t));
+		i += part;
+		pos += part;
+	}
+
+	return cnt;
+}
+
+
+/**
+ * @brief Get a mutable frame at a stack offset (e.g to annotate it)
+ *
+ * @param[in] i the offset (0 is the stack top)
+ *
+ * @returns the i-th frame or NULL if the offset is out of stack bounds
+ *
+ * @note Only the frame annotations (stamp and children) should be modified
+ */
+frame_t* shadow_stack::top(u32 i)
+{
+	if ( unlikely(i >= m_size) ) {
+		return NULL;
+	}
+
+	u32 pos = m_size - 1 - i;
+	return &m_chunks[pos / g_frame_chunk_sz][pos % g_frame_chunk_sz];
+}
+
+
+/**
+ * @brief Release the chunks that hold no frames
+ *
+ * @returns *this
+ */
+shadow_stack& shadow_stack::trim()
+{
+	u32 used = (m_size + g_frame_chunk_sz - 1) / g_frame_chunk_sz;
+
+	while ( likely(m_chunk_count > used) ) {
+		m_chunk_count--;
+		delete[] m_chunks[m_chunk_count];
+		m_chunks[m_chunk_count] = NULL;
+	}
+
+	if ( unlikely(m_chunk_count == 0) ) {
+		delete[] m_chunks;
+		m_chunks = NULL;
+		m_slots = 0;
+	}
+
+	return *this;
+}
+
+}
@@ -0,0 +1,310 @@
+#include "../include/shm_reader.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/shm_reader.cpp
+
+	@brief Class instrument::shm_reader method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] nm the shared memory segment name (e.g /idp, see shm_open(3))
+ *
+ * @param[in] cap the ring data capacity (rounded up to a power of 2, at least a page)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+shm_reader::shm_reader(const i8 *nm, u32 cap)
+try:
+m_name(NULL),
+m_ring(NULL),
+m_capacity(sysconf(_SC_PAGESIZE))
+{
+	if ( unlikely(nm == NULL || strlen(nm) == 0) ) {
+		throw exception("invalid argument: nm (=%p)", nm);
+	}
+
+	while ( likely(m_capacity < cap && m_capacity < (1U << 31)) ) {
+		m_capacity <<= 1;
+	}
+
+	m_name = new i8[strlen(nm) + 1];
+	strcpy(m_name, nm);
+}
+catch (...) {
+	m_name = NULL;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+shm_reader::shm_reader(const shm_reader &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object destructor
+ */
+shm_reader::~shm_reader()
+{
+	close();
+
+	delete[] m_name;
+	m_name = NULL;
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline shm_reader* shm_reader::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Get the ring data capacity
+ *
+ * @returns this->m_capacity
+ */
+inline u32 shm_reader::capacity() const
+{
+	return m_capacity;
+}
+
+
+/**
+ * @brief Check if the ring is mapped
+ *
+ * @returns true if the reader is open, false otherwise
+ */
+inline bool shm_reader::is_open() const
+{
+	return m_ring != NULL;
+}
+
+
+/**
+ * @brief Get the shared memory segment name
+ *
+ * @returns this->m_name
+ */
+inline const i8* shm_reader::name() const
+{
+	return m_name;
+}
+
+
+/**
+ * @brief Get the reserved byte count of the ring (committed or not yet)
+ *
+ * @returns the reserved, not consumed byte count (0 if the reader is not open)
+ */
+u64 shm_reader::pending() const
+{
+	if ( unlikely(m_ring == NULL) ) {
+		return 0;
+	}
+
+	return load_acquire(&m_ring->reserved) - load_acquire(&m_ring->consumed);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline shm_reader& shm_reader::operator=(const shm_reader &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Unmap the ring and remove the shared memory segment
+ *
+ * @returns *this
+ *
+ * @note The producers that still map the ring write to it in vain
+ */
+shm_reader& shm_reader::close()
+{
+	if ( likely(m_ring == NULL) ) {
+		return *this;
+	}
+
+	munmap(m_ring, sizeof(shm_stream::ring) + m_capacity);
+	m_ring = NULL;
+
+	shm_unlink(m_name);
+	return *this;
+}
+
+
+/**
+ * @brief Consume the committed records of the ring
+ *
+ * @param[out] dst the string to append the record data to
+ *
+ * @param[in] max the appended byte count after which no record is consumed (0 for no limit)
+ *
+ * @returns the appended byte count
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The records are zeroed before they're released to the producers
+ */
+u32 shm_reader::consume(string &dst, u32 max)
+{
+	shm_stream::ring *r = m_ring;
+	i8 *data = reinterpret_cast<i8*> (r + 1);
+	u64 start = load_relaxed(&r->consumed);
+	u64 pos = start;
+	u32 retval = 0;
+
+	while ( likely(max == 0 || retval < max) ) {
+		shm_stream::record *hdr = reinterpret_cast<shm_stream::record*> (data + (pos & (m_capacity - 1)));
+		u32 len = load_acquire(&hdr->length);
+		if ( unlikely(len == 0) ) {
+			break;
+		}
+
+		if ( likely(hdr->size > 0) ) {
+			dst.concat(reinterpret_cast<i8*> (hdr + 1), hdr->size);
+			retval += hdr->size;
+		}
+
+		memset(hdr, 0, len);
+		pos += len;
+		store_release(&r->consumed, pos);
+	}
+
+	/*
+	 * The consumed offset must be visible before the sleeping flag is checked.
+	 * Empty records (e.g padding at the ring end) free space too
+	 */
+	if ( likely(pos != start) ) {
+		memory_barrier();
+
+		if ( unlikely(load_relaxed(&r->writer_waiting) != 0 && compare_swap(&r->writer_waiting, 1, 0)) ) {
+			shm_stream::wake(&r->writer_waiting, INT_MAX);
+		}
+	}
+
+	return retval;
+}
+
+
+/**
+ * @brief Create and map the ring
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ *
+ * @note
+ *	If the reader is already open, it is closed and re-opened. A stale segment
+ *	of the same name is replaced
+ */
+shm_reader& shm_reader::open()
+{
+	close();
+	shm_unlink(m_name);
+
+	i32 fd = shm_open(m_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if ( unlikely(fd < 0) ) {
+		throw exception(
+			"failed to create shared memory ring %s (errno %d - %s)",
+			m_name,
+			errno,
+			strerror(errno)
+		);
+	}
+
+	/* The segment is zero filled, the magic number is set last */
+	u64 sz = sizeof(shm_stream::ring) + m_capacity;
+	void *mem = MAP_FAILED;
+	if ( likely(ftruncate(fd, sz) == 0) ) {
+		mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	i32 err = errno;
+	::close(fd);
+
+	if ( unlikely(mem == MAP_FAILED) ) {
+		shm_unlink(m_name);
+
+		throw exception(
+			"failed to map shared memory ring %s (errno %d - %s)",
+			m_name,
+			err,
+			strerror(err)
+		);
+	}
+
+	m_ring = static_cast<shm_stream::ring*> (mem);
+	m_ring->capacity = m_capacity;
+	store_barrier();
+	memcpy(m_ring->magic, g_shm_magic, sizeof(g_shm_magic));
+	return *this;
+}
+
+
+/**
+ * @brief Read the data of the committed records, waiting for records if the ring is empty
+ *
+ * @param[out] dst the string to append the data to
+ *
+ * @param[in] max the appended byte count after which no record is consumed (0 for no limit)
+ *
+ * @param[in] ms the wait timeout in milliseconds (0 to return at once)
+ *
+ * @returns the appended byte count (0 if no record was committed meanwhile)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+u32 shm_reader::read(string &dst, u32 max, u32 ms)
+{
+	if ( unlikely(m_ring == NULL) ) {
+		throw exception("shared memory ring %s is not open", m_name);
+	}
+
+	u32 retval = consume(dst, max);
+	if ( likely(retval > 0 || ms == 0) ) {
+		return retval;
+	}
+
+	/* The sleeping flag must be visible before the ring is checked again */
+	store_relaxed(&m_ring->reader_waiting, 1);
+	memory_barrier();
+
+	retval = consume(dst, max);
+	if ( likely(retval == 0) ) {
+		shm_stream::wait(&m_ring->reader_waiting, 1, ms);
+		retval = consume(dst, max);
+	}
+
+	store_relaxed(&m_ring->reader_waiting, 0);
+	return retval;
+}
+
+}
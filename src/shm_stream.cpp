@@ -0,0 +1,482 @@
+#include "../include/shm_stream.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/shm_stream.cpp
+
+	@brief Class instrument::shm_stream method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Sleep on a futex word of a shared memory ring
+ *
+ * @param[in] word the futex word (in a shared mapping)
+ *
+ * @param[in] val the value expected in the word (no sleep otherwise)
+ *
+ * @param[in] ms the timeout in milliseconds
+ *
+ * @returns 0 if woken up, -1 otherwise (errno is set, ETIMEDOUT or EAGAIN)
+ */
+i32 shm_stream::wait(u32 *word, u32 val, u32 ms)
+{
+	struct timespec timeout;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_nsec = (ms % 1000) * 1000000L;
+
+	return syscall(SYS_futex, word, FUTEX_WAIT, val, &timeout, NULL, 0);
+}
+
+
+/**
+ * @brief Wake up the sleepers of a futex word of a shared memory ring
+ *
+ * @param[in] word the futex word (in a shared mapping)
+ *
+ * @param[in] cnt the maximum woken up sleepers
+ */
+void shm_stream::wake(u32 *word, u32 cnt)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE, cnt, NULL, NULL, 0);
+}
+
+
+/**
+ * @brief Object constructor
+ *
+ * @param[in] nm the shared memory segment name (e.g /idp, see shm_open(3))
+ *
+ * @param[in] policy the backpressure policy (BLOCK or DROP_NEWEST)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+shm_stream::shm_stream(const i8 *nm, u32 policy)
+try:
+stream(),
+m_name(NULL),
+m_ring(NULL),
+m_policy(policy),
+m_dropped(0)
+{
+	if ( unlikely(nm == NULL || strlen(nm) == 0) ) {
+		throw exception("invalid argument: nm (=%p)", nm);
+	}
+
+	m_name = new i8[strlen(nm) + 1];
+	strcpy(m_name, nm);
+}
+catch (...) {
+	release();
+	m_name = NULL;
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+shm_stream::shm_stream(const shm_stream &src)
+try:
+stream(src),
+m_name(NULL),
+m_ring(NULL),
+m_policy(src.m_policy),
+m_dropped(0)
+{
+	m_name = new i8[strlen(src.m_name) + 1];
+	strcpy(m_name, src.m_name);
+
+	/* The duplicated descriptor maps the same ring */
+	if ( likely(m_handle >= 0) ) {
+		map();
+	}
+}
+catch (...) {
+	close();
+
+	release();
+	m_name = NULL;
+}
+
+
+/**
+ * @brief Object destructor
+ */
+shm_stream::~shm_stream()
+{
+	close();
+
+	delete[] m_name;
+	m_name = NULL;
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @returns the object copy (heap allocated)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+inline shm_stream* shm_stream::clone() const
+{
+	return new shm_stream(*this);
+}
+
+
+/**
+ * @brief Get the byte count dropped by the backpressure policy
+ *
+ * @returns this->m_dropped
+ */
+inline u64 shm_stream::dropped() const
+{
+	return m_dropped;
+}
+
+
+/**
+ * @brief Check if the ring is mapped
+ *
+ * @returns true if the stream is open, false otherwise
+ */
+inline bool shm_stream::is_open() const
+{
+	return m_ring != NULL;
+}
+
+
+/**
+ * @brief Get the shared memory segment name
+ *
+ * @returns this->m_name
+ */
+inline const i8* shm_stream::name() const
+{
+	return m_name;
+}
+
+
+/**
+ * @brief Asynchronous output is not supported (flushing never waits for a system call)
+ *
+ * @param[in] how ignored
+ *
+ * @param[in] capacity ignored
+ *
+ * @param[in] policy ignored
+ *
+ * @returns *this
+ */
+inline shm_stream& shm_stream::set_async(bool how, u32 capacity, u32 policy)
+{
+	return *this;
+}
+
+
+#ifdef WITH_STREAM_COMPRESSION
+/**
+ * @brief Compression is not supported (the collector is on the same host)
+ *
+ * @param[in] codec ignored
+ *
+ * @param[in] level ignored
+ *
+ * @param[in] block ignored
+ *
+ * @throws instrument::exception
+ */
+inline shm_stream& shm_stream::set_compression(u32 codec, i32 level, u32 block)
+{
+	throw exception("shared memory rings can't be compressed (%s)", m_name);
+}
+#endif
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+shm_stream& shm_stream::operator=(const shm_stream &rval)
+{
+	if ( unlikely(this == &rval) ) {
+		return *this;
+	}
+
+	/* Copy the buffer and duplicate the stream descriptor */
+	stream::operator=(rval);
+
+	u32 len = strlen(rval.m_name);
+	if (len > strlen(m_name)) {
+		delete[] m_name;
+		m_name = NULL;
+		m_name = new i8[len + 1];
+	}
+
+	strcpy(m_name, rval.m_name);
+	m_policy = rval.m_policy;
+
+	if ( likely(m_handle >= 0) ) {
+		map();
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Unmap the ring and close the shared memory segment
+ *
+ * @returns *this
+ */
+shm_stream& shm_stream::close()
+{
+	if ( likely(m_ring != NULL) ) {
+		munmap(m_ring, sizeof(ring) + m_ring->capacity);
+		m_ring = NULL;
+	}
+
+	stream::close();
+	return *this;
+}
+
+
+/**
+ * @brief Write data to the ring as a single record
+ *
+ * @param[in] iov the data segments
+ *
+ * @param[in] cnt the segment count
+ *
+ * @returns the written (or dropped) byte count or -1 (errno is set)
+ *
+ * @note
+ *	At most a quarter of the ring capacity is written, the stream writes the
+ *	rest as more records
+ */
+i32 shm_stream::emit(const struct iovec *iov, u32 cnt)
+{
+	ring *r = m_ring;
+	if ( unlikely(r == NULL) ) {
+		errno = EBADF;
+		return -1;
+	}
+
+	u64 cap = r->capacity;
+	u32 total = 0;
+	for (u32 i = 0; likely(i < cnt); i++) {
+		total += iov[i].iov_len;
+	}
+
+	if ( unlikely(total > cap / 4) ) {
+		total = cap / 4;
+	}
+
+	/* Reserve the record (and the padding up to the end of the data area) */
+	u64 need = (sizeof(record) + total + 7) & ~7ULL;
+	u64 pos, pad, end;
+	while (true) {
+		pos = load_acquire(&r->reserved);
+
+		u64 offset = pos & (cap - 1);
+		pad = (unlikely(offset + need > cap)) ? cap - offset : 0;
+		end = pos + pad + need;
+
+		if ( unlikely(end - load_acquire(&r->consumed) > cap) ) {
+			if ( likely(m_policy != BLOCK) ) {
+				m_dropped += total;
+				return total;
+			}
+
+			wait_space(end - cap);
+			continue;
+		}
+
+		if ( likely(compare_swap(&r->reserved, pos, end)) ) {
+			break;
+		}
+	}
+
+	i8 *data = reinterpret_cast<i8*> (r + 1);
+	if ( unlikely(pad > 0) ) {
+		record *hdr = reinterpret_cast<record*> (data + (pos & (cap - 1)));
+		hdr->size = 0;
+		store_release(&hdr->length, pad);
+	}
+
+	/* Copy the data, then commit the record */
+	record *hdr = reinterpret_cast<record*> (data + ((pos + pad) & (cap - 1)));
+	i8 *dst = reinterpret_cast<i8*> (hdr + 1);
+	for (u32 i = 0, left = total; likely(i < cnt && left > 0); i++) {
+		u32 len = (likely(iov[i].iov_len < left)) ? iov[i].iov_len : left;
+		memcpy(dst, iov[i].iov_base, len);
+		dst += len;
+		left -= len;
+	}
+
+	hdr->size = total;
+	store_release(&hdr->length, need);
+
+	/* The commit must be visible before the sleeping flag is checked */
+	memory_barrier();
+	if ( unlikely(load_relaxed(&r->reader_waiting) != 0 && compare_swap(&r->reader_waiting, 1, 0)) ) {
+		wake(&r->reader_waiting, 1);
+	}
+
+	return total;
+}
+
+
+/**
+ * @brief Flush the buffered data to the ring
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+shm_stream& shm_stream::flush()
+{
+	try {
+		transmit();
+	}
+	catch (i32 err) {
+		throw exception(
+			"failed to write to shared memory ring %s (errno %d - %s)",
+			m_name,
+			err,
+			strerror(err)
+		);
+	}
+
+	/* Clear the buffer */
+	clear();
+	return *this;
+}
+
+
+/**
+ * @brief Map the ring of the shared memory segment (the descriptor is open)
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ */
+shm_stream& shm_stream::map()
+{
+	struct stat st;
+	if ( unlikely(fstat(m_handle, &st) < 0) ) {
+		throw exception("failed to query %s (errno %d - %s)", m_name, errno, strerror(errno));
+	}
+
+	u64 sz = st.st_size;
+	if ( unlikely(sz < sizeof(ring)) ) {
+		throw exception("%s is not a shared memory ring", m_name);
+	}
+
+	void *mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, m_handle, 0);
+	if ( unlikely(mem == MAP_FAILED) ) {
+		throw exception("failed to map %s (errno %d - %s)", m_name, errno, strerror(errno));
+	}
+
+	ring *r = static_cast<ring*> (mem);
+	if ( unlikely(memcmp(r->magic, g_shm_magic, sizeof(g_shm_magic)) != 0 ||
+								sizeof(ring) + r->capacity != sz) ) {
+		munmap(mem, sz);
+		throw exception("%s is not a shared memory ring", m_name);
+	}
+
+	m_ring = r;
+	return *this;
+}
+
+
+/**
+ * @brief Open and map the ring of the collector
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ *
+ * @note
+ *	If the stream is already open, it is closed and re-opened. The segment must
+ *	exist, it's created by the collector (see instrument::shm_reader)
+ */
+shm_stream& shm_stream::open()
+{
+	if ( unlikely(m_handle >= 0) ) {
+		close();
+	}
+
+	m_handle = shm_open(m_name, O_RDWR, 0);
+	if ( unlikely(m_handle < 0) ) {
+		throw exception(
+			"failed to open shared memory ring %s (errno %d - %s)",
+			m_name,
+			errno,
+			strerror(errno)
+		);
+	}
+
+	try {
+		map();
+	}
+	catch (...) {
+		close();
+		throw;
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Commit cached data to the ring (the records are visible once committed)
+ *
+ * @returns *this
+ */
+inline shm_stream& shm_stream::sync() const
+{
+	return const_cast<shm_stream&> (*this);
+}
+
+
+
+/**
+ * @brief Wait until the collector consumes the ring up to an offset
+ *
+ * @param[in] offset the required consumed offset
+ *
+ * @returns true if the offset was consumed, false if the wait timed out
+ */
+bool shm_stream::wait_space(u64 offset)
+{
+	ring *r = m_ring;
+
+	/* The sleeping flag must be visible before the consumed offset is checked */
+	store_relaxed(&r->writer_waiting, 1);
+	memory_barrier();
+
+	if ( likely(static_cast<i64> (load_acquire(&r->consumed) - offset) >= 0) ) {
+		return true;
+	}
+
+	wait(&r->writer_waiting, 1, g_shm_wait_ms);
+	return static_cast<i64> (load_acquire(&r->consumed) - offset) >= 0;
+}
+
+}
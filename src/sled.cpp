@@ -0,0 +1,776 @@
+#include "../include/metrics.hpp"
+#include "../include/patcher.hpp"
+#include "../include/sled.hpp"
+#include "../include/tracer.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/sled.cpp
+
+	@brief Class instrument::sled method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+__thread sled::stack *sled::s_stack = NULL;
+
+pthread_key_t sled::s_exit_key;
+
+pthread_once_t sled::s_exit_once = PTHREAD_ONCE_INIT;
+
+mem_addr_t sled::s_stubs[g_sled_stubs_max];
+
+u32 sled::s_stub_count = 0;
+
+u32 sled::s_count = 0;
+
+pthread_mutex_t sled::s_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Link the trampolines and the interposed unwinder functions with C-style linking */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void __instrument_sled_entry()	__attribute((visibility("hidden")));
+
+void __instrument_sled_return()	__attribute((visibility("hidden")));
+
+/**
+ * @brief Extended state save area size of the trampolines (see sled::probe_state)
+ */
+__attribute((visibility("hidden"))) u64 __instrument_sled_state_sz = 576;
+
+/**
+ * @brief Extended state components saved by the trampolines (0 for fxsave)
+ */
+__attribute((visibility("hidden"))) u64 __instrument_sled_state_mask = 0;
+
+/**
+ * @brief Compacted extended state saves (xsavec, skips the components in their initial state)
+ */
+__attribute((visibility("hidden"))) u32 __instrument_sled_state_compact = 0;
+
+
+/**
+ * @brief Entry trampoline handler
+ *
+ * @param[in] fn the function address
+ *
+ * @param[in] slot the return address stack slot of the function
+ */
+__attribute((visibility("hidden"))) void __instrument_sled_enter(mem_addr_t fn, mem_addr_t *slot)
+{
+	sled::entered(fn, slot);
+}
+
+
+/**
+ * @brief Exit trampoline handler
+ *
+ * @param[in] sp the stack pointer after the function returned
+ *
+ * @returns the original return address of the function
+ */
+__attribute((visibility("hidden"))) mem_addr_t __instrument_sled_exit(mem_addr_t sp)
+{
+	return sled::returned(sp);
+}
+
+
+/*
+ * The entry trampoline is called from the sled, before the function entry, so
+ * the function address is its return address and the function return address
+ * is above it. It returns past the jump at the entry. The exit trampoline is
+ * returned to, with the return value in rax:rdx, the vector registers (or
+ * st0:st1), and jumps to the original return address. Both align the stack
+ * themselves, the functions entered through a sled aren't always called with
+ * an aligned stack. The extended state is saved in a 64 bytes aligned area,
+ * its XSAVE header zeroed first, as xrstor checks its reserved bytes
+ */
+#if defined __x86_64__
+asm(
+"	.text\n"
+"	.p2align 4\n"
+"	.type __instrument_sled_entry, @function\n"
+"__instrument_sled_entry:\n"
+"	.cfi_startproc\n"
+"	pushq %rbp\n"
+"	.cfi_adjust_cfa_offset 8\n"
+"	.cfi_rel_offset rbp, 0\n"
+"	movq %rsp, %rbp\n"
+"	.cfi_def_cfa_register rbp\n"
+"	subq $72, %rsp\n"
+"	movq %rax, -8(%rbp)\n"
+"	movq %rdi, -16(%rbp)\n"
+"	movq %rsi, -24(%rbp)\n"
+"	movq %rdx, -32(%rbp)\n"
+"	movq %rcx, -40(%rbp)\n"
+"	movq %r8, -48(%rbp)\n"
+"	movq %r9, -56(%rbp)\n"
+"	movq %r10, -64(%rbp)\n"
+"	movq %r11, -72(%rbp)\n"
+"	subq __instrument_sled_state_sz(%rip), %rsp\n"
+"	andq $-64, %rsp\n"
+"	call __instrument_sled_save\n"
+"	movq 8(%rbp), %rdi\n"
+"	leaq 16(%rbp), %rsi\n"
+"	call __instrument_sled_enter\n"
+"	call __instrument_sled_restore\n"
+"	movq -72(%rbp), %r11\n"
+"	movq -64(%rbp), %r10\n"
+"	movq -56(%rbp), %r9\n"
+"	movq -48(%rbp), %r8\n"
+"	movq -40(%rbp), %rcx\n"
+"	movq -32(%rbp), %rdx\n"
+"	movq -24(%rbp), %rsi\n"
+"	movq -16(%rbp), %rdi\n"
+"	movq -8(%rbp), %rax\n"
+"	movq %rbp, %rsp\n"
+"	popq %rbp\n"
+"	.cfi_def_cfa rsp, 8\n"
+"	.cfi_restore rbp\n"
+"	addq $2, (%rsp)\n"
+"	ret\n"
+"	.cfi_endproc\n"
+"	.size __instrument_sled_entry, .-__instrument_sled_entry\n"
+"\n"
+"	.p2align 4\n"
+"	.type __instrument_sled_return, @function\n"
+"__instrument_sled_return:\n"
+"	.cfi_startproc\n"
+"	.cfi_undefined rip\n"
+"	subq $8, %rsp\n"
+"	pushq %rbp\n"
+"	movq %rsp, %rbp\n"
+"	subq $16, %rsp\n"
+"	movq %rax, -8(%rbp)\n"
+"	movq %rdx, -16(%rbp)\n"
+"	subq __instrument_sled_state_sz(%rip), %rsp\n"
+"	andq $-64, %rsp\n"
+"	call __instrument_sled_save\n"
+"	leaq 16(%rbp), %rdi\n"
+"	call __instrument_sled_exit\n"
+"	movq %rax, 8(%rbp)\n"
+"	call __instrument_sled_restore\n"
+"	movq -16(%rbp), %rdx\n"
+"	movq -8(%rbp), %rax\n"
+"	movq %rbp, %rsp\n"
+"	popq %rbp\n"
+"	ret\n"
+"	.cfi_endproc\n"
+"	.size __instrument_sled_return, .-__instrument_sled_return\n"
+"\n"
+/*
+ * Save the extended state in the area at the caller stack pointer (past the
+ * return address), clobbers rax and rdx only
+ */
+"	.p2align 4\n"
+"	.type __instrument_sled_save, @function\n"
+"__instrument_sled_save:\n"
+"	.cfi_startproc\n"
+"	xorl %eax, %eax\n"
+"	movq %rax, 520(%rsp)\n"
+"	movq %rax, 528(%rsp)\n"
+"	movq %rax, 536(%rsp)\n"
+"	movq %rax, 544(%rsp)\n"
+"	movq %rax, 552(%rsp)\n"
+"	movq %rax, 560(%rsp)\n"
+"	movq %rax, 568(%rsp)\n"
+"	movq %rax, 576(%rsp)\n"
+"	movl __instrument_sled_state_mask(%rip), %eax\n"
+"	movl __instrument_sled_state_mask+4(%rip), %edx\n"
+"	testl %eax, %eax\n"
+"	jz 1f\n"
+"	cmpl $0, __instrument_sled_state_compact(%rip)\n"
+"	jne 2f\n"
+"	xsave64 8(%rsp)\n"
+"	ret\n"
+"1:\n"
+"	fxsave64 8(%rsp)\n"
+"	ret\n"
+"2:\n"
+"	xsavec64 8(%rsp)\n"
+"	ret\n"
+"	.cfi_endproc\n"
+"	.size __instrument_sled_save, .-__instrument_sled_save\n"
+"\n"
+/*
+ * Restore the extended state saved by __instrument_sled_save, clobbers rax
+ * and rdx only
+ */
+"	.p2align 4\n"
+"	.type __instrument_sled_restore, @function\n"
+"__instrument_sled_restore:\n"
+"	.cfi_startproc\n"
+"	movl __instrument_sled_state_mask(%rip), %eax\n"
+"	movl __instrument_sled_state_mask+4(%rip), %edx\n"
+"	testl %eax, %eax\n"
+"	jz 1f\n"
+"	xrstor64 8(%rsp)\n"
+"	ret\n"
+"1:\n"
+"	fxrstor64 8(%rsp)\n"
+"	ret\n"
+"	.cfi_endproc\n"
+"	.size __instrument_sled_restore, .-__instrument_sled_restore\n"
+);
+#endif
+
+
+/**
+ * @brief Interposed exception raise, restores the return addresses first
+ *
+ * @param[in] x the exception
+ *
+ * @returns the unwinder reason code
+ */
+_Unwind_Reason_Code _Unwind_RaiseException(_Unwind_Exception *x)
+{
+	typedef _Unwind_Reason_Code (*raise_t)(_Unwind_Exception*);
+	static raise_t next = reinterpret_cast<raise_t> (dlsym(RTLD_NEXT, __FUNCTION__));
+
+	sled::unwinding(reinterpret_cast<mem_addr_t> (__builtin_frame_address(0)));
+	return next(x);
+}
+
+
+/**
+ * @brief Interposed exception rethrow, restores the return addresses first
+ *
+ * @param[in] x the exception
+ *
+ * @returns the unwinder reason code
+ */
+_Unwind_Reason_Code _Unwind_Resume_or_Rethrow(_Unwind_Exception *x)
+{
+	typedef _Unwind_Reason_Code (*rethrow_t)(_Unwind_Exception*);
+	static rethrow_t next = reinterpret_cast<rethrow_t> (dlsym(RTLD_NEXT, __FUNCTION__));
+
+	sled::unwinding(reinterpret_cast<mem_addr_t> (__builtin_frame_address(0)));
+	return next(x);
+}
+
+
+/**
+ * @brief
+ *	Interposed forced unwinding (e.g thread cancellation), restores the return
+ *	addresses first
+ *
+ * @param[in] x the exception
+ *
+ * @param[in] stop the stop function
+ *
+ * @param[in] arg the stop function argument
+ *
+ * @returns the unwinder reason code
+ */
+_Unwind_Reason_Code _Unwind_ForcedUnwind(_Unwind_Exception *x, _Unwind_Stop_Fn stop, void *arg)
+{
+	typedef _Unwind_Reason_Code (*unwind_t)(_Unwind_Exception*, _Unwind_Stop_Fn, void*);
+	static unwind_t next = reinterpret_cast<unwind_t> (dlsym(RTLD_NEXT, __FUNCTION__));
+
+	sled::unwinding(reinterpret_cast<mem_addr_t> (__builtin_frame_address(0)));
+	return next(x, stop, arg);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+
+/**
+ * @brief Create the thread exit hook key (once per library instance)
+ */
+void sled::create_exit_key()
+{
+	if ( unlikely(pthread_key_create(&s_exit_key, on_thread_exit) != 0) ) {
+		util::dbg_warn("failed to create the sled exit key, exited thread return stacks are kept");
+	}
+}
+
+
+/**
+ * @brief Get the return stack of the current thread, allocating it on first use
+ *
+ * @returns the return stack or NULL if it can't be allocated
+ */
+sled::stack* sled::current()
+{
+	stack *retval = s_stack;
+	if ( likely(retval != NULL) ) {
+		return retval;
+	}
+
+	retval = new (std::nothrow) stack;
+	if ( unlikely(retval == NULL) ) {
+		return NULL;
+	}
+
+	retval->frames = new (std::nothrow) frame[g_sled_stack_sz];
+	if ( unlikely(retval->frames == NULL) ) {
+		delete retval;
+		return NULL;
+	}
+
+	retval->size = 0;
+	retval->capacity = g_sled_stack_sz;
+
+	pthread_once(&s_exit_once, create_exit_key);
+	pthread_setspecific(s_exit_key, retval);
+
+	s_stack = retval;
+	return retval;
+}
+
+
+/**
+ * @brief Thread exit hook, dispose the return stack of the exiting thread
+ *
+ * @param[in] arg the return stack
+ */
+void sled::on_thread_exit(void *arg)
+{
+	stack *stk = static_cast<stack*> (arg);
+	if ( likely(stk == s_stack) ) {
+		s_stack = NULL;
+	}
+
+	delete[] stk->frames;
+	delete stk;
+}
+
+
+/**
+ * @brief Size the extended state saved by the trampolines (sled::s_lock must be held)
+ *
+ * @note
+ *	With XSAVE enabled by the OS, the trampolines save the components enabled
+ *	in XCR0, in the area size CPUID leaf 0xD reports for them, in the compacted
+ *	format if supported (xsavec skips the components in their initial state,
+ *	e.g the upper halves of the vector registers after vzeroupper). Otherwise
+ *	they save the legacy x87 and SSE state (fxsave)
+ */
+void sled::probe_state()
+{
+#if defined __x86_64__
+	static bool probed = false;
+	if ( likely(probed) ) {
+		return;
+	}
+
+	probed = true;
+
+	u32 eax = 0, ebx = 0, ecx = 0, edx = 0;
+	if ( unlikely(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) ) {
+		return;
+	}
+
+	u32 lo = 0, hi = 0;
+	asm volatile("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+
+	__cpuid_count(0xd, 0, eax, ebx, ecx, edx);
+	u32 sz = ebx;
+
+	/* The compacted size covers the supervisor components too, it's an upper bound */
+	__cpuid_count(0xd, 1, eax, ebx, ecx, edx);
+	if ( likely(eax & 0x2) ) {
+		__instrument_sled_state_compact = 1;
+		sz = ebx;
+	}
+
+	if ( likely(sz > __instrument_sled_state_sz) ) {
+		__instrument_sled_state_sz = sz;
+	}
+
+	__instrument_sled_state_mask = (static_cast<u64> (hi) << 32) | lo;
+#endif
+}
+
+
+/**
+ * @brief Pop the innermost frame of a return stack and simulate its return
+ *
+ * @param[in,out] stk the return stack (not empty)
+ *
+ * @note The frame is popped first, the return may call instrumented functions
+ */
+void sled::simulate_return(stack *stk)
+{
+	const frame &f = stk->frames[--stk->size];
+	tracer::on_exit(reinterpret_cast<void*> (f.fn), reinterpret_cast<void*> (f.ret), 0);
+}
+
+
+/**
+ * @brief Get a trampoline stub within a rel32 call of a function, mapping one if needed
+ *
+ * @param[in] fn the function address
+ *
+ * @returns the stub address or 0 if it can't be mapped (sled::s_lock must be held)
+ *
+ * @note A stub is an indirect jump to the entry trampoline, on its own page
+ */
+mem_addr_t sled::stub(mem_addr_t fn)
+{
+	const i64 reach = 0x7fff0000;
+	for (u32 i = 0; likely(i < s_stub_count); i++) {
+		i64 dist = static_cast<i64> (s_stubs[i] - fn);
+		if ( likely(dist < reach && dist > -reach) ) {
+			return s_stubs[i];
+		}
+	}
+
+	if ( unlikely(s_stub_count == g_sled_stubs_max) ) {
+		util::dbg_warn("too many sled stubs, the sled at %p is not enabled", fn);
+		return 0;
+	}
+
+	/* Try pages at growing distances, below and above the function */
+	mem_addr_t pgsz = sysconf(_SC_PAGESIZE);
+	for (mem_addr_t delta = 1 << 20; likely(delta < (1U << 30)); delta <<= 1) {
+		for (u32 i = 0; likely(i < 2); i++) {
+			mem_addr_t hint = ((i == 0) ? fn - delta : fn + delta) & ~(pgsz - 1);
+			void *mem = mmap(reinterpret_cast<void*> (hint), pgsz, PROT_READ | PROT_WRITE,
+											 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if ( unlikely(mem == MAP_FAILED) ) {
+				continue;
+			}
+
+			mem_addr_t retval = reinterpret_cast<mem_addr_t> (mem);
+			i64 dist = static_cast<i64> (retval - fn);
+			if ( unlikely(dist >= reach || dist <= -reach) ) {
+				munmap(mem, pgsz);
+				continue;
+			}
+
+			/* jmp *0(%rip), followed by the trampoline address */
+			u8 *code = static_cast<u8*> (mem);
+			mem_addr_t target = reinterpret_cast<mem_addr_t> (&__instrument_sled_entry);
+			const u8 jmp[] = {0xff, 0x25, 0x00, 0x00, 0x00, 0x00};
+
+			memcpy(code, jmp, sizeof(jmp));
+			memcpy(code + sizeof(jmp), &target, sizeof(target));
+			mprotect(mem, pgsz, PROT_READ | PROT_EXEC);
+
+			s_stubs[s_stub_count++] = retval;
+			return retval;
+		}
+	}
+
+	util::dbg_warn("failed to map a sled stub near %p", fn);
+	return 0;
+}
+
+
+/**
+ * @brief Get the 8 replaced bytes of a sled
+ *
+ * @param[in] fn the function address
+ *
+ * @returns the address of the 8 bytes (within a cache line) or 0 if the sled straddles a cache line
+ */
+mem_addr_t sled::window(mem_addr_t fn)
+{
+	mem_addr_t begin = fn - 5;
+	mem_addr_t line = (begin | (g_cacheline_sz - 1)) + 1;
+
+	if ( unlikely(fn + 2 > line) ) {
+		return 0;
+	}
+
+	return (likely(begin + sizeof(u64) <= line)) ? begin : line - sizeof(u64);
+}
+
+
+/**
+ * @brief Get the enabled sled count
+ *
+ * @returns this->s_count
+ */
+u32 sled::count()
+{
+	return load_acquire(&s_count);
+}
+
+
+/**
+ * @brief Disable the sled of a function (restore the NOPs)
+ *
+ * @param[in] fn the function address
+ *
+ * @returns true if the sled was disabled, false if it was not enabled
+ *
+ * @note
+ *	Doesn't throw. The calls entered (or entering) meanwhile still return
+ *	through the exit trampoline
+ */
+bool sled::disable(mem_addr_t fn)
+{
+	pthread_mutex_lock(&s_lock);
+	if ( unlikely(!is_enabled(fn)) ) {
+		pthread_mutex_unlock(&s_lock);
+		return false;
+	}
+
+	mem_addr_t win = window(fn);
+
+	u64 code;
+	memcpy(&code, reinterpret_cast<const void*> (win), sizeof(code));
+
+	u64 nops = code;
+	memset(reinterpret_cast<u8*> (&nops) + (fn - 5 - win), 0x90, 7);
+
+	bool retval = patcher::write(win, code, nops);
+	if ( likely(retval) ) {
+		store_release(&s_count, s_count - 1);
+	}
+
+	pthread_mutex_unlock(&s_lock);
+	return retval;
+}
+
+
+/**
+ * @brief Enable the sled of a function
+ *
+ * @param[in] fn the function address (compiled with -fpatchable-function-entry=7,5)
+ *
+ * @returns true if the sled was enabled, false otherwise
+ *
+ * @note Doesn't throw. Only x86-64 sleds within a cache line are enabled
+ */
+bool sled::enable(mem_addr_t fn)
+{
+#if defined __x86_64__
+	pthread_mutex_lock(&s_lock);
+
+	probe_state();
+
+	mem_addr_t win = window(fn);
+	mem_addr_t st = 0;
+	if ( unlikely(win == 0 || !is_sled(fn) || (st = stub(fn)) == 0) ) {
+		pthread_mutex_unlock(&s_lock);
+		return false;
+	}
+
+	u64 code;
+	memcpy(&code, reinterpret_cast<const void*> (win), sizeof(code));
+
+	/* call stub (before the entry), jmp -7 (at the entry) */
+	i32 rel = static_cast<i32> (st - fn);
+	u8 sled[7] = {0xe8, 0, 0, 0, 0, 0xeb, 0xf9};
+	memcpy(sled + 1, &rel, sizeof(rel));
+
+	u64 patched = code;
+	memcpy(reinterpret_cast<u8*> (&patched) + (fn - 5 - win), sled, sizeof(sled));
+
+	bool retval = patcher::write(win, code, patched);
+	if ( likely(retval) ) {
+		store_release(&s_count, s_count + 1);
+	}
+
+	pthread_mutex_unlock(&s_lock);
+	return retval;
+#else
+	return false;
+#endif
+}
+
+
+/**
+ * @brief Enable the sleds of all the functions of the instrumented modules
+ *
+ * @param[in] proc the process
+ *
+ * @returns the enabled sled count
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The sleds are found by their NOPs at the function symbols, so the deferred
+ *	symbol tables are loaded
+ */
+u32 sled::enable_all(const process *proc)
+{
+	u32 retval = 0;
+	proc->lock();
+
+	try {
+		for (u32 i = 0, sz = proc->m_symtabs->size(); likely(i < sz); i++) {
+			const symtab *tab = proc->m_symtabs->at(i);
+			tab->load();
+
+			const symbol_t *tbl = tab->table();
+			for (u32 j = 0, cnt = tab->size(); likely(j < cnt); j++) {
+				mem_addr_t fn = tab->addr(&tbl[j]);
+
+				if ( likely(tab->contains(fn - 5) && tab->contains(fn + 1) && enable(fn)) ) {
+					retval++;
+				}
+			}
+		}
+	}
+	catch (...) {
+		proc->unlock();
+		throw;
+	}
+
+	proc->unlock();
+	return retval;
+}
+
+
+/**
+ * @brief Entry trampoline handler, simulate a call entered through a sled
+ *
+ * @param[in] fn the function address
+ *
+ * @param[in,out] slot the return address stack slot (replaced with the exit trampoline)
+ *
+ * @note
+ *	A call is not simulated if the return stack can't grow. The innermost
+ *	frames at or below the slot returned without the exit trampoline, their
+ *	returns are simulated first
+ */
+void sled::entered(mem_addr_t fn, mem_addr_t *slot)
+{
+	stack *stk = current();
+	if ( unlikely(stk == NULL) ) {
+		count_metric(METRIC_DROPPED, 1);
+		return;
+	}
+
+	while ( unlikely(stk->size > 0 && stk->frames[stk->size - 1].slot <= slot) ) {
+		simulate_return(stk);
+	}
+
+	if ( unlikely(stk->size == stk->capacity) ) {
+		frame *frames = new (std::nothrow) frame[2 * stk->capacity];
+		if ( unlikely(frames == NULL) ) {
+			count_metric(METRIC_DROPPED, 1);
+			return;
+		}
+
+		memcpy(frames, stk->frames, stk->size * sizeof(frame));
+		delete[] stk->frames;
+		stk->frames = frames;
+		stk->capacity *= 2;
+	}
+
+	frame &f = stk->frames[stk->size++];
+	f.slot = slot;
+	f.ret = *slot;
+	f.fn = fn;
+	f.hijacked = true;
+	*slot = reinterpret_cast<mem_addr_t> (&__instrument_sled_return);
+
+	tracer::on_enter(reinterpret_cast<void*> (fn), reinterpret_cast<void*> (f.ret), 0);
+}
+
+
+/**
+ * @brief Check if the sled of a function is enabled
+ *
+ * @param[in] fn the function address
+ *
+ * @returns true if the function calls the entry trampoline, false otherwise
+ */
+bool sled::is_enabled(mem_addr_t fn)
+{
+	const u8 *code = reinterpret_cast<const u8*> (fn);
+	return (code[-5] == 0xe8 && code[0] == 0xeb && code[1] == 0xf9);
+}
+
+
+/**
+ * @brief Check if a function starts with a disabled sled
+ *
+ * @param[in] fn the function address
+ *
+ * @returns true if the 5 bytes before and the 2 bytes at the entry are NOPs, false otherwise
+ */
+bool sled::is_sled(mem_addr_t fn)
+{
+	const u8 *code = reinterpret_cast<const u8*> (fn - 5);
+	for (u32 i = 0; likely(i < 7); i++) {
+		if ( likely(code[i] != 0x90) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Exit trampoline handler, simulate the return of a call entered through a sled
+ *
+ * @param[in] sp the stack pointer after the return
+ *
+ * @returns the original return address
+ *
+ * @note
+ *	The frames pushed after the returning one returned without the exit
+ *	trampoline, their returns are simulated first. If the returning frame is
+ *	missing, the return stack is corrupt and the process aborts
+ */
+mem_addr_t sled::returned(mem_addr_t sp)
+{
+	stack *stk = s_stack;
+	mem_addr_t *slot = reinterpret_cast<mem_addr_t*> (sp) - 1;
+
+	while ( likely(stk != NULL && stk->size > 0 && stk->frames[stk->size - 1].slot < slot) ) {
+		simulate_return(stk);
+	}
+
+	if ( unlikely(stk == NULL || stk->size == 0 || stk->frames[stk->size - 1].slot != slot) ) {
+		util::dbg_error("sled return stack corrupt at %p", slot);
+		abort();
+	}
+
+	mem_addr_t retval = stk->frames[stk->size - 1].ret;
+	simulate_return(stk);
+	return retval;
+}
+
+
+/**
+ * @brief Restore the original return addresses, before the stack is unwound
+ *
+ * @param[in] sp the stack pointer of the unwinder caller
+ *
+ * @note
+ *	The frames below the stack pointer returned without the exit trampoline,
+ *	their returns are simulated. The other calls stay on the return stack, so
+ *	their returns are simulated when a later call or return finds them unwound
+ */
+void sled::unwinding(mem_addr_t sp)
+{
+	stack *stk = s_stack;
+	if ( likely(stk == NULL) ) {
+		return;
+	}
+
+	mem_addr_t *limit = reinterpret_cast<mem_addr_t*> (sp);
+	while ( likely(stk->size > 0 && stk->frames[stk->size - 1].slot < limit) ) {
+		simulate_return(stk);
+	}
+
+	mem_addr_t tramp = reinterpret_cast<mem_addr_t> (&__instrument_sled_return);
+	for (u32 i = 0; likely(i < stk->size); i++) {
+		frame &f = stk->frames[i];
+
+		if ( likely(f.hijacked && *f.slot == tramp) ) {
+			*f.slot = f.ret;
+		}
+
+		f.hijacked = false;
+	}
+}
+
+}
@@ -0,0 +1,641 @@
+#include "../include/slow_call.hpp"
+#include "../include/util.hpp"
+
+/**
+	@file src/slow_call.cpp
+
+	@brief Class instrument::slow_call method implementation
+*/
+
+namespace instrument {
+
+/* Static member variable definition */
+
+__thread slow_call::ring *slow_call::s_ring = NULL;
+
+slow_call::ring *slow_call::s_rings = NULL;
+
+const plugin *slow_call::s_plugin = NULL;
+
+slow_call::rule slow_call::s_default = {NULL, 0, ~0ULL};
+
+list<slow_call::rule> *slow_call::s_rules = NULL;
+
+registry<mem_addr_t, const slow_call::rule> *slow_call::s_index = NULL;
+
+u64 slow_call::s_floor = ~0ULL;
+
+u64 slow_call::s_tick0 = 0;
+
+u64 slow_call::s_nsec0 = 0;
+
+u64 slow_call::s_tick_rate = 0;
+
+pthread_mutex_t slow_call::s_lock = PTHREAD_MUTEX_INITIALIZER;
+
+pthread_mutex_t slow_call::s_report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @brief Instrumentation starting callback
+ *
+ * @param[in] this_fn the address of the called function
+ *
+ * @param[in] call_site the address where the function was called
+ *
+ * @note
+ *	The call is already on the simulated stack, it's stamped in place unless
+ *	another timing plugin (e.g the profiler) stamped it
+ */
+void slow_call::begin(void *this_fn, void *call_site)
+{
+	thread *thr = process::current()->current_thread();
+
+	/* Calls made while an exception propagates are not simulated */
+	frame_t *f = thr->top();
+	if ( unlikely(f == NULL || f->fn != reinterpret_cast<mem_addr_t> (this_fn)) ) {
+		return;
+	}
+
+	if ( likely(f->stamp == 0) ) {
+		f->stamp = profiler::ticks();
+	}
+}
+
+
+/**
+ * @brief Calibrate the ticks against the monotonic clock, once (not thread safe, s_lock must be held)
+ *
+ * @returns the ticks per microsecond
+ *
+ * @note
+ *	The first call sleeps for g_slow_calibration_ms. The durations of the
+ *	captures are calibrated again when they're reported, from the same start
+ */
+u64 slow_call::calibrate()
+{
+	if ( likely(s_tick_rate > 0) ) {
+		return s_tick_rate;
+	}
+
+	s_tick0 = profiler::ticks();
+	s_nsec0 = profiler::nsec();
+
+	timespec ts;
+	ts.tv_sec = g_slow_calibration_ms / 1000;
+	ts.tv_nsec = (g_slow_calibration_ms % 1000) * 1000000;
+	while ( unlikely(nanosleep(&ts, &ts) != 0 && errno == EINTR) );
+
+	u64 scale = profiler::calibrate(s_tick0, s_nsec0);
+	s_tick_rate = (likely(scale > 0)) ? (1000ULL << 32) / scale : 1000;
+	if ( unlikely(s_tick_rate == 0) ) {
+		s_tick_rate = 1;
+	}
+
+	return s_tick_rate;
+}
+
+
+/**
+ * @brief Capture a slow call in the ring of the current thread
+ *
+ * @param[in] thr the current thread
+ *
+ * @param[in] t the call duration (in ticks)
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The returning call is still on the simulated stack, it's captured first,
+ *	followed by its innermost callers. The oldest capture is overwritten once
+ *	the ring is full
+ */
+void slow_call::capture_call(thread *thr, u64 t)
+{
+	ring *r = s_ring;
+	if ( unlikely(r == NULL) ) {
+		r = register_thread();
+	}
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	u64 head = r->head;
+	capture &c = r->captures[head & (g_slow_ring_sz - 1)];
+	c.usec = static_cast<u64> (now.tv_sec) * 1000000 + now.tv_usec;
+	c.ticks = t;
+	c.depth = thr->call_depth();
+
+	u32 n = 0;
+	for ( ; likely(n < g_slow_frames); n++) {
+		const frame_t *f = thr->top(n);
+		if ( unlikely(f == NULL) ) {
+			break;
+		}
+
+		c.fns[n] = f->fn;
+		c.sites[n] = f->site;
+	}
+
+	c.size = n;
+	store_release(&r->head, head + 1);
+}
+
+
+/**
+ * @brief Copy the captures of a thread written since the previous drain (s_report_lock must be held)
+ *
+ * @param[in,out] r the thread captures
+ *
+ * @param[out] dst the destination array (g_slow_ring_sz captures)
+ *
+ * @returns the valid capture count, the valid captures start at dst[0]
+ *
+ * @note
+ *	After copying, the write position is read again. The captures the thread
+ *	reached meanwhile (including the one it may be writing) are dropped, like
+ *	the ones it overwrote before the drain
+ */
+u32 slow_call::drain(ring *r, capture *dst)
+{
+	u64 head = load_acquire(&r->head);
+	u64 first = r->tail;
+	if ( unlikely(head - first > g_slow_ring_sz) ) {
+		first = head - g_slow_ring_sz;
+	}
+
+	u32 cnt = head - first;
+	for (u32 i = 0; likely(i < cnt); i++) {
+		dst[i] = r->captures[(first + i) & (g_slow_ring_sz - 1)];
+	}
+
+	/* The copies are complete before the write position is read again */
+	memory_barrier();
+	u64 now = load_acquire(&r->head);
+	r->tail = head;
+
+	u64 valid = (likely(now + 1 > g_slow_ring_sz)) ? now + 1 - g_slow_ring_sz : 0;
+	if ( likely(first >= valid) ) {
+		return cnt;
+	}
+
+	u64 lost = valid - first;
+	if ( unlikely(lost >= cnt) ) {
+		return 0;
+	}
+
+	memmove(dst, dst + lost, (cnt - lost) * sizeof(capture));
+	return cnt - lost;
+}
+
+
+/**
+ * @brief Instrumentation ending callback
+ *
+ * @param[in] this_fn the address of the returning function
+ *
+ * @param[in] call_site the address that the program counter will return to
+ *
+ * @note
+ *	The returning call is still on the simulated stack. The calls faster than
+ *	the lowest threshold in use return after a single compare, the threshold of
+ *	the function is only looked up for the slower ones
+ */
+void slow_call::end(void *this_fn, void *call_site)
+{
+	u64 now = profiler::ticks();
+
+	thread *thr = process::current()->current_thread();
+	mem_addr_t fn = reinterpret_cast<mem_addr_t> (this_fn);
+
+	/* Each frame is checked once, even if an exception is propagating */
+	const frame_t *f = thr->top();
+	if ( unlikely(f == NULL || f->fn != fn || f->stamp == 0) ) {
+		return;
+	}
+
+	u64 t = now - f->stamp;
+	if ( likely(t < load_relaxed(&s_floor)) ) {
+		return;
+	}
+
+	const registry<mem_addr_t, const rule> *idx = load_acquire(&s_index);
+	const rule *r = (likely(idx != NULL)) ? idx->find(fn) : NULL;
+	if ( unlikely(r == NULL) ) {
+		r = resolve(fn);
+	}
+
+	if ( unlikely(t >= load_relaxed(&r->ticks)) ) {
+		capture_call(thr, t);
+	}
+}
+
+
+/**
+ * @brief Create the capture ring of the current thread and publish it
+ *
+ * @returns the thread captures
+ *
+ * @throws std::bad_alloc
+ */
+slow_call::ring* slow_call::register_thread()
+{
+	ring *retval = new ring;
+
+	try {
+		retval->captures = new capture[g_slow_ring_sz];
+	}
+	catch (...) {
+		delete retval;
+		throw;
+	}
+
+	retval->head = 0;
+	retval->tail = 0;
+	retval->id = pthread_self();
+
+	/* Lock-free push, the rings are never removed */
+	do {
+		retval->next = load_acquire(&s_rings);
+	} while ( unlikely(!compare_swap(&s_rings, retval->next, retval)) );
+
+	s_ring = retval;
+	return retval;
+}
+
+
+/**
+ * @brief Find the threshold of a function and index it
+ *
+ * @param[in] fn the function address
+ *
+ * @returns the first threshold whose expression matches the function signature, else the default one
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The functions of unknown modules (or without a symbol) get the default
+ *	threshold. The index itself is allocated upon the first resolution
+ */
+const slow_call::rule* slow_call::resolve(mem_addr_t fn)
+{
+	lock_mutex(&s_lock);
+
+	try {
+		if ( unlikely(s_index == NULL) ) {
+			registry<mem_addr_t, const rule> *idx = new registry<mem_addr_t, const rule>;
+			store_release(&s_index, idx);
+		}
+
+		/* The threshold may have been resolved meanwhile */
+		const rule *retval = s_index->find(fn);
+		if ( likely(retval == NULL) ) {
+			retval = &s_default;
+
+			const symtab *module = process::current()->get_module(fn);
+			const i8 *nm = (likely(module != NULL)) ? module->addr2name(fn) : NULL;
+			for (u32 i = 0, sz = (likely(s_rules != NULL)) ? s_rules->size() : 0; likely(nm != NULL && i < sz); i++) {
+				const rule *cur = (*s_rules)[i];
+				if ( unlikely(cur->expr->match(nm)) ) {
+					retval = cur;
+					break;
+				}
+			}
+
+			s_index->insert(fn, retval);
+		}
+
+		pthread_mutex_unlock(&s_lock);
+		return retval;
+	}
+	catch (...) {
+		pthread_mutex_unlock(&s_lock);
+		throw;
+	}
+}
+
+
+/**
+ * @brief Publish the lowest threshold in use (not thread safe, s_lock must be held)
+ */
+void slow_call::update_floor()
+{
+	u64 floor = s_default.ticks;
+	for (u32 i = 0, sz = (likely(s_rules != NULL)) ? s_rules->size() : 0; likely(i < sz); i++) {
+		u64 ticks = (*s_rules)[i]->ticks;
+		if ( unlikely(ticks < floor) ) {
+			floor = ticks;
+		}
+	}
+
+	store_release(&s_floor, floor);
+}
+
+
+/**
+ * @brief Set the threshold of the functions matching an expression
+ *
+ * @param[in] expr the function signature expression (POSIX extended regular expression)
+ *
+ * @param[in] usec the threshold in microseconds (0 to capture none of the functions)
+ *
+ * @param[in] icase true for case insensitive matching
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The expressions are tried in the order they were added, the threshold of
+ *	an expression that was already added is replaced. A new expression
+ *	resolves the thresholds of all the functions again
+ */
+void slow_call::add_threshold(const i8 *expr, u64 usec, bool icase)
+{
+	if ( unlikely(expr == NULL) ) {
+		throw exception("invalid argument: expr (=%p)", expr);
+	}
+
+	i32 flags = REG_EXTENDED | REG_NOSUB;
+	if ( likely(icase) ) {
+		flags |= REG_ICASE;
+	}
+
+	lock_mutex(&s_lock);
+
+	try {
+		u64 rate = calibrate();
+		u64 ticks = (likely(usec > 0 && usec < ~0ULL / rate)) ? usec * rate : ~0ULL;
+
+		if ( unlikely(s_rules == NULL) ) {
+			s_rules = new list<rule>;
+		}
+
+		rule *r = NULL;
+		for (u32 i = 0, sz = s_rules->size(); likely(i < sz); i++) {
+			rule *cur = (*s_rules)[i];
+			if ( unlikely(cur->expr->flags() == flags && strcmp(cur->expr->expr(), expr) == 0) ) {
+				r = cur;
+				break;
+			}
+		}
+
+		if ( likely(r == NULL) ) {
+			r = new rule;
+			r->expr = NULL;
+			r->usec = usec;
+			r->ticks = ticks;
+
+			try {
+				r->expr = new pattern(expr, flags);
+				s_rules->add(r);
+			}
+			catch (...) {
+				delete r->expr;
+				delete r;
+				throw;
+			}
+
+			/* The functions resolved to a lower priority threshold are resolved again */
+			if ( likely(s_index != NULL) ) {
+				s_index->clear();
+			}
+		}
+		else {
+			r->usec = usec;
+			store_relaxed(&r->ticks, ticks);
+		}
+
+		update_floor();
+		pthread_mutex_unlock(&s_lock);
+	}
+	catch (...) {
+		pthread_mutex_unlock(&s_lock);
+		throw;
+	}
+}
+
+
+/**
+ * @brief Register the slow call plugin (if it's not registered)
+ *
+ * @returns the plugin
+ *
+ * @throws std::bad_alloc
+ *
+ * @note Nothing is captured until a threshold is set (see slow_call::set_threshold)
+ */
+const plugin* slow_call::attach()
+{
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		return NULL;
+	}
+
+	try {
+		tracer::lock();
+
+		if ( likely(s_plugin == NULL) ) {
+			s_plugin = iface->add_plugin(begin, end);
+		}
+
+		tracer::unlock();
+		return s_plugin;
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Unregister the slow call plugin (if it's registered)
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The thresholds and the captures that weren't reported yet are kept
+ */
+void slow_call::detach()
+{
+	tracer *iface = tracer::interface();
+	if ( unlikely(iface == NULL) ) {
+		return;
+	}
+
+	try {
+		tracer::lock();
+
+		for (u32 i = 0, sz = iface->plugin_count(); likely(i < sz); i++) {
+			if ( unlikely(iface->get_plugin(i) == s_plugin) ) {
+				iface->remove_plugin(i);
+				break;
+			}
+		}
+
+		s_plugin = NULL;
+		tracer::unlock();
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Check if the slow call plugin is registered
+ *
+ * @returns true if the plugin is attached, false otherwise
+ */
+bool slow_call::is_attached()
+{
+	return load_acquire(&s_plugin) != NULL;
+}
+
+
+/**
+ * @brief Drain the captured slow calls as binary IDP v2 SLOW messages
+ *
+ * @param[in,out] dst the encoder
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	One message per capture, see encoder::begin_slow_call. Each capture is
+ *	reported once, the captures drained when an exception occurs are lost
+ */
+encoder& slow_call::report(encoder &dst)
+{
+	if ( unlikely(load_acquire(&s_rings) == NULL) ) {
+		return dst;
+	}
+
+	u64 scale = profiler::calibrate(s_tick0, s_nsec0);
+	capture *buf = new capture[g_slow_ring_sz];
+	lock_mutex(&s_report_lock);
+
+	try {
+		for (ring *r = load_acquire(&s_rings); likely(r != NULL); r = r->next) {
+			for (u32 i = 0, cnt = drain(r, buf); likely(i < cnt); i++) {
+				const capture &c = buf[i];
+
+				dst.begin_slow_call(r->id, c.usec, profiler::to_nsec(c.ticks, scale), c.depth, c.size);
+				for (u32 j = 0; likely(j < c.size); j++) {
+					dst.frame(c.fns[j], c.sites[j]);
+				}
+
+				dst.end_slow_call();
+			}
+		}
+
+		pthread_mutex_unlock(&s_report_lock);
+		delete[] buf;
+		return dst;
+	}
+	catch (...) {
+		pthread_mutex_unlock(&s_report_lock);
+		delete[] buf;
+		throw;
+	}
+}
+
+
+/**
+ * @brief Drain the captured slow calls to a string
+ *
+ * @param[in,out] dst the report destination string
+ *
+ * @returns the first argument
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	Each capture has the call duration (in nanoseconds), the call depth and the
+ *	thread of the call, followed by the slow call and its innermost callers
+ */
+string& slow_call::report(string &dst)
+{
+	if ( unlikely(load_acquire(&s_rings) == NULL) ) {
+		return dst;
+	}
+
+	u64 scale = profiler::calibrate(s_tick0, s_nsec0);
+	capture *buf = new capture[g_slow_ring_sz];
+	lock_mutex(&s_report_lock);
+
+	try {
+		const process *proc = process::current();
+		dst.append("slow calls {\r\n");
+
+		for (ring *r = load_acquire(&s_rings); likely(r != NULL); r = r->next) {
+			for (u32 i = 0, cnt = drain(r, buf); likely(i < cnt); i++) {
+				const capture &c = buf[i];
+
+				dst.append("  %llu ns at depth %u in thread (0x%llx) {\r\n",
+									 profiler::to_nsec(c.ticks, scale),
+									 c.depth,
+									 static_cast<u64> (r->id));
+
+				for (u32 j = 0; likely(j < c.size); j++) {
+					const i8 *nm = proc->lookup(c.fns[j]);
+					if ( likely(nm != NULL) ) {
+						dst.append("    at %s\r\n", nm);
+					}
+					else {
+						dst.append("    at 0x%llx\r\n", static_cast<u64> (c.fns[j]));
+					}
+				}
+
+				dst.append("  }\r\n");
+			}
+		}
+
+		dst.append("}\r\n");
+		pthread_mutex_unlock(&s_report_lock);
+		delete[] buf;
+		return dst;
+	}
+	catch (...) {
+		pthread_mutex_unlock(&s_report_lock);
+		delete[] buf;
+		throw;
+	}
+}
+
+
+/**
+ * @brief Set the default threshold (of the functions matching no expression)
+ *
+ * @param[in] usec the threshold in microseconds (0 to capture none of these functions)
+ *
+ * @note The ticks are calibrated on the first threshold change (see slow_call::calibrate)
+ */
+void slow_call::set_threshold(u64 usec)
+{
+	lock_mutex(&s_lock);
+
+	u64 rate = calibrate();
+	s_default.usec = usec;
+	store_relaxed(&s_default.ticks, (likely(usec > 0 && usec < ~0ULL / rate)) ? usec * rate : ~0ULL);
+
+	update_floor();
+	pthread_mutex_unlock(&s_lock);
+}
+
+
+/**
+ * @brief Get the default threshold
+ *
+ * @returns the threshold in microseconds (0 if the functions matching no expression are not captured)
+ */
+u64 slow_call::threshold()
+{
+	return load_relaxed(&s_default.usec);
+}
+
+}
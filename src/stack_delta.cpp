@@ -0,0 +1,190 @@
+#include "../include/stack_delta.hpp"
+
+/**
+	@file src/stack_delta.cpp
+
+	@brief Class instrument::stack_delta method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Compare two stacks by ID (qsort(3) comparator)
+ *
+ * @param[in] a the first stack
+ *
+ * @param[in] b the second stack
+ *
+ * @returns -1, 0 or 1 if the first ID is lower, equal or greater
+ */
+i32 stack_delta::compare(const void *a, const void *b)
+{
+	pthread_t x = static_cast<const entry*> (a)->id;
+	pthread_t y = static_cast<const entry*> (b)->id;
+	return (x < y) ? -1 : (x > y);
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws instrument::exception
+ */
+stack_delta::stack_delta(const stack_delta &src)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @throws instrument::exception
+ */
+inline stack_delta* stack_delta::clone() const
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @throws instrument::exception
+ */
+inline stack_delta& stack_delta::operator=(const stack_delta &rval)
+{
+	throw exception("Method %s is dissalowed", __FUNCTION__);
+}
+
+
+/**
+ * @brief Find the previous stack of a thread (or context)
+ *
+ * @param[in] id the thread ID (or context address)
+ *
+ * @returns the previous stack or NULL if it was not in the previous dump
+ *
+ * @note
+ *	The lookup is a binary search. The frames of the stack can be moved to
+ *	the stacks of the next dump (see stack_delta::replace)
+ */
+stack_delta::entry* stack_delta::find(pthread_t id) const
+{
+	u32 lo = 0, hi = m_size;
+	while ( likely(lo < hi) ) {
+		u32 mid = lo + (hi - lo) / 2;
+		if ( unlikely(m_entries[mid].id == id) ) {
+			return &m_entries[mid];
+		}
+
+		if ( m_entries[mid].id < id ) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief Replace the previous stacks with the stacks of a dump
+ *
+ * @param[in] entries the stacks (heap allocated, the object takes ownership)
+ *
+ * @param[in] cnt the stack count
+ *
+ * @returns *this
+ *
+ * @note
+ *	The previous frames are released, except the ones moved to the new stacks
+ *	(their previous pointer is cleared)
+ */
+stack_delta& stack_delta::replace(entry *entries, u32 cnt)
+{
+	qsort(entries, cnt, sizeof(entry), compare);
+
+	for (u32 i = 0; likely(i < m_size); i++) {
+		delete[] m_entries[i].frames;
+	}
+
+	delete[] m_entries;
+	m_entries = entries;
+	m_size = cnt;
+	m_count++;
+	return *this;
+}
+
+
+/**
+ * @brief Object constructor
+ *
+ * @note The first delta dump sends all the stacks in full
+ */
+stack_delta::stack_delta():
+m_entries(NULL),
+m_size(0),
+m_count(0)
+{
+}
+
+
+/**
+ * @brief Object destructor
+ */
+stack_delta::~stack_delta()
+{
+	reset();
+}
+
+
+/**
+ * @brief Get the delta dump count (since the last reset)
+ *
+ * @returns this->m_count
+ */
+inline u64 stack_delta::count() const
+{
+	return m_count;
+}
+
+
+/**
+ * @brief Get the stack count of the previous dump
+ *
+ * @returns this->m_size
+ */
+inline u32 stack_delta::size() const
+{
+	return m_size;
+}
+
+
+/**
+ * @brief Drop the previous stacks, so the next delta dump sends all the stacks in full
+ *
+ * @returns *this
+ *
+ * @note Reset along with the encoder (e.g when the collector reconnects)
+ */
+stack_delta& stack_delta::reset()
+{
+	for (u32 i = 0; likely(i < m_size); i++) {
+		delete[] m_entries[i].frames;
+	}
+
+	delete[] m_entries;
+	m_entries = NULL;
+	m_size = 0;
+	m_count = 0;
+	return *this;
+}
+
+}
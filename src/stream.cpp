@@ -1,3 +1,4 @@
+#include "../include/metrics.hpp"
 #include "../include/stream.hpp"
 #include "../include/util.hpp"
 
@@ -9,6 +10,462 @@
 
 namespace instrument {
 
+/**
+ * @brief Write data to a descriptor, retrying until all of it is written
+ *
+ * @param[in] fd the descriptor
+ *
+ * @param[in] data the data
+ *
+ * @param[in] sz the data size
+ *
+ * @throws i32 (errno)
+ *
+ * @note Synchronous output is enforced (even if O_NONBLOCK is specified)
+ */
+void stream::transmit(i32 fd, const i8 *data, u32 sz)
+{
+	u32 offset = 0;
+	while ( likely(sz > 0) ) {
+		i32 written = write(fd, data + offset, sz);
+		if ( unlikely(written < 0) ) {
+			switch (errno) {
+			case EINTR:
+			case EAGAIN:
+				continue;
+
+			default:
+				throw errno;
+			}
+		}
+
+		sz -= written;
+		offset += written;
+		count_metric(METRIC_STREAM_BYTES, written);
+	}
+}
+
+
+/**
+ * @brief Asynchronous writer thread entry point
+ *
+ * @param[in] arg the stream
+ *
+ * @returns NULL
+ *
+ * @note
+ *	The writer swaps the pending and the front buffer, so producers can flush
+ *	while the front buffer is written. It exits when a stop is requested and no
+ *	data is pending. If batching, it waits for more data until the batch size,
+ *	the capacity or the latency bound is reached. If compressing, the front
+ *	data is compressed up to a complete block before it's written. Write errors
+ *	are recorded and reported by the next flush, unless the stream recovers
+ *	(the front data is dropped then)
+ */
+void* stream::writer(void *arg)
+{
+	stream *strm = static_cast<stream*> (arg);
+	async_writer *as = strm->m_async;
+
+	pthread_mutex_lock(&as->lock);
+	while (true) {
+		while ( likely(as->pending->length() == 0 && !as->stop) ) {
+			pthread_cond_wait(&as->ready, &as->lock);
+		}
+
+		if ( unlikely(as->pending->length() == 0) ) {
+			break;
+		}
+
+		/* Coalesce the flushes of the producers, up to the latency bound */
+		if ( unlikely(as->linger > 0) ) {
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += as->linger / 1000;
+			deadline.tv_nsec += (as->linger % 1000) * 1000000L;
+			if ( unlikely(deadline.tv_nsec >= 1000000000L) ) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+
+			while ( likely(as->pending->length() < as->batch &&
+										 as->pending->length() < as->capacity && !as->urgent && !as->stop) ) {
+				if ( unlikely(pthread_cond_timedwait(&as->ready, &as->lock, &deadline) == ETIMEDOUT) ) {
+					break;
+				}
+			}
+		}
+
+		string *tmp = as->front;
+		as->front = as->pending;
+		as->pending = tmp;
+		as->busy = true;
+		as->urgent = false;
+
+		i32 fd = strm->m_handle;
+#ifdef WITH_STREAM_COMPRESSION
+		compressor *cz = strm->m_compressor;
+#endif
+		pthread_cond_broadcast(&as->drained);
+		pthread_mutex_unlock(&as->lock);
+
+		i32 err = 0;
+		try {
+			const i8 *data = as->front->cstring();
+			u32 sz = as->front->length();
+
+#ifdef WITH_STREAM_COMPRESSION
+			if ( unlikely(cz != NULL) ) {
+				cz->clear();
+				cz->compress(data, sz).flush();
+				data = cz->data();
+				sz = cz->size();
+			}
+#endif
+
+			transmit(fd, data, sz);
+		}
+		catch (i32 x) {
+			err = x;
+		}
+		catch (...) {
+			err = EIO;
+		}
+
+		/* The stream may recover, without the front data */
+		u32 lost = 0;
+		if ( unlikely(err != 0 && strm->recover(err)) ) {
+			lost = as->front->length();
+			err = 0;
+		}
+
+#ifdef WITH_STREAM_COMPRESSION
+		/* The frame is broken, a new one is started (e.g on the new connection) */
+		if ( unlikely((err != 0 || lost > 0) && cz != NULL) ) {
+			cz->reset();
+		}
+#endif
+
+		as->front->clear();
+
+		pthread_mutex_lock(&as->lock);
+		as->dropped += lost;
+		if ( unlikely(err != 0 && as->error == 0) ) {
+			as->error = err;
+		}
+
+		as->busy = false;
+		pthread_cond_broadcast(&as->drained);
+	}
+
+	pthread_mutex_unlock(&as->lock);
+	return NULL;
+}
+
+
+/**
+ * @brief Move the buffered data to the pending buffer of the writer thread
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws i32 (errno)
+ *
+ * @note
+ *	If the pending buffer is full, the backpressure policy either blocks until
+ *	the writer takes the pending data (BLOCK), discards the buffered data
+ *	(DROP_NEWEST) or discards the pending data (DROP_OLDEST). Data larger than
+ *	the capacity is accepted when nothing is pending
+ */
+stream& stream::enqueue()
+{
+	/* The trailing buffered data is the last segment */
+	if ( unlikely(m_segment_count > 0) ) {
+		push(NULL, m_mark, m_length - m_mark);
+		m_mark = m_length;
+	}
+
+	u32 len = m_length;
+	for (u32 i = 0; likely(i < m_segment_count); i++) {
+		if ( likely(m_segments[i].data != NULL) ) {
+			len += m_segments[i].length;
+		}
+	}
+
+	async_writer *as = m_async;
+	pthread_mutex_lock(&as->lock);
+
+	/* Report (once) a failure of the writer, the buffer remains as is */
+	i32 err = as->error;
+	if ( unlikely(err != 0) ) {
+		as->error = 0;
+		pthread_mutex_unlock(&as->lock);
+		throw err;
+	}
+
+	try {
+		while ( unlikely(as->pending->length() > 0 &&
+										 as->pending->length() + len > as->capacity) ) {
+			if ( likely(as->policy == BLOCK) ) {
+				as->urgent = true;
+				pthread_cond_signal(&as->ready);
+				pthread_cond_wait(&as->drained, &as->lock);
+				continue;
+			}
+
+			if ( likely(as->policy == DROP_NEWEST) ) {
+				as->dropped += len;
+				pthread_mutex_unlock(&as->lock);
+				clear();
+				return *this;
+			}
+
+			as->dropped += as->pending->length();
+			m_flushed -= as->pending->length();
+			as->pending->clear();
+		}
+
+		if ( likely(m_segment_count == 0) ) {
+			as->pending->concat(m_data, m_length);
+		}
+
+		/* Borrowed segments are copied, they are only valid until this flush */
+		for (u32 i = 0; likely(i < m_segment_count); i++) {
+			const segment &seg = m_segments[i];
+			const i8 *data = (likely(seg.data != NULL)) ? seg.data : m_data + seg.offset;
+			as->pending->concat(data, seg.length);
+		}
+	}
+	catch (...) {
+		pthread_mutex_unlock(&as->lock);
+		throw;
+	}
+
+	pthread_cond_signal(&as->ready);
+	pthread_mutex_unlock(&as->lock);
+
+	m_flushed += len;
+	clear();
+	return *this;
+}
+
+
+#ifdef WITH_STREAM_COMPRESSION
+/**
+ * @brief Compress the output segments and the buffered data, then write them
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws i32 (errno)
+ * @throws instrument::exception
+ *
+ * @note
+ *	The written data ends with a complete block. If an error occurs, the frame
+ *	is abandoned and the next flush starts a new one
+ */
+stream& stream::deflate()
+{
+	compressor *cz = m_compressor;
+
+	/* The trailing buffered data is the last segment */
+	push(NULL, m_mark, m_length - m_mark);
+	m_mark = m_length;
+
+	try {
+		u32 len = 0;
+		cz->clear();
+		for (u32 i = 0; likely(i < m_segment_count); i++) {
+			const segment &seg = m_segments[i];
+			cz->compress((likely(seg.data != NULL)) ? seg.data : m_data + seg.offset, seg.length);
+			len += seg.length;
+		}
+
+		cz->flush();
+		transmit(m_handle, cz->data(), cz->size());
+		m_flushed += len;
+		return *this;
+	}
+	catch (...) {
+		cz->reset();
+		throw;
+	}
+}
+#endif
+
+
+/**
+ * @brief Output data using vectored I/O
+ *
+ * @param[in] iov the data segments
+ *
+ * @param[in] cnt the segment count (at most IOV_MAX)
+ *
+ * @returns the written byte count or -1 (errno is set)
+ */
+inline i32 stream::emit(const struct iovec *iov, u32 cnt)
+{
+	return writev(m_handle, iov, cnt);
+}
+
+
+/**
+ * @brief Add an output segment
+ *
+ * @param[in] data the borrowed data (NULL for buffered data)
+ *
+ * @param[in] offset the buffered data offset (ignored for borrowed data)
+ *
+ * @param[in] len the segment length (0 for NO-OP)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+stream& stream::push(const i8 *data, u32 offset, u32 len)
+{
+	if ( unlikely(len == 0) ) {
+		return *this;
+	}
+
+	if ( unlikely(m_segment_count == m_segment_slots) ) {
+		u32 slots = (likely(m_segment_slots > 0)) ? 2 * m_segment_slots : 8;
+		segment *segments = new segment[slots];
+		memcpy(segments, m_segments, m_segment_count * sizeof(segment));
+
+		delete[] m_segments;
+		m_segments = segments;
+		m_segment_slots = slots;
+	}
+
+	segment &seg = m_segments[m_segment_count++];
+	seg.data = data;
+	seg.offset = offset;
+	seg.length = len;
+	return *this;
+}
+
+
+/**
+ * @brief Recover from a failed asynchronous write (called by the writer thread)
+ *
+ * @param[in] err the write error (errno)
+ *
+ * @returns true if the output goes on (the failed data is dropped), false to report the error
+ *
+ * @note The default implementation doesn't recover
+ */
+bool stream::recover(i32 err)
+{
+	return false;
+}
+
+
+#ifdef WITH_STREAM_COMPRESSION
+/**
+ * @brief End the compressed frame and write its epilogue
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws i32 (errno)
+ * @throws instrument::exception
+ *
+ * @note NO-OP if no frame is started or the stream isn't open (the writer thread must be idle)
+ */
+stream& stream::seal()
+{
+	compressor *cz = m_compressor;
+	if ( likely(cz == NULL || m_handle < 0) ) {
+		return *this;
+	}
+
+	try {
+		cz->clear();
+		cz->finish();
+		transmit(m_handle, cz->data(), cz->size());
+
+		cz->clear();
+		return *this;
+	}
+	catch (...) {
+		cz->reset();
+		throw;
+	}
+}
+#endif
+
+
+/**
+ * @brief Write the output segments and the buffered data, using vectored I/O
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws i32 (errno)
+ *
+ * @note Synchronous output is enforced (even if O_NONBLOCK is specified)
+ */
+stream& stream::transmit()
+{
+	/* The trailing buffered data is the last segment */
+	push(NULL, m_mark, m_length - m_mark);
+	m_mark = m_length;
+
+	u32 cnt = m_segment_count;
+	struct iovec *iov = new struct iovec[cnt];
+	for (u32 i = 0; likely(i < cnt); i++) {
+		const segment &seg = m_segments[i];
+		const i8 *data = (likely(seg.data != NULL)) ? seg.data : m_data + seg.offset;
+
+		iov[i].iov_base = const_cast<i8*> (data);
+		iov[i].iov_len = seg.length;
+	}
+
+	/* If an exception occurs, release resources and rethrow it */
+	try {
+		u32 first = 0;
+		while ( likely(first < cnt) ) {
+			u32 n = (unlikely(cnt - first > IOV_MAX)) ? IOV_MAX : cnt - first;
+
+			i32 written = emit(iov + first, n);
+			if ( unlikely(written < 0) ) {
+				switch (errno) {
+				case EINTR:
+				case EAGAIN:
+					continue;
+
+				default:
+					throw errno;
+				}
+			}
+
+			count_metric(METRIC_STREAM_BYTES, written);
+			m_flushed += written;
+
+			/* Skip the written segments and advance in a partially written one */
+			u32 sz = written;
+			while ( likely(first < cnt && sz >= iov[first].iov_len) ) {
+				sz -= iov[first].iov_len;
+				first++;
+			}
+
+			if ( unlikely(sz > 0) ) {
+				iov[first].iov_base = static_cast<i8*> (iov[first].iov_base) + sz;
+				iov[first].iov_len -= sz;
+			}
+		}
+
+		delete[] iov;
+		return *this;
+	}
+	catch (...) {
+		delete[] iov;
+		throw;
+	}
+}
+
+
 /**
  * @brief Object default constructor
  *
@@ -17,7 +474,16 @@ namespace instrument {
 stream::stream()
 try:
 string(),
-m_handle(-1)
+m_handle(-1),
+m_async(NULL),
+#ifdef WITH_STREAM_COMPRESSION
+m_compressor(NULL),
+#endif
+m_segments(NULL),
+m_segment_count(0),
+m_segment_slots(0),
+m_mark(0),
+m_flushed(0)
 {
 }
 catch (...) {
@@ -36,13 +502,21 @@ catch (...) {
 stream::stream(const stream &src)
 try:
 string(),
-m_handle(-1)
+m_handle(-1),
+m_async(NULL),
+#ifdef WITH_STREAM_COMPRESSION
+m_compressor(NULL),
+#endif
+m_segments(NULL),
+m_segment_count(0),
+m_segment_slots(0),
+m_mark(0),
+m_flushed(0)
 {
 	*this = src;
 }
 catch (...) {
-	delete[] m_data;
-	m_data = NULL;
+	release();
 	m_handle = -1;
 }
 
@@ -52,7 +526,61 @@ catch (...) {
  */
 stream::~stream()
 {
+	set_async(false);
 	close();
+
+#ifdef WITH_STREAM_COMPRESSION
+	delete m_compressor;
+	m_compressor = NULL;
+#endif
+
+	delete[] m_segments;
+	m_segments = NULL;
+}
+
+
+#ifdef WITH_STREAM_COMPRESSION
+/**
+ * @brief Get the output compression codec
+ *
+ * @returns the codec (compressor::NONE if the output isn't compressed)
+ */
+inline u32 stream::compression() const
+{
+	return (likely(m_compressor == NULL)) ? static_cast<u32> (compressor::NONE) : m_compressor->codec();
+}
+#endif
+
+
+/**
+ * @brief Get the byte count dropped by the backpressure policy
+ *
+ * @returns the dropped byte count (0 if the stream is not asynchronous)
+ */
+u64 stream::dropped() const
+{
+	if ( likely(m_async == NULL) ) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&m_async->lock);
+	u64 retval = m_async->dropped;
+	pthread_mutex_unlock(&m_async->lock);
+
+	return retval;
+}
+
+
+/**
+ * @brief Get the flushed byte count
+ *
+ * @returns
+ *	this->m_flushed, the bytes written synchronously or taken by the writer
+ *	thread (the dropped bytes excluded) since the stream was created
+ */
+inline u64 stream::flushed() const
+{
+	return m_flushed;
 }
 
 
@@ -67,6 +595,17 @@ inline i32 stream::handle() const
 }
 
 
+/**
+ * @brief Check if the stream output is asynchronous
+ *
+ * @returns true if a writer thread outputs the flushed data, false otherwise
+ */
+inline bool stream::is_async() const
+{
+	return m_async != NULL;
+}
+
+
 /**
  * @brief Check if the stream is opened for output
  *
@@ -78,6 +617,212 @@ inline bool stream::is_open() const
 }
 
 
+/**
+ * @brief Enable/disable asynchronous output
+ *
+ * @param[in] how true to enable, false to disable
+ *
+ * @param[in] capacity the pending buffer capacity (in bytes)
+ *
+ * @param[in] policy the backpressure policy (BLOCK, DROP_NEWEST or DROP_OLDEST)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	If output is already asynchronous, only the capacity and the policy are
+ *	updated. Disabling asynchronous output writes any pending data and stops the
+ *	writer thread. The writer thread blocks all signals
+ */
+stream& stream::set_async(bool how, u32 capacity, u32 policy)
+{
+	if ( unlikely(!how) ) {
+		if ( likely(m_async == NULL) ) {
+			return *this;
+		}
+
+		pthread_mutex_lock(&m_async->lock);
+		m_async->stop = true;
+		pthread_cond_signal(&m_async->ready);
+		pthread_mutex_unlock(&m_async->lock);
+
+		pthread_join(m_async->thread, NULL);
+		pthread_cond_destroy(&m_async->ready);
+		pthread_cond_destroy(&m_async->drained);
+		pthread_mutex_destroy(&m_async->lock);
+
+		delete m_async->pending;
+		delete m_async->front;
+		delete m_async;
+		m_async = NULL;
+		return *this;
+	}
+
+	if ( unlikely(policy > DROP_OLDEST) ) {
+		throw exception("invalid argument: policy (=%d)", policy);
+	}
+
+	if ( unlikely(m_async != NULL) ) {
+		pthread_mutex_lock(&m_async->lock);
+		m_async->capacity = capacity;
+		m_async->policy = policy;
+		pthread_cond_broadcast(&m_async->drained);
+		pthread_mutex_unlock(&m_async->lock);
+		return *this;
+	}
+
+	async_writer *as = new async_writer;
+	as->pending = NULL;
+	as->front = NULL;
+	as->dropped = 0;
+	as->capacity = capacity;
+	as->policy = policy;
+	as->batch = 0;
+	as->linger = 0;
+	as->error = 0;
+	as->busy = false;
+	as->urgent = false;
+	as->stop = false;
+
+	try {
+		as->pending = new string;
+		as->front = new string;
+	}
+	catch (...) {
+		delete as->pending;
+		delete as;
+		throw;
+	}
+
+	pthread_mutex_init(&as->lock, NULL);
+	pthread_cond_init(&as->ready, NULL);
+	pthread_cond_init(&as->drained, NULL);
+	m_async = as;
+
+	/* The writer inherits a full signal mask */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	i32 err = pthread_create(&as->thread, NULL, writer, this);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if ( unlikely(err != 0) ) {
+		pthread_cond_destroy(&as->ready);
+		pthread_cond_destroy(&as->drained);
+		pthread_mutex_destroy(&as->lock);
+
+		delete as->pending;
+		delete as->front;
+		delete as;
+		m_async = NULL;
+
+		throw exception(
+			"failed to start the stream writer thread (errno %d - %s)",
+			err,
+			strerror(err)
+		);
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Coalesce the flushed data of asynchronous output
+ *
+ * @param[in] sz the byte count to coalesce (0 to write the pending data at once)
+ *
+ * @param[in] ms the maximum latency of the pending data (in milliseconds)
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ *
+ * @note
+ *	The writer thread waits until sz bytes are pending (or the pending buffer
+ *	is full), at most ms milliseconds after it finds data pending, so many
+ *	flushes are written at once. Each flush is still written whole
+ */
+stream& stream::set_batching(u32 sz, u32 ms)
+{
+	async_writer *as = m_async;
+	if ( unlikely(as == NULL) ) {
+		throw exception("asynchronous output is disabled, can't coalesce flushes");
+	}
+
+	pthread_mutex_lock(&as->lock);
+	as->batch = sz;
+	as->linger = (likely(sz > 0)) ? ms : 0;
+	pthread_cond_signal(&as->ready);
+	pthread_mutex_unlock(&as->lock);
+	return *this;
+}
+
+
+#ifdef WITH_STREAM_COMPRESSION
+/**
+ * @brief Compress the output
+ *
+ * @param[in] codec the codec (compressor::LZ4, compressor::ZSTD or compressor::NONE)
+ *
+ * @param[in] level the compression level (0 for the codec default)
+ *
+ * @param[in] block the input byte count per compressed block
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The pending data is written first and the current frame (if any) is ended,
+ *	the output is a sequence of frames (one per open or compression setting).
+ *	In asynchronous mode the writer thread compresses the data
+ */
+stream& stream::set_compression(u32 codec, i32 level, u32 block)
+{
+	compressor *cz = NULL;
+	if ( likely(codec != compressor::NONE) ) {
+		cz = new compressor(codec, level, block);
+	}
+
+	/* The writer thread must be idle */
+	try {
+		drain();
+		seal();
+	}
+	catch (i32 err) {
+		delete cz;
+		throw exception(
+			"failed to write data to descriptor %d (errno %d - %s)",
+			m_handle,
+			err,
+			strerror(err)
+		);
+	}
+	catch (...) {
+		delete cz;
+		throw;
+	}
+
+	compressor *old = m_compressor;
+	if ( unlikely(m_async != NULL) ) {
+		pthread_mutex_lock(&m_async->lock);
+		m_compressor = cz;
+		pthread_mutex_unlock(&m_async->lock);
+	}
+	else {
+		m_compressor = cz;
+	}
+
+	delete old;
+	return *this;
+}
+#endif
+
+
 /**
  * @brief Assignment operator
  *
@@ -100,6 +845,17 @@ stream& stream::operator=(const stream &rval)
 	/* Copy the buffer */
 	string::operator=(rval);
 
+#ifdef WITH_STREAM_COMPRESSION
+	/* The compression settings are copied, the copy starts its own frame */
+	const compressor *cz = rval.m_compressor;
+	if ( likely(cz == NULL) ) {
+		set_compression(compressor::NONE);
+	}
+	else {
+		set_compression(cz->codec(), cz->level(), cz->block());
+	}
+#endif
+
 	i32 fd = rval.m_handle;
 	if ( unlikely(fd < 0) ) {
 		return *this;
@@ -120,10 +876,81 @@ stream& stream::operator=(const stream &rval)
 }
 
 
+/**
+ * @brief Attach a borrowed segment, output after the current buffered data
+ *
+ * @param[in] data the segment data (can be NULL if len is 0)
+ *
+ * @param[in] len the segment length
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @attention
+ *	The data is not copied, it must remain valid until the stream is flushed or
+ *	cleared. Data appended after the segment is output after it, but buffered
+ *	data must not be modified in place (insert, reduce e.t.c) while segments are
+ *	attached
+ */
+stream& stream::attach(const i8 *data, u32 len)
+{
+	if ( unlikely(data == NULL && len > 0) ) {
+		throw exception("invalid argument: data (=%p)", data);
+	}
+
+	if ( unlikely(len == 0) ) {
+		return *this;
+	}
+
+	push(NULL, m_mark, m_length - m_mark);
+	push(data, 0, len);
+	m_mark = m_length;
+	return *this;
+}
+
+
+/**
+ * @brief Attach a borrowed string, output after the current buffered data
+ *
+ * @param[in] src the string (must remain valid until the next flush or clear)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+inline stream& stream::attach(const string &src)
+{
+	return attach(src.cstring(), src.length());
+}
+
+
+/**
+ * @brief Clear the buffer and detach all borrowed segments
+ *
+ * @returns *this
+ */
+stream& stream::clear()
+{
+	string::clear();
+
+	m_segment_count = 0;
+	m_mark = 0;
+	return *this;
+}
+
+
 /**
  * @brief Close the stream
  *
  * @returns *this
+ *
+ * @note
+ *	If output is asynchronous, pending data is written first (write errors are
+ *	ignored) and the writer thread keeps running, in case the stream is reopened.
+ *	If compressing, the frame is ended (the next open starts a new one)
  */
 stream& stream::close()
 {
@@ -131,6 +958,22 @@ stream& stream::close()
 		return *this;
 	}
 
+	if ( unlikely(m_async != NULL) ) {
+		try {
+			drain();
+		}
+		catch (...) {
+		}
+	}
+
+#ifdef WITH_STREAM_COMPRESSION
+	try {
+		seal();
+	}
+	catch (...) {
+	}
+#endif
+
 	i32 retval;
 	do {
 		retval = ::close(m_handle);
@@ -142,34 +985,86 @@ stream& stream::close()
 }
 
 
+/**
+ * @brief Wait until the writer thread outputs all pending data
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ *
+ * @note NO-OP if output is synchronous
+ */
+stream& stream::drain()
+{
+	async_writer *as = m_async;
+	if ( likely(as == NULL) ) {
+		return *this;
+	}
+
+	pthread_mutex_lock(&as->lock);
+	if ( likely(as->pending->length() > 0) ) {
+		as->urgent = true;
+		pthread_cond_signal(&as->ready);
+	}
+
+	while ( likely(as->pending->length() > 0 || as->busy) ) {
+		pthread_cond_wait(&as->drained, &as->lock);
+	}
+
+	i32 err = as->error;
+	as->error = 0;
+	pthread_mutex_unlock(&as->lock);
+
+	if ( unlikely(err != 0) ) {
+		throw exception(
+			"failed to write data to descriptor %d (errno %d - %s)",
+			m_handle,
+			err,
+			strerror(err)
+		);
+	}
+
+	return *this;
+}
+
+
 /**
  * @brief Flush the buffered data to the stream
  *
  * @returns *this
  *
+ * @throws std::bad_alloc
  * @throws i32 (errno)
  *
  * @note The buffer remains as is, if the stream isn't open
- * @note Synchronous output is enforced (even if O_NONBLOCK is specified)
+ * @note
+ *	Synchronous output is enforced (even if O_NONBLOCK is specified), unless
+ *	output is asynchronous (see stream::set_async)
+ * @note
+ *	Attached segments are output with the buffered data using vectored I/O,
+ *	without copying them (see stream::attach)
+ * @note If compressing, the data is compressed on the calling thread (see stream::set_compression)
  */
 stream& stream::flush()
 {
-	i32 offset = 0, sz = m_length;
-	while ( likely(sz > 0) ) {
-		i32 written = write(m_handle, m_data + offset, sz);
-		if ( unlikely(written < 0) ) {
-			switch (errno) {
-			case EINTR:
-			case EAGAIN:
-				continue;
+	if ( unlikely(m_async != NULL) ) {
+		return enqueue();
+	}
 
-			default:
-				throw errno;
-			}
-		}
+#ifdef WITH_STREAM_COMPRESSION
+	if ( unlikely(m_compressor != NULL) ) {
+		deflate();
+		clear();
+		return *this;
+	}
+#endif
 
-		sz -= written;
-		offset += written;
+	if ( likely(m_segment_count == 0) ) {
+		transmit(m_handle, m_data, m_length);
+		m_flushed += m_length;
+	}
+	else {
+		transmit();
 	}
 
 	/* Clear the buffer */
@@ -31,20 +31,72 @@ string& string::format(const i8 *fmt, va_list args)
 		return memalign(0);
 	}
 
-	try {
-		va_list cpargs;
-		va_copy(cpargs, args);
-		u32 len = util::va_size(fmt, cpargs);
-		memalign(len);
+	memalign(0);
+	return format_tail(fmt, args);
+}
 
-		util::va_format(m_data, fmt, args);
-		m_length = len;
-		return *this;
+
+/**
+ * @brief
+ *	Append a printf-style format C-string expanded with the values of a
+ *	variable argument list, appending it to the buffer tail
+ *
+ * @param[in] fmt a printf-style format C-string
+ *
+ * @param[in] args a variable argument list (as a va_list variable)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The text is formatted once into a stack buffer and appended with a single
+ *	string::concat, so the buffer grows (geometrically) in place. Text longer
+ *	than g_string_format_sz is formatted again on the heap. The arguments may
+ *	refer to this string
+ */
+string& string::format_tail(const i8 *fmt, va_list args)
+{
+	i8 buf[g_string_format_sz];
+	va_list cpargs;
+	va_copy(cpargs, args);
+
+	i32 len = vsnprintf(buf, sizeof(buf), fmt, cpargs);
+	va_end(cpargs);
+
+	if ( unlikely(len < 0) ) {
+		va_end(args);
+		throw exception("failed to format '%s' (errno %d - %s)", fmt, errno, strerror(errno));
+	}
+
+	if ( likely(static_cast<u32> (len) < sizeof(buf)) ) {
+		va_end(args);
+		return concat(buf, len);
+	}
+
+	i8 *tmp = NULL;
+	try {
+		tmp = new i8[len + 1];
 	}
 	catch (...) {
 		va_end(args);
 		throw;
 	}
+
+	vsnprintf(tmp, len + 1, fmt, args);
+	va_end(args);
+
+	try {
+		concat(tmp, len);
+	}
+	catch (...) {
+		delete[] tmp;
+		throw;
+	}
+
+	delete[] tmp;
+	return *this;
 }
 
 
@@ -65,24 +117,60 @@ string& string::memalign(u32 len, bool keep)
 		return (unlikely(keep)) ? *this : clear();
 	}
 
-	/* Aligned size */
-	m_size = (len + g_memblock_sz) / g_memblock_sz;
-	m_size *= g_memblock_sz;
+	/* A new short string is stored inline */
+	if ( likely(m_data == NULL && len < g_string_inline_sz) ) {
+		m_data = m_inline;
+		m_data[0] = '\0';
+		m_length = 0;
+		m_size = g_string_inline_sz;
+		return *this;
+	}
+
+	/* Aligned size, the kept data grows geometrically */
+	u32 sz = (len + g_memblock_sz) / g_memblock_sz;
+	sz *= g_memblock_sz;
+
+	if ( likely(keep && sz < 2 * m_size) ) {
+		sz = 2 * m_size;
+	}
 
-	i8 *aligned = new i8[m_size];
+	i8 *aligned = new i8[sz];
+	u32 length = 0;
 	if ( unlikely(keep) ) {
 		__D_ASSERT(m_data != NULL);
-		__D_ASSERT(strlen(m_data) == m_length);
 
-		strcpy(aligned, m_data);
+		/* The data is copied by length, it may contain null bytes */
+		memcpy(aligned, m_data, m_length + 1);
+		length = m_length;
 	}
 	else {
 		aligned[0] = '\0';
-		m_length = 0;
 	}
 
-	delete[] m_data;
+	release();
 	m_data = aligned;
+	m_length = length;
+	m_size = sz;
+	return *this;
+}
+
+
+/**
+ * @brief Release the buffer, if it's heap allocated
+ *
+ * @returns *this
+ *
+ * @note The string is left without a buffer (NULL data)
+ */
+string& string::release()
+{
+	if ( likely(m_data != m_inline) ) {
+		delete[] m_data;
+	}
+
+	m_data = NULL;
+	m_length = 0;
+	m_size = 0;
 	return *this;
 }
 
@@ -151,8 +239,7 @@ m_size(0)
 	}
 }
 catch(...) {
-	delete[] m_data;
-	m_data = NULL;
+	release();
 }
 
 
@@ -178,9 +265,8 @@ m_size(0)
  */
 string::~string()
 {
-	delete[] m_data;
+	release();
 	delete[] m_locale;
-	m_data = NULL;
 	m_locale = NULL;
 }
 
@@ -308,8 +394,9 @@ string& string::set(const string &src)
 		return *this;
 	}
 
+	/* The data is copied by length, it may contain null bytes */
 	memalign(src.m_length);
-	strcpy(m_data, src.m_data);
+	memcpy(m_data, src.m_data, src.m_length + 1);
 	m_length = src.m_length;
 
 	return *this;
@@ -399,15 +486,9 @@ inline i8& string::operator[](u32 i)
  *
  * @throws std::bad_alloc
  */
-string& string::append(const string &tail)
+inline string& string::append(const string &tail)
 {
-	u32 len = m_length + tail.m_length;
-	memalign(len, true);
-
-	strcpy(m_data + m_length, tail.m_data);
-	m_length = len;
-
-	return *this;
+	return concat(tail.m_data, tail.m_length);
 }
 
 
@@ -432,12 +513,9 @@ string& string::append(const i8 *fmt, ...)
 		return *this;
 	}
 
-	string tmp;
 	va_list args;
 	va_start(args, fmt);
-	tmp.format(fmt, args);
-
-	return append(tmp);
+	return format_tail(fmt, args);
 }
 
 
@@ -451,9 +529,15 @@ string& string::append(const i8 *fmt, ...)
  * @throws std::bad_alloc
  * @throws instrument::exception
  */
-inline string& string::append(i8 ch)
+string& string::append(i8 ch)
 {
-	return append("%c", ch);
+	if ( unlikely(m_length + 1 >= m_size) ) {
+		memalign(m_length + 1, true);
+	}
+
+	m_data[m_length++] = ch;
+	m_data[m_length] = '\0';
+	return *this;
 }
 
 
@@ -470,6 +554,48 @@ inline string& string::clear()
 }
 
 
+/**
+ * @brief Append a number of characters, without formatting
+ *
+ * @param[in] src the characters (can be NULL if len is 0)
+ *
+ * @param[in] len the character count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The buffer grows geometrically, so appending many short pieces (e.g while
+ *	highlighting a stack trace) takes amortized linear time. The characters may
+ *	be a part of this string
+ */
+string& string::concat(const i8 *src, u32 len)
+{
+	if ( unlikely(len == 0) ) {
+		return *this;
+	}
+
+	u32 total = m_length + len;
+	if ( unlikely(total >= m_size) ) {
+		/* Characters of this string are moved with it */
+		bool own = (src >= m_data && src < m_data + m_size);
+		u32 offset = src - m_data;
+
+		memalign(total, true);
+		if ( unlikely(own) ) {
+			src = m_data + offset;
+		}
+	}
+
+	memcpy(m_data + m_length, src, len);
+	m_length = total;
+	m_data[m_length] = '\0';
+
+	return *this;
+}
+
+
 /**
  * @brief Crop the string to a new length
  *
@@ -906,7 +1032,10 @@ inline bool string::match(const string &expr, bool icase) const
  *
  * @returns true if there is a match, false otherwise
  *
+ * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note The expression is compiled once and cached (see pattern::cached)
  */
 bool string::match(const i8 *expr, bool icase) const
 {
@@ -919,27 +1048,27 @@ bool string::match(const i8 *expr, bool icase) const
 		flags |= REG_ICASE;
 	}
 
-	/* Compile the regular expression and perform the matching */
-	regex_t regexp;
-	i32 retval = regcomp(&regexp, expr, flags);
-	if ( likely(retval == 0) ) {
-		retval = regexec(&regexp, m_data, 0, NULL, 0);
-		regfree(&regexp);
-		return !retval;
+	const pattern *p = pattern::cached(expr, flags);
+	if ( likely(p != NULL) ) {
+		return p->match(m_data);
 	}
 
-	/* If the expression compilation failed */
-	i32 len = regerror(retval, &regexp, NULL, 0);
-	i8 errbuf[len];
-	regerror(retval, &regexp, errbuf, len);
-	regfree(&regexp);
-
-	throw exception(
-		"failed to compile regexp '%s' (regex errno %d - %s)",
-		expr,
-		retval,
-		errbuf
-	);
+	/* If the pattern can't be cached */
+	pattern tmp(expr, flags);
+	return tmp.match(m_data);
+}
+
+
+/**
+ * @brief Match against a compiled regular expression
+ *
+ * @param[in] expr the compiled expression
+ *
+ * @returns true if there is a match, false otherwise
+ */
+inline bool string::match(const pattern &expr) const
+{
+	return expr.match(m_data);
 }
 
 
@@ -978,6 +1107,8 @@ inline chain<string>* string::split(	const string &expr,
  *
  * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note The expression is compiled once and cached (see pattern::cached)
  */
 chain<string>* string::split(const i8 *expr, bool imatch, bool icase) const
 {
@@ -985,39 +1116,48 @@ chain<string>* string::split(const i8 *expr, bool imatch, bool icase) const
 		throw exception("invalid argument: expr (=%p)", expr);
 	}
 
+	i32 flags = REG_EXTENDED;
+	if ( unlikely(icase) ) {
+		flags |= REG_ICASE;
+	}
+
+	const pattern *p = pattern::cached(expr, flags);
+	if ( likely(p != NULL) ) {
+		return split(*p, imatch);
+	}
+
+	/* If the pattern can't be cached */
+	pattern tmp(expr, flags);
+	return split(tmp, imatch);
+}
+
+
+/**
+ * @brief Tokenize using a compiled regular expression
+ *
+ * @param[in] expr the delimiter expression (compiled without REG_NOSUB)
+ *
+ * @param[in] imatch false to include the actual matches in the result
+ *
+ * @returns the list of tokens (heap allocated)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+chain<string>* string::split(const pattern &expr, bool imatch) const
+{
 	chain<string> *tokens = NULL;
 	string *word = NULL;
-	regex_t regexp;
 
 	/* If an exception occurs, release resources and rethrow it */
 	try {
 		tokens = new chain<string>;
 
-		/* Compile the regular expression */
-		i32 flags = REG_EXTENDED;
-		if ( unlikely(icase) ) {
-			flags |= REG_ICASE;
-		}
-
-		i32 retval = regcomp(&regexp, expr, flags);
-		if ( unlikely(retval != 0) ) {
-			i32 len = regerror(retval, &regexp, NULL, 0);
-			i8 errbuf[len];
-			regerror(retval, &regexp, errbuf, len);
-
-			throw exception(
-				"failed to compile regexp '%s' (regex errno %d - %s)",
-				expr,
-				retval,
-				errbuf
-			);
-		}
-
 		regmatch_t match;
 		regoff_t offset = 0;
 		i32 len = m_length;
 		do {
-			bool found = !regexec(&regexp, m_data + offset, 1, &match, 0);
+			bool found = expr.search(m_data + offset, len - offset, match);
 
 			/*
 			 * The delimiter pattern is found. The left token is from the beginning of
@@ -1030,17 +1170,17 @@ chain<string>* string::split(const i8 *expr, bool imatch, bool icase) const
 				i32 bgn = match.rm_so;
 				i32 end = match.rm_eo;
 				if ( unlikely(end == 0) ) {
-					throw exception("logic error in regular expression '%s'", expr);
+					throw exception("logic error in regular expression '%s'", expr.expr());
 				}
 
 				word = new string("%.*s", bgn, m_data + offset);
-				tokens->add(word);
+				tokens->add(word, true);
 				word = NULL;
 
 				/* Include matched text in tokens */
 				if ( unlikely(!imatch) ) {
 					word = new string("%.*s", end - bgn, m_data + offset + bgn);
-					tokens->add(word);
+					tokens->add(word, true);
 					word = NULL;
 				}
 
@@ -1058,7 +1198,7 @@ chain<string>* string::split(const i8 *expr, bool imatch, bool icase) const
 			 */
 			else if ( likely(offset <= len) ) {
 				word = new string(m_data + offset);
-				tokens->add(word);
+				tokens->add(word, true);
 				word = NULL;
 				break;
 			}
@@ -1070,13 +1210,11 @@ chain<string>* string::split(const i8 *expr, bool imatch, bool icase) const
 		}
 		while ( likely(true) );
 
-		regfree(&regexp);
 		return tokens;
 	}
 	catch (...) {
 		delete tokens;
 		delete word;
-		regfree(&regexp);
 		throw;
 	}
 }
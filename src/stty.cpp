@@ -120,8 +120,7 @@ m_devnode(NULL)
 	strcpy(m_devnode, port);
 }
 catch (...) {
-	delete[] m_data;
-	m_data = NULL;
+	release();
 	m_devnode = NULL;
 }
 
@@ -146,8 +145,7 @@ m_devnode(NULL)
 catch (...) {
 	close();
 
-	delete[] m_data;
-	m_data = NULL;
+	release();
 	m_devnode = NULL;
 }
 
@@ -286,12 +284,21 @@ stty& stty::discard() const
  *
  * @returns *this
  *
+ * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note In asynchronous mode the data is not synced (see stream::set_async)
  */
 stty& stty::flush()
 {
 	try {
 		stream::flush();
+
+		/* In asynchronous mode the writer thread outputs the data */
+		if ( unlikely(m_async != NULL) ) {
+			return *this;
+		}
+
 		return sync();
 	}
 	catch (i32 err) {
@@ -355,7 +362,7 @@ stty& stty::open(bool ctty)
 	/* Stat the device node path and make some preliminary checks */
 	fileinfo_t inf;
 	i32 retval = stat(m_devnode, &inf);
-	if ( unlikely(errno == ENOENT) ) {
+	if ( unlikely(retval < 0 && errno == ENOENT) ) {
 		throw exception("device node '%s' does not exist", m_devnode);
 	}
 
@@ -26,7 +26,8 @@ style::style(const i8 *nm, color_t fg, color_t bg, attrset_t set):
 m_attributes(set),
 m_bgcolor(bg),
 m_fgcolor(fg),
-m_name(NULL)
+m_name(NULL),
+m_escape_len(0)
 {
 	if ( unlikely(nm == NULL) ) {
 		throw exception("invalid argument: nm (=%p)", nm);
@@ -34,6 +35,7 @@ m_name(NULL)
 
 	m_name = new i8[strlen(nm) + 1];
 	strcpy(m_name, nm);
+	refresh();
 }
 
 
@@ -48,10 +50,12 @@ style::style(const style &src):
 m_attributes(src.m_attributes),
 m_bgcolor(src.m_bgcolor),
 m_fgcolor(src.m_fgcolor),
-m_name(NULL)
+m_name(NULL),
+m_escape_len(src.m_escape_len)
 {
 	m_name = new i8[strlen(src.m_name) + 1];
 	strcpy(m_name, src.m_name);
+	memcpy(m_escape, src.m_escape, sizeof(m_escape));
 }
 
 
@@ -65,6 +69,38 @@ style::~style()
 }
 
 
+/**
+ * @brief Rebuild the cached escape sequence (after any attribute change)
+ *
+ * @returns *this
+ */
+style& style::refresh()
+{
+	static const attrset_t attrs[] = {BOLD, DIM, UNDERLINED, BLINKING, INVERTED, HIDDEN};
+	static const i8 codes[] = "124578";
+
+	i8 *pos = m_escape;
+
+	/* Add the background color, if not translucent */
+	if ( unlikely(m_bgcolor != CLEAR) ) {
+		pos += sprintf(pos, "\e[48;5;%dm", m_bgcolor);
+	}
+
+	/* Add the foreground color */
+	pos += sprintf(pos, "\e[38;5;%dm", m_fgcolor);
+
+	/* Add the escape sequence for each text formatting attribute */
+	for (u32 i = 0; likely(i < sizeof(attrs) / sizeof(attrs[0])); i++) {
+		if ( unlikely(is_attr_enabled(attrs[i])) ) {
+			pos += sprintf(pos, "\e[%cm", codes[i]);
+		}
+	}
+
+	m_escape_len = pos - m_escape;
+	return *this;
+}
+
+
 /**
  * @brief Object virtual copy constructor
  *
@@ -100,6 +136,17 @@ inline color_t style::bgcolor() const
 }
 
 
+/**
+ * @brief Get the style escape sequence
+ *
+ * @returns this->m_escape
+ */
+inline const i8* style::escape() const
+{
+	return m_escape;
+}
+
+
 /**
  * @brief Get the foreground color
  *
@@ -132,7 +179,7 @@ inline const i8* style::name() const
 inline style& style::set_attributes(attrset_t set)
 {
 	m_attributes = set;
-	return *this;
+	return refresh();
 }
 
 
@@ -146,7 +193,7 @@ inline style& style::set_attributes(attrset_t set)
 inline style& style::set_bgcolor(color_t bg)
 {
 	m_bgcolor = bg;
-	return *this;
+	return refresh();
 }
 
 
@@ -160,7 +207,7 @@ inline style& style::set_bgcolor(color_t bg)
 inline style& style::set_fgcolor(color_t fg)
 {
 	m_fgcolor = fg;
-	return *this;
+	return refresh();
 }
 
 
@@ -210,6 +257,7 @@ style& style::operator=(const style &rval)
 	m_attributes = rval.m_attributes;
 	m_bgcolor = rval.m_bgcolor;
 	m_fgcolor = rval.m_fgcolor;
+	refresh();
 
 	return set_name(rval.m_name);
 }
@@ -228,11 +276,33 @@ style& style::operator=(const style &rval)
 style& style::apply(string &dst) const
 {
 	if ( likely(dst.length() > 0) ) {
-		string esc;
-		to_string(esc);
+		dst	.insert(0, "%s", m_escape)
+				.concat("\e[0m", 4);
+	}
 
-		dst	.insert(0, esc)
-				.append("\e[0m");
+	return const_cast<style&> (*this);
+}
+
+
+/**
+ * @brief Append some text to a string, with the style applied
+ *
+ * @param[in,out] dst the target string
+ *
+ * @param[in] text the text (can be NULL if len is 0)
+ *
+ * @param[in] len the text length (empty text is not escaped)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+style& style::apply(string &dst, const i8 *text, u32 len) const
+{
+	if ( likely(len > 0) ) {
+		dst	.concat(m_escape, m_escape_len)
+				.concat(text, len)
+				.concat("\e[0m", 4);
 	}
 
 	return const_cast<style&> (*this);
@@ -270,7 +340,7 @@ inline style& style::set_attr_enabled(attrset_t set, bool how)
 		m_attributes &= ~set;
 	}
 
-	return *this;
+	return refresh();
 }
 
 
@@ -286,43 +356,12 @@ inline style& style::set_attr_enabled(attrset_t set, bool how)
  *
  * @todo Check if for any style, an exit sequense is needed
  * @attention Initial string contents are erased
+ * @note The sequence is cached (see style::refresh)
  */
 style& style::to_string(string &dst) const
 {
-	dst.clear();
-
-	/* Add the background color, if not translucent */
-	if ( unlikely(m_bgcolor != CLEAR) ) {
-		dst.append("\e[48;5;%dm", m_bgcolor);
-	}
-
-	/* Add the foreground color */
-	dst.append("\e[38;5;%dm", m_fgcolor);
-
-	/* Add the escape sequence for each text formatting attribute */
-	if ( unlikely(is_attr_enabled(BOLD)) ) {
-		dst.append("\e[1m");
-	}
-
-	if ( unlikely(is_attr_enabled(DIM)) ) {
-		dst.append("\e[2m");
-	}
-
-	if ( unlikely(is_attr_enabled(UNDERLINED)) ) {
-		dst.append("\e[4m");
-	}
-
-	if ( unlikely(is_attr_enabled(BLINKING)) ) {
-		dst.append("\e[5m");
-	}
-
-	if ( unlikely(is_attr_enabled(INVERTED)) ) {
-		dst.append("\e[7m");
-	}
-
-	if ( unlikely(is_attr_enabled(HIDDEN)) ) {
-		dst.append("\e[8m");
-	}
+	dst	.clear()
+			.concat(m_escape, m_escape_len);
 
 	return const_cast<style&> (*this);
 }
@@ -8,6 +8,52 @@
 
 namespace instrument {
 
+/**
+ * @brief Demangle the decorated name and keep the result
+ *
+ * @returns the demangled name or the decorated name if demangling fails
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	Concurrent callers may demangle the same name, the first result is kept and
+ *	the others are discarded
+ */
+const i8* symbol::demangle() const
+{
+	i8 *retval = NULL;
+	i8 *buf = abi::__cxa_demangle(m_mangled, NULL, NULL, NULL);
+
+	/* If demangling failed the decorated name is used */
+	if ( unlikely(buf == NULL) ) {
+		retval = const_cast<i8*> (m_mangled);
+	}
+	else {
+		try {
+			retval = new i8[strlen(buf) + 1];
+		}
+		catch (...) {
+			free(buf);
+			throw;
+		}
+
+		strcpy(retval, buf);
+		free(buf);
+	}
+
+	i8 **nm = const_cast<i8**> (&m_name);
+	if ( likely(compare_swap(nm, static_cast<i8*> (NULL), retval)) ) {
+		return retval;
+	}
+
+	if ( likely(retval != m_mangled) ) {
+		delete[] retval;
+	}
+
+	return load_acquire(nm);
+}
+
+
 /**
  * @brief Object constructor
  *
@@ -15,11 +61,15 @@ namespace instrument {
  *
  * @param[in] nm the symbol name (NULL if the symbol is unresolved)
  *
+ * @param[in] sz the symbol code size (0 if unknown)
+ *
  * @throws std::bad_alloc
  */
-symbol::symbol(mem_addr_t addr, const i8 *nm):
+symbol::symbol(mem_addr_t addr, const i8 *nm, u32 sz):
 m_addr(addr),
-m_name(NULL)
+m_name(NULL),
+m_mangled(NULL),
+m_size(sz)
 {
 	if ( unlikely(nm != NULL) ) {
 		m_name = new i8[strlen(nm) + 1];
@@ -34,13 +84,17 @@ m_name(NULL)
  * @param[in] src the source object
  *
  * @throws std::bad_alloc
+ *
+ * @note The copy refers to the same decorated name as the source symbol
  */
 symbol::symbol(const symbol &src):
 m_addr(src.m_addr),
-m_name(NULL)
+m_name(NULL),
+m_mangled(src.m_mangled),
+m_size(src.m_size)
 {
-	const i8 *buf = src.m_name;
-	if ( unlikely(buf != NULL) ) {
+	const i8 *buf = load_acquire(&src.m_name);
+	if ( unlikely(buf != NULL && buf != m_mangled) ) {
 		m_name = new i8[strlen(buf) + 1];
 		strcpy(m_name, buf);
 	}
@@ -52,8 +106,12 @@ m_name(NULL)
  */
 symbol::~symbol()
 {
-	delete[] m_name;
+	if ( likely(m_name != m_mangled) ) {
+		delete[] m_name;
+	}
+
 	m_name = NULL;
+	m_mangled = NULL;
 }
 
 
@@ -84,22 +142,63 @@ inline mem_addr_t symbol::addr() const
 /**
  * @brief Check if the symbol is resolved
  *
- * @returns true if the symbol is named/demangled, false otherwise
+ * @returns true if the symbol is named (decorated or demangled), false otherwise
  */
 inline bool symbol::is_resolved() const
 {
-	return m_name != NULL;
+	return m_name != NULL || m_mangled != NULL;
+}
+
+
+/**
+ * @brief Get the decorated symbol name
+ *
+ * @returns this->m_mangled, or this->m_name if there is no decorated name
+ */
+inline const i8* symbol::mangled() const
+{
+	if ( likely(m_mangled != NULL) ) {
+		return m_mangled;
+	}
+
+	return load_acquire(&m_name);
+}
+
+
+/**
+ * @brief Set the decorated symbol name (and unset the demangled name)
+ *
+ * @param[in] nm the decorated name (not copied, must outlive the symbol)
+ *
+ * @returns *this
+ */
+symbol& symbol::set_mangled(const i8 *nm)
+{
+	if ( likely(m_name != m_mangled) ) {
+		delete[] m_name;
+	}
+
+	m_name = NULL;
+	m_mangled = nm;
+	return *this;
 }
 
 
 /**
  * @brief Get the symbol name
  *
- * @returns this->m_name
+ * @returns this->m_name (demangled upon the first call)
+ *
+ * @throws std::bad_alloc
  */
 inline const i8* symbol::name() const
 {
-	return m_name;
+	const i8 *retval = load_acquire(&m_name);
+	if ( likely(retval != NULL || m_mangled == NULL) ) {
+		return retval;
+	}
+
+	return demangle();
 }
 
 
@@ -114,6 +213,11 @@ inline const i8* symbol::name() const
  */
 symbol& symbol::set_name(const i8 *nm)
 {
+	/* The decorated name is not owned */
+	if ( unlikely(m_name == m_mangled) ) {
+		m_name = NULL;
+	}
+
 	if ( unlikely(nm == NULL) ) {
 		delete[] m_name;
 		m_name = NULL;
@@ -132,6 +236,31 @@ symbol& symbol::set_name(const i8 *nm)
 }
 
 
+/**
+ * @brief Get the symbol code size
+ *
+ * @returns this->m_size
+ */
+inline u32 symbol::size() const
+{
+	return m_size;
+}
+
+
+/**
+ * @brief Set the symbol code size
+ *
+ * @param[in] sz the new size (0 if unknown)
+ *
+ * @returns *this
+ */
+inline symbol& symbol::set_size(u32 sz)
+{
+	m_size = sz;
+	return *this;
+}
+
+
 /**
  * @brief Assignment operator
  *
@@ -148,7 +277,35 @@ symbol& symbol::operator=(const symbol &rval)
 	}
 
 	m_addr = rval.m_addr;
-	return set_name(rval.m_name);
+	m_size = rval.m_size;
+	set_mangled(rval.m_mangled);
+
+	/* Keep the demangled name, if any */
+	const i8 *nm = load_acquire(&rval.m_name);
+	if ( likely(nm != NULL && nm != rval.m_mangled) ) {
+		set_name(nm);
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Check if an address is within the symbol code
+ *
+ * @param[in] addr the address
+ *
+ * @returns
+ *	true if the address is in [addr, addr + size), false otherwise. If the size
+ *	is unknown only the symbol address matches
+ */
+inline bool symbol::contains(mem_addr_t addr) const
+{
+	if ( unlikely(m_size == 0) ) {
+		return addr == m_addr;
+	}
+
+	return addr >= m_addr && addr - m_addr < m_size;
 }
 
 }
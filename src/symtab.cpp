@@ -1,3 +1,4 @@
+#include "../include/metrics.hpp"
 #include "../include/symtab.hpp"
 #include "../include/util.hpp"
 
@@ -9,6 +10,757 @@
 
 namespace instrument {
 
+/* Static member variable definition */
+
+pthread_mutex_t symtab::s_bfd_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+
+/**
+ * @brief Compare two symbols by address (and name, to order aliases)
+ *
+ * @param[in] lval the first symbol (symbol_t)
+ *
+ * @param[in] rval the second symbol (symbol_t)
+ *
+ * @returns a negative, zero or positive value if lval is ordered before, with or
+ *	after rval
+ *
+ * @note Aliases are ordered by name pool offset, to avoid comparing the names
+ */
+i32 symtab::compare(const void *lval, const void *rval)
+{
+	const symbol_t *l = static_cast<const symbol_t*> (lval);
+	const symbol_t *r = static_cast<const symbol_t*> (rval);
+
+	if ( likely(l->addr != r->addr) ) {
+		return (l->addr < r->addr) ? -1 : 1;
+	}
+
+	return (l->name < r->name) ? -1 : (l->name > r->name);
+}
+
+
+/**
+ * @brief Dispose a resolved source line (registry callback)
+ *
+ * @param[in] i the line offset (unused)
+ *
+ * @param[in] line the resolved line
+ */
+void symtab::dispose_line(u32 i, string *line)
+{
+	delete line;
+}
+
+
+/**
+ * @brief
+ *	Find the allocated section that contains a link time address (this is a
+ *	bfd_map_over_sections callback)
+ *
+ * @param[in] fd the bfd
+ *
+ * @param[in] sec the current section
+ *
+ * @param[in,out] arg the query (symtab::section_query)
+ */
+void symtab::find_section(bfd *fd, asection *sec, void *arg)
+{
+	section_query *query = static_cast<section_query*> (arg);
+	if ( likely(query->section != NULL || (sec->flags & SEC_ALLOC) == 0) ) {
+		return;
+	}
+
+	bfd_vma vma = bfd_get_section_vma(fd, sec);
+	if ( unlikely(query->pc >= vma && query->pc < vma + bfd_get_section_size(sec)) ) {
+		query->section = sec;
+	}
+}
+
+
+/**
+ * @brief Release the debug information descriptor
+ *
+ * @returns *this
+ */
+symtab& symtab::close_debug_info()
+{
+	delete[] m_symbols;
+	m_symbols = NULL;
+
+	if ( likely(m_bfd != NULL) ) {
+		bfd_close(m_bfd);
+		m_bfd = NULL;
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Reopen the objective code file and canonicalize its symbol table, to resolve
+ *	source lines (not thread safe, symtab::s_bfd_lock must be held)
+ *
+ * @returns true if the debug information is available, false otherwise
+ *
+ * @throws std::bad_alloc
+ */
+bool symtab::open_debug_info()
+{
+	if ( likely(m_bfd != NULL) ) {
+		return true;
+	}
+
+	if ( unlikely(m_lineless) ) {
+		return false;
+	}
+
+	m_lineless = true;
+	m_bfd = bfd_openr(m_path, NULL);
+	if ( unlikely(m_bfd == NULL) ) {
+		return false;
+	}
+
+	if ( unlikely(!bfd_check_format(m_bfd, bfd_object)) ) {
+		close_debug_info();
+		return false;
+	}
+
+	i32 sz = bfd_get_symtab_upper_bound(m_bfd);
+	if ( unlikely(sz <= 0) ) {
+		close_debug_info();
+		return false;
+	}
+
+	m_symbols = new asymbol*[sz];
+	if ( unlikely(bfd_canonicalize_symtab(m_bfd, m_symbols) <= 0) ) {
+		close_debug_info();
+		return false;
+	}
+
+	m_lineless = false;
+	return true;
+}
+
+
+/**
+ * @brief
+ *	Sort a symbol table by address and bound the size of each symbol by the
+ *	address of the next one
+ *
+ * @param[in,out] tbl the symbol table
+ *
+ * @param[in] cnt the symbol count
+ *
+ * @returns the first argument
+ *
+ * @note Before sorting, the size of each symbol spans to the end of its section
+ */
+symbol_t* symtab::sort(symbol_t *tbl, u32 cnt)
+{
+	qsort(tbl, cnt, sizeof(symbol_t), compare);
+
+	for (u32 i = 0; likely(i < cnt); i++) {
+		symbol_t *sym = &tbl[i];
+
+		/* Aliases share the same code, find the next symbol at another address */
+		u32 j = i + 1;
+		while ( likely(j < cnt && tbl[j].addr == sym->addr) ) {
+			j++;
+		}
+
+		if ( likely(j < cnt) ) {
+			mem_addr_t gap = tbl[j].addr - sym->addr;
+
+			if ( likely(sym->size == 0 || gap < sym->size) ) {
+				sym->size = gap;
+			}
+		}
+	}
+
+	return tbl;
+}
+
+
+/**
+ * @brief Write a buffer to a file descriptor, retrying partial writes
+ *
+ * @param[in] fd the file descriptor
+ *
+ * @param[in] buf the buffer
+ *
+ * @param[in] sz the buffer size
+ *
+ * @returns true on success, false otherwise
+ */
+bool symtab::write_all(i32 fd, const void *buf, u32 sz)
+{
+	const i8 *pos = static_cast<const i8*> (buf);
+
+	while ( likely(sz > 0) ) {
+		ssize_t cnt = write(fd, pos, sz);
+		if ( unlikely(cnt < 0) ) {
+			if ( likely(errno == EINTR || errno == EAGAIN) ) {
+				continue;
+			}
+
+			return false;
+		}
+
+		pos += cnt;
+		sz -= cnt;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief
+ *	Copy the symbol table (and its name pool) of another symtab. A deferred
+ *	symbol table stays deferred
+ *
+ * @param[in] src the source symtab
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The demangled names are not copied, they are demangled again on demand
+ */
+symtab& symtab::copy_table(const symtab &src)
+{
+	release_table();
+
+	const symbol_t *tbl = load_acquire(&src.m_table);
+	if ( unlikely(tbl == NULL) ) {
+		return *this;
+	}
+
+	symbol_t *cpy = new symbol_t[src.m_count];
+	memcpy(cpy, tbl, src.m_count * sizeof(symbol_t));
+
+	if ( likely(src.m_names != NULL) ) {
+		try {
+			m_names = new i8[src.m_names_sz];
+		}
+		catch (...) {
+			delete[] cpy;
+			throw;
+		}
+
+		m_names_sz = src.m_names_sz;
+		memcpy(m_names, src.m_names, m_names_sz);
+	}
+
+	/* The entries refer to the names by offset, they are valid in the copy */
+	return publish(cpy, src.m_count);
+}
+
+
+/**
+ * @brief Demangle the decorated name of a symbol and keep the result
+ *
+ * @param[in] i the symbol index
+ *
+ * @returns the demangled name or the decorated name if demangling fails
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	Concurrent callers may demangle the same name (or allocate the memo array),
+ *	the first result is kept and the others are discarded
+ */
+const i8* symtab::demangle(u32 i) const
+{
+	i8 ***memo = const_cast<i8***> (&m_demangled);
+	i8 **names = load_acquire(memo);
+
+	if ( unlikely(names == NULL) ) {
+		names = new i8*[m_count];
+		memset(names, 0, m_count * sizeof(i8*));
+
+		if ( unlikely(!compare_swap(memo, static_cast<i8**> (NULL), names)) ) {
+			delete[] names;
+			names = load_acquire(memo);
+		}
+	}
+
+	i8 *retval = load_acquire(&names[i]);
+	if ( likely(retval != NULL) ) {
+		return retval;
+	}
+
+	i8 *mangled = m_names + m_table[i].name;
+	i8 *buf = abi::__cxa_demangle(mangled, NULL, NULL, NULL);
+
+	/* If demangling failed the decorated name is used */
+	if ( unlikely(buf == NULL) ) {
+		retval = mangled;
+	}
+	else {
+		try {
+			retval = new i8[strlen(buf) + 1];
+		}
+		catch (...) {
+			free(buf);
+			throw;
+		}
+
+		strcpy(retval, buf);
+		free(buf);
+	}
+
+	if ( likely(compare_swap(&names[i], static_cast<i8*> (NULL), retval)) ) {
+		return retval;
+	}
+
+	if ( likely(retval != mangled) ) {
+		delete[] retval;
+	}
+
+	return load_acquire(&names[i]);
+}
+
+
+/**
+ * @brief Get the symbol index file path of the module
+ *
+ * @param[out] dst the index file path
+ *
+ * @param[out] inf the module file information (used to validate the index)
+ *
+ * @returns false if the index cache is not enabled (or the module can't be
+ *	stat-ed), true otherwise
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The index file is named after the module and a hash of its path, so modules
+ *	with the same name in different directories don't share an index file
+ */
+bool symtab::index_path(string &dst, fileinfo_t &inf) const
+{
+	chain<string> *env = util::getenv(g_cache_env);
+	if ( likely(env == NULL) ) {
+		return false;
+	}
+
+	bool retval = (env->size() > 0 && stat(m_path, &inf) == 0);
+	if ( likely(retval) ) {
+		/* FNV-1a path hash */
+		u32 h = 2166136261U;
+		for (const i8 *c = m_path; likely(*c != '\0'); c++) {
+			h ^= static_cast<u8> (*c);
+			h *= 16777619U;
+		}
+
+		const i8 *nm = strrchr(m_path, '/');
+		nm = (likely(nm != NULL)) ? nm + 1 : m_path;
+
+		try {
+			dst.set("%s/%s.%08x.idx", env->at(0)->cstring(), nm, h);
+		}
+		catch (...) {
+			delete env;
+			throw;
+		}
+	}
+
+	delete env;
+	return retval;
+}
+
+
+/**
+ * @brief
+ *	Map the symbol index file of the module, if it's cached and up to date, and
+ *	publish the mapped symbol table (not thread safe, symtab::m_load_lock must
+ *	be held)
+ *
+ * @returns true if the index was mapped, false if it's not available
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The index stores the symbol_t entries verbatim, so the table and the name
+ *	pool are used in place (nothing is copied or demangled)
+ */
+bool symtab::load_index()
+{
+	string path;
+	fileinfo_t inf;
+	if ( likely(!index_path(path, inf)) ) {
+		return false;
+	}
+
+	i32 fd = open(path.cstring(), O_RDONLY);
+	if ( unlikely(fd < 0) ) {
+		return false;
+	}
+
+	fileinfo_t idx;
+	if ( unlikely(fstat(fd, &idx) < 0 || idx.st_size < (off_t) sizeof(index_header)) ) {
+		close(fd);
+		return false;
+	}
+
+	u32 sz = idx.st_size;
+	void *base = mmap(NULL, sz, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if ( unlikely(base == MAP_FAILED) ) {
+		return false;
+	}
+
+	/* Validate the header against the module file */
+	const index_header *hdr = static_cast<const index_header*> (base);
+	const symbol_t *entries = reinterpret_cast<const symbol_t*> (hdr + 1);
+	const u32 max = (sz - sizeof(index_header)) / sizeof(symbol_t);
+
+	bool valid = (memcmp(hdr->magic, g_symidx_magic, sizeof(hdr->magic)) == 0);
+	valid = valid && hdr->version == g_symidx_version;
+	valid = valid && hdr->entry_sz == sizeof(symbol_t);
+	valid = valid && hdr->mtime == static_cast<u64> (inf.st_mtime);
+	valid = valid && hdr->size == static_cast<u64> (inf.st_size);
+	valid = valid && hdr->count <= max;
+
+	const i8 *names = reinterpret_cast<const i8*> (entries + ((valid) ? hdr->count : 0));
+	valid = valid && hdr->names_sz > 0;
+	valid = valid && names + hdr->names_sz == static_cast<const i8*> (base) + sz;
+	valid = valid && names[hdr->names_sz - 1] == '\0';
+
+	for (u32 i = 0; likely(valid && i < hdr->count); i++) {
+		valid = (entries[i].name < hdr->names_sz);
+	}
+
+	if ( unlikely(!valid) ) {
+		munmap(base, sz);
+		util::dbg_warn("ignored stale symbol index '%s'", path.cstring());
+		return false;
+	}
+
+	m_index = base;
+	m_index_sz = sz;
+	m_names = const_cast<i8*> (names);
+	m_names_sz = hdr->names_sz;
+	publish(const_cast<symbol_t*> (entries), hdr->count);
+
+	util::dbg_info("mapped the symbol index of '%s' from '%s'", m_path, path.cstring());
+	return true;
+}
+
+
+/**
+ * @brief
+ *	Parse the objective code file, discard the non-function symbols, copy the
+ *	decorated names of the function symbols to a name pool and publish the
+ *	symbol table (not thread safe, symtab::m_load_lock must be held)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The names are demangled upon request (see symtab::name). Only the libbfd
+ *	calls hold symtab::s_bfd_lock, the table is sorted after it's released
+ */
+symtab& symtab::parse()
+{
+	bfd *fd = NULL;
+	asymbol **tbl = NULL;
+	symbol_t *retval = NULL;
+	i8 *names = NULL;
+	bool locked = false;
+
+	/* If an exception occurs, release resources and rethrow it */
+	try {
+		pthread_mutex_lock(&s_bfd_lock);
+		locked = true;
+
+		/* Open the binary file and obtain a descriptor (the bfd) */
+		fd = bfd_openr(m_path, NULL);
+		if ( unlikely(fd == NULL) ) {
+			bfd_error bfd_errno = bfd_get_error();
+			throw exception(
+				"failed to open binary file '%s' (bfd errno %d - %s)",
+				m_path,
+				bfd_errno,
+				bfd_errmsg(bfd_errno));
+		}
+
+		/* Verify that the file contains objective code */
+		if ( unlikely(!bfd_check_format(fd, bfd_object)) ) {
+			bfd_error bfd_errno = bfd_get_error();
+			throw exception(
+				"failed to verify file '%s' as objective code (bfd errno %d - %s)",
+				m_path,
+				bfd_errno,
+				bfd_errmsg(bfd_errno));
+		}
+
+		/* Get the symbol table storage size */
+		i32 sz = bfd_get_symtab_upper_bound(fd);
+		if ( unlikely(sz == 0) ) {
+			throw exception("objective code file '%s' is stripped", m_path);
+		}
+		else if ( unlikely(sz < 0) ) {
+			bfd_error bfd_errno = bfd_get_error();
+			throw exception(
+				"failed to parse objective code file '%s' (bfd errno %d - %s)",
+				m_path,
+				bfd_errno,
+				bfd_errmsg(bfd_errno));
+		}
+
+		/* Canonicalize the symbol table and get the symbol count */
+		tbl = new asymbol*[sz];
+		i32 cnt = bfd_canonicalize_symtab(fd, tbl);
+		if ( unlikely(cnt == 0) ) {
+			throw exception("objective code file '%s' is stripped", m_path);
+		}
+		else if ( unlikely(cnt < 0) ) {
+			bfd_error bfd_errno = bfd_get_error();
+			throw exception(
+				"failed to canonicalize the symbol table of '%s' (bfd errno %d - %s)",
+				m_path,
+				bfd_errno,
+				bfd_errmsg(bfd_errno));
+		}
+
+		/* Discard non function symbols, count the rest and their name pool size */
+		u32 fn_cnt = 0, names_sz = 0;
+		for (i32 i = 0; likely(i < cnt); i++) {
+			asymbol *cur = tbl[i];
+
+			/* If the entry is not a function symbol in a code section */
+			if ( likely((cur->section->flags & SEC_CODE) == 0 || (cur->flags & BSF_FUNCTION) == 0) ) {
+				tbl[i] = NULL;
+				continue;
+			}
+
+			names_sz += strlen(cur->name) + 1;
+			fn_cnt++;
+		}
+
+		retval = new symbol_t[fn_cnt];
+		names = new i8[(likely(names_sz > 0)) ? names_sz : 1];
+
+		/* Store the symbols and copy the decorated names, before the bfd is closed */
+		for (i32 i = 0, j = 0, pos = 0; likely(i < cnt); i++) {
+			const asymbol *cur = tbl[i];
+			if ( likely(cur == NULL) ) {
+				continue;
+			}
+
+			/*
+			 * A symbol link time address is the section virtual memory address, plus
+			 * the offset from the section base (the load address is added on lookup)
+			 */
+			symbol_t *sym = &retval[j++];
+			sym->addr = bfd_get_section_vma(fd, cur->section) + cur->value;
+
+			/* The size is bounded by the section end, until the table is sorted */
+			sym->size = bfd_get_section_size(cur->section) - cur->value;
+
+			u32 len = strlen(cur->name) + 1;
+			memcpy(names + pos, cur->name, len);
+			sym->name = pos;
+			pos += len;
+		}
+
+		delete[] tbl;
+		tbl = NULL;
+		bfd_close(fd);
+		fd = NULL;
+
+		pthread_mutex_unlock(&s_bfd_lock);
+		locked = false;
+
+		sort(retval, fn_cnt);
+
+#if DBG_LEVEL & DBGL_INFO
+		util::dbg_info("loaded the symbol table of '%s'", m_path);
+		util::dbg_info("  base address @ %p", m_base);
+		util::dbg_info("  number of symbols: %d", cnt);
+		util::dbg_info("  number of function symbols: %d", fn_cnt);
+#endif
+
+		m_names = names;
+		m_names_sz = names_sz;
+		return publish(retval, fn_cnt);
+	}
+	catch (...) {
+		delete[] tbl;
+		delete[] names;
+		delete[] retval;
+
+		if ( likely(fd != NULL) ) {
+			bfd_close(fd);
+		}
+
+		if ( likely(locked) ) {
+			pthread_mutex_unlock(&s_bfd_lock);
+		}
+
+		throw;
+	}
+}
+
+
+/**
+ * @brief Publish a symbol table to the (lock-free) readers
+ *
+ * @param[in] tbl the symbol table (sorted)
+ *
+ * @param[in] cnt the symbol count
+ *
+ * @returns *this
+ *
+ * @note The count is published with the table, readers never see a partial table
+ */
+inline symtab& symtab::publish(symbol_t *tbl, u32 cnt)
+{
+	m_count = cnt;
+	store_release(&m_table, tbl);
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Release the symbol table, its name pool (or the mapped index) and the
+ *	demangled names
+ *
+ * @returns *this
+ */
+symtab& symtab::release_table()
+{
+	if ( likely(m_demangled != NULL) ) {
+		for (u32 i = 0; likely(i < m_count); i++) {
+			i8 *nm = m_demangled[i];
+
+			/* Names that failed to demangle refer to the pool */
+			if ( likely(nm < m_names || nm >= m_names + m_names_sz) ) {
+				delete[] nm;
+			}
+		}
+
+		delete[] m_demangled;
+		m_demangled = NULL;
+	}
+
+	if ( unlikely(m_index != NULL) ) {
+		munmap(m_index, m_index_sz);
+	}
+	else {
+		delete[] m_table;
+		delete[] m_names;
+	}
+
+	m_table = NULL;
+	m_count = 0;
+	m_index = NULL;
+	m_index_sz = 0;
+	m_names = NULL;
+	m_names_sz = 0;
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Save the parsed symbol table to the symbol index file of the module, if the
+ *	index cache is enabled
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The index is written to a temporary file which is then renamed, so readers
+ *	never map a partially written index. Failures are reported and ignored
+ */
+symtab& symtab::save_index() const
+{
+	string path;
+	fileinfo_t inf;
+	if ( likely(m_names == NULL || !index_path(path, inf)) ) {
+		return const_cast<symtab&> (*this);
+	}
+
+	index_header hdr;
+	memset(&hdr, 0, sizeof(index_header));
+	memcpy(hdr.magic, g_symidx_magic, sizeof(hdr.magic));
+	hdr.version = g_symidx_version;
+	hdr.count = m_count;
+	hdr.names_sz = m_names_sz;
+	hdr.entry_sz = sizeof(symbol_t);
+	hdr.mtime = inf.st_mtime;
+	hdr.size = inf.st_size;
+
+	string tmp;
+	tmp.set("%s.%d", path.cstring(), getpid());
+
+	i32 fd = open(tmp.cstring(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool done = (fd >= 0);
+
+	done = done && write_all(fd, &hdr, sizeof(index_header));
+	done = done && write_all(fd, m_table, m_count * sizeof(symbol_t));
+	done = done && write_all(fd, m_names, m_names_sz);
+
+	if ( likely(fd >= 0) ) {
+		done = (close(fd) == 0) && done;
+	}
+
+	done = done && rename(tmp.cstring(), path.cstring()) == 0;
+	if ( unlikely(!done) ) {
+		util::dbg_warn(
+			"failed to save the symbol index '%s' (errno %d - %s)",
+			path.cstring(),
+			errno,
+			strerror(errno));
+
+		unlink(tmp.cstring());
+		return const_cast<symtab&> (*this);
+	}
+
+	util::dbg_info("saved the symbol index of '%s' to '%s'", m_path, path.cstring());
+	return const_cast<symtab&> (*this);
+}
+
+
+/**
+ * @brief Get the symbol table, loading it if it's deferred
+ *
+ * @returns the symbol table (this->m_count entries)
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	If a deferred symbol table fails to load, the error is reported once and the
+ *	module is left without symbols
+ */
+const symbol_t* symtab::table() const
+{
+	const symbol_t *retval = load_acquire(&m_table);
+	if ( likely(retval != NULL) ) {
+		return retval;
+	}
+
+	try {
+		load();
+	}
+	catch (exception &x) {
+		util::dbg_error("in symtab::%s(): %s", __FUNCTION__, x.msg());
+	}
+
+	return load_acquire(&m_table);
+}
+
+
 /**
  * @brief Object constructor
  *
@@ -16,148 +768,80 @@ namespace instrument {
  *
  * @param[in] base the load base address
  *
+ * @param[in] begin the mapped address range start
+ *
+ * @param[in] end
+ *	the mapped address range end. If the range is empty, it is set to span the
+ *	loaded function symbols
+ *
+ * @param[in] lazy
+ *	true to defer loading the symbol table until the first lookup, false to load
+ *	it now. A symtab without an address range is always loaded now
+ *
  * @throws std::bad_alloc
  * @throws instrument::exception
  */
-symtab::symtab(const i8 *path, mem_addr_t base):
+symtab::symtab(	const i8 *path,
+								mem_addr_t base,
+								mem_addr_t begin,
+								mem_addr_t end,
+								bool lazy):
+m_load_lock(PTHREAD_MUTEX_INITIALIZER),
 m_base(base),
+m_begin(begin),
+m_end(end),
+m_mapped(true),
 m_path(NULL),
-m_table(NULL)
+m_table(NULL),
+m_count(0),
+m_demangled(NULL),
+m_names(NULL),
+m_names_sz(0),
+m_index(NULL),
+m_index_sz(0),
+m_bfd(NULL),
+m_symbols(NULL),
+m_lineless(false),
+m_lines(NULL)
 {
 	if ( unlikely(path == NULL) ) {
 		throw exception("invalid argument: path (=%p)", path);
 	}
 
-	m_path = new i8[strlen(path) + 1];
-	strcpy(m_path, path);
-
-	bfd *fd = NULL;
-	i8 *nm = NULL;
-	symbol *sym = NULL;
-	asymbol **tbl = NULL;
-
 	/* If an exception occurs, release resources and rethrow it */
 	try {
-		/* Open the binary file and obtain a descriptor (the bfd) */
-		fd = bfd_openr(m_path, NULL);
-		if ( unlikely(fd == NULL) ) {
-			bfd_error bfd_errno = bfd_get_error();
-			throw exception(
-				"failed to open binary file '%s' (bfd errno %d - %s)",
-				m_path,
-				bfd_errno,
-				bfd_errmsg(bfd_errno));
-		}
-
-		/* Verify that the file contains objective code */
-		if ( unlikely(!bfd_check_format(fd, bfd_object)) ) {
-			bfd_error bfd_errno = bfd_get_error();
-			throw exception(
-				"failed to verify file '%s' as objective code (bfd errno %d - %s)",
-				m_path,
-				bfd_errno,
-				bfd_errmsg(bfd_errno));
-		}
-
-		/* Get the symbol table storage size */
-		i32 sz = bfd_get_symtab_upper_bound(fd);
-		if ( unlikely(sz == 0) ) {
-			throw exception("objective code file '%s' is stripped", m_path);
-		}
-		else if ( unlikely(sz < 0) ) {
-			bfd_error bfd_errno = bfd_get_error();
-			throw exception(
-				"failed to parse objective code file '%s' (bfd errno %d - %s)",
-				m_path,
-				bfd_errno,
-				bfd_errmsg(bfd_errno));
-		}
+		m_path = new i8[strlen(path) + 1];
+		strcpy(m_path, path);
+		m_lines = new registry<mem_addr_t, string>;
 
-		/* Canonicalize the symbol table and get the symbol count */
-		tbl = new asymbol*[sz];
-		i32 cnt = bfd_canonicalize_symtab(fd, tbl);
-		if ( unlikely(cnt == 0) ) {
-			throw exception("objective code file '%s' is stripped", m_path);
-		}
-		else if ( unlikely(cnt < 0) ) {
-			bfd_error bfd_errno = bfd_get_error();
-			throw exception(
-				"failed to canonicalize the symbol table of '%s' (bfd errno %d - %s)",
-				m_path,
-				bfd_errno,
-				bfd_errmsg(bfd_errno));
+		if ( likely(lazy && m_begin < m_end) ) {
+			util::dbg_info("deferred the symbol table of '%s'", m_path);
+			return;
 		}
 
-		/* Traverse the symbol table, discard non function symbols */
-		m_table = new list<symbol>(cnt, true);
-		for (i32 i = 0; likely(i < cnt); i++) {
-			const asymbol *cur = tbl[i];
-
-			/* If the entry is not in a code section */
-			if ( likely((cur->section->flags & SEC_CODE) == 0) ) {
-				continue;
-			}
-
-			/* If the entry is not a function symbol */
-			if ( likely((cur->flags & BSF_FUNCTION) == 0) ) {
-				continue;
-			}
-
-			/*
-			 * A symbol runtime address is the load address, plus the section virtual
-			 * memory address, plus the offset from the section base
-			 */
-			mem_addr_t addr = m_base;
-			addr += bfd_get_section_vma(fd, cur->section);
-			addr += cur->value;
-
-			/* Demangle and store the symbol */
-			nm = abi::__cxa_demangle(cur->name, NULL, NULL, NULL);
-			if ( likely(nm != NULL) ) {
-				sym = new symbol(addr, nm);
-				delete[] nm;
-				nm = NULL;
-			}
+		load();
 
-			/* If demangling failed the decorated name is used */
-			else {
-				sym = new symbol(addr, cur->name);
-			}
+		/* Without segment information, span the function symbols */
+		if ( unlikely(m_begin >= m_end && m_count > 0) ) {
+			const symbol_t *last = &m_table[m_count - 1];
 
-			m_table->add(sym);
-			sym = NULL;
+			m_begin = addr(m_table);
+			m_end = addr(last) + ((likely(last->size > 0)) ? last->size : 1);
 		}
 
-		delete[] tbl;
-		bfd_close(fd);
-
 #if DBG_LEVEL & DBGL_INFO
-		util::dbg_info("loaded the symbol table of '%s'", m_path);
-		util::dbg_info("  base address @ %p", m_base);
-		util::dbg_info("  number of symbols: %d", cnt);
-		util::dbg_info("  number of function symbols: %d", m_table->size());
-
 #if WITH_SYMBOL_ENUMERATION
 		print();
 #endif
-
 #endif
 	}
 	catch (...) {
+		release_table();
 		delete[] m_path;
-		delete[] tbl;
-		delete[] nm;
-
-		delete m_table;
-		delete sym;
+		delete m_lines;
 
 		m_path = NULL;
-		m_table = NULL;
-
-		if ( likely(fd != NULL) ) {
-			bfd_close(fd);
-		}
-
+		m_lines = NULL;
 		throw;
 	}
 }
@@ -172,17 +856,33 @@ m_table(NULL)
  */
 symtab::symtab(const symtab &src)
 try:
+m_load_lock(PTHREAD_MUTEX_INITIALIZER),
 m_base(src.m_base),
+m_begin(src.m_begin),
+m_end(src.m_end),
+m_mapped(src.m_mapped),
 m_path(NULL),
-m_table(NULL)
+m_table(NULL),
+m_count(0),
+m_demangled(NULL),
+m_names(NULL),
+m_names_sz(0),
+m_index(NULL),
+m_index_sz(0),
+m_bfd(NULL),
+m_symbols(NULL),
+m_lineless(false),
+m_lines(NULL)
 {
-	m_table = src.m_table->clone();
+	copy_table(src);
+	m_lines = new registry<mem_addr_t, string>;
 	m_path = new i8[strlen(src.m_path) + 1];
 	strcpy(m_path, src.m_path);
 }
 catch (...) {
-	delete m_table;
-	m_table = NULL;
+	release_table();
+	delete m_lines;
+	m_lines = NULL;
 }
 
 
@@ -191,10 +891,19 @@ catch (...) {
  */
 symtab::~symtab()
 {
+	pthread_mutex_lock(&s_bfd_lock);
+	close_debug_info();
+	pthread_mutex_unlock(&s_bfd_lock);
+
+	if ( likely(m_lines != NULL) ) {
+		m_lines->each(dispose_line);
+	}
+
+	release_table();
 	delete[] m_path;
-	delete m_table;
+	delete m_lines;
 	m_path = NULL;
-	m_table = NULL;
+	m_lines = NULL;
 }
 
 
@@ -222,6 +931,50 @@ inline mem_addr_t symtab::base() const
 }
 
 
+/**
+ * @brief Get the mapped address range start
+ *
+ * @returns this->m_begin
+ */
+inline mem_addr_t symtab::begin() const
+{
+	return m_begin;
+}
+
+
+/**
+ * @brief Get the mapped address range end (the first address past the range)
+ *
+ * @returns this->m_end
+ */
+inline mem_addr_t symtab::end() const
+{
+	return m_end;
+}
+
+
+/**
+ * @brief Check if the module is mapped in the process
+ *
+ * @returns false if the module was unloaded (e.g by dlclose), true otherwise
+ */
+inline bool symtab::is_mapped() const
+{
+	return m_mapped;
+}
+
+
+/**
+ * @brief Check if the symbol table is loaded
+ *
+ * @returns false if the symbol table is deferred, true otherwise
+ */
+inline bool symtab::loaded() const
+{
+	return load_acquire(&m_table) != NULL;
+}
+
+
 /**
  * @brief Get the objective code file path
  *
@@ -257,7 +1010,18 @@ symtab& symtab::operator=(const symtab &rval)
 
 	strcpy(m_path, rval.m_path);
 	m_base = rval.m_base;
-	*m_table = *rval.m_table;
+	m_begin = rval.m_begin;
+	m_end = rval.m_end;
+	m_mapped = rval.m_mapped;
+	copy_table(rval);
+
+	/* The debug information is reopened on demand */
+	pthread_mutex_lock(&s_bfd_lock);
+	close_debug_info();
+	m_lineless = false;
+	m_lines->each(dispose_line);
+	m_lines->clear();
+	pthread_mutex_unlock(&s_bfd_lock);
 
 	return *this;
 }
@@ -270,12 +1034,107 @@ symtab& symtab::operator=(const symtab &rval)
  *
  * @returns the symbol@addr or NULL if the address is unresolved
  */
-inline const symbol* symtab::operator[](mem_addr_t addr) const
+inline const symbol_t* symtab::operator[](mem_addr_t addr) const
 {
 	return lookup(addr);
 }
 
 
+/**
+ * @brief Get the runtime address of a symbol
+ *
+ * @param[in] sym the symbol (an entry of this table)
+ *
+ * @returns the load base address plus the symbol link time address
+ */
+inline mem_addr_t symtab::addr(const symbol_t *sym) const
+{
+	return m_base + sym->addr;
+}
+
+
+/**
+ * @brief
+ *	Resolve the source file name and line of an address, using the debug
+ *	information of the module (in-process, no external program is executed)
+ *
+ * @param[in] addr the (runtime) address
+ *
+ * @returns
+ *	the source line as 'file:line' (the file name has no directory component) or
+ *	NULL if the address can't be resolved
+ *
+ * @note
+ *	This method is thread safe. Resolved addresses (and those that failed to
+ *	resolve) are cached, the cache is read without locking
+ */
+const i8* symtab::addr2line(mem_addr_t addr) const
+{
+	const string *line = m_lines->find(addr);
+	if ( likely(line != NULL) ) {
+		return (likely(line->length() > 0)) ? line->cstring() : NULL;
+	}
+
+	symtab *self = const_cast<symtab*> (this);
+	pthread_mutex_lock(&s_bfd_lock);
+
+	try {
+		/* The address may have been resolved meanwhile */
+		line = m_lines->find(addr);
+		if ( likely(line == NULL) ) {
+			string *buf = new string;
+			count_metric(METRIC_ADDR2LINE, 1);
+
+			try {
+				section_query query;
+				query.pc = addr - m_base;
+				query.section = NULL;
+
+				const i8 *file = NULL;
+				const i8 *fn = NULL;
+				u32 ln = 0;
+
+				if ( likely(self->open_debug_info()) ) {
+					bfd_map_over_sections(m_bfd, find_section, &query);
+				}
+
+				if ( likely(query.section != NULL) ) {
+					bfd_vma offset = query.pc - bfd_get_section_vma(m_bfd, query.section);
+
+					bool found = bfd_find_nearest_line(	m_bfd,
+																							query.section,
+																							m_symbols,
+																							offset,
+																							&file,
+																							&fn,
+																							&ln);
+
+					if ( likely(found && file != NULL && ln > 0) ) {
+						const i8 *base = strrchr(file, '/');
+						buf->set("%s:%u", (base != NULL) ? base + 1 : file, ln);
+					}
+				}
+
+				m_lines->insert(addr, buf);
+			}
+			catch (...) {
+				delete buf;
+				throw;
+			}
+
+			line = buf;
+		}
+
+		pthread_mutex_unlock(&s_bfd_lock);
+		return (likely(line->length() > 0)) ? line->cstring() : NULL;
+	}
+	catch (...) {
+		pthread_mutex_unlock(&s_bfd_lock);
+		throw;
+	}
+}
+
+
 /**
  * @brief Lookup an address to resolve a symbol name
  *
@@ -284,20 +1143,33 @@ inline const symbol* symtab::operator[](mem_addr_t addr) const
  * @returns the symbol name or NULL if the address is unresolved
  *
  * @note
- *	If demangling failed upon symbol table loading/parsing the decorated symbol
- *	name is returned
+ *	The name is demangled upon the first lookup. If demangling fails the
+ *	decorated symbol name is returned
  */
 inline const i8* symtab::addr2name(mem_addr_t addr) const
 {
-	const symbol *sym = lookup(addr);
+	const symbol_t *sym = lookup(addr);
 	if ( likely(sym != NULL) ) {
-		return sym->name();
+		return name(sym);
 	}
 
 	return NULL;
 }
 
 
+/**
+ * @brief Check if an address is within the mapped address range of the module
+ *
+ * @param[in] addr the address
+ *
+ * @returns true if the address is in [begin, end), false otherwise
+ */
+inline bool symtab::contains(mem_addr_t addr) const
+{
+	return addr >= m_begin && addr < m_end;
+}
+
+
 /**
  * @brief Traverse the symbol table with a callback for each symbol
  *
@@ -305,9 +1177,18 @@ inline const i8* symtab::addr2name(mem_addr_t addr) const
  *
  * @returns *this
  */
-inline symtab& symtab::each(const callback_t pfunc) const
+symtab& symtab::each(const callback_t pfunc) const
 {
-	m_table->each(pfunc);
+	__D_ASSERT(pfunc != NULL);
+	if ( unlikely(pfunc == NULL) ) {
+		return const_cast<symtab&> (*this);
+	}
+
+	const symbol_t *tbl = table();
+	for (u32 i = 0; likely(i < m_count); i++) {
+		pfunc(i, &tbl[i]);
+	}
+
 	return const_cast<symtab&> (*this);
 }
 
@@ -325,20 +1206,91 @@ inline bool symtab::exists(mem_addr_t addr) const
 }
 
 
+/**
+ * @brief Load the symbol table, if it's deferred
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	This method is thread safe, concurrent calls load the symbol table once. If
+ *	loading fails an empty symbol table is published, so it's not retried
+ */
+symtab& symtab::load() const
+{
+	symtab *self = const_cast<symtab*> (this);
+	if ( likely(load_acquire(&m_table) != NULL) ) {
+		return *self;
+	}
+
+	pthread_mutex_lock(&self->m_load_lock);
+
+	try {
+		/* The symbol table may have been loaded meanwhile */
+		if ( likely(m_table == NULL) ) {
+			/* Map the cached index or parse the module (and cache the index) */
+			if ( likely(!self->load_index()) ) {
+				try {
+					self->parse();
+				}
+				catch (exception&) {
+					self->publish(new symbol_t[0], 0);
+					throw;
+				}
+
+				save_index();
+			}
+		}
+	}
+	catch (...) {
+		pthread_mutex_unlock(&self->m_load_lock);
+		throw;
+	}
+
+	pthread_mutex_unlock(&self->m_load_lock);
+	return *self;
+}
+
+
 /**
  * @brief Lookup an address to resolve a symbol
  *
- * @param[in] addr the address
+ * @param[in] addr
+ *	the address, either a symbol address or any address within the symbol code
+ *	(e.g a call site)
+ *
+ * @returns the symbol that contains the address or NULL if it is unresolved
  *
- * @returns the symbol or NULL if the address is unresolved
+ * @note The table is sorted by address, the lookup is a binary search O(log n)
  */
-const symbol* symtab::lookup(mem_addr_t addr) const
+const symbol_t* symtab::lookup(mem_addr_t addr) const
 {
-	for (u32 i = 0, sz = m_table->size(); likely(i < sz); i++) {
-		const symbol *sym = m_table->at(i);
-		if ( unlikely(sym->addr() == addr) ) {
-			return sym;
+	const symbol_t *tbl = table();
+	mem_addr_t offset = addr - m_base;
+
+	/* Find the last symbol with an address less than or equal to addr */
+	u32 lo = 0, hi = m_count;
+	while ( likely(lo < hi) ) {
+		u32 mid = lo + (hi - lo) / 2;
+
+		if ( likely(tbl[mid].addr <= offset) ) {
+			lo = mid + 1;
 		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if ( unlikely(lo == 0 || addr < m_base) ) {
+		return NULL;
+	}
+
+	/* An unknown size spans only the symbol address */
+	const symbol_t *sym = &tbl[lo - 1];
+	if ( likely(offset - sym->addr < ((likely(sym->size > 0)) ? sym->size : 1)) ) {
+		return sym;
 	}
 
 	/* The address was not resolved */
@@ -346,6 +1298,70 @@ const symbol* symtab::lookup(mem_addr_t addr) const
 }
 
 
+/**
+ * @brief Lookup a batch of addresses to resolve their symbols
+ *
+ * @param[in] addrs the addresses (sorted in ascending order)
+ *
+ * @param[in] cnt the address count
+ *
+ * @param[out] dst the symbols (NULL for each unresolved address)
+ *
+ * @returns the resolved address count
+ *
+ * @note
+ *	The addresses and the table are merged in a single pass. The table cursor
+ *	gallops (exponential then binary search) to each next address, so sparse
+ *	batches don't scan the whole table and dense ones are linear
+ */
+u32 symtab::lookup(const mem_addr_t *addrs, u32 cnt, const symbol_t **dst) const
+{
+	const symbol_t *tbl = table();
+	u32 retval = 0, cur = 0;
+
+	for (u32 i = 0; likely(i < cnt); i++) {
+		dst[i] = NULL;
+		if ( unlikely(addrs[i] < m_base) ) {
+			continue;
+		}
+
+		/* Gallop past the symbols with an address less than or equal to the offset */
+		mem_addr_t offset = addrs[i] - m_base;
+		u32 lo = cur, step = 1;
+		while ( likely(lo + step <= m_count && tbl[lo + step - 1].addr <= offset) ) {
+			lo += step;
+			step <<= 1;
+		}
+
+		u32 hi = (likely(lo + step <= m_count)) ? lo + step - 1 : m_count;
+		while ( likely(lo < hi) ) {
+			u32 mid = lo + (hi - lo) / 2;
+
+			if ( likely(tbl[mid].addr <= offset) ) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
+			}
+		}
+
+		cur = lo;
+		if ( unlikely(cur == 0) ) {
+			continue;
+		}
+
+		/* An unknown size spans only the symbol address, as in the single lookup */
+		const symbol_t *sym = &tbl[cur - 1];
+		if ( likely(offset - sym->addr < ((likely(sym->size > 0)) ? sym->size : 1)) ) {
+			dst[i] = sym;
+			retval++;
+		}
+	}
+
+	return retval;
+}
+
+
 /**
  * @brief Lookup a name to resolve a symbol
  *
@@ -353,12 +1369,13 @@ const symbol* symtab::lookup(mem_addr_t addr) const
  *
  * @returns the symbol or NULL if the name was not found
  */
-const symbol* symtab::lookup(const i8 *nm) const
+const symbol_t* symtab::lookup(const i8 *nm) const
 {
-	for (u32 i = 0, sz = m_table->size(); likely(i < sz); i++) {
-		const symbol *sym = m_table->at(i);
-		if ( unlikely(strcmp(sym->name(), nm) == 0) ) {
-			return sym;
+	const symbol_t *tbl = table();
+
+	for (u32 i = 0; likely(i < m_count); i++) {
+		if ( unlikely(strcmp(name(&tbl[i]), nm) == 0) ) {
+			return &tbl[i];
 		}
 	}
 
@@ -366,6 +1383,33 @@ const symbol* symtab::lookup(const i8 *nm) const
 }
 
 
+/**
+ * @brief Get the name of a symbol
+ *
+ * @param[in] sym the symbol (an entry of this table)
+ *
+ * @returns the demangled symbol name or the decorated name if demangling fails
+ *
+ * @throws std::bad_alloc
+ *
+ * @note The name is demangled upon the first request (thread safe)
+ */
+inline const i8* symtab::name(const symbol_t *sym) const
+{
+	i8 **names = load_acquire(&m_demangled);
+	u32 i = sym - m_table;
+
+	if ( likely(names != NULL) ) {
+		const i8 *retval = load_acquire(&names[i]);
+		if ( likely(retval != NULL) ) {
+			return retval;
+		}
+	}
+
+	return demangle(i);
+}
+
+
 /**
  * @brief Lookup a name to resolve a symbol address
  *
@@ -375,9 +1419,9 @@ const symbol* symtab::lookup(const i8 *nm) const
  */
 inline mem_addr_t symtab::name2addr(const i8 *nm) const
 {
-	const symbol *sym = lookup(nm);
+	const symbol_t *sym = lookup(nm);
 	if ( likely(sym != NULL) ) {
-		return sym->addr();
+		return addr(sym);
 	}
 
 	return -1;
@@ -404,11 +1448,12 @@ symtab& symtab::print(std::ostream &out) const
 			<< ")"
 			<< std::endl;
 
-	for (u32 i = 0, sz = m_table->size(); likely(i < sz); i++) {
-		const symbol *sym = m_table->at(i);
+	const symbol_t *tbl = table();
+	for (u32 i = 0; likely(i < m_count); i++) {
+		const symbol_t *sym = &tbl[i];
 
 		out << "  "
-				<< sym->name()
+				<< name(sym)
 				<< " @ "
 #ifdef WITH_COLOR_TERM
 				<< "\e[38;5;"
@@ -418,7 +1463,7 @@ symtab& symtab::print(std::ostream &out) const
 #endif
 				<< "0x"
 				<< std::hex
-				<< sym->addr()
+				<< addr(sym)
 #ifdef WITH_COLOR_TERM
 				<< "\e[0m"
 #endif
@@ -432,11 +1477,29 @@ symtab& symtab::print(std::ostream &out) const
 /**
  * @brief Get the number of symbols
  *
- * @returns this->m_table->size()
+ * @returns this->m_count
+ *
+ * @note A deferred symbol table is loaded
  */
 inline u32 symtab::size() const
 {
-	return m_table->size();
+	table();
+	return m_count;
+}
+
+
+/**
+ * @brief Create a standalone view of a symbol (for the public API)
+ *
+ * @param[in] sym the symbol (an entry of this table)
+ *
+ * @returns the symbol with its runtime address, size and demangled name
+ *
+ * @throws std::bad_alloc
+ */
+symbol symtab::view(const symbol_t *sym) const
+{
+	return symbol(addr(sym), name(sym), sym->size);
 }
 
 }
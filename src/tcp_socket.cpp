@@ -9,10 +9,30 @@
 
 namespace instrument {
 
+/**
+ * @brief Set a TCP level boolean option of a socket
+ *
+ * @param[in] fd the socket descriptor
+ *
+ * @param[in] nm the option name (TCP_NODELAY, TCP_CORK e.t.c)
+ *
+ * @param[in] how the option value
+ *
+ * @returns 0 on success, -1 otherwise (errno is set)
+ */
+i32 tcp_socket::set_tcp_option(i32 fd, i32 nm, bool how)
+{
+	i32 val = how;
+	return setsockopt(fd, IPPROTO_TCP, nm, &val, sizeof(val));
+}
+
+
 /**
  * @brief Object constructor
  *
- * @param[in] addr the peer (server) IP address (localhost if NULL is passed)
+ * @param[in] addr
+ *	the peer (server) IPv4 or IPv6 address, host name or Unix domain socket
+ *	path (localhost if NULL is passed)
  *
  * @param[in] port the peer TCP port
  *
@@ -22,7 +42,12 @@ tcp_socket::tcp_socket(const i8 *addr, i32 port)
 try:
 stream(),
 m_address(NULL),
-m_port(port)
+m_port(port),
+m_timeout(g_idp_timeout_ms),
+m_retry(0),
+m_reconnect(false),
+m_nodelay(false),
+m_cork(false)
 {
 	if ( unlikely(addr == NULL || strlen(addr) == 0) ) {
 		addr = "127.0.0.1";
@@ -32,8 +57,7 @@ m_port(port)
 	strcpy(m_address, addr);
 }
 catch (...) {
-	delete[] m_data;
-	m_data = NULL;
+	release();
 	m_address = NULL;
 }
 
@@ -50,7 +74,12 @@ tcp_socket::tcp_socket(const tcp_socket &src)
 try:
 stream(src),
 m_address(NULL),
-m_port(src.m_port)
+m_port(src.m_port),
+m_timeout(src.m_timeout),
+m_retry(0),
+m_reconnect(src.m_reconnect),
+m_nodelay(src.m_nodelay),
+m_cork(src.m_cork)
 {
 	m_address = new i8[strlen(src.m_address) + 1];
 	strcpy(m_address, src.m_address);
@@ -58,8 +87,7 @@ m_port(src.m_port)
 catch (...) {
 	close();
 
-	delete[] m_data;
-	m_data = NULL;
+	release();
 	m_address = NULL;
 }
 
@@ -121,6 +149,91 @@ inline i32 tcp_socket::port() const
 }
 
 
+/**
+ * @brief Enable/disable the TCP_CORK option (partial frames are held back while corked)
+ *
+ * @param[in] how true to cork, false to uncork (sends the held back data)
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ *
+ * @note The option is ignored for Unix domain sockets, it's restored upon reconnection
+ */
+tcp_socket& tcp_socket::set_cork(bool how)
+{
+	m_cork = how;
+	if ( unlikely(m_handle >= 0 && !is_local() && set_tcp_option(m_handle, TCP_CORK, how) < 0) ) {
+		throw exception("failed to set TCP_CORK (errno %d - %s)", errno, strerror(errno));
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Enable/disable the TCP_NODELAY option (no Nagle algorithm)
+ *
+ * @param[in] how true to send small segments at once, false to coalesce them
+ *
+ * @returns *this
+ *
+ * @throws instrument::exception
+ *
+ * @note The option is ignored for Unix domain sockets, it's restored upon reconnection
+ */
+tcp_socket& tcp_socket::set_nodelay(bool how)
+{
+	m_nodelay = how;
+	if ( unlikely(m_handle >= 0 && !is_local() && set_tcp_option(m_handle, TCP_NODELAY, how) < 0) ) {
+		throw exception("failed to set TCP_NODELAY (errno %d - %s)", errno, strerror(errno));
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Enable/disable background reconnection
+ *
+ * @param[in] how true to reconnect when an asynchronous send fails, false to report the failure
+ *
+ * @returns *this
+ *
+ * @note Synchronous output always reports failures
+ */
+inline tcp_socket& tcp_socket::set_reconnect(bool how)
+{
+	m_reconnect = how;
+	return *this;
+}
+
+
+/**
+ * @brief Set the connection timeout
+ *
+ * @param[in] ms the timeout in milliseconds (0 for the default)
+ *
+ * @returns *this
+ */
+inline tcp_socket& tcp_socket::set_timeout(u32 ms)
+{
+	m_timeout = (likely(ms > 0)) ? ms : g_idp_timeout_ms;
+	return *this;
+}
+
+
+/**
+ * @brief Get the connection timeout
+ *
+ * @returns this->m_timeout
+ */
+inline u32 tcp_socket::timeout() const
+{
+	return m_timeout;
+}
+
+
 /**
  * @brief Assignment operator
  *
@@ -149,15 +262,197 @@ tcp_socket& tcp_socket::operator=(const tcp_socket &rval)
 
 	strcpy(m_address, rval.m_address);
 	m_port = rval.m_port;
+	m_timeout = rval.m_timeout;
+	m_reconnect = rval.m_reconnect;
+	m_nodelay = rval.m_nodelay;
+	m_cork = rval.m_cork;
 	return *this;
 }
 
 
+/**
+ * @brief Connect a new socket to the peer
+ *
+ * @returns the connected socket descriptor or -1 (errno is set)
+ *
+ * @note
+ *	Each address of the peer is tried in turn. A connection attempt doesn't
+ *	block for longer than the timeout, the descriptor blocks once connected
+ */
+i32 tcp_socket::dial() const
+{
+	unix_addr_t local;
+	struct addrinfo hints, *addrs = NULL, unix_info;
+
+	if ( unlikely(is_local()) ) {
+		if ( unlikely(strlen(m_address) >= sizeof(local.sun_path)) ) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+
+		memset(&local, 0, sizeof(local));
+		local.sun_family = AF_UNIX;
+		strcpy(local.sun_path, m_address);
+
+		memset(&unix_info, 0, sizeof(unix_info));
+		unix_info.ai_family = AF_UNIX;
+		unix_info.ai_socktype = SOCK_STREAM;
+		unix_info.ai_addr = reinterpret_cast<ip_addr_t*> (&local);
+		unix_info.ai_addrlen = sizeof(local);
+	}
+	else {
+		i8 port[16];
+		sprintf(port, "%d", m_port);
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+
+		i32 err = getaddrinfo(m_address, port, &hints, &addrs);
+		if ( unlikely(err != 0) ) {
+			errno = (err == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+			return -1;
+		}
+	}
+
+	i32 retval = -1;
+	for (struct addrinfo *ai = (likely(addrs != NULL)) ? addrs : &unix_info; likely(ai != NULL); ai = ai->ai_next) {
+		retval = socket(ai->ai_family, SOCK_STREAM, 0);
+		if ( unlikely(retval < 0) ) {
+			continue;
+		}
+
+		/* Connect without blocking, up to the timeout */
+		i32 flags = fcntl(retval, F_GETFL);
+		fcntl(retval, F_SETFL, flags | O_NONBLOCK);
+
+		i32 err = 0;
+		if ( unlikely(connect(retval, ai->ai_addr, ai->ai_addrlen) < 0) ) {
+			err = errno;
+			if ( likely(err == EINPROGRESS || err == EAGAIN) ) {
+				struct pollfd pfd;
+				pfd.fd = retval;
+				pfd.events = POLLOUT;
+
+				i32 ready;
+				do {
+					ready = poll(&pfd, 1, m_timeout);
+				}
+				while ( unlikely(ready < 0 && errno == EINTR) );
+
+				socklen_t len = sizeof(err);
+				err = ETIMEDOUT;
+				if ( likely(ready > 0) ) {
+					getsockopt(retval, SOL_SOCKET, SO_ERROR, &err, &len);
+				}
+			}
+		}
+
+		if ( likely(err == 0) ) {
+			fcntl(retval, F_SETFL, flags);
+
+			if ( likely(ai->ai_family != AF_UNIX) ) {
+				set_tcp_option(retval, TCP_NODELAY, m_nodelay);
+				set_tcp_option(retval, TCP_CORK, m_cork);
+			}
+
+			break;
+		}
+
+		::close(retval);
+		retval = -1;
+		errno = err;
+	}
+
+	if ( likely(addrs != NULL) ) {
+		i32 err = errno;
+		freeaddrinfo(addrs);
+		errno = err;
+	}
+
+	return retval;
+}
+
+
+/**
+ * @brief Send data using scatter/gather I/O
+ *
+ * @param[in] iov the data segments
+ *
+ * @param[in] cnt the segment count (at most IOV_MAX)
+ *
+ * @returns the sent byte count or -1 (errno is set)
+ *
+ * @note A dead peer fails the send with EPIPE, no SIGPIPE is raised
+ */
+i32 tcp_socket::emit(const struct iovec *iov, u32 cnt)
+{
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = const_cast<struct iovec*> (iov);
+	msg.msg_iovlen = cnt;
+
+	return sendmsg(m_handle, &msg, MSG_NOSIGNAL);
+}
+
+
+/**
+ * @brief Check if the peer is a Unix domain socket
+ *
+ * @returns true if the peer address is an absolute path, false otherwise
+ */
+inline bool tcp_socket::is_local() const
+{
+	return m_address[0] == '/';
+}
+
+
+/**
+ * @brief Reconnect after a failed asynchronous send (called by the writer thread)
+ *
+ * @param[in] err the send error (errno)
+ *
+ * @returns true if the output goes on (the failed data is dropped), false to report the error
+ *
+ * @note
+ *	The new connection replaces the failed one under the same descriptor, so
+ *	the producers never see the descriptor change. While the peer is down,
+ *	a reconnection is attempted at most once every g_idp_retry_ms milliseconds
+ */
+bool tcp_socket::recover(i32 err)
+{
+	if ( unlikely(!m_reconnect || m_handle < 0) ) {
+		return false;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	u64 ms = static_cast<u64> (now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+	if ( likely(ms < m_retry) ) {
+		return true;
+	}
+
+	m_retry = ms + g_idp_retry_ms;
+
+	i32 fd = dial();
+	if ( unlikely(fd < 0) ) {
+		return true;
+	}
+
+	dup2(fd, m_handle);
+	::close(fd);
+	m_retry = ms;
+	return true;
+}
+
+
 /**
  * @brief Flush the buffered data to the socket
  *
  * @returns *this
  *
+ * @throws std::bad_alloc
  * @throws instrument::exception
  */
 tcp_socket& tcp_socket::flush()
@@ -195,35 +490,10 @@ tcp_socket& tcp_socket::open()
 		close();
 	}
 
-	/* Create the stream socket */
-	m_handle = socket(AF_INET, SOCK_STREAM, 0);
+	m_handle = dial();
 	if ( unlikely(m_handle < 0) ) {
 		throw exception(
-			"failed to create stream socket (errno %d - %s)",
-			errno,
-			strerror(errno)
-		);
-	}
-
-	tcp_addr_t addr;
-	util::memset(&addr, 0, sizeof(tcp_addr_t));
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(m_port);
-	addr.sin_addr.s_addr = inet_addr(m_address);
-
-	/* Connect the socket to its peer */
-	ip_addr_t *ip = reinterpret_cast<ip_addr_t*> (&addr);
-	i32 retval;
-	do {
-		retval = connect(m_handle, ip, sizeof(tcp_addr_t));
-	}
-	while ( unlikely(retval < 0 && (errno == EINTR || errno == EAGAIN)) );
-
-	if ( unlikely(retval < 0) ) {
-		close();
-
-		throw exception(
-			"failed to connect TCP/IP socket @ %s:%d (errno %d - %s)",
+			"failed to connect socket @ %s:%d (errno %d - %s)",
 			m_address,
 			m_port,
 			errno,
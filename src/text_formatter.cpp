@@ -0,0 +1,207 @@
+#include "../include/text_formatter.hpp"
+
+/**
+	@file src/text_formatter.cpp
+
+	@brief Class instrument::text_formatter method implementation
+*/
+
+namespace instrument {
+
+/**
+ * @brief Object constructor
+ */
+text_formatter::text_formatter():
+formatter()
+{
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ */
+text_formatter::text_formatter(const text_formatter &src):
+formatter()
+{
+}
+
+
+/**
+ * @brief Object destructor
+ */
+text_formatter::~text_formatter()
+{
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @returns the object copy (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+inline text_formatter* text_formatter::clone() const
+{
+	return new text_formatter(*this);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @returns *this
+ */
+inline text_formatter& text_formatter::operator=(const text_formatter &rval)
+{
+	return *this;
+}
+
+
+/**
+ * @brief Append the opening line of a trace
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[in] nm the thread name
+ *
+ * @param[in] depth the frame count
+ *
+ * @param[in] sig the trace signature (0 if not deduplicating)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+text_formatter& text_formatter::begin_trace(string &dst, pthread_t id, const i8 *nm, u32 depth, u64 sig)
+{
+	dst.concat("at '", 4);
+	dst.concat(nm, strlen(nm));
+	dst.concat("' thread (0x", 12);
+	hex(dst, id);
+
+	if ( unlikely(sig != 0) ) {
+		dst.concat(") signature ", 12);
+		hex(dst, sig, 16);
+		dst.concat(" {\r\n", 4);
+	}
+	else {
+		dst.concat(") {\r\n", 5);
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief Append the closing line of a trace
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] dropped the calls past the maximum depth (a '  ... N calls dropped' line if any)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+text_formatter& text_formatter::end_trace(string &dst, u32 dropped)
+{
+	if ( unlikely(dropped > 0) ) {
+		dst.concat("  ... ", 6);
+		decimal(dst, dropped);
+		dst.concat(" calls dropped\r\n", 16);
+	}
+
+	dst.concat("}\r\n", 3);
+	return *this;
+}
+
+
+/**
+ * @brief Append a frame line
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] fn the called function address (unused)
+ *
+ * @param[in] site the call site address (unused)
+ *
+ * @param[in] sym the function name (NULL if unresolved)
+ *
+ * @param[in] line the call site source file and line (NULL if unknown)
+ *
+ * @param[in] repeats the folded calls of the frame (shown as ' ×N' if more than 1)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note Unresolved functions are included only if WITH_UNRESOLVED is defined
+ */
+text_formatter& text_formatter::frame(string &dst, mem_addr_t fn, mem_addr_t site, const i8 *sym, const i8 *line, u32 repeats)
+{
+	if ( likely(sym != NULL) ) {
+		dst.concat("  at ", 5);
+		dst.concat(sym, strlen(sym));
+	}
+	else {
+#ifdef WITH_UNRESOLVED
+		dst.concat("  at UNRESOLVED", 15);
+#endif
+	}
+
+	if ( likely(line != NULL) ) {
+		dst.concat(" (", 2);
+		dst.concat(line, strlen(line));
+		dst.concat(")", 1);
+	}
+
+	/* U+00D7 (multiplication sign), UTF-8 encoded */
+	if ( unlikely(repeats > 1) ) {
+		dst.concat(" \xc3\x97", 3);
+		decimal(dst, repeats);
+	}
+
+	dst.concat("\r\n", 2);
+	return *this;
+}
+
+
+/**
+ * @brief Append the line of a deduplicated trace repeat
+ *
+ * @param[in,out] dst the destination string
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[in] nm the thread name
+ *
+ * @param[in] sig the trace signature
+ *
+ * @param[in] n the repeat count
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+text_formatter& text_formatter::repeat(string &dst, pthread_t id, const i8 *nm, u64 sig, u32 n)
+{
+	dst.concat("at '", 4);
+	dst.concat(nm, strlen(nm));
+	dst.concat("' thread (0x", 12);
+	hex(dst, id);
+	dst.concat(") signature ", 12);
+	hex(dst, sig, 16);
+	dst.concat(" repeated ", 10);
+	decimal(dst, n);
+	dst.concat(" times\r\n", 8);
+	return *this;
+}
+
+}
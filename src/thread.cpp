@@ -8,6 +8,9 @@
 
 namespace instrument {
 
+u64 thread::s_serials = 0;
+
+
 /**
  * @brief Attach (register) this thread to the running process
  *
@@ -37,6 +40,42 @@ inline thread& thread::detach_from_process()
 }
 
 
+/**
+ * @brief Move the call tracking state of the thread to a context and load another one
+ *
+ * @param[in,out] prev the context that receives the current state (it's suspended next)
+ *
+ * @param[in,out] next the context whose state is loaded (it's active)
+ *
+ * @returns *this
+ *
+ * @note
+ *	Only pointers and counters are moved, in O(1). An active context holds
+ *	none of them, its state is the state of its thread
+ */
+thread& thread::exchange(context *prev, context *next)
+{
+	prev->m_stack = m_stack;
+	prev->m_lag = m_lag;
+	prev->m_sampled = m_sampled;
+	prev->m_sampled_slots = m_sampled_slots;
+	prev->m_depth = m_depth;
+
+	m_stack = next->m_stack;
+	m_lag = next->m_lag;
+	m_sampled = next->m_sampled;
+	m_sampled_slots = next->m_sampled_slots;
+	m_depth = next->m_depth;
+
+	next->m_stack = NULL;
+	next->m_lag = 0;
+	next->m_sampled = NULL;
+	next->m_sampled_slots = 0;
+	next->m_depth = 0;
+	return *this;
+}
+
+
 /**
  * @brief Spawn a new, instrumented and named thread
  *
@@ -93,18 +132,33 @@ thread* thread::fork(	const i8 *nm, thread_main_t entry, thread_arg_t arg)
  */
 thread::thread(const i8 *nm)
 try:
+m_serial(fetch_add(&s_serials, 1)),
+m_lock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP),
 m_handle(pthread_self()),
 m_lag(0),
+m_uncaught(0),
 m_name(NULL),
 m_stack(NULL),
-m_status(THREAD_INIT)
+m_seq(0),
+m_status(THREAD_INIT),
+m_ticks(NULL),
+m_sampled(NULL),
+m_sampled_slots(0),
+m_depth(0),
+m_recorder(NULL),
+m_slot(0),
+m_tracing(0),
+m_period(0),
+m_plugin_mask(~0U),
+m_active(NULL),
+m_home(NULL)
 {
 	if ( unlikely(nm != NULL) ) {
 		m_name = new i8[strlen(nm) + 1];
 		strcpy(m_name, nm);
 	}
 
-	m_stack = new stack<call>;
+	m_stack = new shadow_stack;
 }
 catch (...) {
 	delete[] m_name;
@@ -124,11 +178,26 @@ catch (...) {
  */
 thread::thread(pthread_t id, const i8 *nm)
 try:
+m_serial(fetch_add(&s_serials, 1)),
+m_lock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP),
 m_handle(id),
 m_lag(0),
+m_uncaught(0),
 m_name(NULL),
 m_stack(NULL),
-m_status(THREAD_INIT)
+m_seq(0),
+m_status(THREAD_INIT),
+m_ticks(NULL),
+m_sampled(NULL),
+m_sampled_slots(0),
+m_depth(0),
+m_recorder(NULL),
+m_slot(0),
+m_tracing(0),
+m_period(0),
+m_plugin_mask(~0U),
+m_active(NULL),
+m_home(NULL)
 {
 	if ( unlikely(nm == NULL) ) {
 		throw exception("invalid argument: nm (=%p)", nm);
@@ -136,7 +205,7 @@ m_status(THREAD_INIT)
 
 	m_name = new i8[strlen(nm) + 1];
 	strcpy(m_name, nm);
-	m_stack = new stack<call>;
+	m_stack = new shadow_stack;
 }
 catch (...) {
 	delete[] m_name;
@@ -153,11 +222,26 @@ catch (...) {
  */
 thread::thread(const thread &src)
 try:
+m_serial(fetch_add(&s_serials, 1)),
+m_lock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP),
 m_handle(src.m_handle),
 m_lag(src.m_lag),
+m_uncaught(src.m_uncaught),
 m_name(NULL),
 m_stack(NULL),
-m_status(src.m_status)
+m_seq(0),
+m_status(src.m_status),
+m_ticks(NULL),
+m_sampled(NULL),
+m_sampled_slots(0),
+m_depth(0),
+m_recorder(NULL),
+m_slot(src.m_slot),
+m_tracing(0),
+m_period(0),
+m_plugin_mask(~0U),
+m_active(NULL),
+m_home(NULL)
 {
 	const i8 *nm = src.m_name;
 	if ( unlikely(nm != NULL) ) {
@@ -165,9 +249,17 @@ m_status(src.m_status)
 		strcpy(m_name, nm);
 	}
 
-	m_stack = src.m_stack->clone();
-}
+	src.lock();
 
+	try {
+		m_stack = src.m_stack->clone();
+		src.unlock();
+	}
+	catch (...) {
+		src.unlock();
+		throw;
+	}
+}
 catch (...) {
 	delete[] m_name;
 	m_name = NULL;
@@ -176,13 +268,33 @@ catch (...) {
 
 /**
  * @brief Object destructor
+ *
+ * @note The running context is suspended, the stack of the thread itself is disposed
  */
 thread::~thread()
 {
+	if ( unlikely(m_active != NULL) ) {
+		exchange(m_active, m_home);
+		m_active->suspend();
+		m_active = NULL;
+	}
+
+	/* The home context is disposed while active (empty), so it's never pinned */
+	if ( unlikely(m_home != NULL) ) {
+		delete m_home;
+		m_home = NULL;
+	}
+
 	delete[] m_name;
 	delete m_stack;
+	delete[] m_ticks;
+	delete[] m_sampled;
+	delete m_recorder;
 	m_name = NULL;
 	m_stack = NULL;
+	m_ticks = NULL;
+	m_sampled = NULL;
+	m_recorder = NULL;
 }
 
 
@@ -199,6 +311,43 @@ inline thread* thread::clone() const
 }
 
 
+/**
+ * @brief Get the running context
+ *
+ * @returns this->m_active (NULL if the thread runs its own stack)
+ */
+inline context* thread::active_context() const
+{
+	return m_active;
+}
+
+
+/**
+ * @brief Get the count of the calls past the maximum simulated stack depth
+ *
+ * @returns the calls that are counted, not stored (see shadow_stack::set_limit)
+ */
+inline u32 thread::dropped_calls() const
+{
+	return m_stack->dropped();
+}
+
+
+/**
+ * @brief Get the flight recorder
+ *
+ * @returns this->m_recorder (NULL if the thread didn't record any event)
+ *
+ * @note
+ *	Any thread may read the recorder (see recorder::snapshot). It's released
+ *	with the thread, so readers should hold the tracer lock
+ */
+inline recorder* thread::get_recorder() const
+{
+	return load_acquire(&m_recorder);
+}
+
+
 /**
  * @brief Get the thread handle
  *
@@ -264,6 +413,58 @@ thread& thread::set_name(const i8 *nm)
 }
 
 
+/**
+ * @brief Get the plugin mask applied from the control block
+ *
+ * @returns this->m_plugin_mask (bit i dispatches plugin i)
+ */
+inline u32 thread::plugin_mask() const
+{
+	return m_plugin_mask;
+}
+
+
+/**
+ * @brief Get the call sampling period applied from the control block
+ *
+ * @returns this->m_period (0 if call sampling is off)
+ */
+inline u32 thread::sample_period() const
+{
+	return m_period;
+}
+
+
+/**
+ * @brief Get the simulated call stack sequence
+ *
+ * @returns this->m_seq (odd while the stack is modified)
+ *
+ * @note
+ *	The sequence changes whenever the stack does (a call, a return, a context
+ *	switch or a resync), so two equal even sequences stand for identical stacks
+ */
+inline u32 thread::sequence() const
+{
+	return load_acquire(&m_seq);
+}
+
+
+/**
+ * @brief Get the serial number
+ *
+ * @returns this->m_serial (never 0)
+ *
+ * @note
+ *	Thread IDs are reused after a thread is joined, a serial number tells the
+ *	threads apart (see tracer::dump(encoder&, stack_delta&) const)
+ */
+inline u64 thread::serial() const
+{
+	return m_serial;
+}
+
+
 /**
  * @brief Get the thread status
  *
@@ -275,6 +476,17 @@ inline thread_status_t thread::status() const
 }
 
 
+/**
+ * @brief Get the applied control block tracing word
+ *
+ * @returns this->m_tracing (0 if no generation was applied)
+ */
+inline u32 thread::tracing() const
+{
+	return m_tracing;
+}
+
+
 /**
  * @brief Assignment operator
  *
@@ -290,10 +502,27 @@ thread& thread::operator=(const thread &rval)
 		return *this;
 	}
 
-	*m_stack = *rval.m_stack;
-	m_handle = rval.m_handle;
-	m_lag = rval.m_lag;
-	m_status = rval.m_status;
+	rval.lock();
+	lock();
+
+	try {
+		store_relaxed(&m_seq, m_seq + 1);
+		store_barrier();
+		*m_stack = *rval.m_stack;
+		store_release(&m_seq, m_seq + 1);
+		m_handle = rval.m_handle;
+		m_lag = rval.m_lag;
+		m_uncaught = rval.m_uncaught;
+		m_status = rval.m_status;
+
+		unlock();
+		rval.unlock();
+	}
+	catch (...) {
+		unlock();
+		rval.unlock();
+		throw;
+	}
 
 	return set_name(rval.m_name);
 }
@@ -304,26 +533,56 @@ thread& thread::operator=(const thread &rval)
  *
  * @param[in] i the backtrace offset
  *
- * @returns the i-th function call
+ * @returns the i-th frame of the simulated call stack
  *
  * @throws instrument::exception
  */
-inline const call* thread::operator[](u32 i) const
+inline const frame_t* thread::operator[](u32 i) const
 {
 	return backtrace(i);
 }
 
 
+/**
+ * @brief Obtain access to the simulated call stack
+ *
+ * @returns *this
+ *
+ * @note
+ *	The simulated call stack of a thread must be locked while it's read from
+ *	another thread
+ */
+inline thread& thread::lock() const
+{
+	lock_mutex(const_cast<pthread_mutex_t*> (&m_lock));
+	return const_cast<thread&> (*this);
+}
+
+
+/**
+ * @brief Yield access to the simulated call stack
+ *
+ * @returns *this
+ */
+inline thread& thread::unlock() const
+{
+	pthread_mutex_unlock(const_cast<pthread_mutex_t*> (&m_lock));
+	return const_cast<thread&> (*this);
+}
+
+
 /**
  * @brief Peek at the simulated call stack
  *
- * @param[in] i the offset
+ * @param[in] i the offset (0 is the most recent call)
  *
- * @returns the i-th function call
+ * @returns the i-th frame of the simulated call stack
  *
  * @throws instrument::exception
+ *
+ * @note The access is O(1)
  */
-inline const call* thread::backtrace(u32 i) const
+inline const frame_t* thread::backtrace(u32 i) const
 {
 	return m_stack->peek(i);
 }
@@ -347,35 +606,53 @@ inline u32 thread::call_depth() const
  *
  * @param[in] site the call site address
  *
- * @param[in] nm the function name (can be NULL)
- *
  * @returns *this
  *
  * @throws std::bad_alloc
  */
-thread& thread::called(mem_addr_t addr, mem_addr_t site, const i8 *nm)
+thread& thread::called(mem_addr_t addr, mem_addr_t site)
 {
+	/* The call graph follows the real calls, even while unwinding */
+	callgraph::called(addr);
+
 	/*
 	 * If the function is called while an exception is unwinding the stack, keep
 	 * track of the call depth difference between the simulated and the real call
 	 * stack (the 'lag')
 	 */
-	if ( unlikely(std::uncaught_exception()) ) {
+	if ( unlikely(m_uncaught > 0) ) {
 		m_lag--;
 		return *this;
 	}
 
-	call *c = NULL;
+	/* Readers don't modify the chunk directory, the thread locks itself if it grows */
+	bool grows = unlikely(m_stack->size() >= m_stack->capacity());
+	if ( unlikely(grows) ) {
+		lock();
+	}
+
+	store_relaxed(&m_seq, m_seq + 1);
+	store_barrier();
+
 	try {
-		c = new call(addr, site, nm);
-		m_stack->push(c);
+		m_stack->push(addr, site);
 		m_status = THREAD_START;
-		return *this;
 	}
 	catch (...) {
-		delete c;
+		store_release(&m_seq, m_seq + 1);
+		if ( unlikely(grows) ) {
+			unlock();
+		}
+
 		throw;
 	}
+
+	store_release(&m_seq, m_seq + 1);
+	if ( unlikely(grows) ) {
+		unlock();
+	}
+
+	return *this;
 }
 
 
@@ -393,6 +670,26 @@ inline thread& thread::cancel()
 }
 
 
+/**
+ * @brief Count an exception caught by a handler of the thread
+ *
+ * @returns *this
+ *
+ * @note
+ *	The exceptions not counted by thread::thrown (e.g foreign exceptions or
+ *	exceptions thrown before the thread was tracked) are ignored. Only the
+ *	thread itself may call this method
+ */
+inline thread& thread::caught()
+{
+	if ( likely(m_uncaught > 0) ) {
+		m_uncaught--;
+	}
+
+	return *this;
+}
+
+
 /**
  * @brief Traverse the simulated stack with a callback for each call
  *
@@ -407,6 +704,48 @@ inline thread& thread::each(const callback_t pfunc) const
 }
 
 
+/**
+ * @brief Find the simulated frame of a call, counting the folded and the dropped calls
+ *
+ * @param[in] calls the call offset (0 is the most recent call, e.g the lag)
+ *
+ * @param[out] repeats the calls of the frame up to the offset (0 if the call was dropped)
+ *
+ * @returns
+ *	the frame offset (see thread::backtrace) or -1 if the call is past the
+ *	maximum depth. An offset beyond the stack bottom (e.g in call sampling mode)
+ *	yields the outermost frame with all its calls
+ */
+i32 thread::frame_of(u32 calls, u32 &repeats) const
+{
+	repeats = 0;
+
+	u32 dropped = m_stack->dropped();
+	if ( unlikely(calls < dropped) ) {
+		return -1;
+	}
+
+	calls -= dropped;
+	u32 sz = m_stack->size();
+	for (u32 i = 0; likely(i < sz); i++) {
+		u32 n = m_stack->peek(i)->repeats;
+		if ( likely(calls < n) ) {
+			repeats = calls + 1;
+			return i;
+		}
+
+		calls -= n;
+	}
+
+	if ( unlikely(sz == 0) ) {
+		return -1;
+	}
+
+	repeats = m_stack->peek(sz - 1)->repeats;
+	return sz - 1;
+}
+
+
 /**
  * @brief Check if this thread ID matches the argument (pthread) ID
  *
@@ -491,31 +830,338 @@ thread& thread::join(void *exit_status)
 }
 
 
+/**
+ * @brief Record a function entry or exit event in the flight recorder
+ *
+ * @param[in] kind the event kind (RECORD_ENTER or RECORD_EXIT)
+ *
+ * @param[in] fn the function address
+ *
+ * @param[in] site the call site address
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	NO-OP if recording is off. The recorder is allocated upon the first event,
+ *	then recording doesn't allocate memory. Only the thread itself may call this
+ *	method, it doesn't lock the thread
+ */
+thread& thread::record(u32 kind, mem_addr_t fn, mem_addr_t site)
+{
+	recorder *rec = m_recorder;
+	if ( unlikely(rec == NULL) ) {
+		u32 slots = recorder::slots();
+		if ( likely(slots == 0) ) {
+			return *this;
+		}
+
+		rec = new recorder(slots);
+		store_release(&m_recorder, rec);
+	}
+
+	rec->record(kind, fn, site);
+	return *this;
+}
+
+
 /**
  * @brief Simulate a function return
  *
  * @returns *this
  *
  * @throws Detect return from thread entry point (thread exit)
+ *
+ * @note
+ *	While an exception propagates, the top frame timestamp (frame_t::stamp) is
+ *	cleared, so the timing plugins count an unwound frame once
  */
 thread& thread::returned()
 {
+	callgraph::returned();
+
 	/*
 	 * If the function returned because an exception is propagating, unwinding the
 	 * stack, keep track of the call depth difference between the simulated and
 	 * the real call stack (the 'lag')
 	 */
-	if ( unlikely(std::uncaught_exception()) ) {
+	if ( unlikely(m_uncaught > 0) ) {
+		/* The exit plugins ran, the stamp is cleared so the frame is timed once */
+		frame_t *f = m_stack->top();
+		if ( likely(f != NULL) ) {
+			f->stamp = 0;
+		}
+
 		m_lag++;
+		return *this;
+	}
+
+	store_relaxed(&m_seq, m_seq + 1);
+	store_barrier();
+	m_stack->pop();
+	store_release(&m_seq, m_seq + 1);
+	return *this;
+}
+
+
+/**
+ * @brief Apply a new control block generation, starting over the simulated stack
+ *
+ * @param[in] word the tracing word (see control::tracing)
+ *
+ * @returns *this
+ *
+ * @note
+ *	The calls entered before (or while tracing was off) are not on the new
+ *	simulated stack, they return while it's empty and their returns are skipped
+ *	(see __cyg_profile_func_exit). Only the thread itself may call this method
+ */
+thread& thread::resync(u32 word)
+{
+	store_relaxed(&m_seq, m_seq + 1);
+	store_barrier();
+	m_stack->clear();
+	m_lag = 0;
+	store_release(&m_seq, m_seq + 1);
+
+	callgraph::rewind();
+	m_depth = 0;
+	m_period = control::sample_period();
+	m_plugin_mask = control::plugin_mask();
+	m_tracing = word;
+	return *this;
+}
+
+
+/**
+ * @brief Decide if a call is simulated, in call sampling mode
+ *
+ * @param[in] addr the called function address
+ *
+ * @param[in] period the sampling period (N, for 1 out of N calls)
+ *
+ * @returns true if the call must be simulated, false otherwise
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	Calls are counted per function address hash, so each function is sampled
+ *	independently. The decision is kept at the real call depth, in a bitmap, so
+ *	thread::sampled_return knows if the returning call was simulated. Only the
+ *	thread itself may call this method, it doesn't lock the thread
+ */
+bool thread::sampled_call(mem_addr_t addr, u32 period)
+{
+	if ( unlikely(m_ticks == NULL) ) {
+		m_ticks = new u32[g_sample_buckets];
+		memset(m_ticks, 0, g_sample_buckets * sizeof(u32));
+	}
+
+	u32 &tick = m_ticks[((addr >> 4) ^ (addr >> 12)) & (g_sample_buckets - 1)];
+	bool retval = (++tick >= period);
+	if ( unlikely(retval) ) {
+		tick = 0;
+	}
+
+	u32 word = m_depth / 64;
+	if ( unlikely(word >= m_sampled_slots) ) {
+		u32 slots = (likely(m_sampled_slots > 0)) ? 2 * m_sampled_slots : 4;
+		u64 *sampled = new u64[slots];
+		memcpy(sampled, m_sampled, m_sampled_slots * sizeof(u64));
+
+		delete[] m_sampled;
+		m_sampled = sampled;
+		m_sampled_slots = slots;
+	}
+
+	u64 bit = 1ULL << (m_depth % 64);
+	if ( unlikely(retval) ) {
+		m_sampled[word] |= bit;
 	}
 	else {
-		m_stack->pop();
+		m_sampled[word] &= ~bit;
+	}
+
+	m_depth++;
+	return retval;
+}
+
+
+/**
+ * @brief Check if a returning call was simulated, in call sampling mode
+ *
+ * @returns true if the call was simulated, false otherwise
+ *
+ * @note
+ *	Calls that were entered before any sampled call are considered simulated.
+ *	Only the thread itself may call this method, it doesn't lock the thread
+ */
+bool thread::sampled_return()
+{
+	if ( unlikely(m_depth == 0) ) {
+		return true;
+	}
+
+	m_depth--;
+	return (m_sampled[m_depth / 64] >> (m_depth % 64)) & 1;
+}
+
+
+/**
+ * @brief Copy a consistent snapshot of the most recent simulated frames
+ *
+ * @param[out] dst the destination array (bottom to top)
+ *
+ * @param[in] max the destination array size
+ *
+ * @param[out] depth the call depth at the snapshot (can exceed the copied count)
+ *
+ * @param[out] dropped the calls past the maximum depth at the snapshot (can be NULL)
+ *
+ * @param[out] seq the stack sequence the copy is consistent with (can be NULL)
+ *
+ * @returns the copied frame count, dst[0] is the outermost copied frame
+ *
+ * @note
+ *	Any thread may take a snapshot, the thread is locked only to keep its stack
+ *	from growing while the frames are copied. The copy is repeated if the stack
+ *	was modified meanwhile, it's never blocked by the thread. The snapshot of
+ *	the current thread (e.g from a signal handler) is not validated
+ */
+u32 thread::snapshot(frame_t *dst, u32 max, u32 &depth, u32 *dropped, u32 *seq) const
+{
+	if ( unlikely(is_current()) ) {
+		depth = m_stack->size();
+		if ( unlikely(dropped != NULL) ) {
+			*dropped = m_stack->dropped();
+		}
+
+		if ( unlikely(seq != NULL) ) {
+			*seq = m_seq;
+		}
+
+		return m_stack->snapshot(dst, max);
+	}
+
+	lock();
+
+	u32 retval;
+	while ( true ) {
+		u32 cur = load_acquire(&m_seq);
+		if ( unlikely(cur & 1) ) {
+			sched_yield();
+			continue;
+		}
+
+		depth = m_stack->size();
+		retval = m_stack->snapshot(dst, max);
+		if ( unlikely(dropped != NULL) ) {
+			*dropped = m_stack->dropped();
+		}
+
+		/* The frames are copied before the sequence is read again */
+		load_barrier();
+		if ( likely(load_relaxed(&m_seq) == cur) ) {
+			if ( unlikely(seq != NULL) ) {
+				*seq = cur;
+			}
+
+			break;
+		}
 	}
 
+	unlock();
+	return retval;
+}
+
+
+/**
+ * @brief Switch the context running on the thread (e.g along with a fiber switch)
+ *
+ * @param[in] to the resumed context (NULL to resume the stack of the thread itself)
+ *
+ * @returns the suspended context (NULL if it was the stack of the thread itself)
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The simulated stack and the call tracking state are exchanged with the
+ *	ones of the contexts in O(1), under the stack sequence counter and the
+ *	thread lock (readers hold it while they copy the stack, see
+ *	thread::snapshot). The resumed context must be suspended, the call waits
+ *	while a reader copies its frames. The call graph cursor starts over from
+ *	the root. Only the thread itself may call this method
+ */
+context* thread::switch_context(context *to)
+{
+	context *from = m_active;
+	if ( unlikely(to == from) ) {
+		return from;
+	}
+
+	/* The home context is active (empty) as long as the thread runs its own stack */
+	if ( unlikely(m_home == NULL) ) {
+		m_home = new context((likely(m_name != NULL)) ? m_name : "anonymous");
+		m_home->resume(m_handle);
+		delete m_home->m_stack;
+		m_home->m_stack = NULL;
+	}
+
+	context *prev = (likely(from != NULL)) ? from : m_home;
+	context *next = (likely(to != NULL)) ? to : m_home;
+	next->resume(m_handle);
+
+	lock();
+	store_relaxed(&m_seq, m_seq + 1);
+	store_barrier();
+	exchange(prev, next);
+	m_active = to;
+	store_release(&m_seq, m_seq + 1);
+	unlock();
+
+	prev->suspend();
+	callgraph::rewind();
+	return from;
+}
+
+
+/**
+ * @brief Count an exception thrown (or rethrown) by the thread
+ *
+ * @returns *this
+ *
+ * @note
+ *	Until it's caught (see thread::caught), the calls and the returns of the
+ *	thread update the lag, the simulated stack is not modified. Only the thread
+ *	itself may call this method
+ */
+inline thread& thread::thrown()
+{
+	m_uncaught++;
 	return *this;
 }
 
 
+/**
+ * @brief Get a mutable simulated frame, for a plugin to annotate it
+ *
+ * @param[in] i the offset (0 is the executing function)
+ *
+ * @returns the i-th frame or NULL if the offset is out of stack bounds
+ *
+ * @note
+ *	Only the thread itself may call this method (e.g from a plugin callback)
+ *	and only the frame annotations (stamp and children) should be modified, the
+ *	thread is not locked
+ */
+inline frame_t* thread::top(u32 i)
+{
+	return m_stack->top(i);
+}
+
+
 /**
  * @brief Unwind the simulated call stack to meet the real call stack
  *
@@ -523,11 +1169,15 @@ thread& thread::returned()
  */
 thread& thread::unwind()
 {
+	store_relaxed(&m_seq, m_seq + 1);
+	store_barrier();
+
 	while ( likely(m_lag > 0) ) {
 		m_stack->pop();
 		m_lag--;
 	}
 
+	store_release(&m_seq, m_seq + 1);
 	return *this;
 }
 
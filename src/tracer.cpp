@@ -1,6 +1,12 @@
+#include "../include/text_formatter.hpp"
 #include "../include/tracer.hpp"
 #include "../include/util.hpp"
 
+#ifdef WITH_PLUGIN
+#include "../include/latency.hpp"
+#include "../include/slow_call.hpp"
+#endif
+
 /**
 	@file src/tracer.cpp
 
@@ -13,8 +19,64 @@ namespace instrument {
 
 tracer *tracer::s_iface = NULL;
 
+tracer_state_t tracer::s_state = TRACER_UNINITIALIZED;
+
 pthread_mutex_t tracer::s_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
+u8 tracer::s_symtab_mode = SYMTAB_EAGER;
+
+pthread_t tracer::s_loader = 0;
+
+u8 tracer::s_sampling = SAMPLING_OFF;
+
+u32 tracer::s_sample_period = 0;
+
+#ifdef WITH_SLEDS
+bool tracer::s_sleds = false;
+#endif
+
+pthread_t tracer::s_sampler = 0;
+
+u32 tracer::s_dedup_window = 0;
+
+tracer::dso_selection *tracer::s_selection = NULL;
+
+pthread_mutex_t tracer::s_scan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef WITH_FILTER
+const bool tracer::s_verdicts[2] = {false, true};
+#endif
+
+const tracer::hook_variant tracer::s_variants[HOOK_VARIANTS] = {
+	{0, enter_hook<0>, exit_hook<0>},
+	{HOOK_FILTERS, enter_hook<HOOK_FILTERS>, exit_hook<HOOK_FILTERS>},
+	{HOOK_PLUGINS, enter_hook<HOOK_PLUGINS>, exit_hook<HOOK_PLUGINS>},
+	{
+		HOOK_FILTERS | HOOK_PLUGINS,
+		enter_hook<HOOK_FILTERS | HOOK_PLUGINS>,
+		exit_hook<HOOK_FILTERS | HOOK_PLUGINS>
+	},
+	{HOOK_RECORDING, enter_hook<HOOK_RECORDING>, exit_hook<HOOK_RECORDING>},
+	{
+		HOOK_FILTERS | HOOK_RECORDING,
+		enter_hook<HOOK_FILTERS | HOOK_RECORDING>,
+		exit_hook<HOOK_FILTERS | HOOK_RECORDING>
+	},
+	{
+		HOOK_PLUGINS | HOOK_RECORDING,
+		enter_hook<HOOK_PLUGINS | HOOK_RECORDING>,
+		exit_hook<HOOK_PLUGINS | HOOK_RECORDING>
+	},
+	{
+		HOOK_FILTERS | HOOK_PLUGINS | HOOK_RECORDING,
+		enter_hook<HOOK_FILTERS | HOOK_PLUGINS | HOOK_RECORDING>,
+		exit_hook<HOOK_FILTERS | HOOK_PLUGINS | HOOK_RECORDING>
+	}
+};
+
+/* The hooks drop every call until the interface is created, no feature is served */
+const tracer::hook_variant *tracer::s_hooks = &tracer::s_variants[0];
+
 
 /* Link the instrumentation functions with C-style linking */
 
@@ -33,45 +95,12 @@ extern "C" {
  *
  * @param[in] call_site the address where the function was called
  *
- * @note If an exception occurs, the process exits
+ * @see tracer::on_enter
  */
 void __cyg_profile_func_enter(void *this_fn, void *call_site)
 {
-	tracer *iface = tracer::interface();
-
-	__D_ASSERT(this_fn != NULL);
-	__D_ASSERT(call_site != NULL);
-	__D_ASSERT(iface != NULL);
-	if ( unlikely(iface == NULL) ) {
-		return;
-	}
-
-#ifdef WITH_PLUGIN
-	iface->begin_plugins(this_fn, call_site);
-#endif
-
-	try {
-		mem_addr_t addr = reinterpret_cast<mem_addr_t> (this_fn);
-		mem_addr_t site = reinterpret_cast<mem_addr_t> (call_site);
-
-		tracer::lock();
-
-		iface->proc()
-				 ->current_thread()
-				 ->called(addr, site);
-
-		tracer::unlock();
-		return;
-	}
-	catch (exception &x) {
-		std::cerr << x;
-	}
-	catch (std::exception &x) {
-		std::cerr << x;
-	}
-
-	tracer::unlock();
-	exit(EXIT_FAILURE);
+	tracer::on_enter(this_fn, call_site,
+									 reinterpret_cast<mem_addr_t> (__builtin_return_address(0)));
 }
 
 
@@ -86,40 +115,116 @@ void __cyg_profile_func_enter(void *this_fn, void *call_site)
  *
  * @param[in] call_site the address that the program counter will return to
  *
- * @note If an exception occurs, the process exits
+ * @see tracer::on_exit
  */
 void __cyg_profile_func_exit(void *this_fn, void *call_site)
 {
-	tracer *iface = tracer::interface();
+	tracer::on_exit(this_fn, call_site,
+									reinterpret_cast<mem_addr_t> (__builtin_return_address(0)));
+}
 
-	__D_ASSERT(iface != NULL);
-	if ( unlikely(iface == NULL) ) {
-		return;
-	}
 
-#ifdef WITH_PLUGIN
-	iface->end_plugins(this_fn, call_site);
-#endif
+/**
+ * @brief Interposed dlopen(3), registers the modules it loads
+ *
+ * @param[in] file the shared object path (NULL for the executable)
+ *
+ * @param[in] mode the binding mode flags
+ *
+ * @returns the shared object handle or NULL if it can't be loaded
+ *
+ * @note
+ *	The next dlopen (libdl or libc) loads the shared object on behalf of
+ *	libinstrument, so a bare file name is searched in the paths of the caller
+ *	first (see tracer::open_module)
+ *
+ * @see tracer::on_dlopen
+ */
+void* dlopen(const char *file, int mode) __THROWNL
+{
+	void *retval = tracer::open_module(file, mode, __builtin_return_address(0));
+	tracer::on_dlopen(retval);
+	return retval;
+}
 
-	try {
-		tracer::lock();
 
-		iface->proc()
-				 ->current_thread()
-				 ->returned();
+/**
+ * @brief Interposed dlclose(3), drops the modules it unloads
+ *
+ * @param[in] handle the shared object handle
+ *
+ * @returns 0 on success, non-zero otherwise
+ *
+ * @see tracer::on_dlclose
+ */
+int dlclose(void *handle) __THROWNL
+{
+	typedef int (*dlclose_t)(void*);
+	static dlclose_t next = reinterpret_cast<dlclose_t> (dlsym(RTLD_NEXT, __FUNCTION__));
 
-		tracer::unlock();
-		return;
-	}
-	catch (exception x) {
-		std::cerr << x;
-	}
-	catch (std::exception x) {
-		std::cerr << x;
+	i32 retval = next(handle);
+	if ( likely(retval == 0) ) {
+		tracer::on_dlclose();
 	}
 
-	tracer::unlock();
-	exit(EXIT_FAILURE);
+	return retval;
+}
+
+
+/**
+ * @brief Interposed C++ throw, counts the propagating exception
+ *
+ * @param[in] x the exception object
+ *
+ * @param[in] type the exception type
+ *
+ * @param[in] dtor the exception object destructor
+ *
+ * @see tracer::on_throw
+ */
+__attribute((noreturn)) void __cxa_throw(void *x, std::type_info *type, void (*dtor)(void*))
+{
+	typedef void (*throw_t)(void*, std::type_info*, void (*)(void*));
+	static throw_t next = reinterpret_cast<throw_t> (dlsym(RTLD_NEXT, __FUNCTION__));
+
+	tracer::on_throw();
+	next(x, type, dtor);
+	__builtin_unreachable();
+}
+
+
+/**
+ * @brief Interposed C++ rethrow, counts the propagating exception again
+ *
+ * @see tracer::on_throw
+ */
+__attribute((noreturn)) void __cxa_rethrow()
+{
+	typedef void (*rethrow_t)();
+	static rethrow_t next = reinterpret_cast<rethrow_t> (dlsym(RTLD_NEXT, __FUNCTION__));
+
+	tracer::on_throw();
+	next();
+	__builtin_unreachable();
+}
+
+
+/**
+ * @brief Interposed C++ handler entry, counts the caught exception
+ *
+ * @param[in] x the unwinder exception header
+ *
+ * @returns the exception object
+ *
+ * @see tracer::on_catch
+ */
+void* __cxa_begin_catch(void *x) throw()
+{
+	typedef void* (*catch_t)(void*);
+	static catch_t next = reinterpret_cast<catch_t> (dlsym(RTLD_NEXT, __FUNCTION__));
+
+	tracer::on_catch();
+	return next(x);
 }
 
 #ifdef __cplusplus
@@ -127,6 +232,44 @@ void __cyg_profile_func_exit(void *this_fn, void *call_site)
 #endif
 
 
+/**
+ * @brief Simulate a function call (the body of the enter hooks of all backends)
+ *
+ * @param[in] this_fn the address of the called function
+ *
+ * @param[in] call_site the address where the function was called
+ *
+ * @param[in] ret
+ *	the return address of the hook call (0 from an entry sled, see
+ *	instrument::sled), so the call of a filtered out function can be unhooked
+ *
+ * @note The call is simulated by the selected hook variant (see tracer::select_hooks)
+ */
+void tracer::on_enter(void *this_fn, void *call_site, mem_addr_t ret)
+{
+	load_relaxed(&s_hooks)->enter(this_fn, call_site, ret);
+}
+
+
+/**
+ * @brief Simulate a function return (the body of the exit hooks of all backends)
+ *
+ * @param[in] this_fn the address of the returning function
+ *
+ * @param[in] call_site the address that the program counter will return to
+ *
+ * @param[in] ret
+ *	the return address of the hook call (0 from an exit sled, see
+ *	instrument::sled), so the call of a filtered out function can be unhooked
+ *
+ * @note The return is simulated by the selected hook variant (see tracer::select_hooks)
+ */
+void tracer::on_exit(void *this_fn, void *call_site, mem_addr_t ret)
+{
+	load_relaxed(&s_hooks)->exit(this_fn, call_site, ret);
+}
+
+
 /**
  * @brief Library constructor
  *
@@ -136,21 +279,126 @@ void tracer::__on_lib_load()
 {
 	/* Initialize libbfd internals and backends */
 	bfd_init();
+	store_release(&s_state, TRACER_LOADING);
 
 	try {
 		s_iface = new tracer;
+#ifdef WITH_FILTER
+		if ( unlikely(patching_mode()) ) {
+			s_iface->m_patcher = new patcher;
+		}
+#endif
 
-		/* Load the symbol table of the executable */
-		const i8 *path = util::executable_path();
-		s_iface->m_proc->add_module(path, 0);
-		delete[] path;
+		s_symtab_mode = loading_mode();
+		s_sampling = sampling_mode(s_sample_period);
+		control::attach(s_sample_period);
+		recorder::set_slots(recording_size());
+		shadow_stack::set_limit(depth_limit());
+		shadow_stack::set_folding(folding_mode());
+
+		s_dedup_window = dedup_window();
+		if ( unlikely(s_dedup_window > 0) ) {
+			s_iface->m_signatures = new trace_signature[g_dedup_sets * g_dedup_ways];
+			memset(s_iface->m_signatures, 0, g_dedup_sets * g_dedup_ways * sizeof(trace_signature));
+		}
 
-		/* Load the symbol tables of the selected DSO */
+		/* The selection is kept for the modules loaded later (see tracer::on_dlopen) */
 		chain<string> *libs = util::getenv(g_libs_env);
-		dl_iterate_phdr(on_dso_load, libs);
-		delete libs;
 
+		try {
+			s_selection = new dso_selection;
+			if ( likely(!select_dso(*s_selection, libs)) ) {
+				delete s_selection;
+				s_selection = NULL;
+			}
+
+			delete libs;
+			libs = NULL;
+		}
+		catch (...) {
+			delete libs;
+			throw;
+		}
+
+		/* The modules are collected deferred, then the eager tables are loaded in parallel */
+		process *proc = s_iface->m_proc;
+		scan_modules(proc, true);
+
+		if ( likely(s_symtab_mode == SYMTAB_EAGER) ) {
+			load_modules(proc);
+		}
+
+		/* The symbol tables are loaded once, publish the outcome */
+		u32 cnt = proc->module_count();
+
+		/* Deferred symbol tables are not counted, to avoid loading them */
+		if ( likely(s_symtab_mode == SYMTAB_EAGER) ) {
+			cnt = proc->symbol_count();
+		}
+
+		if ( unlikely(cnt == 0) ) {
+			store_release(&s_state, TRACER_UNINITIALIZED);
+			util::dbg_warn("no symbols loaded, call stack simulation disabled");
+			return;
+		}
+
+		store_release(&s_state, TRACER_READY);
 		util::dbg_info("libinstrument.so.%d.%d initialized", g_major, g_minor);
+
+#ifdef WITH_SLEDS
+		/* The sleds are enabled once the hooks can trace */
+		if ( unlikely(sled_mode()) ) {
+			s_sleds = true;
+			util::dbg_info("%u function entry sleds enabled", sled::enable_all(proc));
+		}
+#endif
+
+#ifdef WITH_PLUGIN
+		/* If the plugin can't be attached, no slow call is captured */
+		u64 slow = slow_threshold();
+		if ( unlikely(slow > 0) ) {
+			try {
+				slow_call::set_threshold(slow);
+				slow_call::attach();
+			}
+			catch (std::bad_alloc &x) {
+				util::dbg_warn("failed to attach the slow call plugin");
+			}
+		}
+#endif
+
+		/* If the crash handlers can't be installed, crashes are not dumped */
+		string path;
+		if ( unlikely(crash_path(path)) ) {
+			try {
+				crash::install((path.length() > 0) ? path.cstring() : NULL);
+			}
+			catch (exception &x) {
+				util::dbg_warn("failed to install the crash handlers");
+			}
+		}
+
+		/* If the loader can't be started, the symbol tables are loaded lazily */
+		if ( unlikely(s_symtab_mode == SYMTAB_BACKGROUND) ) {
+			if ( unlikely(pthread_create(&s_loader, NULL, load_symbols, proc) != 0) ) {
+				s_loader = 0;
+				util::dbg_warn("failed to start the background symbol table loader");
+			}
+		}
+
+		/* If the sampler can't be started, no timer samples are taken */
+		if ( unlikely(s_sampling == SAMPLING_TIMER) ) {
+			if ( unlikely(pthread_create(&s_sampler, NULL, sample_stacks, NULL) != 0) ) {
+				s_sampler = 0;
+				util::dbg_warn("failed to start the timer sampler");
+			}
+		}
+
+		/* If the fork handlers can't be installed, forked children keep the parent threads */
+		if ( unlikely(pthread_atfork(on_fork_prepare, on_fork_parent, on_fork_child) != 0) ) {
+			util::dbg_warn("failed to install the fork handlers");
+		}
+
 		return;
 	}
 	catch (exception &x) {
@@ -169,71 +417,133 @@ void tracer::__on_lib_load()
  */
 void tracer::__on_lib_unload()
 {
+	store_release(&s_state, TRACER_SHUTDOWN);
+	crash::uninstall();
+
+	/* The loader stops after the symbol table it's loading */
+	if ( unlikely(s_loader != 0) ) {
+		pthread_join(s_loader, NULL);
+		s_loader = 0;
+	}
+
+	/* The sampler stops after the sample it's taking */
+	if ( unlikely(s_sampler != 0) ) {
+		pthread_join(s_sampler, NULL);
+		s_sampler = 0;
+	}
+
 	delete s_iface;
 	s_iface = NULL;
+
+	if ( unlikely(s_selection != NULL) ) {
+		if ( likely(!s_selection->none) ) {
+			regfree(&s_selection->expr);
+		}
+
+		delete s_selection;
+		s_selection = NULL;
+	}
+
+	control::detach();
+	pattern::flush();
 	util::dbg_info("libinstrument.so.%d.%d finalized", g_major, g_minor);
 }
 
 
 /**
- * @brief
- *	Given an address in an objective code file, extract from the gdb-related
- *	debug information, the equivalent source code file name and line and append
- *	it to a string buffer
+ * @brief Compare the self samples of two sampling counters (descending order)
  *
- * @param[in,out] dst the destination string
+ * @param[in] a the first counter
  *
- * @param[in] path the path of the objective code file (can be NULL for NO-OP)
+ * @param[in] b the second counter
  *
- * @param[in] addr the address
+ * @returns a negative, zero or positive value (list::comparator_t)
  *
- * @returns the first argument
+ * @note Counters with equal self samples are ordered by their total samples
+ */
+i32 tracer::by_self_samples(const sample_counter *a, const sample_counter *b)
+{
+	if ( likely(a->self != b->self) ) {
+		return (a->self > b->self) ? -1 : 1;
+	}
+
+	if ( likely(a->total != b->total) ) {
+		return (a->total > b->total) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Load the deferred symbol tables of all the modules on a loader pool
  *
- * @note
- *	If the addr2line program fails to retreive the debug information, or if any
- *	other error or exception occurs, nothing is appended to the destination
- *	string
+ * @param[in] proc the process
  *
- * @see man addr2line
- * @see man g++ (-g family options)
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The calling thread is part of the pool, so the tables are loaded even if no
+ *	loader thread can be started. Each loader takes the next module index, until
+ *	none is left (see tracer::load_worker)
  */
-string& tracer::addr2line(string &dst, const i8 *path, mem_addr_t addr)
+void tracer::load_modules(const process *proc)
 {
-	__D_ASSERT(path != NULL);
-	if ( unlikely(path == NULL) ) {
-		return dst;
+	u32 cnt = loader_count();
+	u32 mods = proc->module_count();
+	if ( likely(cnt > mods) ) {
+		cnt = mods;
 	}
 
-	FILE *pipe = NULL;
-	try {
-		/* Command to be executed by the child process */
-		string cmd("addr2line -se %s 0x%x", path, addr);
+	load_job job;
+	job.proc = proc;
+	job.next = 0;
 
-		/* Open a readonly pipe to the child process */
-		pipe = popen(cmd.cstring(), "r");
-		if ( unlikely(pipe == NULL) ) {
-			throw exception(
-				"failed to open pipe for command '%s' (errno %d - %s)",
-				cmd.cstring(),
-				errno,
-				strerror(errno));
-		}
+	pthread_t *pool = (likely(cnt > 1)) ? new pthread_t[cnt - 1] : NULL;
+	u32 started = 0;
 
-		/* Read a line of output from the pipe to a buffer */
-		string buf;
-		i8 ch = fgetc(pipe);
-		while ( likely(ch != '\n' && ch != EOF) ) {
-			buf.append(ch);
-			ch = fgetc(pipe);
+	for (; likely(started + 1 < cnt); started++) {
+		if ( unlikely(pthread_create(&pool[started], NULL, load_worker, &job) != 0) ) {
+			util::dbg_warn("failed to start symbol table loader %d", started + 1);
+			break;
 		}
+	}
 
-		if ( unlikely(ferror(pipe) != 0) ) {
-			throw exception("failed to read pipe for command '%s'", cmd.cstring());
-		}
+	load_worker(&job);
+
+	for (u32 i = 0; likely(i < started); i++) {
+		pthread_join(pool[i], NULL);
+	}
+
+	delete[] pool;
+	util::dbg_info("loaded %d symbol tables with %d loaders", mods, started + 1);
+}
+
+
+/**
+ * @brief Background symbol table loader (thread entry function)
+ *
+ * @param[in] arg the process (instrument::process)
+ *
+ * @returns NULL
+ *
+ * @note The loader exits early if the tracer shuts down
+ */
+void* tracer::load_symbols(void *arg)
+{
+	const process *proc = static_cast<process*> (arg);
+
+	try {
+		u32 i = 0;
+		while ( likely(load_acquire(&s_state) == TRACER_READY) ) {
+			if ( unlikely(!proc->load_module(i)) ) {
+				break;
+			}
 
-		if ( likely(buf.compare("??:0") != 0) ) {
-			dst.append(" (%s)", buf.cstring());
+			i++;
 		}
+
+		util::dbg_info("loaded %d symbol tables in the background", i);
 	}
 	catch (exception &x) {
 		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
@@ -242,355 +552,2955 @@ string& tracer::addr2line(string &dst, const i8 *path, mem_addr_t addr)
 		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
 	}
 
-	if ( likely(pipe != NULL) ) {
-		pclose(pipe);
-	}
-
-	return dst;
+	return NULL;
 }
 
 
 /**
- * @brief
- *	This is a dl_iterate_phdr (libdl) callback, called for each linked shared
- *	object. It loads the symbol table of the DSO (if it's not filtered out) to
- *	tracer::s_iface->m_proc
- *
- * @param[in] dso
- *	a dl_phdr_info struct (libdl) that describes the shared object (file path,
- *	load address e.t.c)
- *
- * @param[in] sz the sizeof dso
- *
- * @param[in] arg
- *	a chain of POSIX extended regular expressions used to select the shared
- *	objects that will participate in the call stack simulation. The absolute
- *	path of each DSO is matched against each regexp. If NULL, all linked DSO
- *	symbol tables will be loaded. If not NULL but empty, all DSO are filtered
- *	out from instrumentation
+ * @brief Symbol table loader pool worker (thread entry function)
  *
- * @returns 0
+ * @param[in,out] arg the shared loading job (tracer::load_job)
  *
- * @note
- *	If an exception occurs, it's caught and handled. 0 is returned, signaling to
- *	the iterator (dl_iterate_phdr) to continue with the next DSO
+ * @returns NULL
  */
-i32 tracer::on_dso_load(dl_phdr_info *dso, size_t sz, void *arg)
+void* tracer::load_worker(void *arg)
 {
-	try {
-		if ( unlikely(dso == NULL) ) {
-			throw exception("invalid argument: dso (=%p)", dso);
-		}
+	load_job *job = static_cast<load_job*> (arg);
 
-		/* If the DSO path is undefined */
-		string path(dso->dlpi_name);
-		if ( unlikely(path.length() == 0) ) {
-			throw exception("undefined DSO path");
-		}
+	try {
+		while ( likely(job->proc->load_module(fetch_add(&job->next, 1) - 1)) );
+	}
+	catch (exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
+	}
+	catch (std::exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
+	}
 
-		/* If the DSO has no segments */
-		if ( unlikely(dso->dlpi_phnum == 0) ) {
-			throw exception("'%s' has 0 segments", path.cstring());
-		}
+	return NULL;
+}
 
-		/* Check if the DSO is filtered out */
-		bool found = false;
-		if ( likely(arg != NULL) ) {
-			const chain<string> *filters = static_cast<chain<string>*> (arg);
 
-			for (u32 i = 0, sz = filters->size(); likely(i < sz); i++) {
-				const string *flt = filters->at(i);
+/**
+ * @brief Get the crash dump file path from the environment
+ *
+ * @param[out] path the dump file path (empty for the standard error)
+ *
+ * @returns true if crashes are dumped, false otherwise (the default)
+ *
+ * @throws std::bad_alloc
+ *
+ * @see g_crash_env
+ */
+bool tracer::crash_path(string &path)
+{
+	path.clear();
+
+	const i8 *val = ::getenv(g_crash_env);
+	if ( likely(val == NULL || strcmp(val, "off") == 0) ) {
+		return false;
+	}
 
-				if ( unlikely(path.match(*flt)) ) {
-					found = true;
-					break;
-				}
-			}
+	if ( likely(strcmp(val, "stderr") != 0 && val[0] != '\0') ) {
+		path.set("%s", val);
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Get the exception trace deduplication window from the environment
+ *
+ * @returns the window in milliseconds (0 if deduplication is off, the default)
+ *
+ * @see g_dedup_env
+ */
+u32 tracer::dedup_window()
+{
+	const i8 *val = ::getenv(g_dedup_env);
+	if ( likely(val == NULL || strcmp(val, "off") == 0) ) {
+		return 0;
+	}
+
+	if ( likely(strcmp(val, "on") == 0) ) {
+		return g_dedup_window;
+	}
+
+	i8 *end = NULL;
+	i64 ms = strtol(val, &end, 10);
+	if ( unlikely(end == val || *end != '\0' || ms <= 0 || ms > INT_MAX) ) {
+		util::dbg_warn("invalid exception trace deduplication window '%s'", val);
+		return 0;
+	}
+
+	return ms;
+}
+
+
+/**
+ * @brief Get the maximum simulated call stack depth from the environment
+ *
+ * @returns the maximum stored frames per thread (0 for no limit, the default)
+ *
+ * @see g_depth_env
+ */
+u32 tracer::depth_limit()
+{
+	const i8 *val = ::getenv(g_depth_env);
+	if ( likely(val == NULL || val[0] == '\0' || strcmp(val, "off") == 0) ) {
+		return 0;
+	}
+
+	i8 *end = NULL;
+	i64 depth = strtol(val, &end, 10);
+	if ( unlikely(end == val || *end != '\0' || depth <= 0 || depth > INT_MAX) ) {
+		util::dbg_warn("invalid maximum call stack depth '%s'", val);
+		return 0;
+	}
+
+	return depth;
+}
+
+
+/**
+ * @brief Simulate a function call, serving the features of a hook variant
+ *
+ * @param[in] this_fn the address of the called function
+ *
+ * @param[in] call_site the address where the function was called
+ *
+ * @param[in] ret
+ *	the return address of the hook call (0 from an entry sled, see
+ *	instrument::sled), so the call of a filtered out function can be unhooked
+ *
+ * @tparam F the served features (HOOK_* definitions)
+ *
+ * @note If an exception occurs, the process exits
+ *
+ * @note
+ *	No global lock is acquired, each thread reaches its own simulated call stack
+ *	through thread-local storage. With tracing switched off (see
+ *	instrument::control), the hook costs a single relaxed load and branch
+ */
+template <u32 F>
+void tracer::enter_hook(void *this_fn, void *call_site, mem_addr_t ret)
+{
+	u32 word = control::tracing();
+	if ( unlikely(!control::is_enabled(word)) ) {
+		return;
+	}
+
+	tracer *iface = tracer::interface();
+	count_metric(METRIC_HOOKS, 1);
+
+	__D_ASSERT(this_fn != NULL);
+	__D_ASSERT(call_site != NULL);
+	__D_ASSERT(iface != NULL);
+	if ( unlikely(iface == NULL) ) {
+		count_metric(METRIC_DROPPED, 1);
+		return;
+	}
+
+#ifdef WITH_FILTER
+	/* Filtered out functions are not instrumented (nor call the hook, if hot-patching) */
+	if ( (F & HOOK_FILTERS) && unlikely(iface->is_filtered(reinterpret_cast<mem_addr_t> (this_fn))) ) {
+		iface->unhook(reinterpret_cast<mem_addr_t> (this_fn), ret,
+									reinterpret_cast<mem_addr_t> (&instrument::__cyg_profile_func_enter));
+		return;
+	}
+#endif
+
+	try {
+		mem_addr_t addr = reinterpret_cast<mem_addr_t> (this_fn);
+		mem_addr_t site = reinterpret_cast<mem_addr_t> (call_site);
+		thread *thr = iface->proc()->current_thread();
+		if ( unlikely(thr->tracing() != word) ) {
+			iface->resync(thr, word);
 		}
-		else {
-			found = true;
+
+		if ( F & HOOK_RECORDING ) {
+			thr->record(RECORD_ENTER, addr, site);
 		}
 
-		if ( likely(!found) ) {
-			util::dbg_warn("filtered out '%s'", path.cstring());
-			return 0;
+		/* In call sampling mode, most calls only update the depth bitmap */
+		u32 period = thr->sample_period();
+		if ( unlikely(period > 0 && !thr->sampled_call(addr, period)) ) {
+			return;
+		}
+
+		thr->called(addr, site);
+
+		/* The plugins see the call on the simulated stack */
+#ifdef WITH_PLUGIN
+		if ( F & HOOK_PLUGINS ) {
+			iface->begin_plugins(this_fn, call_site, thr->plugin_mask());
 		}
+#endif
 
-		/* Load the DSO symbol table */
-		mem_addr_t base = dso->dlpi_addr + dso->dlpi_phdr[0].p_vaddr;
-		s_iface->m_proc
-					 ->add_module(path.cstring(), base);
+		return;
 	}
 	catch (exception &x) {
-		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
+		std::cerr << x;
 	}
 	catch (std::exception &x) {
-		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
+		std::cerr << x;
 	}
 
-	return 0;
+	exit(EXIT_FAILURE);
 }
 
 
 /**
- * @brief Object default constructor
+ * @brief Simulate a function return, serving the features of a hook variant
  *
- * @throws std::bad_alloc
+ * @param[in] this_fn the address of the returning function
+ *
+ * @param[in] call_site the address that the program counter will return to
+ *
+ * @param[in] ret
+ *	the return address of the hook call (0 from an exit sled, see
+ *	instrument::sled), so the call of a filtered out function can be unhooked
+ *
+ * @tparam F the served features (HOOK_* definitions)
+ *
+ * @note If an exception occurs, the process exits
+ *
+ * @note
+ *	No global lock is acquired, each thread reaches its own simulated call stack
+ *	through thread-local storage. With tracing switched off (see
+ *	instrument::control), the hook costs a single relaxed load and branch
  */
-tracer::tracer()
-try:
+template <u32 F>
+void tracer::exit_hook(void *this_fn, void *call_site, mem_addr_t ret)
+{
+	u32 word = control::tracing();
+	if ( unlikely(!control::is_enabled(word)) ) {
+		return;
+	}
+
+	tracer *iface = tracer::interface();
+	count_metric(METRIC_HOOKS, 1);
+
+	__D_ASSERT(iface != NULL);
+	if ( unlikely(iface == NULL) ) {
+		count_metric(METRIC_DROPPED, 1);
+		return;
+	}
+
+	try {
+		thread *thr = iface->proc()->current_thread();
+		if ( unlikely(thr->tracing() != word) ) {
+			iface->resync(thr, word);
+		}
+
 #ifdef WITH_FILTER
-m_filters(NULL),
+		/* A filtered out function is simulated only if it was called before */
+		mem_addr_t addr = reinterpret_cast<mem_addr_t> (this_fn);
+		if ( (F & HOOK_FILTERS) && unlikely(iface->is_filtered(addr)) ) {
+			if ( likely(thr->call_depth() == 0 || thr->backtrace(0)->fn != addr) ) {
+				iface->unhook(addr, ret, reinterpret_cast<mem_addr_t> (&instrument::__cyg_profile_func_exit));
+				return;
+			}
+		}
 #endif
+
+		if ( F & HOOK_RECORDING ) {
+			thr->record(RECORD_EXIT, reinterpret_cast<mem_addr_t> (this_fn),
+									reinterpret_cast<mem_addr_t> (call_site));
+		}
+
+		/* In call sampling mode, only the simulated calls return */
+		if ( unlikely(thr->sample_period() > 0 && !thr->sampled_return()) ) {
+			return;
+		}
+
+		/* The calls entered before the simulated stack started over are not simulated */
+		if ( unlikely(thr->call_depth() == 0) ) {
+			return;
+		}
+
 #ifdef WITH_PLUGIN
-m_plugins(NULL),
+		if ( F & HOOK_PLUGINS ) {
+			iface->end_plugins(this_fn, call_site, thr->plugin_mask());
+		}
 #endif
-m_proc(NULL)
+
+		thr->returned();
+		return;
+	}
+	catch (exception &x) {
+		std::cerr << x;
+	}
+	catch (std::exception &x) {
+		std::cerr << x;
+	}
+
+	exit(EXIT_FAILURE);
+}
+
+
+/**
+ * @brief Get the recursion folding mode from the environment
+ *
+ * @returns true if recursion is folded, false otherwise (the default)
+ *
+ * @see g_fold_env
+ */
+bool tracer::folding_mode()
+{
+	const i8 *val = ::getenv(g_fold_env);
+	if ( likely(val == NULL || val[0] == '\0' || strcmp(val, "off") == 0) ) {
+		return false;
+	}
+
+	if ( unlikely(strcmp(val, "on") != 0) ) {
+		util::dbg_warn("unknown recursion folding mode '%s'", val);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Get the features that the hooks must serve
+ *
+ * @returns the features of the current configuration (HOOK_* definitions)
+ *
+ * @note
+ *	Recording is served once it's on, the threads that recorded events keep
+ *	their recorders
+ */
+u32 tracer::hook_features()
 {
+	u32 retval = load_acquire(&s_hooks)->features & HOOK_RECORDING;
+	if ( unlikely(recorder::slots() > 0) ) {
+		retval |= HOOK_RECORDING;
+	}
+
+	tracer *iface = load_acquire(&s_iface);
+	if ( unlikely(iface == NULL) ) {
+		return retval;
+	}
+
 #ifdef WITH_FILTER
-	m_filters = new list<filter>;
+	if ( unlikely(load_acquire(&iface->m_filtering)) ) {
+		retval |= HOOK_FILTERS;
+	}
 #endif
 
 #ifdef WITH_PLUGIN
-	m_plugins = new list<plugin>;
+	if ( unlikely(load_acquire(&iface->m_snapshot) != NULL) ) {
+		retval |= HOOK_PLUGINS;
+	}
 #endif
 
-	m_proc = new process;
+	return retval;
 }
-catch (...) {
-	destroy();
+
+
+/**
+ * @brief Get the symbol table loader pool size from the environment
+ *
+ * @returns the loader count (at least 1, at most g_loaders_max)
+ *
+ * @see g_loaders_env
+ */
+u32 tracer::loader_count()
+{
+	i64 retval = sysconf(_SC_NPROCESSORS_ONLN);
+
+	const i8 *val = ::getenv(g_loaders_env);
+	if ( unlikely(val != NULL) ) {
+		i8 *end = NULL;
+		i64 cnt = strtol(val, &end, 10);
+
+		if ( likely(end != val && *end == '\0' && cnt > 0) ) {
+			retval = cnt;
+		}
+		else {
+			util::dbg_warn("invalid symbol table loader count '%s'", val);
+		}
+	}
+
+	if ( unlikely(retval < 1) ) {
+		retval = 1;
+	}
+
+	return (likely(retval < g_loaders_max)) ? retval : g_loaders_max;
 }
 
 
 /**
- * @brief Object copy constructor
+ * @brief Get the symbol table loading mode from the environment
  *
- * @param[in] src the source object
+ * @returns one of the SYMTAB_* definitions (SYMTAB_EAGER by default)
  *
  * @throws std::bad_alloc
+ *
+ * @see g_symbols_env
  */
-tracer::tracer(const tracer &src)
-try:
-#ifdef WITH_FILTER
-m_filters(NULL),
-#endif
-#ifdef WITH_PLUGIN
-m_plugins(NULL),
-#endif
-m_proc(NULL)
+u8 tracer::loading_mode()
 {
-/* todo Copy if made copyable */
+	chain<string> *env = util::getenv(g_symbols_env);
+	if ( likely(env == NULL) ) {
+		return SYMTAB_EAGER;
+	}
+
+	u8 retval = SYMTAB_EAGER;
+	if ( likely(env->size() > 0) ) {
+		const string *mode = env->at(0);
+
+		if ( likely(mode->compare("lazy") == 0) ) {
+			retval = SYMTAB_LAZY;
+		}
+		else if ( likely(mode->compare("background") == 0) ) {
+			retval = SYMTAB_BACKGROUND;
+		}
+		else if ( unlikely(mode->compare("eager") != 0) ) {
+			util::dbg_warn("unknown symbol loading mode '%s'", mode->cstring());
+		}
+	}
+
+	delete env;
+	return retval;
+}
+
+
 #ifdef WITH_FILTER
-	m_filters = new list<filter>;
+/**
+ * @brief Get the hot-patching mode from the environment
+ *
+ * @returns true if the hook calls of filtered out functions are patched, false otherwise (the default)
+ *
+ * @see g_patch_env
+ */
+bool tracer::patching_mode()
+{
+	const i8 *val = ::getenv(g_patch_env);
+	if ( likely(val == NULL || val[0] == '\0' || strcmp(val, "off") == 0) ) {
+		return false;
+	}
+
+	if ( unlikely(strcmp(val, "on") != 0) ) {
+		util::dbg_warn("unknown hot-patching mode '%s'", val);
+		return false;
+	}
+
+	return true;
+}
 #endif
 
-#ifdef WITH_PLUGIN
-	m_plugins = src.m_plugins->clone();
-#endif
 
-	m_proc = src.m_proc->clone();
-}
-catch (...) {
-	destroy();
-}
+/**
+ * @brief Get the flight recorder size from the environment
+ *
+ * @returns the records per thread (0 if recording is off, the default)
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The shell variable is 'on' for g_recorder_sz records per thread, a record
+ *	count or 'off'
+ *
+ * @see g_recorder_env
+ */
+u32 tracer::recording_size()
+{
+	chain<string> *env = util::getenv(g_recorder_env);
+	if ( likely(env == NULL) ) {
+		return 0;
+	}
+
+	u32 retval = 0;
+	if ( likely(env->size() > 0) ) {
+		const string *mode = env->at(0);
+
+		if ( likely(mode->compare("on") == 0) ) {
+			retval = g_recorder_sz;
+		}
+		else if ( unlikely(mode->compare("off") != 0) ) {
+			retval = strtoul(mode->cstring(), NULL, 10);
+			if ( unlikely(retval == 0 || retval > (1U << 31)) ) {
+				util::dbg_warn("invalid recorder size '%s'", mode->cstring());
+				retval = 0;
+			}
+		}
+	}
+
+	delete env;
+	return retval;
+}
+
+
+/**
+ * @brief Release the stack snapshots of the threads
+ *
+ * @param[in] snaps the snapshots (can be NULL)
+ *
+ * @param[in] cnt the snapshot count
+ */
+void tracer::release_snapshots(stack_snapshot *snaps, u32 cnt)
+{
+	for (u32 i = 0; likely(snaps != NULL && i < cnt); i++) {
+		delete[] snaps[i].frames;
+	}
+
+	delete[] snaps;
+}
+
+
+/**
+ * @brief Timer sampler (thread entry function)
+ *
+ * @param[in] arg unused
+ *
+ * @returns NULL
+ *
+ * @note
+ *	The sampler takes a sample of all the simulated stacks every
+ *	tracer::s_sample_period milliseconds and exits if the tracer shuts down or
+ *	if an exception occurs
+ */
+void* tracer::sample_stacks(void *arg)
+{
+	timespec interval;
+	interval.tv_sec = s_sample_period / 1000;
+	interval.tv_nsec = (s_sample_period % 1000) * 1000000L;
+
+	try {
+		while ( likely(load_acquire(&s_state) == TRACER_READY) ) {
+			nanosleep(&interval, NULL);
+
+			if ( likely(load_acquire(&s_state) == TRACER_READY) ) {
+				s_iface->sample();
+			}
+		}
+	}
+	catch (exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
+	}
+	catch (std::exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief Get the sampling mode from the environment
+ *
+ * @param[out] period
+ *	the call sampling period or the timer sampling interval (in milliseconds),
+ *	0 if sampling is off
+ *
+ * @returns one of the SAMPLING_* definitions (SAMPLING_OFF by default)
+ *
+ * @throws std::bad_alloc
+ *
+ * @note A call sampling period of 1 (or less) turns sampling off
+ *
+ * @see g_sampling_env
+ */
+u8 tracer::sampling_mode(u32 &period)
+{
+	period = 0;
+
+	chain<string> *env = util::getenv(g_sampling_env);
+	if ( likely(env == NULL) ) {
+		return SAMPLING_OFF;
+	}
+
+	u8 retval = SAMPLING_OFF;
+	if ( likely(env->size() > 0) ) {
+		const string *mode = env->at(0);
+		const string *arg = (env->size() > 1) ? env->at(1) : NULL;
+
+		if ( likely(mode->compare("calls") == 0) ) {
+			retval = SAMPLING_CALLS;
+			period = g_sample_period;
+		}
+		else if ( likely(mode->compare("timer") == 0) ) {
+			retval = SAMPLING_TIMER;
+			period = g_sample_interval;
+		}
+		else if ( unlikely(mode->compare("off") != 0) ) {
+			util::dbg_warn("unknown sampling mode '%s'", mode->cstring());
+		}
+
+		if ( likely(retval != SAMPLING_OFF && arg != NULL) ) {
+			u32 val = strtoul(arg->cstring(), NULL, 10);
+			if ( likely(val > 0) ) {
+				period = val;
+			}
+			else {
+				util::dbg_warn("invalid sampling argument '%s'", arg->cstring());
+			}
+		}
+
+		if ( unlikely(retval == SAMPLING_CALLS && period <= 1) ) {
+			retval = SAMPLING_OFF;
+			period = 0;
+		}
+	}
+
+	delete env;
+	return retval;
+}
+
+
+/**
+ * @brief Span the loadable segments of a shared object
+ *
+ * @param[in] dso the shared object (dl_iterate_phdr report)
+ *
+ * @param[out] begin the mapped address range start
+ *
+ * @param[out] end the mapped address range end (begin if there's no loadable segment)
+ */
+void tracer::dso_range(const dl_phdr_info *dso, mem_addr_t &begin, mem_addr_t &end)
+{
+	begin = 0;
+	end = 0;
+
+	for (u32 i = 0; likely(i < dso->dlpi_phnum); i++) {
+		const ElfW(Phdr) *seg = &dso->dlpi_phdr[i];
+		if ( likely(seg->p_type != PT_LOAD) ) {
+			continue;
+		}
+
+		mem_addr_t lo = dso->dlpi_addr + seg->p_vaddr;
+		mem_addr_t hi = lo + seg->p_memsz;
+
+		if ( unlikely(begin == end) ) {
+			begin = lo;
+			end = hi;
+			continue;
+		}
+
+		begin = (lo < begin) ? lo : begin;
+		end = (hi > end) ? hi : end;
+	}
+}
+
+
+/**
+ * @brief
+ *	This is a dl_iterate_phdr (libdl) callback, called for each linked shared
+ *	object. It defers the symbol table of the DSO (if it's not filtered out and
+ *	not registered already) to the module scan. The first object reported is
+ *	the executable, which is never filtered out. The address range of each
+ *	module is the span of its loadable segments
+ *
+ * @param[in] dso
+ *	a dl_phdr_info struct (libdl) that describes the shared object (file path,
+ *	load address e.t.c)
+ *
+ * @param[in] sz the sizeof dso
+ *
+ * @param[in,out] arg
+ *	the module scan (tracer::dso_scan). The absolute path of each DSO is matched
+ *	against the DSO selection (tracer::s_selection), the combined POSIX extended
+ *	regular expressions used to select the shared objects that will participate
+ *	in the call stack simulation. If there's no selection, all linked DSO symbol
+ *	tables will be loaded. If no expression was given, all DSO are filtered out
+ *	from instrumentation
+ *
+ * @returns 0
+ *
+ * @note
+ *	If an exception occurs, it's caught and handled. 0 is returned, signaling to
+ *	the iterator (dl_iterate_phdr) to continue with the next DSO. The rescans
+ *	(see tracer::on_dlopen) skip the registered modules without allocating and
+ *	don't report the filtered out DSO again
+ */
+i32 tracer::on_dso_load(dl_phdr_info *dso, size_t sz, void *arg)
+{
+	dso_scan *scan = static_cast<dso_scan*> (arg);
+
+	try {
+		if ( unlikely(dso == NULL) ) {
+			throw exception("invalid argument: dso (=%p)", dso);
+		}
+
+		/* The executable is reported first, with an empty path */
+		bool exe = (scan->reported++ == 0 && dso->dlpi_name[0] == '\0');
+		if ( unlikely(!scan->initial && (exe || dso->dlpi_name[0] == '\0')) ) {
+			return 0;
+		}
+
+		mem_addr_t begin = 0, end = 0;
+		dso_range(dso, begin, end);
+
+		/* A registered module is found in the index, without locking */
+		if ( likely(!scan->initial) ) {
+			const symtab *known = scan->proc->get_module(begin);
+			if ( likely(known != NULL &&
+									known->base() == dso->dlpi_addr &&
+									known->begin() == begin &&
+									strcmp(known->path(), dso->dlpi_name) == 0) ) {
+				return 0;
+			}
+		}
+
+		string path(dso->dlpi_name);
+		if ( unlikely(exe) ) {
+			const i8 *buf = util::executable_path();
+			path.set("%s", buf);
+			delete[] buf;
+		}
+
+		/* If the DSO path is undefined */
+		if ( unlikely(path.length() == 0) ) {
+			throw exception("undefined DSO path");
+		}
+
+		/* If the DSO has no segments */
+		if ( unlikely(dso->dlpi_phnum == 0) ) {
+			throw exception("'%s' has 0 segments", path.cstring());
+		}
+
+		/* Check if the DSO is filtered out */
+		bool found = true;
+		if ( likely(!exe && s_selection != NULL) ) {
+			found = !s_selection->none && !regexec(&s_selection->expr, path.cstring(), 0, NULL, 0);
+		}
+
+		if ( likely(!found) ) {
+			if ( unlikely(scan->initial) ) {
+				util::dbg_warn("filtered out '%s'", path.cstring());
+			}
+
+			return 0;
+		}
+
+		/*
+		 * Defer the DSO symbol table, relocated by the load bias. In eager mode it's
+		 * loaded once all the modules are collected (see tracer::load_modules)
+		 */
+		symtab *table = new symtab(path.cstring(), dso->dlpi_addr, begin, end, true);
+		try {
+			scan->found->add(table);
+		}
+		catch (...) {
+			delete table;
+			throw;
+		}
+	}
+	catch (exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
+	}
+	catch (std::exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief
+ *	This is a dl_iterate_phdr (libdl) callback, called for each linked shared
+ *	object until the probed module is found
+ *
+ * @param[in] dso the shared object
+ *
+ * @param[in] sz the sizeof dso
+ *
+ * @param[in,out] arg the probe (tracer::dso_probe)
+ *
+ * @returns 1 if the shared object is the probed module (the iteration stops), 0 otherwise
+ */
+i32 tracer::on_dso_probe(dl_phdr_info *dso, size_t sz, void *arg)
+{
+	dso_probe *probe = static_cast<dso_probe*> (arg);
+
+	mem_addr_t begin = 0, end = 0;
+	dso_range(dso, begin, end);
+
+	probe->found = (dso->dlpi_addr == probe->table->base() && begin == probe->table->begin());
+	return (probe->found) ? 1 : 0;
+}
+
+
+/**
+ * @brief Count an exception caught on the current thread
+ *
+ * @note The thread is not attached if it's not tracked yet (see process::cached_thread)
+ */
+void tracer::on_catch()
+{
+	if ( unlikely(load_acquire(&s_state) != TRACER_READY) ) {
+		return;
+	}
+
+	thread *thr = s_iface->m_proc->cached_thread();
+	if ( likely(thr != NULL) ) {
+		thr->caught();
+	}
+}
+
+
+/**
+ * @brief Drop the modules unloaded by a dlclose call from the process
+ *
+ * @note
+ *	Each mapped module is probed in the loaded objects (dl_iterate_phdr), the
+ *	ones no longer loaded are dropped from the module index (see
+ *	process::unmap_module). Their symbol tables are kept. The module scans are
+ *	serialized. Failures are reported, they're not propagated to the caller
+ */
+void tracer::on_dlclose()
+{
+	if ( unlikely(load_acquire(&s_state) != TRACER_READY) ) {
+		return;
+	}
+
+	pthread_mutex_lock(&s_scan_lock);
+
+	try {
+		process *proc = s_iface->m_proc;
+		u32 cnt = 0;
+
+		/* The executable is never unloaded */
+		for (u32 i = 1, sz = proc->module_count(); likely(i < sz); i++) {
+			const symtab *table = proc->get_module(i);
+			if ( unlikely(!table->is_mapped()) ) {
+				continue;
+			}
+
+			dso_probe probe = {table, false};
+			dl_iterate_phdr(on_dso_probe, &probe);
+			if ( unlikely(!probe.found) ) {
+				util::dbg_info("dropped unloaded module '%s'", table->path());
+				proc->unmap_module(table);
+				cnt++;
+			}
+		}
+	}
+	catch (exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
+	}
+	catch (std::exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
+	}
+
+	pthread_mutex_unlock(&s_scan_lock);
+}
+
+
+/**
+ * @brief Register the modules loaded by a dlopen call to the process
+ *
+ * @param[in] handle the dlopen handle (NULL if it failed)
+ *
+ * @note
+ *	Only the modules that are not registered yet are added, with deferred
+ *	symbol tables, even in eager mode (see tracer::scan_modules). The module
+ *	scans are serialized. Failures are reported, they're not propagated to the
+ *	caller
+ */
+void tracer::on_dlopen(void *handle)
+{
+	if ( unlikely(handle == NULL || load_acquire(&s_state) != TRACER_READY) ) {
+		return;
+	}
+
+	pthread_mutex_lock(&s_scan_lock);
+
+	try {
+		u32 cnt = scan_modules(s_iface->m_proc, false);
+		if ( unlikely(cnt > 0) ) {
+			util::dbg_info("registered %u loaded modules", cnt);
+		}
+	}
+	catch (exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
+	}
+	catch (std::exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
+	}
+
+	pthread_mutex_unlock(&s_scan_lock);
+}
+
+
+/**
+ * @brief Count an exception thrown (or rethrown) on the current thread
+ *
+ * @note
+ *	While the exception propagates, the simulated stack is not modified (see
+ *	thread::thrown), so the frames of the unwound calls are still found when
+ *	it's caught (see tracer::trace). The thread is not attached if it's not
+ *	tracked yet, it counts the propagating exception once attached
+ */
+void tracer::on_throw()
+{
+	if ( unlikely(load_acquire(&s_state) != TRACER_READY) ) {
+		return;
+	}
+
+	thread *thr = s_iface->m_proc->cached_thread();
+	if ( likely(thr != NULL) ) {
+		thr->thrown();
+	}
+}
+
+
+/**
+ * @brief Load a shared object on behalf of another object (the next dlopen(3))
+ *
+ * @param[in] file the shared object path (NULL for the executable)
+ *
+ * @param[in] mode the binding mode flags
+ *
+ * @param[in] caller an address in the calling object (the dlopen return address)
+ *
+ * @returns the shared object handle or NULL if it can't be loaded
+ *
+ * @note
+ *	The next dlopen takes libinstrument for the caller, so a bare file name
+ *	would be searched in the RPATH (or RUNPATH) of libinstrument. Unless an
+ *	object is loaded by that name already, the name is searched first in the
+ *	paths of the caller that libinstrument doesn't share (its RPATH, RUNPATH
+ *	and $ORIGIN, in the order of the caller), then by the next dlopen (the
+ *	LD_LIBRARY_PATH, the loader cache and the default paths). Doesn't throw
+ */
+void* tracer::open_module(const i8 *file, i32 mode, const void *caller)
+{
+	typedef void* (*dlopen_t)(const char*, int);
+	static dlopen_t next = reinterpret_cast<dlopen_t> (dlsym(RTLD_NEXT, "dlopen"));
+
+	/* Only the bare names are searched, the paths are loaded as is */
+	if ( likely(file == NULL || strchr(file, '/') != NULL) ) {
+		return next(file, mode);
+	}
+
+	void *retval = next(file, mode | RTLD_NOLOAD);
+	if ( likely(retval != NULL) ) {
+		return retval;
+	}
+
+	Dl_serinfo *own = NULL, *paths = NULL;
+	try {
+		own = search_paths(reinterpret_cast<const void*> (&open_module));
+		paths = search_paths(caller);
+
+		if ( likely(own != NULL && paths != NULL) ) {
+			/* The trailing paths shared with libinstrument are searched by the next dlopen */
+			u32 cnt = paths->dls_cnt, shared = 0;
+			while ( likely(shared < cnt && shared < own->dls_cnt &&
+										 strcmp(paths->dls_serpath[cnt - 1 - shared].dls_name,
+														own->dls_serpath[own->dls_cnt - 1 - shared].dls_name) == 0) ) {
+				shared++;
+			}
+
+			string path;
+			for (u32 i = 0; likely(i < cnt - shared && retval == NULL); i++) {
+				path.set("%s/%s", paths->dls_serpath[i].dls_name, file);
+				if ( unlikely(access(path.cstring(), F_OK) == 0) ) {
+					retval = next(path.cstring(), mode);
+				}
+			}
+		}
+	}
+	catch (...) {
+		retval = NULL;
+	}
+
+	delete[] reinterpret_cast<u8*> (paths);
+	delete[] reinterpret_cast<u8*> (own);
+	if ( likely(retval != NULL) ) {
+		return retval;
+	}
+
+	/* Clear the errors of the paths tried, the next dlopen reports its own */
+	dlerror();
+	return next(file, mode);
+}
+
+
+/**
+ * @brief Fork handler, reinitialize the tracer in the child process
+ *
+ * @note
+ *	The process drops the threads of the parent (see process::after_fork) and
+ *	the loader and the sampler, which don't exist in the child, are started
+ *	again. Nothing else is loaded, the symbol tables are inherited
+ */
+void tracer::on_fork_child()
+{
+	/* The child thread has a new ID, it doesn't own the (recursive) mutex */
+	pthread_mutex_t fresh = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+	pthread_mutex_t normal = PTHREAD_MUTEX_INITIALIZER;
+	s_lock = fresh;
+
+	/* A module scan of the parent may have been interrupted by the fork */
+	s_scan_lock = normal;
+
+	/* Before the loader and the sampler start, so the child never unlinks the file of the parent */
+	control::after_fork();
+
+	if ( likely(s_iface != NULL) ) {
+		s_iface->m_proc->after_fork(true);
+	}
+
+	/* If the loader can't be started, the remaining symbol tables are loaded lazily */
+	if ( unlikely(s_loader != 0) ) {
+		if ( unlikely(pthread_create(&s_loader, NULL, load_symbols, s_iface->m_proc) != 0) ) {
+			s_loader = 0;
+			util::dbg_warn("failed to restart the background symbol table loader");
+		}
+	}
+
+	if ( unlikely(s_sampler != 0) ) {
+		if ( unlikely(pthread_create(&s_sampler, NULL, sample_stacks, NULL) != 0) ) {
+			s_sampler = 0;
+			util::dbg_warn("failed to restart the timer sampler");
+		}
+	}
+}
+
+
+/**
+ * @brief Fork handler, release the tracer locks in the parent process
+ */
+void tracer::on_fork_parent()
+{
+	if ( likely(s_iface != NULL) ) {
+		s_iface->m_proc->after_fork(false);
+	}
+
+	tracer::unlock();
+}
+
+
+/**
+ * @brief Fork handler, take the tracer locks before the process forks
+ *
+ * @note
+ *	The tracer lock, then the process locks (see process::before_fork), are
+ *	held across the fork, so the child inherits consistent threads and symbol
+ *	tables. The cross-thread readers (traces, dumps, samples) complete first
+ */
+void tracer::on_fork_prepare()
+{
+	tracer::lock();
+
+	if ( likely(s_iface != NULL) ) {
+		s_iface->m_proc->before_fork();
+	}
+}
+
+
+/**
+ * @brief
+ *	Combine the DSO selection expressions to a single POSIX extended regular
+ *	expression and compile it, so each DSO path is matched once
+ *
+ * @param[out] sel the DSO selection (release the expression with regfree)
+ *
+ * @param[in] exprs the selection expressions (NULL to select all DSO)
+ *
+ * @returns false if all DSO are selected, true otherwise
+ *
+ * @throws std::bad_alloc
+ *
+ * @note If the expressions fail to compile, the error is reported and no DSO is
+ *	selected
+ */
+bool tracer::select_dso(dso_selection &sel, const chain<string> *exprs)
+{
+	sel.none = true;
+	if ( likely(exprs == NULL) ) {
+		return false;
+	}
+
+	if ( unlikely(exprs->size() == 0) ) {
+		return true;
+	}
+
+	string buf;
+	for (chain<string>::cursor cur = exprs->first(); likely(cur.is_valid()); cur.next()) {
+		buf.append((likely(cur.index() == 0)) ? "(%s)" : "|(%s)", cur.data()->cstring());
+	}
+
+	i32 retval = regcomp(&sel.expr, buf.cstring(), REG_EXTENDED | REG_NOSUB);
+	if ( likely(retval == 0) ) {
+		sel.none = false;
+		return true;
+	}
+
+	/* If the expression compilation failed */
+	i32 len = regerror(retval, &sel.expr, NULL, 0);
+	i8 errbuf[len];
+	regerror(retval, &sel.expr, errbuf, len);
+	regfree(&sel.expr);
+
+	util::dbg_error(
+		"failed to compile DSO selection '%s' (regex errno %d - %s)",
+		buf.cstring(),
+		retval,
+		errbuf);
+
+	return true;
+}
+
+
+/**
+ * @brief Register the loaded modules that are not registered yet to the process
+ *
+ * @param[in] proc the process
+ *
+ * @param[in] initial true for the library constructor scan, false for the rescans
+ *
+ * @returns the added module count
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	The loaded objects are iterated first, without holding the process lock
+ *	(the dynamic linker lock is held meanwhile). Then the new modules are added
+ *	in the order they were reported, with deferred symbol tables, and the
+ *	module index is republished without blocking the lookups (see
+ *	process::add_module)
+ */
+u32 tracer::scan_modules(process *proc, bool initial)
+{
+	list<symtab> found(1, true);
+	dso_scan scan = {proc, &found, 0, initial};
+	dl_iterate_phdr(on_dso_load, &scan);
+
+	u32 retval = found.size();
+	while ( likely(found.size() > 0) ) {
+		proc->add_module(found.detach(0));
+	}
+
+	return retval;
+}
+
+
+/**
+ * @brief Hash the raw frames of a simulated call stack (an exception trace signature)
+ *
+ * @param[in] thr the thread (locked)
+ *
+ * @param[in] top the offset of the outermost traced frame (see thread::frame_of)
+ *
+ * @returns the signature of the function and call site sequence
+ *
+ * @note
+ *	The frames are hashed as is, before any symbolization. The repeats of the
+ *	folded frames are not hashed, so a recursion fails with one signature at
+ *	any depth
+ */
+u64 tracer::signature(const thread *thr, i32 top)
+{
+	/* FNV-1a on the frame words, with a final avalanche */
+	u64 retval = 0xcbf29ce484222325ULL;
+	for (i32 i = top; likely(i >= 0); i--) {
+		const frame_t *cur = thr->backtrace(i);
+		retval = (retval ^ cur->fn) * 0x100000001b3ULL;
+		retval = (retval ^ cur->site) * 0x100000001b3ULL;
+	}
+
+	retval ^= retval >> 33;
+	retval *= 0xff51afd7ed558ccdULL;
+	retval ^= retval >> 33;
+	return retval;
+}
+
+
+#ifdef WITH_PLUGIN
+/**
+ * @brief Get the slow call capture threshold from the environment
+ *
+ * @returns the threshold in microseconds (0 if slow calls are not captured, the default)
+ *
+ * @see g_slow_env
+ */
+u64 tracer::slow_threshold()
+{
+	const i8 *val = ::getenv(g_slow_env);
+	if ( likely(val == NULL || val[0] == '\0' || strcmp(val, "off") == 0) ) {
+		return 0;
+	}
+
+	i8 *end = NULL;
+	i64 usec = strtoll(val, &end, 10);
+	if ( unlikely(end == val || *end != '\0' || usec <= 0) ) {
+		util::dbg_warn("invalid slow call threshold '%s'", val);
+		return 0;
+	}
+
+	return usec;
+}
+#endif
+
+
+/**
+ * @brief
+ *	Given an address in an objective code file, extract from the gdb-related
+ *	debug information, the equivalent source code file name and line
+ *
+ * @param[in] module the symbol table of the module (can be NULL)
+ *
+ * @param[in] addr the (runtime) address
+ *
+ * @returns the source file and line (kept by the symbol table) or NULL
+ *
+ * @note
+ *	The debug information is read in-process (see symtab::addr2line). If it
+ *	can't be retrieved, or if any other error or exception occurs, NULL is
+ *	returned
+ *
+ * @see man g++ (-g family options)
+ */
+const i8* tracer::source_line(const symtab *module, mem_addr_t addr)
+{
+	if ( unlikely(module == NULL) ) {
+		return NULL;
+	}
+
+	try {
+		return module->addr2line(addr);
+	}
+	catch (exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
+	}
+	catch (std::exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
+	}
+
+	return NULL;
+}
+
+
+#ifdef WITH_SLEDS
+/**
+ * @brief Get the function entry sled mode from the environment
+ *
+ * @returns true if the sleds are enabled, false otherwise (the default)
+ *
+ * @see g_sled_env
+ */
+bool tracer::sled_mode()
+{
+	const i8 *val = ::getenv(g_sled_env);
+	if ( likely(val == NULL || val[0] == '\0' || strcmp(val, "off") == 0) ) {
+		return false;
+	}
+
+	if ( unlikely(strcmp(val, "on") != 0) ) {
+		util::dbg_warn("unknown function entry sled mode '%s'", val);
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+#ifdef WITH_PLUGIN
+
+/**
+ * @brief Release a plugin snapshot and the plugins retired with it
+ *
+ * @param[in] t the snapshot (can be NULL for NO-OP)
+ */
+void tracer::release_plugins(plugin_table *t)
+{
+	if ( unlikely(t == NULL) ) {
+		return;
+	}
+
+	delete[] t->begin;
+	delete[] t->end;
+	delete t->retired;
+	delete t;
+}
+
+
+/**
+ * @brief Get the plugin snapshot reader stripe of the current thread
+ *
+ * @returns the stripe index (less than g_plugin_stripes)
+ */
+inline u32 tracer::stripe()
+{
+	u64 h = static_cast<u64> (pthread_self()) * 0x9e3779b97f4a7c15ULL;
+	return static_cast<u32> (h >> 32) & (g_plugin_stripes - 1);
+}
+#endif
+
+
+/**
+ * @brief Object default constructor
+ *
+ * @throws std::bad_alloc
+ */
+tracer::tracer()
+try:
+#ifdef WITH_FILTER
+m_filters(NULL),
+m_compiled(NULL),
+m_verdicts(NULL),
+m_filtering(false),
+m_filter_generation(0),
+m_patcher(NULL),
+m_filter_lock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP),
+#endif
+#ifdef WITH_PLUGIN
+m_plugins(NULL),
+m_snapshot(NULL),
+m_retired(NULL),
+#endif
+m_proc(NULL),
+m_sample_index(NULL),
+m_samples(NULL),
+m_sample_ticks(0),
+m_signatures(NULL),
+m_signature_ticks(0)
+{
+#ifdef WITH_FILTER
+	m_filters = new list<filter>;
+	m_compiled = new list<filter>;
+	m_verdicts = new registry<mem_addr_t, const bool>;
+#endif
+
+#ifdef WITH_PLUGIN
+	memset(m_readers, 0, sizeof(m_readers));
+	m_plugins = new list<plugin>;
+#endif
+
+	m_proc = new process;
+	m_sample_index = new registry<mem_addr_t, sample_counter>;
+	m_samples = new list<sample_counter>;
+}
+catch (...) {
+	destroy();
+}
+
+
+/**
+ * @brief Object copy constructor
+ *
+ * @param[in] src the source object
+ *
+ * @throws std::bad_alloc
+ */
+tracer::tracer(const tracer &src)
+try:
+#ifdef WITH_FILTER
+m_filters(NULL),
+m_compiled(NULL),
+m_verdicts(NULL),
+m_filtering(false),
+m_filter_generation(0),
+m_patcher(NULL),
+m_filter_lock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP),
+#endif
+#ifdef WITH_PLUGIN
+m_plugins(NULL),
+m_snapshot(NULL),
+m_retired(NULL),
+#endif
+m_proc(NULL),
+m_sample_index(NULL),
+m_samples(NULL),
+m_sample_ticks(0),
+m_signatures(NULL),
+m_signature_ticks(0)
+{
+/* todo Copy if made copyable */
+#ifdef WITH_FILTER
+	m_filters = new list<filter>;
+	m_compiled = new list<filter>;
+	m_verdicts = new registry<mem_addr_t, const bool>;
+#endif
+
+#ifdef WITH_PLUGIN
+	memset(m_readers, 0, sizeof(m_readers));
+	m_plugins = src.m_plugins->clone();
+	publish_plugins(NULL);
+#endif
+
+	m_proc = src.m_proc->clone();
+	m_sample_index = new registry<mem_addr_t, sample_counter>;
+	m_samples = new list<sample_counter>;
+}
+catch (...) {
+	destroy();
+}
+
+
+/**
+ * @brief Object destructor
+ */
+tracer::~tracer()
+{
+	destroy();
+}
+
+
+/**
+ * @brief Object virtual copy constructor
+ *
+ * @returns the object copy (heap allocated)
+ *
+ * @throws std::bad_alloc
+ */
+inline tracer* tracer::clone() const
+{
+	return new tracer(*this);
+}
+
+
+/**
+ * @brief Assignment operator
+ *
+ * @param[in] rval the assigned object
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+inline tracer& tracer::operator=(const tracer &rval)
+{
+	if ( unlikely(this == &rval) ) {
+		return *this;
+	}
+
+	/* todo Copy filters if they are made copyable */
+
+#ifdef WITH_PLUGIN
+	tracer::lock();
+
+	try {
+		/* The replaced plugins are retired with the current snapshot */
+		list<plugin> *retired = m_plugins;
+		m_plugins = rval.m_plugins->clone();
+
+		try {
+			publish_plugins(retired);
+		}
+		catch (...) {
+			delete m_plugins;
+			m_plugins = retired;
+			throw;
+		}
+
+		tracer::unlock();
+	}
+	catch (...) {
+		tracer::unlock();
+		throw;
+	}
+#endif
+
+	*m_proc = *rval.m_proc;
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Count an exception trace signature in the recent signature cache (not
+ *	thread safe, tracer::s_lock must be held)
+ *
+ * @param[in] sig the signature
+ *
+ * @returns the repeats of the signature in its window (0 if the trace is output in full)
+ *
+ * @note
+ *	The cache is set associative, a new signature replaces the least recently
+ *	used one of its set. A signature seen after its window starts a new window
+ */
+u32 tracer::deduplicate(u64 sig)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	u64 ms = static_cast<u64> (now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+
+	trace_signature *set = m_signatures + (sig & (g_dedup_sets - 1)) * g_dedup_ways;
+	trace_signature *victim = set;
+	m_signature_ticks++;
+
+	for (u32 i = 0; likely(i < g_dedup_ways); i++) {
+		trace_signature *cur = &set[i];
+		if ( likely(cur->used > 0 && cur->hash == sig) ) {
+			cur->used = m_signature_ticks;
+			if ( likely(ms - cur->window < s_dedup_window) ) {
+				return ++cur->repeats;
+			}
+
+			cur->window = ms;
+			cur->repeats = 0;
+			return 0;
+		}
+
+		if ( likely(cur->used < victim->used) ) {
+			victim = cur;
+		}
+	}
+
+	victim->hash = sig;
+	victim->window = ms;
+	victim->used = m_signature_ticks;
+	victim->repeats = 0;
+	return 0;
+}
+
+
+/**
+ * @brief Release object resources
+ *
+ * @returns *this
+ */
+inline tracer& tracer::destroy()
+{
+#ifdef WITH_FILTER
+	delete m_filters;
+	delete m_compiled;
+	delete m_verdicts;
+	delete m_patcher;
+	m_filters = NULL;
+	m_compiled = NULL;
+	m_verdicts = NULL;
+	m_patcher = NULL;
+#endif
+
+#ifdef WITH_PLUGIN
+	/* No plugin is dispatched after the tracer shuts down */
+	release_plugins(m_snapshot);
+	m_snapshot = NULL;
+
+	while ( likely(m_retired != NULL) ) {
+		plugin_table *t = m_retired;
+		m_retired = t->next;
+		release_plugins(t);
+	}
+
+	delete m_plugins;
+	m_plugins = NULL;
+#endif
+
+	delete m_proc;
+	m_proc = NULL;
+
+	/* The list owns the sampling counters, the index doesn't */
+	delete m_sample_index;
+	delete m_samples;
+	m_sample_index = NULL;
+	m_samples = NULL;
+
+	delete[] m_signatures;
+	m_signatures = NULL;
+
+	return *this;
+}
+
+
+/**
+ * @brief Lay out the stack trace of a thread snapshot with a formatter
+ *
+ * @param[in,out] dst the trace destination string
+ *
+ * @param[in,out] fmt the trace format
+ *
+ * @param[in] snap the stack snapshot (nothing is appended if the thread exited)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+tracer& tracer::format_trace(string &dst, formatter &fmt, const stack_snapshot &snap) const
+{
+	if ( unlikely(snap.frames == NULL) ) {
+		return const_cast<tracer&> (*this);
+	}
+
+	fmt.begin_trace(dst, snap.id, snap.name.cstring(), snap.depth, 0);
+
+	/* For each function call */
+	for (u32 i = 0; likely(i < snap.depth); i++) {
+		symbolize(dst, fmt, &snap.frames[i], snap.frames[i].repeats);
+	}
+
+	fmt.end_trace(dst, snap.dropped);
+	return const_cast<tracer&> (*this);
+}
+
+
+/**
+ * @brief
+ *	Take a timer sample, counting the functions of all the simulated stacks
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	Each function is counted once per sample in the total samples, even if it's
+ *	called recursively. The top function of each stack is counted in the self
+ *	samples. Blocked threads are sampled as well (wall clock profile)
+ */
+tracer& tracer::sample()
+{
+	pthread_t *ids = NULL;
+
+	try {
+		tracer::lock();
+
+		/* The thread IDs are copied first, see tracer::dump */
+		m_proc->lock();
+
+		u32 sz = m_proc->thread_count();
+		try {
+			ids = new pthread_t[sz];
+			for (u32 i = 0; likely(i < sz); i++) {
+				ids[i] = m_proc->get_thread(i)->handle();
+			}
+
+			m_proc->unlock();
+		}
+		catch (...) {
+			m_proc->unlock();
+			throw;
+		}
+
+		u64 tick = ++m_sample_ticks;
+		for (u32 i = 0; likely(i < sz); i++) {
+			/* The sampled threads are not blocked while their functions are counted */
+			string nm;
+			u32 depth = 0;
+			frame_t *frames = snapshot(ids[i], depth, nm);
+			if ( unlikely(frames == NULL) ) {
+				continue;
+			}
+
+			try {
+				for (u32 j = 0; likely(j < depth); j++) {
+					mem_addr_t fn = frames[depth - 1 - j].fn;
+
+					sample_counter *cnt = m_sample_index->find(fn);
+					if ( unlikely(cnt == NULL) ) {
+						cnt = new sample_counter;
+						cnt->fn = fn;
+						cnt->self = cnt->total = cnt->stamp = 0;
+
+						/* The counter is new, the duplicate check is skipped */
+						try {
+							m_samples->add_range(&cnt, 1, true);
+						}
+						catch (...) {
+							delete cnt;
+							throw;
+						}
+
+						m_sample_index->insert(fn, cnt);
+					}
+
+					if ( unlikely(j == 0) ) {
+						cnt->self++;
+					}
+
+					if ( likely(cnt->stamp != tick) ) {
+						cnt->stamp = tick;
+						cnt->total++;
+					}
+				}
+
+				delete[] frames;
+			}
+			catch (...) {
+				delete[] frames;
+				throw;
+			}
+		}
+
+		delete[] ids;
+		tracer::unlock();
+		return *this;
+	}
+	catch (...) {
+		delete[] ids;
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Copy a snapshot of the simulated call stack of a thread
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[out] depth the copied frame count (the call depth)
+ *
+ * @param[out] nm the thread name
+ *
+ * @param[out] dropped the calls past the maximum depth (can be NULL)
+ *
+ * @param[out] seq the stack sequence of the copy (can be NULL, see thread::snapshot)
+ *
+ * @returns the frames (bottom to top, heap allocated) or NULL if no thread has this ID
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The tracer is locked only while the frames and the name are copied, so the
+ *	thread is not disposed meanwhile. The thread itself is never blocked (see
+ *	thread::snapshot), so the snapshot can be symbolized and formatted later
+ *	without holding any lock
+ */
+frame_t* tracer::snapshot(pthread_t id, u32 &depth, string &nm, u32 *dropped, u32 *seq) const
+{
+	frame_t *retval = NULL;
+
+	try {
+		tracer::lock();
+
+		depth = 0;
+		thread *thr = m_proc->get_thread(id);
+		if ( unlikely(thr == NULL) ) {
+			tracer::unlock();
+			return NULL;
+		}
+
+		nm.set("%s", (likely(thr->name() != NULL)) ? thr->name() : "anonymous");
+
+		/* Retry with a larger array if the stack grew meanwhile */
+		u32 max = 0, cnt = 0;
+		depth = thr->call_depth();
+		do {
+			delete[] retval;
+			retval = NULL;
+
+			max = depth + g_snapshot_slack;
+			retval = new frame_t[max];
+			cnt = thr->snapshot(retval, max, depth, dropped, seq);
+		} while ( unlikely(cnt < depth) );
+
+		tracer::unlock();
+		return retval;
+	}
+	catch (...) {
+		delete[] retval;
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief Get the library search paths of a loaded object
+ *
+ * @param[in] addr an address in the object
+ *
+ * @returns the paths (heap allocated, an u8 array) or NULL if they can't be read
+ *
+ * @note Doesn't throw, the dlinfo(3) errors are cleared
+ */
+Dl_serinfo* tracer::search_paths(const void *addr)
+{
+	Dl_info info;
+	link_map *map = NULL;
+	if ( unlikely(dladdr1(addr, &info, reinterpret_cast<void**> (&map), RTLD_DL_LINKMAP) == 0 ||
+								map == NULL) ) {
+		return NULL;
+	}
+
+	Dl_serinfo sz;
+	if ( unlikely(dlinfo(map, RTLD_DI_SERINFOSIZE, &sz) != 0) ) {
+		dlerror();
+		return NULL;
+	}
+
+	Dl_serinfo *retval = reinterpret_cast<Dl_serinfo*> (new (std::nothrow) u8[sz.dls_size]);
+	if ( unlikely(retval == NULL) ) {
+		return NULL;
+	}
+
+	retval->dls_size = sz.dls_size;
+	retval->dls_cnt = sz.dls_cnt;
+	if ( unlikely(dlinfo(map, RTLD_DI_SERINFO, retval) != 0) ) {
+		dlerror();
+		delete[] reinterpret_cast<u8*> (retval);
+		return NULL;
+	}
+
+	return retval;
+}
+
+
+/**
+ * @brief Take a snapshot of the simulated call stack of each thread
+ *
+ * @param[out] cnt the snapshot count
+ *
+ * @param[in] resolve true to resolve the function names of all the frames
+ *
+ * @param[in] base
+ *	the previous delta dump (can be NULL), the threads whose stack sequence
+ *	didn't change since are not copied
+ *
+ * @returns the snapshots (to be released with tracer::release_snapshots)
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The thread IDs are copied first and the process lock is not held while the
+ *	stacks are copied, as threads keep registering. The function names are
+ *	resolved in a single batch (see process::lookup), so the frames are then
+ *	symbolized from the name cache, instead of one module search and one lock
+ *	acquisition per frame. The suspended execution contexts (see
+ *	instrument::context) follow the threads, copied under the process lock, with
+ *	the context address as ID
+ */
+tracer::stack_snapshot* tracer::snapshot_threads(u32 &cnt, bool resolve, const stack_delta *base) const
+{
+	stack_snapshot *retval = NULL;
+	mem_addr_t *addrs = NULL;
+	const i8 **names = NULL;
+	cnt = 0;
+
+	try {
+		m_proc->lock();
+
+		u32 sz = m_proc->thread_count();
+		u32 contexts = m_proc->context_count();
+		try {
+			retval = new stack_snapshot[sz + contexts];
+			for (u32 i = 0; likely(i < sz + contexts); i++) {
+				retval[i].id = (likely(i < sz)) ? m_proc->get_thread(i)->handle() : 0;
+				retval[i].serial = (likely(i < sz)) ? m_proc->get_thread(i)->serial() : 0;
+				retval[i].frames = NULL;
+				retval[i].depth = 0;
+				retval[i].dropped = 0;
+				retval[i].seq = ~0U;
+				retval[i].unchanged = false;
+			}
+
+			/* The active contexts are skipped, their frames are in the thread stacks */
+			cnt = sz;
+			for (u32 i = 0; likely(i < contexts); i++) {
+				const context *ctx = m_proc->get_context(i);
+				stack_snapshot &cur = retval[cnt];
+				cur.frames = ctx->snapshot(cur.depth, cur.dropped);
+				if ( unlikely(cur.frames == NULL) ) {
+					continue;
+				}
+
+				cnt++;
+				cur.id = reinterpret_cast<pthread_t> (ctx);
+				cur.name.set("%s", (likely(ctx->name() != NULL)) ? ctx->name() : "anonymous");
+			}
+
+			m_proc->unlock();
+		}
+		catch (...) {
+			m_proc->unlock();
+			throw;
+		}
+
+		u32 frames = 0;
+		for (u32 i = 0; likely(i < cnt); i++) {
+			stack_snapshot &cur = retval[i];
+			if ( unlikely(base != NULL && i < sz) ) {
+				const stack_delta::entry *prev = base->find(cur.id);
+				if ( likely(prev != NULL && prev->serial == cur.serial && !(prev->seq & 1)) ) {
+					tracer::lock();
+					const thread *thr = m_proc->get_thread(cur.id);
+					cur.unchanged = (likely(thr != NULL) && thr->serial() == prev->serial &&
+													 thr->sequence() == prev->seq);
+					tracer::unlock();
+				}
+
+				if ( likely(cur.unchanged) ) {
+					continue;
+				}
+			}
+
+			if ( likely(i < sz) ) {
+				cur.frames = snapshot(cur.id, cur.depth, cur.name, &cur.dropped, &cur.seq);
+			}
+
+			frames += cur.depth;
+		}
+
+		if ( likely(resolve && frames > 0) ) {
+			addrs = new mem_addr_t[frames];
+			names = new const i8*[frames];
+
+			for (u32 i = 0, n = 0; likely(i < cnt); i++) {
+				for (u32 j = 0; likely(j < retval[i].depth); j++) {
+					addrs[n++] = retval[i].frames[j].fn;
+				}
+			}
+
+			m_proc->lookup(addrs, frames, names);
+		}
+
+		delete[] names;
+		delete[] addrs;
+		return retval;
+	}
+	catch (...) {
+		delete[] names;
+		delete[] addrs;
+		release_snapshots(retval, cnt);
+		cnt = 0;
+		throw;
+	}
+}
+
+
+/**
+ * @brief Format a frame, symbolized if the format needs it
+ *
+ * @param[in,out] dst the trace destination string
+ *
+ * @param[in,out] fmt the trace format
+ *
+ * @param[in] cur the frame
+ *
+ * @param[in] repeats the folded calls of the frame included in the trace
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+tracer& tracer::symbolize(string &dst, formatter &fmt, const frame_t *cur, u32 repeats) const
+{
+	if ( unlikely(!fmt.is_symbolic()) ) {
+		fmt.frame(dst, cur->fn, cur->site, NULL, NULL, repeats);
+		return const_cast<tracer&> (*this);
+	}
+
+	/* The symbol names are demangled once and kept by the symbol tables */
+	const i8 *nm = m_proc->lookup(cur->fn);
+	const i8 *line = source_line(m_proc->get_module(cur->site), cur->site);
+
+	fmt.frame(dst, cur->fn, cur->site, nm, line, repeats);
+	return const_cast<tracer&> (*this);
+}
+
+
+#ifdef WITH_FILTER
+/**
+ * @brief
+ *	Combine the registered filters of the same type and case sensitivity and
+ *	compile them, then discard the cached verdicts (not thread safe,
+ *	tracer::m_filter_lock must be held)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note Each expression is grouped, so the combined expression is an alternation
+ */
+tracer& tracer::compile_filters()
+{
+	list<filter> *compiled = new list<filter>;
+
+	try {
+		const bool modes[] = {MODULE_FILTER, SYMBOL_FILTER};
+		for (u32 i = 0; likely(i < 4); i++) {
+			bool mode = modes[i >> 1];
+			bool icase = (i & 1);
+
+			string buf;
+			for (u32 j = 0, sz = m_filters->size(); likely(j < sz); j++) {
+				const filter *f = m_filters->at(j);
+
+				if ( likely(f->mode() == mode && f->icase() == icase) ) {
+					buf.append((buf.length() == 0) ? "(%s)" : "|(%s)", f->expr());
+				}
+			}
+
+			if ( likely(buf.length() > 0) ) {
+				compiled->add(new filter(buf.cstring(), icase, mode));
+			}
+		}
+	}
+	catch (...) {
+		delete compiled;
+		throw;
+	}
+
+	/* The calls running meanwhile may be unmatched, the simulated stacks start over */
+	if ( unlikely(m_patcher != NULL) ) {
+		m_patcher->revert();
+		control::restart();
+	}
+
+	delete m_compiled;
+	m_compiled = compiled;
+	m_verdicts->clear();
+	store_release(&m_filter_generation, control::next_filter_generation());
+	store_release(&m_filtering, m_filters->size() > 0);
+	select_hooks();
+
+#ifdef WITH_SLEDS
+	/* The sleds disabled by the replaced filters are enabled again */
+	if ( unlikely(s_sleds) ) {
+		sled::enable_all(m_proc);
+	}
+#endif
+
+	return *this;
+}
+
+
+/**
+ * @brief Apply the filters to a function and cache the verdict
+ *
+ * @param[in] addr the function address
+ *
+ * @returns true if the function is filtered out, false otherwise
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The function is filtered out if its module path matches a module filter or
+ *	its name matches a symbol filter. Unresolved functions are not filtered out
+ */
+bool tracer::verdict(mem_addr_t addr)
+{
+	lock_mutex(&m_filter_lock);
+
+	try {
+		/* The verdict may have been cached meanwhile */
+		const bool *retval = m_verdicts->find(addr);
+		if ( likely(retval == NULL) ) {
+			const symtab *module = m_proc->get_module(addr);
+
+			bool filtered = false;
+			count_metric(METRIC_FILTER_EVALS, 1);
+			if ( likely(module != NULL) ) {
+				filtered = apply_module_filters(module->path());
+				filtered = filtered || apply_symbol_filters(module->addr2name(addr));
+			}
+
+			retval = &s_verdicts[filtered];
+			m_verdicts->insert(addr, retval);
+		}
+
+		pthread_mutex_unlock(&m_filter_lock);
+		return *retval;
+	}
+	catch (...) {
+		pthread_mutex_unlock(&m_filter_lock);
+		throw;
+	}
+}
+#endif
+
+
+#ifdef WITH_PLUGIN
+/**
+ * @brief
+ *	Publish a new plugin snapshot, built from the registered plugins, and retire
+ *	the replaced snapshot (not thread safe, tracer::s_lock must be held)
+ *
+ * @param[in] retired
+ *	the unregistered plugins, deleted with the replaced snapshot (can be NULL)
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	If the snapshot can't be built, an empty snapshot is published (no plugin
+ *	is dispatched until the next successful call) and the exception is
+ *	rethrown. The replaced snapshot is retired in any case
+ */
+tracer& tracer::publish_plugins(list<plugin> *retired)
+{
+	plugin_table *t = NULL;
+	bool failed = false;
+
+	try {
+		u32 sz = m_plugins->size();
+		if ( likely(sz > 0) ) {
+			t = new plugin_table;
+			t->size = sz;
+			t->begin = NULL;
+			t->end = NULL;
+			t->retired = NULL;
+			t->next = NULL;
+
+			t->begin = new modsym_t[sz];
+			t->end = new modsym_t[sz];
+			for (u32 i = 0; likely(i < sz); i++) {
+				const plugin *plg = m_plugins->at(i);
+				t->begin[i] = plg->begin_callback();
+				t->end[i] = plg->end_callback();
+			}
+		}
+	}
+	catch (...) {
+		release_plugins(t);
+		t = NULL;
+		failed = true;
+	}
+
+	plugin_table *old = m_snapshot;
+	store_release(&m_snapshot, t);
+	select_hooks();
+
+	if ( likely(old != NULL) ) {
+		old->retired = retired;
+		old->next = m_retired;
+		m_retired = old;
+	}
+	else {
+		delete retired;
+	}
+
+	reclaim_plugins();
+	if ( unlikely(failed) ) {
+		throw std::bad_alloc();
+	}
+
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Dispose the retired plugin snapshots, once all their readers are done (not
+ *	thread safe, tracer::s_lock must be held)
+ *
+ * @returns *this
+ *
+ * @note
+ *	Each reader stripe must be seen idle once, after the snapshots were
+ *	retired. The method yields while waiting, up to g_plugin_grace_sz times per
+ *	stripe. Otherwise (e.g a plugin callback that registers a plugin) the
+ *	disposal is deferred to the next call
+ */
+tracer& tracer::reclaim_plugins()
+{
+	if ( likely(m_retired == NULL) ) {
+		return *this;
+	}
+
+	/* Order the snapshot publication before the reader count checks */
+	memory_barrier();
+
+	for (u32 i = 0; likely(i < g_plugin_stripes); i++) {
+		u32 n = 0;
+		while ( unlikely(load_acquire(&m_readers[i].count) != 0) ) {
+			if ( unlikely(++n > g_plugin_grace_sz) ) {
+				return *this;
+			}
+
+			sched_yield();
+		}
+	}
+
+	while ( likely(m_retired != NULL) ) {
+		plugin_table *t = m_retired;
+		m_retired = t->next;
+		release_plugins(t);
+	}
+
+	return *this;
+}
+#endif
+
+
+/**
+ * @brief Get the interface object
+ *
+ * @returns tracer::s_iface if the interface object is ready, NULL otherwise
+ *
+ * @note
+ *	The tracer becomes ready once, after the library constructor has loaded the
+ *	symbol tables, so the check costs a single (acquire) load
+ */
+tracer* tracer::interface()
+{
+	if ( likely(load_acquire(&s_state) == TRACER_READY) ) {
+		return s_iface;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief Get the call sampling period
+ *
+ * @returns
+ *	tracer::s_sample_period in call sampling mode (SAMPLING_CALLS), 0 otherwise
+ *	(every call is simulated)
+ */
+u32 tracer::sample_period()
+{
+	return (likely(s_sampling != SAMPLING_CALLS)) ? 0 : s_sample_period;
+}
+
+
+/**
+ * @brief Select the hook variant that serves the current configuration
+ *
+ * @note
+ *	Called whenever the plugins, the filters or the recorder size change. The
+ *	selection is rechecked after it's published, so concurrent changes settle
+ *	on the variant of the latest configuration. The threads that run a replaced
+ *	variant meanwhile serve the features of the previous configuration, as if
+ *	the change happened after their call
+ */
+void tracer::select_hooks()
+{
+	u32 features = 0;
+
+	do {
+		features = hook_features();
+		store_release(&s_hooks, &s_variants[features]);
+	} while ( unlikely(hook_features() != features) );
+}
+
+
+/**
+ * @brief Get the initialization state
+ *
+ * @returns tracer::s_state (one of the TRACER_* definitions)
+ */
+tracer_state_t tracer::state()
+{
+	return load_acquire(&s_state);
+}
+
+
+/**
+ * @brief Lock the access mutex
+ *
+ * @note Recursive locking is supported
+ */
+void tracer::lock()
+{
+	lock_mutex(&s_lock);
+}
+
+
+/**
+ * @brief Unlock the access mutex
+ */
+void tracer::unlock()
+{
+	pthread_mutex_unlock(&s_lock);
+}
+
+
+/**
+ * @brief Stream insertion operator for instrument::tracer objects
+ *
+ * @param[in] lval the output stream
+ *
+ * @param[in] rval the object to output
+ *
+ * @returns its first argument
+ */
+std::ostream& operator<<(std::ostream &lval, tracer &rval)
+{
+	try {
+		string buf;
+		rval.trace(buf);
+
+		util::lock();
+		lval << buf;
+		util::unlock();
+
+		return lval;
+	}
+	catch (exception &x) {
+		lval << x;
+	}
+	catch (std::exception &x) {
+		lval << x;
+	}
+
+	rval.unwind();
+	util::unlock();
+	return lval;
+}
+
+
+/**
+ * @brief Get the process handle
+ *
+ * @returns this->m_proc
+ */
+inline process* tracer::proc() const
+{
+	return m_proc;
+}
+
+
+/**
+ * @brief
+ *	Encode the stack traces of all threads (and of the suspended execution
+ *	contexts) as binary IDP v2 TRACE messages. The stacks are not unwinded
+ *
+ * @param[in,out] dst the encoder
+ *
+ * @returns *this
+ *
+ * @throw std::bad_alloc
+ * @throw instrument::exception
+ *
+ * @note The stacks are copied first, as in tracer::dump(string&)
+ */
+tracer& tracer::dump(encoder &dst) const
+{
+	stack_snapshot *snaps = NULL;
+	u32 sz = 0;
+
+	try {
+		snaps = snapshot_threads(sz, false);
+
+		for (u32 i = 0; likely(i < sz); i++) {
+			const stack_snapshot &cur = snaps[i];
+			if ( unlikely(cur.frames == NULL) ) {
+				continue;
+			}
+
+			dst.begin_trace(cur.id, cur.name.cstring(), cur.depth);
+			for (u32 j = 0; likely(j < cur.depth); j++) {
+				dst.frame(cur.frames[j].fn, cur.frames[j].site);
+			}
+
+			dst.end_trace();
+		}
+
+		release_snapshots(snaps, sz);
+		return const_cast<tracer&> (*this);
+	}
+	catch (...) {
+		release_snapshots(snaps, sz);
+		throw;
+	}
+}
+
+
+/**
+ * @brief
+ *	Encode the changes of the stacks of all threads (and of the suspended
+ *	execution contexts) since the previous delta dump, as binary IDP v2 DELTA
+ *	messages. The stacks are not unwinded
+ *
+ * @param[in,out] dst the encoder (the one the previous delta dumps used)
+ *
+ * @param[in,out] base the stacks of the previous delta dump (updated)
+ *
+ * @returns *this
+ *
+ * @throw std::bad_alloc
+ * @throw instrument::exception
+ *
+ * @note
+ *	A changed stack is sent as the depth of the outermost frames it shares with
+ *	its previous frames and the frames past them. The unchanged stacks are not
+ *	sent (nor copied, if their sequence didn't change) and the stacks gone since
+ *	(exited threads, resumed or disposed contexts) are sent as exited. The stack
+ *	of a new thread that reuses a previous thread ID is sent in full. If the
+ *	dump fails, the base is not updated, so the next dump sends the changes
+ *	since the last successful one
+ */
+tracer& tracer::dump(encoder &dst, stack_delta &base) const
+{
+	stack_snapshot *snaps = NULL;
+	stack_delta::entry *entries = NULL;
+	u32 sz = 0, cnt = 0;
+
+	try {
+		for (u32 i = 0; likely(i < base.size()); i++) {
+			base.m_entries[i].seen = false;
+		}
+
+		snaps = snapshot_threads(sz, false, &base);
+		entries = new stack_delta::entry[sz];
+
+		/* The frames change hands once the dump can't fail anymore */
+		u64 number = base.count() + 1;
+		for (u32 i = 0; likely(i < sz); i++) {
+			stack_snapshot &cur = snaps[i];
+			if ( unlikely(cur.frames == NULL && !cur.unchanged) ) {
+				continue;
+			}
+
+			stack_delta::entry *prev = base.find(cur.id);
+			if ( likely(prev != NULL) ) {
+				prev->seen = true;
+			}
+
+			stack_delta::entry &next = entries[cnt++];
+			next.id = cur.id;
+			next.serial = cur.serial;
+			next.seen = false;
+			if ( likely(cur.unchanged) ) {
+				next.frames = prev->frames;
+				next.depth = prev->depth;
+				next.seq = prev->seq;
+				continue;
+			}
+
+			next.frames = cur.frames;
+			next.depth = cur.depth;
+			next.seq = cur.seq;
+
+			/* The outermost frames shared with the previous stack of the same thread are kept */
+			u32 kept = 0;
+			if ( likely(prev != NULL && prev->serial == cur.serial) ) {
+				u32 max = (prev->depth < cur.depth) ? prev->depth : cur.depth;
+				while ( likely(kept < max && cur.frames[kept].fn == prev->frames[kept].fn &&
+											 cur.frames[kept].site == prev->frames[kept].site) ) {
+					kept++;
+				}
+
+				if ( unlikely(kept == cur.depth && kept == prev->depth) ) {
+					continue;
+				}
+			}
+
+			dst.begin_delta(number, cur.id, cur.name.cstring(), false, kept, cur.depth - kept);
+			for (u32 j = kept; likely(j < cur.depth); j++) {
+				dst.frame(cur.frames[j].fn, cur.frames[j].site);
+			}
+
+			dst.end_delta();
+		}
+
+		/* The previous stacks not found are gone */
+		for (u32 i = 0; likely(i < base.size()); i++) {
+			const stack_delta::entry &prev = base.m_entries[i];
+			if ( unlikely(!prev.seen) ) {
+				dst.begin_delta(number, prev.id, NULL, true, 0, 0);
+				dst.end_delta();
+			}
+		}
+
+		for (u32 i = 0; likely(i < sz); i++) {
+			stack_snapshot &cur = snaps[i];
+			if ( likely(cur.unchanged) ) {
+				base.find(cur.id)->frames = NULL;
+			}
+
+			cur.frames = NULL;
+		}
+
+		base.replace(entries, cnt);
+		release_snapshots(snaps, sz);
+		return const_cast<tracer&> (*this);
+	}
+	catch (...) {
+		delete[] entries;
+		release_snapshots(snaps, sz);
+		throw;
+	}
+}
+
+
+/**
+ * @brief
+ *	Create multiple stack traces using the simulated call stack of each thread.
+ *	The traces, followed by the latest flight recorder events of each thread if
+ *	recording is on, are appended to a string. The stacks are not unwinded
+ *
+ * @param[in,out] dst the trace destination string
+ *
+ * @returns *this
+ *
+ * @throw std::bad_alloc
+ * @throw instrument::exception
+ */
+tracer& tracer::dump(string &dst) const
+{
+	stack_snapshot *snaps = NULL;
+	u32 sz = 0;
+
+	try {
+		/*
+		 * Threads keep registering while the dump is produced, so the stacks are
+		 * copied first, the process lock is not held meanwhile and each copy holds
+		 * the tracer lock only while the thread stack is copied. All the frames
+		 * are resolved at once, before any trace is laid out
+		 */
+		text_formatter fmt;
+		snaps = snapshot_threads(sz, true);
+
+		for (u32 i = 0; likely(i < sz); i++) {
+			format_trace(dst, fmt, snaps[i]);
+
+			/* The latest events of each thread follow its trace, if recording */
+			if ( unlikely(recorder::slots() > 0) ) {
+				history(dst, snaps[i].id, g_recorder_dump_sz);
+			}
+
+			if ( likely(i < sz - 1) ) {
+				dst.append("\r\n");
+			}
+		}
+
+		release_snapshots(snaps, sz);
+		return const_cast<tracer&> (*this);
+	}
+	catch (...) {
+		release_snapshots(snaps, sz);
+		throw;
+	}
+}
+
+
+/**
+ * @brief
+ *	Create multiple stack traces using the simulated call stack of each thread,
+ *	laid out by a formatter, and append them to a string. The stacks are not
+ *	unwinded
+ *
+ * @param[in,out] dst the trace destination string
+ *
+ * @param[in,out] fmt the trace format
+ *
+ * @returns *this
+ *
+ * @throw std::bad_alloc
+ * @throw instrument::exception
+ *
+ * @note The flight recorder events are not included
+ */
+tracer& tracer::dump(string &dst, formatter &fmt) const
+{
+	stack_snapshot *snaps = NULL;
+	u32 sz = 0;
+
+	try {
+		/* The stacks are copied and resolved first, as in tracer::dump(string&) */
+		snaps = snapshot_threads(sz, fmt.is_symbolic());
+
+		for (u32 i = 0; likely(i < sz); i++) {
+			format_trace(dst, fmt, snaps[i]);
+		}
+
+		release_snapshots(snaps, sz);
+		return const_cast<tracer&> (*this);
+	}
+	catch (...) {
+		release_snapshots(snaps, sz);
+		throw;
+	}
+}
+
+
+/**
+ * @brief Apply a new control block generation to the current thread
+ *
+ * @param[in] thr the current thread
+ *
+ * @param[in] word the tracing word of the new generation (see control::tracing)
+ *
+ * @returns *this
+ *
+ * @note
+ *	The thread starts over its simulated stack (see thread::resync). If the
+ *	control block filter generation changed, the cached verdicts are discarded
+ */
+tracer& tracer::resync(thread *thr, u32 word)
+{
+	thr->resync(word);
+
+#ifdef WITH_FILTER
+	if ( unlikely(load_acquire(&m_filter_generation) != control::filter_generation()) ) {
+		lock_mutex(&m_filter_lock);
+		u32 gen = control::filter_generation();
+		if ( likely(m_filter_generation != gen) ) {
+			m_verdicts->clear();
+			store_release(&m_filter_generation, gen);
+		}
+
+		pthread_mutex_unlock(&m_filter_lock);
+	}
+#endif
+
+	return *this;
+}
+
+
+/**
+ * @brief
+ *	Encode an exception stack trace, using the simulated call stack of the
+ *	current thread, as a binary IDP v2 TRACE message. The simulated stack is
+ *	unwinded
+ *
+ * @param[in,out] dst the encoder
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @attention
+ *	The simulated call stack is <b>unwinded even if the method fails, in any way
+ *	to produce a trace</b>
+ */
+tracer& tracer::trace(encoder &dst)
+{
+	thread *thr = NULL;
+
+	/* If an exception occurs, unwind, unlock and rethrow it */
+	try {
+		tracer::lock();
+		thr = m_proc->current_thread();
+		thr->lock();
+
+		/*
+		 * The lag counts calls, so the frame of the catching function is found
+		 * past the dropped and the folded calls. In call sampling mode, the
+		 * catching function may not be simulated
+		 */
+		u32 calls = (likely(thr->lag() > 0)) ? thr->lag() + 1 : 1;
+		u32 repeats = 0;
+		i32 top = thr->frame_of(calls - 1, repeats);
+		dst.begin_trace(thr->handle(), thr->name(), top + 1);
+
+		for (i32 i = top; likely(i >= 0); i--) {
+			const frame_t *cur = thr->backtrace(i);
+			dst.frame(cur->fn, cur->site);
+		}
+
+		dst.end_trace();
+		thr->unwind();
+		thr->unlock();
+		tracer::unlock();
+
+		return *this;
+	}
+	catch (...) {
+		if ( likely(thr != NULL) ) {
+			thr->unlock();
+		}
+
+		unwind();
+		tracer::unlock();
+		throw;
+	}
+}
+
+
+/**
+ * @brief
+ *	Encode the stack trace of a thread indexed by its ID, as a binary IDP v2
+ *	TRACE message
+ *
+ * @param[in,out] dst the encoder
+ *
+ * @param[in] id the thread ID
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ */
+tracer& tracer::trace(encoder &dst, pthread_t id) const
+{
+	string nm;
+	u32 depth = 0;
+
+	/* The frames are encoded after the snapshot, without holding any lock */
+	frame_t *frames = snapshot(id, depth, nm);
+	if ( unlikely(frames == NULL) ) {
+		return const_cast<tracer&> (*this);
+	}
+
+	try {
+		dst.begin_trace(id, nm.cstring(), depth);
 
+		for (u32 i = 0; likely(i < depth); i++) {
+			dst.frame(frames[i].fn, frames[i].site);
+		}
 
-/**
- * @brief Object destructor
- */
-tracer::~tracer()
-{
-	destroy();
+		dst.end_trace();
+		delete[] frames;
+
+		return const_cast<tracer&> (*this);
+	}
+	catch (...) {
+		delete[] frames;
+		throw;
+	}
 }
 
 
 /**
- * @brief Object virtual copy constructor
+ * @brief
+ *	Create an exception stack trace using the simulated call stack of the
+ *	current thread. The trace is appended to a string and the simulated stack is
+ *	unwinded
  *
- * @returns the object copy (heap allocated)
+ * @param[in,out] dst the trace destination string
+ *
+ * @returns *this
  *
  * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @attention
+ *	The simulated call stack is <b>unwinded even if the method fails, in any way
+ *	to produce a trace</b>
+ *
+ * @note The trace is laid out as text (see instrument::text_formatter)
  */
-inline tracer* tracer::clone() const
+tracer& tracer::trace(string &dst)
 {
-	return new tracer(*this);
+	text_formatter fmt;
+	return trace(dst, fmt);
 }
 
 
 /**
- * @brief Assignment operator
+ * @brief
+ *	Create the stack trace of a thread indexed by its ID and append it to a
+ *	string
  *
- * @param[in] rval the assigned object
+ * @param[in,out] dst the trace destination string
+ *
+ * @param[in] id the thread ID
  *
  * @returns *this
  *
  * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note The trace is laid out as text (see instrument::text_formatter)
  */
-inline tracer& tracer::operator=(const tracer &rval)
+tracer& tracer::trace(string &dst, pthread_t id) const
 {
-	if ( unlikely(this == &rval) ) {
-		return *this;
-	}
-
-	/* todo Copy filters if they are made copyable */
-
-#ifdef WITH_PLUGIN
-	*m_plugins = *rval.m_plugins;
-#endif
-
-	*m_proc = *rval.m_proc;
-	return *this;
+	text_formatter fmt;
+	return trace(dst, fmt, id);
 }
 
 
 /**
- * @brief Release object resources
+ * @brief
+ *	Create an exception stack trace using the simulated call stack of the
+ *	current thread, laid out by a formatter. The trace is appended to a string
+ *	and the simulated stack is unwinded
+ *
+ * @param[in,out] dst the trace destination string (e.g a stream)
+ *
+ * @param[in,out] fmt the trace format
  *
  * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @attention
+ *	The simulated call stack is <b>unwinded even if the method fails, in any way
+ *	to produce a trace</b>
+ *
+ * @note
+ *	If deduplicating (see g_dedup_env), the trace signature is passed to the
+ *	formatter and the repeats of a signature in its window are formatted as a
+ *	single repeat record, without any symbolization. The trace is formatted
+ *	straight into the destination, no intermediate text is built
  */
-inline tracer& tracer::destroy()
+tracer& tracer::trace(string &dst, formatter &fmt)
 {
-#ifdef WITH_FILTER
-	delete m_filters;
-	m_filters = NULL;
-#endif
-
-#ifdef WITH_PLUGIN
-	delete m_plugins;
-	m_plugins = NULL;
-#endif
+	thread *thr = NULL;
 
-	delete m_proc;
-	m_proc = NULL;
+	/* If an exception occurs, unwind, unlock and rethrow it */
+	try {
+		tracer::lock();
+		thr = m_proc->current_thread();
+		thr->lock();
 
-	return *this;
-}
+		const i8 *nm = thr->name();
+		if ( likely(nm == NULL) ) {
+			nm = "anonymous";
+		}
 
+		/*
+		 * The lag counts calls, so the frame of the catching function is found
+		 * past the dropped and the folded calls. In call sampling mode, the
+		 * catching function may not be simulated
+		 */
+		u32 calls = (likely(thr->lag() > 0)) ? thr->lag() + 1 : 1;
+		u32 repeats = 0;
+		i32 top = thr->frame_of(calls - 1, repeats);
+
+		u64 sig = 0;
+		if ( unlikely(m_signatures != NULL) ) {
+			/* The repeats are counted, not symbolized */
+			sig = signature(thr, top);
+			u32 seen = deduplicate(sig);
+			if ( likely(seen > 0) ) {
+				fmt.repeat(dst, thr->handle(), nm, sig, seen);
+
+				thr->unwind();
+				thr->unlock();
+				tracer::unlock();
+				return *this;
+			}
+		}
 
-/**
- * @brief Get the interface object
- *
- * @returns tracer::s_iface if the interface object is enabled, NULL otherwise
- */
-tracer* tracer::interface()
-{
-	/* The interface is not yet initialized */
-	if ( unlikely(s_iface == NULL) ) {
-		return NULL;
-	}
+		fmt.begin_trace(dst, thr->handle(), nm, top + 1, sig);
 
-	const process *proc = s_iface->m_proc;
+		/* For each function call, the catching one may be partially folded */
+		for (i32 i = top; likely(i >= 0); i--) {
+			const frame_t *cur = thr->backtrace(i);
+			symbolize(dst, fmt, cur, (unlikely(i == top)) ? repeats : cur->repeats);
+		}
 
-	/* The interface process handle is not yet initialized */
-	if ( unlikely(proc == NULL) ) {
-		return NULL;
-	}
+		u32 dropped = thr->dropped_calls();
+		fmt.end_trace(dst, (likely(dropped < calls)) ? dropped : calls);
+		thr->unwind();
+		thr->unlock();
+		tracer::unlock();
 
-	/* No modules are loaded yet */
-	else if ( unlikely(proc->module_count() == 0) ) {
-		return NULL;
+		return *this;
 	}
+	catch (...) {
+		if ( likely(thr != NULL) ) {
+			thr->unlock();
+		}
 
-	/* No symbols are loaded yet */
-	else if ( unlikely(proc->symbol_count() == 0) ) {
-		return NULL;
+		unwind();
+		tracer::unlock();
+		throw;
 	}
-
-	return s_iface;
 }
 
 
 /**
- * @brief Lock the access mutex
+ * @brief
+ *	Create the stack trace of a thread indexed by its ID, laid out by a
+ *	formatter, and append it to a string
  *
- * @note Recursive locking is supported
+ * @param[in,out] dst the trace destination string (e.g a stream)
+ *
+ * @param[in,out] fmt the trace format
+ *
+ * @param[in] id the thread ID
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
  */
-void tracer::lock()
+tracer& tracer::trace(string &dst, formatter &fmt, pthread_t id) const
 {
-	pthread_mutex_lock(&s_lock);
-}
+	stack_snapshot snap;
+	snap.id = id;
+	snap.depth = 0;
+	snap.dropped = 0;
 
+	/* The frames are symbolized after the snapshot, without holding any lock */
+	snap.frames = snapshot(id, snap.depth, snap.name, &snap.dropped);
 
-/**
- * @brief Unlock the access mutex
- */
-void tracer::unlock()
-{
-	pthread_mutex_unlock(&s_lock);
+	try {
+		format_trace(dst, fmt, snap);
+		delete[] snap.frames;
+
+		return const_cast<tracer&> (*this);
+	}
+	catch (...) {
+		delete[] snap.frames;
+		throw;
+	}
 }
 
 
 /**
- * @brief Stream insertion operator for instrument::tracer objects
+ * @brief Unwind the simulated call stack of the current thread
  *
- * @param[in] lval the output stream
+ * @returns *this
  *
- * @param[in] rval the object to output
+ * @throw std::bad_alloc
  *
- * @returns its first argument
+ * @attention
+ *	If an exception trace is not produced, before a new exception occurs, you
+ *	must perform an explicit simulated call stack unwinding, to discard the
+ *	current exception trace. If you don't properly unwind the simulated stack,
+ *	the stored trace will mess with the next attempt to obtain a stack trace.
+ *	Nevertheless, if the trace was actually created, a call to unwind doesn't
+ *	affect the tracer object state at all (nothing to dispose), so it is not an
+ *	error to call it once or even more times even when the trace was produced
  */
-std::ostream& operator<<(std::ostream &lval, tracer &rval)
+tracer& tracer::unwind()
 {
-	try {
-		string buf;
-		rval.trace(buf);
-
-		util::lock();
-		lval << buf;
-		util::unlock();
-
-		return lval;
-	}
-	catch (exception &x) {
-		lval << x;
-	}
-	catch (std::exception &x) {
-		lval << x;
-	}
+	m_proc->current_thread()
+				->unwind();
 
-	rval.unwind();
-	util::unlock();
-	return lval;
+	return *this;
 }
 
 
 /**
- * @brief Get the process handle
+ * @brief Get the timer sample count
  *
- * @returns this->m_proc
+ * @returns this->m_sample_ticks (0 if timer sampling is off)
  */
-inline process* tracer::proc() const
+inline u64 tracer::sample_count() const
 {
-	return m_proc;
+	return m_sample_ticks;
 }
 
 
 /**
  * @brief
- *	Create multiple stack traces using the simulated call stack of each thread.
- *	The traces are appended to a string. The stacks are not unwinded
+ *	Append the timer sampling profile to a string, the functions with the most
+ *	self samples first
  *
- * @param[in,out] dst the trace destination string
+ * @param[in,out] dst the profile destination string
  *
  * @returns *this
  *
- * @throw std::bad_alloc
- * @throw instrument::exception
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	Each line has the self and total samples of a function, as percentages of
+ *	the samples taken
  */
-tracer& tracer::dump(string &dst) const
+tracer& tracer::samples(string &dst) const
 {
 	try {
 		tracer::lock();
+		m_samples->sort(by_self_samples);
 
-		for (u32 i = 0, sz = m_proc->thread_count(); likely(i < sz); i++) {
-			const thread *thr = m_proc->get_thread(i);
-			trace(dst, thr->handle());
+		dst.append("samples (%llu) {\r\n", m_sample_ticks);
 
-			if ( likely(i < sz - 1) ) {
-				dst.append("\r\n");
+		/* Percentages in hundredths (no floating point) */
+		u64 ticks = (likely(m_sample_ticks > 0)) ? m_sample_ticks : 1;
+		for (u32 i = 0, sz = m_samples->size(); likely(i < sz); i++) {
+			const sample_counter *cur = m_samples->at(i);
+			u64 self = 10000 * cur->self / ticks;
+			u64 total = 10000 * cur->total / ticks;
+
+			dst.append("  %3llu.%02llu%% %3llu.%02llu%% ", self / 100, self % 100,
+																							total / 100, total % 100);
+
+			const i8 *nm = m_proc->lookup(cur->fn);
+			if ( likely(nm != NULL) ) {
+				dst.append("%s\r\n", nm);
+			}
+			else {
+				dst.append("0x%llx\r\n", static_cast<u64> (cur->fn));
 			}
 		}
 
+		dst.append("}\r\n");
 		tracer::unlock();
 		return const_cast<tracer&> (*this);
 	}
@@ -603,191 +3513,226 @@ tracer& tracer::dump(string &dst) const
 
 /**
  * @brief
- *	Create an exception stack trace using the simulated call stack of the
- *	current thread. The trace is appended to a string and the simulated stack is
- *	unwinded
+ *	Append the latest flight recorder events of a thread indexed by its ID to a
+ *	string (oldest first)
  *
- * @param[in,out] dst the trace destination string
+ * @param[in,out] dst the history destination string
+ *
+ * @param[in] id the thread ID
+ *
+ * @param[in] max the maximum event count
  *
  * @returns *this
  *
  * @throws std::bad_alloc
  * @throws instrument::exception
  *
- * @attention
- *	The simulated call stack is <b>unwinded even if the method fails, in any way
- *	to produce a trace</b>
- *
- * @todo Set the symbol name on first lookup (optimization)
+ * @note
+ *	Each line has the event timestamp, relative to the oldest event shown, the
+ *	event kind and the function name. Nothing is appended if the thread has no
+ *	recorder. The thread keeps recording meanwhile, it's not locked
  */
-tracer& tracer::trace(string &dst)
+tracer& tracer::history(string &dst, pthread_t id, u32 max) const
 {
-	/* If an exception occurs, unwind, unlock and rethrow it */
+	record_t *events = NULL;
+
 	try {
 		tracer::lock();
-		thread *thr = m_proc->current_thread();
+
+		thread *thr = m_proc->get_thread(id);
+		recorder *rec = (likely(thr != NULL)) ? thr->get_recorder() : NULL;
+		if ( likely(rec == NULL || max == 0) ) {
+			tracer::unlock();
+			return const_cast<tracer&> (*this);
+		}
+
+		events = new record_t[max];
+		u32 cnt = rec->snapshot(events, max);
 
 		const i8 *nm = thr->name();
 		if ( likely(nm == NULL) ) {
 			nm = "anonymous";
 		}
 
-		dst.append("at '%s' thread (0x%lx) {\r\n", nm, thr->handle());
+		dst.append("history of '%s' thread (0x%lx, %llu events) {\r\n", nm,
+							 thr->handle(), rec->count());
 
-		/* For each function call */
-		for (i32 i = thr->lag(); likely(i >= 0); i--) {
-			call *cur = const_cast<call*> (thr->backtrace(i));
+		for (u32 i = 0; likely(i < cnt); i++) {
+			const record_t *cur = &events[i];
 
-			const i8 *nm = cur->name();
-			if ( likely(nm == NULL) ) {
-				nm = m_proc->lookup(cur->addr());
-			}
+			dst.append("  +%-12llu %s ", cur->tsc - events[0].tsc,
+								 (cur->kind == RECORD_ENTER) ? "enter" : "exit ");
 
-			if ( likely(nm != NULL) ) {
-				cur->set_name(nm);
-				dst.append("  at %s", nm);
+			const i8 *fn = m_proc->lookup(cur->fn);
+			if ( likely(fn != NULL) ) {
+				dst.append("%s\r\n", fn);
 			}
 			else {
-#ifdef WITH_UNRESOLVED
-				dst.append("  at UNRESOLVED");
-#endif
-			}
-
-			/* Append addr2line debug information */
-			u32 prev = i + 1;
-			if ( likely (prev < thr->call_depth()) ) {
-				const call *caller = thr->backtrace(prev);
-				mem_addr_t base = 0;
-
-				const i8 *path = m_proc->inverse_lookup(caller->addr(), base);
-				addr2line(dst, path, cur->site() - base);
+				dst.append("0x%llx\r\n", static_cast<u64> (cur->fn));
 			}
-
-			dst.append("\r\n");
 		}
 
 		dst.append("}\r\n");
-		thr->unwind();
+		delete[] events;
 		tracer::unlock();
-
-		return *this;
+		return const_cast<tracer&> (*this);
 	}
 	catch (...) {
-		unwind();
+		delete[] events;
 		tracer::unlock();
 		throw;
 	}
 }
 
 
+#ifdef WITH_PLUGIN
+/**
+ * @brief Encode the latency summary of each function as binary IDP v2 LATENCY messages
+ *
+ * @param[in,out] dst the encoder
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note Nothing is encoded unless the latency plugin was attached (see latency::attach)
+ */
+tracer& tracer::latencies(encoder &dst) const
+{
+	latency::report(dst);
+	return const_cast<tracer&> (*this);
+}
+
+
 /**
  * @brief
- *	Create the stack trace of a thread indexed by its ID and append it to a
- *	string
- *
- * @param[in,out] dst the trace destination string
+ *	Append the latency summary of each function to a string, the functions with
+ *	the highest 99th percentile first
  *
- * @param[in] id the thread ID
+ * @param[in,out] dst the summary destination string
  *
  * @returns *this
  *
  * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note
+ *	Each line has the call count, the median, the 99th and 99.9th percentiles
+ *	and the maximum (in nanoseconds) of a function
  */
-tracer& tracer::trace(string &dst, pthread_t id) const
+tracer& tracer::latencies(string &dst) const
 {
-	/* If an exception occurs, unlock and rethrow it */
-	try {
-		tracer::lock();
-		thread *thr = m_proc->get_thread(id);
-		if ( unlikely(thr == NULL) ) {
-			tracer::unlock();
-			return const_cast<tracer&> (*this);
-		}
-
-		const i8 *nm = thr->name();
-		if ( likely(nm == NULL) ) {
-			nm = "anonymous";
-		}
+	latency::report(dst);
+	return const_cast<tracer&> (*this);
+}
 
-		dst.append("at '%s' thread (0x%lx) {\r\n", nm, thr->handle());
 
-		/* For each function call */
-		for (i32 i = thr->call_depth() - 1; likely(i >= 0); i--) {
-			call *cur = const_cast<call*> (thr->backtrace(i));
+/**
+ * @brief Encode the slow calls captured since the previous call as binary IDP v2 SLOW messages
+ *
+ * @param[in,out] dst the encoder
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note Nothing is encoded unless the slow call plugin was attached (see slow_call::attach)
+ */
+tracer& tracer::slow_calls(encoder &dst) const
+{
+	slow_call::report(dst);
+	return const_cast<tracer&> (*this);
+}
 
-			const i8 *nm = cur->name();
-			if ( likely(nm == NULL) ) {
-				nm = m_proc->lookup(cur->addr());
-			}
 
-			if ( likely(nm != NULL) ) {
-				cur->set_name(nm);
-				dst.append("  at %s", nm);
-			}
-			else {
-#ifdef WITH_UNRESOLVED
-				dst.append("  at UNRESOLVED");
+/**
+ * @brief Append the slow calls captured since the previous call to a string
+ *
+ * @param[in,out] dst the report destination string
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ * @throws instrument::exception
+ *
+ * @note
+ *	Each capture has the call duration (in nanoseconds), the call depth and the
+ *	thread of the call, followed by the slow call and its innermost callers
+ */
+tracer& tracer::slow_calls(string &dst) const
+{
+	slow_call::report(dst);
+	return const_cast<tracer&> (*this);
+}
 #endif
-			}
-
-			/* Append addr2line debug information */
-			u32 prev = i + 1;
-			if ( likely (prev < thr->call_depth()) ) {
-				const call *caller = thr->backtrace(prev);
-				mem_addr_t base = 0;
-
-				const i8 *path = m_proc->inverse_lookup(caller->addr(), base);
-				addr2line(dst, path, cur->site() - base);
-			}
 
-			dst.append("\r\n");
-		}
 
-		dst.append("}\r\n");
-		tracer::unlock();
+#ifdef WITH_METRICS
+/**
+ * @brief Encode the merged self-metrics counters as a binary IDP v2 METRICS message
+ *
+ * @param[in,out] dst the encoder
+ *
+ * @returns *this
+ *
+ * @throws std::bad_alloc
+ */
+tracer& tracer::metrics(encoder &dst) const
+{
+	u64 counters[METRIC_COUNT];
+	metrics(counters);
 
-		return const_cast<tracer&> (*this);
-	}
-	catch (...) {
-		tracer::unlock();
-		throw;
-	}
+	dst.metrics(counters, METRIC_COUNT);
+	return const_cast<tracer&> (*this);
 }
 
 
 /**
- * @brief Unwind the simulated call stack of the current thread
+ * @brief Append the merged self-metrics counters to a string
+ *
+ * @param[in,out] dst the metrics destination string
  *
  * @returns *this
  *
- * @throw std::bad_alloc
+ * @throws std::bad_alloc
+ * @throws instrument::exception
  *
- * @attention
- *	If an exception trace is not produced, before a new exception occurs, you
- *	must perform an explicit simulated call stack unwinding, to discard the
- *	current exception trace. If you don't properly unwind the simulated stack,
- *	the stored trace will mess with the next attempt to obtain a stack trace.
- *	Nevertheless, if the trace was actually created, a call to unwind doesn't
- *	affect the tracer object state at all (nothing to dispose), so it is not an
- *	error to call it once or even more times even when the trace was produced
+ * @note Each line has a counter name and value
  */
-tracer& tracer::unwind()
+tracer& tracer::metrics(string &dst) const
 {
-	try {
-		tracer::lock();
+	u64 counters[METRIC_COUNT];
+	metrics(counters);
 
-		m_proc->current_thread()
-					->unwind();
-
-		tracer::unlock();
-		return *this;
-	}
-	catch (...) {
-		tracer::unlock();
-		throw;
+	dst.append("metrics {\r\n");
+	for (u32 i = 0; likely(i < METRIC_COUNT); i++) {
+		dst.append("  %-16s %llu\r\n", metrics::name(i), counters[i]);
 	}
+
+	dst.append("}\r\n");
+	return const_cast<tracer&> (*this);
+}
+
+
+/**
+ * @brief Merge the self-metrics counters of all threads
+ *
+ * @param[out] dst the merged counters (METRIC_COUNT counters, by METRIC_* definition)
+ *
+ * @returns *this
+ *
+ * @note
+ *	The counters are not locked, they keep counting meanwhile (see
+ *	metrics::merge). The counters are totals since the library was loaded
+ */
+tracer& tracer::metrics(u64 *dst) const
+{
+	metrics::merge(dst);
+	return const_cast<tracer&> (*this);
 }
+#endif
 
 
 #ifdef WITH_FILTER
@@ -804,25 +3749,40 @@ tracer& tracer::unwind()
  *
  * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note The cached verdicts are discarded
  */
 filter* tracer::add_filter(const i8 *expr, bool icase, bool mode)
 {
 	filter *retval = NULL;
+	pthread_mutex_lock(&m_filter_lock);
 
 	try {
 		retval = new filter(expr, icase, mode);
 		m_filters->add(retval);
-		return retval;
 	}
 	catch (...) {
+		pthread_mutex_unlock(&m_filter_lock);
 		delete retval;
 		throw;
 	}
+
+	try {
+		compile_filters();
+	}
+	catch (...) {
+		m_filters->remove(m_filters->size() - 1);
+		pthread_mutex_unlock(&m_filter_lock);
+		throw;
+	}
+
+	pthread_mutex_unlock(&m_filter_lock);
+	return retval;
 }
 
 
 /**
- * @brief Apply all module filters (in the order they were registered)
+ * @brief Apply all module filters (combined) to a module path
  *
  * @param[in] path the filtered module path
  *
@@ -830,34 +3790,28 @@ filter* tracer::add_filter(const i8 *expr, bool icase, bool mode)
  */
 bool tracer::apply_module_filters(const i8 *path)
 {
-	/* todo
-				Use:
-					mem_addr_t base = 0;
-					const i8 *path = proc->ilookup(addr, base);
-			to obtain path in caller
-	*/
 	if ( unlikely(path == NULL) ) {
 		return false;
 	}
 
-	for (u32 i = 0, sz = filter_count(); likely(i < sz); i++) {
-		const filter *f = get_filter(i);
+	pthread_mutex_lock(&m_filter_lock);
 
-		if ( likely(f->mode() == SYMBOL_FILTER) ) {
-			continue;
-		}
+	bool retval = false;
+	for (u32 i = 0, sz = m_compiled->size(); likely(i < sz && !retval); i++) {
+		const filter *f = m_compiled->at(i);
 
-		if ( unlikely(f->apply(path)) ) {
-			return true;
+		if ( likely(f->mode() == MODULE_FILTER) ) {
+			retval = f->apply(path);
 		}
 	}
 
-	return false;
+	pthread_mutex_unlock(&m_filter_lock);
+	return retval;
 }
 
 
 /**
- * @brief Apply all symbol filters (in the order they were registered) to a name
+ * @brief Apply all symbol filters (combined) to a name
  *
  * @param[in] nm the filtered name
  *
@@ -869,19 +3823,19 @@ bool tracer::apply_symbol_filters(const i8 *nm)
 		return false;
 	}
 
-	for (u32 i = 0, sz = filter_count(); likely(i < sz); i++) {
-		const filter *f = get_filter(i);
+	pthread_mutex_lock(&m_filter_lock);
 
-		if ( likely(f->mode() == MODULE_FILTER) ) {
-			continue;
-		}
+	bool retval = false;
+	for (u32 i = 0, sz = m_compiled->size(); likely(i < sz && !retval); i++) {
+		const filter *f = m_compiled->at(i);
 
-		if ( unlikely(f->apply(nm)) ) {
-			return true;
+		if ( likely(f->mode() == SYMBOL_FILTER) ) {
+			retval = f->apply(nm);
 		}
 	}
 
-	return false;
+	pthread_mutex_unlock(&m_filter_lock);
+	return retval;
 }
 
 
@@ -904,6 +3858,10 @@ inline u32 tracer::filter_count() const
  * @returns this->m_filters->at(i)
  *
  * @throws instrument::exception
+ *
+ * @note
+ *	Filters are compiled when registered, changes to a returned filter don't
+ *	apply to the instrumentation
  */
 inline filter* tracer::get_filter(u32 i) const
 {
@@ -911,6 +3869,54 @@ inline filter* tracer::get_filter(u32 i) const
 }
 
 
+/**
+ * @brief Check if a function is filtered out from instrumentation
+ *
+ * @param[in] addr the function address
+ *
+ * @returns true if the function is filtered out, false otherwise
+ *
+ * @note
+ *	The filters are applied once for each function, the verdict is cached. The
+ *	cache is read without locking, a cached verdict costs a single hash probe.
+ *	If the verdict can't be cached the function is not filtered out
+ */
+bool tracer::is_filtered(mem_addr_t addr)
+{
+	if ( likely(!load_acquire(&m_filtering)) ) {
+		return false;
+	}
+
+	const bool *retval = m_verdicts->find(addr);
+	if ( likely(retval != NULL) ) {
+		return *retval;
+	}
+
+	try {
+		return verdict(addr);
+	}
+	catch (exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.msg());
+	}
+	catch (std::exception &x) {
+		util::dbg_error("in tracer::%s(): %s", __FUNCTION__, x.what());
+	}
+
+	return false;
+}
+
+
+/**
+ * @brief Get the patched hook call count
+ *
+ * @returns the count of hook calls patched into NOPs (0 if hot-patching is off)
+ */
+u32 tracer::patch_count() const
+{
+	return (likely(m_patcher != NULL)) ? m_patcher->count() : 0;
+}
+
+
 /**
  * @brief Unregister a filter
  *
@@ -918,11 +3924,58 @@ inline filter* tracer::get_filter(u32 i) const
  *
  * @returns *this
  *
+ * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note The cached verdicts are discarded
+ */
+tracer& tracer::remove_filter(u32 i)
+{
+	pthread_mutex_lock(&m_filter_lock);
+
+	try {
+		m_filters->remove(i);
+		compile_filters();
+	}
+	catch (...) {
+		pthread_mutex_unlock(&m_filter_lock);
+		throw;
+	}
+
+	pthread_mutex_unlock(&m_filter_lock);
+	return *this;
+}
+
+
+/**
+ * @brief Stop a filtered out function from calling the hooks, if possible
+ *
+ * @param[in] fn the function address
+ *
+ * @param[in] ret the return address of the hook (0 if called from a sled)
+ *
+ * @param[in] hook the hook address
+ *
+ * @returns *this
+ *
+ * @note
+ *	Doesn't throw. With hot-patching, the hook call is patched into a NOP (a
+ *	call site is tried once, see patcher::patch). The sleds of a filtered out
+ *	function are disabled (see sled::disable)
  */
-inline tracer& tracer::remove_filter(u32 i)
+tracer& tracer::unhook(mem_addr_t fn, mem_addr_t ret, mem_addr_t hook)
 {
-	m_filters->remove(i);
+#ifdef WITH_SLEDS
+	if ( unlikely(ret == 0) ) {
+		sled::disable(fn);
+		return *this;
+	}
+#endif
+
+	if ( likely(m_patcher != NULL) ) {
+		m_patcher->patch(ret, hook);
+	}
+
 	return *this;
 }
 #endif
@@ -952,8 +4005,13 @@ const plugin* tracer::add_plugin(const i8 *path, const i8 *scope)
 		retval = new plugin(path, scope);
 		m_plugins->add(retval);
 
+		/* The plugin stays registered, even if it can't be published */
+		const plugin *plg = retval;
+		retval = NULL;
+		publish_plugins(NULL);
+
 		tracer::unlock();
-		return retval;
+		return plg;
 	}
 	catch (...) {
 		delete retval;
@@ -984,8 +4042,13 @@ const plugin* tracer::add_plugin(modsym_t bgn, modsym_t end)
 		retval = new plugin(bgn, end);
 		m_plugins->add(retval);
 
+		/* The plugin stays registered, even if it can't be published */
+		const plugin *plg = retval;
+		retval = NULL;
+		publish_plugins(NULL);
+
 		tracer::unlock();
-		return retval;
+		return plg;
 	}
 	catch (...) {
 		delete retval;
@@ -1002,13 +4065,26 @@ const plugin* tracer::add_plugin(modsym_t bgn, modsym_t end)
  *
  * @param[in] call_site the address where the function was called
  *
+ * @param[in] mask the dispatched plugins (bit i for plugin i, see control::plugin_mask)
+ *
  * @returns *this
+ *
+ * @note The callbacks are read from the published snapshot, without locking
  */
-tracer& tracer::begin_plugins(void *this_fn, void *call_site) const
+tracer& tracer::begin_plugins(void *this_fn, void *call_site, u32 mask) const
 {
-	for (u32 i = 0, sz = plugin_count(); likely(i < sz); i++) {
+	u32 *readers = const_cast<u32*> (&m_readers[stripe()].count);
+	fetch_add(readers, 1);
+
+	const plugin_table *t = load_acquire(&m_snapshot);
+	for (u32 i = 0, sz = (likely(t != NULL)) ? t->size : 0; likely(i < sz); i++) {
+		if ( unlikely(t->begin[i] == NULL || (i < 32 && !((mask >> i) & 1))) ) {
+			continue;
+		}
+
+		count_metric(METRIC_PLUGIN_CALLS, 1);
 		try {
-			get_plugin(i)->begin(this_fn, call_site);
+			t->begin[i](this_fn, call_site);
 		}
 		catch (exception &x) {
 			std::cerr << x;
@@ -1025,6 +4101,7 @@ tracer& tracer::begin_plugins(void *this_fn, void *call_site) const
 		}
 	}
 
+	fetch_sub(readers, 1);
 	return const_cast<tracer&> (*this);
 }
 
@@ -1037,13 +4114,26 @@ tracer& tracer::begin_plugins(void *this_fn, void *call_site) const
  *
  * @param[in] call_site the address where the function was called
  *
+ * @param[in] mask the dispatched plugins (bit i for plugin i, see control::plugin_mask)
+ *
  * @returns *this
+ *
+ * @note The callbacks are read from the published snapshot, without locking
  */
-tracer& tracer::end_plugins(void *this_fn, void *call_site) const
+tracer& tracer::end_plugins(void *this_fn, void *call_site, u32 mask) const
 {
-	for (i32 i = plugin_count() - 1; likely(i >= 0); i--) {
+	u32 *readers = const_cast<u32*> (&m_readers[stripe()].count);
+	fetch_add(readers, 1);
+
+	const plugin_table *t = load_acquire(&m_snapshot);
+	for (i32 i = (likely(t != NULL)) ? t->size - 1 : -1; likely(i >= 0); i--) {
+		if ( unlikely(t->end[i] == NULL || (i < 32 && !((mask >> i) & 1))) ) {
+			continue;
+		}
+
+		count_metric(METRIC_PLUGIN_CALLS, 1);
 		try {
-			get_plugin(i)->end(this_fn, call_site);
+			t->end[i](this_fn, call_site);
 		}
 		catch (exception &x) {
 			std::cerr << x;
@@ -1060,6 +4150,7 @@ tracer& tracer::end_plugins(void *this_fn, void *call_site) const
 		}
 	}
 
+	fetch_sub(readers, 1);
 	return const_cast<tracer&> (*this);
 }
 
@@ -1139,35 +4230,63 @@ inline u32 tracer::plugin_count() const
  * @param[in] which plugin selector (one of ALL, DSO, INLINE)
  *
  * @returns *this
+ *
+ * @throws std::bad_alloc
+ *
+ * @note
+ *	The plugins are deleted (and the plugin modules unlinked) once no thread
+ *	dispatches to them
  */
 tracer& tracer::remove_all_plugins(u32 which)
 {
-	tracer::lock();
+	list<plugin> *retired = NULL;
 
-	if ( likely(which == ALL) ) {
-		m_plugins->clear();
-		tracer::unlock();
-		return *this;
-	}
+	try {
+		tracer::lock();
 
-	for (u32 i = 0, sz = m_plugins->size(); likely(i < sz); i++) {
-		const plugin *plg = m_plugins->at(i);
+		/* The unregistered plugins are deleted with the replaced snapshot */
+		retired = new list<plugin>;
 
-		if ( unlikely(plg->path() == NULL) ) {
-			if ( unlikely(which == DSO) ) {
-				continue;
+		for (u32 i = 0, sz = m_plugins->size(); likely(i < sz); i++) {
+			const plugin *plg = m_plugins->at(i);
+
+			if ( unlikely(which != ALL) ) {
+				if ( unlikely(plg->path() == NULL) ) {
+					if ( unlikely(which == DSO) ) {
+						continue;
+					}
+				}
+				else if ( unlikely(which == INLINED) ) {
+					continue;
+				}
 			}
-		}
-		else if ( unlikely(which == INLINED) ) {
-			continue;
+
+			retired->add(m_plugins->at(i));
+			m_plugins->detach(i--);
+			sz--;
 		}
 
-		m_plugins->remove(i--);
-		sz--;
+		list<plugin> *tmp = retired;
+		retired = NULL;
+		publish_plugins(tmp);
+
+		tracer::unlock();
+		return *this;
 	}
+	catch (...) {
+		/* The plugins detached so far are kept registered */
+		if ( likely(retired != NULL) ) {
+			for (u32 i = 0, sz = retired->size(); likely(i < sz); i++) {
+				m_plugins->add(retired->at(i));
+			}
 
-	tracer::unlock();
-	return *this;
+			retired->detach_all();
+			delete retired;
+		}
+
+		tracer::unlock();
+		throw;
+	}
 }
 
 
@@ -1177,6 +4296,8 @@ tracer& tracer::remove_all_plugins(u32 which)
  * @param[in] path the path of the module file (can be NULL)
  *
  * @returns *this
+ *
+ * @throws std::bad_alloc
  */
 tracer& tracer::remove_plugin(const i8 *path)
 {
@@ -1195,7 +4316,14 @@ tracer& tracer::remove_plugin(const i8 *path)
 		}
 
 		if ( unlikely(strcmp(plg->path(), path) == 0) ) {
-			m_plugins->remove(i);
+			try {
+				remove_plugin(i);
+			}
+			catch (...) {
+				tracer::unlock();
+				throw;
+			}
+
 			break;
 		}
 	}
@@ -1212,17 +4340,38 @@ tracer& tracer::remove_plugin(const i8 *path)
  *
  * @returns *this
  *
+ * @throws std::bad_alloc
  * @throws instrument::exception
+ *
+ * @note
+ *	The plugin is deleted (and its module unlinked) once no thread dispatches
+ *	to it
  */
 tracer& tracer::remove_plugin(u32 i)
 {
+	list<plugin> *retired = NULL;
+
 	try {
 		tracer::lock();
-		m_plugins->remove(i);
+
+		/* The plugin is deleted with the replaced snapshot */
+		retired = new list<plugin>;
+		retired->add(m_plugins->at(i));
+		m_plugins->detach(i);
+
+		list<plugin> *tmp = retired;
+		retired = NULL;
+		publish_plugins(tmp);
+
 		tracer::unlock();
 		return *this;
 	}
 	catch (...) {
+		if ( likely(retired != NULL) ) {
+			retired->detach_all();
+			delete retired;
+		}
+
 		tracer::unlock();
 		throw;
 	}
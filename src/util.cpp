@@ -15,6 +15,70 @@ chain<string> *util::s_config = NULL;
 
 pthread_mutex_t util::s_global_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
+const i8 *util::s_mem_kernel = NULL;
+
+i32 (*util::s_memcmp)(const void*, const void*, u32) = util::memcmp_resolve;
+
+void* (*util::s_memcpy)(void*, const void*, u32) = util::memcpy_resolve;
+
+void* (*util::s_memset)(void*, u8, u32) = util::memset_resolve;
+
+void* (*util::s_memswap)(void*, u32) = util::memswap_resolve;
+
+
+/**
+ * @brief Select the memory kernels
+ *
+ * @note
+ *	The fastest kernel set the processor supports is selected, unless the
+ *	g_mem_kernel_env shell variable names another supported one (unsupported
+ *	names select the scalar kernels). Concurrent selections select the same
+ *	kernels, so the kernel pointers are published without locking
+ */
+void util::dispatch()
+{
+	const i8 *nm = ::getenv(g_mem_kernel_env);
+
+	i32 (*cmp)(const void*, const void*, u32) = memcmp_scalar;
+	void* (*cpy)(void*, const void*, u32) = memcpy_scalar;
+	void* (*set)(void*, u8, u32) = memset_scalar;
+	void* (*swap)(void*, u32) = memswap_scalar;
+	const i8 *kernel = "scalar";
+
+#if defined __x86_64__ || defined __i386__
+	__builtin_cpu_init();
+
+	if ( likely(__builtin_cpu_supports("avx2") && (nm == NULL || strcmp(nm, "avx2") == 0)) ) {
+		cmp = memcmp_avx2;
+		cpy = memcpy_avx2;
+		set = memset_avx2;
+		swap = memswap_avx2;
+		kernel = "avx2";
+	}
+	else if ( likely(__builtin_cpu_supports("sse2") && (nm == NULL || strcmp(nm, "sse2") == 0)) ) {
+		cmp = memcmp_sse2;
+		cpy = memcpy_sse2;
+		set = memset_sse2;
+		swap = memswap_sse2;
+		kernel = "sse2";
+	}
+#elif defined __ARM_NEON
+	if ( likely(nm == NULL || strcmp(nm, "neon") == 0) ) {
+		cmp = memcmp_neon;
+		cpy = memcpy_neon;
+		set = memset_neon;
+		swap = memswap_neon;
+		kernel = "neon";
+	}
+#endif
+
+	store_relaxed(&s_memcmp, cmp);
+	store_relaxed(&s_memcpy, cpy);
+	store_relaxed(&s_memset, set);
+	store_relaxed(&s_memswap, swap);
+	store_release(&s_mem_kernel, kernel);
+}
+
 
 /**
  * @brief Library constructor
@@ -50,6 +114,576 @@ void util::on_lib_unload()
 }
 
 
+/**
+ * @brief Select the memory kernels and compare two memory blocks
+ *
+ * @param[in] b1 the base address of the first block
+ *
+ * @param[in] b2 the base address of the second block
+ *
+ * @param[in] sz the block size compared
+ *
+ * @returns the selected kernel's result
+ */
+i32 util::memcmp_resolve(const void *b1, const void *b2, u32 sz)
+{
+	dispatch();
+	return s_memcmp(b1, b2, sz);
+}
+
+
+/**
+ * @brief Select the memory kernels and copy a memory block
+ *
+ * @param[out] dst the destination base address
+ *
+ * @param[in] src the source base address
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memcpy_resolve(void *dst, const void *src, u32 sz)
+{
+	dispatch();
+	return s_memcpy(dst, src, sz);
+}
+
+
+/**
+ * @brief Select the memory kernels and fill a memory block with a constant byte
+ *
+ * @param[out] mem the base address of the block
+ *
+ * @param[in] val the byte
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memset_resolve(void *mem, u8 val, u32 sz)
+{
+	dispatch();
+	return s_memset(mem, val, sz);
+}
+
+
+/**
+ * @brief Select the memory kernels and reverse the byte order of a memory block
+ *
+ * @param[in,out] mem the base address of the block
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memswap_resolve(void *mem, u32 sz)
+{
+	dispatch();
+	return s_memswap(mem, sz);
+}
+
+
+/**
+ * @brief Compare two memory blocks, a machine word at a time
+ *
+ * @param[in] b1 the base address of the first block
+ *
+ * @param[in] b2 the base address of the second block
+ *
+ * @param[in] sz the block size compared
+ *
+ * @returns the difference of the first differing bytes (0 if none)
+ *
+ * @note The words are loaded unaligned, through __builtin_memcpy
+ */
+i32 util::memcmp_scalar(const void *b1, const void *b2, u32 sz)
+{
+	const u8 *p1 = static_cast<const u8*> (b1);
+	const u8 *p2 = static_cast<const u8*> (b2);
+
+	/* The differing word is compared bytewise below */
+	for (; likely(sz >= sizeof(u64)); sz -= sizeof(u64), p1 += sizeof(u64), p2 += sizeof(u64)) {
+		u64 w1, w2;
+		__builtin_memcpy(&w1, p1, sizeof(u64));
+		__builtin_memcpy(&w2, p2, sizeof(u64));
+
+		if ( unlikely(w1 != w2) ) {
+			break;
+		}
+	}
+
+	while ( likely(sz-- > 0) ) {
+		i32 diff = static_cast<i32> (*(p1++)) - *(p2++);
+
+		if ( unlikely(diff != 0) ) {
+			return diff;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Copy a memory block, a machine word at a time
+ *
+ * @param[out] dst the destination base address
+ *
+ * @param[in] src the source base address
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memcpy_scalar(void *dst, const void *src, u32 sz)
+{
+	u8 *d = static_cast<u8*> (dst);
+	const u8 *s = static_cast<const u8*> (src);
+
+	for (; likely(sz >= sizeof(u64)); sz -= sizeof(u64), d += sizeof(u64), s += sizeof(u64)) {
+		u64 w;
+		__builtin_memcpy(&w, s, sizeof(u64));
+		__builtin_memcpy(d, &w, sizeof(u64));
+	}
+
+	while ( likely(sz-- > 0) ) {
+		*(d++) = *(s++);
+	}
+
+	return dst;
+}
+
+
+/**
+ * @brief Fill a memory block with a constant byte, a machine word at a time
+ *
+ * @param[out] mem the base address of the block
+ *
+ * @param[in] val the byte
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memset_scalar(void *mem, u8 val, u32 sz)
+{
+	u8 *p = static_cast<u8*> (mem);
+	u64 w = 0x0101010101010101ULL * val;
+
+	for (; likely(sz >= sizeof(u64)); sz -= sizeof(u64), p += sizeof(u64)) {
+		__builtin_memcpy(p, &w, sizeof(u64));
+	}
+
+	while ( likely(sz-- > 0) ) {
+		*(p++) = val;
+	}
+
+	return mem;
+}
+
+
+/**
+ * @brief Reverse the byte order of a memory block, a machine word at a time
+ *
+ * @param[in,out] mem the base address of the block
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ *
+ * @note The words of both ends are swapped and byte-reversed, the middle bytewise
+ */
+void* util::memswap_scalar(void *mem, u32 sz)
+{
+	u8 *l = static_cast<u8*> (mem);
+	u8 *r = l + sz;
+
+	while ( likely(r - l >= static_cast<i64> (2 * sizeof(u64))) ) {
+		u64 wl, wr;
+		r -= sizeof(u64);
+		__builtin_memcpy(&wl, l, sizeof(u64));
+		__builtin_memcpy(&wr, r, sizeof(u64));
+
+		wl = __builtin_bswap64(wl);
+		wr = __builtin_bswap64(wr);
+		__builtin_memcpy(l, &wr, sizeof(u64));
+		__builtin_memcpy(r, &wl, sizeof(u64));
+		l += sizeof(u64);
+	}
+
+	while ( likely(r - l > 1) ) {
+		u8 tmp = *l;
+		*(l++) = *(--r);
+		*r = tmp;
+	}
+
+	return mem;
+}
+
+#if defined __x86_64__ || defined __i386__
+
+/**
+ * @brief Compare two memory blocks, 32 bytes at a time (AVX2)
+ *
+ * @param[in] b1 the base address of the first block
+ *
+ * @param[in] b2 the base address of the second block
+ *
+ * @param[in] sz the block size compared
+ *
+ * @returns the difference of the first differing bytes (0 if none)
+ */
+i32 util::memcmp_avx2(const void *b1, const void *b2, u32 sz)
+{
+	const u8 *p1 = static_cast<const u8*> (b1);
+	const u8 *p2 = static_cast<const u8*> (b2);
+
+	for (; likely(sz >= sizeof(__m256i)); sz -= sizeof(__m256i), p1 += sizeof(__m256i), p2 += sizeof(__m256i)) {
+		__m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (p1));
+		__m256i v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (p2));
+
+		/* A clear mask bit marks a differing byte */
+		u32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v2));
+		if ( unlikely(mask != 0xffffffff) ) {
+			u32 i = __builtin_ctz(~mask);
+			return static_cast<i32> (p1[i]) - p2[i];
+		}
+	}
+
+	return memcmp_sse2(p1, p2, sz);
+}
+
+
+/**
+ * @brief Copy a memory block, 32 bytes at a time (AVX2)
+ *
+ * @param[out] dst the destination base address
+ *
+ * @param[in] src the source base address
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memcpy_avx2(void *dst, const void *src, u32 sz)
+{
+	u8 *d = static_cast<u8*> (dst);
+	const u8 *s = static_cast<const u8*> (src);
+
+	for (; likely(sz >= sizeof(__m256i)); sz -= sizeof(__m256i), d += sizeof(__m256i), s += sizeof(__m256i)) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (s));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*> (d), v);
+	}
+
+	memcpy_sse2(d, s, sz);
+	return dst;
+}
+
+
+/**
+ * @brief Fill a memory block with a constant byte, 32 bytes at a time (AVX2)
+ *
+ * @param[out] mem the base address of the block
+ *
+ * @param[in] val the byte
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memset_avx2(void *mem, u8 val, u32 sz)
+{
+	u8 *p = static_cast<u8*> (mem);
+	__m256i v = _mm256_set1_epi8(static_cast<i8> (val));
+
+	for (; likely(sz >= sizeof(__m256i)); sz -= sizeof(__m256i), p += sizeof(__m256i)) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i*> (p), v);
+	}
+
+	memset_sse2(p, val, sz);
+	return mem;
+}
+
+
+/**
+ * @brief Reverse the byte order of a memory block, 32 bytes at a time (AVX2)
+ *
+ * @param[in,out] mem the base address of the block
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ *
+ * @note
+ *	The bytes of each 128-bit lane are reversed with a shuffle, then the lanes
+ *	are swapped. The middle is reversed by the SSE2 kernel
+ */
+void* util::memswap_avx2(void *mem, u32 sz)
+{
+	const __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+																			 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	u8 *l = static_cast<u8*> (mem);
+	u8 *r = l + sz;
+
+	while ( likely(r - l >= static_cast<i64> (2 * sizeof(__m256i))) ) {
+		r -= sizeof(__m256i);
+		__m256i vl = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (l));
+		__m256i vr = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (r));
+
+		vl = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(vl, rev), 0x4e);
+		vr = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(vr, rev), 0x4e);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*> (l), vr);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*> (r), vl);
+		l += sizeof(__m256i);
+	}
+
+	memswap_sse2(l, r - l);
+	return mem;
+}
+
+
+/**
+ * @brief Compare two memory blocks, 16 bytes at a time (SSE2)
+ *
+ * @param[in] b1 the base address of the first block
+ *
+ * @param[in] b2 the base address of the second block
+ *
+ * @param[in] sz the block size compared
+ *
+ * @returns the difference of the first differing bytes (0 if none)
+ */
+i32 util::memcmp_sse2(const void *b1, const void *b2, u32 sz)
+{
+	const u8 *p1 = static_cast<const u8*> (b1);
+	const u8 *p2 = static_cast<const u8*> (b2);
+
+	for (; likely(sz >= sizeof(__m128i)); sz -= sizeof(__m128i), p1 += sizeof(__m128i), p2 += sizeof(__m128i)) {
+		__m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*> (p1));
+		__m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*> (p2));
+
+		/* A clear mask bit marks a differing byte */
+		u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2));
+		if ( unlikely(mask != 0xffff) ) {
+			u32 i = __builtin_ctz(~mask);
+			return static_cast<i32> (p1[i]) - p2[i];
+		}
+	}
+
+	return memcmp_scalar(p1, p2, sz);
+}
+
+
+/**
+ * @brief Copy a memory block, 16 bytes at a time (SSE2)
+ *
+ * @param[out] dst the destination base address
+ *
+ * @param[in] src the source base address
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memcpy_sse2(void *dst, const void *src, u32 sz)
+{
+	u8 *d = static_cast<u8*> (dst);
+	const u8 *s = static_cast<const u8*> (src);
+
+	for (; likely(sz >= sizeof(__m128i)); sz -= sizeof(__m128i), d += sizeof(__m128i), s += sizeof(__m128i)) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*> (s));
+		_mm_storeu_si128(reinterpret_cast<__m128i*> (d), v);
+	}
+
+	memcpy_scalar(d, s, sz);
+	return dst;
+}
+
+
+/**
+ * @brief Fill a memory block with a constant byte, 16 bytes at a time (SSE2)
+ *
+ * @param[out] mem the base address of the block
+ *
+ * @param[in] val the byte
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memset_sse2(void *mem, u8 val, u32 sz)
+{
+	u8 *p = static_cast<u8*> (mem);
+	__m128i v = _mm_set1_epi8(static_cast<i8> (val));
+
+	for (; likely(sz >= sizeof(__m128i)); sz -= sizeof(__m128i), p += sizeof(__m128i)) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*> (p), v);
+	}
+
+	memset_scalar(p, val, sz);
+	return mem;
+}
+
+
+/**
+ * @brief Reverse the byte order of a memory block, 16 bytes at a time (SSE2)
+ *
+ * @param[in,out] mem the base address of the block
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ *
+ * @note
+ *	SSE2 has no byte shuffle: the bytes of each 16-bit word are swapped with
+ *	shifts, then the words are reversed with word and double word shuffles. The
+ *	middle is reversed by the scalar kernel
+ */
+void* util::memswap_sse2(void *mem, u32 sz)
+{
+	u8 *l = static_cast<u8*> (mem);
+	u8 *r = l + sz;
+
+	while ( likely(r - l >= static_cast<i64> (2 * sizeof(__m128i))) ) {
+		r -= sizeof(__m128i);
+		__m128i vl = _mm_loadu_si128(reinterpret_cast<const __m128i*> (l));
+		__m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i*> (r));
+
+		vl = _mm_or_si128(_mm_slli_epi16(vl, 8), _mm_srli_epi16(vl, 8));
+		vl = _mm_shufflehi_epi16(_mm_shufflelo_epi16(vl, 0x1b), 0x1b);
+		vl = _mm_shuffle_epi32(vl, 0x4e);
+
+		vr = _mm_or_si128(_mm_slli_epi16(vr, 8), _mm_srli_epi16(vr, 8));
+		vr = _mm_shufflehi_epi16(_mm_shufflelo_epi16(vr, 0x1b), 0x1b);
+		vr = _mm_shuffle_epi32(vr, 0x4e);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*> (l), vr);
+		_mm_storeu_si128(reinterpret_cast<__m128i*> (r), vl);
+		l += sizeof(__m128i);
+	}
+
+	memswap_scalar(l, r - l);
+	return mem;
+}
+
+#elif defined __ARM_NEON
+
+/**
+ * @brief Compare two memory blocks, 16 bytes at a time (NEON)
+ *
+ * @param[in] b1 the base address of the first block
+ *
+ * @param[in] b2 the base address of the second block
+ *
+ * @param[in] sz the block size compared
+ *
+ * @returns the difference of the first differing bytes (0 if none)
+ *
+ * @note The differing vector is compared by the scalar kernel
+ */
+i32 util::memcmp_neon(const void *b1, const void *b2, u32 sz)
+{
+	const u8 *p1 = static_cast<const u8*> (b1);
+	const u8 *p2 = static_cast<const u8*> (b2);
+
+	for (; likely(sz >= sizeof(uint8x16_t)); sz -= sizeof(uint8x16_t), p1 += sizeof(uint8x16_t), p2 += sizeof(uint8x16_t)) {
+		uint64x2_t eq = vreinterpretq_u64_u8(vceqq_u8(vld1q_u8(p1), vld1q_u8(p2)));
+
+		if ( unlikely((vgetq_lane_u64(eq, 0) & vgetq_lane_u64(eq, 1)) != ~0ULL) ) {
+			return memcmp_scalar(p1, p2, sizeof(uint8x16_t));
+		}
+	}
+
+	return memcmp_scalar(p1, p2, sz);
+}
+
+
+/**
+ * @brief Copy a memory block, 16 bytes at a time (NEON)
+ *
+ * @param[out] dst the destination base address
+ *
+ * @param[in] src the source base address
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memcpy_neon(void *dst, const void *src, u32 sz)
+{
+	u8 *d = static_cast<u8*> (dst);
+	const u8 *s = static_cast<const u8*> (src);
+
+	for (; likely(sz >= sizeof(uint8x16_t)); sz -= sizeof(uint8x16_t), d += sizeof(uint8x16_t), s += sizeof(uint8x16_t)) {
+		vst1q_u8(d, vld1q_u8(s));
+	}
+
+	memcpy_scalar(d, s, sz);
+	return dst;
+}
+
+
+/**
+ * @brief Fill a memory block with a constant byte, 16 bytes at a time (NEON)
+ *
+ * @param[out] mem the base address of the block
+ *
+ * @param[in] val the byte
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ */
+void* util::memset_neon(void *mem, u8 val, u32 sz)
+{
+	u8 *p = static_cast<u8*> (mem);
+	uint8x16_t v = vdupq_n_u8(val);
+
+	for (; likely(sz >= sizeof(uint8x16_t)); sz -= sizeof(uint8x16_t), p += sizeof(uint8x16_t)) {
+		vst1q_u8(p, v);
+	}
+
+	memset_scalar(p, val, sz);
+	return mem;
+}
+
+
+/**
+ * @brief Reverse the byte order of a memory block, 16 bytes at a time (NEON)
+ *
+ * @param[in,out] mem the base address of the block
+ *
+ * @param[in] sz the block size
+ *
+ * @returns the first argument
+ *
+ * @note
+ *	The bytes of each double word are reversed, then the double words are
+ *	swapped. The middle is reversed by the scalar kernel
+ */
+void* util::memswap_neon(void *mem, u32 sz)
+{
+	u8 *l = static_cast<u8*> (mem);
+	u8 *r = l + sz;
+
+	while ( likely(r - l >= static_cast<i64> (2 * sizeof(uint8x16_t))) ) {
+		r -= sizeof(uint8x16_t);
+		uint8x16_t vl = vrev64q_u8(vld1q_u8(l));
+		uint8x16_t vr = vrev64q_u8(vld1q_u8(r));
+
+		vst1q_u8(l, vcombine_u8(vget_high_u8(vr), vget_low_u8(vr)));
+		vst1q_u8(r, vcombine_u8(vget_high_u8(vl), vget_low_u8(vl)));
+		l += sizeof(uint8x16_t);
+	}
+
+	memswap_scalar(l, r - l);
+	return mem;
+}
+
+#endif
+
+
 /**
  * @brief Get the number of CLI arguments, related with libinstrument
  *
@@ -199,12 +833,10 @@ void util::init(i32 &argc, i8 **argv)
 			util::dbg_info("libinstrument runtime configuration:");
 		}
 
-		for (u32 i = 0, sz = s_config->size(); likely(i < sz); i++) {
-			const i8 *option =
-				s_config	->at(i)
-									->cstring();
+		for (chain<string>::cursor cur = s_config->first(); likely(cur.is_valid()); cur.next()) {
+			const i8 *option = cur.data()->cstring();
 
-			util::dbg_info("  arg %d: --instrument-(%s)", i, option);
+			util::dbg_info("  arg %d: --instrument-(%s)", cur.index(), option);
 		}
 #endif
 
@@ -291,6 +923,25 @@ void util::lock()
 }
 
 
+/**
+ * @brief Get the name of the selected memory kernels
+ *
+ * @returns scalar, sse2, avx2 or neon
+ *
+ * @see util::dispatch
+ */
+const i8* util::mem_kernel()
+{
+	const i8 *retval = load_acquire(&s_mem_kernel);
+	if ( unlikely(retval == NULL) ) {
+		dispatch();
+		retval = load_acquire(&s_mem_kernel);
+	}
+
+	return retval;
+}
+
+
 /**
  * @brief Compare two memory blocks
  *
@@ -307,6 +958,7 @@ void util::lock()
  * @throws instrument::exception
  *
  * @note This method is used for portability (in place of BSD's bcmp)
+ * @note The bytes are compared unsigned, as by memcmp(3)
  */
 i32 util::memcmp(const void *b1, const void *b2, u32 sz)
 {
@@ -316,17 +968,7 @@ i32 util::memcmp(const void *b1, const void *b2, u32 sz)
 		throw exception("invalid argument: b1 (=%p) and/or b2 (=%p)", b1, b2);
 	}
 
-	const u8 *p1 = static_cast<const u8*> (b1);
-	const u8 *p2 = static_cast<const u8*> (b2);
-	while ( likely(sz-- > 0) ) {
-		i8 diff = *(p1++) - *(p2++);
-
-		if ( likely(diff != 0) ) {
-			return diff;
-		}
-	}
-
-	return 0;
+	return load_relaxed(&s_memcmp)(b1, b2, sz);
 }
 
 
@@ -351,13 +993,7 @@ void* util::memcpy(void *dst, const void *src, u32 sz)
 		return dst;
 	}
 
-	u8 *d = static_cast<u8*> (dst);
-	const u8 *s = static_cast<const u8*> (src);
-	while ( likely(sz-- > 0) ) {
-		*(d++) = *(s++);
-	}
-
-	return dst;
+	return load_relaxed(&s_memcpy)(dst, src, sz);
 }
 
 
@@ -381,12 +1017,7 @@ void* util::memset(void *mem, u8 val, u32 sz)
 		return mem;
 	}
 
-	u8 *p = static_cast<u8*> (mem);
-	while ( likely(sz-- > 0) ) {
-		*(p++) = val;
-	}
-
-	return mem;
+	return load_relaxed(&s_memset)(mem, val, sz);
 }
 
 
@@ -400,6 +1031,7 @@ void* util::memset(void *mem, u8 val, u32 sz)
  * @returns the first argument
  *
  * @note Used to convert big endian data to little endian and vice versa
+ * @note The block is reversed by the kernel util::dispatch selected
  */
 void* util::memswap(void *mem, u32 sz)
 {
@@ -408,15 +1040,7 @@ void* util::memswap(void *mem, u32 sz)
 		return mem;
 	}
 
-	u8 *l = static_cast<u8*> (mem);
-	u8 *r = l + sz - 1;
-	while ( likely(l < r) ) {
-		u8 tmp = *l;
-		*(l++) = *r;
-		*(r--) = tmp;
-	}
-
-	return mem;
+	return load_relaxed(&s_memswap)(mem, sz);
 }
 
 
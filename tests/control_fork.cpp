@@ -0,0 +1,81 @@
+#include "../include/control.hpp"
+#include "../include/util.hpp"
+
+#include <sys/wait.h>
+
+/**
+	@file tests/control_fork.cpp
+
+	@brief Control block test, a forked child keeps the file of its parent
+
+	Run with INSTRUMENT_CONTROL=on. The child maps a file of its own (named
+	after its process ID) and removes only that file when it exits, the file of
+	the parent must still exist afterwards
+*/
+
+using namespace instrument;
+
+
+/**
+ * @brief Check if a file exists
+ *
+ * @param[in] path the file path
+ *
+ * @returns true if the file exists, false otherwise
+ */
+static bool exists(const i8 *path)
+{
+	struct stat st;
+	return stat(path, &st) == 0;
+}
+
+
+/**
+ * @brief Control block fork test
+ *
+ * @returns EXIT_SUCCESS, or EXIT_FAILURE if a check fails
+ */
+int main()
+{
+	/* A copy, the child releases the path of the parent */
+	i8 path[PATH_MAX];
+	if ( unlikely(control::path() == NULL || !exists(control::path())) ) {
+		std::cerr << "no control block file (INSTRUMENT_CONTROL=on expected)" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	snprintf(path, sizeof(path), "%s", control::path());
+
+	pid_t pid = fork();
+	if ( unlikely(pid < 0) ) {
+		std::cerr << "fork failed (" << strerror(errno) << ")" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if ( pid == 0 ) {
+		/* The library destructor removes the file of the child */
+		const i8 *own = control::path();
+		exit(own != NULL && strcmp(own, path) != 0 && exists(own) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	i32 status = 0;
+	if ( unlikely(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) ) {
+		std::cerr << "the child has no control block file of its own" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if ( unlikely(!exists(path)) ) {
+		std::cerr << "the child removed the control block file of the parent" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	i8 own[PATH_MAX];
+	snprintf(own, sizeof(own), g_control_path, pid);
+	if ( unlikely(exists(own)) ) {
+		std::cerr << "the child left its control block file behind" << std::endl;
+		unlink(own);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
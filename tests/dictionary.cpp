@@ -0,0 +1,45 @@
+#include "../include/dictionary.hpp"
+
+/**
+	@file tests/dictionary.cpp
+
+	@brief Dictionary test, the words added in bulk are looked up
+
+	The index is built by a first lookup, so the words added afterwards with
+	dictionary::add_range are found only if the index is rebuilt
+*/
+
+using namespace instrument;
+
+
+/**
+ * @brief Dictionary test
+ *
+ * @returns EXIT_SUCCESS, or EXIT_FAILURE if a check fails
+ */
+int main()
+{
+	dictionary dict("test");
+
+	string *words[] = {new string("alpha"), new string("beta")};
+	dict.add(words[0]);
+
+	if ( unlikely(dict.lookup(string("alpha")) != words[0]) ) {
+		std::cerr << "the added word was not found" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	dict.add_range(&words[1], 1, true);
+
+	if ( unlikely(dict.lookup(string("beta")) != words[1]) ) {
+		std::cerr << "the word added with add_range was not found" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if ( unlikely(dict.lookup(string("BETA"), true) != words[1]) ) {
+		std::cerr << "the word added with add_range was not found (case insensitive)" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,604 @@
+#include "../include/symtab.hpp"
+#include "../include/util.hpp"
+
+#include <algorithm>
+#include <elf.h>
+#include <getopt.h>
+#include <link.h>
+
+/**
+	@file tools/symbolize.cpp
+
+	@brief Offline batch symbolizer (instrument-symbolize)
+
+	Resolves the raw addresses of traces captured without symbols (e.g an
+	unresolved text trace, a decoded IDP stream or a flight recorder dump), off
+	the machine that produced them. The modules are described by a module map,
+	one module per line:
+
+	@code
+	<path> <build-id | -> <base address (hex)>
+	@endcode
+
+	Empty lines and lines starting with '#' are ignored. If a build-id is given,
+	the module file must carry the same GNU build-id note, otherwise the module is
+	skipped, so the addresses aren't resolved against another build. Each module
+	symbol table is loaded once (from the symbol index cache, if INSTRUMENT_CACHE
+	is set and the module was indexed) and is shared by all the inputs.
+
+	Each input file is symbolized by a worker thread. Every hexadecimal token
+	(0x...) is collected, the addresses are sorted and deduplicated, split by
+	module (the module with the greatest base address not above it) and each run
+	is resolved with a single batch lookup (symtab::lookup). The input is written
+	to <input>.sym (or to the output directory) with " (name+0xoffset)" appended
+	to each resolved address. Diagnostics are printed on the standard error
+*/
+
+using namespace instrument;
+
+
+/**
+ * @brief Output file suffix
+ */
+static const i8 * const g_suffix = ".sym";
+
+
+/**
+ * @brief Module of the module map
+ */
+struct module {
+	i8 *path;															/**< @brief Module file path */
+
+	i8 *build_id;													/**< @brief Expected build-id (NULL if unchecked) */
+
+	mem_addr_t base;											/**< @brief Load base address */
+
+	symtab *table;												/**< @brief Symbol table (NULL if not loaded) */
+};
+
+/**
+ * @brief Worker pool job
+ */
+struct pool_job {
+	u32 next;															/**< @brief Next task index (atomic) */
+
+	u32 count;														/**< @brief Task count */
+
+	void (*run)(u32, void*);							/**< @brief Task callback */
+
+	void *arg;														/**< @brief Task callback argument */
+};
+
+/**
+ * @brief Symbolization context (shared by the workers)
+ */
+struct context {
+	module *modules;											/**< @brief Modules (sorted by base address) */
+
+	u32 module_cnt;												/**< @brief Module count */
+
+	i8 **inputs;													/**< @brief Input file paths */
+
+	const i8 *out_dir;										/**< @brief Output directory (NULL to write next to the inputs) */
+
+	u32 failed;														/**< @brief Failed input count (atomic) */
+};
+
+
+/**
+ * @brief Compare two modules by base address
+ *
+ * @param[in] lval the left module
+ *
+ * @param[in] rval the right module
+ *
+ * @returns true if the left module is loaded below the right one
+ */
+static bool by_base(const module &lval, const module &rval)
+{
+	return lval.base < rval.base;
+}
+
+
+/**
+ * @brief Worker thread, run the pool tasks until none is left
+ *
+ * @param[in] arg the pool job
+ *
+ * @returns NULL
+ */
+static void* pool_worker(void *arg)
+{
+	pool_job *job = static_cast<pool_job*> (arg);
+
+	for (u32 i = fetch_add(&job->next, 1) - 1; likely(i < job->count); i = fetch_add(&job->next, 1) - 1) {
+		job->run(i, job->arg);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief Run a number of tasks on a worker pool
+ *
+ * @param[in] cnt the task count
+ *
+ * @param[in] workers the worker count
+ *
+ * @param[in] run the task callback (called with the task index)
+ *
+ * @param[in] arg the task callback argument
+ *
+ * @note If a worker can't be started, its tasks are run by the others (or by the caller)
+ */
+static void run_pool(u32 cnt, u32 workers, void (*run)(u32, void*), void *arg)
+{
+	pool_job job = {0, cnt, run, arg};
+	workers = std::min(workers, cnt);
+
+	pthread_t *tids = new pthread_t[workers];
+	u32 started = 0;
+	for (; likely(started < workers); started++) {
+		if ( unlikely(pthread_create(&tids[started], NULL, pool_worker, &job) != 0) ) {
+			break;
+		}
+	}
+
+	if ( unlikely(started == 0) ) {
+		pool_worker(&job);
+	}
+
+	for (u32 i = 0; likely(i < started); i++) {
+		pthread_join(tids[i], NULL);
+	}
+
+	delete[] tids;
+}
+
+
+/**
+ * @brief Read a whole file
+ *
+ * @param[in] path the file path
+ *
+ * @param[out] size the file size
+ *
+ * @returns the file contents (NUL terminated, to be deleted[] by the caller) or NULL on error
+ */
+static i8* read_file(const i8 *path, u32 &size)
+{
+	i32 fd = open(path, O_RDONLY | O_CLOEXEC);
+	if ( unlikely(fd < 0) ) {
+		return NULL;
+	}
+
+	struct stat st;
+	if ( unlikely(fstat(fd, &st) != 0) ) {
+		close(fd);
+		return NULL;
+	}
+
+	i8 *retval = new i8[st.st_size + 1];
+	size = 0;
+
+	while ( likely(size < static_cast<u32> (st.st_size)) ) {
+		ssize_t rd = read(fd, retval + size, st.st_size - size);
+		if ( unlikely(rd <= 0) ) {
+			if ( likely(rd < 0 && errno == EINTR) ) {
+				continue;
+			}
+
+			break;
+		}
+
+		size += rd;
+	}
+
+	close(fd);
+	retval[size] = '\0';
+	return retval;
+}
+
+
+/**
+ * @brief Read the GNU build-id note of an ELF file
+ *
+ * @param[in] path the file path
+ *
+ * @param[out] dst the build-id (hexadecimal)
+ *
+ * @returns true if the build-id was found, false otherwise
+ *
+ * @note Only the ELF class of the host is supported
+ */
+static bool read_build_id(const i8 *path, string &dst)
+{
+	i32 fd = open(path, O_RDONLY | O_CLOEXEC);
+	if ( unlikely(fd < 0) ) {
+		return false;
+	}
+
+	struct stat st;
+	void *img = MAP_FAILED;
+	if ( likely(fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t> (sizeof(ElfW(Ehdr)))) ) {
+		img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	close(fd);
+	if ( unlikely(img == MAP_FAILED) ) {
+		return false;
+	}
+
+	const u8 *base = static_cast<const u8*> (img);
+	const ElfW(Ehdr) *ehdr = static_cast<const ElfW(Ehdr)*> (img);
+	u64 sz = st.st_size;
+	bool retval = false;
+
+	if ( likely(memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 && ehdr->e_ident[EI_CLASS] == ((__ELF_NATIVE_CLASS == 64) ? ELFCLASS64 : ELFCLASS32)
+			&& ehdr->e_shoff + static_cast<u64> (ehdr->e_shnum) * sizeof(ElfW(Shdr)) <= sz) ) {
+		const ElfW(Shdr) *shdrs = reinterpret_cast<const ElfW(Shdr)*> (base + ehdr->e_shoff);
+
+		for (u32 i = 0; likely(i < ehdr->e_shnum && !retval); i++) {
+			if ( likely(shdrs[i].sh_type != SHT_NOTE || shdrs[i].sh_offset + shdrs[i].sh_size > sz) ) {
+				continue;
+			}
+
+			/* The note names and descriptors are padded to 4 bytes */
+			u64 off = shdrs[i].sh_offset, end = off + shdrs[i].sh_size;
+			while ( likely(off + sizeof(ElfW(Nhdr)) <= end) ) {
+				const ElfW(Nhdr) *note = reinterpret_cast<const ElfW(Nhdr)*> (base + off);
+				u64 name = off + sizeof(ElfW(Nhdr));
+				u64 desc = name + ((note->n_namesz + 3) & ~3U);
+				off = desc + ((note->n_descsz + 3) & ~3U);
+				if ( unlikely(off > end) ) {
+					break;
+				}
+
+				if ( unlikely(note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4
+						&& memcmp(base + name, "GNU", 4) == 0) ) {
+					dst.clear();
+					for (u32 j = 0; likely(j < note->n_descsz); j++) {
+						dst.append("%02x", base[desc + j]);
+					}
+
+					retval = true;
+					break;
+				}
+			}
+		}
+	}
+
+	munmap(img, sz);
+	return retval;
+}
+
+
+/**
+ * @brief Parse the module map
+ *
+ * @param[in] path the module map path
+ *
+ * @param[out] cnt the module count
+ *
+ * @returns the modules (to be deleted[] by the caller) or NULL on error
+ */
+static module* parse_map(const i8 *path, u32 &cnt)
+{
+	u32 sz = 0;
+	i8 *text = read_file(path, sz);
+	if ( unlikely(text == NULL) ) {
+		std::cerr << "failed to read the module map " << path << ": " << strerror(errno) << std::endl;
+		return NULL;
+	}
+
+	/* Each line holds a module at most */
+	u32 lines = 1;
+	for (u32 i = 0; likely(i < sz); i++) {
+		lines += (text[i] == '\n');
+	}
+
+	module *retval = new module[lines];
+	cnt = 0;
+
+	i8 *save = NULL;
+	u32 line = 0;
+	for (i8 *cur = strtok_r(text, "\n", &save); likely(cur != NULL); cur = strtok_r(NULL, "\n", &save)) {
+		line++;
+		while ( unlikely(*cur == ' ' || *cur == '\t') ) {
+			cur++;
+		}
+
+		if ( unlikely(*cur == '\0' || *cur == '#') ) {
+			continue;
+		}
+
+		i8 *field = NULL;
+		i8 *mpath = strtok_r(cur, " \t\r", &field);
+		i8 *id = strtok_r(NULL, " \t\r", &field);
+		i8 *base = strtok_r(NULL, " \t\r", &field);
+		i8 *tail = NULL;
+		mem_addr_t addr = (likely(base != NULL)) ? strtoull(base, &tail, 16) : 0;
+
+		if ( unlikely(base == NULL || *tail != '\0') ) {
+			std::cerr << path << ":" << line << ": expected <path> <build-id | -> <base>, line skipped" << std::endl;
+			continue;
+		}
+
+		module &mod = retval[cnt++];
+		mod.path = strdup(mpath);
+		mod.build_id = (likely(strcmp(id, "-") != 0)) ? strdup(id) : NULL;
+		mod.base = addr;
+		mod.table = NULL;
+	}
+
+	delete[] text;
+	std::sort(retval, retval + cnt, by_base);
+	return retval;
+}
+
+
+/**
+ * @brief Load a module symbol table (pool task)
+ *
+ * @param[in] i the module index
+ *
+ * @param[in] arg the symbolization context
+ */
+static void load_module(u32 i, void *arg)
+{
+	module &mod = static_cast<context*> (arg)->modules[i];
+
+	if ( likely(mod.build_id != NULL) ) {
+		string id;
+		if ( unlikely(!read_build_id(mod.path, id)) ) {
+			std::cerr << mod.path << ": no build-id found, module skipped" << std::endl;
+			return;
+		}
+
+		if ( unlikely(!id.equals(mod.build_id, true)) ) {
+			std::cerr << mod.path << ": build-id " << id.cstring() << " does not match " << mod.build_id << ", module skipped" << std::endl;
+			return;
+		}
+	}
+
+	try {
+		mod.table = new symtab(mod.path, mod.base);
+	}
+	catch (exception &x) {
+		std::cerr << x;
+		mod.table = NULL;
+	}
+}
+
+
+/**
+ * @brief Parse a hexadecimal address token
+ *
+ * @param[in] text the text
+ *
+ * @param[in] pos the token position (at "0x")
+ *
+ * @param[out] addr the address
+ *
+ * @returns the token end position, or pos if there's no address token at pos
+ */
+static u32 parse_token(const i8 *text, u32 pos, mem_addr_t &addr)
+{
+	if ( likely(text[pos] != '0' || (text[pos + 1] != 'x' && text[pos + 1] != 'X')) ) {
+		return pos;
+	}
+
+	if ( unlikely(pos > 0 && (isalnum(text[pos - 1]) || text[pos - 1] == '_')) ) {
+		return pos;
+	}
+
+	u32 end = pos + 2;
+	addr = 0;
+	while ( likely(isxdigit(text[end]) && end - pos < 2 + 2 * sizeof(mem_addr_t)) ) {
+		i8 c = text[end++];
+		addr = (addr << 4) | ((c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10);
+	}
+
+	/* Longer tokens (and identifiers) are not addresses */
+	if ( unlikely(end == pos + 2 || isalnum(text[end]) || text[end] == '_') ) {
+		return pos;
+	}
+
+	return end;
+}
+
+
+/**
+ * @brief Symbolize an input file (pool task)
+ *
+ * @param[in] i the input index
+ *
+ * @param[in] arg the symbolization context
+ */
+static void symbolize(u32 i, void *arg)
+{
+	context *ctx = static_cast<context*> (arg);
+	const i8 *path = ctx->inputs[i];
+
+	u32 sz = 0;
+	i8 *text = read_file(path, sz);
+	if ( unlikely(text == NULL) ) {
+		std::cerr << "failed to read " << path << ": " << strerror(errno) << std::endl;
+		fetch_add(&ctx->failed, 1);
+		return;
+	}
+
+	/* Collect, sort and deduplicate the addresses (a token is 3 characters at least) */
+	mem_addr_t *addrs = new mem_addr_t[sz / 3 + 1];
+	u32 cnt = 0;
+	for (u32 pos = 0; likely(pos < sz); pos++) {
+		u32 end = parse_token(text, pos, addrs[cnt]);
+		if ( unlikely(end != pos) ) {
+			cnt++;
+			pos = end - 1;
+		}
+	}
+
+	std::sort(addrs, addrs + cnt);
+	cnt = std::unique(addrs, addrs + cnt) - addrs;
+
+	/* The modules and the addresses are both sorted, each module resolves a run */
+	const symbol_t **syms = new const symbol_t*[cnt + 1];
+	const module **owners = new const module*[cnt + 1];
+	const i8 **names = new const i8*[cnt + 1];
+	u32 resolved = 0;
+
+	for (u32 first = 0, m = 0; likely(first < cnt); ) {
+		while ( likely(m < ctx->module_cnt && ctx->modules[m].base <= addrs[first]) ) {
+			m++;
+		}
+
+		u32 last = first + 1;
+		mem_addr_t limit = (likely(m < ctx->module_cnt)) ? ctx->modules[m].base : ~static_cast<mem_addr_t> (0);
+		while ( likely(last < cnt && addrs[last] < limit) ) {
+			last++;
+		}
+
+		module *mod = (likely(m > 0)) ? &ctx->modules[m - 1] : NULL;
+		if ( likely(mod != NULL && mod->table != NULL) ) {
+			resolved += mod->table->lookup(addrs + first, last - first, syms + first);
+
+			/* The names are demangled on first use, concurrent demangling is safe */
+			for (u32 j = first; likely(j < last); j++) {
+				names[j] = (likely(syms[j] != NULL)) ? mod->table->name(syms[j]) : NULL;
+				owners[j] = mod;
+			}
+		}
+		else {
+			for (u32 j = first; likely(j < last); j++) {
+				names[j] = NULL;
+			}
+		}
+
+		first = last;
+	}
+
+	/* Copy the input, appending the symbol of each resolved address */
+	string out(sz + sz / 2);
+	u32 copied = 0;
+	for (u32 pos = 0; likely(pos < sz); pos++) {
+		mem_addr_t addr = 0;
+		u32 end = parse_token(text, pos, addr);
+		if ( likely(end == pos) ) {
+			continue;
+		}
+
+		u32 j = std::lower_bound(addrs, addrs + cnt, addr) - addrs;
+		if ( likely(names[j] != NULL) ) {
+			out.concat(text + copied, end - copied);
+			out.append(" (%s+0x%llx)", names[j], static_cast<u64> (addr - owners[j]->table->addr(syms[j])));
+			copied = end;
+		}
+
+		pos = end - 1;
+	}
+
+	out.concat(text + copied, sz - copied);
+
+	string dst;
+	if ( unlikely(ctx->out_dir != NULL) ) {
+		const i8 *name = strrchr(path, '/');
+		dst.set("%s/%s%s", ctx->out_dir, (likely(name != NULL)) ? name + 1 : path, g_suffix);
+	}
+	else {
+		dst.set("%s%s", path, g_suffix);
+	}
+
+	FILE *fp = fopen(dst.cstring(), "w");
+	if ( unlikely(fp == NULL || fwrite(out.cstring(), 1, out.length(), fp) != out.length()) ) {
+		std::cerr << "failed to write " << dst.cstring() << ": " << strerror(errno) << std::endl;
+		fetch_add(&ctx->failed, 1);
+	}
+	else {
+		std::cerr << path << ": " << resolved << " of " << cnt << " addresses resolved" << std::endl;
+	}
+
+	if ( likely(fp != NULL) ) {
+		fclose(fp);
+	}
+
+	delete[] names;
+	delete[] owners;
+	delete[] syms;
+	delete[] addrs;
+	delete[] text;
+}
+
+
+/**
+ * @brief Print the usage on the standard error
+ *
+ * @param[in] prog the program name
+ */
+static void usage(const i8 *prog)
+{
+	std::cerr << "usage: " << prog << " -m <module map> [-o <output dir>] [-j <workers>] <file>..." << std::endl;
+}
+
+
+/**
+ * @brief Symbolize the input files
+ *
+ * @param[in] argc the argument count
+ *
+ * @param[in] argv the arguments
+ *
+ * @returns EXIT_SUCCESS, or EXIT_FAILURE if an input could not be symbolized
+ */
+int main(int argc, char *argv[])
+{
+	const i8 *map = NULL;
+	context ctx = {NULL, 0, NULL, NULL, 0};
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (i32 opt = getopt(argc, argv, "m:o:j:h"); likely(opt != -1); opt = getopt(argc, argv, "m:o:j:h")) {
+		switch (opt) {
+		case 'm':
+			map = optarg;
+			break;
+
+		case 'o':
+			ctx.out_dir = optarg;
+			break;
+
+		case 'j':
+			workers = strtol(optarg, NULL, 10);
+			break;
+
+		default:
+			usage(argv[0]);
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if ( unlikely(map == NULL || optind >= argc) ) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ctx.modules = parse_map(map, ctx.module_cnt);
+	if ( unlikely(ctx.modules == NULL) ) {
+		return EXIT_FAILURE;
+	}
+
+	u32 pool_sz = (likely(workers > 0)) ? workers : 1;
+	run_pool(ctx.module_cnt, pool_sz, load_module, &ctx);
+
+	ctx.inputs = argv + optind;
+	run_pool(argc - optind, pool_sz, symbolize, &ctx);
+
+	for (u32 i = 0; likely(i < ctx.module_cnt); i++) {
+		delete ctx.modules[i].table;
+		free(ctx.modules[i].build_id);
+		free(ctx.modules[i].path);
+	}
+
+	delete[] ctx.modules;
+	return (likely(ctx.failed == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}